@@ -10,6 +10,92 @@ public struct MachnetFlow_t
     public UInt16 dst_port;
 }
 
+[StructLayout(LayoutKind.Sequential)]
+public struct MachnetIovec_t
+{
+    public IntPtr base_;
+    public UIntPtr len;
+}
+
+[StructLayout(LayoutKind.Sequential)]
+public struct MachnetMsgHdr_t
+{
+    public UInt32 msg_size;
+    public MachnetFlow_t flow_info;
+    public IntPtr msg_iov;
+    public UIntPtr msg_iovlen;
+    public UInt16 flags;
+    public UInt32 cookie;
+}
+
+// A batch of up to `Capacity` messages of up to `SlotSize` bytes each, sent or
+// received with a single P/Invoke call (see MachnetShim.SendBatch() and
+// MachnetShim.RecvBatch()). The C descriptors and the message slots are
+// allocated once, on the pinned object heap, so that no garbage is created
+// per message: message `i` is read and written in place in Slot(i).
+public sealed class MachnetMsgBatch
+{
+    public readonly int Capacity;
+    public readonly int SlotSize;
+    internal readonly MachnetMsgHdr_t[] hdrs;
+    private readonly MachnetIovec_t[] iovs;
+    private readonly byte[] data;
+    // Whether the lengths of the slots were set for sending.
+    private bool sizedForSend = true;
+
+    public MachnetMsgBatch(int capacity = 32, int slotSize = 1024)
+    {
+        Capacity = capacity;
+        SlotSize = slotSize;
+        hdrs = GC.AllocateArray<MachnetMsgHdr_t>(capacity, pinned: true);
+        iovs = GC.AllocateArray<MachnetIovec_t>(capacity, pinned: true);
+        data = GC.AllocateArray<byte>(capacity * slotSize, pinned: true);
+        for (int i = 0; i < capacity; i++)
+        {
+            iovs[i].base_ = Marshal.UnsafeAddrOfPinnedArrayElement(data, i * slotSize);
+            hdrs[i].msg_iov = Marshal.UnsafeAddrOfPinnedArrayElement(iovs, i);
+            hdrs[i].msg_iovlen = (UIntPtr)1;
+        }
+    }
+
+    // The memory of message `i` (a view, not a copy).
+    public Span<byte> Slot(int i) => new Span<byte>(data, i * SlotSize, SlotSize);
+
+    // The size of message `i` in bytes (0 if it was received, but did not fit
+    // in its slot).
+    public int MsgSize(int i) => (int)hdrs[i].msg_size;
+
+    public MachnetFlow_t Flow(int i) => hdrs[i].flow_info;
+
+    // Set message `i` to the first `len` bytes of its slot, sent on `flow`.
+    public void SetMsg(int i, MachnetFlow_t flow, int len)
+    {
+        hdrs[i].msg_size = (UInt32)len;
+        hdrs[i].flow_info = flow;
+        hdrs[i].flags = 0;
+        iovs[i].len = (UIntPtr)len;
+        sizedForSend = true;
+    }
+
+    // Turn received message `i` into a reply to its sender, of `len` bytes
+    // (default: the size of the message), without copying it.
+    public void SetReply(int i, int len = -1)
+    {
+        MachnetFlow_t flow = hdrs[i].flow_info;
+        (flow.src_ip, flow.dst_ip) = (flow.dst_ip, flow.src_ip);
+        (flow.src_port, flow.dst_port) = (flow.dst_port, flow.src_port);
+        SetMsg(i, flow, len < 0 ? MsgSize(i) : len);
+    }
+
+    // Receiving: each message may take its whole slot.
+    internal void SizeForRecv()
+    {
+        if (!sizedForSend) return;
+        for (int i = 0; i < Capacity; i++) iovs[i].len = (UIntPtr)SlotSize;
+        sizedForSend = false;
+    }
+}
+
 public static class MachnetShim
 {
     private const string libmachnet_shim_location = "libmachnet_shim.so";
@@ -31,4 +117,27 @@ public static class MachnetShim
 
     [DllImport(libmachnet_shim_location, CallingConvention = CallingConvention.Cdecl)]
     public static extern int machnet_recv(IntPtr channel_ctx, byte[] data, IntPtr dataSize, ref MachnetFlow_t flow);
+
+    [DllImport(libmachnet_shim_location, CallingConvention = CallingConvention.Cdecl)]
+    public static extern int machnet_sendmmsg(IntPtr channel_ctx, [In] MachnetMsgHdr_t[] msghdr_iovec, int vlen);
+
+    [DllImport(libmachnet_shim_location, CallingConvention = CallingConvention.Cdecl)]
+    public static extern int machnet_recvmmsg(IntPtr channel_ctx, [In, Out] MachnetMsgHdr_t[] msgvec, int vlen);
+
+    // Send the first `n` messages of `batch` (all of them if negative) with a
+    // single P/Invoke call. Returns the number of (leading) messages sent; the
+    // others are to be retried.
+    public static int SendBatch(IntPtr channel_ctx, MachnetMsgBatch batch, int n = -1)
+    {
+        return machnet_sendmmsg(channel_ctx, batch.hdrs, n < 0 ? batch.Capacity : n);
+    }
+
+    // Receive up to `n` pending messages (the capacity of `batch` if negative)
+    // into `batch` with a single P/Invoke call. Returns the number of messages
+    // received.
+    public static int RecvBatch(IntPtr channel_ctx, MachnetMsgBatch batch, int n = -1)
+    {
+        batch.SizeForRecv();
+        return machnet_recvmmsg(channel_ctx, batch.hdrs, n < 0 ? batch.Capacity : n);
+    }
 }
@@ -20,8 +20,9 @@ int __machnet_sendmsg_go(const MachnetChannelCtx_t* ctx, MachnetIovec_t msg_iov,
 
   msghdr.msg_iov = &msg_iov;
   msghdr.msg_iovlen = msg_iovlen;
+  msghdr.flags = 0;
 
-  return __machnet_sendmsg(ctx, &msghdr);
+  return machnet_sendmsg(ctx, &msghdr);
 }
 
 MachnetFlow_t __machnet_recvmsg_go(const MachnetChannelCtx_t* ctx,
@@ -29,7 +30,7 @@ MachnetFlow_t __machnet_recvmsg_go(const MachnetChannelCtx_t* ctx,
   MachnetMsgHdr_t msghdr;  // NOLINT
   msghdr.msg_iov = &msg_iov;
   msghdr.msg_iovlen = msg_iovlen;
-  int ret = __machnet_recvmsg(ctx, &msghdr);
+  int ret = machnet_recvmsg(ctx, &msghdr);
 
   if (ret > 0) {
     return msghdr.flow_info;
@@ -43,6 +44,87 @@ MachnetFlow_t __machnet_recvmsg_go(const MachnetChannelCtx_t* ctx,
   }
 }
 
+// Maximum number of messages sent or received by one call of the batched
+// helpers below (their descriptors are on the stack).
+#define MACHNET_GO_BATCH_MAX 64
+
+// Send up to `vlen' messages in a single call: message `i' is the `lens[i]'
+// bytes at `buf + i * stride', sent on `flows[i]'. The Go side passes its
+// slices as they are, so that a batch costs a single cgo crossing.
+int __machnet_sendmmsg_go(const MachnetChannelCtx_t* ctx,
+                          const MachnetFlow_t* flows, uint8_t* buf,
+                          size_t stride, const uint32_t* lens, int vlen) {
+  MachnetIovec_t iov[MACHNET_GO_BATCH_MAX];
+  MachnetMsgHdr_t msghdr[MACHNET_GO_BATCH_MAX];  // NOLINT
+  if (vlen > MACHNET_GO_BATCH_MAX) vlen = MACHNET_GO_BATCH_MAX;
+  for (int i = 0; i < vlen; i++) {
+    iov[i].base = buf + i * stride;
+    iov[i].len = lens[i];
+    msghdr[i].msg_size = lens[i];
+    msghdr[i].flow_info = flows[i];
+    msghdr[i].msg_iov = &iov[i];
+    msghdr[i].msg_iovlen = 1;
+    msghdr[i].flags = 0;
+  }
+  return machnet_sendmmsg(ctx, msghdr, vlen);
+}
+
+// Receive up to `vlen' messages in a single call, message `i' into the
+// `stride' bytes at `buf + i * stride'. Its size is set in `lens[i]' (0 if it
+// did not fit, and was dropped), and its flow in `flows[i]'.
+// Returns the number of messages received.
+int __machnet_recvmmsg_go(const MachnetChannelCtx_t* ctx, MachnetFlow_t* flows,
+                          uint8_t* buf, size_t stride, uint32_t* lens,
+                          int vlen) {
+  MachnetIovec_t iov[MACHNET_GO_BATCH_MAX];
+  MachnetMsgHdr_t msghdr[MACHNET_GO_BATCH_MAX];  // NOLINT
+  if (vlen > MACHNET_GO_BATCH_MAX) vlen = MACHNET_GO_BATCH_MAX;
+  for (int i = 0; i < vlen; i++) {
+    iov[i].base = buf + i * stride;
+    iov[i].len = stride;
+    msghdr[i].msg_iov = &iov[i];
+    msghdr[i].msg_iovlen = 1;
+  }
+  int ret = machnet_recvmmsg(ctx, msghdr, vlen);
+  for (int i = 0; i < ret; i++) {
+    lens[i] = msghdr[i].msg_size;
+    flows[i] = msghdr[i].flow_info;
+  }
+  return ret;
+}
+
+// A message received without copying, left in the channel's buffers.
+typedef struct {
+  const MachnetMsgBuf_t* msg;  // The first buffer of the message.
+  MachnetFlow_t flow;
+  void* data;        // The data of the first buffer...
+  uint32_t len;      // ...and its length.
+  uint32_t msg_len;  // The total length of the message.
+  int chained;       // Whether the message spans more than one buffer.
+} MachnetZeroCopyMsg_go_t;
+
+// Receive up to `vlen' messages without copying them. The messages are
+// borrowed until they are returned with `__machnet_msg_release_go()'.
+// Returns the number of messages received.
+int __machnet_recv_zc_go(const MachnetChannelCtx_t* ctx,
+                         MachnetZeroCopyMsg_go_t* msgs, int vlen) {
+  int n = 0;
+  while (n < vlen && machnet_recv_zc(ctx, &msgs[n].msg, &msgs[n].flow) == 1) {
+    msgs[n].data = machnet_msgbuf_data(msgs[n].msg);
+    msgs[n].len = machnet_msgbuf_len(msgs[n].msg);
+    msgs[n].msg_len = msgs[n].msg->msg_len;
+    msgs[n].chained = machnet_msgbuf_next(ctx, msgs[n].msg) != NULL;
+    n++;
+  }
+  return n;
+}
+
+// Return `n' messages received with `__machnet_recv_zc_go()' to the channel.
+void __machnet_msg_release_go(const MachnetChannelCtx_t* ctx,
+                              const MachnetZeroCopyMsg_go_t* msgs, int n) {
+  for (int i = 0; i < n; i++) machnet_msg_release(ctx, msgs[i].msg);
+}
+
 int __machnet_connect_go(MachnetChannelCtx_t* ctx, uint32_t local_ip,
                          uint32_t remote_ip, uint16_t remote_port,
                          MachnetFlow_t* flow) {
@@ -68,6 +68,57 @@ func Attach() *MachnetChannelCtx {
 	return (*MachnetChannelCtx)(c_ctx)
 }
 
+// Flags for AttachWithHints.
+const (
+	// The application sends from a single goroutine (locked to its thread),
+	// and receives from a single one.
+	AttachSPSC uint32 = C.MACHNET_ATTACH_F_SPSC
+)
+
+// Attach to the MACHNET shim, with hints on the size of the channel (0 for
+// the defaults), and options (Attach* flags).
+// Returns a pointer to the channel context.
+func AttachWithHints(desc_ring_size uint32, buffer_count uint32, flags uint32) *MachnetChannelCtx {
+	var c_ctx *C.MachnetChannelCtx_t = (*C.MachnetChannelCtx_t)(C.machnet_attach_with_hints(C.uint32_t(desc_ring_size), C.uint32_t(buffer_count), C.uint32_t(flags)))
+	return (*MachnetChannelCtx)(c_ctx)
+}
+
+// Placement policies for AttachWithPlacement.
+const (
+	// The engine serving the fewest channels.
+	PlacementLeastLoaded uint32 = C.MACHNET_PLACEMENT_LEAST_LOADED
+	// The least loaded engine on a NUMA node (-1 for the caller's).
+	PlacementNumaLocal uint32 = C.MACHNET_PLACEMENT_NUMA_LOCAL
+	// An explicitly requested engine.
+	PlacementEngine uint32 = C.MACHNET_PLACEMENT_ENGINE
+)
+
+// The engine a channel is served by, the NUMA node and CPUs it runs on.
+type MachnetPlacement struct {
+	EngineId uint32
+	NumaNode int32
+	CpuMask  uint64
+}
+
+// Attach to the MACHNET shim, like AttachWithHints, and place the channel on
+// an engine with the given policy (Placement*). The hint is the engine for
+// PlacementEngine, and the NUMA node for PlacementNumaLocal.
+func AttachWithPlacement(desc_ring_size uint32, buffer_count uint32, flags uint32, policy uint32, hint int32) *MachnetChannelCtx {
+	var c_ctx *C.MachnetChannelCtx_t = (*C.MachnetChannelCtx_t)(C.machnet_attach_with_placement(C.uint32_t(desc_ring_size), C.uint32_t(buffer_count), C.uint32_t(flags), C.uint32_t(policy), C.int32_t(hint)))
+	return (*MachnetChannelCtx)(c_ctx)
+}
+
+// Get the placement of the channel.
+func GetPlacement(ctx *MachnetChannelCtx) (int, MachnetPlacement) {
+	var c_placement C.MachnetChannelPlacement_t
+	ret := C.machnet_get_placement(unsafe.Pointer(ctx), &c_placement)
+	return (int)(ret), MachnetPlacement{
+		EngineId: uint32(c_placement.engine_id),
+		NumaNode: int32(c_placement.numa_node),
+		CpuMask:  uint64(c_placement.cpu_mask),
+	}
+}
+
 // Connect to the remote host and port.
 func Connect(ctx *MachnetChannelCtx, local_ip string, remote_ip string, remote_port uint) (int, MachnetFlow) {
 	// Initialize the flow
@@ -112,3 +163,128 @@ func RecvMsg(ctx *MachnetChannelCtx, base *uint8, iov_len uint) (int, MachnetFlo
 		return 0, convert_net_flow_go(&flow)
 	}
 }
+
+// Maximum number of messages sent or received by one call of SendMsgs,
+// RecvMsgs or ZeroCopyMsgs.Recv.
+const MaxBatch = C.MACHNET_GO_BATCH_MAX
+
+// The number of messages of a batch with n and m descriptors (e.g., flows and
+// lengths): the smaller, and at most MaxBatch.
+func batch_len(n int, m int) int {
+	if m < n {
+		n = m
+	}
+	if n > MaxBatch {
+		n = MaxBatch
+	}
+	return n
+}
+
+// The flows of a batch are passed to C as they are (MachnetFlow has the
+// layout of C.MachnetFlow_t).
+func flows_c(flows []MachnetFlow) *C.MachnetFlow_t {
+	return (*C.MachnetFlow_t)(unsafe.Pointer(&flows[0]))
+}
+
+// Send a batch of messages, with a single cgo call: message i is the first
+// lens[i] bytes of buf[i*stride:], sent on flows[i].
+// Returns the number of (leading) messages sent, at most MaxBatch.
+func SendMsgs(ctx *MachnetChannelCtx, flows []MachnetFlow, buf []uint8, stride uint, lens []uint32) int {
+	n := batch_len(len(flows), len(lens))
+	if n == 0 {
+		return 0
+	}
+	ret := C.__machnet_sendmmsg_go((*C.MachnetChannelCtx_t)(ctx), flows_c(flows),
+		(*C.uint8_t)(unsafe.Pointer(&buf[0])), C.size_t(stride),
+		(*C.uint32_t)(unsafe.Pointer(&lens[0])), C.int(n))
+	return (int)(ret)
+}
+
+// Receive a batch of pending messages, with a single cgo call: message i is
+// copied to buf[i*stride:], its size set in lens[i] (0 if it was larger than
+// stride, and dropped), and its flow in flows[i].
+// Returns the number of messages received, at most MaxBatch.
+func RecvMsgs(ctx *MachnetChannelCtx, buf []uint8, stride uint, lens []uint32, flows []MachnetFlow) int {
+	n := batch_len(len(flows), len(lens))
+	if stride == 0 {
+		return 0
+	}
+	if slots := int(uint(len(buf)) / stride); slots < n {
+		n = slots
+	}
+	if n == 0 {
+		return 0
+	}
+	ret := C.__machnet_recvmmsg_go((*C.MachnetChannelCtx_t)(ctx), flows_c(flows),
+		(*C.uint8_t)(unsafe.Pointer(&buf[0])), C.size_t(stride),
+		(*C.uint32_t)(unsafe.Pointer(&lens[0])), C.int(n))
+	return (int)(ret)
+}
+
+// A batch of messages received without copying: their data are slices of the
+// channel's (pinned, shared) memory, valid until the batch is released.
+type ZeroCopyMsgs struct {
+	ctx  *MachnetChannelCtx
+	msgs []C.MachnetZeroCopyMsg_go_t
+	n    int
+}
+
+// Create a batch of up to `batch' zero-copy messages (at most MaxBatch).
+func NewZeroCopyMsgs(ctx *MachnetChannelCtx, batch int) *ZeroCopyMsgs {
+	n := batch_len(batch, MaxBatch)
+	if n < 1 {
+		n = 1
+	}
+	return &ZeroCopyMsgs{ctx: ctx, msgs: make([]C.MachnetZeroCopyMsg_go_t, n)}
+}
+
+// Receive a batch of pending messages, with a single cgo call, after
+// releasing the previous batch.
+// Returns the number of messages received.
+func (z *ZeroCopyMsgs) Recv() int {
+	z.Release()
+	ret := C.__machnet_recv_zc_go((*C.MachnetChannelCtx_t)(z.ctx), &z.msgs[0], C.int(len(z.msgs)))
+	z.n = (int)(ret)
+	return z.n
+}
+
+// Return the messages of the batch to the channel. Their slices must not be
+// used anymore; holding on to many messages drains the channel's buffers.
+func (z *ZeroCopyMsgs) Release() {
+	if z.n == 0 {
+		return
+	}
+	C.__machnet_msg_release_go((*C.MachnetChannelCtx_t)(z.ctx), &z.msgs[0], C.int(z.n))
+	z.n = 0
+}
+
+// The number of messages in the batch.
+func (z *ZeroCopyMsgs) Len() int { return z.n }
+
+// The flow message i was received on.
+func (z *ZeroCopyMsgs) Flow(i int) MachnetFlow { return convert_net_flow_go(&z.msgs[i].flow) }
+
+// The total size of message i in bytes.
+func (z *ZeroCopyMsgs) Size(i int) uint { return uint(z.msgs[i].msg_len) }
+
+// The data of message i, if it fits in a single buffer (see Chained);
+// otherwise, its first buffer only.
+func (z *ZeroCopyMsgs) Data(i int) []byte {
+	return unsafe.Slice((*byte)(z.msgs[i].data), z.msgs[i].len)
+}
+
+// Whether message i spans more than one buffer (see Segments).
+func (z *ZeroCopyMsgs) Chained(i int) bool { return z.msgs[i].chained != 0 }
+
+// Append the data of all the buffers of message i to segs.
+func (z *ZeroCopyMsgs) Segments(i int, segs [][]byte) [][]byte {
+	segs = append(segs, z.Data(i))
+	if !z.Chained(i) {
+		return segs
+	}
+	ctx := unsafe.Pointer(z.ctx)
+	for buf := C.machnet_msgbuf_next(ctx, z.msgs[i].msg); buf != nil; buf = C.machnet_msgbuf_next(ctx, buf) {
+		segs = append(segs, unsafe.Slice((*byte)(C.machnet_msgbuf_data(buf)), C.machnet_msgbuf_len(buf)))
+	}
+	return segs
+}
@@ -25,6 +25,8 @@ var msg_nr uint64 = math.MaxUint64
 var active_generator bool = false
 var verify bool = false
 var latency bool = false
+var batch int = 1
+var zerocopy bool = false
 
 type stats struct {
 	tx_success   uint64
@@ -40,6 +42,15 @@ type task_ctx struct {
 	flow     machnet.MachnetFlow
 	msg_data []uint8
 	rx_msg   []uint8
+
+	// Batches of messages, when `batch` > 1.
+	tx_flows []machnet.MachnetFlow
+	tx_buf   []uint8
+	tx_lens  []uint32
+	rx_flows []machnet.MachnetFlow
+	rx_buf   []uint8
+	rx_lens  []uint32
+	zc_msgs  *machnet.ZeroCopyMsgs
 }
 
 // TODO: Currently, allows for exactly `msg_size` bytes of data.
@@ -57,6 +68,21 @@ func new_task_ctx(ctx *machnet.MachnetChannelCtx, flow machnet.MachnetFlow) *tas
 		task.msg_data[i] = 0
 	}
 
+	task.tx_flows = make([]machnet.MachnetFlow, batch)
+	task.tx_buf = make([]uint8, batch*msg_size)
+	task.tx_lens = make([]uint32, batch)
+	task.rx_flows = make([]machnet.MachnetFlow, batch)
+	task.rx_buf = make([]uint8, batch*msg_size)
+	task.rx_lens = make([]uint32, batch)
+	for i := 0; i < batch; i++ {
+		task.tx_flows[i] = flow
+		copy(task.tx_buf[i*msg_size:], task.msg_data)
+		task.tx_lens[i] = uint32(msg_size)
+	}
+	if zerocopy {
+		task.zc_msgs = machnet.NewZeroCopyMsgs(ctx, batch)
+	}
+
 	return task
 }
 
@@ -84,7 +110,16 @@ func init_flags() {
 	flag.BoolVar(&active_generator, "active_generator", active_generator, "When 'true' this host is generating the traffic, otherwise it is bouncing.")
 	flag.BoolVar(&verify, "verify", verify, "When 'true' verify the payload of received messages.")
 	flag.BoolVar(&latency, "latency", latency, "When 'true' measure the latency of the messages.")
+	flag.IntVar(&batch, "batch", batch, "Send and receive up to this many messages per call (one cgo call per batch).")
+	flag.BoolVar(&zerocopy, "zerocopy", zerocopy, "When 'true' receive messages in place, in the channel's memory (with -batch).")
 	flag.Parse()
+
+	if batch < 1 || batch > machnet.MaxBatch {
+		glog.Fatalf("-batch must be between 1 and %d.", machnet.MaxBatch)
+	}
+	if zerocopy && batch == 1 {
+		glog.Fatal("-zerocopy requires -batch.")
+	}
 }
 
 // Function to report the stats.
@@ -157,6 +192,68 @@ func tx(task *task_ctx, stats *stats) {
 	}
 }
 
+// Verify if a received message is the same as the sent message.
+func verify_msg(data []uint8, msg_data []uint8) {
+	for i := range data {
+		if data[i] != msg_data[i] {
+			glog.Fatalf("Received message does not match the sent message: %d %d %d", i, data[i], msg_data[i])
+		}
+	}
+}
+
+// Like tx, with a single call for up to `batch` messages.
+func tx_batch(task *task_ctx, stats *stats) {
+	// Return if we have already sent the required number of messages.
+	if msg_nr <= stats.tx_success {
+		return
+	}
+
+	n := uint64(batch)
+	if n > msg_nr-stats.tx_success {
+		n = msg_nr - stats.tx_success
+	}
+	// Don't send more than msg_window messages at a time.
+	if inflight := stats.tx_success - stats.rx_count; inflight >= msg_window {
+		return
+	} else if n > msg_window-inflight {
+		n = msg_window - inflight
+	}
+	if n == 0 {
+		return
+	}
+
+	sent := uint64(machnet.SendMsgs(task.ctx, task.tx_flows[:n], task.tx_buf, uint(msg_size), task.tx_lens[:n]))
+	stats.tx_success += sent
+	stats.tx_bytes += sent * uint64(msg_size)
+	stats.err_tx_drops += n - sent
+}
+
+// Like rx, with a single call for up to `batch` messages.
+func rx_batch(task *task_ctx, stats *stats) {
+	if zerocopy {
+		z := task.zc_msgs
+		n := z.Recv()
+		for i := 0; i < n; i++ {
+			if verify {
+				verify_msg(z.Data(i), task.msg_data)
+			}
+			stats.rx_count += 1
+			stats.rx_bytes += uint64(z.Size(i))
+		}
+		z.Release()
+		return
+	}
+
+	n := machnet.RecvMsgs(task.ctx, task.rx_buf, uint(msg_size), task.rx_lens, task.rx_flows)
+	for i := 0; i < n; i++ {
+		if verify {
+			verify_msg(task.rx_buf[i*msg_size:i*msg_size+int(task.rx_lens[i])], task.msg_data)
+		}
+		stats.rx_count += 1
+		stats.rx_bytes += uint64(task.rx_lens[i])
+	}
+}
+
 func rx(task *task_ctx, stats *stats) {
 	channel_ctx := task.ctx
 
@@ -248,6 +345,47 @@ func bounce(task *task_ctx, stats *stats) {
 	}
 }
 
+// Like bounce, with a single call for up to `batch` messages each way.
+func bounce_batch(task *task_ctx, stats *stats) {
+	var n int
+	if zerocopy {
+		// The messages are copied once, from the channel to the TX batch.
+		z := task.zc_msgs
+		n = z.Recv()
+		for i := 0; i < n; i++ {
+			task.rx_flows[i] = z.Flow(i)
+			task.tx_lens[i] = uint32(copy(task.tx_buf[i*msg_size:(i+1)*msg_size], z.Data(i)))
+		}
+		z.Release()
+	} else {
+		n = machnet.RecvMsgs(task.ctx, task.tx_buf, uint(msg_size), task.tx_lens, task.rx_flows)
+	}
+	if n == 0 {
+		return
+	}
+
+	for i := 0; i < n; i++ {
+		stats.rx_count += 1
+		stats.rx_bytes += uint64(task.tx_lens[i])
+
+		// Swap the source and destination IP addresses.
+		flow_info := task.rx_flows[i]
+		task.tx_flows[i] = machnet.MachnetFlow{
+			SrcIp:   flow_info.DstIp,
+			DstIp:   flow_info.SrcIp,
+			SrcPort: flow_info.DstPort,
+			DstPort: flow_info.SrcPort,
+		}
+	}
+
+	sent := machnet.SendMsgs(task.ctx, task.tx_flows[:n], task.tx_buf, uint(msg_size), task.tx_lens[:n])
+	for i := 0; i < sent; i++ {
+		stats.tx_success += 1
+		stats.tx_bytes += uint64(task.tx_lens[i])
+	}
+	stats.err_tx_drops += uint64(n - sent)
+}
+
 func run_worker(task *task_ctx, active_generator bool, tick *time.Ticker, stats_chan chan<- stats) {
 	task_stats := new_stats()
 	count_histogram := hdrhistogram.New(1, 1000000, 3)
@@ -255,6 +393,9 @@ func run_worker(task *task_ctx, active_generator bool, tick *time.Ticker, stats_
 		for {
 			if latency {
 				ping(task, task_stats, count_histogram)
+			} else if batch > 1 {
+				tx_batch(task, task_stats)
+				rx_batch(task, task_stats)
 			} else {
 				tx(task, task_stats)
 				rx(task, task_stats)
@@ -274,7 +415,11 @@ func run_worker(task *task_ctx, active_generator bool, tick *time.Ticker, stats_
 		}
 	} else {
 		for {
-			bounce(task, task_stats)
+			if batch > 1 {
+				bounce_batch(task, task_stats)
+			} else {
+				bounce(task, task_stats)
+			}
 
 			// Report the stats every second.
 			select {
@@ -1,12 +1,21 @@
 const ref = require('ref-napi');
 const commander = require('commander');
 const chalk = require('chalk');
-const {machnet_shim, MachnetFlow_t} = require('./machnet_shim');
+const {
+  machnet_shim,
+  MachnetFlow_t,
+  MachnetMsgBatch,
+  machnet_send_batch,
+  machnet_recv_batch
+} = require('./machnet_shim');
 
 const kHelloWorldPort = 888;
 commander.option('-l, --local_ip <ip>', 'Local IP address')
     .option('-r, --remote_ip <ip>', 'Remote IP address')
     .option('-c, --is_client', 'Run as client')
+    .option(
+        '-b, --batch <n>',
+        'Server: receive and reply to up to n messages per call', '1')
     .parse(process.argv);
 
 const options = commander.opts();
@@ -112,6 +121,22 @@ if (options.is_client) {
   const rx_flow = new MachnetFlow_t();
   const replyMsg = `yes`;
   const replyBuffer = Buffer.from(replyMsg, 'utf8');
+  const batchSize = parseInt(options.batch);
+
+  if (batchSize > 1) {
+    // One FFI call per batch each way, and no allocation per message: the
+    // replies are all the same, so they are set up once.
+    const rx_batch = new MachnetMsgBatch(batchSize, 1024);
+    const tx_batch = new MachnetMsgBatch(batchSize, replyBuffer.length);
+    for (let i = 0; i < batchSize; i++) {
+      replyBuffer.copy(tx_batch.slot(i));
+      tx_batch.setMsg(i, tx_flow, replyBuffer.length);
+    }
+    while (true) {
+      const n = machnet_recv_batch(channel_ctx, rx_batch);
+      if (n > 0) machnet_send_batch(channel_ctx, tx_batch, n);
+    }
+  }
 
   while (true) {
     const bytesRead =
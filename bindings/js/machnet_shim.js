@@ -16,6 +16,20 @@ const charPtr = ref.refType(ref.types.char);
 const uint16 = ref.types.uint16;
 const MachnetFlowPtr = ref.refType(MachnetFlow_t);
 
+const MachnetIovec_t = Struct({
+  base: voidPtr,
+  len: size_t
+});
+
+const MachnetMsgHdr_t = Struct({
+  msg_size: 'uint32',
+  flow_info: MachnetFlow_t,
+  msg_iov: ref.refType(MachnetIovec_t),
+  msg_iovlen: size_t,
+  flags: uint16,
+  cookie: 'uint32'
+});
+
 var dir = __dirname;
 const libmachnet_shim_location = dir + '/libmachnet_shim.so';
 
@@ -26,10 +40,129 @@ var machnet_shim = ffi.Library(libmachnet_shim_location, {
   'machnet_listen': ['int', [voidPtr, charPtr, uint16]],
   'machnet_connect': ['int', [voidPtr, charPtr, charPtr, uint16, MachnetFlowPtr]],
   'machnet_send': ['int', [voidPtr, MachnetFlow_t, voidPtr, size_t]],
-  'machnet_recv': ['int', [voidPtr, voidPtr, size_t, MachnetFlowPtr]]
+  'machnet_recv': ['int', [voidPtr, voidPtr, size_t, MachnetFlowPtr]],
+  'machnet_sendmmsg': ['int', [voidPtr, voidPtr, 'int']],
+  'machnet_recvmmsg': ['int', [voidPtr, voidPtr, 'int']]
 });
 
+// Offsets in the C descriptors (MachnetMsgHdr_t and MachnetIovec_t).
+const kHdrSize = MachnetMsgHdr_t.size;
+const kHdrMsgSize = MachnetMsgHdr_t.fields.msg_size.offset;
+const kHdrFlow = MachnetMsgHdr_t.fields.flow_info.offset;
+const kHdrIov = MachnetMsgHdr_t.fields.msg_iov.offset;
+const kHdrIovLen = MachnetMsgHdr_t.fields.msg_iovlen.offset;
+const kIovSize = MachnetIovec_t.size;
+const kIovBase = MachnetIovec_t.fields.base.offset;
+const kIovLen = MachnetIovec_t.fields.len.offset;
+const kFlowSrcIp = MachnetFlow_t.fields.src_ip.offset;
+const kFlowDstIp = MachnetFlow_t.fields.dst_ip.offset;
+const kFlowSrcPort = MachnetFlow_t.fields.src_port.offset;
+const kFlowDstPort = MachnetFlow_t.fields.dst_port.offset;
+
+// A batch of up to `capacity' messages of up to `slotSize' bytes each, sent or
+// received with a single FFI call (see machnet_send_batch() and
+// machnet_recv_batch()). The C descriptors and the message slots are
+// allocated once, so that no garbage is created per message: the message `i'
+// is read and written in place in `slot(i)'.
+class MachnetMsgBatch {
+  constructor(capacity = 32, slotSize = 1024) {
+    this.capacity = capacity;
+    this.slotSize = slotSize;
+    this.hdrs = Buffer.alloc(capacity * kHdrSize);
+    this.iovs = Buffer.alloc(capacity * kIovSize);
+    this.data = Buffer.alloc(capacity * slotSize);
+    this.slots_ = [];
+    for (let i = 0; i < capacity; i++) {
+      const slot = this.data.subarray(i * slotSize, (i + 1) * slotSize);
+      const iov = this.iovs.subarray(i * kIovSize, (i + 1) * kIovSize);
+      this.slots_.push(slot);
+      ref.writePointer(iov, kIovBase, slot);
+      ref.writePointer(this.hdrs, i * kHdrSize + kHdrIov, iov);
+      size_t.set(this.hdrs, i * kHdrSize + kHdrIovLen, 1);
+    }
+    // Whether the lengths of the slots were set for sending.
+    this.sizedForSend_ = true;
+  }
+
+  // The memory of message `i' (a view, not a copy).
+  slot(i) {
+    return this.slots_[i];
+  }
+
+  // Set message `i' to the first `len' bytes of its slot, sent on `flow' (a
+  // MachnetFlow_t, or any object with the same fields).
+  setMsg(i, flow, len) {
+    const hdr = i * kHdrSize;
+    this.hdrs.writeUInt32LE(len, hdr + kHdrMsgSize);
+    this.hdrs.writeUInt32LE(flow.src_ip, hdr + kHdrFlow + kFlowSrcIp);
+    this.hdrs.writeUInt32LE(flow.dst_ip, hdr + kHdrFlow + kFlowDstIp);
+    this.hdrs.writeUInt16LE(flow.src_port, hdr + kHdrFlow + kFlowSrcPort);
+    this.hdrs.writeUInt16LE(flow.dst_port, hdr + kHdrFlow + kFlowDstPort);
+    size_t.set(this.iovs, i * kIovSize + kIovLen, len);
+    this.sizedForSend_ = true;
+  }
+
+  // Turn received message `i' into a reply to its sender, of `len' bytes
+  // (default: the size of the message), without copying it.
+  setReply(i, len = this.msgSize(i)) {
+    const flow = i * kHdrSize + kHdrFlow;
+    const src_ip = this.hdrs.readUInt32LE(flow + kFlowSrcIp);
+    const src_port = this.hdrs.readUInt16LE(flow + kFlowSrcPort);
+    this.hdrs.writeUInt32LE(this.hdrs.readUInt32LE(flow + kFlowDstIp),
+                            flow + kFlowSrcIp);
+    this.hdrs.writeUInt16LE(this.hdrs.readUInt16LE(flow + kFlowDstPort),
+                            flow + kFlowSrcPort);
+    this.hdrs.writeUInt32LE(src_ip, flow + kFlowDstIp);
+    this.hdrs.writeUInt16LE(src_port, flow + kFlowDstPort);
+    this.hdrs.writeUInt32LE(len, i * kHdrSize + kHdrMsgSize);
+    size_t.set(this.iovs, i * kIovSize + kIovLen, len);
+    this.sizedForSend_ = true;
+  }
+
+  // The size of message `i' in bytes (0 if it was received, but did not fit
+  // in its slot).
+  msgSize(i) {
+    return this.hdrs.readUInt32LE(i * kHdrSize + kHdrMsgSize);
+  }
+
+  // Copy the flow of message `i' to `out' (a MachnetFlow_t, or any object),
+  // and return it.
+  getFlow(i, out) {
+    const flow = i * kHdrSize + kHdrFlow;
+    out.src_ip = this.hdrs.readUInt32LE(flow + kFlowSrcIp);
+    out.dst_ip = this.hdrs.readUInt32LE(flow + kFlowDstIp);
+    out.src_port = this.hdrs.readUInt16LE(flow + kFlowSrcPort);
+    out.dst_port = this.hdrs.readUInt16LE(flow + kFlowDstPort);
+    return out;
+  }
+
+  // Receiving: each message may take its whole slot.
+  sizeForRecv_() {
+    if (!this.sizedForSend_) return;
+    for (let i = 0; i < this.capacity; i++) {
+      size_t.set(this.iovs, i * kIovSize + kIovLen, this.slotSize);
+    }
+    this.sizedForSend_ = false;
+  }
+}
+
+// Send the first `n' messages of `batch' with a single FFI call. Returns the
+// number of (leading) messages sent; the others are to be retried.
+function machnet_send_batch(channel_ctx, batch, n = batch.capacity) {
+  return machnet_shim.machnet_sendmmsg(channel_ctx, batch.hdrs, n);
+}
+
+// Receive up to `n' pending messages into `batch' with a single FFI call.
+// Returns the number of messages received.
+function machnet_recv_batch(channel_ctx, batch, n = batch.capacity) {
+  batch.sizeForRecv_();
+  return machnet_shim.machnet_recvmmsg(channel_ctx, batch.hdrs, n);
+}
+
 module.exports = {
   machnet_shim: machnet_shim,
-  MachnetFlow_t: MachnetFlow_t
+  MachnetFlow_t: MachnetFlow_t,
+  MachnetMsgBatch: MachnetMsgBatch,
+  machnet_send_batch: machnet_send_batch,
+  machnet_recv_batch: machnet_recv_batch
 };
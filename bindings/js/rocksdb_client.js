@@ -12,6 +12,16 @@ commander
   .option("-n, --num_keys <num>", "Number of keys at the server")
   .option("-o, --num_ops <num>", "Number of operations to perform")
   .option("-t, --transport <transport>", "Transport to use: machnet/udp")
+  .option(
+    "-f, --num_flows <num>",
+    "Number of flows, each with one request outstanding (machnet only)",
+    "1"
+  )
+  .option(
+    "-w, --server_workers <num>",
+    "Number of server workers; flow i goes to the port of worker i % num",
+    "1"
+  )
   .parse(process.argv);
 
 const options = commander.opts();
@@ -65,16 +75,25 @@ async function machnetTransportClientAsync() {
   customCheck(channel_ctx !== null, "machnet_attach()");
 
   const latencies_us = [];
-
-  const tx_flow = new MachnetFlow_t();
-  var ret = machnet_shim.machnet_connect(
-    channel_ctx,
-    ref.allocCString(options.local_ip),
-    ref.allocCString(options.remote_ip),
-    kRocksDbServerPort,
-    tx_flow.ref()
-  );
-  customCheck(ret === 0, "machnet_connect()");
+  const num_ops = parseInt(options.num_ops);
+  const num_flows = parseInt(options.num_flows);
+  const server_workers = parseInt(options.server_workers);
+
+  // Flows to the server's workers, in turn; responses are matched to their
+  // flow by its local port.
+  const flows = new Map();
+  for (let i = 0; i < num_flows; i++) {
+    const tx_flow = new MachnetFlow_t();
+    ret = machnet_shim.machnet_connect(
+      channel_ctx,
+      ref.allocCString(options.local_ip),
+      ref.allocCString(options.remote_ip),
+      kRocksDbServerPort + (i % server_workers),
+      tx_flow.ref()
+    );
+    customCheck(ret === 0, `machnet_connect() of flow ${i}`);
+    flows.set(tx_flow.src_port, { tx_flow: tx_flow, startTime: null });
+  }
 
   ret = machnet_shim.machnet_listen(
     channel_ctx,
@@ -83,83 +102,70 @@ async function machnetTransportClientAsync() {
   );
   customCheck(ret === 0, "machnet_listen()");
 
+  let sent = 0;
   let msgCounter = 0;
   const rx_flow = new MachnetFlow_t();
   const rx_buf = Buffer.alloc(1024);
 
-  console.log(`Sending ${options.num_ops} queries`);
-
-  async function nextRequest() {
-    if (msgCounter >= options.num_ops) return;
-
-    const startTime = process.hrtime();
+  function sendRequest(flow) {
     const keyIndex = Math.floor(Math.random() * options.num_keys);
     const key = "key" + keyIndex;
     const key_buffer = Buffer.from(key, "utf8");
+    flow.startTime = process.hrtime();
+    ret = machnet_shim.machnet_send(
+      channel_ctx,
+      flow.tx_flow,
+      key_buffer,
+      key_buffer.length
+    );
+    if (ret === -1) {
+      console.log(chalk.red(`Error: machnet_send() failed for key ${key}`));
+      process.exit(1);
+    }
+    sent++;
+  }
 
-    try {
-      await new Promise((resolve, reject) => {
-        ret = machnet_shim.machnet_send(
-          channel_ctx,
-          tx_flow,
-          key_buffer,
-          key_buffer.length
-        );
-        if (ret === -1) {
-          reject(new Error(`Error: machnet_send() failed for key ${key}`));
-        } else {
-          resolve();
-        }
-      });
-
-      await new Promise((resolve, reject) => {
-        let bytesRead = 0;
-        while (bytesRead === 0) {
-          const result = machnet_shim.machnet_recv(
-            channel_ctx,
-            rx_buf,
-            rx_buf.length,
-            rx_flow.ref()
-          );
-          if (result === -1) {
-            reject(new Error(`Error: machnet_recv() failed for key ${key}`));
-          }
-          bytesRead = result;
-        }
-
-        const endTime = process.hrtime();
-        const latency_us =
-          (endTime[0] - startTime[0]) * 1e6 + (endTime[1] - startTime[1]) / 1e3;
-        latencies_us.push(latency_us);
-
-        /*
-        const value = rx_buf.toString("utf8", 0, bytesRead);
-        const expected_value = "value" + "x".repeat(200);
-        if (value !== expected_value) {
-          reject(
-            new Error(`Error: Key '${key}' has an incorrect value`)
-          );
-        }
-        */
-        resolve();
-      });
-    } catch (err) {
-      console.log(chalk.red(err.message));
+  console.log(`Sending ${num_ops} queries over ${num_flows} flows`);
+  const benchStart = process.hrtime();
+  for (const flow of flows.values()) {
+    if (sent < num_ops) sendRequest(flow);
+  }
+
+  while (msgCounter < num_ops) {
+    const result = machnet_shim.machnet_recv(
+      channel_ctx,
+      rx_buf,
+      rx_buf.length,
+      rx_flow.ref()
+    );
+    if (result === -1) {
+      console.log(chalk.red("Error: machnet_recv() failed"));
       process.exit(1);
     }
+    if (result === 0) continue;
 
+    const flow = flows.get(rx_flow.dst_port);
+    if (flow === undefined || flow.startTime === null) continue;
+    const endTime = process.hrtime();
+    const latency_us =
+      (endTime[0] - flow.startTime[0]) * 1e6 +
+      (endTime[1] - flow.startTime[1]) / 1e3;
+    latencies_us.push(latency_us);
+    flow.startTime = null;
     msgCounter++;
 
-    if (msgCounter % (options.num_ops / 10) === 0) {
-      console.log(`Sent ${msgCounter} RocksDB queries of ${options.num_ops}`);
+    if (msgCounter % Math.max(1, Math.floor(num_ops / 10)) === 0) {
+      console.log(`Sent ${msgCounter} RocksDB queries of ${num_ops}`);
       print_stats(latencies_us);
       latencies_us.length = 0;
     }
 
-    nextRequest();
+    if (sent < num_ops) sendRequest(flow);
   }
 
-  await nextRequest();
+  const elapsed = process.hrtime(benchStart);
+  const elapsed_s = elapsed[0] + elapsed[1] / 1e9;
+  console.log(`Throughput: ${Math.floor(num_ops / elapsed_s)} queries/s`);
 }
 
 async function udpTransportClient() {
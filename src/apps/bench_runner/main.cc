@@ -0,0 +1,325 @@
+/**
+ * @file main.cc
+ * @brief Benchmark driver of the shared-memory rings, which carry the messages
+ * between applications and engines (`jring') and the requests of the
+ * microbenchmarks (`jring2'). It sweeps over the ring, message size, window,
+ * ring size and core pair given by its flags, and writes the throughput,
+ * latency percentiles and cycles per operation of each point as CSV or JSON
+ * lines (see `BenchResults'), for results to be compared across commits and
+ * machines.
+ *
+ * At each point, a producer sends messages, stamped with their send time, to
+ * a consumer that echoes them back over a second ring, with up to `window'
+ * messages in flight; an operation is a round trip.
+ */
+
+#include <bench_results.h>
+#include <common.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <jring.h>
+#include <jring2.h>
+#include <latency_histogram.h>
+#include <ttime.h>
+#include <utils.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+DEFINE_string(rings, "jring,jring2", "Rings to benchmark (`jring', `jring2').");
+DEFINE_string(msg_sizes, "64,256,1024",
+              "Sizes of the messages, in bytes (rounded up to a multiple of 4, "
+              "at least 16).");
+DEFINE_string(windows, "1,16,64", "Maximum numbers of messages in flight.");
+DEFINE_string(ring_sizes, "1024",
+              "Numbers of slots of the rings (powers of two).");
+DEFINE_string(core_pairs, "2:5",
+              "Pairs of `producer:consumer' cores to run on.");
+DEFINE_uint32(duration_ms, 1000, "Duration of each point, in milliseconds.");
+DEFINE_uint32(warmup_ms, 100,
+              "Warm-up before each point, in milliseconds (not measured).");
+DEFINE_string(results, "",
+              "File to append the results to (CSV if it ends in `.csv', JSON "
+              "lines otherwise), instead of stdout.");
+DEFINE_string(format, "csv",
+              "Format of the results on stdout (`csv' or `json').");
+
+namespace juggler {
+
+// Minimum message: the send time and a sequence number.
+static constexpr uint32_t kMinMsgSize = 2 * sizeof(uint64_t);
+
+// A single-producer, single-consumer ring of fixed-size messages.
+class Ring {
+ public:
+  virtual ~Ring() = default;
+  virtual bool Enqueue(const void *msg) = 0;
+  virtual bool Dequeue(void *msg) = 0;
+};
+
+class Jring : public Ring {
+ public:
+  Jring(uint32_t slots, uint32_t msg_size)
+      : ring_(static_cast<jring_t *>(std::aligned_alloc(
+            hardware_constructive_interference_size,
+            jring_get_buf_ring_size(msg_size, slots)))) {
+    CHECK_NOTNULL(ring_);
+    CHECK_EQ(jring_init(ring_, slots, msg_size, 0, 0), 0);
+  }
+  ~Jring() override { std::free(ring_); }
+  bool Enqueue(const void *msg) override {
+    return jring_sp_enqueue_bulk(ring_, msg, 1, nullptr) == 1;
+  }
+  bool Dequeue(void *msg) override {
+    return jring_sc_dequeue_bulk(ring_, msg, 1, nullptr) == 1;
+  }
+
+ private:
+  jring_t *const ring_;
+};
+
+class Jring2 : public Ring {
+ public:
+  Jring2(uint32_t slots, uint32_t msg_size)
+      : ring_(static_cast<jring2_t *>(std::aligned_alloc(
+            hardware_constructive_interference_size,
+            jring2_get_buf_ring_size(msg_size, slots)))) {
+    CHECK_NOTNULL(ring_);
+    CHECK_EQ(jring2_init(ring_, slots, msg_size), 0);
+  }
+  ~Jring2() override { std::free(ring_); }
+  bool Enqueue(const void *msg) override {
+    return jring2_enqueue(ring_, msg) == 1;
+  }
+  bool Dequeue(void *msg) override { return jring2_dequeue(ring_, msg) == 1; }
+
+ private:
+  jring2_t *const ring_;
+};
+
+static std::unique_ptr<Ring> MakeRing(const std::string &name, uint32_t slots,
+                                      uint32_t msg_size) {
+  if (name == "jring") return std::make_unique<Jring>(slots, msg_size);
+  if (name == "jring2") return std::make_unique<Jring2>(slots, msg_size);
+  LOG(FATAL) << "Unknown ring: " << name;
+  return nullptr;
+}
+
+// A point of the sweep.
+struct Point {
+  std::string ring;
+  uint32_t msg_size;
+  uint32_t window;
+  uint32_t ring_size;
+  size_t producer_core;
+  size_t consumer_core;
+};
+
+struct PointResult {
+  uint64_t ops{0};
+  double seconds{0};
+  double cycles_per_op{0};
+  LatencyHistogram::Summary latency{};
+};
+
+/**
+ * @brief Run a point of the sweep: the producer on the calling thread, the
+ * consumer on a thread of its own.
+ */
+static PointResult RunPoint(const Point &point) {
+  auto p2c = MakeRing(point.ring, point.ring_size, point.msg_size);
+  auto c2p = MakeRing(point.ring, point.ring_size, point.msg_size);
+  std::atomic<bool> stop{false};
+
+  std::thread consumer([&point, &p2c, &c2p, &stop] {
+    CHECK(utils::BindThisThreadToCore(point.consumer_core));
+    std::vector<uint8_t> msg(point.msg_size);
+    while (!stop.load(std::memory_order_relaxed)) {
+      if (!p2c->Dequeue(msg.data())) continue;
+      while (!c2p->Enqueue(msg.data())) {
+      }
+    }
+  });
+
+  CHECK(utils::BindThisThreadToCore(point.producer_core));
+  time::tsc_hz = time::estimate_tsc_hz();
+  std::vector<uint8_t> msg(point.msg_size);
+  std::vector<uint8_t> echo(point.msg_size);
+  LatencyHistogram latency;
+  uint64_t seqno = 0, inflight = 0, ops = 0;
+
+  // Keep `window' messages in flight until `end', and record the round trips
+  // if `measure'.
+  auto run = [&](uint64_t end, bool measure) {
+    uint64_t now;
+    while ((now = time::rdtsc()) < end) {
+      while (inflight < point.window) {
+        std::memcpy(msg.data(), &now, sizeof(now));
+        std::memcpy(msg.data() + sizeof(now), &seqno, sizeof(seqno));
+        if (!p2c->Enqueue(msg.data())) break;
+        seqno++;
+        inflight++;
+      }
+      if (!c2p->Dequeue(echo.data())) continue;
+      inflight--;
+      if (!measure) continue;
+      uint64_t tx_tsc;
+      std::memcpy(&tx_tsc, echo.data(), sizeof(tx_tsc));
+      latency.Record(time::cycles_to_ns(time::rdtsc() - tx_tsc));
+      ops++;
+    }
+  };
+
+  run(time::rdtsc() + time::ms_to_cycles(FLAGS_warmup_ms), false);
+  const uint64_t start = time::rdtsc();
+  run(start + time::ms_to_cycles(FLAGS_duration_ms), true);
+  const uint64_t cycles = time::rdtsc() - start;
+
+  // Drain the messages in flight, before the consumer stops.
+  while (inflight != 0) {
+    if (c2p->Dequeue(echo.data())) inflight--;
+  }
+  stop.store(true, std::memory_order_relaxed);
+  consumer.join();
+
+  PointResult result;
+  result.ops = ops;
+  result.seconds = time::cycles_to_s<double>(cycles);
+  result.cycles_per_op = ops != 0 ? static_cast<double>(cycles) / ops : 0;
+  result.latency = latency.GetSummary();
+  return result;
+}
+
+// Split a comma-separated list.
+static std::vector<std::string> SplitList(const std::string &list) {
+  std::vector<std::string> items;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) items.push_back(item);
+  }
+  return items;
+}
+
+static std::vector<uint32_t> ParseNumbers(const std::string &flag,
+                                          const std::string &list) {
+  std::vector<uint32_t> numbers;
+  for (const auto &item : SplitList(list)) {
+    char *end;
+    const auto number = std::strtoul(item.c_str(), &end, 10);
+    CHECK(*end == '\0' && number != 0 && number <= UINT32_MAX)
+        << "Invalid --" << flag << ": " << item;
+    numbers.push_back(number);
+  }
+  CHECK(!numbers.empty()) << "Empty --" << flag;
+  return numbers;
+}
+
+static std::vector<std::pair<size_t, size_t>> ParseCorePairs(
+    const std::string &list) {
+  std::vector<std::pair<size_t, size_t>> pairs;
+  for (const auto &item : SplitList(list)) {
+    size_t producer, consumer;
+    char extra;
+    CHECK_EQ(std::sscanf(item.c_str(), "%zu:%zu%c", &producer, &consumer,
+                         &extra),
+             2)
+        << "Invalid --core_pairs: " << item;
+    pairs.emplace_back(producer, consumer);
+  }
+  CHECK(!pairs.empty()) << "Empty --core_pairs";
+  return pairs;
+}
+
+static void Run() {
+  const auto rings = SplitList(FLAGS_rings);
+  const auto msg_sizes = ParseNumbers("msg_sizes", FLAGS_msg_sizes);
+  const auto windows = ParseNumbers("windows", FLAGS_windows);
+  const auto ring_sizes = ParseNumbers("ring_sizes", FLAGS_ring_sizes);
+  const auto core_pairs = ParseCorePairs(FLAGS_core_pairs);
+  for (const auto ring_size : ring_sizes) {
+    CHECK(utils::is_power_of_two(ring_size))
+        << "Ring size not a power of two: " << ring_size;
+  }
+
+  BenchResults results;
+  for (const auto &ring : rings) {
+    for (const auto ring_size : ring_sizes) {
+      for (const auto msg_size : msg_sizes) {
+        for (const auto window : windows) {
+          for (const auto &[producer_core, consumer_core] : core_pairs) {
+            // The rings hold one slot less than their size.
+            if (window >= ring_size) {
+              LOG(WARNING) << "Skipping window " << window << " over a ring "
+                           << "of " << ring_size << " slots";
+              continue;
+            }
+            const Point point{ring,
+                              std::max(kMinMsgSize, (msg_size + 3) & ~3u),
+                              window,
+                              ring_size,
+                              producer_core,
+                              consumer_core};
+            const auto result = RunPoint(point);
+            LOG(INFO) << utils::Format(
+                "%s, msg_size %u, window %u, ring_size %u, cores %zu:%zu: "
+                "%.3f Mops, %.1f cycles/op, ",
+                ring.c_str(), point.msg_size, window, ring_size,
+                producer_core, consumer_core, result.ops / result.seconds / 1E6,
+                result.cycles_per_op)
+                      << result.latency.ToString();
+            results.Add({{"ring", ring},
+                         {"msg_size", uint64_t{point.msg_size}},
+                         {"window", uint64_t{window}},
+                         {"ring_size", uint64_t{ring_size}},
+                         {"producer_core", uint64_t{producer_core}},
+                         {"consumer_core", uint64_t{consumer_core}},
+                         {"ops", result.ops},
+                         {"seconds", result.seconds},
+                         {"mops", result.ops / result.seconds / 1E6},
+                         {"cycles_per_op", result.cycles_per_op},
+                         {"rtt_p50_ns", result.latency.p50_ns},
+                         {"rtt_p99_ns", result.latency.p99_ns},
+                         {"rtt_p999_ns", result.latency.p999_ns},
+                         {"rtt_max_ns", result.latency.max_ns}});
+          }
+        }
+      }
+    }
+  }
+
+  if (!FLAGS_results.empty()) {
+    CHECK(results.Append(FLAGS_results));
+    LOG(INFO) << "Results appended to " << FLAGS_results;
+  } else {
+    results.Write(std::cout, FLAGS_format == "json"
+                                 ? BenchResults::Format::kJson
+                                 : BenchResults::Format::kCsv);
+  }
+}
+
+}  // namespace juggler
+
+int main(int argc, char *argv[]) {
+  ::google::InitGoogleLogging(argv[0]);
+  gflags::SetUsageMessage(
+      "Benchmark driver of the shared-memory rings, over parameter sweeps.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  FLAGS_logtostderr = 1;
+  CHECK(FLAGS_format == "csv" || FLAGS_format == "json")
+      << "Invalid --format: " << FLAGS_format;
+  CHECK_GT(FLAGS_duration_ms, 0);
+
+  juggler::Run();
+  return 0;
+}
@@ -0,0 +1,260 @@
+/**
+ * @file main.cc
+ * @brief Performance harness of the Machnet protocol: two engines, back to
+ * back over an in-memory link with configurable impairments (see
+ * `dpdk::LoopbackLink'), in one process. A client sends messages over a flow to
+ * a server, with a bounded number in flight; the harness reports the goodput,
+ * the one-way latencies of the messages, the retransmissions of the flow and
+ * what the link did to the packets.
+ */
+
+#include <channel.h>
+#include <dpdk.h>
+#include <engine_stats.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <latency_histogram.h>
+#include <loopback_link.h>
+#include <machnet.h>
+#include <machnet_engine.h>
+#include <ttime.h>
+#include <utils.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+DEFINE_uint32(msg_size, 1024, "Size of the messages to send.");
+DEFINE_uint32(msg_window, 32, "Maximum number of messages in flight.");
+DEFINE_uint32(duration, 10, "Duration of the run, in seconds.");
+DEFINE_uint32(drain_timeout, 10,
+              "Time to wait for the messages in flight at the end of the run "
+              "to be delivered, in seconds.");
+DEFINE_double(loss, 0, "Probability that a packet is lost.");
+DEFINE_double(duplicate, 0, "Probability that a packet is duplicated.");
+DEFINE_double(reorder, 0, "Probability that a packet is reordered.");
+DEFINE_uint64(reorder_delay_us, 20,
+              "How long reordered packets are held back, in microseconds.");
+DEFINE_uint64(delay_us, 0, "One-way delay of the link, in microseconds.");
+DEFINE_uint64(jitter_us, 0,
+              "Maximum jitter of the delay of the link, in microseconds.");
+DEFINE_bool(impair_acks, false,
+            "Impair the packets from the server to the client (i.e., the "
+            "ACKs) too.");
+
+namespace juggler {
+
+static constexpr const char *kClientIp = "10.0.0.1";
+static constexpr const char *kServerIp = "10.0.0.2";
+static constexpr uint16_t kServerPort = 888;
+
+/**
+ * @brief One end of the harness: a channel, served by an engine of its own
+ * thread.
+ */
+class Host {
+ public:
+  Host(const char *name, std::shared_ptr<dpdk::PmdPort> pmd_port,
+       const char *ip)
+      : name_(name) {
+    CHECK(channel_mgr_.AddChannel(name, 1 << 10, 1 << 10, 1 << 14, 1 << 12));
+    channel_ = channel_mgr_.GetChannel(name);
+    net::Ipv4::Address addr;
+    CHECK(addr.FromString(ip));
+    engine_ = std::make_unique<MachnetEngine>(
+        pmd_port, 0, 0,
+        std::make_shared<MachnetEngineSharedState>(
+            std::vector<uint8_t>{}, pmd_port->GetL2Addr(),
+            std::vector<net::Ipv4::Address>{addr}),
+        std::vector<std::shared_ptr<shm::Channel>>{channel_});
+    thread_ = std::thread([this] {
+      while (!stop_.load(std::memory_order_relaxed)) {
+        engine_->Run(time::rdtsc());
+      }
+    });
+  }
+  Host(const Host &) = delete;
+  Host &operator=(const Host &) = delete;
+
+  ~Host() {
+    stop_.store(true, std::memory_order_relaxed);
+    thread_.join();
+    engine_.reset();
+    channel_.reset();
+    channel_mgr_.DestroyChannel(name_.c_str());
+  }
+
+  void *ctx() const { return channel_->ctx(); }
+
+ private:
+  const std::string name_;
+  shm::ChannelManager<shm::Channel> channel_mgr_;
+  std::shared_ptr<shm::Channel> channel_;
+  std::unique_ptr<MachnetEngine> engine_;
+  std::atomic<bool> stop_{false};
+  std::thread thread_;
+};
+
+// Counters of the messages, shared by the client and the server.
+struct Counters {
+  std::atomic<uint64_t> sent{0};
+  std::atomic<uint64_t> received{0};
+  std::atomic<uint64_t> received_bytes{0};
+};
+
+// Send messages, stamped with their send time, while no more than
+// `--msg_window' are in flight.
+static void ClientLoop(void *ctx, MachnetFlow_t flow, Counters *counters,
+                       const std::atomic<bool> *stop) {
+  std::vector<uint8_t> msg(FLAGS_msg_size);
+  uint64_t sent = 0;
+  while (!stop->load(std::memory_order_relaxed)) {
+    if (sent - counters->received.load(std::memory_order_acquire) >=
+        FLAGS_msg_window) {
+      continue;
+    }
+    const uint64_t tsc = time::rdtsc();
+    std::memcpy(msg.data(), &tsc, sizeof(tsc));
+    if (machnet_send(ctx, flow, msg.data(), msg.size()) != 0) continue;
+    counters->sent.store(++sent, std::memory_order_release);
+  }
+}
+
+// Receive the messages, and record their one-way latency.
+static void ServerLoop(void *ctx, Counters *counters,
+                       LatencyHistogram *latency,
+                       const std::atomic<bool> *stop) {
+  std::vector<uint8_t> msg(MACHNET_MSG_MAX_LEN);
+  MachnetFlow_t flow;
+  uint64_t received = 0, received_bytes = 0;
+  while (!stop->load(std::memory_order_relaxed)) {
+    const auto n = machnet_recv(ctx, msg.data(), msg.size(), &flow);
+    if (n <= 0) continue;
+    uint64_t tsc;
+    std::memcpy(&tsc, msg.data(), sizeof(tsc));
+    latency->Record(time::cycles_to_ns(time::rdtsc() - tsc));
+    received_bytes += n;
+    counters->received_bytes.store(received_bytes, std::memory_order_relaxed);
+    counters->received.store(++received, std::memory_order_release);
+  }
+}
+
+static void ReportLink(const char *direction, const dpdk::LinkStats &stats) {
+  LOG(INFO) << utils::Format(
+      "Link %s: %lu packets, %lu lost, %lu duplicated, %lu reordered",
+      direction, stats.packets, stats.drops, stats.duplicates, stats.reorders);
+}
+
+// Report the retransmissions of the flows of the client, from its stats page.
+static void ReportRetransmissions(const dpdk::PmdPort &port) {
+  const auto reader =
+      stats::StatsPageReader::Open(stats::PageName(port.GetPortId(), 0));
+  stats::Snapshot snapshot;
+  if (reader == nullptr || !reader->Read(&snapshot)) {
+    LOG(WARNING) << "Failed to read the stats of the client";
+    return;
+  }
+  for (const auto &flow : snapshot.flows) {
+    LOG(INFO) << utils::Format(
+        "Client flow: fast retransmissions: %u, RTO retransmissions: %u, "
+        "cwnd: %.2f, srtt: %.1f us",
+        flow.fast_rexmits, flow.rto_rexmits, flow.cwnd, flow.srtt_ns / 1E3);
+  }
+}
+
+static void Run() {
+  dpdk::LinkImpairments impairments;
+  impairments.loss = FLAGS_loss;
+  impairments.duplicate = FLAGS_duplicate;
+  impairments.reorder = FLAGS_reorder;
+  impairments.reorder_delay_ns = FLAGS_reorder_delay_us * 1000;
+  impairments.delay_ns = FLAGS_delay_us * 1000;
+  impairments.jitter_ns = FLAGS_jitter_us * 1000;
+  dpdk::LinkImpairments ack_impairments;
+  if (FLAGS_impair_acks) {
+    ack_impairments = impairments;
+  } else {
+    // The ACKs are not impaired, but as delayed.
+    ack_impairments.delay_ns = impairments.delay_ns;
+  }
+  dpdk::LoopbackLink link("lbperf", 1, {impairments, ack_impairments});
+
+  Counters counters;
+  LatencyHistogram latency;
+  Host server("lbperf_server", link.port(1), kServerIp);
+  Host client("lbperf_client", link.port(0), kClientIp);
+  CHECK_EQ(machnet_listen(server.ctx(), kServerIp, kServerPort), 0);
+  MachnetFlow_t flow;
+  CHECK_EQ(
+      machnet_connect(client.ctx(), kClientIp, kServerIp, kServerPort, &flow),
+      0);
+  LOG(INFO) << "Connected; running for " << FLAGS_duration << "s";
+
+  std::atomic<bool> stop_client{false}, stop_server{false};
+  std::thread server_thread(ServerLoop, server.ctx(), &counters, &latency,
+                            &stop_server);
+  std::thread client_thread(ClientLoop, client.ctx(), flow, &counters,
+                            &stop_client);
+  const auto start = std::chrono::steady_clock::now();
+  uint64_t last_bytes = 0;
+  for (uint32_t s = 0; s < FLAGS_duration; s++) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    const auto bytes = counters.received_bytes.load();
+    LOG(INFO) << utils::Format("[%us] goodput: %.3f Gbps", s + 1,
+                               (bytes - last_bytes) * 8 / 1E9);
+    last_bytes = bytes;
+  }
+  stop_client.store(true);
+  client_thread.join();
+  const auto elapsed_s =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  // Wait for the messages in flight.
+  const auto sent = counters.sent.load();
+  for (uint32_t i = 0;
+       counters.received.load() < sent && i < 10 * FLAGS_drain_timeout; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  stop_server.store(true);
+  server_thread.join();
+  // Let the stats page of the client catch up.
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  const auto received = counters.received.load();
+  LOG(INFO) << utils::Format(
+      "Messages: %lu sent, %lu received (%lu undelivered), goodput: %.3f "
+      "Gbps, %.0f msgs/s",
+      sent, received, sent - received,
+      counters.received_bytes.load() * 8 / 1E9 / elapsed_s,
+      received / elapsed_s);
+  LOG(INFO) << "One-way latency: " << latency.GetSummary().ToString();
+  ReportRetransmissions(*link.port(0));
+  ReportLink("client->server", link.GetStats(0));
+  ReportLink("server->client", link.GetStats(1));
+}
+
+}  // namespace juggler
+
+int main(int argc, char *argv[]) {
+  ::google::InitGoogleLogging(argv[0]);
+  gflags::SetUsageMessage(
+      "Machnet performance harness, over an in-memory link between two "
+      "engines.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  FLAGS_logtostderr = 1;
+  CHECK_GE(FLAGS_msg_size, sizeof(uint64_t)) << "Message size too small";
+  CHECK_GT(FLAGS_msg_window, 0);
+
+  auto kEalOpts = juggler::utils::CmdLineOpts(
+      {"-c", "0x0", "-n", "6", "--proc-type=auto", "-m", "2048", "--log-level",
+       "8", "--no-pci"});
+  auto d = juggler::dpdk::Dpdk();
+  d.InitDpdk(kEalOpts);
+
+  juggler::Run();
+  return 0;
+}
@@ -0,0 +1,314 @@
+/**
+ * @file main.cc
+ * @brief Packet capture tool of the Machnet engines.
+ *
+ * Starts a capture on the capture rings (see `capture_ring.h') of the engines,
+ * with a filter given by flags, and drains the headers of the packets they
+ * capture into a pcapng file, one interface per engine, until stopped. The
+ * engines never wait for the tool: they drop what does not fit in their ring
+ * (reported at the end).
+ */
+#include <arpa/inet.h>
+#include <capture_ring.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <machnet_pkthdr.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+DEFINE_string(rings, "",
+              "Comma-separated capture rings to capture from (e.g., "
+              "`machnet-capture-p0-q0'); all of them if empty.");
+DEFINE_string(output, "", "The pcapng file to write (`-' for stdout).");
+DEFINE_string(host, "",
+              "Capture the packets from or to this `ip[:port]' only.");
+DEFINE_string(peer, "",
+              "With `--host', capture the packets between it and this "
+              "`ip[:port]' only.");
+DEFINE_string(flags, "",
+              "Capture the Machnet packets of this type only (`data', "
+              "`syn', `ack', `syn_ack', `data_ack' or `rst').");
+DEFINE_string(direction, "both", "Directions to capture (rx, tx or both).");
+DEFINE_uint32(sample_every, 1, "Capture one in every this many packets.");
+DEFINE_uint32(budget, 32,
+              "Maximum packets captured per iteration of each engine.");
+DEFINE_uint64(count, 0, "Stop after this many packets (0: no limit).");
+DEFINE_uint32(duration_s, 0, "Stop after this many seconds (0: no limit).");
+
+static volatile int g_keep_running = 1;
+
+void int_handler([[maybe_unused]] int signal) { g_keep_running = 0; }
+
+namespace juggler {
+namespace capture {
+
+/**
+ * @brief Class `PcapngWriter' writes packets to a pcapng file: a section
+ * header, then interface descriptions and packets (see
+ * https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng-02.html).
+ */
+class PcapngWriter {
+ public:
+  explicit PcapngWriter(std::FILE *file) : file_(file) {
+    // Section header: byte-order magic, version 1.0, unknown section length.
+    Block block(0x0a0d0d0a);
+    block.Put<uint32_t>(0x1a2b3c4d);
+    block.Put<uint16_t>(1);
+    block.Put<uint16_t>(0);
+    block.Put<uint64_t>(UINT64_MAX);
+    Write(&block);
+  }
+
+  // Describe an (Ethernet) interface; interfaces are numbered in order.
+  void AddInterface(const std::string &name) {
+    Block block(0x1);
+    block.Put<uint16_t>(1);  // LINKTYPE_ETHERNET.
+    block.Put<uint16_t>(0);
+    block.Put<uint32_t>(Record::kSnapLen);
+    block.PutOption(2, name.data(), name.size());  // if_name.
+    const uint8_t tsresol = 9;                     // Nanoseconds.
+    block.PutOption(9, &tsresol, sizeof(tsresol));
+    block.PutOption(0, nullptr, 0);
+    Write(&block);
+  }
+
+  void AddPacket(uint32_t interface, uint64_t timestamp_ns,
+                 const Record &record) {
+    Block block(0x6);
+    block.Put<uint32_t>(interface);
+    block.Put<uint32_t>(timestamp_ns >> 32);
+    block.Put<uint32_t>(timestamp_ns & UINT32_MAX);
+    block.Put<uint32_t>(record.cap_len);
+    block.Put<uint32_t>(record.orig_len);
+    block.PutPadded(record.data, record.cap_len);
+    // epb_flags: inbound (1) or outbound (2).
+    const uint32_t flags = record.direction == kRx ? 1 : 2;
+    block.PutOption(2, &flags, sizeof(flags));
+    block.PutOption(0, nullptr, 0);
+    Write(&block);
+  }
+
+  bool Flush() { return std::fflush(file_) == 0; }
+
+ private:
+  // A block, with its type and total length around the body.
+  struct Block {
+    explicit Block(uint32_t type) {
+      Put(type);
+      Put<uint32_t>(0);
+    }
+    template <typename T>
+    void Put(T value) {
+      PutPadded(&value, sizeof(value));
+    }
+    void PutPadded(const void *data, size_t len) {
+      const auto *bytes = static_cast<const uint8_t *>(data);
+      buf.insert(buf.end(), bytes, bytes + len);
+      buf.resize(utils::align_size<size_t>(buf.size(), 4), 0);
+    }
+    void PutOption(uint16_t code, const void *data, uint16_t len) {
+      Put(code);
+      Put(len);
+      if (len != 0) PutPadded(data, len);
+    }
+    std::vector<uint8_t> buf;
+  };
+
+  void Write(Block *block) {
+    const uint32_t len = block->buf.size() + sizeof(uint32_t);
+    block->Put(len);
+    std::memcpy(&block->buf[sizeof(uint32_t)], &len, sizeof(len));
+    CHECK_EQ(std::fwrite(block->buf.data(), 1, block->buf.size(), file_),
+             block->buf.size())
+        << "Failed to write the capture";
+  }
+
+  std::FILE *const file_;
+};
+
+// Split a comma-separated list.
+static std::vector<std::string> SplitList(const std::string &list) {
+  std::vector<std::string> items;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) items.push_back(item);
+  }
+  return items;
+}
+
+// All the capture rings, on hugetlbfs or in POSIX shared memory.
+static std::vector<std::string> FindRings() {
+  std::vector<std::string> names;
+  for (const auto *dir : {kHugePageDir, "/dev/shm"}) {
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+      const auto name = entry.path().filename().string();
+      if (name.starts_with(kRingNamePrefix)) names.push_back(name);
+    }
+  }
+  std::sort(names.begin(), names.end());
+  names.erase(std::unique(names.begin(), names.end()), names.end());
+  return names;
+}
+
+// Parse an `ip[:port]' endpoint into a filter.
+static void ParseEndpoint(const std::string &flag, const std::string &value,
+                          size_t i, Filter *filter) {
+  const auto colon = value.find(':');
+  const auto ip = value.substr(0, colon);
+  if (!ip.empty() && ip != "*") {
+    in_addr addr;
+    CHECK_EQ(inet_pton(AF_INET, ip.c_str(), &addr), 1)
+        << "Invalid --" << flag << ": " << value;
+    filter->ip[i] = ntohl(addr.s_addr);
+  }
+  if (colon == std::string::npos) return;
+  char *end;
+  const auto port = std::strtoul(value.c_str() + colon + 1, &end, 10);
+  CHECK(*end == '\0' && port <= UINT16_MAX)
+      << "Invalid --" << flag << ": " << value;
+  filter->port[i] = port;
+}
+
+static Filter MakeFilter() {
+  Filter filter{};
+  filter.sample_every = FLAGS_sample_every;
+  filter.budget = FLAGS_budget;
+  if (!FLAGS_host.empty()) ParseEndpoint("host", FLAGS_host, 0, &filter);
+  if (!FLAGS_peer.empty()) {
+    CHECK(!FLAGS_host.empty()) << "--peer requires --host";
+    ParseEndpoint("peer", FLAGS_peer, 1, &filter);
+  }
+
+  using Flags = net::MachnetPktHdr::MachnetFlags;
+  static const std::pair<const char *, Flags> kFlags[] = {
+      {"data", Flags::kData},         {"syn", Flags::kSyn},
+      {"ack", Flags::kAck},           {"syn_ack", Flags::kSynAck},
+      {"data_ack", Flags::kDataAck},  {"rst", Flags::kRst}};
+  if (!FLAGS_flags.empty()) {
+    const auto it = std::find_if(
+        std::begin(kFlags), std::end(kFlags),
+        [](const auto &f) { return FLAGS_flags == f.first; });
+    CHECK(it != std::end(kFlags)) << "Invalid --flags: " << FLAGS_flags;
+    filter.flags = static_cast<uint8_t>(it->second);
+    filter.flags_mask = UINT8_MAX;
+  }
+
+  if (FLAGS_direction == "rx") {
+    filter.directions = kRx;
+  } else if (FLAGS_direction == "tx") {
+    filter.directions = kTx;
+  } else {
+    CHECK_EQ(FLAGS_direction, "both") << "Invalid --direction";
+    filter.directions = kRx | kTx;
+  }
+  return filter;
+}
+
+static void Run() {
+  auto names = SplitList(FLAGS_rings);
+  if (names.empty()) names = FindRings();
+  CHECK(!names.empty()) << "No capture rings (are the engines running, with "
+                           "`capture_records' set?)";
+
+  std::FILE *file = FLAGS_output == "-" ? stdout
+                                        : std::fopen(FLAGS_output.c_str(), "w");
+  CHECK(file != nullptr) << "Failed to open " << FLAGS_output << ": "
+                         << std::strerror(errno);
+  PcapngWriter writer(file);
+
+  struct Ring {
+    std::string name;
+    std::unique_ptr<RingReader> reader;
+    // Counters of the ring when the capture started.
+    uint64_t drops;
+    uint64_t skipped;
+    uint64_t packets;
+  };
+  std::vector<Ring> rings;
+  const auto filter = MakeFilter();
+  for (const auto &name : names) {
+    auto reader = RingReader::Open(name);
+    if (reader == nullptr) {
+      LOG(WARNING) << "Cannot open capture ring " << name;
+      continue;
+    }
+    writer.AddInterface(name);
+    reader->Start(filter);
+    const auto drops = reader->header().drops;
+    const auto skipped = reader->header().skipped;
+    rings.push_back({name, std::move(reader), drops, skipped, 0});
+  }
+  CHECK(!rings.empty()) << "No capture ring could be opened";
+  LOG(INFO) << "Capturing from " << rings.size() << " engines";
+
+  const auto start = std::chrono::steady_clock::now();
+  uint64_t total = 0;
+  while (g_keep_running) {
+    size_t drained = 0;
+    for (uint32_t i = 0; i < rings.size(); i++) {
+      auto &ring = rings[i];
+      drained += ring.reader->Drain([&](const Record &record) {
+        if (FLAGS_count != 0 && total == FLAGS_count) return;
+        writer.AddPacket(i, ring.reader->TimestampNs(record), record);
+        ring.packets++;
+        total++;
+      });
+    }
+    if (FLAGS_count != 0 && total == FLAGS_count) break;
+    if (FLAGS_duration_s != 0 &&
+        std::chrono::steady_clock::now() - start >=
+            std::chrono::seconds(FLAGS_duration_s)) {
+      break;
+    }
+    if (drained == 0) {
+      writer.Flush();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  for (auto &ring : rings) {
+    ring.reader->Stop();
+    LOG(INFO) << juggler::utils::Format(
+        "%s: %lu packets, %lu dropped (ring full), %lu skipped (over budget)",
+        ring.name.c_str(), ring.packets,
+        ring.reader->header().drops - ring.drops,
+        ring.reader->header().skipped - ring.skipped);
+  }
+  CHECK(writer.Flush()) << "Failed to write the capture";
+  if (file != stdout) std::fclose(file);
+}
+
+}  // namespace capture
+}  // namespace juggler
+
+int main(int argc, char *argv[]) {
+  ::google::InitGoogleLogging(argv[0]);
+  gflags::SetUsageMessage(
+      "machnet_capture --output=<file.pcapng> [--host=<ip[:port]>] "
+      "[--peer=<ip[:port]>] [--flags=<type>] [--direction=rx|tx|both]");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  FLAGS_logtostderr = 1;
+  CHECK(!FLAGS_output.empty()) << "--output is required";
+
+  signal(SIGINT, int_handler);
+  signal(SIGTERM, int_handler);
+
+  juggler::capture::Run();
+  return 0;
+}
@@ -0,0 +1,455 @@
+/**
+ * @file main.cc
+ * @brief Exporter of the stats pages of the Machnet engines.
+ *
+ * Reads the stats pages (see `engine_stats.h') that the engines publish in
+ * shared memory, and prints them either as tables, or in the Prometheus text
+ * exposition format (e.g., for the textfile collector of node_exporter). The
+ * engines are never stopped, nor slowed down, by the exporter.
+ */
+#include <engine_stats.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+DEFINE_bool(prometheus, false, "Print in the Prometheus text format.");
+DEFINE_uint32(interval, 0,
+              "Print the stats every `interval' seconds (0: print once).");
+DEFINE_string(output, "",
+              "Write the stats to this file instead of stdout (replaced "
+              "atomically, e.g., for the node_exporter textfile collector).");
+DEFINE_bool(flows, true, "Include per-flow stats.");
+
+static constexpr char kShmDir[] = "/dev/shm";
+
+static volatile int g_keep_running = 1;
+
+void int_handler([[maybe_unused]] int signal) { g_keep_running = 0; }
+
+using juggler::stats::LoopStats;
+using juggler::stats::PoolsStats;
+using juggler::stats::Snapshot;
+using juggler::stats::TraceStats;
+
+struct EngineSnapshot {
+  std::string name;
+  Snapshot snapshot;
+};
+
+// Names of the flow states, in the order of `Flow::State'.
+static const char *FlowStateName(uint8_t state) {
+  static constexpr const char *kNames[] = {"closed", "syn_sent",
+                                           "syn_received", "established"};
+  return state < std::size(kNames) ? kNames[state] : "unknown";
+}
+
+// Non-empty buckets of a histogram of batch sizes, as `size:count' pairs.
+static std::string BatchesToString(const uint64_t *batches) {
+  std::string str;
+  for (size_t i = 0; i < juggler::stats::kBatchBuckets; i++) {
+    if (batches[i] == 0) continue;
+    if (!str.empty()) str += " ";
+    str += juggler::utils::Format(
+        "%s:%lu", juggler::stats::kBatchBucketNames[i], batches[i]);
+  }
+  return str.empty() ? "none" : str;
+}
+
+static std::string IpToString(uint32_t ip) {
+  return juggler::utils::Format("%u.%u.%u.%u", (ip >> 24) & 0xff,
+                                (ip >> 16) & 0xff, (ip >> 8) & 0xff,
+                                ip & 0xff);
+}
+
+// Read all the stats pages in shared memory, ordered by name.
+static std::vector<EngineSnapshot> ReadPages() {
+  std::vector<std::string> names;
+  std::error_code ec;
+  for (const auto &entry : std::filesystem::directory_iterator(kShmDir, ec)) {
+    const auto name = entry.path().filename().string();
+    if (name.starts_with(juggler::stats::kPageNamePrefix)) {
+      names.push_back(name);
+    }
+  }
+  std::sort(names.begin(), names.end());
+
+  std::vector<EngineSnapshot> engines;
+  for (const auto &name : names) {
+    auto reader = juggler::stats::StatsPageReader::Open(name);
+    if (reader == nullptr) continue;
+    EngineSnapshot engine{name, {}};
+    if (!reader->Read(&engine.snapshot)) {
+      LOG(WARNING) << "Could not take a consistent copy of " << name;
+      continue;
+    }
+    engines.push_back(std::move(engine));
+  }
+  return engines;
+}
+
+static void PrintTables(const std::vector<EngineSnapshot> &engines,
+                        std::ostream &out) {
+  for (const auto &engine : engines) {
+    const auto &h = engine.snapshot.header;
+    const auto &q = h.queue;
+    out << juggler::utils::Format(
+        "[%s] port %u rxq %u txq %u\n"
+        "  RX: %lu pkts, %lu bytes, %lu drops\n"
+        "  TX: %lu pkts, %lu bytes, %lu bursts, backlog %lu (%lu drops)\n"
+        "  busy cycles: %lu, NIC-timestamped RX pkts: %lu\n"
+        "  flows: %lu bytes, %lu compacted\n"
+        "  RTT: %lu samples, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, "
+        "max %.1f us\n",
+        engine.name.c_str(), q.port_id, q.rx_queue_id, q.tx_queue_id,
+        q.rx_packets, q.rx_bytes, q.rx_drops, q.tx_packets, q.tx_bytes,
+        q.tx_bursts, q.tx_backlog, q.tx_backlog_drops, q.busy_cycles,
+        q.rx_hw_timestamps, q.flow_memory_bytes, q.flows_compacted,
+        q.rtt_samples, q.rtt_p50_ns / 1E3, q.rtt_p99_ns / 1E3,
+        q.rtt_p999_ns / 1E3, q.rtt_max_ns / 1E3);
+    if (h.trace.sample_every != 0) {
+      out << "  trace (1 in " << h.trace.sample_every << " msgs):\n";
+      for (size_t i = 0; i < TraceStats::kNumStages; i++) {
+        const auto &t = h.trace.stages[i];
+        out << juggler::utils::Format(
+            "    %-12s %lu samples, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, "
+            "max %.1f us\n",
+            TraceStats::kStageNames[i], t.samples, t.p50_ns / 1E3,
+            t.p99_ns / 1E3, t.p999_ns / 1E3, t.max_ns / 1E3);
+      }
+    }
+    const auto &l = h.loop;
+    const auto loop_cycles = q.busy_cycles + l.empty_cycles;
+    out << juggler::utils::Format(
+        "  loop: %lu iterations, %lu empty, %.1f%% of cycles busy\n",
+        l.iterations, l.empty_iterations,
+        loop_cycles != 0 ? 100.0 * q.busy_cycles / loop_cycles : 0.0);
+    uint64_t stage_cycles = 0;
+    for (const auto cycles : l.stage_cycles) stage_cycles += cycles;
+    if (stage_cycles != 0) {
+      out << "    stages (1 in " << l.sample_every << " iterations):";
+      for (size_t i = 0; i < LoopStats::kNumStages; i++) {
+        out << juggler::utils::Format(
+            " %s %.1f%%", LoopStats::kStageNames[i],
+            100.0 * l.stage_cycles[i] / stage_cycles);
+      }
+      out << "\n";
+    }
+    out << "    rx batches: " << BatchesToString(l.rx_batches) << "\n";
+    out << "  pools:";
+    for (size_t i = 0; i < PoolsStats::kNumPools; i++) {
+      const auto &p = h.pools.pools[i];
+      if (p.capacity == 0) continue;
+      out << juggler::utils::Format(
+          " %s %u/%u free (min %u, %lu alloc failures)",
+          PoolsStats::kPoolNames[i], p.avail, p.capacity, p.min_avail,
+          p.alloc_failures);
+    }
+    out << "\n";
+    for (const auto &c : engine.snapshot.channels) {
+      out << juggler::utils::Format(
+          "  channel %s: rx %lu msgs, tx %lu msgs, buffers %u/%u free, "
+          "%u flows\n"
+          "    tx batches: %s\n",
+          c.name, c.rx_messages, c.tx_messages, c.free_buffers,
+          c.total_buffers, c.flows, BatchesToString(c.tx_batches).c_str());
+    }
+    if (h.channels_truncated != 0) {
+      out << "  (" << h.channels_truncated << " more channels)\n";
+    }
+    if (!FLAGS_flows) continue;
+    for (const auto &f : engine.snapshot.flows) {
+      out << juggler::utils::Format(
+          "  flow %s:%u -> %s:%u [%s]: cwnd %.2f, srtt %lu ns, snd_nxt %u, "
+          "snd_una %u, rcv_nxt %u, pending %u, fast rexmits %u, "
+          "rto rexmits %u, %u bytes\n",
+          IpToString(f.local_ip).c_str(), f.local_port,
+          IpToString(f.remote_ip).c_str(), f.remote_port,
+          FlowStateName(f.state), f.cwnd, f.srtt_ns, f.snd_nxt, f.snd_una,
+          f.rcv_nxt, f.pending_msgbufs, f.fast_rexmits, f.rto_rexmits,
+          f.memory_bytes);
+    }
+    if (h.flows_truncated != 0) {
+      out << "  (" << h.flows_truncated << " more flows)\n";
+    }
+  }
+}
+
+static void PrintPrometheus(const std::vector<EngineSnapshot> &engines,
+                            std::ostream &out) {
+  struct Metric {
+    const char *name;
+    const char *type;
+    const char *help;
+    uint64_t juggler::stats::QueueStats::*field;
+  };
+  using juggler::stats::QueueStats;
+  static constexpr Metric kQueueMetrics[] = {
+      {"rx_packets_total", "counter", "Packets received.",
+       &QueueStats::rx_packets},
+      {"rx_bytes_total", "counter", "Bytes received.", &QueueStats::rx_bytes},
+      {"rx_drops_total", "counter", "Received packets dropped by the engine.",
+       &QueueStats::rx_drops},
+      {"tx_packets_total", "counter", "Packets sent.",
+       &QueueStats::tx_packets},
+      {"tx_bytes_total", "counter", "Bytes sent.", &QueueStats::tx_bytes},
+      {"tx_bursts_total", "counter", "TX bursts to the NIC.",
+       &QueueStats::tx_bursts},
+      {"tx_backlog", "gauge", "Packets in the TX backlog.",
+       &QueueStats::tx_backlog},
+      {"tx_backlog_drops_total", "counter",
+       "Packets dropped as the TX backlog overflowed.",
+       &QueueStats::tx_backlog_drops},
+      {"busy_cycles_total", "counter", "TSC cycles spent doing work.",
+       &QueueStats::busy_cycles},
+      {"rx_hw_timestamps_total", "counter",
+       "Packets received with a NIC timestamp.",
+       &QueueStats::rx_hw_timestamps},
+      {"rtt_samples", "gauge", "RTT samples over the last interval.",
+       &QueueStats::rtt_samples},
+      {"flow_memory_bytes", "gauge", "Memory taken by the flows.",
+       &QueueStats::flow_memory_bytes},
+      {"flows_compacted_total", "counter",
+       "Idle flows whose per-packet state was released.",
+       &QueueStats::flows_compacted},
+  };
+
+  auto engine_labels = [](const Snapshot &s) {
+    return juggler::utils::Format("port=\"%u\",queue=\"%u\"",
+                                  s.header.queue.port_id,
+                                  s.header.queue.rx_queue_id);
+  };
+
+  for (const auto &metric : kQueueMetrics) {
+    out << "# HELP machnet_" << metric.name << " " << metric.help << "\n";
+    out << "# TYPE machnet_" << metric.name << " " << metric.type << "\n";
+    for (const auto &engine : engines) {
+      out << "machnet_" << metric.name << "{"
+          << engine_labels(engine.snapshot) << "} "
+          << engine.snapshot.header.queue.*metric.field << "\n";
+    }
+  }
+
+  out << "# HELP machnet_rtt_ns RTT percentiles over the last interval.\n"
+      << "# TYPE machnet_rtt_ns gauge\n";
+  for (const auto &engine : engines) {
+    const auto &q = engine.snapshot.header.queue;
+    if (q.rtt_samples == 0) continue;
+    const std::pair<const char *, uint64_t> quantiles[] = {
+        {"0", q.rtt_min_ns},      {"0.5", q.rtt_p50_ns},
+        {"0.99", q.rtt_p99_ns},   {"0.999", q.rtt_p999_ns},
+        {"1", q.rtt_max_ns}};
+    for (const auto &[quantile, value] : quantiles) {
+      out << "machnet_rtt_ns{" << engine_labels(engine.snapshot)
+          << ",quantile=\"" << quantile << "\"} " << value << "\n";
+    }
+  }
+
+  out << "# HELP machnet_trace_stage_ns Latency percentiles of the stages of "
+         "the traced messages over the last interval.\n"
+      << "# TYPE machnet_trace_stage_ns gauge\n";
+  for (const auto &engine : engines) {
+    const auto &trace = engine.snapshot.header.trace;
+    if (trace.sample_every == 0) continue;
+    for (size_t i = 0; i < TraceStats::kNumStages; i++) {
+      const auto &t = trace.stages[i];
+      if (t.samples == 0) continue;
+      const std::pair<const char *, uint64_t> quantiles[] = {
+          {"0.5", t.p50_ns}, {"0.99", t.p99_ns}, {"0.999", t.p999_ns},
+          {"1", t.max_ns}};
+      for (const auto &[quantile, value] : quantiles) {
+        out << "machnet_trace_stage_ns{" << engine_labels(engine.snapshot)
+            << ",stage=\"" << TraceStats::kStageNames[i] << "\",quantile=\""
+            << quantile << "\"} " << value << "\n";
+      }
+    }
+  }
+
+  out << "# HELP machnet_loop_iterations_total Iterations of the main loop.\n"
+      << "# TYPE machnet_loop_iterations_total counter\n";
+  for (const auto &engine : engines) {
+    const auto &l = engine.snapshot.header.loop;
+    out << "machnet_loop_iterations_total{" << engine_labels(engine.snapshot)
+        << ",kind=\"useful\"} " << l.iterations - l.empty_iterations << "\n";
+    out << "machnet_loop_iterations_total{" << engine_labels(engine.snapshot)
+        << ",kind=\"empty\"} " << l.empty_iterations << "\n";
+  }
+  out << "# HELP machnet_loop_empty_cycles_total TSC cycles spent in empty "
+         "iterations (estimated).\n"
+      << "# TYPE machnet_loop_empty_cycles_total counter\n";
+  for (const auto &engine : engines) {
+    out << "machnet_loop_empty_cycles_total{" << engine_labels(engine.snapshot)
+        << "} " << engine.snapshot.header.loop.empty_cycles << "\n";
+  }
+  out << "# HELP machnet_loop_stage_cycles_total TSC cycles spent in a stage "
+         "of the main loop (estimated).\n"
+      << "# TYPE machnet_loop_stage_cycles_total counter\n";
+  for (const auto &engine : engines) {
+    const auto &l = engine.snapshot.header.loop;
+    for (size_t i = 0; i < LoopStats::kNumStages; i++) {
+      out << "machnet_loop_stage_cycles_total{"
+          << engine_labels(engine.snapshot) << ",stage=\""
+          << LoopStats::kStageNames[i] << "\"} " << l.stage_cycles[i] << "\n";
+    }
+  }
+  out << "# HELP machnet_rx_batches_total Bursts of packets received, by "
+         "size.\n"
+      << "# TYPE machnet_rx_batches_total counter\n";
+  for (const auto &engine : engines) {
+    const auto &l = engine.snapshot.header.loop;
+    for (size_t i = 0; i < juggler::stats::kBatchBuckets; i++) {
+      out << "machnet_rx_batches_total{" << engine_labels(engine.snapshot)
+          << ",size=\"" << juggler::stats::kBatchBucketNames[i] << "\"} "
+          << l.rx_batches[i] << "\n";
+    }
+  }
+
+  out << "# HELP machnet_pool_packets Packets of a packet pool, by kind "
+         "(capacity, available, and the fewest available).\n"
+      << "# TYPE machnet_pool_packets gauge\n";
+  for (const auto &engine : engines) {
+    for (size_t i = 0; i < PoolsStats::kNumPools; i++) {
+      const auto &p = engine.snapshot.header.pools.pools[i];
+      if (p.capacity == 0) continue;
+      const auto labels = engine_labels(engine.snapshot) + ",pool=\"" +
+                          PoolsStats::kPoolNames[i] + "\"";
+      out << "machnet_pool_packets{" << labels << ",kind=\"capacity\"} "
+          << p.capacity << "\n";
+      out << "machnet_pool_packets{" << labels << ",kind=\"avail\"} "
+          << p.avail << "\n";
+      out << "machnet_pool_packets{" << labels << ",kind=\"min_avail\"} "
+          << p.min_avail << "\n";
+    }
+  }
+  out << "# HELP machnet_pool_alloc_failures_total Allocations that failed "
+         "for lack of packets in a pool.\n"
+      << "# TYPE machnet_pool_alloc_failures_total counter\n";
+  for (const auto &engine : engines) {
+    for (size_t i = 0; i < PoolsStats::kNumPools; i++) {
+      const auto &p = engine.snapshot.header.pools.pools[i];
+      if (p.capacity == 0) continue;
+      out << "machnet_pool_alloc_failures_total{"
+          << engine_labels(engine.snapshot) << ",pool=\""
+          << PoolsStats::kPoolNames[i] << "\"} " << p.alloc_failures << "\n";
+    }
+  }
+
+  out << "# HELP machnet_channel_messages_total Messages through a channel.\n"
+      << "# TYPE machnet_channel_messages_total counter\n";
+  for (const auto &engine : engines) {
+    for (const auto &c : engine.snapshot.channels) {
+      const auto labels = engine_labels(engine.snapshot) +
+                          ",channel=\"" + std::string(c.name) + "\"";
+      out << "machnet_channel_messages_total{" << labels
+          << ",direction=\"rx\"} " << c.rx_messages << "\n";
+      out << "machnet_channel_messages_total{" << labels
+          << ",direction=\"tx\"} " << c.tx_messages << "\n";
+    }
+  }
+  out << "# HELP machnet_channel_free_buffers Free buffers of a channel.\n"
+      << "# TYPE machnet_channel_free_buffers gauge\n";
+  for (const auto &engine : engines) {
+    for (const auto &c : engine.snapshot.channels) {
+      out << "machnet_channel_free_buffers{" << engine_labels(engine.snapshot)
+          << ",channel=\"" << c.name << "\"} " << c.free_buffers << "\n";
+    }
+  }
+  out << "# HELP machnet_channel_tx_batches_total Batches of messages "
+         "dequeued from a channel, by size.\n"
+      << "# TYPE machnet_channel_tx_batches_total counter\n";
+  for (const auto &engine : engines) {
+    for (const auto &c : engine.snapshot.channels) {
+      for (size_t i = 0; i < juggler::stats::kBatchBuckets; i++) {
+        out << "machnet_channel_tx_batches_total{"
+            << engine_labels(engine.snapshot) << ",channel=\"" << c.name
+            << "\",size=\"" << juggler::stats::kBatchBucketNames[i] << "\"} "
+            << c.tx_batches[i] << "\n";
+      }
+    }
+  }
+  out << "# HELP machnet_flows Flows of an engine.\n"
+      << "# TYPE machnet_flows gauge\n";
+  for (const auto &engine : engines) {
+    const auto &h = engine.snapshot.header;
+    out << "machnet_flows{" << engine_labels(engine.snapshot) << "} "
+        << h.nb_flows + h.flows_truncated << "\n";
+  }
+
+  if (!FLAGS_flows) return;
+  out << "# HELP machnet_flow_cwnd Congestion window of a flow.\n"
+      << "# TYPE machnet_flow_cwnd gauge\n"
+      << "# HELP machnet_flow_srtt_ns Smoothed RTT of a flow.\n"
+      << "# TYPE machnet_flow_srtt_ns gauge\n"
+      << "# HELP machnet_flow_pending_msgbufs Message buffers not yet sent.\n"
+      << "# TYPE machnet_flow_pending_msgbufs gauge\n";
+  for (const auto &engine : engines) {
+    for (const auto &f : engine.snapshot.flows) {
+      const auto labels = juggler::utils::Format(
+          "%s,local=\"%s:%u\",remote=\"%s:%u\"",
+          engine_labels(engine.snapshot).c_str(),
+          IpToString(f.local_ip).c_str(), f.local_port,
+          IpToString(f.remote_ip).c_str(), f.remote_port);
+      out << "machnet_flow_cwnd{" << labels << "} " << f.cwnd << "\n";
+      out << "machnet_flow_srtt_ns{" << labels << "} " << f.srtt_ns << "\n";
+      out << "machnet_flow_pending_msgbufs{" << labels << "} "
+          << f.pending_msgbufs << "\n";
+    }
+  }
+}
+
+static void Print(const std::vector<EngineSnapshot> &engines) {
+  std::ostringstream out;
+  if (FLAGS_prometheus) {
+    PrintPrometheus(engines, out);
+  } else {
+    PrintTables(engines, out);
+  }
+
+  if (FLAGS_output.empty()) {
+    std::fputs(out.str().c_str(), stdout);
+    std::fflush(stdout);
+    return;
+  }
+  const auto tmp = FLAGS_output + ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::trunc);
+    file << out.str();
+    if (!file) {
+      LOG(ERROR) << "Failed to write " << tmp;
+      return;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, FLAGS_output, ec);
+  LOG_IF(ERROR, ec) << "Failed to replace " << FLAGS_output << ": "
+                    << ec.message();
+}
+
+int main(int argc, char *argv[]) {
+  ::google::InitGoogleLogging(argv[0]);
+  gflags::SetUsageMessage("machnet_stats [--prometheus] [--interval=<s>]");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  FLAGS_logtostderr = 1;
+
+  signal(SIGINT, int_handler);
+  signal(SIGTERM, int_handler);
+
+  do {
+    Print(ReadPages());
+    for (uint32_t i = 0; i < FLAGS_interval * 10 && g_keep_running; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+  } while (FLAGS_interval != 0 && g_keep_running);
+
+  return 0;
+}
@@ -4,19 +4,27 @@
  * and receiving network messages using Machnet.
  */
 
+#include <bench_results.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <hdr/hdr_histogram.h>
 #include <machnet.h>
+#include <machnet_rpc.h>
 
+#include <algorithm>
 #include <chrono>
 #include <csignal>
 #include <cstdint>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <numeric>
+#include <random>
 #include <sstream>
+#include <string>
 #include <thread>
+#include <vector>
 
 using std::chrono::duration_cast;
 using std::chrono::high_resolution_clock;
@@ -30,11 +38,95 @@ DEFINE_uint32(msg_size, 64, "Size of the message (request/response) to send.");
 DEFINE_uint32(msg_window, 8, "Maximum number of messages in flight.");
 DEFINE_uint64(msg_nr, UINT64_MAX, "Number of messages to send.");
 DEFINE_bool(verify, false, "Verify payload of received messages.");
+DEFINE_uint32(num_threads, 1,
+              "Number of threads, each with its own channel. Server thread `i' "
+              "listens on `local_port' + i, and client thread `i' connects to "
+              "`remote_port' + i: run the server with at least as many.");
+DEFINE_uint32(num_flows, 1,
+              "Number of flows of each client thread (closed-loop, the window "
+              "slots are spread over them).");
+DEFINE_string(arrival, "closed",
+              "Arrivals of the client's requests: `closed' (keep `msg_window' "
+              "requests in flight per thread), or open-loop at `msg_rate', "
+              "`fixed' (evenly spaced) or `poisson'.");
+DEFINE_double(msg_rate, 10000,
+              "Open-loop request rate of each client thread, in messages per "
+              "second, spread over its flows in turn.");
+DEFINE_string(msg_size_dist, "",
+              "File with the distribution of the sizes of the client's "
+              "requests, instead of `msg_size': one `<size> <weight>' pair per "
+              "line (`#' starts a comment).");
+DEFINE_bool(rpc, false,
+            "Run the requests and responses over the RPC layer (see "
+            "`machnet_rpc.h'), rather than matching them in the application; "
+            "the client and the server must agree.");
+DEFINE_uint64(rpc_timeout_us, 1000000,
+              "With `rpc': time after which a request with no response is "
+              "given up on.");
+DEFINE_string(results, "",
+              "Client: file to append a summary of the run to, for sweeps over "
+              "the flags (CSV if it ends in `.csv', JSON lines otherwise).");
 
 static volatile int g_keep_running = 1;
 
 struct app_hdr_t {
+  // Window slot of the request (closed-loop), or index of its flow in its
+  // thread (open-loop).
   uint64_t window_slot;
+  // When the request was meant to be sent (open-loop), in nanoseconds of the
+  // client's clock (see `NowNs()'); echoed back by the server.
+  int64_t tx_ns;
+};
+
+// The clock of the latencies: the controller's calibration of the TSC, rather
+// than a system call per message.
+int64_t NowNs() { return static_cast<int64_t>(machnet_clock_ns()); }
+
+/**
+ * @brief Sizes of the requests: `--msg_size', or drawn from the distribution
+ * of `--msg_size_dist'.
+ */
+class SizeDistribution {
+ public:
+  SizeDistribution() {
+    if (FLAGS_msg_size_dist.empty()) {
+      sizes_.push_back(FLAGS_msg_size);
+      dist_ = std::discrete_distribution<size_t>({1.0});
+      return;
+    }
+    std::ifstream file(FLAGS_msg_size_dist);
+    CHECK(file.is_open()) << "Failed to open " << FLAGS_msg_size_dist;
+    std::vector<double> weights;
+    std::string line;
+    while (std::getline(file, line)) {
+      line = line.substr(0, line.find('#'));
+      std::istringstream fields(line);
+      uint32_t size;
+      double weight;
+      if (!(fields >> size)) continue;
+      CHECK(fields >> weight) << "Missing weight for size " << size;
+      CHECK_GE(size, sizeof(app_hdr_t)) << "Message size too small";
+      CHECK_LE(size, MACHNET_MSG_MAX_LEN) << "Message size too large";
+      CHECK_GE(weight, 0);
+      sizes_.push_back(size);
+      weights.push_back(weight);
+    }
+    CHECK(!sizes_.empty()) << "No sizes in " << FLAGS_msg_size_dist;
+    dist_ = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+  }
+
+  template <typename Rng>
+  uint32_t Sample(Rng *rng) {
+    return sizes_.size() == 1 ? sizes_[0] : sizes_[dist_(*rng)];
+  }
+
+  uint32_t Max() const {
+    return *std::max_element(sizes_.begin(), sizes_.end());
+  }
+
+ private:
+  std::vector<uint32_t> sizes_;
+  std::discrete_distribution<size_t> dist_;
 };
 
 struct stats_t {
@@ -48,18 +140,24 @@ struct stats_t {
 };
 
 class ThreadCtx {
- private:
+ public:
   static constexpr int64_t kMinLatencyMicros = 1;
   static constexpr int64_t kMaxLatencyMicros = 1000 * 1000 * 100;  // 100 sec
   static constexpr int64_t kLatencyPrecision = 2;  // Two significant digits
 
+ private:
   struct msg_latency_info_t {
-    time_point<high_resolution_clock> tx_ts;
+    int64_t tx_ns;
   };
 
  public:
-  ThreadCtx(const void *channel_ctx, const MachnetFlow_t *flow_info)
-      : channel_ctx(CHECK_NOTNULL(channel_ctx)), flow(flow_info), stats() {
+  ThreadCtx(const void *channel_ctx, std::vector<MachnetFlow_t> flows,
+            uint32_t thread_id)
+      : channel_ctx(CHECK_NOTNULL(channel_ctx)),
+        flows(std::move(flows)),
+        thread_id(thread_id),
+        rng(thread_id),
+        stats() {
     // Fill-in max-sized messages, we'll send the actual size later
     rx_message.resize(MACHNET_MSG_MAX_LEN);
     tx_message.resize(MACHNET_MSG_MAX_LEN);
@@ -72,34 +170,52 @@ class ThreadCtx {
     CHECK_EQ(ret, 0) << "Failed to initialize latency histogram.";
 
     msg_latency_info_vec.resize(FLAGS_msg_window);
+
+    // Latencies over the whole run, by flow.
+    flow_latency_hists.resize(this->flows.size());
+    for (auto &hist : flow_latency_hists) {
+      ret = hdr_init(kMinLatencyMicros, kMaxLatencyMicros, kLatencyPrecision,
+                     &hist);
+      CHECK_EQ(ret, 0) << "Failed to initialize latency histogram.";
+    }
+  }
+  ~ThreadCtx() {
+    hdr_close(latency_hist);
+    for (auto *hist : flow_latency_hists) hdr_close(hist);
   }
-  ~ThreadCtx() { hdr_close(latency_hist); }
 
   void RecordRequestStart(uint64_t window_slot) {
-    msg_latency_info_vec[window_slot].tx_ts = high_resolution_clock::now();
+    msg_latency_info_vec[window_slot].tx_ns = NowNs();
   }
 
   /// Return the request's latency in microseconds
   size_t RecordRequestEnd(uint64_t window_slot) {
     auto &msg_latency_info = msg_latency_info_vec[window_slot];
-    auto latency_us = duration_cast<std::chrono::microseconds>(
-                          high_resolution_clock::now() - msg_latency_info.tx_ts)
-                          .count();
+    const int64_t latency_us = (NowNs() - msg_latency_info.tx_ns) / 1000;
 
+    RecordLatency(window_slot % flows.size(), latency_us);
+    return latency_us;
+  }
+
+  void RecordLatency(size_t flow_index, int64_t latency_us) {
     hdr_record_value(latency_hist, latency_us);
+    hdr_record_value(flow_latency_hists[flow_index], latency_us);
     num_request_latency_samples++;
-    return latency_us;
   }
 
  public:
   const void *channel_ctx;
-  const MachnetFlow_t *flow;
+  const std::vector<MachnetFlow_t> flows;
+  const uint32_t thread_id;
+  std::mt19937_64 rng;
+  SizeDistribution sizes;
   std::vector<uint8_t> rx_message;
   std::vector<uint8_t> tx_message;
   std::vector<uint8_t> message_gold;
   hdr_histogram *latency_hist;
   size_t num_request_latency_samples;
   std::vector<msg_latency_info_t> msg_latency_info_vec;
+  std::vector<hdr_histogram *> flow_latency_hists;
 
   struct {
     stats_t current;
@@ -149,6 +265,9 @@ void ReportStats(ThreadCtx *thread_ctx) {
       drops_stats_ss << ", TX drops: " << msg_dropped;
     }
 
+    if (FLAGS_num_threads > 1) {
+      std::cout << "[Thread " << thread_ctx->thread_id << "] ";
+    }
     std::cout << "TX/RX (msg/sec, Gbps): (" << std::fixed
               << std::setprecision(1) << tx_kmps << "K/" << rx_kmps << "K"
               << std::fixed << std::setprecision(3) << ", " << tx_gbps << "/"
@@ -161,8 +280,8 @@ void ReportStats(ThreadCtx *thread_ctx) {
   }
 }
 
-void ServerLoop(void *channel_ctx) {
-  ThreadCtx thread_ctx(channel_ctx, nullptr /* flow info */);
+void ServerLoop(ThreadCtx *ctx) {
+  ThreadCtx &thread_ctx = *ctx;
   LOG(INFO) << "Server Loop: Starting.";
 
   while (true) {
@@ -189,7 +308,7 @@ void ServerLoop(void *channel_ctx) {
     // Send the response
     app_hdr_t *resp_hdr =
         reinterpret_cast<app_hdr_t *>(thread_ctx.tx_message.data());
-    resp_hdr->window_slot = req_hdr->window_slot;
+    *resp_hdr = *req_hdr;
 
     MachnetFlow_t tx_flow;
     tx_flow.dst_ip = rx_flow.src_ip;
@@ -220,18 +339,20 @@ void ServerLoop(void *channel_ctx) {
 void ClientSendOne(ThreadCtx *thread_ctx, uint64_t window_slot) {
   VLOG(1) << "Client: Sending message for window slot " << window_slot;
   auto &stats_cur = thread_ctx->stats.current;
-  thread_ctx->msg_latency_info_vec[window_slot].tx_ts =
-      high_resolution_clock::now();
+  thread_ctx->msg_latency_info_vec[window_slot].tx_ns = NowNs();
 
   app_hdr_t *req_hdr =
       reinterpret_cast<app_hdr_t *>(thread_ctx->tx_message.data());
   req_hdr->window_slot = window_slot;
 
-  const int ret = machnet_send(thread_ctx->channel_ctx, *thread_ctx->flow,
-                               thread_ctx->tx_message.data(), FLAGS_msg_size);
+  const auto &flow =
+      thread_ctx->flows[window_slot % thread_ctx->flows.size()];
+  const auto msg_size = thread_ctx->sizes.Sample(&thread_ctx->rng);
+  const int ret = machnet_send(thread_ctx->channel_ctx, flow,
+                               thread_ctx->tx_message.data(), msg_size);
   if (ret == 0) {
     stats_cur.tx_success++;
-    stats_cur.tx_bytes += FLAGS_msg_size;
+    stats_cur.tx_bytes += msg_size;
   } else {
     LOG(WARNING) << "Client: Failed to send message for window slot "
                  << window_slot;
@@ -239,6 +360,17 @@ void ClientSendOne(ThreadCtx *thread_ctx, uint64_t window_slot) {
   }
 }
 
+void VerifyPayload(const ThreadCtx *thread_ctx, ssize_t rx_size) {
+  for (uint32_t i = sizeof(app_hdr_t); i < rx_size; i++) {
+    if (thread_ctx->rx_message[i] != thread_ctx->message_gold[i]) {
+      LOG(ERROR) << "Message data mismatch at index " << i << std::hex << " "
+                 << static_cast<uint32_t>(thread_ctx->rx_message[i]) << " "
+                 << static_cast<uint32_t>(thread_ctx->message_gold[i]);
+      break;
+    }
+  }
+}
+
 // Return the window slot for which a response was received
 uint64_t ClientRecvOneBlocking(ThreadCtx *thread_ctx) {
   const auto *channel_ctx = thread_ctx->channel_ctx;
@@ -270,17 +402,7 @@ uint64_t ClientRecvOneBlocking(ThreadCtx *thread_ctx) {
     VLOG(1) << "Client: Received message for window slot "
             << resp_hdr->window_slot << " in " << latency_us << " us";
 
-    if (FLAGS_verify) {
-      for (uint32_t i = sizeof(app_hdr_t); i < rx_size; i++) {
-        if (thread_ctx->rx_message[i] != thread_ctx->message_gold[i]) {
-          LOG(ERROR) << "Message data mismatch at index " << i << std::hex
-                     << " " << static_cast<uint32_t>(thread_ctx->rx_message[i])
-                     << " "
-                     << static_cast<uint32_t>(thread_ctx->message_gold[i]);
-          break;
-        }
-      }
-    }
+    if (FLAGS_verify) VerifyPayload(thread_ctx, rx_size);
 
     return resp_hdr->window_slot;
   }
@@ -289,8 +411,8 @@ uint64_t ClientRecvOneBlocking(ThreadCtx *thread_ctx) {
   return 0;
 }
 
-void ClientLoop(void *channel_ctx, MachnetFlow *flow) {
-  ThreadCtx thread_ctx(channel_ctx, flow);
+void ClientLoop(ThreadCtx *ctx) {
+  ThreadCtx &thread_ctx = *ctx;
   LOG(INFO) << "Client Loop: Starting.";
 
   // Send a full window of messages
@@ -318,6 +440,316 @@ void ClientLoop(void *channel_ctx, MachnetFlow *flow) {
             << stats_cur.rx_bytes << " Bytes)";
 }
 
+// Send a request over flow `flow_index', meant to go out at `tx_ns'. Return
+// false if the channel is full, for the caller to retry.
+bool ClientSendOpenLoop(ThreadCtx *thread_ctx, size_t flow_index,
+                        int64_t tx_ns) {
+  auto *req_hdr = reinterpret_cast<app_hdr_t *>(thread_ctx->tx_message.data());
+  req_hdr->window_slot = flow_index;
+  req_hdr->tx_ns = tx_ns;
+
+  const auto msg_size = thread_ctx->sizes.Sample(&thread_ctx->rng);
+  const int ret =
+      machnet_send(thread_ctx->channel_ctx, thread_ctx->flows[flow_index],
+                   thread_ctx->tx_message.data(), msg_size);
+  if (ret != 0) return false;
+  thread_ctx->stats.current.tx_success++;
+  thread_ctx->stats.current.tx_bytes += msg_size;
+  return true;
+}
+
+// Receive the responses that have arrived, up to a burst; return how many.
+uint32_t ClientRecvOpenLoop(ThreadCtx *thread_ctx, uint32_t max_nr) {
+  uint32_t n = 0;
+  for (; n < max_nr; n++) {
+    MachnetFlow_t rx_flow;
+    const ssize_t rx_size =
+        machnet_recv(thread_ctx->channel_ctx, thread_ctx->rx_message.data(),
+                     thread_ctx->rx_message.size(), &rx_flow);
+    if (rx_size <= 0) break;
+    const auto now_ns = NowNs();
+    thread_ctx->stats.current.rx_count++;
+    thread_ctx->stats.current.rx_bytes += rx_size;
+
+    const auto *resp_hdr =
+        reinterpret_cast<const app_hdr_t *>(thread_ctx->rx_message.data());
+    if (resp_hdr->window_slot >= thread_ctx->flows.size()) {
+      LOG(ERROR) << "Received invalid flow index: " << resp_hdr->window_slot;
+      continue;
+    }
+    // From when the request was meant to be sent, not when it was: the
+    // requests held back by a slow system count its slowness too.
+    thread_ctx->RecordLatency(resp_hdr->window_slot,
+                              (now_ns - resp_hdr->tx_ns) / 1000);
+    if (FLAGS_verify) VerifyPayload(thread_ctx, rx_size);
+  }
+  return n;
+}
+
+// Send requests at `--msg_rate', evenly spaced or as a Poisson process,
+// regardless of the responses, over the flows of the thread in turn.
+//
+// The latencies are corrected for coordinated omission: each request is
+// stamped with its intended send time, which does not slip when the client
+// falls behind (e.g., while the channel is full), so that the requests it
+// could not send on time are not left out of the tail.
+void OpenLoopClientLoop(ThreadCtx *ctx) {
+  // Sends per iteration, before the responses are polled for.
+  static constexpr uint32_t kMaxBurst = 32;
+  ThreadCtx &thread_ctx = *ctx;
+  LOG(INFO) << "Open-loop Client Loop: Starting.";
+
+  const bool poisson = FLAGS_arrival == "poisson";
+  const double mean_gap_ns = 1E9 / FLAGS_msg_rate;
+  std::exponential_distribution<double> gap_ns(1.0 / mean_gap_ns);
+  double next_ns = NowNs();
+  size_t next_flow = 0;
+  uint64_t nr_sent = 0;
+
+  while (g_keep_running) {
+    const auto now_ns = NowNs();
+    for (uint32_t i = 0; i < kMaxBurst && next_ns <= now_ns; i++) {
+      if (nr_sent == FLAGS_msg_nr) break;
+      if (!ClientSendOpenLoop(&thread_ctx, next_flow,
+                              static_cast<int64_t>(next_ns))) {
+        break;  // Retried next time, with the same intended send time.
+      }
+      nr_sent++;
+      next_flow = (next_flow + 1) % thread_ctx.flows.size();
+      next_ns += poisson ? gap_ns(thread_ctx.rng) : mean_gap_ns;
+    }
+    ClientRecvOpenLoop(&thread_ctx, kMaxBurst);
+
+    ReportStats(&thread_ctx);
+  }
+
+  auto &stats_cur = thread_ctx.stats.current;
+  LOG(INFO) << "Application Statistics (TOTAL) - [TX] Sent: "
+            << stats_cur.tx_success << " (" << stats_cur.tx_bytes
+            << " Bytes), [RX] Received: " << stats_cur.rx_count << " ("
+            << stats_cur.rx_bytes << " Bytes)";
+}
+
+// The request type of `msg_gen' over the RPC layer.
+static constexpr uint8_t kRpcMsgGen = 1;
+
+// An RPC endpoint on the channel of a thread, for messages of up to the largest
+// request or response.
+std::unique_ptr<juggler::rpc::Endpoint> NewRpcEndpoint(ThreadCtx *thread_ctx) {
+  juggler::rpc::Options options;
+  options.slots = std::max<uint32_t>(FLAGS_msg_window, 256);
+  options.max_msg_size = sizeof(juggler::rpc::Header) +
+                         std::max(FLAGS_msg_size, thread_ctx->sizes.Max());
+  options.timeout_ns = FLAGS_rpc_timeout_us * 1000;
+  return std::make_unique<juggler::rpc::Endpoint>(
+      const_cast<void *>(thread_ctx->channel_ctx), options);
+}
+
+void RpcRecordResponse(ThreadCtx *thread_ctx,
+                       const juggler::rpc::Result &result) {
+  auto &stats_cur = thread_ctx->stats.current;
+  if (result.status != juggler::rpc::Status::kOk) {
+    stats_cur.err_tx_drops++;
+    return;
+  }
+  stats_cur.rx_count++;
+  stats_cur.rx_bytes += result.payload.size();
+  if (FLAGS_verify &&
+      !std::equal(result.payload.begin(), result.payload.end(),
+                  thread_ctx->message_gold.begin())) {
+    LOG(ERROR) << "Response data mismatch";
+  }
+}
+
+// The server over the RPC layer: the responses are sent from `tx_message',
+// without copying it into the endpoint.
+void RpcServerLoop(ThreadCtx *ctx) {
+  ThreadCtx &thread_ctx = *ctx;
+  LOG(INFO) << "RPC Server Loop: Starting.";
+  auto endpoint = NewRpcEndpoint(&thread_ctx);
+  endpoint->Register(
+      kRpcMsgGen, [&thread_ctx](const juggler::rpc::Request &request,
+                                juggler::rpc::Response *response) {
+        auto &stats_cur = thread_ctx.stats.current;
+        stats_cur.rx_count++;
+        stats_cur.rx_bytes += request.payload.size();
+        response->Reference(thread_ctx.tx_message.data(), FLAGS_msg_size);
+        stats_cur.tx_success++;
+        stats_cur.tx_bytes += FLAGS_msg_size;
+      });
+
+  while (g_keep_running) {
+    endpoint->Poll();
+    ReportStats(&thread_ctx);
+  }
+  LOG(INFO) << "Application Statistics (TOTAL) - [RPC] Requests: "
+            << endpoint->stats().requests
+            << ", invalid messages: " << endpoint->stats().rx_invalid;
+}
+
+// A window slot of the closed-loop client over the RPC layer: a coroutine
+// that issues a request whenever the previous one completes.
+juggler::rpc::Task RpcClosedLoopSlot(ThreadCtx *thread_ctx,
+                                     juggler::rpc::Endpoint *endpoint,
+                                     uint64_t window_slot, uint64_t *nr_sent) {
+  const auto &flow = thread_ctx->flows[window_slot % thread_ctx->flows.size()];
+  while (g_keep_running && *nr_sent < FLAGS_msg_nr) {
+    const auto msg_size = thread_ctx->sizes.Sample(&thread_ctx->rng);
+    const int64_t tx_ns = NowNs();
+    (*nr_sent)++;
+    thread_ctx->stats.current.tx_success++;
+    thread_ctx->stats.current.tx_bytes += msg_size;
+    const auto result = co_await endpoint->AsyncCall(
+        flow, kRpcMsgGen, {thread_ctx->tx_message.data(), msg_size});
+    if (result.status == juggler::rpc::Status::kOk) {
+      thread_ctx->RecordLatency(window_slot % thread_ctx->flows.size(),
+                                (NowNs() - tx_ns) / 1000);
+    }
+    RpcRecordResponse(thread_ctx, result);
+  }
+}
+
+void RpcClientLoop(ThreadCtx *ctx) {
+  ThreadCtx &thread_ctx = *ctx;
+  LOG(INFO) << "RPC Client Loop: Starting.";
+  auto endpoint = NewRpcEndpoint(&thread_ctx);
+  uint64_t nr_sent = 0;
+  for (uint32_t i = 0; i < FLAGS_msg_window; i++) {
+    RpcClosedLoopSlot(&thread_ctx, endpoint.get(), i, &nr_sent);
+  }
+  // The pending calls complete (or time out) before the endpoint goes away.
+  while (g_keep_running || endpoint->GetPendingCount() != 0) {
+    endpoint->Poll();
+    ReportStats(&thread_ctx);
+  }
+  LOG(INFO) << "Application Statistics (TOTAL) - [RPC] Calls: "
+            << endpoint->stats().calls
+            << ", completed: " << endpoint->stats().completions
+            << ", timed out: " << endpoint->stats().timeouts;
+}
+
+// The open-loop client over the RPC layer (see `OpenLoopClientLoop()').
+void RpcOpenLoopClientLoop(ThreadCtx *ctx) {
+  static constexpr uint32_t kMaxBurst = 32;
+  ThreadCtx &thread_ctx = *ctx;
+  LOG(INFO) << "RPC Open-loop Client Loop: Starting.";
+  auto endpoint = NewRpcEndpoint(&thread_ctx);
+
+  const bool poisson = FLAGS_arrival == "poisson";
+  const double mean_gap_ns = 1E9 / FLAGS_msg_rate;
+  std::exponential_distribution<double> gap_ns(1.0 / mean_gap_ns);
+  double next_ns = NowNs();
+  size_t next_flow = 0;
+  uint64_t nr_sent = 0;
+
+  while (g_keep_running || endpoint->GetPendingCount() != 0) {
+    const auto now_ns = NowNs();
+    for (uint32_t i = 0; g_keep_running && i < kMaxBurst && next_ns <= now_ns;
+         i++) {
+      if (nr_sent == FLAGS_msg_nr) break;
+      const auto msg_size = thread_ctx.sizes.Sample(&thread_ctx.rng);
+      const auto tx_ns = static_cast<int64_t>(next_ns);
+      const bool called = endpoint->Call(
+          thread_ctx.flows[next_flow], kRpcMsgGen,
+          {thread_ctx.tx_message.data(), msg_size},
+          [ctx, next_flow, tx_ns](const juggler::rpc::Result &result) {
+            if (result.status == juggler::rpc::Status::kOk) {
+              ctx->RecordLatency(next_flow, (NowNs() - tx_ns) / 1000);
+            }
+            RpcRecordResponse(ctx, result);
+          });
+      if (!called) break;  // Retried next time, as in `OpenLoopClientLoop()'.
+      thread_ctx.stats.current.tx_success++;
+      thread_ctx.stats.current.tx_bytes += msg_size;
+      nr_sent++;
+      next_flow = (next_flow + 1) % thread_ctx.flows.size();
+      next_ns += poisson ? gap_ns(thread_ctx.rng) : mean_gap_ns;
+    }
+    endpoint->Poll();
+
+    ReportStats(&thread_ctx);
+  }
+  LOG(INFO) << "Application Statistics (TOTAL) - [RPC] Calls: "
+            << endpoint->stats().calls
+            << ", completed: " << endpoint->stats().completions
+            << ", timed out: " << endpoint->stats().timeouts;
+}
+
+// Print the latency percentiles of each flow over the whole run, and of all of
+// them.
+void ReportFlowLatencies(
+    const std::vector<std::unique_ptr<ThreadCtx>> &thread_ctxs) {
+  hdr_histogram *total;
+  CHECK_EQ(hdr_init(ThreadCtx::kMinLatencyMicros, ThreadCtx::kMaxLatencyMicros,
+                    ThreadCtx::kLatencyPrecision, &total),
+           0);
+  auto print = [](const std::string &name, const hdr_histogram *hist) {
+    std::cout << name << " RTT (p50/99/99.9 us): ";
+    if (hist->total_count == 0) {
+      std::cout << "N/A" << std::endl;
+      return;
+    }
+    std::cout << hdr_value_at_percentile(hist, 50.0) << "/"
+              << hdr_value_at_percentile(hist, 99.0) << "/"
+              << hdr_value_at_percentile(hist, 99.9) << " ("
+              << hist->total_count << " samples)" << std::endl;
+  };
+  for (const auto &thread_ctx : thread_ctxs) {
+    for (size_t i = 0; i < thread_ctx->flows.size(); i++) {
+      const auto &flow = thread_ctx->flows[i];
+      const auto *hist = thread_ctx->flow_latency_hists[i];
+      print("[Thread " + std::to_string(thread_ctx->thread_id) + ", flow " +
+                std::to_string(flow.src_port) + " -> " +
+                std::to_string(flow.dst_port) + "]",
+            hist);
+      hdr_add(total, hist);
+    }
+  }
+  print("[All flows]", total);
+  hdr_close(total);
+}
+
+// Append a summary of the run of a client to `--results': its configuration,
+// the rate of responses, and the latency percentiles over all the flows.
+void AppendResults(const std::vector<std::unique_ptr<ThreadCtx>> &thread_ctxs,
+                   double elapsed_s) {
+  hdr_histogram *total;
+  CHECK_EQ(hdr_init(ThreadCtx::kMinLatencyMicros, ThreadCtx::kMaxLatencyMicros,
+                    ThreadCtx::kLatencyPrecision, &total),
+           0);
+  uint64_t responses = 0, rx_bytes = 0;
+  for (const auto &thread_ctx : thread_ctxs) {
+    for (const auto *hist : thread_ctx->flow_latency_hists) {
+      hdr_add(total, hist);
+    }
+    responses += thread_ctx->stats.current.rx_count;
+    rx_bytes += thread_ctx->stats.current.rx_bytes;
+  }
+  auto percentile = [total](double p) -> uint64_t {
+    return total->total_count != 0 ? hdr_value_at_percentile(total, p) : 0;
+  };
+  juggler::BenchResults results;
+  results.Add({{"arrival", FLAGS_arrival},
+               {"msg_size", uint64_t{FLAGS_msg_size}},
+               {"msg_size_dist", FLAGS_msg_size_dist},
+               {"msg_window", uint64_t{FLAGS_msg_window}},
+               {"msg_rate", FLAGS_msg_rate},
+               {"num_threads", uint64_t{FLAGS_num_threads}},
+               {"num_flows", uint64_t{FLAGS_num_flows}},
+               {"seconds", elapsed_s},
+               {"responses", responses},
+               {"rps", responses / elapsed_s},
+               {"rx_gbps", rx_bytes * 8 / elapsed_s / 1E9},
+               {"rtt_p50_us", percentile(50.0)},
+               {"rtt_p99_us", percentile(99.0)},
+               {"rtt_p999_us", percentile(99.9)},
+               {"rtt_max_us", static_cast<uint64_t>(hdr_max(total))}});
+  hdr_close(total);
+  if (results.Append(FLAGS_results)) {
+    LOG(INFO) << "Results appended to " << FLAGS_results;
+  }
+}
+
 int main(int argc, char *argv[]) {
   ::google::InitGoogleLogging(argv[0]);
   gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -326,45 +758,83 @@ int main(int argc, char *argv[]) {
   FLAGS_logtostderr = 1;
 
   CHECK_GT(FLAGS_msg_size, sizeof(app_hdr_t)) << "Message size too small";
-  if (FLAGS_remote_ip == "") {
+  CHECK_GT(FLAGS_num_threads, 0);
+  CHECK_GT(FLAGS_num_flows, 0);
+  CHECK(FLAGS_arrival == "closed" || FLAGS_arrival == "fixed" ||
+        FLAGS_arrival == "poisson")
+      << "Invalid arrival process: " << FLAGS_arrival;
+  CHECK_GT(FLAGS_msg_rate, 0);
+  const bool client = FLAGS_remote_ip != "";
+  if (!client) {
     LOG(INFO) << "Starting in server mode, response size " << FLAGS_msg_size;
   } else {
-    LOG(INFO) << "Starting in client mode, request size " << FLAGS_msg_size;
+    LOG(INFO) << "Starting in client mode, request size " << FLAGS_msg_size
+              << ", " << FLAGS_arrival << " arrivals";
   }
 
   CHECK_EQ(machnet_init(), 0) << "Failed to initialize Machnet library.";
-  void *channel_ctx = machnet_attach();
-  CHECK_NOTNULL(channel_ctx);
-
-  MachnetFlow_t flow;
-  std::thread datapath_thread;
-  if (FLAGS_remote_ip != "") {
-    // Client-mode
-    int ret =
-        machnet_connect(channel_ctx, FLAGS_local_ip.c_str(),
-                        FLAGS_remote_ip.c_str(), FLAGS_remote_port, &flow);
-    CHECK(ret == 0) << "Failed to connect to remote host. machnet_connect() "
-                       "error: "
-                    << strerror(ret);
-
-    LOG(INFO) << "[CONNECTED] [" << FLAGS_local_ip << ":" << flow.src_port
-              << " <-> " << FLAGS_remote_ip << ":" << flow.dst_port << "]";
-
-    datapath_thread = std::thread(ClientLoop, channel_ctx, &flow);
-  } else {
-    int ret =
-        machnet_listen(channel_ctx, FLAGS_local_ip.c_str(), FLAGS_local_port);
-    CHECK(ret == 0)
-        << "Failed to listen on local port. machnet_listen() error: "
-        << strerror(ret);
-
-    LOG(INFO) << "[LISTENING] [" << FLAGS_local_ip << ":" << FLAGS_local_port
-              << "]";
+  std::vector<std::unique_ptr<ThreadCtx>> thread_ctxs;
+  for (uint32_t t = 0; t < FLAGS_num_threads; t++) {
+    void *channel_ctx = machnet_attach();
+    CHECK_NOTNULL(channel_ctx);
+
+    std::vector<MachnetFlow_t> flows;
+    if (client) {
+      // Each connection takes a round of the control path of the engine
+      // (about a second): many flows take a while to set up.
+      const auto remote_port = FLAGS_remote_port + t;
+      for (uint32_t f = 0; f < FLAGS_num_flows; f++) {
+        MachnetFlow_t flow;
+        int ret = machnet_connect(channel_ctx, FLAGS_local_ip.c_str(),
+                                  FLAGS_remote_ip.c_str(), remote_port, &flow);
+        CHECK(ret == 0) << "Failed to connect to remote host. "
+                           "machnet_connect() error: "
+                        << strerror(ret);
+
+        LOG(INFO) << "[CONNECTED] [" << FLAGS_local_ip << ":" << flow.src_port
+                  << " <-> " << FLAGS_remote_ip << ":" << flow.dst_port << "]";
+        flows.push_back(flow);
+      }
+    } else {
+      const auto local_port = FLAGS_local_port + t;
+      int ret =
+          machnet_listen(channel_ctx, FLAGS_local_ip.c_str(), local_port);
+      CHECK(ret == 0)
+          << "Failed to listen on local port. machnet_listen() error: "
+          << strerror(ret);
+
+      LOG(INFO) << "[LISTENING] [" << FLAGS_local_ip << ":" << local_port
+                << "]";
+    }
+    thread_ctxs.emplace_back(
+        std::make_unique<ThreadCtx>(channel_ctx, std::move(flows), t));
+  }
 
-    datapath_thread = std::thread(ServerLoop, channel_ctx);
+  const auto start = high_resolution_clock::now();
+  std::vector<std::thread> datapath_threads;
+  for (auto &thread_ctx : thread_ctxs) {
+    if (FLAGS_rpc) {
+      datapath_threads.emplace_back(
+          !client                    ? RpcServerLoop
+          : FLAGS_arrival == "closed" ? RpcClientLoop
+                                      : RpcOpenLoopClientLoop,
+          thread_ctx.get());
+    } else if (!client) {
+      datapath_threads.emplace_back(ServerLoop, thread_ctx.get());
+    } else if (FLAGS_arrival == "closed") {
+      datapath_threads.emplace_back(ClientLoop, thread_ctx.get());
+    } else {
+      datapath_threads.emplace_back(OpenLoopClientLoop, thread_ctx.get());
+    }
   }
 
   while (g_keep_running) sleep(5);
-  datapath_thread.join();
+  for (auto &thread : datapath_threads) thread.join();
+  const std::chrono::duration<double> elapsed =
+      high_resolution_clock::now() - start;
+  if (client) ReportFlowLatencies(thread_ctxs);
+  if (client && !FLAGS_results.empty()) {
+    AppendResults(thread_ctxs, elapsed.count());
+  }
   return 0;
 }
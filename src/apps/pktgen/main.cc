@@ -16,9 +16,20 @@
 #include <utils.h>
 #include <worker.h>
 
+#include <rte_thash.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <csignal>
 #include <iostream>
+#include <memory>
 #include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "ttime.h"
@@ -44,6 +55,21 @@ DEFINE_bool(active_generator, false,
             "bouncing.");
 DEFINE_bool(zerocopy, true, "Use memcpy to fill packet payload.");
 DEFINE_string(rtt_log, "", "Log file for RTT measurements.");
+DEFINE_uint32(num_queues, 1,
+              "Number of RX/TX queue pairs of the port, each driven by a "
+              "worker thread of its own (on the `cores' of the config, if "
+              "set).");
+DEFINE_string(pkt_size_dist, "",
+              "Sizes of the packets to generate, instead of `pkt_size': "
+              "`imix' (64, 576 and 1500 bytes, 7:4:1), or a list of "
+              "`size:weight' pairs (e.g., `64:7,576:4,1500:1').");
+DEFINE_double(tx_rate_mpps, 0,
+              "Rate to generate packets at, in Mpps over all the queues (0: "
+              "as fast as possible).");
+DEFINE_uint32(flows_per_queue, 1,
+              "Number of flows (UDP source ports) each queue generates, "
+              "picked for RSS to land them on the same queue index at both "
+              "ends.");
 
 // This is the source/destination UDP port used by the application.
 const uint16_t kAppUDPPort = 6666;
@@ -52,23 +78,56 @@ static volatile int g_keep_running = 1;
 
 void int_handler([[maybe_unused]] int signal) { g_keep_running = 0; }
 
+// Number of entries of the table of packet sizes of each queue; a power of two.
+constexpr size_t kPacketSizesNr = 1 << 10;
+// Bytes each packet takes on the wire beyond its frame: preamble, start of
+// frame delimiter, CRC and inter-frame gap.
+constexpr uint64_t kL1OverheadBytes = 24;
+
 // Structure to keep application statistics related to TX and RX packets/errors.
+// Each worker updates its own, and the main thread reports them.
 struct stats {
-  stats()
-      : tx_success(0),
-        tx_bytes(0),
-        rx_count(0),
-        rx_bytes(0),
-        err_no_mbufs(0),
-        err_tx_drops(0) {}
-  uint64_t tx_success;
-  uint64_t tx_bytes;
-  uint64_t rx_count;
-  uint64_t rx_bytes;
-  uint64_t err_no_mbufs;
-  uint64_t err_tx_drops;
+  std::atomic<uint64_t> tx_success{0};
+  std::atomic<uint64_t> tx_bytes{0};
+  std::atomic<uint64_t> rx_count{0};
+  std::atomic<uint64_t> rx_bytes{0};
+  std::atomic<uint64_t> err_no_mbufs{0};
+  std::atomic<uint64_t> err_tx_drops{0};
+};
+
+// A point-in-time copy of `stats', or the sum over several of them.
+struct stats_snapshot {
+  stats_snapshot() = default;
+  explicit stats_snapshot(const stats &st)
+      : tx_success(st.tx_success.load(std::memory_order_relaxed)),
+        tx_bytes(st.tx_bytes.load(std::memory_order_relaxed)),
+        rx_count(st.rx_count.load(std::memory_order_relaxed)),
+        rx_bytes(st.rx_bytes.load(std::memory_order_relaxed)),
+        err_no_mbufs(st.err_no_mbufs.load(std::memory_order_relaxed)),
+        err_tx_drops(st.err_tx_drops.load(std::memory_order_relaxed)) {}
+  stats_snapshot &operator+=(const stats_snapshot &other) {
+    tx_success += other.tx_success;
+    tx_bytes += other.tx_bytes;
+    rx_count += other.rx_count;
+    rx_bytes += other.rx_bytes;
+    err_no_mbufs += other.err_no_mbufs;
+    err_tx_drops += other.err_tx_drops;
+    return *this;
+  }
+  uint64_t tx_success{0};
+  uint64_t tx_bytes{0};
+  uint64_t rx_count{0};
+  uint64_t rx_bytes{0};
+  uint64_t err_no_mbufs{0};
+  uint64_t err_tx_drops{0};
 };
 
+// Add to a counter of `stats'; only its worker writes it.
+static inline void stats_add(std::atomic<uint64_t> *counter, uint64_t n) {
+  counter->store(counter->load(std::memory_order_relaxed) + n,
+                 std::memory_order_relaxed);
+}
+
 /**
  * @brief This structure contains all the metadata required for all the routines
  * implemented in this application.
@@ -84,45 +143,173 @@ struct task_context {
    * @param remote_ip (std::optional) Remote host's IP address to be used by the
    * applicaton in `juggler::net::Ipv4::Address` format. `std::nullopt` in
    * passive mode.
-   * @param packet_size Size of the packets to be generated.
+   * @param packet_size Size of the packets to be generated (the largest,
+   * with a distribution of sizes).
+   * @param packet_sizes Sizes of the packets to be generated, in turn; the
+   * number of entries must be a power of two.
+   * @param src_ports UDP source ports of the packets to be generated, in
+   * turn (i.e., the flows of the queue).
+   * @param tx_pps Rate to generate packets at, in packets per second (0: as
+   * fast as possible).
    * @param rxring Pointer to the RX ring previously initialized.
    * @param txring Pointer to the TX ring previously initialized.
+   * @param payloads Payloads to copy into the packets (shared with the other
+   * queues); empty with `--zerocopy'.
    */
   task_context(juggler::net::Ethernet::Address local_mac,
                juggler::net::Ipv4::Address local_ip,
                std::optional<juggler::net::Ethernet::Address> remote_mac,
                std::optional<juggler::net::Ipv4::Address> remote_ip,
-               uint16_t packet_size, juggler::dpdk::RxRing *rxring,
-               juggler::dpdk::TxRing *txring,
-               std::vector<std::vector<uint8_t>> payloads)
+               uint16_t packet_size, std::vector<uint16_t> packet_sizes,
+               std::vector<uint16_t> src_ports, double tx_pps,
+               juggler::dpdk::RxRing *rxring, juggler::dpdk::TxRing *txring,
+               const std::vector<std::vector<uint8_t>> &payloads)
       : local_mac_addr(local_mac),
         local_ipv4_addr(local_ip),
         remote_mac_addr(remote_mac),
         remote_ipv4_addr(remote_ip),
         packet_size(packet_size),
+        packet_sizes(std::move(packet_sizes)),
+        src_ports(std::move(src_ports)),
+        tx_pps(tx_pps),
         rx_ring(CHECK_NOTNULL(rxring)),
         tx_ring(CHECK_NOTNULL(txring)),
         packet_payloads(payloads),
         arp_handler(local_mac, {local_ip}),
         statistics(),
-        rtt_log() {}
+        rtt_log() {
+    CHECK(juggler::utils::is_power_of_two(this->packet_sizes.size()));
+    CHECK(!this->src_ports.empty());
+  }
   const juggler::net::Ethernet::Address local_mac_addr;
   const juggler::net::Ipv4::Address local_ipv4_addr;
   const std::optional<juggler::net::Ethernet::Address> remote_mac_addr;
   const std::optional<juggler::net::Ipv4::Address> remote_ipv4_addr;
   const uint16_t packet_size;
+  const std::vector<uint16_t> packet_sizes;
+  const std::vector<uint16_t> src_ports;
+  const double tx_pps;
 
   juggler::dpdk::PacketPool *packet_pool;
   juggler::dpdk::RxRing *rx_ring;
   juggler::dpdk::TxRing *tx_ring;
 
-  std::vector<std::vector<uint8_t>> packet_payloads;
+  const std::vector<std::vector<uint8_t>> &packet_payloads;
   juggler::ArpHandler arp_handler;
 
+  // Rate limiting of the generator (see `tx()'): TSC cycles per batch, and
+  // when the next batch is due.
+  uint64_t tx_batch_cycles{0};
+  uint64_t next_tx_tsc{0};
+
   stats statistics;
   juggler::utils::TimeLog rtt_log;
 };
 
+/**
+ * @brief Parse the distribution of the sizes of the packets to generate (see
+ * `--pkt_size_dist'), as `(size, weight)' pairs.
+ */
+std::optional<std::vector<std::pair<uint16_t, uint32_t>>> ParseSizeDist(
+    const std::string &spec) {
+  if (spec == "imix") return {{{64, 7}, {576, 4}, {1500, 1}}};
+  std::vector<std::pair<uint16_t, uint32_t>> dist;
+  std::stringstream ss(spec);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    const auto colon = item.find(':');
+    if (colon == std::string::npos) return std::nullopt;
+    const auto size = std::strtoul(item.substr(0, colon).c_str(), nullptr, 10);
+    const auto weight = std::strtoul(item.substr(colon + 1).c_str(), nullptr,
+                                     10);
+    if (size == 0 || size > UINT16_MAX || weight == 0) return std::nullopt;
+    dist.emplace_back(size, weight);
+  }
+  if (dist.empty()) return std::nullopt;
+  return dist;
+}
+
+/**
+ * @brief Lay out a distribution of packet sizes in a table of
+ * `kPacketSizesNr' entries, in proportion to their weights and shuffled, for
+ * the generator to go through in turn.
+ *
+ * @param dist The `(size, weight)' pairs of the distribution; the sizes are
+ * clamped to `[min_size, max_size]'.
+ * @param seed Seed of the shuffle (e.g., the queue).
+ */
+std::vector<uint16_t> MakePacketSizes(
+    const std::vector<std::pair<uint16_t, uint32_t>> &dist, uint16_t min_size,
+    uint16_t max_size, uint64_t seed) {
+  uint64_t total_weight = 0;
+  for (const auto &[size, weight] : dist) total_weight += weight;
+  std::vector<uint16_t> sizes;
+  sizes.reserve(kPacketSizesNr);
+  uint64_t cumulative_weight = 0;
+  for (const auto &[size, weight] : dist) {
+    cumulative_weight += weight;
+    const auto clamped = std::clamp(size, min_size, max_size);
+    const size_t end = kPacketSizesNr * cumulative_weight / total_weight;
+    while (sizes.size() < end) sizes.push_back(clamped);
+  }
+  std::mt19937_64 rng(seed);
+  std::shuffle(sizes.begin(), sizes.end(), rng);
+  return sizes;
+}
+
+/**
+ * @brief Pick UDP source ports for the flows of a queue, such that RSS lands
+ * the packets of each flow on that queue at both ends: the bounced packets at
+ * this end, and the generated ones at the remote end (assuming it uses the
+ * same RSS key, and as many queues, as this one).
+ *
+ * @param pmd_port The port (with its RSS key and redirection table).
+ * @param local_ip Local IP address.
+ * @param remote_ip Remote IP address.
+ * @param queue The queue.
+ * @param num_queues Number of queues of the port.
+ * @param num_flows Number of ports to pick.
+ */
+std::vector<uint16_t> PickRssSourcePorts(
+    const juggler::dpdk::PmdPort &pmd_port,
+    const juggler::net::Ipv4::Address &local_ip,
+    const juggler::net::Ipv4::Address &remote_ip, uint16_t queue,
+    uint16_t num_queues, uint32_t num_flows) {
+  auto landing_queue = [&pmd_port, num_queues](uint32_t src_addr,
+                                               uint32_t dst_addr,
+                                               uint16_t sport, uint16_t dport) {
+    rte_thash_tuple tuple;
+    tuple.v4.src_addr = src_addr;
+    tuple.v4.dst_addr = dst_addr;
+    tuple.v4.sport = sport;
+    tuple.v4.dport = dport;
+    const auto rss_hash =
+        rte_softrss(reinterpret_cast<uint32_t *>(&tuple), RTE_THASH_V4_L4_LEN,
+                    pmd_port.GetRSSKey().data());
+    // The redirection table is laid out round-robin (see `InitDriver()').
+    return pmd_port.GetRSSBucket(rss_hash) % num_queues;
+  };
+
+  std::vector<uint16_t> ports;
+  if (num_queues == 1 || pmd_port.GetRSSKey().empty()) {
+    for (uint32_t i = 0; i < num_flows; i++) {
+      ports.push_back(kAppUDPPort + queue * num_flows + i);
+    }
+    return ports;
+  }
+  const auto local = local_ip.address.value();
+  const auto remote = remote_ip.address.value();
+  for (uint32_t port = 1024; port <= UINT16_MAX && ports.size() < num_flows;
+       port++) {
+    if (landing_queue(remote, local, kAppUDPPort, port) != queue) continue;
+    if (landing_queue(local, remote, port, kAppUDPPort) != queue) continue;
+    ports.push_back(port);
+  }
+  CHECK_EQ(ports.size(), num_flows)
+      << "Not enough source ports landing on queue " << queue;
+  return ports;
+}
+
 /**
  * @brief Resolves the MAC address of a remote IP using ARP, with busy-waiting.
  *
@@ -194,6 +381,7 @@ std::optional<juggler::net::Ethernet::Address> ArpResolveBusyWait(
  * @param context A pointer to the context containing the necessary packet
  * information.
  * @param packet A pointer to the packet to be prepared.
+ * @param len The length of the packet.
  * @param seqno The sequence number to set in the packet.
  * @param timestamp The timestamp to set in the packet.
  *
@@ -202,10 +390,9 @@ std::optional<juggler::net::Ethernet::Address> ArpResolveBusyWait(
  * otherwise, it will result in abort execution.
  */
 void prepare_packet(void *context, juggler::dpdk::Packet *packet,
-                    uint64_t seqno, uint64_t timestamp) {
+                    uint16_t len, uint64_t seqno, uint64_t timestamp) {
   auto *ctx = static_cast<task_context *>(context);
 
-  const auto len = ctx->packet_size;
   CHECK_NOTNULL(packet->append(len));
 
   // Prepare the L2 header.
@@ -230,7 +417,8 @@ void prepare_packet(void *context, juggler::dpdk::Packet *packet,
 
   // Prepare the L4 header.
   auto *udph = reinterpret_cast<juggler::net::Udp *>(ipv4h + 1);
-  udph->src_port.port = juggler::be16_t(kAppUDPPort);
+  udph->src_port.port =
+      juggler::be16_t(ctx->src_ports[seqno % ctx->src_ports.size()]);
   udph->dst_port.port = juggler::be16_t(kAppUDPPort);
   udph->len = juggler::be16_t(len - sizeof(*eh) - sizeof(*ipv4h));
   udph->cksum = juggler::be16_t(0);
@@ -247,7 +435,7 @@ void prepare_packet(void *context, juggler::dpdk::Packet *packet,
   if (!FLAGS_zerocopy) {
     auto payload_len = len - kMinPacketLength;
     const size_t kPayloadArrayBitmask = ctx->packet_payloads.size() - 1;
-    static size_t payload_idx = 0;
+    thread_local size_t payload_idx = 0;
     auto *src_payload =
         ctx->packet_payloads[payload_idx & kPayloadArrayBitmask].data();
     auto *dst_payload = reinterpret_cast<uint8_t *>(pkt_timestamp + 1);
@@ -279,19 +467,19 @@ void ping(uint64_t now, void *context) {
     // Allocate a packet from the packet pool.
     auto *packet = tx->GetPacketPool()->PacketAlloc();
     if (packet == nullptr) {
-      st->err_no_mbufs++;
+      stats_add(&st->err_no_mbufs, 1);
       return;
     }
 
     // Prepare the packet.
-    auto seqno = st->tx_success;
+    auto seqno = st->tx_success.load(std::memory_order_relaxed);
     now = juggler::time::rdtsc();
-    prepare_packet(context, packet, seqno++, now);
+    prepare_packet(context, packet, ctx->packet_size, seqno++, now);
 
     // Send the packet.
     tx->SendPackets(&packet, 1);
-    st->tx_success++;
-    st->tx_bytes += ctx->packet_size;
+    stats_add(&st->tx_success, 1);
+    stats_add(&st->tx_bytes, ctx->packet_size);
     last_ping_time = now;
   }
 
@@ -321,8 +509,8 @@ void ping(uint64_t now, void *context) {
     // Calculate the round-trip time.
     const auto rtt = juggler::time::cycles_to_ns(now - *pkt_timestamp);
     ctx->rtt_log.Record(rtt);
-    st->rx_count++;
-    st->rx_bytes += packet->length();
+    stats_add(&st->rx_count, 1);
+    stats_add(&st->rx_bytes, packet->length());
 
     if (now - last_report_time >= juggler::time::ms_to_cycles(1000)) {
       // Report the RTT.
@@ -335,52 +523,66 @@ void ping(uint64_t now, void *context) {
   batch.Release();
 }
 
+// Log the rates of the packets sent and received, between two snapshots of
+// the stats, taken `sec_elapsed' apart.
+void report_rates(const char *label, const stats_snapshot &cur,
+                  const stats_snapshot &prev, double sec_elapsed) {
+  static const size_t kGiga = 1E9;
+  auto packets_sent = cur.tx_success - prev.tx_success;
+  auto bytes_sent = cur.tx_bytes - prev.tx_bytes;
+  auto tx_mpps = static_cast<double>(packets_sent) / sec_elapsed / 1E6;
+  auto tx_gbps = static_cast<double>(bytes_sent) / sec_elapsed * 8.0 / kGiga;
+  // The rate on the wire, to compare with the line rate of the NIC.
+  auto tx_l1_gbps =
+      static_cast<double>(bytes_sent + packets_sent * kL1OverheadBytes) /
+      sec_elapsed * 8.0 / kGiga;
+  auto packets_received = cur.rx_count - prev.rx_count;
+  auto rx_mpps = static_cast<double>(packets_received) / sec_elapsed / 1E6;
+  auto rx_gbps = static_cast<double>(cur.rx_bytes - prev.rx_bytes) /
+                 sec_elapsed * 8.0 / kGiga;
+  auto packets_dropped = cur.err_tx_drops - prev.err_tx_drops;
+  auto tx_drop_mpps = static_cast<double>(packets_dropped) / sec_elapsed / 1E6;
+
+  LOG(INFO) << juggler::utils::Format(
+      "%s[TX Mpps: %lf (%lf Gbps, %lf Gbps on the wire), RX Mpps: %lf (%lf "
+      "Gbps), TX_DROP Mpps: %lf]",
+      label, tx_mpps, tx_gbps, tx_l1_gbps, rx_mpps, rx_gbps, tx_drop_mpps);
+}
+
 /**
- * @brief Helper function to report TX/RX statistics at second granularity. It
- * keeps a checkpoint of the statistics since the previous report to calculate
+ * @brief Helper function to report TX/RX statistics at second granularity,
+ * over all the queues (and per queue, with more than one). It keeps a
+ * checkpoint of the statistics since the previous report to calculate
  * per-second statistics.
  *
- * @param now Current TSC.
- * @param cur Pointer to the main statistics object.
+ * @param contexts The contexts of the workers.
+ * @param sec_elapsed Seconds since the previous report.
+ * @param checkpoints The statistics of each worker at the previous report.
  */
-void report_stats(uint64_t now, void *context) {
-  static const size_t kGiga = 1E9;
-  thread_local uint64_t last_report_timestamp;
-  thread_local stats stats_checkpoint;
-  const auto *ctx = static_cast<task_context *>(context);
-  const stats *cur = &ctx->statistics;
-
-  auto cycles_elapsed = now - last_report_timestamp;
-  if (cycles_elapsed > juggler::time::s_to_cycles(1)) {
-    auto sec_elapsed = juggler::time::cycles_to_s<double>(cycles_elapsed);
-    auto packets_sent = cur->tx_success - stats_checkpoint.tx_success;
-    auto tx_pps = static_cast<double>(packets_sent) / sec_elapsed;
-    auto tx_gbps =
-        static_cast<double>(cur->tx_bytes - stats_checkpoint.tx_bytes) /
-        sec_elapsed * 8.0 / kGiga;
-    auto packets_received = cur->rx_count - stats_checkpoint.rx_count;
-    auto rx_pps = static_cast<double>(packets_received / sec_elapsed);
-    auto rx_gbps =
-        static_cast<double>(cur->rx_bytes - stats_checkpoint.rx_bytes) /
-        sec_elapsed * 8.0 / kGiga;
-    auto packets_dropped = cur->err_tx_drops - stats_checkpoint.err_tx_drops;
-    auto tx_drop_pps = static_cast<double>(packets_dropped / sec_elapsed);
-
-    LOG(INFO) << juggler::utils::Format(
-        "[TX PPS: %lf (%lf Gbps), RX PPS: %lf (%lf Gbps), TX_DROP PPS: %lf]",
-        tx_pps, tx_gbps, rx_pps, rx_gbps, tx_drop_pps);
-
+void report_stats(const std::vector<std::unique_ptr<task_context>> &contexts,
+                  double sec_elapsed,
+                  std::vector<stats_snapshot> *checkpoints) {
+  checkpoints->resize(contexts.size());
+  stats_snapshot total, total_checkpoint;
+  for (size_t q = 0; q < contexts.size(); q++) {
+    const stats_snapshot cur(contexts[q]->statistics);
+    if (contexts.size() > 1) {
+      const auto label = juggler::utils::Format("Queue %zu: ", q);
+      report_rates(label.c_str(), cur, (*checkpoints)[q], sec_elapsed);
+    }
+    total += cur;
+    total_checkpoint += (*checkpoints)[q];
     // Update local variables for next report.
-    stats_checkpoint = *cur;
-    last_report_timestamp = now;
+    (*checkpoints)[q] = cur;
   }
+  report_rates("", total, total_checkpoint, sec_elapsed);
 }
 
 void report_final_stats(void *context) {
   if (!FLAGS_ping) return;
 
   auto *ctx = static_cast<task_context *>(context);
-  const stats *st = &ctx->statistics;
+  const stats_snapshot st(ctx->statistics);
   auto *rtt_log = &ctx->rtt_log;
 
   using stats_tuple =
@@ -434,35 +636,53 @@ void report_final_stats(void *context) {
       "Application Statistics (TOTAL) - [TX] Sent: %lu, Drops: %lu, "
       "DropsNoMbuf: %lu "
       "[RX] Received: %lu",
-      st->tx_success, st->err_tx_drops, st->err_no_mbufs, st->rx_count);
+      st.tx_success, st.err_tx_drops, st.err_no_mbufs, st.rx_count);
 }
 
 // Main transmit (generator) routine.
 // It generates packets in batches and attempts to transmit them to the remote
-// host.
-void tx(void *context) {
+// host, no faster than `tx_pps' if set.
+void tx(uint64_t now, void *context) {
   auto *ctx = static_cast<task_context *>(context);
   auto *tx = ctx->tx_ring;
   auto *pp = tx->GetPacketPool();
   auto *st = &ctx->statistics;
 
+  if (ctx->tx_pps != 0) {
+    if (ctx->tx_batch_cycles == 0) {
+      // The TSC frequency is known once the worker runs.
+      ctx->tx_batch_cycles = std::max<uint64_t>(
+          1, juggler::time::tsc_hz * FLAGS_tx_batch_size / ctx->tx_pps);
+      ctx->next_tx_tsc = now;
+    }
+    if (now < ctx->next_tx_tsc) return;
+    // Catch up on at most one batch, after falling behind.
+    ctx->next_tx_tsc =
+        std::max(ctx->next_tx_tsc, now - ctx->tx_batch_cycles) +
+        ctx->tx_batch_cycles;
+  }
+
   thread_local uint64_t seqno;
   juggler::dpdk::PacketBatch batch;
   const auto ret = pp->PacketBulkAlloc(&batch, FLAGS_tx_batch_size);
   if (!ret) {
-    st->err_no_mbufs++;
+    stats_add(&st->err_no_mbufs, 1);
     return;
   }
 
+  const size_t kPacketSizesBitmask = ctx->packet_sizes.size() - 1;
+  std::array<size_t, juggler::dpdk::PacketBatch::kMaxBurst> tx_bytes;
   for (uint16_t i = 0; i < batch.GetSize(); i++) {
     auto *packet = batch[i];
-    prepare_packet(context, packet, seqno++, 0);
+    const auto len = ctx->packet_sizes[seqno & kPacketSizesBitmask];
+    prepare_packet(context, packet, len, seqno++, 0);
+    tx_bytes[i] = len + (i != 0 ? tx_bytes[i - 1] : 0);
   }
 
   auto packets_sent = tx->TrySendPackets(&batch);
-  st->err_tx_drops += FLAGS_tx_batch_size - packets_sent;
-  st->tx_success += packets_sent;
-  st->tx_bytes += static_cast<uint64_t>(packets_sent * ctx->packet_size);
+  stats_add(&st->err_tx_drops, FLAGS_tx_batch_size - packets_sent);
+  stats_add(&st->tx_success, packets_sent);
+  if (packets_sent) stats_add(&st->tx_bytes, tx_bytes[packets_sent - 1]);
 }
 
 // Main network receive routine.
@@ -475,11 +695,13 @@ void rx(void *context) {
 
   juggler::dpdk::PacketBatch batch;
   auto packets_received = rx->RecvPackets(&batch);
+  uint64_t rx_bytes = 0;
   for (uint16_t i = 0; i < packets_received; i++) {
     auto *packet = batch[i];
-    st->rx_bytes += packet->length();
+    rx_bytes += packet->length();
   }
-  st->rx_count += packets_received;
+  stats_add(&st->rx_bytes, rx_bytes);
+  stats_add(&st->rx_count, packets_received);
   // We need to release the received packet mbufs back to the pool.
   batch.Release();
 }
@@ -500,6 +722,7 @@ void bounce(void *context) {
   juggler::dpdk::PacketBatch rx_batch;
   auto packets_received = rx->RecvPackets(&rx_batch);
   std::array<size_t, juggler::dpdk::PacketBatch::kMaxBurst> tx_bytes;
+  uint64_t rx_bytes = 0;
   juggler::dpdk::PacketBatch tx_batch;
   for (uint16_t i = 0; i < rx_batch.GetSize(); i++) {
     auto *packet = rx_batch[i];
@@ -531,7 +754,7 @@ void bounce(void *context) {
     tx_batch.Append(packet);
 
     const auto tx_bytes_index = tx_batch.GetSize() - 1;
-    st->rx_bytes += packet->length();
+    rx_bytes += packet->length();
     tx_bytes[tx_bytes_index] = packet->length();
     if (tx_bytes_index != 0)
       tx_bytes[tx_bytes_index] += tx_bytes[tx_bytes_index - 1];
@@ -539,10 +762,11 @@ void bounce(void *context) {
   rx_batch.Clear();
 
   auto packets_sent = tx->TrySendPackets(&tx_batch);
-  st->err_tx_drops += packets_received - packets_sent;
-  st->tx_success += packets_sent;
-  if (packets_sent) st->tx_bytes += tx_bytes[packets_sent - 1];
-  st->rx_count += packets_received;
+  stats_add(&st->err_tx_drops, packets_received - packets_sent);
+  stats_add(&st->tx_success, packets_sent);
+  if (packets_sent) stats_add(&st->tx_bytes, tx_bytes[packets_sent - 1]);
+  stats_add(&st->rx_bytes, rx_bytes);
+  stats_add(&st->rx_count, packets_received);
 }
 
 int main(int argc, char *argv[]) {
@@ -567,6 +791,31 @@ int main(int argc, char *argv[]) {
         << "Invalid remote IP address: " << FLAGS_remote_ip;
   }
 
+  if (FLAGS_num_queues == 0 ||
+      FLAGS_num_queues > juggler::WorkerPool<juggler::Task>::kMaxWorkers_) {
+    LOG(ERROR) << "Invalid number of queues: " << FLAGS_num_queues;
+    exit(1);
+  }
+  if (FLAGS_ping && FLAGS_num_queues != 1) {
+    LOG(ERROR) << "Ping mode uses a single queue.";
+    exit(1);
+  }
+  if (FLAGS_flows_per_queue == 0 || FLAGS_tx_rate_mpps < 0) {
+    LOG(ERROR) << "Invalid number of flows per queue, or rate.";
+    exit(1);
+  }
+  std::vector<std::pair<uint16_t, uint32_t>> size_dist{
+      {static_cast<uint16_t>(FLAGS_pkt_size), 1}};
+  if (!FLAGS_pkt_size_dist.empty()) {
+    const auto dist = ParseSizeDist(FLAGS_pkt_size_dist);
+    if (!dist.has_value()) {
+      LOG(ERROR) << "Invalid packet size distribution: "
+                 << FLAGS_pkt_size_dist;
+      exit(1);
+    }
+    size_dist = dist.value();
+  }
+
   // Load the configuration file.
   juggler::MachnetConfigProcessor machnet_config(FLAGS_config_json);
   if (machnet_config.interfaces_config().size() != 1) {
@@ -587,7 +836,14 @@ int main(int argc, char *argv[]) {
     exit(1);
   }
 
-  juggler::dpdk::PmdPort pmd_obj(pmd_port_id.value());
+  const auto num_queues = static_cast<uint16_t>(FLAGS_num_queues);
+  const auto &cores = interface.cores();
+  if (!cores.empty() && cores.size() < num_queues) {
+    LOG(ERROR) << "Fewer cores than queues in the configuration.";
+    exit(1);
+  }
+
+  juggler::dpdk::PmdPort pmd_obj(pmd_port_id.value(), num_queues, num_queues);
   pmd_obj.InitDriver();
 
   auto *rxring = pmd_obj.GetRing<juggler::dpdk::RxRing>(0);
@@ -607,10 +863,13 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  const uint16_t packet_len =
-      std::max(std::min(static_cast<uint16_t>(FLAGS_pkt_size),
-                        juggler::dpdk::PmdRing::kDefaultFrameSize),
-               kMinPacketLength);
+  uint16_t packet_len = 0;
+  for (const auto &[size, weight] : size_dist) {
+    packet_len = std::max(packet_len, size);
+  }
+  packet_len = std::max(
+      std::min(packet_len, juggler::dpdk::PmdRing::kDefaultFrameSize),
+      kMinPacketLength);
 
   std::vector<std::vector<uint8_t>> packet_payloads;
   if (!FLAGS_zerocopy) {
@@ -628,32 +887,59 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  // auto tx_packet_pool = std::make_unique<juggler::dpdk::PacketPool>(4096);
-  // We share the packet pool attached to the RX ring. Since we plan to handle a
-  // queue pair from a single core this is safe.
-  task_context task_ctx(interface.l2_addr(), interface.ip_addr(),
-                        remote_l2_addr, remote_ip, packet_len, rxring, txring,
-                        packet_payloads);
+  // One worker per queue pair. We share the packet pool attached to the RX
+  // ring of each queue. Since we plan to handle a queue pair from a single core
+  // this is safe.
+  const double tx_pps = FLAGS_tx_rate_mpps * 1E6 / num_queues;
+  std::vector<std::unique_ptr<task_context>> task_ctxs;
+  for (uint16_t q = 0; q < num_queues; q++) {
+    auto *rx_ring = CHECK_NOTNULL(pmd_obj.GetRing<juggler::dpdk::RxRing>(q));
+    auto *tx_ring = CHECK_NOTNULL(pmd_obj.GetRing<juggler::dpdk::TxRing>(q));
+    std::vector<uint16_t> src_ports{kAppUDPPort};
+    if (remote_ip.has_value()) {
+      src_ports =
+          PickRssSourcePorts(pmd_obj, interface.ip_addr(), remote_ip.value(),
+                             q, num_queues, FLAGS_flows_per_queue);
+    }
+    // Ping mode matches the responses by size.
+    auto packet_sizes =
+        FLAGS_ping
+            ? std::vector<uint16_t>{packet_len}
+            : MakePacketSizes(size_dist, kMinPacketLength, packet_len, q);
+    task_ctxs.emplace_back(std::make_unique<task_context>(
+        interface.l2_addr(), interface.ip_addr(), remote_l2_addr, remote_ip,
+        packet_len, std::move(packet_sizes), std::move(src_ports), tx_pps,
+        rx_ring, tx_ring, packet_payloads));
+  }
 
   auto packet_generator = [](uint64_t now, void *context) {
-    tx(context);
+    tx(now, context);
     rx(context);
-    report_stats(now, context);
   };
 
   auto pingpong = [](uint64_t now, void *context) { ping(now, context); };
 
-  auto packet_bouncer = [](uint64_t now, void *context) {
-    bounce(context);
-    report_stats(now, context);
-  };
+  auto packet_bouncer = [](uint64_t, void *context) { bounce(context); };
 
   auto routine =
       FLAGS_ping ? pingpong
                  : (FLAGS_active_generator ? packet_generator : packet_bouncer);
-  // Create a task object to pass to worker thread.
-  auto task =
-      std::make_shared<juggler::Task>(routine, static_cast<void *>(&task_ctx));
+  // Create a task object per queue to pass to the worker threads, each on a
+  // core of its own if the configuration lists them.
+  std::vector<std::shared_ptr<juggler::Task>> tasks;
+  std::vector<cpu_set_t> cpu_masks;
+  for (uint16_t q = 0; q < num_queues; q++) {
+    tasks.emplace_back(std::make_shared<juggler::Task>(
+        routine, static_cast<void *>(task_ctxs[q].get())));
+    if (cores.empty()) {
+      cpu_masks.push_back(interface.cpu_mask());
+    } else {
+      cpu_set_t core_mask;
+      CPU_ZERO(&core_mask);
+      CPU_SET(cores[q], &core_mask);
+      cpu_masks.push_back(core_mask);
+    }
+  }
 
   if (FLAGS_ping)
     std::cout << "Starting in ping mode; press Ctrl-C to stop." << std::endl;
@@ -662,19 +948,26 @@ int main(int argc, char *argv[]) {
   else
     std::cout << "Starting in passive message bouncing mode." << std::endl;
 
-  juggler::WorkerPool<juggler::Task> WPool({task}, {interface.cpu_mask()});
+  juggler::WorkerPool<juggler::Task> WPool(tasks, cpu_masks);
   WPool.Init();
 
   // Set worker to running.
   WPool.Launch();
 
+  std::vector<stats_snapshot> checkpoints;
+  auto last_report = std::chrono::steady_clock::now();
   while (g_keep_running) {
-    sleep(5);
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    const auto now = std::chrono::steady_clock::now();
+    report_stats(task_ctxs,
+                 std::chrono::duration<double>(now - last_report).count(),
+                 &checkpoints);
+    last_report = now;
   }
 
   WPool.Pause();
   WPool.Terminate();
-  report_final_stats(&task_ctx);
+  report_final_stats(task_ctxs.front().get());
   pmd_obj.DumpStats();
 
   return (0);
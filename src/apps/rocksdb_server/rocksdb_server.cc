@@ -2,10 +2,12 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <machnet.h>
+#include <machnet_rpc.h>
 #include <netinet/in.h>
 #include <rocksdb/db.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <utils.h>
 
 #include <algorithm>
 #include <array>
@@ -13,65 +15,188 @@
 #include <iostream>
 #include <random>
 #include <string>
+#include <thread>
 #include <vector>
 
 DEFINE_int32(num_keys, 1000, "Number of keys to insert and retrieve");
 DEFINE_int32(num_probes, 10000, "Number of probes to perform");
 DEFINE_int32(value_size, 200, "Size of value in bytes");
 DEFINE_string(local, "", "Local IP address, needed for Machnet only");
-DEFINE_string(transport, "machnet", "Transport to use (machnet, udp)");
+DEFINE_string(transport, "machnet",
+              "Transport to use (machnet, machnet_rpc, udp); with "
+              "machnet_rpc, the keys are GET requests of the RPC layer (see "
+              "`machnet_rpc.h')");
+DEFINE_uint32(workers, 1,
+              "Number of worker threads; worker `i' listens on `port + i', "
+              "on a channel of its own");
+DEFINE_uint32(port, 888, "Port of the first worker");
+DEFINE_uint32(batch_size, 32,
+              "Maximum number of requests a worker receives and answers at "
+              "a time (Machnet only)");
+DEFINE_string(cpus, "",
+              "CPUs to pin the workers to, in turn (a cpulist); not pinned "
+              "if empty");
 
-static constexpr uint16_t kPort = 888;
+static constexpr size_t kMaxKeySize = 1024;
 const char kNsaasRocksDbServerFile[] = "/tmp/testdb";
 
-void MachnetTransportServer(rocksdb::DB *db) {
-  // Initialize machnet and attach
-  int ret = machnet_init();
-  CHECK_EQ(ret, 0) << "machnet_init() failed";
-  void *channel = machnet_attach();
+// Pin worker `id' to its CPU, if `--cpus' is set.
+static void PinWorker(uint32_t id) {
+  if (FLAGS_cpus.empty()) return;
+  const auto cpus = juggler::utils::ParseCpuList(FLAGS_cpus);
+  CHECK(cpus.has_value() && !cpus->empty()) << "Invalid --cpus";
+  const auto cpu = cpus.value()[id % cpus->size()];
+  CHECK(juggler::utils::BindThisThreadToCore(cpu))
+      << "Cannot pin worker " << id << " to CPU " << cpu;
+}
 
-  CHECK(channel != nullptr) << "machnet_attach() failed";
-  ret = machnet_listen(channel, FLAGS_local.c_str(), kPort);
-  CHECK_EQ(ret, 0) << "machnet_listen() failed";
+/**
+ * @brief A worker of the Machnet transport. It receives up to
+ * `--batch_size' requests at a time, looks their keys up with a single
+ * `MultiGet()', and sends the values back in a single batch.
+ *
+ * @param channel The channel of the worker, listening on its port.
+ */
+void MachnetTransportServer(rocksdb::DB *db, void *channel, uint32_t id) {
+  PinWorker(id);
+  const size_t batch_size = FLAGS_batch_size;
+  // Requests, and the answers to those of them found.
+  std::vector<std::array<char, kMaxKeySize>> keys(batch_size);
+  std::vector<MachnetIovec_t> rx_iov(batch_size);
+  std::vector<MachnetMsgHdr_t> rx_msghdr(batch_size);
+  for (size_t i = 0; i < batch_size; i++) {
+    rx_iov[i].base = keys[i].data();
+    rx_iov[i].len = keys[i].size();
+    rx_msghdr[i].msg_iov = &rx_iov[i];
+    rx_msghdr[i].msg_iovlen = 1;
+  }
+  std::vector<MachnetFlow_t> flows(batch_size);
+  std::vector<rocksdb::Slice> key_slices(batch_size);
+  std::vector<rocksdb::PinnableSlice> values(batch_size);
+  std::vector<rocksdb::Status> statuses(batch_size);
+  std::vector<MachnetIovec_t> tx_iov(batch_size);
+  std::vector<MachnetMsgHdr_t> tx_msghdr(batch_size);
 
   // Handle client requests
-  LOG(INFO) << "Waiting for client requests";
+  LOG(INFO) << "Worker " << id << " waiting for client requests on port "
+            << FLAGS_port + id;
   while (true) {
-    std::array<char, 1024> buf;
-    MachnetFlow rx_flow;
-    const ssize_t ret = machnet_recv(channel, buf.data(), buf.size(), &rx_flow);
-    CHECK_GE(ret, 0) << "machnet_recv() failed";
-    if (ret == 0) {
+    const int nb_rx =
+        machnet_recvmmsg(channel, rx_msghdr.data(), rx_msghdr.size());
+    CHECK_GE(nb_rx, 0) << "machnet_recvmmsg() failed";
+    if (nb_rx == 0) {
       usleep(1);
       continue;
     }
 
-    std::string key(buf.data(), ret);
-    VLOG(1) << "Received GET request for key: " << key;
+    // Messages too large for a key are dropped (`msg_size' 0).
+    size_t nb_keys = 0;
+    for (int i = 0; i < nb_rx; i++) {
+      if (rx_msghdr[i].msg_size == 0) continue;
+      flows[nb_keys] = rx_msghdr[i].flow_info;
+      key_slices[nb_keys++] =
+          rocksdb::Slice(keys[i].data(), rx_msghdr[i].msg_size);
+    }
+    VLOG(1) << "Worker " << id << " received " << nb_keys << " GET requests";
+    db->MultiGet(rocksdb::ReadOptions(), db->DefaultColumnFamily(), nb_keys,
+                 key_slices.data(), values.data(), statuses.data());
 
-    std::string value;
-    const rocksdb::Status status = db->Get(rocksdb::ReadOptions(), key, &value);
+    size_t nb_tx = 0;
+    for (size_t i = 0; i < nb_keys; i++) {
+      if (!statuses[i].ok()) {
+        LOG(ERROR) << "Error retrieving key: " << statuses[i].ToString();
+        continue;
+      }
+      const auto &rx_flow = flows[i];
+      auto &tx = tx_msghdr[nb_tx];
+      tx.flow_info.dst_ip = rx_flow.src_ip;
+      tx.flow_info.src_ip = rx_flow.dst_ip;
+      tx.flow_info.dst_port = rx_flow.src_port;
+      tx.flow_info.src_port = rx_flow.dst_port;
+      tx_iov[nb_tx].base = const_cast<char *>(values[i].data());
+      tx_iov[nb_tx].len = values[i].size();
+      tx.msg_size = values[i].size();
+      tx.msg_iov = &tx_iov[nb_tx];
+      tx.msg_iovlen = 1;
+      tx.flags = 0;
+      nb_tx++;
+    }
 
-    if (status.ok()) {
-      MachnetFlow tx_flow;
-      tx_flow.dst_ip = rx_flow.src_ip;
-      tx_flow.src_ip = rx_flow.dst_ip;
-      tx_flow.dst_port = rx_flow.src_port;
-      tx_flow.src_port = rx_flow.dst_port;
+    // The tail of a batch is dropped when the channel is full: send it again.
+    size_t sent = 0;
+    while (sent < nb_tx) {
+      const int ret = machnet_sendmmsg(channel, &tx_msghdr[sent], nb_tx - sent);
+      if (ret <= 0) {
+        LOG_EVERY_N(WARNING, 1000) << "machnet_sendmmsg() is backpressured";
+        continue;
+      }
+      sent += ret;
+    }
+    VLOG(1) << "Worker " << id << " sent " << nb_tx << " values to clients";
+    for (size_t i = 0; i < nb_keys; i++) values[i].Reset();
+  }
+}
 
-      ssize_t send_ret =
-          machnet_send(channel, tx_flow, value.data(), value.size());
-      VLOG(1) << "Sent value of size " << value.size() << " bytes to client";
-      if (send_ret == -1) {
-        LOG(ERROR) << "machnet_send() failed";
+// The request type of GETs over the RPC layer.
+static constexpr uint8_t kRpcGet = 1;
+
+/**
+ * @brief A worker of the Machnet transport over the RPC layer: the same as
+ * `MachnetTransportServer()', with the batching, the response matching and
+ * the retries on a full channel left to the endpoint. The values are sent
+ * from RocksDB's pinned slices, without copying them into the endpoint.
+ */
+void MachnetRpcTransportServer(rocksdb::DB *db, void *channel, uint32_t id) {
+  PinWorker(id);
+  const size_t batch_size = FLAGS_batch_size;
+  std::vector<rocksdb::Slice> key_slices(batch_size);
+  std::vector<rocksdb::PinnableSlice> values(batch_size);
+  std::vector<rocksdb::Status> statuses(batch_size);
+
+  juggler::rpc::Options options;
+  options.batch_size = FLAGS_batch_size;
+  options.max_msg_size = sizeof(juggler::rpc::Header) +
+                         std::max<uint32_t>(kMaxKeySize, FLAGS_value_size + 64);
+  juggler::rpc::Endpoint endpoint(channel, options);
+  // The values looked up in the current `Poll()' (its batch may be split
+  // into runs of GETs by other requests), pinned until it sends them.
+  size_t nb_values = 0;
+  endpoint.RegisterBatch(kRpcGet, [&](const juggler::rpc::Request *requests,
+                                      juggler::rpc::Response *responses,
+                                      size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      key_slices[nb_values + i] = rocksdb::Slice(
+          reinterpret_cast<const char *>(requests[i].payload.data()),
+          requests[i].payload.size());
+    }
+    VLOG(1) << "Worker " << id << " received " << n << " GET requests";
+    db->MultiGet(rocksdb::ReadOptions(), db->DefaultColumnFamily(), n,
+                 &key_slices[nb_values], &values[nb_values],
+                 &statuses[nb_values]);
+    // Keys not found get empty responses.
+    for (size_t i = 0; i < n; i++, nb_values++) {
+      if (!statuses[nb_values].ok()) {
+        LOG(ERROR) << "Error retrieving key: "
+                   << statuses[nb_values].ToString();
+        continue;
       }
-    } else {
-      LOG(ERROR) << "Error retrieving key: " << status.ToString();
+      responses[i].Reference(values[nb_values].data(),
+                             values[nb_values].size());
     }
+  });
+
+  LOG(INFO) << "Worker " << id << " waiting for RPC requests on port "
+            << FLAGS_port + id;
+  while (true) {
+    const size_t nb_rx = endpoint.Poll();
+    for (size_t i = 0; i < nb_values; i++) values[i].Reset();
+    nb_values = 0;
+    if (nb_rx == 0) usleep(1);
   }
 }
 
-void UDPTransportServer(rocksdb::DB *db) {
+void UDPTransportServer(rocksdb::DB *db, uint32_t id) {
+  PinWorker(id);
   // Create and configure the UDP socket
   int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
   CHECK_GE(sockfd, 0) << "socket() failed";
@@ -84,7 +209,7 @@ void UDPTransportServer(rocksdb::DB *db) {
   memset(&server_addr, 0, sizeof(server_addr));
   server_addr.sin_family = AF_INET;
   server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-  server_addr.sin_port = htons(kPort);
+  server_addr.sin_port = htons(FLAGS_port + id);
 
   int ret = bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr));
   if (ret < 0) {
@@ -92,9 +217,10 @@ void UDPTransportServer(rocksdb::DB *db) {
   }
 
   // Handle client requests
-  LOG(INFO) << "Waiting for client requests";
+  LOG(INFO) << "Worker " << id << " waiting for client requests on port "
+            << FLAGS_port + id;
   while (true) {
-    std::array<char, 1024> buf;
+    std::array<char, kMaxKeySize> buf;
     struct sockaddr_in client_addr;
     socklen_t client_addr_len = sizeof(client_addr);
     const ssize_t ret =
@@ -157,13 +283,38 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  if (FLAGS_transport == "machnet") {
-    MachnetTransportServer(db);
+  CHECK_GT(FLAGS_workers, 0) << "At least one worker is needed";
+  CHECK_LE(FLAGS_port + FLAGS_workers, UINT16_MAX + 1) << "Invalid --port";
+  CHECK_GT(FLAGS_batch_size, 0) << "Invalid --batch_size";
+  std::vector<std::thread> workers;
+  if (FLAGS_transport == "machnet" || FLAGS_transport == "machnet_rpc") {
+    int ret = machnet_init();
+    CHECK_EQ(ret, 0) << "machnet_init() failed";
+    for (uint32_t i = 0; i < FLAGS_workers; i++) {
+      // Spread the workers' channels across the engines.
+      void *channel = machnet_attach_with_placement(
+          0, 0, 0, MACHNET_PLACEMENT_LEAST_LOADED, 0);
+      CHECK(channel != nullptr) << "machnet_attach_with_placement() failed";
+      ret = machnet_listen(channel, FLAGS_local.c_str(), FLAGS_port + i);
+      CHECK_EQ(ret, 0) << "machnet_listen() failed";
+      MachnetChannelPlacement_t placement;
+      CHECK_EQ(machnet_get_placement(channel, &placement), 0);
+      LOG(INFO) << "Worker " << i << " served by engine "
+                << placement.engine_id << " (NUMA node "
+                << placement.numa_node << ")";
+      workers.emplace_back(FLAGS_transport == "machnet"
+                               ? MachnetTransportServer
+                               : MachnetRpcTransportServer,
+                           db, channel, i);
+    }
   } else if (FLAGS_transport == "udp") {
-    UDPTransportServer(db);
+    for (uint32_t i = 0; i < FLAGS_workers; i++) {
+      workers.emplace_back(UDPTransportServer, db, i);
+    }
   } else {
     LOG(FATAL) << "Unknown transport: " << FLAGS_transport;
   }
+  for (auto &worker : workers) worker.join();
 
   return 0;
 }
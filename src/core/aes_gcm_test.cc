@@ -0,0 +1,143 @@
+/**
+ * @file aes_gcm_test.cc
+ *
+ * Unit tests for AES-128-GCM, against the test vectors of the GCM
+ * specification (McGrew and Viega).
+ */
+#include <aes_gcm.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace juggler {
+namespace crypto {
+
+static std::vector<uint8_t> FromHex(const std::string &hex) {
+  std::vector<uint8_t> bytes;
+  for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+    bytes.push_back(std::stoi(hex.substr(i, 2), nullptr, 16));
+  }
+  return bytes;
+}
+
+static Key KeyFromHex(const std::string &hex) {
+  Key key{};
+  const auto bytes = FromHex(hex);
+  std::copy(bytes.begin(), bytes.end(), key.begin());
+  return key;
+}
+
+class AesGcmTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    if (!Supported()) GTEST_SKIP() << "No AES-NI on this CPU";
+  }
+
+  // Seal and open a test vector.
+  static void Check(const std::string &key, const std::string &iv,
+                    const std::string &aad, const std::string &plaintext,
+                    const std::string &ciphertext, const std::string &tag) {
+    const AesGcm gcm(KeyFromHex(key));
+    const auto iv_bytes = FromHex(iv);
+    const auto aad_bytes = FromHex(aad);
+    const auto pt = FromHex(plaintext);
+    std::vector<uint8_t> ct(pt.size());
+    uint8_t t[AesGcm::kTagSize];
+    gcm.Seal(iv_bytes.data(), aad_bytes.data(), aad_bytes.size(), pt.data(),
+             ct.data(), pt.size(), t);
+    EXPECT_EQ(ct, FromHex(ciphertext));
+    EXPECT_EQ(std::vector<uint8_t>(t, t + sizeof(t)), FromHex(tag));
+
+    std::vector<uint8_t> decrypted(ct.size());
+    EXPECT_TRUE(gcm.Open(iv_bytes.data(), aad_bytes.data(), aad_bytes.size(),
+                         ct.data(), decrypted.data(), ct.size(), t));
+    EXPECT_EQ(decrypted, pt);
+  }
+};
+
+TEST_F(AesGcmTest, EmptyMessage) {
+  Check("00000000000000000000000000000000", "000000000000000000000000", "", "",
+        "", "58e2fccefa7e3061367f1d57a4e7455a");
+}
+
+TEST_F(AesGcmTest, SingleBlock) {
+  Check("00000000000000000000000000000000", "000000000000000000000000", "",
+        "00000000000000000000000000000000",
+        "0388dace60b6a392f328c2b971b2fe78",
+        "ab6e47d42cec13bdf53a67b21257bddf");
+}
+
+TEST_F(AesGcmTest, FourBlocks) {
+  Check("feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", "",
+        "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+        "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+        "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+        "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+        "4d5c2af327cd64a62cf35abd2ba6fab4");
+}
+
+TEST_F(AesGcmTest, PartialBlockWithAad) {
+  Check("feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888",
+        "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+        "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+        "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+        "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+        "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+        "5bc94fbc3221a5db94fae95ae7121a47");
+}
+
+TEST_F(AesGcmTest, InPlaceAndTampering) {
+  std::mt19937 rng(42);
+  Key key;
+  for (auto &byte : key) byte = rng();
+  const AesGcm gcm(key);
+  uint8_t iv[AesGcm::kIvSize] = {1, 2, 3};
+  uint8_t aad[70];
+  for (auto &byte : aad) byte = rng();
+
+  for (size_t len : {0, 1, 15, 16, 17, 63, 64, 65, 1000, 8930}) {
+    std::vector<uint8_t> msg(len);
+    for (auto &byte : msg) byte = rng();
+    auto buf = msg;
+    uint8_t tag[AesGcm::kTagSize];
+    gcm.Seal(iv, aad, sizeof(aad), buf.data(), buf.data(), len, tag);
+    if (len != 0) {
+      EXPECT_NE(buf, msg);
+    }
+
+    auto opened = buf;
+    EXPECT_TRUE(gcm.Open(iv, aad, sizeof(aad), opened.data(), opened.data(),
+                         len, tag));
+    EXPECT_EQ(opened, msg) << "len " << len;
+
+    // Any change to the ciphertext, the AAD or the IV is caught.
+    if (len != 0) {
+      opened = buf;
+      opened[len / 2] ^= 0x10;
+      EXPECT_FALSE(gcm.Open(iv, aad, sizeof(aad), opened.data(),
+                            opened.data(), len, tag));
+    }
+    aad[3] ^= 1;
+    EXPECT_FALSE(
+        gcm.Open(iv, aad, sizeof(aad), buf.data(), msg.data(), len, tag));
+    aad[3] ^= 1;
+    iv[11] ^= 1;
+    EXPECT_FALSE(
+        gcm.Open(iv, aad, sizeof(aad), buf.data(), msg.data(), len, tag));
+    iv[11] ^= 1;
+  }
+}
+
+}  // namespace crypto
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
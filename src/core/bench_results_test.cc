@@ -0,0 +1,76 @@
+/**
+ * @file bench_results_test.cc
+ *
+ * Unit tests for the BenchResults class.
+ */
+#include <bench_results.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace juggler {
+
+static BenchResults::Row MakeRow(uint64_t window, double mops) {
+  return {{"ring", std::string("jring")},
+          {"window", window},
+          {"mops", mops}};
+}
+
+TEST(BenchResultsTest, Csv) {
+  BenchResults results;
+  results.Add(MakeRow(1, 2.5));
+  results.Add({{"ring", std::string("a,\"b\"")},
+               {"window", uint64_t{16}},
+               {"mops", NAN}});
+  std::ostringstream out;
+  results.Write(out, BenchResults::Format::kCsv);
+  EXPECT_EQ(out.str(),
+            "ring,window,mops\n"
+            "jring,1,2.5\n"
+            "\"a,\"\"b\"\"\",16,null\n");
+}
+
+TEST(BenchResultsTest, Json) {
+  BenchResults results;
+  results.Add(MakeRow(8, 0.125));
+  results.Add({{"name", std::string("say \"hi\"\n")}});
+  std::ostringstream out;
+  results.Write(out, BenchResults::Format::kJson);
+  EXPECT_EQ(out.str(),
+            "{\"ring\": \"jring\", \"window\": 8, \"mops\": 0.125}\n"
+            "{\"name\": \"say \\\"hi\\\"\\u000a\"}\n");
+}
+
+TEST(BenchResultsTest, Append) {
+  EXPECT_EQ(BenchResults::FormatOf("results.csv"), BenchResults::Format::kCsv);
+  EXPECT_EQ(BenchResults::FormatOf("results.json"),
+            BenchResults::Format::kJson);
+
+  const std::string path =
+      "/tmp/bench_results_test_" + std::to_string(getpid()) + ".csv";
+  BenchResults first, second;
+  first.Add(MakeRow(1, 1));
+  second.Add(MakeRow(2, 2));
+  ASSERT_TRUE(first.Append(path));
+  ASSERT_TRUE(second.Append(path));
+
+  // The header is only written once.
+  std::ifstream in(path);
+  std::stringstream contents;
+  contents << in.rdbuf();
+  EXPECT_EQ(contents.str(), "ring,window,mops\njring,1,1\njring,2,2\n");
+  unlink(path.c_str());
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,165 @@
+/**
+ * @file cc_test.cc
+ *
+ * Unit tests for the Swift congestion control protocol control block.
+ */
+#include <cc.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+namespace juggler {
+namespace net {
+namespace swift {
+
+constexpr uint64_t kUs = 1000;
+
+TEST(SwiftTest, AdditiveIncrease) {
+  Pcb pcb;
+  const double initial_cwnd = pcb.cwnd;
+  uint64_t now = 1000 * kUs;
+  // Delays well below target: the window grows by ~1 packet per window's worth
+  // of ACKs.
+  for (uint32_t i = 0; i < static_cast<uint32_t>(initial_cwnd); i++) {
+    pcb.OnAck(now, 1, 20 * kUs, 5 * kUs);
+    now += kUs;
+  }
+  EXPECT_GT(pcb.cwnd, initial_cwnd);
+  EXPECT_LT(pcb.cwnd, initial_cwnd + 1.5);
+  EXPECT_EQ(pcb.fabric_delay_ns, 15 * kUs);
+  EXPECT_EQ(pcb.endpoint_delay_ns, 5 * kUs);
+  EXPECT_NE(pcb.srtt_ns, 0);
+}
+
+TEST(SwiftTest, MultiplicativeDecreaseOncePerRtt) {
+  Pcb pcb;
+  const uint64_t rtt = 10 * Pcb::kFabricBaseTargetDelayNs;
+  uint64_t now = 1000 * rtt;
+  pcb.OnAck(now, 1, rtt, 0);
+  const double cwnd_after_first = pcb.cwnd;
+  EXPECT_LT(cwnd_after_first, Pcb::kInitialCwnd);
+  // Bounded by the maximum decrease factor.
+  EXPECT_GE(cwnd_after_first, Pcb::kInitialCwnd * (1 - Pcb::kMaxMdf));
+
+  // Further congestion signals within the same RTT do not decrease the window.
+  pcb.OnAck(now + rtt / 2, 1, rtt, 0);
+  EXPECT_EQ(pcb.cwnd, cwnd_after_first);
+
+  // ...but they do one RTT later.
+  pcb.OnAck(now + 2 * rtt, 1, rtt, 0);
+  EXPECT_LT(pcb.cwnd, cwnd_after_first);
+}
+
+TEST(SwiftTest, EndpointCongestion) {
+  Pcb pcb;
+  const uint64_t now = 1000 * 1000 * kUs;
+  // Low fabric delay, high endpoint delay: only the endpoint window drops.
+  pcb.OnAck(now, 1, 10 * Pcb::kEndpointTargetDelayNs,
+            10 * Pcb::kEndpointTargetDelayNs - kUs);
+  EXPECT_GT(pcb.fabric_cwnd, Pcb::kInitialCwnd);
+  EXPECT_LT(pcb.endpoint_cwnd, Pcb::kInitialCwnd);
+  EXPECT_EQ(pcb.cwnd, pcb.endpoint_cwnd);
+}
+
+TEST(SwiftTest, FractionalWindowAndPacing) {
+  Pcb pcb;
+  const uint64_t rtt = 100 * Pcb::kFabricBaseTargetDelayNs;
+  uint64_t now = rtt;
+  while (pcb.cwnd > Pcb::kMinCwnd) {
+    now += 2 * rtt;
+    pcb.OnAck(now, 1, rtt, 0);
+  }
+  EXPECT_EQ(pcb.cwnd, Pcb::kMinCwnd);
+  EXPECT_TRUE(pcb.pacing_enabled());
+  EXPECT_EQ(pcb.effective_wnd(), 1);
+  EXPECT_GT(pcb.pacing_delay_ns(), pcb.srtt_ns);
+  EXPECT_GT(pcb.fabric_target_delay_ns(), Pcb::kFabricBaseTargetDelayNs);
+
+  // One packet in flight closes the window.
+  pcb.get_snd_nxt();
+  EXPECT_EQ(pcb.effective_wnd(), 0);
+}
+
+TEST(SwiftTest, ReceiveWindow) {
+  Pcb pcb;
+  const auto cwnd = static_cast<uint32_t>(pcb.cwnd);
+  pcb.rwnd = 4;
+  EXPECT_EQ(pcb.effective_wnd(), 4);
+  // SACKed packets still count against the receive window.
+  for (int i = 0; i < 3; i++) pcb.get_snd_nxt();
+  pcb.snd_ooo_acks = 2;
+  EXPECT_EQ(pcb.effective_wnd(), 1);
+  pcb.get_snd_nxt();
+  EXPECT_EQ(pcb.effective_wnd(), 0);
+
+  // A zero window lets a single probe out.
+  pcb.snd_una = pcb.snd_nxt;
+  pcb.snd_ooo_acks = 0;
+  pcb.rwnd = 0;
+  EXPECT_TRUE(pcb.zero_window());
+  EXPECT_EQ(pcb.effective_wnd(), 1);
+  pcb.get_snd_nxt();
+  EXPECT_EQ(pcb.effective_wnd(), 0);
+
+  // A large window leaves the congestion window in charge.
+  pcb.rwnd = 0xffff;
+  EXPECT_EQ(pcb.effective_wnd(), cwnd - 1);
+}
+
+TEST(SwiftTest, LossDecrease) {
+  Pcb pcb;
+  pcb.OnFastRetransmit(1000 * Pcb::kInitialRttNs);
+  EXPECT_DOUBLE_EQ(pcb.cwnd, Pcb::kInitialCwnd * (1 - Pcb::kMaxMdf));
+  pcb.OnRto(1000 * Pcb::kInitialRttNs + 1);
+  EXPECT_DOUBLE_EQ(pcb.cwnd, Pcb::kInitialCwnd * (1 - Pcb::kMaxMdf));
+}
+
+TEST(SwiftTest, RtoFromRtt) {
+  Pcb pcb;
+  EXPECT_EQ(pcb.rto_ns(), Pcb::kInitialRtoNs);
+  // Small RTTs are bounded by the minimum RTO.
+  pcb.OnAck(1000 * kUs, 1, 20 * kUs, 0);
+  EXPECT_EQ(pcb.rto_ns(), Pcb::kMinRtoNs);
+
+  // srtt + 4 * rttvar, backed off exponentially on consecutive timeouts.
+  Pcb slow;
+  slow.OnAck(1000 * kUs, 1, 2 * Pcb::kMinRtoNs, 0);
+  EXPECT_EQ(slow.rto_ns(), 6 * Pcb::kMinRtoNs);
+  slow.rto_rexmits = 2;
+  EXPECT_EQ(slow.rto_ns(), 24 * Pcb::kMinRtoNs);
+  slow.rto_rexmits = Pcb::kMaxRtoRexmits;
+  EXPECT_EQ(slow.rto_ns(), Pcb::kMaxRtoNs);
+}
+
+TEST(SwiftTest, LossDetectionTimeouts) {
+  Pcb pcb;
+  EXPECT_EQ(pcb.reorder_window_ns(), Pcb::kInitialRttNs / 4);
+  EXPECT_EQ(pcb.pto_ns(), 2 * Pcb::kInitialRttNs);
+
+  // The reordering window follows the minimum RTT, the PTO the smoothed one;
+  // tail loss probes go out well before the RTO.
+  pcb.OnAck(1000 * kUs, 1, 40 * kUs, 0);
+  pcb.OnAck(1001 * kUs, 1, 20 * kUs, 0);
+  pcb.OnAck(1002 * kUs, 1, 80 * kUs, 0);
+  EXPECT_EQ(pcb.min_rtt_ns, 20 * kUs);
+  EXPECT_EQ(pcb.reorder_window_ns(), 5 * kUs);
+  EXPECT_EQ(pcb.pto_ns(), 2 * pcb.srtt_ns);
+  EXPECT_LT(pcb.pto_ns(), pcb.rto_ns());
+
+  // Tiny RTTs are bounded by the minimum PTO, large ones by the RTO.
+  Pcb fast;
+  fast.OnAck(1000 * kUs, 1, 1 * kUs, 0);
+  EXPECT_EQ(fast.pto_ns(), Pcb::kMinPtoNs);
+  Pcb slow;
+  slow.OnAck(1000 * kUs, 1, Pcb::kMaxRtoNs, 0);
+  EXPECT_EQ(slow.pto_ns(), slow.rto_ns());
+}
+
+}  // namespace swift
+}  // namespace net
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,86 @@
+/**
+ * @file clock_page_test.cc
+ *
+ * Unit tests for the ClockPage class.
+ */
+#include <clock_page.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <sys/mman.h>
+#include <time.h>
+
+namespace juggler {
+namespace time {
+
+static uint64_t MonotonicRawNs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+static int64_t Distance(uint64_t a, uint64_t b) {
+  return a > b ? static_cast<int64_t>(a - b) : static_cast<int64_t>(b - a);
+}
+
+TEST(ClockPageTest, Calibration) {
+  auto clock = ClockPage::Create();
+  ASSERT_NE(clock, nullptr);
+  EXPECT_GT(clock->tsc_hz(), 0);
+  EXPECT_EQ(shared_tsc_hz.load(), clock->tsc_hz());
+  EXPECT_EQ(calibrated_tsc_hz(), clock->tsc_hz());
+  EXPECT_EQ(clock->page()->seq % 2, 0);
+
+  // Within a millisecond of the system's clock.
+  EXPECT_LT(Distance(clock->Now(), MonotonicRawNs()), 1'000'000);
+}
+
+TEST(ClockPageTest, RefineIsMonotonic) {
+  auto clock = ClockPage::Create();
+  ASSERT_NE(clock, nullptr);
+  uint64_t last = clock->Now();
+  for (int i = 0; i < 20; i++) {
+    clock->Refine();
+    for (int j = 0; j < 100; j++) {
+      const uint64_t now = clock->Now();
+      EXPECT_GE(now, last);
+      last = now;
+    }
+  }
+  EXPECT_LT(Distance(clock->Now(), MonotonicRawNs()), 1'000'000);
+}
+
+TEST(ClockPageTest, ReadOnlyMapping) {
+  auto clock = ClockPage::Create();
+  ASSERT_NE(clock, nullptr);
+  void *mem =
+      mmap(nullptr, kPageSize, PROT_READ, MAP_SHARED, clock->GetFd(), 0);
+  ASSERT_NE(mem, MAP_FAILED);
+  const auto *page = static_cast<const MachnetClockPage_t *>(mem);
+  EXPECT_EQ(page->tsc_hz, clock->tsc_hz());
+  EXPECT_LT(Distance(__machnet_clock_tsc_to_ns(page, rdtsc()), clock->Now()),
+            1'000'000);
+  munmap(mem, kPageSize);
+
+#ifdef F_SEAL_FUTURE_WRITE
+  // Only the controller writes the page.
+  EXPECT_EQ(mmap(nullptr, kPageSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 clock->GetFd(), 0),
+            MAP_FAILED);
+#endif
+}
+
+TEST(ClockPageTest, Start) {
+  auto clock = ClockPage::Create();
+  ASSERT_NE(clock, nullptr);
+  clock->Start();
+  // Destroyed while its thread waits.
+}
+
+}  // namespace time
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,102 @@
+/**
+ * @file cycle_accounting_test.cc
+ *
+ * Unit tests for the CycleAccounting class.
+ */
+#include <cycle_accounting.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <ttime.h>
+
+namespace juggler {
+
+// Spin for (at least) `cycles' TSC cycles.
+static void Spin(uint64_t cycles) {
+  const auto end = time::rdtsc() + cycles;
+  while (time::rdtsc() < end) {
+  }
+}
+
+TEST(CycleAccountingTest, Iterations) {
+  CycleAccounting cycles;
+  size_t sampled = 0;
+  for (uint32_t i = 0; i < 4 * CycleAccounting::kSampleEvery; i++) {
+    if (cycles.Begin(time::rdtsc())) sampled++;
+    cycles.Mark(CycleAccounting::kRx);
+    cycles.End(i % 2 == 0);
+  }
+  EXPECT_EQ(sampled, 4);
+
+  stats::LoopStats loop;
+  cycles.GetStats(&loop);
+  EXPECT_EQ(loop.iterations, 4 * CycleAccounting::kSampleEvery);
+  EXPECT_EQ(loop.empty_iterations, 2 * CycleAccounting::kSampleEvery);
+  EXPECT_EQ(loop.sample_every, CycleAccounting::kSampleEvery);
+  // Sampled iterations are the last of each run of `kSampleEvery', hence odd
+  // (i.e., empty) ones.
+  EXPECT_GT(loop.empty_cycles, 0);
+  EXPECT_EQ(loop.empty_cycles % CycleAccounting::kSampleEvery, 0);
+}
+
+TEST(CycleAccountingTest, Stages) {
+  static constexpr uint64_t kCycles = 100000;
+  CycleAccounting cycles;
+  // Skip to a sampled iteration.
+  while (!cycles.Begin(time::rdtsc())) cycles.End(true);
+
+  Spin(kCycles);
+  cycles.Mark(CycleAccounting::kTimers);
+  Spin(kCycles);
+  cycles.Nested(CycleAccounting::kArp, [] { Spin(2 * kCycles); });
+  cycles.Mark(CycleAccounting::kRx);
+  cycles.End(true);
+
+  // Stages are not timed on the next (unsampled) iterations.
+  cycles.Begin(time::rdtsc());
+  Spin(kCycles);
+  cycles.Mark(CycleAccounting::kTx);
+  cycles.Nested(CycleAccounting::kArp, [] { Spin(kCycles); });
+  cycles.End(true);
+
+  stats::LoopStats loop;
+  cycles.GetStats(&loop);
+  const auto scaled = [](uint64_t c) {
+    return c * CycleAccounting::kSampleEvery;
+  };
+  EXPECT_GE(loop.stage_cycles[CycleAccounting::kTimers], scaled(kCycles));
+  EXPECT_LT(loop.stage_cycles[CycleAccounting::kTimers], scaled(2 * kCycles));
+  // The nested stage is taken off the RX stage.
+  EXPECT_GE(loop.stage_cycles[CycleAccounting::kRx], scaled(kCycles));
+  EXPECT_LT(loop.stage_cycles[CycleAccounting::kRx], scaled(2 * kCycles));
+  EXPECT_GE(loop.stage_cycles[CycleAccounting::kArp], scaled(2 * kCycles));
+  EXPECT_LT(loop.stage_cycles[CycleAccounting::kArp], scaled(3 * kCycles));
+  EXPECT_EQ(loop.stage_cycles[CycleAccounting::kTx], 0);
+  EXPECT_EQ(loop.empty_iterations, 0);
+}
+
+TEST(CycleAccountingTest, Batches) {
+  EXPECT_EQ(stats::BatchBucket(1), 0);
+  EXPECT_EQ(stats::BatchBucket(2), 1);
+  EXPECT_EQ(stats::BatchBucket(3), 1);
+  EXPECT_EQ(stats::BatchBucket(32), 5);
+  EXPECT_EQ(stats::BatchBucket(64), 6);
+  EXPECT_EQ(stats::BatchBucket(1000), stats::kBatchBuckets - 1);
+
+  CycleAccounting cycles;
+  cycles.CountRxBatch(1);
+  cycles.CountRxBatch(32);
+  cycles.CountRxBatch(32);
+  stats::LoopStats loop;
+  cycles.GetStats(&loop);
+  EXPECT_EQ(loop.rx_batches[0], 1);
+  EXPECT_EQ(loop.rx_batches[5], 2);
+  EXPECT_EQ(loop.rx_batches[1], 0);
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
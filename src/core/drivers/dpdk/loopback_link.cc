@@ -0,0 +1,206 @@
+#include <glog/logging.h>
+#include <loopback_link.h>
+#include <rte_errno.h>
+#include <rte_eth_ring.h>
+#include <ttime.h>
+#include <utils.h>
+
+#include <functional>
+
+namespace juggler {
+namespace dpdk {
+
+LoopbackLink::Queue::Queue(const LinkImpairments &impairments, uint64_t seed,
+                           rte_ring *ring, rte_mempool *rx_pool)
+    : impairments_(impairments),
+      delay_cycles_(time::ns_to_cycles(impairments.delay_ns)),
+      jitter_cycles_(time::ns_to_cycles(impairments.jitter_ns)),
+      reorder_cycles_(time::ns_to_cycles(impairments.reorder_delay_ns)),
+      ring_(CHECK_NOTNULL(ring)),
+      rx_pool_(CHECK_NOTNULL(rx_pool)),
+      tx_rng_(seed),
+      rx_rng_(~seed) {}
+
+LoopbackLink::Queue::~Queue() {
+  for (; !delayed_.empty(); delayed_.pop()) {
+    rte_pktmbuf_free(delayed_.top().mbuf);
+  }
+}
+
+rte_mbuf *LoopbackLink::Queue::Copy(const rte_mbuf *mbuf) {
+  auto *copy = rte_pktmbuf_copy(mbuf, rx_pool_, 0, UINT32_MAX);
+  if (copy != nullptr) copy->ol_flags &= ~RTE_MBUF_F_TX_OFFLOAD_MASK;
+  return copy;
+}
+
+uint16_t LoopbackLink::Queue::Transmit(rte_mbuf **pkts, uint16_t nb_pkts) {
+  // The packets left out are returned to the sender, which must get its own
+  // back: copy no more than the ring has room for, and stop short if the
+  // other end runs out of receive buffers (as flow control would).
+  uint32_t room = rte_ring_free_count(ring_);
+  uint16_t n = 0;
+  for (; n < nb_pkts && room != 0; n++, room--) {
+    auto *copy = Copy(pkts[n]);
+    if (copy == nullptr) [[unlikely]] break;  // NOLINT
+    // Duplicates go ahead of the burst.
+    if (room > 1 && Chance(&tx_rng_, impairments_.duplicate)) {
+      auto *duplicate = Copy(copy);
+      if (duplicate != nullptr) {
+        CHECK_EQ(rte_ring_sp_enqueue(ring_, duplicate), 0);
+        Count(&duplicates);
+        room--;
+      }
+    }
+    // The original is done with, as if the NIC had sent it.
+    rte_pktmbuf_free(pkts[n]);
+    pkts[n] = copy;
+  }
+  return n;
+}
+
+uint16_t LoopbackLink::Queue::Receive(rte_mbuf **pkts, uint16_t nb_pkts,
+                                      uint16_t max_pkts) {
+  const auto now = time::rdtsc();
+  for (uint16_t i = 0; i < nb_pkts; i++) {
+    if (Chance(&rx_rng_, impairments_.loss)) {
+      rte_pktmbuf_free(pkts[i]);
+      Count(&drops);
+      continue;
+    }
+    auto release = now + delay_cycles_;
+    if (jitter_cycles_ != 0) release += rx_rng_() % (jitter_cycles_ + 1);
+    if (Chance(&rx_rng_, impairments_.reorder)) {
+      release += reorder_cycles_;
+      Count(&reorders);
+    }
+    delayed_.push({release, next_seq_++, pkts[i]});
+  }
+
+  // Hand over the packets that are due, in order; the rest wait for a later
+  // burst.
+  uint16_t n = 0;
+  while (n < max_pkts && !delayed_.empty() && delayed_.top().release <= now) {
+    pkts[n++] = delayed_.top().mbuf;
+    delayed_.pop();
+  }
+  return n;
+}
+
+LoopbackLink::LoopbackLink(const std::string &name, uint16_t nr_queues,
+                           const std::array<LinkImpairments, 2> &impairments,
+                           uint16_t mtu) {
+  CHECK_GT(nr_queues, 0);
+  for (size_t end = 0; end < 2; end++) {
+    for (uint16_t q = 0; q < nr_queues; q++) {
+      const auto ring_name = utils::Format("%s_%zu_q%u", name.c_str(), end, q);
+      auto *ring = rte_ring_create(ring_name.c_str(), kRingSize, SOCKET_ID_ANY,
+                                   RING_F_SP_ENQ | RING_F_SC_DEQ);
+      CHECK_NOTNULL(ring);
+      rings_[end].push_back(ring);
+    }
+  }
+
+  for (size_t end = 0; end < 2; end++) {
+    // Each end receives from the rings the other end transmits into.
+    const auto port_name = utils::Format("%s_%zu", name.c_str(), end);
+    const int port_id = rte_eth_from_rings(
+        port_name.c_str(), rings_[1 - end].data(), nr_queues,
+        rings_[end].data(), nr_queues, SOCKET_ID_ANY);
+    CHECK_GE(port_id, 0) << "Failed to create port " << port_name << ": "
+                         << rte_strerror(rte_errno);
+
+    // Locally administered L2 addresses, unique to each port.
+    rte_ether_addr l2addr = {{0x02, 0x00, 0x00, 0x00,
+                              static_cast<uint8_t>(port_id >> 8),
+                              static_cast<uint8_t>(port_id)}};
+    CHECK_EQ(rte_eth_dev_default_mac_addr_set(port_id, &l2addr), 0);
+
+    ports_[end] = std::make_shared<PmdPort>(port_id, nr_queues, nr_queues,
+                                            kRxDescNr);
+    ports_[end]->InitDriver(mtu);
+  }
+
+  for (size_t end = 0; end < 2; end++) {
+    const auto &impaired = impairments[end];
+    const bool rx_impaired = impaired.loss != 0 || impaired.reorder != 0 ||
+                             impaired.delay_ns != 0 || impaired.jitter_ns != 0;
+    const auto tx_port_id = ports_[end]->GetPortId();
+    const auto &rx_port = ports_[1 - end];
+    for (uint16_t q = 0; q < nr_queues; q++) {
+      auto *rx_pool = rx_port->GetRing<RxRing>(q)->GetPacketPool();
+      auto queue = std::make_unique<Queue>(
+          impaired, std::hash<std::string>{}(name) ^ (end << 16 | q),
+          rings_[end][q], rx_pool->GetMemPool());
+      queue->tx_callback = rte_eth_add_tx_callback(
+          tx_port_id, q, Queue::TxCallback, queue.get());
+      CHECK_NOTNULL(queue->tx_callback);
+      if (rx_impaired) {
+        queue->rx_callback = rte_eth_add_rx_callback(
+            rx_port->GetPortId(), q, Queue::RxCallback, queue.get());
+        CHECK_NOTNULL(queue->rx_callback);
+      }
+      queues_[end].emplace_back(std::move(queue));
+    }
+  }
+}
+
+LoopbackLink::~LoopbackLink() {
+  for (size_t end = 0; end < 2; end++) {
+    const auto tx_port_id = ports_[end]->GetPortId();
+    const auto rx_port_id = ports_[1 - end]->GetPortId();
+    for (uint16_t q = 0; q < queues_[end].size(); q++) {
+      const auto &queue = queues_[end][q];
+      rte_eth_remove_tx_callback(tx_port_id, q, queue->tx_callback);
+      if (queue->rx_callback != nullptr) {
+        rte_eth_remove_rx_callback(rx_port_id, q, queue->rx_callback);
+      }
+    }
+  }
+
+  // The packets in flight come from the pools of the ports: free them before
+  // the ports go away, and the rings after.
+  queues_[0].clear();
+  queues_[1].clear();
+  DrainRings();
+  for (auto &port : ports_) {
+    LOG_IF(ERROR, port.use_count() > 1)
+        << "Port " << port->GetPortId() << " is still in use";
+    port.reset();
+  }
+  for (auto &rings : rings_) {
+    for (auto *ring : rings) rte_ring_free(ring);
+  }
+}
+
+LinkStats LoopbackLink::GetStats(size_t end) const {
+  LinkStats stats;
+  rte_eth_stats eth_stats;
+  if (rte_eth_stats_get(ports_.at(end)->GetPortId(), &eth_stats) == 0) {
+    stats.packets = eth_stats.opackets;
+  }
+  constexpr auto kRelaxed = std::memory_order_relaxed;
+  for (const auto &queue : queues_[end]) {
+    stats.drops += queue->drops.load(kRelaxed);
+    stats.duplicates += queue->duplicates.load(kRelaxed);
+    stats.reorders += queue->reorders.load(kRelaxed);
+  }
+  return stats;
+}
+
+void LoopbackLink::DrainRings() {
+  for (auto &rings : rings_) {
+    for (auto *ring : rings) {
+      void *mbufs[PacketBatch::kMaxBurst];
+      unsigned n;
+      while ((n = rte_ring_sc_dequeue_burst(ring, mbufs, PacketBatch::kMaxBurst,
+                                            nullptr)) != 0) {
+        for (unsigned i = 0; i < n; i++) {
+          rte_pktmbuf_free(static_cast<rte_mbuf *>(mbufs[i]));
+        }
+      }
+    }
+  }
+}
+
+}  // namespace dpdk
+}  // namespace juggler
@@ -0,0 +1,122 @@
+/**
+ * @file loopback_link_test.cc
+ *
+ * Unit tests for the LoopbackLink class.
+ */
+#include <dpdk.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <loopback_link.h>
+#include <packet.h>
+#include <pmd.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace juggler {
+namespace dpdk {
+
+class LoopbackLinkTest : public ::testing::Test {
+ protected:
+  void Create(const LinkImpairments &impairments) {
+    static int links = 0;
+    link_ = std::make_unique<LoopbackLink>(
+        "lbtest" + std::to_string(links++), 1,
+        std::array<LinkImpairments, 2>{impairments, LinkImpairments{}});
+  }
+
+  // Send `n' packets from end 0, numbered from 0.
+  void Send(uint32_t n) {
+    auto *txring = link_->port(0)->GetRing<TxRing>(0);
+    for (uint32_t i = 0; i < n; i++) {
+      auto *packet = CHECK_NOTNULL(txring->GetPacketPool()->PacketAlloc());
+      auto *seqno = CHECK_NOTNULL(packet->append<uint32_t *>(kPacketLen));
+      *seqno = i;
+      txring->BufferPacket(packet);
+    }
+    txring->Flush();
+  }
+
+  // The numbers of the packets received at end 1, in order.
+  std::vector<uint32_t> Receive() {
+    std::vector<uint32_t> received;
+    auto *rxring = link_->port(1)->GetRing<RxRing>(0);
+    PacketBatch batch;
+    while (rxring->RecvPackets(&batch) != 0) {
+      for (uint16_t i = 0; i < batch.GetSize(); i++) {
+        received.push_back(*batch.pkts()[i]->head_data<uint32_t *>());
+      }
+      batch.Release();
+    }
+    return received;
+  }
+
+  static constexpr uint16_t kPacketLen = 64;
+  std::unique_ptr<LoopbackLink> link_;
+};
+
+TEST_F(LoopbackLinkTest, PassThrough) {
+  Create(LinkImpairments{});
+  Send(100);
+  const auto received = Receive();
+  ASSERT_EQ(received.size(), 100);
+  for (uint32_t i = 0; i < received.size(); i++) EXPECT_EQ(received[i], i);
+  EXPECT_EQ(link_->GetStats(0).packets, 100);
+  EXPECT_EQ(link_->GetStats(1).packets, 0);
+}
+
+TEST_F(LoopbackLinkTest, LossAndDuplication) {
+  LinkImpairments lossy;
+  lossy.loss = 1;
+  Create(lossy);
+  Send(100);
+  EXPECT_TRUE(Receive().empty());
+  EXPECT_EQ(link_->GetStats(0).drops, 100);
+
+  LinkImpairments duplicating;
+  duplicating.duplicate = 1;
+  Create(duplicating);
+  Send(10);
+  EXPECT_EQ(Receive().size(), 20);
+  EXPECT_EQ(link_->GetStats(0).duplicates, 10);
+}
+
+TEST_F(LoopbackLinkTest, DelayAndReorder) {
+  LinkImpairments delayed;
+  delayed.delay_ns = 10000000;  // 10ms
+  delayed.reorder = 0.5;
+  delayed.reorder_delay_ns = 1000000;  // 1ms
+  Create(delayed);
+  Send(100);
+  EXPECT_TRUE(Receive().empty());
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  auto received = Receive();
+  ASSERT_EQ(received.size(), 100);
+  // Some packets were overtaken, but all of them made it.
+  EXPECT_GT(link_->GetStats(0).reorders, 0);
+  EXPECT_FALSE(std::is_sorted(received.begin(), received.end()));
+  std::sort(received.begin(), received.end());
+  for (uint32_t i = 0; i < received.size(); i++) EXPECT_EQ(received[i], i);
+}
+
+}  // namespace dpdk
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+
+  auto kEalOpts = juggler::utils::CmdLineOpts(
+      {"-c", "0x0", "-n", "6", "--proc-type=auto", "-m", "1024", "--log-level",
+       "8", "--no-pci"});
+  auto d = juggler::dpdk::Dpdk();
+  d.InitDpdk(kEalOpts);
+  return RUN_ALL_TESTS();
+}
@@ -3,28 +3,117 @@
 #include <rte_mbuf.h>
 #include <rte_mbuf_pool_ops.h>
 #include <rte_mempool.h>
+#include <rte_ring.h>
 
 #include <string>
 
 namespace juggler {
 namespace dpdk {
 
-[[maybe_unused]] static rte_mempool* CreateSpScPacketPool(
-    const std::string& name, uint32_t nmbufs, uint16_t mbuf_data_size) {
+// Mempool handler of packet pools: a single-producer/single-consumer ring
+// (like DPDK's "ring_sp_sc"), which also detaches the external buffers of
+// mbufs put back to the pool while still attached to them.
+//
+// This happens with the `FAST_FREE' TX offload, where drivers return sent
+// mbufs straight to their pool, skipping `rte_pktmbuf_free()'. Without this,
+// zero-copy TX packets would come back with the (channel) buffer they were
+// attached to, and the buffer would never learn that the NIC is done with it.
+
+static int PacketPoolOpsAlloc(rte_mempool* mp) {
+  char name[RTE_RING_NAMESIZE];
+  const int ret = snprintf(name, sizeof(name), "%s%s", RTE_MEMPOOL_MZ_PREFIX,
+                           mp->name);
+  if (ret < 0 || ret >= static_cast<int>(sizeof(name))) return -ENAMETOOLONG;
+
+  auto* r = rte_ring_create(name, rte_align32pow2(mp->size + 1), mp->socket_id,
+                            RING_F_SP_ENQ | RING_F_SC_DEQ);
+  if (r == nullptr) return -rte_errno;
+  mp->pool_data = r;
+  return 0;
+}
+
+static void PacketPoolOpsFree(rte_mempool* mp) {
+  rte_ring_free(static_cast<rte_ring*>(mp->pool_data));
+}
+
+static int PacketPoolOpsEnqueue(rte_mempool* mp, void* const* obj_table,
+                                unsigned int n) {
+  for (unsigned int i = 0; i < n; i++) {
+    auto* mbuf = static_cast<rte_mbuf*>(obj_table[i]);
+    if (RTE_MBUF_HAS_EXTBUF(mbuf)) [[unlikely]]
+      rte_pktmbuf_detach(mbuf);
+  }
+  return rte_ring_sp_enqueue_bulk(static_cast<rte_ring*>(mp->pool_data),
+                                  obj_table, n, nullptr) == 0
+             ? -ENOBUFS
+             : 0;
+}
+
+static int PacketPoolOpsDequeue(rte_mempool* mp, void** obj_table,
+                                unsigned int n) {
+  return rte_ring_sc_dequeue_bulk(static_cast<rte_ring*>(mp->pool_data),
+                                  obj_table, n, nullptr) == 0
+             ? -ENOBUFS
+             : 0;
+}
+
+static unsigned int PacketPoolOpsGetCount(const rte_mempool* mp) {
+  return rte_ring_count(static_cast<const rte_ring*>(mp->pool_data));
+}
+
+static rte_mempool_ops packet_pool_ops = {
+    .name = "machnet_ring_sp_sc",
+    .alloc = PacketPoolOpsAlloc,
+    .free = PacketPoolOpsFree,
+    .enqueue = PacketPoolOpsEnqueue,
+    .dequeue = PacketPoolOpsDequeue,
+    .get_count = PacketPoolOpsGetCount,
+};
+RTE_MEMPOOL_REGISTER_OPS(packet_pool_ops);
+
+// Mempools are allocated on the caller's socket, unless told otherwise.
+static int PacketPoolSocket(int socket_id) {
+  return socket_id == SOCKET_ID_ANY ? static_cast<int>(rte_socket_id())
+                                    : socket_id;
+}
+
+static rte_mempool* CreateSpScPacketPool(const std::string& name,
+                                         uint32_t nmbufs,
+                                         uint16_t mbuf_data_size,
+                                         int socket_id) {
+  // Mbufs are single-producer/single-consumer, and have no per-lcore cache,
+  // so that every mbuf put back goes through `PacketPoolOpsEnqueue()'.
+  struct rte_mempool* mp = rte_pktmbuf_pool_create_by_ops(
+      name.c_str(), nmbufs, 0, 0, mbuf_data_size, PacketPoolSocket(socket_id),
+      packet_pool_ops.name);
+  if (mp == nullptr) {
+    LOG(ERROR) << "rte_pktmbuf_pool_create_by_ops() failed: "
+               << rte_strerror(rte_errno);
+    return nullptr;
+  }
+
+  return mp;
+}
+
+static rte_mempool* CreatePinnedExtBufPacketPool(
+    const std::string& name, uint32_t nmbufs, uint16_t buf_size,
+    rte_mempool_obj_cb_t* obj_init, void* obj_init_arg, int socket_id) {
   struct rte_mempool* mp;
   struct rte_pktmbuf_pool_private mbp_priv;
 
-  const uint16_t priv_size = 0;
-  const size_t elt_size = sizeof(struct rte_mbuf) + priv_size + mbuf_data_size;
+  // The data buffers are external; each element only holds the mbuf.
+  const size_t elt_size = sizeof(struct rte_mbuf);
   memset(&mbp_priv, 0, sizeof(mbp_priv));
-  mbp_priv.mbuf_data_room_size = mbuf_data_size;
-  mbp_priv.mbuf_priv_size = priv_size;
+  mbp_priv.mbuf_data_room_size = buf_size;
+  mbp_priv.mbuf_priv_size = 0;
+  mbp_priv.flags = RTE_PKTMBUF_POOL_F_PINNED_EXT_BUF;
 
   const unsigned int kMemPoolFlags =
       RTE_MEMPOOL_F_SC_GET | RTE_MEMPOOL_F_SP_PUT;
   mp = rte_mempool_create(name.c_str(), nmbufs, elt_size, 0, sizeof(mbp_priv),
-                          rte_pktmbuf_pool_init, &mbp_priv, rte_pktmbuf_init,
-                          NULL, rte_socket_id(), kMemPoolFlags);
+                          rte_pktmbuf_pool_init, &mbp_priv, obj_init,
+                          obj_init_arg, PacketPoolSocket(socket_id),
+                          kMemPoolFlags);
   if (mp == nullptr) {
     LOG(ERROR) << "rte_mempool_create() failed. ";
     return nullptr;
@@ -39,17 +128,18 @@ uint16_t PacketPool::next_id_ = 0;
 // 'nmbufs' is the number of mbufs to allocate in the backing pool.
 // 'mbuf_size' the size of an mbuf buffer. (MBUF_DATASZ_DEFAULT is the minimum)
 PacketPool::PacketPool(uint32_t nmbufs, uint16_t mbuf_size,
-                       const char* mempool_name)
+                       const char* mempool_name, int socket_id)
     : is_dpdk_primary_process_(rte_eal_process_type() == RTE_PROC_PRIMARY) {
   if (is_dpdk_primary_process_) {
     // Create mempool here, choose the name automatically
     id_ = ++next_id_;
     std::string mpool_name = "mbufpool" + std::to_string(id_);
     LOG(INFO) << "[ALLOC] [type:mempool, name:" << mpool_name
-              << ", nmbufs:" << nmbufs << ", mbuf_size:" << mbuf_size << "]";
+              << ", nmbufs:" << nmbufs << ", mbuf_size:" << mbuf_size
+              << ", socket:" << PacketPoolSocket(socket_id) << "]";
     // mpool_ = rte_pktmbuf_pool_create(mpool_name.c_str(), nmbufs, 0, 0,
     //                                  mbuf_size, SOCKET_ID_ANY);
-    mpool_ = CreateSpScPacketPool(mpool_name, nmbufs, mbuf_size);
+    mpool_ = CreateSpScPacketPool(mpool_name, nmbufs, mbuf_size, socket_id);
     CHECK(mpool_) << "Failed to create packet pool.";
   } else {
     // Lookup mempool created earlier by the primary
@@ -66,6 +156,21 @@ PacketPool::PacketPool(uint32_t nmbufs, uint16_t mbuf_size,
   }
 }
 
+PacketPool::PacketPool(uint32_t nmbufs, uint16_t buf_size,
+                       rte_mempool_obj_cb_t* obj_init, void* obj_init_arg,
+                       int socket_id)
+    : is_dpdk_primary_process_(rte_eal_process_type() == RTE_PROC_PRIMARY) {
+  CHECK(is_dpdk_primary_process_)
+      << "External buffer pools can only be created by the primary process.";
+  id_ = ++next_id_;
+  std::string mpool_name = "extbufpool" + std::to_string(id_);
+  LOG(INFO) << "[ALLOC] [type:mempool, name:" << mpool_name
+            << ", nmbufs:" << nmbufs << ", ext_buf_size:" << buf_size << "]";
+  mpool_ = CreatePinnedExtBufPacketPool(mpool_name, nmbufs, buf_size, obj_init,
+                                        obj_init_arg, socket_id);
+  CHECK(mpool_) << "Failed to create packet pool.";
+}
+
 PacketPool::~PacketPool() {
   LOG(INFO) << "[FREE] [type:mempool, name:" << this->GetPacketPoolName()
             << "]";
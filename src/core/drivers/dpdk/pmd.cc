@@ -1,6 +1,8 @@
 #include <glog/logging.h>
 #include <pmd.h>
+#include <rte_errno.h>
 #include <rte_ether.h>
+#include <rte_mbuf_dyn.h>
 #include <utils.h>
 
 #include <algorithm>
@@ -29,14 +31,20 @@ __attribute__((unused)) static void ReportLinkStatus(uint8_t port_id) {
   }
 }
 
-static rte_eth_conf DefaultEthConf(const rte_eth_dev_info *devinfo) {
+static rte_eth_conf DefaultEthConf(const rte_eth_dev_info *devinfo,
+                                   uint16_t mtu, bool tx_fast_free) {
   CHECK_NOTNULL(devinfo);
 
   struct rte_eth_conf port_conf = rte_eth_conf();
 
-  // The `net_null' driver is only used for testing, and it does not support
-  // offloads so return a very basic ethernet configuration.
-  if (std::string(devinfo->driver_name) == "net_null") return port_conf;
+  // The `net_null' and `net_ring' (see `LoopbackLink') drivers are only used
+  // for testing, and they do not support offloads so return a very basic
+  // ethernet configuration.
+  const std::string driver_name(devinfo->driver_name);
+  if (driver_name == "net_null" || driver_name == "net_ring") {
+    port_conf.rxmode.mtu = mtu;
+    return port_conf;
+  }
 
   port_conf.link_speeds = ETH_LINK_SPEED_AUTONEG;
   uint64_t rss_hf = ETH_RSS_IP | ETH_RSS_UDP | ETH_RSS_TCP | ETH_RSS_SCTP;
@@ -47,11 +55,17 @@ static rte_eth_conf DefaultEthConf(const rte_eth_dev_info *devinfo) {
   port_conf.lpbk_mode = 1;
   port_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
 
-  port_conf.rxmode.mtu = PmdRing::kDefaultFrameSize;
-  port_conf.rxmode.max_lro_pkt_size = PmdRing::kDefaultFrameSize;
+  port_conf.rxmode.mtu = mtu;
+  port_conf.rxmode.max_lro_pkt_size = mtu;
   port_conf.rxmode.split_hdr_size = 0;
   const auto rx_offload_capa = devinfo->rx_offload_capa;
   port_conf.rxmode.offloads |= ((RTE_ETH_RX_OFFLOAD_CHECKSUM)&rx_offload_capa);
+  if ((rx_offload_capa & RTE_ETH_RX_OFFLOAD_BUFFER_SPLIT) &&
+      (rx_offload_capa & RTE_ETH_RX_OFFLOAD_SCATTER)) {
+    // Multi-segment RX, needed to split packets into header and payload
+    // buffers (see `RxRing::ConfigureBufferSplit()').
+    port_conf.rxmode.offloads |= RTE_ETH_RX_OFFLOAD_SCATTER;
+  }
 
   port_conf.rx_adv_conf.rss_conf = {
       .rss_key = nullptr,
@@ -70,7 +84,7 @@ static rte_eth_conf DefaultEthConf(const rte_eth_dev_info *devinfo) {
   port_conf.txmode.offloads =
       (DEV_TX_OFFLOAD_IPV4_CKSUM | DEV_TX_OFFLOAD_UDP_CKSUM);
 
-  if (tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE) {
+  if (tx_fast_free && (tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE)) {
     // TODO(ilias): Add option to the constructor to enable this offload.
     LOG(WARNING)
         << "Enabling FAST FREE: use always the same mempool for each queue.";
@@ -82,7 +96,7 @@ static rte_eth_conf DefaultEthConf(const rte_eth_dev_info *devinfo) {
 
 void TxRing::Init() {
   int ret = rte_eth_tx_queue_setup(this->GetPortId(), this->GetRingId(),
-                                   this->GetDescNum(), SOCKET_ID_ANY, &conf_);
+                                   this->GetDescNum(), GetSocketId(), &conf_);
   if (ret != 0) {
     LOG(FATAL) << "rte_eth_tx_queue_setup() faled. Cannot setup TX queue.";
   }
@@ -90,14 +104,90 @@ void TxRing::Init() {
 
 void RxRing::Init() {
   int ret = rte_eth_rx_queue_setup(this->GetPortId(), this->GetRingId(),
-                                   this->GetDescNum(), SOCKET_ID_ANY, &conf_,
+                                   this->GetDescNum(), GetSocketId(), &conf_,
                                    this->GetPacketMemPool());
   if (ret != 0) {
     LOG(FATAL) << "rte_eth_rx_queue_setup() faled. Cannot setup RX queue.";
   }
 }
 
+bool RxRing::InitInterrupt() {
+  int ret = rte_eth_dev_rx_intr_ctl_q(GetPortId(), GetRingId(),
+                                      RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_ADD,
+                                      nullptr);
+  if (ret != 0) {
+    LOG(WARNING) << "RX interrupts are not supported for RX ring "
+                 << GetRingId() << " (" << rte_strerror(-ret) << ")";
+    return false;
+  }
+  return true;
+}
+
+void RxRing::WaitForPackets(int timeout_ms) {
+  if (rte_eth_dev_rx_intr_enable(GetPortId(), GetRingId()) != 0) return;
+  // Packets that arrived before the interrupt was enabled raise none.
+  if (rte_eth_rx_queue_count(GetPortId(), GetRingId()) <= 0) {
+    struct rte_epoll_event event;
+    rte_epoll_wait(RTE_EPOLL_PER_THREAD, &event, 1, timeout_ms);
+  }
+  rte_eth_dev_rx_intr_disable(GetPortId(), GetRingId());
+}
+
+bool RxRing::ConfigureBufferSplit(PacketPool *payload_pool, uint16_t hdr_len) {
+  if (payload_pool != nullptr && !GetPmdPort()->SupportsRxBufferSplit()) {
+    LOG(WARNING) << "Port " << static_cast<int>(GetPortId())
+                 << " does not support RX buffer split.";
+    return false;
+  }
+
+  int ret = rte_eth_dev_rx_queue_stop(GetPortId(), GetRingId());
+  if (ret != 0) {
+    LOG(ERROR) << "rte_eth_dev_rx_queue_stop() failed for RX ring "
+               << GetRingId() << " (" << rte_strerror(-ret) << ")";
+    return false;
+  }
+
+  struct rte_eth_rxconf conf = conf_;
+  union rte_eth_rxseg rx_seg[2];
+  memset(rx_seg, 0, sizeof(rx_seg));
+  rte_mempool *mp = GetPacketMemPool();
+  if (payload_pool != nullptr) {
+    rx_seg[0].split.mp = GetPacketMemPool();
+    rx_seg[0].split.length = hdr_len;
+    rx_seg[1].split.mp = payload_pool->GetMemPool();
+    rx_seg[1].split.length = 0;  // The rest of the packet.
+    conf.rx_seg = rx_seg;
+    conf.rx_nseg = 2;
+    conf.offloads |= RTE_ETH_RX_OFFLOAD_BUFFER_SPLIT;
+    mp = nullptr;
+  }
+
+  bool success = true;
+  ret = rte_eth_rx_queue_setup(GetPortId(), GetRingId(), GetDescNum(),
+                               GetSocketId(), &conf, mp);
+  if (ret != 0) {
+    LOG(ERROR) << "rte_eth_rx_queue_setup() failed for RX ring " << GetRingId()
+               << " (" << rte_strerror(-ret) << ")";
+    // Fall back to receiving whole packets.
+    success = false;
+    ret = rte_eth_rx_queue_setup(GetPortId(), GetRingId(), GetDescNum(),
+                                 GetSocketId(), &conf_, GetPacketMemPool());
+    if (ret != 0) {
+      LOG(FATAL) << "rte_eth_rx_queue_setup() faled. Cannot setup RX queue.";
+    }
+  }
+
+  ret = rte_eth_dev_rx_queue_start(GetPortId(), GetRingId());
+  if (ret != 0) {
+    LOG(FATAL) << "rte_eth_dev_rx_queue_start() failed for RX ring "
+               << GetRingId() << " (" << rte_strerror(-ret) << ")";
+  }
+
+  return success;
+}
+
 void PmdPort::InitDriver(uint16_t mtu) {
+  mtu_ = mtu;
   if (is_dpdk_primary_process_) {
     // Get DPDK port info.
     FetchDpdkPortInfo(port_id_, &devinfo_, &l2_addr_, &pci_info_);
@@ -135,7 +225,33 @@ void PmdPort::InitDriver(uint16_t mtu) {
     }
 
     LOG(INFO) << "Rings nr: " << rx_rings_nr_;
-    const rte_eth_conf portconf = DefaultEthConf(&devinfo_);
+    if (devinfo_.max_mtu != 0 && mtu > devinfo_.max_mtu) {
+      LOG(FATAL) << "MTU " << mtu << " exceeds the maximum MTU ("
+                 << devinfo_.max_mtu << ") of port "
+                 << static_cast<int>(port_id_);
+    }
+    // Fast free takes all the mbufs of a TX queue to be of a single pool.
+    rte_eth_conf portconf = DefaultEthConf(
+        &devinfo_, mtu,
+        tx_fast_free_requested_ && pool_config_.ctrl_mbufs == 0);
+    tx_fast_free_ =
+        (portconf.txmode.offloads & DEV_TX_OFFLOAD_MBUF_FAST_FREE) != 0;
+    portconf.intr_conf.rxq = rx_interrupts_ ? 1 : 0;
+    if (rx_timestamps_requested_) {
+      if (!(devinfo_.rx_offload_capa & RTE_ETH_RX_OFFLOAD_TIMESTAMP)) {
+        LOG(WARNING) << "Port " << static_cast<int>(port_id_)
+                     << " does not support RX timestamps; using software "
+                        "timestamps.";
+      } else if (rte_mbuf_dyn_rx_timestamp_register(&rx_timestamp_offset_,
+                                                    &rx_timestamp_flag_) !=
+                 0) {
+        LOG(WARNING) << "Failed to register the RX timestamp mbuf field: "
+                     << rte_strerror(rte_errno);
+        rx_timestamp_offset_ = -1;
+      } else {
+        portconf.rxmode.offloads |= RTE_ETH_RX_OFFLOAD_TIMESTAMP;
+      }
+    }
     int ret =
         rte_eth_dev_configure(port_id_, rx_rings_nr_, tx_rings_nr_, &portconf);
     if (ret != 0) {
@@ -171,11 +287,13 @@ void PmdPort::InitDriver(uint16_t mtu) {
     rss_reta_conf_.resize(devinfo_.reta_size / RTE_ETH_RETA_GROUP_SIZE,
                           {-1ull, {0}});
 
+    // The reserved queues are left out (see `ReserveQueues()').
+    const uint16_t rss_rings_nr = rx_rings_nr_ - reserved_queues_nr_;
     for (auto i = 0u; i < devinfo_.reta_size; i++) {
       // Initialize the RETA table in a round-robin fashion.
       auto index = i / RTE_ETH_RETA_GROUP_SIZE;
       auto shift = i % RTE_ETH_RETA_GROUP_SIZE;
-      rss_reta_conf_[index].reta[shift] = i % rx_rings_nr_;
+      rss_reta_conf_[index].reta[shift] = i % rss_rings_nr;
       rss_reta_conf_[index].mask |= (1 << shift);
     }
 
@@ -236,18 +354,36 @@ void PmdPort::InitDriver(uint16_t mtu) {
           << static_cast<int>(port_id_);
     }
 
-    const auto mbuf_data_size =
+    const uint32_t frame_data_size =
         mtu + RTE_ETHER_HDR_LEN + RTE_ETHER_CRC_LEN + RTE_PKTMBUF_HEADROOM;
+    const uint32_t mbuf_data_size = pool_config_.data_room != 0
+                                        ? pool_config_.data_room
+                                        : frame_data_size;
+    CHECK_GE(mbuf_data_size, frame_data_size)
+        << "Mbufs must hold full frames at MTU " << mtu;
+    const uint32_t tx_mbufs = pool_config_.tx_mbufs != 0
+                                  ? pool_config_.tx_mbufs
+                                  : 2 * tx_ring_desc_nr_ - 1;
+    const uint32_t rx_mbufs = pool_config_.rx_mbufs != 0
+                                  ? pool_config_.rx_mbufs
+                                  : 2 * rx_ring_desc_nr_ - 1;
+    // The NIC holds an mbuf per RX descriptor.
+    CHECK_GT(rx_mbufs, rx_ring_desc_nr_)
+        << "RX pools need more mbufs than the " << rx_ring_desc_nr_
+        << " RX descriptors";
 
     // Setup the TX queues.
     for (auto q = 0; q < tx_rings_nr_; q++) {
       LOG(INFO) << "Initializing TX ring: " << q;
       auto tx_ring = makeRing<TxRing>(this, port_id_, q, tx_ring_desc_nr_,
-                                      devinfo_.default_txconf,
-                                      2 * tx_ring_desc_nr_ - 1, mbuf_data_size);
+                                      devinfo_.default_txconf, tx_mbufs,
+                                      mbuf_data_size);
       // auto tx_ring = makeRing<TxRing>(this, port_id_, q, tx_ring_desc_nr_,
       //                                 devinfo_.default_txconf);
       tx_ring.get()->Init();
+      if (pool_config_.ctrl_mbufs != 0) {
+        tx_ring->AttachCtrlPool(pool_config_.ctrl_mbufs);
+      }
       tx_rings_.emplace_back(std::move(tx_ring));
     }
 
@@ -255,8 +391,8 @@ void PmdPort::InitDriver(uint16_t mtu) {
     for (auto q = 0; q < rx_rings_nr_; q++) {
       LOG(INFO) << "Initializing RX ring: " << q;
       auto rx_ring = makeRing<RxRing>(this, port_id_, q, rx_ring_desc_nr_,
-                                      devinfo_.default_rxconf,
-                                      2 * rx_ring_desc_nr_ - 1, mbuf_data_size);
+                                      devinfo_.default_rxconf, rx_mbufs,
+                                      mbuf_data_size);
       rx_ring.get()->Init();
       rx_rings_.emplace_back(std::move(rx_ring));
     }
@@ -278,6 +414,16 @@ void PmdPort::InitDriver(uint16_t mtu) {
       LOG(FATAL) << "rte_eth_dev_start() failed.";
     }
 
+    // Timestamps are of no use if the NIC clock cannot be read to convert them
+    // (see `NicClock').
+    uint64_t nic_ticks;
+    if (rx_timestamps() && rte_eth_read_clock(port_id_, &nic_ticks) != 0) {
+      LOG(WARNING) << "Cannot read the clock of port "
+                   << static_cast<int>(port_id_)
+                   << "; using software timestamps.";
+      rx_timestamp_offset_ = -1;
+    }
+
     LOG(INFO) << "Waiting for link to get up...";
     struct rte_eth_link link;
     memset(&link, '0', sizeof(link));
@@ -321,6 +467,36 @@ void PmdPort::InitDriver(uint16_t mtu) {
   initialized_ = true;
 }
 
+void PmdPort::InitSecondary(uint16_t queue_id,
+                            const std::string &rx_mempool_name,
+                            const std::string &tx_mempool_name) {
+  CHECK(!is_dpdk_primary_process_)
+      << "Only DPDK secondary processes share the queues of a port.";
+  CHECK(!initialized_);
+  CHECK_LT(queue_id, std::min(rx_rings_nr_, tx_rings_nr_));
+  FetchDpdkPortInfo(port_id_, &devinfo_, &l2_addr_, &pci_info_);
+  device_ = devinfo_.device;
+  const auto mtu = GetMTU();
+  CHECK(mtu.has_value()) << "Failed to get MTU for port "
+                         << static_cast<int>(port_id_);
+  mtu_ = mtu.value();
+  // The primary process configured the port, possibly with fast free.
+  tx_fast_free_ = true;
+
+  // The primary process set the queues up already; only the pair of this
+  // process gets rings.
+  tx_rings_.resize(tx_rings_nr_);
+  rx_rings_.resize(rx_rings_nr_);
+  tx_rings_[queue_id] = makeRing<TxRing>(this, port_id_, queue_id,
+                                         tx_ring_desc_nr_, tx_mempool_name);
+  rx_rings_[queue_id] = makeRing<RxRing>(this, port_id_, queue_id,
+                                         rx_ring_desc_nr_, rx_mempool_name);
+  LOG(INFO) << "[PMDPORT: " << static_cast<int>(port_id_)
+            << "] Attached to queue " << queue_id << " (MTU " << mtu_ << ")";
+
+  initialized_ = true;
+}
+
 void PmdPort::UpdatePortStats() {
   int ret = rte_eth_stats_get(port_id_, &port_stats_);
   if (ret != 0) {
@@ -329,8 +505,134 @@ void PmdPort::UpdatePortStats() {
   }
 }
 
+bool PmdPort::RedirectRSSBuckets(const std::vector<uint16_t> &buckets,
+                                 uint16_t rx_queue_id) {
+  CHECK_LT(rx_queue_id, rx_rings_nr_);
+  const std::lock_guard<std::mutex> lock(reta_mtx_);
+  // Only the entries with their bit set in the masks are updated.
+  std::vector<rte_eth_rss_reta_entry64> update(rss_reta_conf_.size(),
+                                               {0, {0}});
+  for (const auto bucket : buckets) {
+    CHECK_LT(bucket, devinfo_.reta_size);
+    const auto index = bucket / RTE_ETH_RETA_GROUP_SIZE;
+    const auto shift = bucket % RTE_ETH_RETA_GROUP_SIZE;
+    update[index].mask |= (1ULL << shift);
+    update[index].reta[shift] = rx_queue_id;
+  }
+
+  const int ret =
+      rte_eth_dev_rss_reta_update(port_id_, update.data(), devinfo_.reta_size);
+  if (ret != 0) {
+    LOG(WARNING) << "Failed to update RSS RETA configuration for port "
+                 << static_cast<int>(port_id_) << ". Error "
+                 << rte_strerror(ret);
+    return false;
+  }
+
+  for (const auto bucket : buckets) {
+    const auto index = bucket / RTE_ETH_RETA_GROUP_SIZE;
+    const auto shift = bucket % RTE_ETH_RETA_GROUP_SIZE;
+    __atomic_store_n(&rss_reta_conf_[index].reta[shift], rx_queue_id,
+                     __ATOMIC_RELAXED);
+  }
+  return true;
+}
+
+rte_flow *PmdPort::AddUdpSteeringRule(const net::Ipv4::Address *dst_addr,
+                                      uint16_t dst_port,
+                                      uint16_t dst_port_mask,
+                                      uint16_t rx_queue_id, uint32_t priority) {
+  rte_flow_item_ipv4 ipv4_spec{}, ipv4_mask{};
+  if (dst_addr != nullptr) {
+    ipv4_spec.hdr.dst_addr = dst_addr->address.raw_value();
+    ipv4_mask.hdr.dst_addr = UINT32_MAX;
+  }
+  rte_flow_item_udp udp_spec{}, udp_mask{};
+  udp_spec.hdr.dst_port = rte_cpu_to_be_16(dst_port & dst_port_mask);
+  udp_mask.hdr.dst_port = rte_cpu_to_be_16(dst_port_mask);
+
+  const rte_flow_item pattern[] = {
+      {.type = RTE_FLOW_ITEM_TYPE_ETH},
+      {.type = RTE_FLOW_ITEM_TYPE_IPV4,
+       .spec = dst_addr != nullptr ? &ipv4_spec : nullptr,
+       .mask = dst_addr != nullptr ? &ipv4_mask : nullptr},
+      {.type = RTE_FLOW_ITEM_TYPE_UDP, .spec = &udp_spec, .mask = &udp_mask},
+      {.type = RTE_FLOW_ITEM_TYPE_END},
+  };
+  return AddSteeringRule("UDP", priority, pattern, rx_queue_id);
+}
+
+rte_flow *PmdPort::AddEthTypeSteeringRule(uint16_t eth_type,
+                                          uint16_t rx_queue_id,
+                                          uint32_t priority) {
+  rte_flow_item_eth eth_spec{}, eth_mask{};
+  eth_spec.type = rte_cpu_to_be_16(eth_type);
+  eth_mask.type = UINT16_MAX;
+
+  const rte_flow_item pattern[] = {
+      {.type = RTE_FLOW_ITEM_TYPE_ETH, .spec = &eth_spec, .mask = &eth_mask},
+      {.type = RTE_FLOW_ITEM_TYPE_END},
+  };
+  return AddSteeringRule("EtherType", priority, pattern, rx_queue_id);
+}
+
+rte_flow *PmdPort::AddIpv4ProtoSteeringRule(uint8_t proto,
+                                            uint16_t rx_queue_id,
+                                            uint32_t priority) {
+  rte_flow_item_ipv4 ipv4_spec{}, ipv4_mask{};
+  ipv4_spec.hdr.next_proto_id = proto;
+  ipv4_mask.hdr.next_proto_id = UINT8_MAX;
+
+  const rte_flow_item pattern[] = {
+      {.type = RTE_FLOW_ITEM_TYPE_ETH},
+      {.type = RTE_FLOW_ITEM_TYPE_IPV4, .spec = &ipv4_spec, .mask = &ipv4_mask},
+      {.type = RTE_FLOW_ITEM_TYPE_END},
+  };
+  return AddSteeringRule("IP protocol", priority, pattern, rx_queue_id);
+}
+
+rte_flow *PmdPort::AddSteeringRule(const char *kind, uint32_t priority,
+                                   const rte_flow_item *pattern,
+                                   uint16_t rx_queue_id) {
+  CHECK_LT(rx_queue_id, rx_rings_nr_);
+  rte_flow_attr attr{};
+  attr.ingress = 1;
+  attr.priority = priority;
+
+  const rte_flow_action_queue queue{.index = rx_queue_id};
+  const rte_flow_action actions[] = {
+      {.type = RTE_FLOW_ACTION_TYPE_QUEUE, .conf = &queue},
+      {.type = RTE_FLOW_ACTION_TYPE_END},
+  };
+
+  rte_flow_error error{};
+  if (rte_flow_validate(port_id_, &attr, pattern, actions, &error) != 0) {
+    LOG(WARNING) << "[PMDPORT: " << static_cast<int>(port_id_)
+                 << "] Cannot offload " << kind << " steering rule: "
+                 << (error.message != nullptr ? error.message : "unknown");
+    return nullptr;
+  }
+  auto *rule = rte_flow_create(port_id_, &attr, pattern, actions, &error);
+  LOG_IF(WARNING, rule == nullptr)
+      << "[PMDPORT: " << static_cast<int>(port_id_)
+      << "] Failed to create " << kind << " steering rule: "
+      << (error.message != nullptr ? error.message : "unknown");
+  return rule;
+}
+
+void PmdPort::RemoveSteeringRule(rte_flow *rule) {
+  if (rule == nullptr) return;
+  rte_flow_error error{};
+  LOG_IF(WARNING, rte_flow_destroy(port_id_, rule, &error) != 0)
+      << "[PMDPORT: " << static_cast<int>(port_id_)
+      << "] Failed to remove steering rule: "
+      << (error.message != nullptr ? error.message : "unknown");
+}
+
 void PmdPort::DeInit() {
   if (!initialized_ || !is_dpdk_primary_process_) return;
+  rte_flow_error error{};
+  rte_flow_flush(port_id_, &error);
   rte_eth_dev_stop(port_id_);
   rte_eth_dev_close(port_id_);
   LOG(INFO) << juggler::utils::Format("[PMDPORT: %u closed.]", port_id_);
@@ -4,41 +4,312 @@
  * Implementation of `Channel' and `ChannelManager' methods.
  */
 #include <channel.h>
+#include <fcntl.h>
 #include <flow.h>
 #include <glog/logging.h>
+#include <sys/mman.h>
+#include <utils.h>
+
+#include <utility>
 
 namespace juggler {
 namespace shm {
 
+ChannelArena::ChannelArena(const std::string &name, uchar_t *mem,
+                           size_t slot_size, std::vector<int> slot_fds,
+                           bool is_posix_shm)
+    : name_(name),
+      mem_(CHECK_NOTNULL(mem)),
+      slot_size_(slot_size),
+      slot_fds_(std::move(slot_fds)),
+      is_posix_shm_(is_posix_shm),
+      slots_(slot_fds_.size()) {
+  CHECK_EQ(slot_size_ % page_size(), 0);
+  free_slots_.resize(GetSlotCount());
+  // Slots are taken from the back: the lowest ones first.
+  for (size_t i = 0; i < free_slots_.size(); i++) {
+    free_slots_[i] = static_cast<uint32_t>(free_slots_.size() - 1 - i);
+  }
+}
+
+ChannelArena::~ChannelArena() {
+  // The channels of the arena hold it, so none is left by now.
+  if (attached_dev_ != nullptr) {
+    for (size_t i = 0; i < pages_iova_.size(); i++) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+      const auto ret = rte_dev_dma_unmap(attached_dev_, mem_ + i * page_size(),
+                                         pages_iova_[i], page_size());
+#pragma GCC diagnostic pop
+      LOG_IF(ERROR, ret != 0)
+          << "Failed to DMA unmap page " << i << " of channel arena " << name_
+          << " (" << rte_strerror(rte_errno) << ")";
+    }
+    if (rte_extmem_unregister(mem_, mem_size()) != 0) {
+      LOG(ERROR) << "Failed to unregister external memory with DPDK ("
+                 << rte_strerror(rte_errno) << ")";
+    }
+  }
+  munmap(mem_, mem_size());
+  for (const int fd : slot_fds_) close(fd);
+}
+
+std::shared_ptr<ChannelArena> ChannelArena::Create(const std::string &name,
+                                                   size_t slots_nr,
+                                                   size_t slot_size,
+                                                   bool is_posix_shm) {
+  const size_t page_size = is_posix_shm ? kPageSize : kHugePage2MSize;
+  if (slots_nr == 0 || slot_size == 0 || slot_size % page_size != 0) {
+    return nullptr;
+  }
+
+  // Reserve a range of addresses, aligned to the pages, for the slots to be
+  // mapped into one after the other.
+  const size_t mem_size = slots_nr * slot_size;
+  const size_t reserved_size = mem_size + page_size;
+  auto *reserved = static_cast<uchar_t *>(
+      mmap(nullptr, reserved_size, PROT_NONE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+  if (reserved == MAP_FAILED) {
+    LOG(WARNING) << "Failed to reserve " << reserved_size
+                 << " bytes for channel arena " << name << ": "
+                 << strerror(errno);
+    return nullptr;
+  }
+  auto *mem = reinterpret_cast<uchar_t *>(
+      utils::align_size(reinterpret_cast<uintptr_t>(reserved), page_size));
+  if (mem > reserved) munmap(reserved, mem - reserved);
+  if (mem + mem_size < reserved + reserved_size) {
+    munmap(mem + mem_size, reserved + reserved_size - (mem + mem_size));
+  }
+
+  // The applications get the file descriptor of their slot, which they can
+  // map but not resize (the engine would fault on a truncated one).
+  const unsigned int memfd_flags =
+      MFD_CLOEXEC | MFD_ALLOW_SEALING | (is_posix_shm ? 0 : MFD_HUGETLB);
+  const int mmap_flags = MAP_SHARED | MAP_FIXED | MAP_POPULATE |
+                         (is_posix_shm ? 0 : MAP_HUGETLB);
+  std::vector<int> slot_fds;
+  slot_fds.reserve(slots_nr);
+  for (size_t i = 0; i < slots_nr; i++) {
+    auto *slot = mem + i * slot_size;
+    const int fd = memfd_create(name.c_str(), memfd_flags);
+    if (fd >= 0) slot_fds.push_back(fd);
+    if (fd < 0 || ftruncate(fd, slot_size) != 0 ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) !=
+            0 ||
+        mmap(slot, slot_size, PROT_READ | PROT_WRITE, mmap_flags, fd, 0) !=
+            slot ||
+        mlock(slot, slot_size) != 0) {
+      LOG(WARNING) << "Failed to set up slot " << i << " of channel arena "
+                   << name << (is_posix_shm ? "" : " (huge pages)") << ": "
+                   << strerror(errno);
+      munmap(mem, mem_size);
+      for (const int slot_fd : slot_fds) close(slot_fd);
+      return nullptr;
+    }
+  }
+
+  return std::make_shared<ChannelArena>(name, mem, slot_size,
+                                        std::move(slot_fds), is_posix_shm);
+}
+
+uchar_t *ChannelArena::AllocSlot() {
+  uint32_t index;
+  bool dirty;
+  {
+    const std::lock_guard<std::mutex> lock(mtx_);
+    if (free_slots_.empty()) return nullptr;
+    index = free_slots_.back();
+    free_slots_.pop_back();
+    dirty = std::exchange(slots_[index].dirty, false);
+  }
+  auto *slot = mem_ + index * slot_size_;
+  // Nothing that the channel had before is left for the next one to read.
+  if (dirty) memset(slot, 0, slot_size_);
+  return slot;
+}
+
+void ChannelArena::FreeSlot(const void *slot) {
+  const auto index = SlotIndex(slot);
+  const std::lock_guard<std::mutex> lock(mtx_);
+  auto &s = slots_[index];
+  s.dirty = true;
+  if (!s.owner.empty()) {
+    s.retired = true;
+    return;
+  }
+  free_slots_.push_back(static_cast<uint32_t>(index));
+}
+
+void ChannelArena::ReleaseOwner(const std::string &owner) {
+  const std::lock_guard<std::mutex> lock(mtx_);
+  for (size_t i = 0; i < slots_.size(); i++) {
+    auto &s = slots_[i];
+    if (s.owner != owner) continue;
+    // Slots that are still in use are given back directly.
+    s.owner.clear();
+    if (std::exchange(s.retired, false)) {
+      free_slots_.push_back(static_cast<uint32_t>(i));
+    }
+  }
+}
+
+bool ChannelArena::RegisterMemForDMA(rte_device *dev) {
+  if (attached_dev_ == dev) return true;
+  if (attached_dev_ != nullptr) {
+    LOG(ERROR) << "Channel arena " << name_
+               << " is registered with another device";
+    return false;
+  }
+
+  const auto pages_nr = mem_size() / page_size();
+  pages_iova_.resize(pages_nr);
+  for (size_t i = 0; i < pages_nr; i++) {
+    pages_iova_[i] = rte_mem_virt2phy(mem_ + i * page_size());
+    if (pages_iova_[i] == RTE_BAD_IOVA) {
+      LOG(ERROR) << "Failed to get IOVA for page " << i << " of channel arena "
+                 << name_;
+      pages_iova_.clear();
+      return false;
+    }
+  }
+
+  if (rte_extmem_register(mem_, mem_size(), pages_iova_.data(), pages_nr,
+                          page_size()) != 0) {
+    LOG(ERROR) << "Failed to register external memory with DPDK ("
+               << rte_strerror(rte_errno) << ")";
+    pages_iova_.clear();
+    return false;
+  }
+  for (size_t i = 0; i < pages_nr; i++) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    const auto ret = rte_dev_dma_map(dev, mem_ + i * page_size(),
+                                     pages_iova_[i], page_size());
+#pragma GCC diagnostic pop
+    if (ret != 0) {
+      LOG(ERROR) << "Failed to DMA map page " << i << " of channel arena "
+                 << name_ << " (" << rte_strerror(rte_errno) << ")";
+      // Undo the mappings so far.
+      for (size_t j = 0; j < i; j++) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+        rte_dev_dma_unmap(dev, mem_ + j * page_size(), pages_iova_[j],
+                          page_size());
+#pragma GCC diagnostic pop
+      }
+      rte_extmem_unregister(mem_, mem_size());
+      pages_iova_.clear();
+      return false;
+    }
+  }
+
+  attached_dev_ = dev;
+  LOG(INFO) << "Channel arena " << name_ << ": registered " << pages_nr
+            << " pages of size " << page_size() << " bytes for DMA";
+  return true;
+}
+
 ShmChannel::ShmChannel(const std::string channel_name,
                        const MachnetChannelCtx_t *channel_ctx,
                        const size_t channel_mem_size, const bool is_posix_shm,
-                       int channel_fd)
+                       int channel_fd, std::shared_ptr<ChannelArena> arena)
     : name_(channel_name),
       ctx_(CHECK_NOTNULL(channel_ctx)),
       mem_size_(channel_mem_size),
       is_posix_shm_(is_posix_shm),
       channel_fd_(channel_fd),
-      cached_buf_indices(),
-      cached_bufs(),
-      cached_buf_count(0) {}
+      arena_(std::move(arena)),
+      notify_fd_(-1),
+      buf_caches_() {}
 
 ShmChannel::~ShmChannel() {
+  if (notify_fd_ >= 0) close(notify_fd_);
+  // The memory of the channel goes back to its arena, which holds the file
+  // descriptor.
+  if (arena_ != nullptr) {
+    arena_->FreeSlot(ctx_);
+    return;
+  }
   __machnet_channel_destroy(
       const_cast<void *>(reinterpret_cast<const void *>(ctx_)), mem_size_,
       &channel_fd_, is_posix_shm_, name_.c_str());
 }
 
+bool ShmChannel::Reset(size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
+                       size_t buf_ring_slot_nr, size_t buffer_size,
+                       int ring_type) {
+  const int notify_fd = notify_fd_.exchange(-1);
+  if (notify_fd >= 0) close(notify_fd);
+
+  // Whatever the application left in the channel memory is overwritten.
+  const auto ret = __machnet_channel_dataplane_init(
+      reinterpret_cast<uchar_t *>(ctx()), mem_size_, is_posix_shm_,
+      name_.c_str(), machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr,
+      buffer_size, ring_type, 0);
+  if (ret != 0) {
+    LOG(ERROR) << "Failed to reset channel " << name_;
+    return false;
+  }
+
+  rx_msg_count_.store(0, std::memory_order_relaxed);
+  tx_msg_count_.store(0, std::memory_order_relaxed);
+  for (auto &count : tx_batch_counts_) {
+    count.store(0, std::memory_order_relaxed);
+  }
+  buf_drops_.store(0, std::memory_order_relaxed);
+  ctrl_requests_dequeued_ = 0;
+  for (auto &cache : buf_caches_) cache.count = 0;
+  return true;
+}
+
 Channel::Channel(const std::string &channel_name,
                  const MachnetChannelCtx_t *channel_ctx,
                  const size_t channel_mem_size, const bool is_posix_shm,
-                 int channel_fd)
+                 int channel_fd, std::shared_ptr<ChannelArena> arena)
     : ShmChannel(channel_name, channel_ctx, channel_mem_size, is_posix_shm,
-                 channel_fd),
+                 channel_fd, std::move(arena)),
       listeners_(),
-      active_flows_() {}
+      active_flows_(SlabAllocator<Flow>(&flow_pool_)) {}
+
+Channel::~Channel() {
+  LOG_IF(ERROR, tx_zerocopy_inflight_ > 0)
+      << "Channel " << GetName() << " destroyed with " << tx_zerocopy_inflight_
+      << " buffers still held by the NIC";
+  DestroyRxBufferPool();
+  UnregisterDMAMem();
+}
 
-Channel::~Channel() { UnregisterDMAMem(); }
+bool Channel::Recycle(size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
+                      size_t buf_ring_slot_nr, size_t buffer_size,
+                      int ring_type) {
+  CHECK_EQ(tx_zerocopy_inflight_, 0)
+      << "Channel " << GetName() << " still has buffers held by the NIC";
+  DestroyRxBufferPool();
+  tx_zerocopy_bufs_.clear();
+  tx_zerocopy_threshold_ = 0;
+  unordered_delivery_ = false;
+  listeners_.clear();
+  active_flows_.clear();
+  tx_sched_state_ = {};
+  if (!Reset(machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr,
+             buffer_size, ring_type)) {
+    return false;
+  }
+  if (attached_dev_ == nullptr) return true;
+
+  // The buffers stay where they were, but the application could write to
+  // their IOVAs: take them from the pages registered for DMA again.
+  const auto *bufp_mem_start = GetBufPoolAddr();
+  const size_t page_size = IsPosixShm() ? kPageSize : kHugePage2MSize;
+  for (auto i = 0u; i < GetTotalBufCount() + GetSmallBufCount(); ++i) {
+    auto *msg_buf = GetMsgBuf(i);
+    const size_t ofs = msg_buf->base<uchar_t *>() - bufp_mem_start;
+    msg_buf->set_iova(buffer_pages_iova_[ofs / page_size] + ofs % page_size);
+  }
+  return true;
+}
 
 bool Channel::RegisterMemForDMA(rte_device *dev) {
   const auto *bufp_mem_start = GetBufPoolAddr();
@@ -50,6 +321,13 @@ bool Channel::RegisterMemForDMA(rte_device *dev) {
     return false;
   }
 
+  // The channels of an arena share its registration.
+  auto *arena = GetArena();
+  if (arena != nullptr && !arena->RegisterMemForDMA(dev)) return false;
+  const auto iova_of = [arena](const void *va) {
+    return arena != nullptr ? arena->GetIova(va) : rte_mem_virt2phy(va);
+  };
+
   // Check that the memory is page-aligned.
   if (reinterpret_cast<uintptr_t>(bufp_mem_start) & (page_size - 1)) {
     LOG(ERROR) << "Channel memory is not page-aligned (page size: " << page_size
@@ -73,7 +351,7 @@ bool Channel::RegisterMemForDMA(rte_device *dev) {
     const auto *page_addr = bufp_mem_start + i * page_size;
     buffer_pages_va_[i] =
         const_cast<void *>(static_cast<const void *>(page_addr));
-    buffer_pages_iova_[i] = rte_mem_virt2phy(page_addr);
+    buffer_pages_iova_[i] = iova_of(page_addr);
     LOG(INFO) << "Page " << i << " at " << buffer_pages_va_[i] << " has IOVA "
               << buffer_pages_iova_[i];
     if (buffer_pages_iova_[i] == RTE_BAD_IOVA) {
@@ -82,17 +360,23 @@ bool Channel::RegisterMemForDMA(rte_device *dev) {
     }
   }
 
-  // Update the IOVA addresses of the buffers in the buffer pool.
-  for (auto i = 0u; i < GetTotalBufCount(); ++i) {
+  // Update the IOVA addresses of the buffers in the buffer pool (small
+  // buffers included).
+  for (auto i = 0u; i < GetTotalBufCount() + GetSmallBufCount(); ++i) {
     auto *msg_buf = GetMsgBuf(i);
     const auto *buf_va = msg_buf->base();
-    msg_buf->set_iova(rte_mem_virt2phy(buf_va));
+    msg_buf->set_iova(iova_of(buf_va));
     if (msg_buf->iova() == RTE_BAD_IOVA) {
       LOG(ERROR) << utils::Format("Failed to get IOVA for buffer@%p)", buf_va);
       return false;
     }
   }
 
+  if (arena != nullptr) {
+    attached_dev_ = dev;
+    return true;
+  }
+
   // Register external memory with DPDK.
   const auto ret = rte_extmem_register(
       const_cast<void *>(GetBufPoolAddr<void *>()), pages_nr * page_size,
@@ -135,6 +419,14 @@ void Channel::UnregisterDMAMem() {
     return;
   }
 
+  // The memory of an arena stays registered until it is destroyed.
+  if (GetArena() != nullptr) {
+    buffer_pages_va_.clear();
+    buffer_pages_iova_.clear();
+    attached_dev_ = nullptr;
+    return;
+  }
+
   const size_t page_size = IsPosixShm() ? kPageSize : kHugePage2MSize;
   for (auto i = 0u; i < buffer_pages_va_.size(); ++i) {
     LOG(INFO) << utils::Format(
@@ -166,8 +458,92 @@ void Channel::UnregisterDMAMem() {
   attached_dev_ = nullptr;
 }
 
-void Channel::RemoveFlow(
-    const std::list<std::unique_ptr<Flow>>::const_iterator &flow_it) {
+dpdk::PacketPool *Channel::CreateRxBufferPool(uint32_t nmbufs) {
+  if (attached_dev_ == nullptr) {
+    LOG(ERROR) << "Memory is not registered with DPDK";
+    return nullptr;
+  }
+  if (rx_buffer_pool_ != nullptr) {
+    LOG(ERROR) << "RX buffer pool already exists for channel " << GetName();
+    return nullptr;
+  }
+
+  // Channel buffers are attached after the `MachnetMsgBuf_t' header, so that
+  // the NIC places the data where the buffer's payload starts.
+  const size_t buf_size = GetTotalBufSize() - MACHNET_MSGBUF_SPACE_RESERVED;
+  if (buf_size > UINT16_MAX) {
+    LOG(ERROR) << "Channel buffers are too large for mbufs (" << buf_size
+               << " bytes)";
+    return nullptr;
+  }
+  if (GetFreeBufCount() < nmbufs) {
+    LOG(ERROR) << "Not enough free buffers in channel " << GetName()
+               << " for an RX buffer pool of " << nmbufs << " buffers";
+    return nullptr;
+  }
+
+  const auto obj_init = [](rte_mempool *mp, void *opaque, void *obj,
+                           unsigned obj_idx) {
+    auto *channel = static_cast<Channel *>(opaque);
+    rte_pktmbuf_init(mp, nullptr, obj, obj_idx);
+    auto *mbuf = static_cast<rte_mbuf *>(obj);
+    auto *msg_buf = CHECK_NOTNULL(channel->MsgBufAlloc());
+    mbuf->buf_addr = msg_buf->base();
+    mbuf->buf_iova = msg_buf->iova();
+    mbuf->buf_len = rte_pktmbuf_data_room_size(mp);
+    mbuf->shinfo = &channel->rx_sh_info_;
+    mbuf->ol_flags = RTE_MBUF_F_EXTERNAL;
+    rte_pktmbuf_reset_headroom(mbuf);
+  };
+  rx_buffer_pool_ = std::make_unique<dpdk::PacketPool>(
+      nmbufs, static_cast<uint16_t>(buf_size), obj_init, this);
+  LOG(INFO) << "Created RX buffer pool of " << nmbufs << " buffers for channel "
+            << GetName();
+  return rx_buffer_pool_.get();
+}
+
+void Channel::DestroyRxBufferPool() {
+  if (rx_buffer_pool_ == nullptr) return;
+
+  // Return the attached buffers to the channel.
+  const auto release = [](rte_mempool *, void *opaque, void *obj, unsigned) {
+    auto *channel = static_cast<Channel *>(opaque);
+    auto *mbuf = static_cast<rte_mbuf *>(obj);
+    auto *msg_buf = reinterpret_cast<MsgBuf *>(
+        static_cast<uchar_t *>(mbuf->buf_addr) - MACHNET_MSGBUF_SPACE_RESERVED);
+    channel->MsgBufFree(msg_buf);
+  };
+  auto *mp = rx_buffer_pool_->GetMemPool();
+  CHECK_EQ(rte_mempool_avail_count(mp), mp->populated_size)
+      << "RX buffer pool of channel " << GetName() << " is still in use";
+  rte_mempool_obj_iter(mp, release, this);
+  rx_buffer_pool_.reset();
+}
+
+bool Channel::EnableTxZeroCopy(uint32_t threshold) {
+  if (attached_dev_ == nullptr) {
+    LOG(ERROR) << "Memory is not registered with DPDK";
+    return false;
+  }
+  if (GetTotalBufSize() - MACHNET_MSGBUF_SPACE_RESERVED > UINT16_MAX) {
+    LOG(ERROR) << "Channel buffers are too large for mbufs";
+    return false;
+  }
+
+  tx_zerocopy_bufs_.resize(GetTotalBufCount() + GetSmallBufCount());
+  for (auto &buf : tx_zerocopy_bufs_) {
+    buf.shinfo.free_cb = tx_zerocopy_free_cb;
+    buf.shinfo.fcb_opaque = this;
+    rte_mbuf_ext_refcnt_set(&buf.shinfo, 0);
+    buf.acked = false;
+  }
+  tx_zerocopy_threshold_ = threshold;
+  LOG(INFO) << "Zero-copy TX enabled for channel " << GetName()
+            << " (threshold: " << threshold << " bytes)";
+  return true;
+}
+
+void Channel::RemoveFlow(const FlowList::const_iterator &flow_it) {
   active_flows_.erase(flow_it);
 }
 
@@ -1,19 +1,43 @@
+/**
+ * @file channel_bench.cc
+ * @brief Benchmark of the shared memory channels: application threads
+ * exchange messages with stack threads (standing for the engines) over a set
+ * of channels, copying real payloads in and out, as the engines and the
+ * applications do.
+ *
+ * `--app_threads' application threads share `--channels' channels (thread `i'
+ * uses channel `i % channels'), which `--stack_threads' stack threads serve
+ * (channel `j' is served by stack thread `j % stack_threads'). Threads are
+ * pinned to the CPUs of `--stack_cpus' and `--app_cpus' in turn, so that
+ * cross-socket placements can be measured by giving CPUs of different NUMA
+ * nodes; `--channel_numa_node' places the channels' memory, and
+ * `--nohugepages' backs them with 4 KB pages instead of 2 MB hugepages.
+ *
+ * Each experiment (stack to application, application to stack, and both)
+ * runs for `--duration_s' seconds, and reports the throughput of each thread,
+ * along with how often it found the rings full or empty, and the average
+ * cycles of its ring operations (which grow as threads contend on a ring).
+ */
 #include <channel.h>
 #include <channel_msgbuf.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <machnet.h>
 #include <machnet_common.h>
+#include <machnet_private.h>
 #include <signal.h>
+#include <sys/syscall.h>
 #include <ttime.h>
 #include <unistd.h>
 #include <utils.h>
 
+#include <atomic>
+#include <iostream>
+#include <memory>
 #include <numeric>
+#include <string>
 #include <thread>
-
-static constexpr uint8_t kStackCpuCoreId = 3;
-static constexpr uint8_t kAppCpuCoreId = 5;
+#include <vector>
 
 using ShmChannel = juggler::shm::ShmChannel;
 using ChannelManager = juggler::shm::ChannelManager<ShmChannel>;
@@ -29,326 +53,439 @@ constexpr const char *file_name(const char *path) {
 }
 
 const char *channel_name = file_name(__FILE__);
-const uint32_t kRingSlotEntries = 1 << 8;
-const uint32_t kBuffersNr = 1 << 9;
 const uint32_t kBufferSize = 1500;  // MTU
+// Messages dequeued by a stack thread from a channel at a time, as an engine
+// does (see `MachnetEngine::Run()').
+const uint32_t kStackBurst = 32;
+
+DEFINE_bool(spsc_rings, false,
+            "Use SPSC (jring2) messaging rings for the channels (requires a "
+            "single application thread per channel).");
+DEFINE_uint32(app_threads, 1, "Number of application threads.");
+DEFINE_uint32(channels, 1, "Number of channels.");
+DEFINE_uint32(stack_threads, 1, "Number of stack threads.");
+DEFINE_string(stack_cpus, "3", "CPUs of the stack threads (a cpulist).");
+DEFINE_string(app_cpus, "5", "CPUs of the application threads (a cpulist).");
+DEFINE_int32(channel_numa_node, -1,
+             "NUMA node of the channels' memory (-1: that of the main "
+             "thread).");
+DEFINE_bool(hugepages, true,
+            "Back the channels with 2 MB hugepages (4 KB pages otherwise).");
+DEFINE_uint32(msg_size, 64, "Size of the messages, in bytes.");
+DEFINE_uint32(ring_slots, 1 << 8, "Slots of each messaging ring.");
+DEFINE_uint32(buffers_nr, 1 << 12,
+              "Buffers of each channel (plus one, a power of two).");
+DEFINE_uint32(duration_s, 5, "Duration of each experiment, in seconds.");
+
 static std::atomic<bool> g_start{false};
 static std::atomic<bool> g_should_stop{false};
+static std::atomic<bool> g_interrupted{false};
+
+// Counters of a thread over an experiment.
+struct thread_stats {
+  uint64_t messages_sent{0};
+  uint64_t messages_received{0};
+  // Attempts that found the ring out of space (or the channel out of
+  // buffers), and polls that found nothing to receive.
+  uint64_t tx_full{0};
+  uint64_t rx_empty{0};
+  // TSC cycles in successful send and receive operations.
+  uint64_t tx_cycles{0};
+  uint64_t rx_cycles{0};
+  uint64_t duration_in_ns{0};
+};
 
 struct thread_conf {
-  thread_conf(std::shared_ptr<ShmChannel> ch, uint8_t core_id,
-              uint64_t messages_to_send, uint64_t tx_message_size,
-              uint64_t messages_to_receive)
-      : channel(ch),
-        cpu_core(core_id),
-        messages_to_send(messages_to_send),
-        tx_message_size(tx_message_size),
-        messages_to_receive(messages_to_receive),
-        messages_sent(0),
-        messages_received(0),
-        duration_in_ns(0),
-        finished(false) {}
-  std::shared_ptr<ShmChannel> channel;
-  uint8_t cpu_core;
-  uint64_t messages_to_send;
-  uint64_t tx_message_size;
-  uint64_t messages_to_receive;
-  uint64_t messages_sent;
-  uint64_t messages_received;
-  uint64_t duration_in_ns;
-  bool finished{false};
+  bool is_stack;
+  uint32_t id;
+  size_t cpu_core;
+  int numa_node{-1};
+  // The channels of the thread (one for an application thread).
+  std::vector<std::shared_ptr<ShmChannel>> channels;
+  bool send;
+  bool receive;
+  thread_stats stats;
+  std::atomic<bool> finished{false};
 };
 
-void stack_loop(thread_conf *conf) {
-  juggler::utils::BindThisThreadToCore(conf->cpu_core);
-  LOG(INFO) << "Starting the stack thread on core " << sched_getcpu();
-  const uint32_t kDummyIp = 0x0100007f;
-  const uint16_t kDummyPort = 1234;
-  auto &channel = conf->channel;
-  CHECK_NOTNULL(channel);
-  const auto buffers_per_msg =
-      conf->tx_message_size / channel->GetUsableBufSize();
-  std::vector<MachnetRingSlot_t> buffer_indexes;
-  buffer_indexes.reserve(buffers_per_msg);
-  std::vector<uint8_t> tx_buffer(conf->tx_message_size);
-  std::iota(tx_buffer.begin(), tx_buffer.end(), 0);
+// Pin the calling thread, and find the NUMA node it runs on.
+static void bind_thread(thread_conf *conf) {
+  CHECK(juggler::utils::BindThisThreadToCore(conf->cpu_core))
+      << "Cannot run on CPU " << conf->cpu_core;
+  unsigned int cpu, node;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) conf->numa_node = node;
+}
 
-  // Wait for flag to start.
+// Wait for all the threads to be ready.
+static void wait_for_start() {
   while (!g_start.load()) {
     __asm__ volatile("pause" ::: "memory");
   }
+}
+
+// Free the buffers of a message, after copying its payload out.
+static void consume_message(ShmChannel *channel, MachnetRingSlot_t slot,
+                            juggler::shm::MsgBuf *buf,
+                            std::vector<uint8_t> *rx_buffer,
+                            std::vector<MachnetRingSlot_t> *buffer_indexes) {
+  size_t ofs = 0;
+  buffer_indexes->emplace_back(slot);
+  while (true) {
+    const auto len = std::min<size_t>(buf->length(), rx_buffer->size() - ofs);
+    juggler::utils::Copy(rx_buffer->data() + ofs, buf->head_data(), len);
+    ofs += len;
+    if (!buf->has_next()) break;
+    buffer_indexes->emplace_back(buf->next());
+    buf = channel->GetMsgBuf(buf->next());
+  }
+  CHECK(channel->MsgBufBulkFree(buffer_indexes->data(),
+                                buffer_indexes->size()));
+  buffer_indexes->clear();
+}
+
+// Build a message of `tx_buffer', chaining as many buffers as it takes.
+static juggler::shm::MsgBuf *build_message(
+    ShmChannel *channel, const std::vector<uint8_t> &tx_buffer) {
+  const uint32_t kDummyIp = 0x0100007f;
+  const uint16_t kDummyPort = 1234;
+  juggler::shm::MsgBuf *first = nullptr, *last = nullptr;
+  size_t ofs = 0;
+  do {
+    auto *buf = channel->MsgBufAlloc(tx_buffer.size() - ofs);
+    if (buf == nullptr) {
+      // Out of buffers: give back those taken so far.
+      while (first != nullptr) {
+        auto *next =
+            first->has_next() ? channel->GetMsgBuf(first->next()) : nullptr;
+        channel->MsgBufFree(first);
+        first = next;
+      }
+      return nullptr;
+    }
+    const auto len = std::min<size_t>(buf->tailroom(), tx_buffer.size() - ofs);
+    juggler::utils::Copy(CHECK_NOTNULL(buf->append(len)),
+                         tx_buffer.data() + ofs, len);
+    ofs += len;
+    if (first == nullptr) {
+      first = buf;
+    } else {
+      last->set_next(buf);
+    }
+    last = buf;
+  } while (ofs < tx_buffer.size());
+
+  first->set_src_ip(kDummyIp);
+  first->set_src_port(kDummyPort);
+  first->set_dst_ip(kDummyIp);
+  first->set_dst_port(kDummyPort);
+  first->set_msg_length(tx_buffer.size());
+  first->set_last(last->index());
+  first->mark_first();
+  last->mark_last();
+  return first;
+}
+
+void stack_loop(thread_conf *conf) {
+  bind_thread(conf);
+  LOG(INFO) << "Starting stack thread " << conf->id << " on core "
+            << sched_getcpu();
+  std::vector<MachnetRingSlot_t> buffer_indexes;
+  std::vector<uint8_t> rx_buffer(FLAGS_msg_size);
+  std::vector<uint8_t> tx_buffer(FLAGS_msg_size);
+  std::iota(tx_buffer.begin(), tx_buffer.end(), 0);
+  auto &stats = conf->stats;
+  wait_for_start();
 
   // Use a high precision timer to measure time in nanoseconds for this
   // experiment (std::chrono) Start the timer.
   auto start = std::chrono::high_resolution_clock::now();
-  while (!g_should_stop.load()) {
-    // Receive any messages.
-    juggler::shm::MsgBuf *buf;
-    MachnetRingSlot_t slot;
-
-    auto ret = channel->DequeueMessages(&slot, &buf, 1);
-    if (ret == 1) {
-      // We have received one message.
-      conf->messages_received++;
-      buffer_indexes.emplace_back(slot);
-      while (buf->has_next()) {
-        buffer_indexes.emplace_back(buf->next());
-        buf = channel->GetMsgBuf(buf->next());
+  while (!g_should_stop.load(std::memory_order_relaxed)) {
+    for (const auto &channel : conf->channels) {
+      // Receive any messages.
+      if (conf->receive) {
+        MachnetRingSlot_t slots[kStackBurst];
+        juggler::shm::MsgBuf *bufs[kStackBurst];
+        const auto tsc = juggler::time::rdtsc();
+        const auto ret = channel->DequeueMessages(slots, bufs, kStackBurst);
+        if (ret == 0) {
+          stats.rx_empty++;
+        } else {
+          stats.rx_cycles += juggler::time::rdtsc() - tsc;
+          stats.messages_received += ret;
+          for (uint32_t i = 0; i < ret; i++) {
+            consume_message(channel.get(), slots[i], bufs[i], &rx_buffer,
+                            &buffer_indexes);
+          }
+        }
       }
 
-      CHECK(channel->MsgBufBulkFree(buffer_indexes.data(),
-                                    buffer_indexes.size()));
-      buffer_indexes.clear();
-    }
-
-    if (conf->messages_sent >= conf->messages_to_send) {
-      if (conf->messages_received >= conf->messages_to_receive) {
-        break;
+      if (!conf->send) continue;
+      auto *buf = build_message(channel.get(), tx_buffer);
+      if (buf == nullptr) {
+        stats.tx_full++;
+        continue;
       }
-      continue;
-    }
-
-    buf = channel->MsgBufAlloc();
-    if (buf == nullptr) {
-      continue;
-    }
-
-    CHECK_NOTNULL(buf->append(tx_buffer.size()));
-
-    juggler::utils::Copy(buf->head_data(), tx_buffer.data(), buf->length());
-    buf->set_src_ip(kDummyIp);
-    buf->set_src_port(kDummyPort);
-    buf->set_dst_ip(kDummyIp);
-    buf->set_dst_port(kDummyPort);
-    buf->mark_first();
-    buf->mark_last();
-    // TODO(ilias): Copy some data.
-    // Send the message.
-    ret = channel->EnqueueMessages(&buf, 1);
-    if (ret != 1) {
-      LOG(ERROR) << "Couldn't enqueue message. ret: " << ret;
-      channel->MsgBufFree(buf);
+      const auto tsc = juggler::time::rdtsc();
+      if (channel->EnqueueMessages(&buf, 1) != 1) {
+        stats.tx_full++;
+        MachnetRingSlot_t slot = buf->index();
+        consume_message(channel.get(), slot, buf, &rx_buffer, &buffer_indexes);
+        continue;
+      }
+      stats.tx_cycles += juggler::time::rdtsc() - tsc;
+      stats.messages_sent++;
     }
-    conf->messages_sent += ret;
   }
   // Calculate the duration in nanoseconds.
   auto end = std::chrono::high_resolution_clock::now();
-  conf->duration_in_ns =
+  stats.duration_in_ns =
       std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-
-  if (conf->messages_sent < conf->messages_to_send ||
-      conf->messages_received < conf->messages_to_receive) {
-    LOG(ERROR) << "Not all messages were sent. Sent: " << conf->messages_sent
-               << ", received: " << conf->messages_received
-               << " expected: " << conf->messages_to_send << ", "
-               << conf->messages_to_receive << ". Stack thread exiting.";
-  }
-
   conf->finished = true;
 }
 
 void application_loop(thread_conf *conf) {
-  juggler::utils::BindThisThreadToCore(conf->cpu_core);
-  LOG(INFO) << "Starting the app thread on core " << sched_getcpu();
-  std::vector<uint8_t> rx_buffer(conf->tx_message_size);
-  std::vector<uint8_t> tx_buffer(conf->tx_message_size);
+  bind_thread(conf);
+  LOG(INFO) << "Starting app thread " << conf->id << " on core "
+            << sched_getcpu();
+  std::vector<uint8_t> rx_buffer(FLAGS_msg_size);
+  std::vector<uint8_t> tx_buffer(FLAGS_msg_size);
   std::iota(tx_buffer.begin(), tx_buffer.end(), 0);
-  auto &channel = conf->channel;
+  auto *ctx = conf->channels[0]->ctx();
+  const MachnetFlow_t flow = {};
+  auto &stats = conf->stats;
+  wait_for_start();
 
-  // Wait for flag to start.
-  while (!g_start.load()) {
-    __asm__ volatile("pause" ::: "memory");
-  }
-
-  // Now start receiving messages.
   auto start = std::chrono::high_resolution_clock::now();
-  while (!g_should_stop.load()) {
-    // RX.
-    MachnetFlow_t flow;
-
-    auto nbytes =
-        machnet_recv(channel->ctx(), rx_buffer.data(), rx_buffer.size(), &flow);
-    if (nbytes > 0) {
-      conf->messages_received++;
-      CHECK_EQ(nbytes, conf->tx_message_size);
-    }
-
-    if (conf->messages_sent >= conf->messages_to_send) {
-      if (conf->messages_received >= conf->messages_to_receive) {
-        break;
+  while (!g_should_stop.load(std::memory_order_relaxed)) {
+    if (conf->receive) {
+      MachnetFlow_t rx_flow;
+      const auto tsc = juggler::time::rdtsc();
+      auto nbytes =
+          machnet_recv(ctx, rx_buffer.data(), rx_buffer.size(), &rx_flow);
+      if (nbytes > 0) {
+        stats.rx_cycles += juggler::time::rdtsc() - tsc;
+        stats.messages_received++;
+        CHECK_EQ(nbytes, FLAGS_msg_size);
+      } else {
+        CHECK_EQ(nbytes, 0);
+        stats.rx_empty++;
       }
-      continue;
     }
 
-    // TX.
-    auto ret =
-        machnet_send(channel->ctx(), flow, tx_buffer.data(), tx_buffer.size());
-    if (ret == 0) {
-      conf->messages_sent++;
+    if (!conf->send) continue;
+    const auto tsc = juggler::time::rdtsc();
+    if (machnet_send(ctx, flow, tx_buffer.data(), tx_buffer.size()) != 0) {
+      stats.tx_full++;
+      continue;
     }
+    stats.tx_cycles += juggler::time::rdtsc() - tsc;
+    stats.messages_sent++;
   }
 
   // Calculate the duration in nanoseconds.
   auto end = std::chrono::high_resolution_clock::now();
-  conf->duration_in_ns =
+  stats.duration_in_ns =
       std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  // Hand the cached buffers back, before the channel goes.
+  machnet_release_cached_buffers(ctx);
+  conf->finished = true;
+}
 
-  if (conf->messages_sent < conf->messages_to_send ||
-      conf->messages_received < conf->messages_to_receive) {
-    LOG(ERROR) << "Not all messages were sent. Sent: " << conf->messages_sent
-               << ", received: " << conf->messages_received
-               << " expected: " << conf->messages_to_send << ", "
-               << conf->messages_to_receive << ". App thread exiting.";
-  }
+/**
+ * @brief Create a channel backed by hugepages or by regular (4 KB) pages, on
+ * a NUMA node (-1 for the default).
+ */
+static std::shared_ptr<ShmChannel> create_channel(const std::string &name,
+                                                  bool hugepages,
+                                                  int numa_node) {
+  const int ring_type = FLAGS_spsc_rings ? MACHNET_CHANNEL_RING_JRING2
+                                         : MACHNET_CHANNEL_RING_JRING;
+  const int is_posix_shm = hugepages ? 0 : 1;
+  const size_t size = __machnet_channel_dataplane_calculate_size(
+      FLAGS_ring_slots, FLAGS_ring_slots, FLAGS_buffers_nr, kBufferSize,
+      ring_type, is_posix_shm);
+  CHECK_NE(size, static_cast<size_t>(-1)) << "Invalid channel parameters";
+
+  int fd;
+  const bool bind = numa_node >= 0 && ChannelManager::SetMemoryNode(numa_node);
+  auto *ctx = hugepages
+                  ? __machnet_channel_hugetlbfs_create(name.c_str(), size, &fd)
+                  : __machnet_channel_posix_create(name.c_str(), size, &fd);
+  if (bind) ChannelManager::SetMemoryNode(-1);
+  CHECK(ctx != nullptr) << "Failed to create channel " << name
+                        << (hugepages ? " (are there free hugepages?)" : "");
+  CHECK_EQ(__machnet_channel_dataplane_init(
+               reinterpret_cast<uchar_t *>(ctx), size, is_posix_shm,
+               name.c_str(), FLAGS_ring_slots, FLAGS_ring_slots,
+               FLAGS_buffers_nr, kBufferSize, ring_type, 0),
+           0);
+  return std::make_shared<ShmChannel>(name, ctx, size, is_posix_shm, fd);
+}
 
-  conf->finished = true;
+static void print_thread(const thread_conf &conf) {
+  const auto &s = conf.stats;
+  const double seconds = static_cast<double>(s.duration_in_ns) / 1e9;
+  const auto rate = [seconds](uint64_t n) {
+    return seconds > 0 ? static_cast<double>(n) / seconds : 0.0;
+  };
+  const auto per_op = [](uint64_t cycles, uint64_t n) {
+    return n ? static_cast<double>(cycles) / static_cast<double>(n) : 0.0;
+  };
+  std::cout << juggler::utils::Format(
+                   "\t[%s %u/CPU:%zu/Node:%d] TX %.3lf Mmsg/s (%.3lf Gbps, "
+                   "%.1lf cycles/op, %lu full), RX %.3lf Mmsg/s (%.3lf Gbps, "
+                   "%.1lf cycles/op, %lu empty)",
+                   conf.is_stack ? "Stack" : "App", conf.id, conf.cpu_core,
+                   conf.numa_node, rate(s.messages_sent) / 1e6,
+                   rate(s.messages_sent) * FLAGS_msg_size * 8 / 1e9,
+                   per_op(s.tx_cycles, s.messages_sent), s.tx_full,
+                   rate(s.messages_received) / 1e6,
+                   rate(s.messages_received) * FLAGS_msg_size * 8 / 1e9,
+                   per_op(s.rx_cycles, s.messages_received), s.rx_empty)
+            << std::endl;
 }
 
-void print_results(const thread_conf &stack_conf, const thread_conf &app_conf) {
-  // Print the results.
-  auto channel = stack_conf.channel;
+void print_results(const std::vector<std::unique_ptr<thread_conf>> &stack,
+                   const std::vector<std::unique_ptr<thread_conf>> &apps) {
+  const auto &channel = stack[0]->channels[0];
   std::cout << juggler::utils::Format(
-                   "[Channel:%s/HugePageBacked:%s/Size:%luKiB/BufferNr:%u/"
+                   "[Channels:%u/HugePageBacked:%s/Size:%luKiB/BufferNr:%u/"
                    "BufSize:%u]",
-                   channel_name, channel->IsPosixShm() ? "0" : "1",
+                   FLAGS_channels, channel->IsPosixShm() ? "0" : "1",
                    channel->GetSize() / 1024, channel->GetTotalBufCount(),
                    channel->GetUsableBufSize())
             << std::endl;
-  // Print whether the stack and app are sending or not.
-  std::cout << juggler::utils::Format("[StackTX:%s/AppTX:%s]",
-                                      stack_conf.messages_to_send ? "1" : "0",
-                                      app_conf.messages_to_send ? "1" : "0");
-  std::cout << juggler::utils::Format("[TX message size:%lu]",
-                                      stack_conf.tx_message_size)
-            << std::endl;
-  std::cout << "[Stack]" << std::endl;
-
-  std::cout
-      << juggler::utils::Format(
-             "\t[TX] %lu messages, %lu bytes, %lu ns, %lf ns/msg, %lf msg/s",
-             stack_conf.messages_sent,
-             stack_conf.messages_sent * stack_conf.tx_message_size,
-             stack_conf.duration_in_ns,
-             stack_conf.messages_sent
-                 ? static_cast<double>(stack_conf.duration_in_ns) /
-                       stack_conf.messages_sent
-                 : 0.0,
-             static_cast<double>(stack_conf.messages_sent) /
-                 (static_cast<double>(stack_conf.duration_in_ns) / 1e9))
-      << std::endl;
-  std::cout
-      << juggler::utils::Format(
-             "\t[RX] %lu messages, %lu bytes, %lu ns, %lf ns/msg, %lf msg/s",
-             stack_conf.messages_received,
-             stack_conf.messages_received * stack_conf.tx_message_size,
-             stack_conf.duration_in_ns,
-             stack_conf.messages_received
-                 ? static_cast<double>(stack_conf.duration_in_ns) /
-                       stack_conf.messages_received
-                 : 0.0,
-             stack_conf.messages_received
-                 ? static_cast<double>(stack_conf.messages_received) /
-                       (static_cast<double>(stack_conf.duration_in_ns) / 1e9)
-                 : 0.0)
-      << std::endl;
-  std::cout << "[Application]" << std::endl;
-  std::cout << juggler::utils::Format(
-                   "\t[TX]"
-                   " %lu messages, %lu bytes, %lu ns, %lf ns/msg, %lf msg/s",
-                   app_conf.messages_sent,
-                   app_conf.messages_sent * app_conf.tx_message_size,
-                   app_conf.duration_in_ns,
-                   app_conf.messages_sent
-                       ? static_cast<double>(app_conf.duration_in_ns) /
-                             static_cast<double>(app_conf.messages_sent)
-                       : 0.0,
-                   app_conf.messages_sent
-                       ? static_cast<double>(app_conf.messages_sent) /
-                             (static_cast<double>(app_conf.duration_in_ns /
-                                                  1e9))
-                       : 0.0)
-            << std::endl;
   std::cout << juggler::utils::Format(
-                   "\t[RX]"
-                   " %lu messages, %lu bytes, %lu ns, %lf ns/msg, %lf msg/s",
-                   app_conf.messages_received,
-                   app_conf.messages_received * app_conf.tx_message_size,
-                   app_conf.duration_in_ns,
-                   app_conf.messages_received
-                       ? static_cast<double>(app_conf.duration_in_ns) /
-                             static_cast<double>(app_conf.messages_received)
-                       : 0.0,
-                   app_conf.messages_received
-                       ? static_cast<double>(app_conf.messages_received) /
-                             (static_cast<double>(app_conf.duration_in_ns /
-                                                  1e9))
-                       : 0.0)
+                   "[StackThreads:%zu/AppThreads:%zu][StackTX:%s/AppTX:%s]"
+                   "[TX message size:%u]",
+                   stack.size(), apps.size(), stack[0]->send ? "1" : "0",
+                   apps[0]->send ? "1" : "0", FLAGS_msg_size)
             << std::endl;
+
+  const auto print_total = [](const char *name, const auto &threads) {
+    uint64_t sent = 0, received = 0, duration_ns = 0;
+    for (const auto &t : threads) {
+      sent += t->stats.messages_sent;
+      received += t->stats.messages_received;
+      duration_ns = std::max(duration_ns, t->stats.duration_in_ns);
+    }
+    const double seconds = static_cast<double>(duration_ns) / 1e9;
+    std::cout << juggler::utils::Format(
+                     "[%s] TX %lu messages (%.3lf Mmsg/s), RX %lu messages "
+                     "(%.3lf Mmsg/s)",
+                     name, sent, seconds > 0 ? sent / seconds / 1e6 : 0.0,
+                     received, seconds > 0 ? received / seconds / 1e6 : 0.0)
+              << std::endl;
+    for (const auto &t : threads) print_thread(*t);
+  };
+  print_total("Stack", stack);
+  print_total("Application", apps);
+
+  for (uint32_t i = 0; i < FLAGS_channels; i++) {
+    const auto *ch = stack[i % stack.size()]->channels[i / stack.size()].get();
+    const auto *a_stats = &__machnet_channel_stats(ch->ctx())->a_stats;
+    std::cout << juggler::utils::Format(
+                     "\t[Channel %u] Application TX drops: %lu", i,
+                     a_stats->tx_msg_drops)
+              << std::endl;
+  }
   std::cout << std::endl;
 }
 
-int main() {
+static std::vector<size_t> parse_cpus(const std::string &flag,
+                                      const std::string &cpulist) {
+  const auto cpus = juggler::utils::ParseCpuList(cpulist);
+  CHECK(cpus.has_value() && !cpus->empty())
+      << "Invalid --" << flag << ": " << cpulist;
+  return cpus.value();
+}
+
+int main(int argc, char *argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
   google::InitGoogleLogging("channel_bench");
   FLAGS_logtostderr = 1;
-  signal(SIGINT, [](int) { g_should_stop.store(true); });
+  signal(SIGINT, [](int) {
+    g_interrupted.store(true);
+    g_should_stop.store(true);
+  });
 
   if (geteuid() != 0) {
     LOG(ERROR) << "Must be run as root.";
     return -1;
   }
-  LOG(INFO) << "Creating channel " << channel_name;
-  ChannelManager channel_manager;
-  CHECK(channel_manager.AddChannel(channel_name, kRingSlotEntries,
-                                   kRingSlotEntries, kBuffersNr, kBufferSize));
-
-  const uint64_t kMessagesToSend = 2 * 1e7;
-  const uint64_t kTxMessageSize = 64;
-  std::vector<std::pair<uint64_t, uint64_t>> exp_config_vec;
-
-  exp_config_vec.emplace_back(kMessagesToSend, 0);  // Stack -> app only
-  exp_config_vec.emplace_back(0, kMessagesToSend);  // App -> stack only
-  exp_config_vec.emplace_back(kMessagesToSend, kMessagesToSend);  // Bi-dir
+  CHECK_GT(FLAGS_app_threads, 0);
+  CHECK_GT(FLAGS_stack_threads, 0);
+  CHECK_GE(FLAGS_channels, FLAGS_stack_threads)
+      << "Each stack thread needs a channel to serve";
+  CHECK_GT(FLAGS_msg_size, 0);
+  CHECK_LE(FLAGS_msg_size, MACHNET_MSG_MAX_LEN);
+  CHECK(!FLAGS_spsc_rings || FLAGS_app_threads <= FLAGS_channels)
+      << "SPSC rings take a single application thread per channel";
+  const auto stack_cpus = parse_cpus("stack_cpus", FLAGS_stack_cpus);
+  const auto app_cpus = parse_cpus("app_cpus", FLAGS_app_cpus);
+  juggler::time::tsc_hz = juggler::time::estimate_tsc_hz();
+
+  // Stack -> app only, app -> stack only, and both ways.
+  const std::vector<std::pair<bool, bool>> exp_config_vec = {
+      {true, false}, {false, true}, {true, true}};
 
   LOG(INFO) << "Running channel_bench";
 
-  for (const auto &exp_conf : exp_config_vec) {
-    LOG(INFO) << "Running experiment: Stack will send " << exp_conf.first
-              << " messages, App will send " << exp_conf.second << " messages.";
-
-    thread_conf stack_conf{channel_manager.GetChannel(channel_name),
-                           kStackCpuCoreId, exp_conf.first, kTxMessageSize,
-                           exp_conf.second};
-    thread_conf app_conf{channel_manager.GetChannel(channel_name),
-                         kAppCpuCoreId, exp_conf.second, kTxMessageSize,
-                         exp_conf.first};
+  for (const auto &[stack_tx, app_tx] : exp_config_vec) {
+    if (g_interrupted.load()) break;
+    LOG(INFO) << "Running experiment: Stack TX: " << stack_tx
+              << ", App TX: " << app_tx;
+
+    // Fresh channels, so that no messages are left from the previous
+    // experiment.
+    std::vector<std::shared_ptr<ShmChannel>> channels;
+    for (uint32_t i = 0; i < FLAGS_channels; i++) {
+      channels.emplace_back(create_channel(
+          std::string(channel_name) + "-" + std::to_string(i),
+          FLAGS_hugepages, FLAGS_channel_numa_node));
+    }
+    std::vector<std::unique_ptr<thread_conf>> stack, apps;
+    for (uint32_t i = 0; i < FLAGS_stack_threads; i++) {
+      auto conf = std::make_unique<thread_conf>();
+      conf->is_stack = true;
+      conf->id = i;
+      conf->cpu_core = stack_cpus[i % stack_cpus.size()];
+      for (uint32_t j = i; j < FLAGS_channels; j += FLAGS_stack_threads) {
+        conf->channels.push_back(channels[j]);
+      }
+      conf->send = stack_tx;
+      conf->receive = app_tx;
+      stack.emplace_back(std::move(conf));
+    }
+    for (uint32_t i = 0; i < FLAGS_app_threads; i++) {
+      auto conf = std::make_unique<thread_conf>();
+      conf->is_stack = false;
+      conf->id = i;
+      conf->cpu_core = app_cpus[i % app_cpus.size()];
+      conf->channels.push_back(channels[i % FLAGS_channels]);
+      conf->send = app_tx;
+      conf->receive = stack_tx;
+      apps.emplace_back(std::move(conf));
+    }
 
     // Launch the threads.
-    std::thread(&stack_loop, &stack_conf).detach();
-    std::thread(&application_loop, &app_conf).detach();
+    std::vector<std::thread> threads;
+    for (auto &conf : stack) threads.emplace_back(&stack_loop, conf.get());
+    for (auto &conf : apps) {
+      threads.emplace_back(&application_loop, conf.get());
+    }
     usleep(500000);
     g_start.store(true);
 
-    const uint32_t kTimeoutSeconds = 30;
-    uint32_t seconds_passed = 0;
-    while (seconds_passed < kTimeoutSeconds) {
-      if (stack_conf.finished && app_conf.finished) {
-        break;
-      } else {
-        LOG(INFO) << "Main: Waiting for threads to finish. "
-                  << "Stack finished: " << stack_conf.finished
-                  << ", App finished: " << app_conf.finished;
-      }
-      seconds_passed++;
-      sleep(1);
-    }
-
-    if (!stack_conf.finished || !app_conf.finished) {
-      g_should_stop.store(true);
-      LOG(INFO) << "Timeout reached. Stopping the threads.";
+    for (uint32_t s = 0; s < FLAGS_duration_s && !g_should_stop.load(); s++) {
       sleep(1);
     }
+    g_should_stop.store(true);
+    for (auto &thread : threads) thread.join();
+    print_results(stack, apps);
 
-    print_results(stack_conf, app_conf);
+    g_start.store(false);
+    g_should_stop.store(false);
   }
 
   return 0;
@@ -9,11 +9,16 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <machnet.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <utils.h>
 
 #include <atomic>
+#include <chrono>
 #include <random>
+#include <set>
 #include <thread>
 
 constexpr const char *file_name(const char *path) {
@@ -125,6 +130,105 @@ TEST(BasicChannelTest, ChannelCreateDestroy) {
   }
 }
 
+TEST(BasicChannelTest, ChannelArena) {
+  using ChannelManager = juggler::shm::ChannelManager<juggler::shm::ShmChannel>;
+  const uint32_t kChannelRingSize = 1 << 8;
+  const uint32_t kBufferSize = 1 << 12;
+  // More channels than the manager creates with memory of their own.
+  const size_t kSlotsNr = 2 * ChannelManager::kMaxChannelNr;
+  const std::vector<char> tx_msg(64, 'a');
+  const auto channel_name = [](size_t i) {
+    return std::string(fname) + "-" + std::to_string(i);
+  };
+
+  const std::string arena_name = std::string(fname) + "-arena";
+  auto arena = ChannelManager::CreateArena(arena_name.c_str(), kSlotsNr,
+                                           kChannelRingSize, kChannelRingSize,
+                                           kChannelRingSize, kBufferSize);
+  ASSERT_NE(arena, nullptr);
+  EXPECT_EQ(arena->GetSlotCount(), kSlotsNr);
+
+  ChannelManager channel_mgr;
+  std::set<int> fds;
+  for (size_t i = 0; i < kSlotsNr; i++) {
+    EXPECT_TRUE(channel_mgr.AddChannel(
+        channel_name(i).c_str(), kChannelRingSize, kChannelRingSize,
+        kChannelRingSize, kBufferSize, MACHNET_CHANNEL_RING_JRING, -1, arena));
+    auto channel = channel_mgr.GetChannel(channel_name(i).c_str());
+    ASSERT_NE(channel, nullptr);
+    EXPECT_EQ(channel->GetArena(), arena.get());
+    EXPECT_EQ(channel->GetFd(), arena->GetSlotFd(channel->ctx()));
+    fds.insert(channel->GetFd());
+  }
+  EXPECT_EQ(fds.size(), kSlotsNr);
+  EXPECT_EQ(arena->GetFreeSlotCount(), 0);
+
+  // Once the arena is full, channels get memory of their own.
+  EXPECT_TRUE(channel_mgr.AddChannel(
+      fname, kChannelRingSize, kChannelRingSize, kChannelRingSize, kBufferSize,
+      MACHNET_CHANNEL_RING_JRING, -1, arena));
+  EXPECT_EQ(channel_mgr.GetChannel(fname)->GetArena(), nullptr);
+  EXPECT_EQ(channel_mgr.GetChannelCount(), kSlotsNr + 1);
+
+  // The application maps the slot of its channel, which is all that its file
+  // descriptor holds.
+  auto channel = channel_mgr.GetChannel(channel_name(1).c_str());
+  const int fd = channel->GetFd();
+  struct stat stat_buf;
+  ASSERT_EQ(fstat(fd, &stat_buf), 0);
+  EXPECT_EQ(stat_buf.st_size, arena->GetSlotSize());
+  void *mem = mmap(nullptr, stat_buf.st_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+  ASSERT_NE(mem, MAP_FAILED);
+  auto *app_ctx = static_cast<MachnetChannelCtx_t *>(mem);
+  EXPECT_EQ(app_ctx->magic, MACHNET_CHANNEL_CTX_MAGIC);
+  EXPECT_STREQ(app_ctx->name, channel_name(1).c_str());
+  EXPECT_TRUE(app_msg_enqueue(app_ctx, tx_msg));
+  machnet_release_cached_buffers(app_ctx);
+  juggler::shm::MsgBufBatch rx_batch;
+  EXPECT_EQ(channel->DequeueMessages(&rx_batch), 1);
+  EXPECT_TRUE(check_msg(channel.get(), rx_batch.bufs()[0], tx_msg));
+  EXPECT_TRUE(channel->MsgBufBulkFree(&rx_batch));
+
+  // No more of the arena can be reached from it: it cannot be resized, and
+  // past its end there is nothing to read.
+  EXPECT_EQ(ftruncate(fd, 2 * arena->GetSlotSize()), -1);
+  EXPECT_EQ(errno, EPERM);
+  void *next = mmap(nullptr, arena->GetSlotSize(), PROT_READ, MAP_SHARED, fd,
+                    arena->GetSlotSize());
+  if (next != MAP_FAILED) {
+    EXPECT_DEATH(
+        { [[maybe_unused]] volatile char c = *static_cast<char *>(next); },
+        "");
+    munmap(next, arena->GetSlotSize());
+  }
+
+  // Once the channel belongs to an application, its slot is given back when
+  // the application is gone (which may map it still), and zeroed.
+  arena->SetSlotOwner(channel->ctx(), "app");
+  auto *slot = reinterpret_cast<volatile uchar_t *>(channel->ctx());
+  static_cast<uchar_t *>(mem)[arena->GetSlotSize() - 1] = 0xab;
+  munmap(mem, stat_buf.st_size);
+  channel.reset();
+  channel_mgr.DestroyChannel(channel_name(1).c_str());
+  EXPECT_EQ(arena->GetFreeSlotCount(), 0);
+  arena->ReleaseOwner("app");
+  EXPECT_EQ(arena->GetFreeSlotCount(), 1);
+  EXPECT_TRUE(channel_mgr.AddChannel(
+      channel_name(1).c_str(), kChannelRingSize, kChannelRingSize,
+      kChannelRingSize, kBufferSize, MACHNET_CHANNEL_RING_JRING, -1, arena));
+  channel = channel_mgr.GetChannel(channel_name(1).c_str());
+  EXPECT_EQ(reinterpret_cast<volatile uchar_t *>(channel->ctx()), slot);
+  EXPECT_EQ(channel->GetFd(), fd);
+  EXPECT_EQ(slot[arena->GetSlotSize() - 1], 0);
+  EXPECT_EQ(arena->GetFreeSlotCount(), 0);
+
+  // Slots that no application had go back directly.
+  channel.reset();
+  channel_mgr.DestroyChannel(channel_name(1).c_str());
+  EXPECT_EQ(arena->GetFreeSlotCount(), 1);
+}
+
 TEST(BasicChannelTest, ChannelMsgBufAllocFree) {
   using ChannelManager = juggler::shm::ChannelManager<juggler::shm::ShmChannel>;
   const uint32_t kChannelRingSize = 1 << 11;  // 2048 slots for all rings.
@@ -143,6 +247,49 @@ TEST(BasicChannelTest, ChannelMsgBufAllocFree) {
   EXPECT_TRUE(channel->MsgBufFree(msg_buf));
 }
 
+TEST(BasicChannelTest, ChannelMsgBufSizeClasses) {
+  using ChannelManager = juggler::shm::ChannelManager<juggler::shm::ShmChannel>;
+  const uint32_t kChannelRingSize = 1 << 8;  // 256 slots for all rings.
+  const uint32_t kBufferSize = 1 << 12;      // 4096 bytes for buffer.
+
+  ChannelManager channel_mgr;
+
+  std::string channel_name(fname);
+  EXPECT_TRUE(channel_mgr.AddChannel(channel_name.c_str(), kChannelRingSize,
+                                     kChannelRingSize, kChannelRingSize,
+                                     kBufferSize));
+  auto *channel = channel_mgr.GetChannel(channel_name.c_str()).get();
+  CHECK_NOTNULL(channel);
+  const auto small_size = channel->GetUsableSmallBufSize();
+  ASSERT_GT(small_size, 0);
+  EXPECT_EQ(channel->GetSmallBufCount(), kChannelRingSize - 1);
+
+  // Small payloads get small buffers, until these run out.
+  std::vector<juggler::shm::MsgBuf *> bufs;
+  for (uint32_t i = 0; i < channel->GetSmallBufCount(); i++) {
+    auto *msg_buf = channel->MsgBufAlloc(small_size);
+    ASSERT_NE(msg_buf, nullptr);
+    EXPECT_GE(msg_buf->index(), channel->GetTotalBufCount());
+    EXPECT_EQ(channel->GetBufIndex(msg_buf), msg_buf->index());
+    EXPECT_NE(msg_buf->append(small_size), nullptr);
+    EXPECT_EQ(msg_buf->append(1), nullptr);
+    bufs.push_back(msg_buf);
+  }
+  EXPECT_EQ(channel->GetFreeSmallBufCount(), 0);
+  auto *msg_buf = channel->MsgBufAlloc(1);
+  ASSERT_NE(msg_buf, nullptr);
+  EXPECT_LT(msg_buf->index(), channel->GetTotalBufCount());
+  bufs.push_back(msg_buf);
+  msg_buf = channel->MsgBufAlloc(small_size + 1);
+  ASSERT_NE(msg_buf, nullptr);
+  EXPECT_LT(msg_buf->index(), channel->GetTotalBufCount());
+  bufs.push_back(msg_buf);
+
+  for (auto *buf : bufs) EXPECT_TRUE(channel->MsgBufFree(buf));
+  EXPECT_EQ(channel->GetFreeSmallBufCount(), channel->GetSmallBufCount());
+  EXPECT_EQ(channel->GetFreeBufCount(), channel->GetTotalBufCount());
+}
+
 TEST(BasicChannelTest, ChannelDequeue) {
   using ChannelManager = juggler::shm::ChannelManager<juggler::shm::ShmChannel>;
   const uint32_t kChannelRingSize = 1 << 11;  // 2048 slots for all rings.
@@ -174,6 +321,48 @@ TEST(BasicChannelTest, ChannelDequeue) {
   EXPECT_TRUE(check_msg(channel, batch.bufs()[1], msg2));
 }
 
+TEST(BasicChannelTest, ChannelDequeueInline) {
+  using ChannelManager = juggler::shm::ChannelManager<juggler::shm::ShmChannel>;
+  const uint32_t kChannelRingSize = 1 << 10;
+  const uint32_t kBufferSize = 1 << 12;
+
+  for (const int ring_type :
+       {MACHNET_CHANNEL_RING_JRING, MACHNET_CHANNEL_RING_JRING2}) {
+    ChannelManager channel_mgr;
+    std::string channel_name(fname);
+    EXPECT_TRUE(channel_mgr.AddChannel(channel_name.c_str(), kChannelRingSize,
+                                       kChannelRingSize, kChannelRingSize,
+                                       kBufferSize, ring_type));
+    auto *channel = channel_mgr.GetChannel(channel_name.c_str()).get();
+    CHECK_NOTNULL(channel);
+    auto *ctx = const_cast<MachnetChannelCtx_t *>(channel->ctx());
+
+    // Mix inline and regular messages, so that inline messages are cut by
+    // the dequeue bursts.
+    std::vector<std::vector<char>> msgs;
+    for (uint32_t i = 0; i < 40; i++) {
+      const uint32_t len = i % 3 == 2 ? 100 : 1 + i % MACHNET_MSG_INLINE_MAX;
+      msgs.emplace_back(len, 'a' + i % 26);
+      EXPECT_TRUE(app_msg_enqueue(ctx, msgs.back()));
+    }
+
+    uint32_t received = 0;
+    juggler::shm::MsgBufBatch batch;
+    while (channel->DequeueMessages(&batch) != 0) {
+      for (uint32_t i = 0; i < batch.GetSize(); i++) {
+        auto *msg = batch.bufs()[i];
+        EXPECT_TRUE(msg->is_first() && msg->is_last());
+        EXPECT_EQ(msg->msg_length(), msgs[received].size());
+        EXPECT_TRUE(check_msg(channel, msg, msgs[received])) << received;
+        received++;
+      }
+      EXPECT_TRUE(channel->MsgBufBulkFree(&batch));
+    }
+    EXPECT_EQ(received, msgs.size());
+    EXPECT_FALSE(channel->HasPendingMessages());
+  }
+}
+
 TEST(BasicChannelTest, ChannelEnqueue) {
   const uint32_t kChannelRingSize = 1 << 11;  // 2048 slots for all rings.
   const uint32_t kBufferSize = 1 << 12;       // 4096 bytes for buffer.
@@ -217,6 +406,112 @@ TEST(BasicChannelTest, ChannelEnqueue) {
   EXPECT_EQ(rx_msg, tx_msg);
 }
 
+TEST(BasicChannelTest, ChannelNotify) {
+  const uint32_t kChannelRingSize = 1 << 8;
+  const uint32_t kBufferSize = 1 << 12;
+  const std::vector<uint8_t> tx_msg(64, 'a');
+
+  juggler::shm::ChannelManager channel_mgr;
+  std::string channel_name(fname);
+  EXPECT_TRUE(channel_mgr.AddChannel(channel_name.c_str(), kChannelRingSize,
+                                     kChannelRingSize, kChannelRingSize,
+                                     kBufferSize));
+  auto *channel = channel_mgr.GetChannel(channel_name.c_str()).get();
+  CHECK_NOTNULL(channel);
+  auto *ctx = channel->ctx();
+
+  // Both sides share the eventfd, as if it had been passed to the controller.
+  const int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  ASSERT_GE(efd, 0);
+  EXPECT_TRUE(channel->SetNotifyFd(efd));
+  EXPECT_FALSE(channel->SetNotifyFd(efd));
+  ctx->notify_ctx.app_fd = efd;
+
+  auto deliver = [&]() {
+    juggler::shm::MsgBufBatch batch;
+    EXPECT_TRUE(channel->MsgBufBulkAlloc(&batch, 1));
+    EXPECT_TRUE(machnet_msg_prepare(&batch, tx_msg.data(), tx_msg.size()));
+    EXPECT_EQ(channel->EnqueueMessages(&batch.bufs()[0], 1), 1);
+  };
+  auto receive = [&]() {
+    std::vector<uint8_t> rx_msg(tx_msg.size());
+    MachnetIovec_t rx_iov = {.base = rx_msg.data(), .len = rx_msg.size()};
+    MachnetMsgHdr_t rx_msghdr = {};
+    rx_msghdr.msg_iov = &rx_iov;
+    rx_msghdr.msg_iovlen = 1;
+    EXPECT_EQ(machnet_recvmsg(ctx, &rx_msghdr), 1);
+    EXPECT_EQ(rx_msg, tx_msg);
+  };
+
+  // Nothing is signaled while the application is polling.
+  EXPECT_EQ(machnet_wait(ctx, 0), 0);
+  deliver();
+  uint64_t val;
+  EXPECT_EQ(read(efd, &val, sizeof(val)), -1);
+  EXPECT_EQ(machnet_wait(ctx, 0), 1);
+  receive();
+
+  // A blocked application is woken up by the next delivery.
+  std::thread engine([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    deliver();
+  });
+  EXPECT_EQ(machnet_wait(ctx, 10 * 1000), 1);
+  EXPECT_EQ(ctx->notify_ctx.armed, 0);
+  engine.join();
+  receive();
+
+  EXPECT_EQ(machnet_wait(ctx, 1), 0);
+}
+
+TEST(BasicChannelTest, ChannelReset) {
+  using ChannelManager = juggler::shm::ChannelManager<juggler::shm::ShmChannel>;
+  const uint32_t kChannelRingSize = 1 << 8;
+  const uint32_t kBufferSize = 1 << 12;
+  const std::vector<char> tx_msg(64, 'a');
+
+  ChannelManager channel_mgr;
+  std::string channel_name(fname);
+  EXPECT_TRUE(channel_mgr.AddChannel(channel_name.c_str(), kChannelRingSize,
+                                     kChannelRingSize, kChannelRingSize,
+                                     kBufferSize));
+  auto *channel = channel_mgr.GetChannel(channel_name.c_str()).get();
+  CHECK_NOTNULL(channel);
+  auto *ctx = channel->ctx();
+  const auto free_bufs = channel->GetFreeBufCount();
+
+  // Leave the channel as an application would: buffers held, messages in
+  // flight both ways, and notifications set up.
+  EXPECT_NE(channel->MsgBufAlloc(), nullptr);
+  EXPECT_TRUE(app_msg_enqueue(ctx, tx_msg));
+  juggler::shm::MsgBufBatch batch;
+  EXPECT_TRUE(channel->MsgBufBulkAlloc(&batch, 1));
+  EXPECT_EQ(channel->EnqueueMessages(&batch.bufs()[0], 1), 1);
+  EXPECT_TRUE(channel->SetNotifyFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)));
+  ctx->tx_weight = MACHNET_CHANNEL_TX_WEIGHT_MAX;
+  machnet_release_cached_buffers(ctx);
+  EXPECT_LT(channel->GetFreeBufCount(), free_bufs);
+
+  EXPECT_TRUE(channel->Reset(kChannelRingSize, kChannelRingSize,
+                             kChannelRingSize, kBufferSize,
+                             MACHNET_CHANNEL_RING_JRING));
+  EXPECT_EQ(ctx->magic, MACHNET_CHANNEL_CTX_MAGIC);
+  EXPECT_STREQ(ctx->name, channel_name.c_str());
+  EXPECT_EQ(ctx->tx_weight, MACHNET_CHANNEL_TX_WEIGHT_DEFAULT);
+  EXPECT_EQ(channel->GetFreeBufCount(), free_bufs);
+  EXPECT_EQ(channel->GetRxMessageCount(), 0);
+  EXPECT_EQ(__machnet_channel_machnet_ring_pending(ctx), 0);
+  juggler::shm::MsgBufBatch rx_batch;
+  EXPECT_EQ(channel->DequeueMessages(&rx_batch), 0);
+  EXPECT_FALSE(channel->HasCtrlRequests());
+  EXPECT_TRUE(channel->SetNotifyFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)));
+
+  // The channel works as a new one.
+  EXPECT_TRUE(app_msg_enqueue(ctx, tx_msg));
+  EXPECT_EQ(channel->DequeueMessages(&rx_batch), 1);
+  EXPECT_TRUE(check_msg(channel, rx_batch.bufs()[0], tx_msg));
+}
+
 TEST(ChannelFullDuplex, SendRecvMsg) {
   const std::chrono::milliseconds kTimeoutMs =
       std::chrono::milliseconds(60 * 1000);   // 60 seconds.
@@ -328,6 +623,7 @@ TEST(ChannelFullDuplex, SendRecvMsg) {
 
     // Check the buffer pool status.
     EXPECT_EQ(channel->GetFreeBufCount(), channel->GetTotalBufCount());
+    EXPECT_EQ(channel->GetFreeSmallBufCount(), channel->GetSmallBufCount());
 
     std::vector<MachnetRingSlot_t> expected_buffers(
         channel->GetTotalBufCount());
@@ -335,16 +631,10 @@ TEST(ChannelFullDuplex, SendRecvMsg) {
     std::vector<MachnetRingSlot_t> buffers;
     uint32_t buffers_size = channel->GetTotalBufCount();
 
-    // Allocate all the buffers in the channel in 3 parts
-    // Allocate from ctx->cache
-    uint32_t current_buffers_cnt;
-    auto ctx = channel->ctx();
-    while (ctx->app_buffer_cache.count > 0)
-      buffers.push_back(
-          ctx->app_buffer_cache.indices[--ctx->app_buffer_cache.count]);
-    current_buffers_cnt = buffers.size();
+    // Allocate all the buffers in the channel in 2 parts (the application's
+    // caches were drained when the child exited).
     // Allocate from shm::channel->cache
-    current_buffers_cnt += channel->GetAllCachedBufferIndices(&buffers);
+    uint32_t current_buffers_cnt = channel->GetAllCachedBufferIndices(&buffers);
     // Allocate from ring
     buffers.resize(buffers_size);
     current_buffers_cnt += __machnet_channel_buf_alloc_bulk(
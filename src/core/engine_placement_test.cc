@@ -0,0 +1,56 @@
+/**
+ * @file engine_placement_test.cc
+ *
+ * Unit tests for the EnginePlacement class.
+ */
+#include <engine_placement.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+namespace juggler {
+
+TEST(EnginePlacementTest, LeastLoaded) {
+  EnginePlacement placement({0, 0, 1});
+  // Channels spread over all engines, instead of piling up on one.
+  for (size_t i = 0; i < 6; i++) {
+    EXPECT_EQ(placement.Place(MACHNET_PLACEMENT_LEAST_LOADED, 0, -1), i % 3);
+  }
+  for (size_t i = 0; i < placement.size(); i++) EXPECT_EQ(placement.load(i), 2);
+
+  placement.Release(1);
+  EXPECT_EQ(placement.Place(MACHNET_PLACEMENT_LEAST_LOADED, 0, -1), 1);
+}
+
+TEST(EnginePlacementTest, NumaLocal) {
+  EnginePlacement placement({0, 1, 1});
+  EXPECT_EQ(placement.Place(MACHNET_PLACEMENT_NUMA_LOCAL, 0, 1), 1);
+  EXPECT_EQ(placement.Place(MACHNET_PLACEMENT_NUMA_LOCAL, 0, 1), 2);
+  EXPECT_EQ(placement.Place(MACHNET_PLACEMENT_NUMA_LOCAL, 0, 1), 1);
+  EXPECT_EQ(placement.Place(MACHNET_PLACEMENT_NUMA_LOCAL, 0, 0), 0);
+
+  // No engine on the node (or unknown node): fall back to the least loaded.
+  EXPECT_EQ(placement.Place(MACHNET_PLACEMENT_NUMA_LOCAL, 0, 7), 0);
+  EXPECT_EQ(placement.Place(MACHNET_PLACEMENT_NUMA_LOCAL, 0, -1), 2);
+}
+
+TEST(EnginePlacementTest, ExplicitEngine) {
+  EnginePlacement placement({0, 1});
+  EXPECT_EQ(placement.Place(MACHNET_PLACEMENT_ENGINE, 1, -1), 1);
+  EXPECT_EQ(placement.Place(MACHNET_PLACEMENT_ENGINE, 1, -1), 1);
+  EXPECT_EQ(placement.load(1), 2);
+
+  EXPECT_FALSE(placement.Place(MACHNET_PLACEMENT_ENGINE, 2, -1).has_value());
+  EXPECT_FALSE(placement.Place(0xFF, 0, -1).has_value());
+  EXPECT_EQ(placement.load(0), 0);
+
+  EnginePlacement none({});
+  EXPECT_FALSE(none.Place(MACHNET_PLACEMENT_LEAST_LOADED, 0, -1).has_value());
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,55 @@
+/**
+ * @file engine_rebalancer_test.cc
+ *
+ * Unit tests for the EngineRebalancer class.
+ */
+#include <engine_rebalancer.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+namespace juggler {
+
+TEST(EngineRebalancerTest, MigratesFromHotToCold) {
+  EngineRebalancer rebalancer(0.2, 0);
+  // Engine 1 is the busiest: moving the channel with a fourth of its load
+  // (0.2) evens out the gap (0.4) best.
+  const std::vector<EngineRebalancer::EngineLoad> engines = {
+      {0.4, {100}}, {0.8, {50, 100, 250}}, {0.5, {}}};
+  const auto migration = rebalancer.Rebalance(engines);
+  ASSERT_TRUE(migration.has_value());
+  EXPECT_EQ(migration->from, 1);
+  EXPECT_EQ(migration->to, 0);
+  EXPECT_EQ(migration->channel, 1);
+}
+
+TEST(EngineRebalancerTest, Balanced) {
+  EngineRebalancer rebalancer(0.2, 0);
+  // Below the threshold.
+  EXPECT_FALSE(rebalancer.Rebalance({{0.5, {1, 1}}, {0.4, {1}}}).has_value());
+  // A single channel on the hot engine: it would just move the hotspot.
+  EXPECT_FALSE(rebalancer.Rebalance({{0.9, {10}}, {0.1, {}}}).has_value());
+  // Each channel carries more than the gap.
+  EXPECT_FALSE(
+      rebalancer.Rebalance({{0.9, {10, 10}}, {0.5, {}}}).has_value());
+  // No messages to estimate the load of the channels from.
+  EXPECT_FALSE(rebalancer.Rebalance({{0.9, {0, 0}}, {0.1, {}}}).has_value());
+  EXPECT_FALSE(rebalancer.Rebalance({{0.9, {1, 1}}}).has_value());
+}
+
+TEST(EngineRebalancerTest, Cooldown) {
+  EngineRebalancer rebalancer(0.2, 2);
+  const std::vector<EngineRebalancer::EngineLoad> engines = {
+      {0.9, {1, 1}}, {0.1, {}}};
+  EXPECT_TRUE(rebalancer.Rebalance(engines).has_value());
+  EXPECT_FALSE(rebalancer.Rebalance(engines).has_value());
+  EXPECT_FALSE(rebalancer.Rebalance(engines).has_value());
+  EXPECT_TRUE(rebalancer.Rebalance(engines).has_value());
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,94 @@
+/**
+ * @file engine_stats_test.cc
+ *
+ * Unit tests for the shared-memory stats pages of the engines.
+ */
+#include <engine_stats.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+namespace juggler {
+namespace stats {
+
+static constexpr char kTestPageName[] = "machnet-stats-test";
+
+TEST(EngineStatsTest, ReadWrite) {
+  auto page = StatsPage::Create(kTestPageName, 4, 8);
+  ASSERT_NE(page, nullptr);
+  auto reader = StatsPageReader::Open(kTestPageName);
+  ASSERT_NE(reader, nullptr);
+
+  Snapshot snapshot;
+  ASSERT_TRUE(reader->Read(&snapshot));
+  EXPECT_EQ(snapshot.header.max_channels, 4);
+  EXPECT_EQ(snapshot.header.max_flows, 8);
+  EXPECT_TRUE(snapshot.channels.empty());
+  EXPECT_TRUE(snapshot.flows.empty());
+
+  page->Update([](PageHeader *header, ChannelStats *channels,
+                  FlowStats *flows) {
+    header->queue.rx_packets = 42;
+    std::strncpy(channels[0].name, "chan", sizeof(channels[0].name));
+    channels[0].flows = 2;
+    flows[0].local_port = 1;
+    flows[1].local_port = 2;
+    header->nb_channels = 1;
+    header->nb_flows = 2;
+  });
+
+  ASSERT_TRUE(reader->Read(&snapshot));
+  EXPECT_EQ(snapshot.header.seq % 2, 0);
+  EXPECT_EQ(snapshot.header.queue.rx_packets, 42);
+  ASSERT_EQ(snapshot.channels.size(), 1);
+  EXPECT_STREQ(snapshot.channels[0].name, "chan");
+  ASSERT_EQ(snapshot.flows.size(), 2);
+  EXPECT_EQ(snapshot.flows[1].local_port, 2);
+}
+
+TEST(EngineStatsTest, ConcurrentUpdates) {
+  auto page = StatsPage::Create(kTestPageName, 1, 64);
+  ASSERT_NE(page, nullptr);
+  auto reader = StatsPageReader::Open(kTestPageName);
+  ASSERT_NE(reader, nullptr);
+
+  // The writer keeps every entry of the page equal to a counter: a reader must
+  // never see a mix of two updates.
+  std::atomic<bool> stop{false};
+  std::thread writer([&page, &stop]() {
+    uint64_t i = 0;
+    while (!stop.load()) {
+      i++;
+      page->Update([i](PageHeader *header, ChannelStats *, FlowStats *flows) {
+        header->queue.tx_packets = i;
+        for (uint32_t f = 0; f < 64; f++) flows[f].srtt_ns = i;
+        header->nb_flows = 64;
+      });
+    }
+  });
+
+  Snapshot snapshot;
+  for (int i = 0; i < 1000; i++) {
+    if (!reader->Read(&snapshot)) continue;
+    for (const auto &flow : snapshot.flows) {
+      ASSERT_EQ(flow.srtt_ns, snapshot.header.queue.tx_packets);
+    }
+  }
+  stop.store(true);
+  writer.join();
+}
+
+TEST(EngineStatsTest, OpenMissing) {
+  EXPECT_EQ(StatsPageReader::Open("machnet-stats-missing"), nullptr);
+}
+
+}  // namespace stats
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
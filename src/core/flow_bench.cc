@@ -0,0 +1,361 @@
+/**
+ * @file flow_bench.cc
+ *
+ * Benchmarks of the per-packet paths of a flow: reassembly of received packets
+ * (`RXTracking'), tracking of the messages sent (`TXTracking'), preparation of
+ * data packets, and processing of ACKs carrying SACK information.
+ *
+ * Besides the time, each benchmark reports the TSC cycles spent per packet in
+ * the code under test (`cycles/pkt'), which does not depend on the frequency
+ * the CPU happens to run at. The set-up of each round (allocating messages,
+ * draining the channel, as the application would) is left out.
+ */
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include "channel.h"
+#include "dpdk.h"
+#include "machnet.h"
+#include "machnet_pkthdr.h"
+#include "packet_pool.h"
+#include "pmd.h"
+#include "ttime.h"
+
+#define private public
+#include "flow.h"
+
+namespace juggler {
+namespace net {
+namespace flow {
+
+// Packets per round of the benchmarks; within the range of the SACK bitmap.
+static constexpr uint32_t kRoundPackets = 64;
+static constexpr uint32_t kChannelRingSize = 1 << 10;
+static constexpr uint32_t kBufferRingSize = 1 << 13;
+static constexpr uint32_t kBufferSize = 1 << 11;
+static constexpr uint32_t kMbufsNr = 1 << 13;
+// Largest payload of a data packet, at the default MTU.
+static constexpr uint32_t kMaxPayloadLen =
+    dpdk::PmdRing::kDefaultFrameSize - Flow::kDataHeadersLen;
+
+// State shared by the benchmarks, set up once DPDK is initialized.
+struct BenchContext {
+  BenchContext()
+      : pmd_port(std::make_shared<dpdk::PmdPort>(0, 1, 1)),
+        pkt_pool(kMbufsNr, dpdk::PmdRing::kDefaultFrameSize +
+                               RTE_ETHER_HDR_LEN + RTE_ETHER_CRC_LEN +
+                               RTE_PKTMBUF_HEADROOM),
+        timer_wheel(time::rdtsc()) {
+    pmd_port->InitDriver();
+    for (const auto *name : {"flow_bench", "flow_bench_zc"}) {
+      CHECK(channel_mgr.AddChannel(name, kChannelRingSize, kChannelRingSize,
+                                   kBufferRingSize, kBufferSize));
+    }
+    channel = channel_mgr.GetChannel("flow_bench");
+    // Zero-copy TX leaves the buffers of its channel to the NIC; it gets a
+    // channel of its own.
+    zerocopy_channel = channel_mgr.GetChannel("flow_bench_zc");
+    local_addr.FromString("10.0.0.1");
+    remote_addr.FromString("10.0.0.2");
+  }
+
+  ~BenchContext() {
+    channel.reset();
+    zerocopy_channel.reset();
+    channel_mgr.DestroyChannel("flow_bench");
+    channel_mgr.DestroyChannel("flow_bench_zc");
+  }
+
+  // Set up zero-copy TX on `zerocopy_channel', once; not every device
+  // supports it (see `shm::Channel::RegisterMemForDMA()').
+  bool EnableTxZeroCopy() {
+    if (!zerocopy.has_value()) {
+      zerocopy =
+          zerocopy_channel->RegisterMemForDMA(pmd_port->GetDevice()) &&
+          zerocopy_channel->EnableTxZeroCopy(0);
+    }
+    return zerocopy.value();
+  }
+
+  std::unique_ptr<Flow> NewFlow(shm::Channel *flow_channel) {
+    auto flow = std::make_unique<Flow>(
+        local_addr, Udp::Port(1234), remote_addr, Udp::Port(888),
+        pmd_port->GetL2Addr(), Ethernet::Address("00:00:00:00:00:02"),
+        pmd_port->GetRing<dpdk::TxRing>(0),
+        [](shm::Channel *, bool, const Key &) {}, kDefaultAckEvery, 0, 1,
+        std::nullopt, &timer_wheel, [](Flow *) {}, flow_channel);
+    flow->state_ = Flow::State::kEstablished;
+    return flow;
+  }
+
+  std::shared_ptr<dpdk::PmdPort> pmd_port;
+  dpdk::PacketPool pkt_pool;
+  TimerWheel timer_wheel;
+  shm::ChannelManager<shm::Channel> channel_mgr;
+  std::shared_ptr<shm::Channel> channel;
+  std::shared_ptr<shm::Channel> zerocopy_channel;
+  std::optional<bool> zerocopy;
+  Ipv4::Address local_addr;
+  Ipv4::Address remote_addr;
+};
+
+static BenchContext *ctx = nullptr;
+
+static void ReportCycles(benchmark::State &state, uint64_t cycles,
+                         uint64_t packets) {
+  state.counters["cycles/pkt"] =
+      packets == 0 ? 0 : static_cast<double>(cycles) / packets;
+  state.SetItemsProcessed(packets);
+}
+
+// A message of `len' bytes, in a single buffer of the channel.
+static shm::MsgBuf *NewMessage(shm::Channel *channel, uint32_t len) {
+  auto *msg = CHECK_NOTNULL(channel->MsgBufAlloc(len));
+  std::fill_n(CHECK_NOTNULL(msg->append<uint8_t *>(len)), len, 'a');
+  msg->set_flags(MACHNET_MSGBUF_FLAGS_SYN | MACHNET_MSGBUF_FLAGS_FIN);
+  msg->set_msg_length(len);
+  msg->set_last(msg->index());
+  return msg;
+}
+
+// Receive all the messages delivered to the application.
+static void Drain(shm::Channel *channel) {
+  static std::vector<uint8_t> buf(MACHNET_MSG_MAX_LEN);
+  MachnetFlow_t flow;
+  while (machnet_recv(channel->ctx(), buf.data(), buf.size(), &flow) > 0) {
+  }
+}
+
+// Data packets of single-packet messages of `len' bytes, as received from the
+// remote end (only the Machnet header matters to `RXTracking').
+static std::vector<dpdk::Packet *> NewDataPackets(uint32_t len) {
+  std::vector<dpdk::Packet *> packets(kRoundPackets);
+  CHECK(ctx->pkt_pool.PacketBulkAlloc(packets.data(), packets.size()));
+  for (auto *packet : packets) {
+    auto *data = CHECK_NOTNULL(
+        packet->append<uint8_t *>(Flow::kDataHeadersLen + len));
+    auto *machneth = reinterpret_cast<MachnetPktHdr *>(
+        data + sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp));
+    machneth->magic = be16_t(MachnetPktHdr::kMagic);
+    machneth->net_flags = MachnetPktHdr::MachnetFlags::kData;
+    machneth->msg_flags = MACHNET_MSGBUF_FLAGS_SYN | MACHNET_MSGBUF_FLAGS_FIN;
+    std::fill_n(data + Flow::kDataHeadersLen, len, 'a');
+  }
+  return packets;
+}
+
+// Feed rounds of data packets to `RXTracking::Add()', in the order given by
+// `order' (a permutation of the packets of a round).
+static void RxTrackingAdd(benchmark::State &state,
+                          const std::vector<uint32_t> &order) {
+  auto *channel = ctx->channel.get();
+  RXTracking rx_tracking(ctx->local_addr.address.value(), 1234,
+                         ctx->remote_addr.address.value(), 888, channel);
+  swift::Pcb pcb;
+  auto packets = NewDataPackets(state.range(0));
+  uint64_t cycles = 0, npackets = 0;
+  for (auto _ : state) {
+    const auto base = pcb.rcv_nxt;
+    for (uint32_t i = 0; i < kRoundPackets; i++) {
+      auto *machneth = packets[i]->head_data<MachnetPktHdr *>(
+          sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp));
+      machneth->seqno = be32_t(base + i);
+    }
+    const auto start = time::rdtsc();
+    for (const auto i : order) rx_tracking.Add(&pcb, packets[i]);
+    cycles += time::rdtsc() - start;
+    npackets += kRoundPackets;
+
+    state.PauseTiming();
+    CHECK_EQ(pcb.rcv_nxt, base + kRoundPackets);
+    Drain(channel);
+    state.ResumeTiming();
+  }
+  for (auto *packet : packets) dpdk::Packet::Free(packet);
+  ReportCycles(state, cycles, npackets);
+}
+
+static void BM_RxTrackingAddInOrder(benchmark::State &state) {  // NOLINT
+  std::vector<uint32_t> order(kRoundPackets);
+  std::iota(order.begin(), order.end(), 0);
+  RxTrackingAdd(state, order);
+}
+BENCHMARK(BM_RxTrackingAddInOrder)->Arg(64)->Arg(512)->Arg(kMaxPayloadLen);
+
+// Packets reordered at random within each round: most of them go through the
+// reassembly buffer, and the SACK state.
+static void BM_RxTrackingAddOutOfOrder(benchmark::State &state) {  // NOLINT
+  std::vector<uint32_t> order(kRoundPackets);
+  std::iota(order.begin(), order.end(), 0);
+  std::shuffle(order.begin(), order.end(), std::mt19937(42));
+  RxTrackingAdd(state, order);
+}
+BENCHMARK(BM_RxTrackingAddOutOfOrder)->Arg(64)->Arg(512)->Arg(kMaxPayloadLen);
+
+// Messages queued (`Append()'), sent, and acknowledged in batches of the given
+// size (`ReceiveAcks()', which frees their buffers).
+static void BM_TxTrackingAppendAndAck(benchmark::State &state) {  // NOLINT
+  auto *channel = ctx->channel.get();
+  TXTracking tx_tracking(channel);
+  const uint32_t ack_batch = state.range(0);
+  std::vector<shm::MsgBuf *> msgs(kRoundPackets);
+  uint64_t cycles = 0, npackets = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (auto &msg : msgs) msg = NewMessage(channel, 64);
+    state.ResumeTiming();
+
+    const auto start = time::rdtsc();
+    for (auto *msg : msgs) tx_tracking.Append(msg);
+    for (uint32_t i = 0; i < kRoundPackets; i++) {
+      benchmark::DoNotOptimize(tx_tracking.GetAndUpdateOldestUnsent());
+    }
+    for (uint32_t i = 0; i < kRoundPackets; i += ack_batch) {
+      tx_tracking.ReceiveAcks(std::min(ack_batch, kRoundPackets - i));
+    }
+    cycles += time::rdtsc() - start;
+    npackets += kRoundPackets;
+  }
+  CHECK_EQ(tx_tracking.NumTrackedMsgbufs(), 0);
+  ReportCycles(state, cycles, npackets);
+}
+BENCHMARK(BM_TxTrackingAppendAndAck)->Arg(1)->Arg(16)->Arg(kRoundPackets);
+
+// Data packets prepared from a message buffer, which the NIC then sends (and
+// frees); the payload is copied, or the buffer attached to the packet.
+template <CopyMode copy_mode>
+static void BM_PrepareDataPacket(benchmark::State &state) {  // NOLINT
+  auto *channel = copy_mode == CopyMode::kZeroCopy
+                      ? ctx->zerocopy_channel.get()
+                      : ctx->channel.get();
+  if (copy_mode == CopyMode::kZeroCopy && !ctx->EnableTxZeroCopy()) {
+    state.SkipWithError("Zero-copy TX not supported by the device.");
+    return;
+  }
+  auto flow = ctx->NewFlow(channel);
+  auto *txring = ctx->pmd_port->GetRing<dpdk::TxRing>(0);
+  auto *msg = NewMessage(channel, state.range(0));
+  dpdk::PacketBatch batch;
+  uint64_t cycles = 0, npackets = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    CHECK(txring->GetPacketPool()->PacketBulkAlloc(
+        &batch, dpdk::PacketBatch::kMaxBurst));
+    state.ResumeTiming();
+
+    const auto start = time::rdtsc();
+    for (uint32_t i = 0; i < batch.GetSize(); i++) {
+      flow->PrepareDataPacket<copy_mode>(msg, batch[i],
+                                         flow->pcb_.get_snd_nxt());
+    }
+    cycles += time::rdtsc() - start;
+    npackets += batch.GetSize();
+
+    state.PauseTiming();
+    txring->SendPackets(&batch);
+    state.ResumeTiming();
+  }
+  ReportCycles(state, cycles, npackets);
+}
+BENCHMARK_TEMPLATE(BM_PrepareDataPacket, CopyMode::kMemCopy)
+    ->Arg(64)
+    ->Arg(512)
+    ->Arg(kMaxPayloadLen);
+BENCHMARK_TEMPLATE(BM_PrepareDataPacket, CopyMode::kZeroCopy)
+    ->Arg(64)
+    ->Arg(512)
+    ->Arg(kMaxPayloadLen);
+
+// A round of ACKs for a window of packets whose first one is lost: one ACK
+// per packet delivered, each SACKing one more of them, of which the first
+// reveals the loss (see `Flow::RackDetectLosses()') and has the packet
+// retransmitted; then the ACK of the retransmission acknowledges all of them.
+static void BM_ProcessAckSack(benchmark::State &state) {  // NOLINT
+  auto *channel = ctx->channel.get();
+  auto flow = ctx->NewFlow(channel);
+  auto *txring = ctx->pmd_port->GetRing<dpdk::TxRing>(0);
+  auto *ack = CHECK_NOTNULL(ctx->pkt_pool.PacketAlloc());
+  auto *machneth = CHECK_NOTNULL(ack->append<uint8_t *>(
+                       Flow::kDataHeadersLen)) +
+                   sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp);
+  auto *ackh = reinterpret_cast<MachnetPktHdr *>(machneth);
+  std::fill_n(machneth, sizeof(MachnetPktHdr), 0);
+  ackh->magic = be16_t(MachnetPktHdr::kMagic);
+  ackh->net_flags = MachnetPktHdr::MachnetFlags::kAck;
+  ackh->rwnd = be16_t(UINT16_MAX);
+
+  const uint32_t window = state.range(0);
+  uint64_t cycles = 0, nacks = 0;
+  for (auto _ : state) {
+    // Packets in flight, the first one sent well before the others.
+    state.PauseTiming();
+    auto &pcb = flow->pcb_;
+    auto &tx_tracking = flow->tx_tracking_;
+    const auto now_ns = Flow::Now();
+    const auto snd_una = pcb.snd_una;
+    for (uint32_t i = 0; i < window; i++) {
+      tx_tracking.Append(NewMessage(channel, 64));
+      tx_tracking.GetAndUpdateOldestUnsent();
+      tx_tracking.SetSendTimeNs(pcb.get_snd_nxt(),
+                                i == 0 ? now_ns - 1000000 : now_ns + i);
+    }
+    state.ResumeTiming();
+
+    std::array<uint64_t, MachnetPktHdr::kSackBitmapWords> sacked{};
+    const auto start = time::rdtsc();
+    for (uint32_t i = 1; i < window; i++) {
+      ackh->ackno = be32_t(snd_una);
+      sacked[i / 64] |= 1ULL << (i % 64);
+      for (size_t w = 0; w < sacked.size(); w++) {
+        ackh->sack_bitmap[w] = be64_t(sacked[w]);
+      }
+      ackh->sack_bitmap_count = be16_t(i);
+      ackh->timestamp2 = be64_t(now_ns + i);
+      flow->InputPacket(ack);
+    }
+    ackh->ackno = be32_t(snd_una + window);
+    for (auto &word : ackh->sack_bitmap) word = be64_t(0);
+    ackh->sack_bitmap_count = be16_t(0);
+    ackh->timestamp2 = be64_t(Flow::Now());
+    flow->InputPacket(ack);
+    cycles += time::rdtsc() - start;
+    nacks += window;
+
+    state.PauseTiming();
+    CHECK_EQ(pcb.snd_una, snd_una + window);
+    txring->Flush();
+    state.ResumeTiming();
+  }
+  dpdk::Packet::Free(ack);
+  ReportCycles(state, cycles, nacks);
+}
+BENCHMARK(BM_ProcessAckSack)->Arg(16)->Arg(kRoundPackets)->Arg(256);
+
+}  // namespace flow
+}  // namespace net
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  benchmark::Initialize(&argc, argv);
+
+  auto kEalOpts = juggler::utils::CmdLineOpts(
+      {"-c", "0x0", "-n", "6", "--proc-type=auto", "-m", "1024", "--log-level",
+       "8", "--vdev=net_null0,copy=1", "--no-pci"});
+  auto d = juggler::dpdk::Dpdk();
+  d.InitDpdk(kEalOpts);
+
+  juggler::net::flow::BenchContext ctx;
+  juggler::net::flow::ctx = &ctx;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
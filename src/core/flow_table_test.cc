@@ -0,0 +1,166 @@
+/**
+ * @file flow_table_test.cc
+ *
+ * Unit tests for the FlowTable class.
+ */
+#include <flow_table.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+namespace juggler {
+namespace net {
+namespace flow {
+
+class FlowTableTest : public ::testing::Test {
+ protected:
+  FlowTableTest() : rng_(std::random_device{}()) {}  // NOLINT
+
+  std::vector<Key> RandomKeys(size_t n) {
+    std::uniform_int_distribution<uint32_t> dist;
+    std::vector<Key> keys;
+    keys.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+      keys.emplace_back(dist(rng_), static_cast<uint16_t>(dist(rng_)),
+                        dist(rng_), static_cast<uint16_t>(dist(rng_)));
+    }
+    return keys;
+  }
+
+  std::mt19937 rng_;
+};
+
+TEST_F(FlowTableTest, InsertLookupErase) {
+  FlowTable<uint64_t> table;
+  const Key key(0x0a000001, 1234, 0x0a000002, 888);
+  const auto hash = FlowTable<uint64_t>::Hash(key);
+
+  EXPECT_EQ(table.Lookup(key, hash), nullptr);
+  EXPECT_TRUE(table.Insert(key, hash, 42));
+  EXPECT_FALSE(table.Insert(key, hash, 43));
+  EXPECT_EQ(table.size(), 1);
+
+  auto *value = table.Lookup(key, hash);
+  ASSERT_NE(value, nullptr);
+  EXPECT_EQ(*value, 42);
+
+  // A key with the same hash but different contents must not match.
+  const Key other(0x0a000001, 1234, 0x0a000002, 889);
+  EXPECT_EQ(table.Lookup(other, hash), nullptr);
+
+  EXPECT_TRUE(table.Erase(key, hash));
+  EXPECT_FALSE(table.Erase(key, hash));
+  EXPECT_EQ(table.Lookup(key, hash), nullptr);
+  EXPECT_TRUE(table.empty());
+}
+
+TEST_F(FlowTableTest, CollidingHashes) {
+  // Force all keys to the same bucket to exercise overflow into the
+  // neighbouring buckets and tombstone handling.
+  FlowTable<size_t> table(64);
+  const uint32_t kHash = 0xdeadbeef;
+  const auto keys = RandomKeys(16);
+  for (size_t i = 0; i < keys.size(); i++) {
+    EXPECT_TRUE(table.Insert(keys[i], kHash, i));
+  }
+
+  // Remove every other key, and check that the rest are still reachable.
+  for (size_t i = 0; i < keys.size(); i += 2) {
+    EXPECT_TRUE(table.Erase(keys[i], kHash));
+  }
+  for (size_t i = 0; i < keys.size(); i++) {
+    auto *value = table.Lookup(keys[i], kHash);
+    if (i % 2 == 0) {
+      EXPECT_EQ(value, nullptr);
+    } else {
+      ASSERT_NE(value, nullptr);
+      EXPECT_EQ(*value, i);
+    }
+  }
+}
+
+TEST_F(FlowTableTest, GrowAndIterate) {
+  FlowTable<size_t> table(4);
+  const size_t kNumKeys = 1 << 14;
+  const auto keys = RandomKeys(kNumKeys);
+  std::unordered_map<Key, size_t> reference;
+  for (size_t i = 0; i < keys.size(); i++) {
+    const bool inserted = reference.emplace(keys[i], i).second;
+    EXPECT_EQ(table.Insert(keys[i], FlowTable<size_t>::Hash(keys[i]), i),
+              inserted);
+  }
+  EXPECT_EQ(table.size(), reference.size());
+  EXPECT_GE(table.capacity(), table.size());
+
+  for (const auto &[key, index] : reference) {
+    auto *value = table.Lookup(key, FlowTable<size_t>::Hash(key));
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(*value, index);
+  }
+
+  size_t visited = 0;
+  table.ForEach([&visited](size_t &) { visited++; });
+  EXPECT_EQ(visited, reference.size());
+
+  const auto nerased =
+      table.EraseIf([](const size_t &value) { return value % 3 == 0; });
+  EXPECT_EQ(table.size() + nerased, reference.size());
+  for (const auto &[key, index] : reference) {
+    auto *value = table.Lookup(key, FlowTable<size_t>::Hash(key));
+    EXPECT_EQ(value == nullptr, index % 3 == 0);
+  }
+}
+
+TEST_F(FlowTableTest, LookupBulk) {
+  using Table = FlowTable<size_t>;
+  Table table;
+  const auto keys = RandomKeys(Table::kMaxBulkLookup);
+  const auto missing = RandomKeys(Table::kMaxBulkLookup);
+  for (size_t i = 0; i < keys.size(); i++) {
+    table.Insert(keys[i], Table::Hash(keys[i]), i);
+  }
+
+  const Key *batch[Table::kMaxBulkLookup];
+  uint32_t hashes[Table::kMaxBulkLookup];
+  size_t *values[Table::kMaxBulkLookup];
+  size_t expected_found = 0;
+  for (size_t i = 0; i < Table::kMaxBulkLookup; i++) {
+    switch (i % 3) {
+      case 0:
+        batch[i] = &keys[i];
+        expected_found++;
+        break;
+      case 1:
+        batch[i] = &missing[i];
+        break;
+      default:
+        batch[i] = nullptr;
+    }
+    hashes[i] = batch[i] == nullptr ? 0 : Table::Hash(*batch[i]);
+  }
+
+  EXPECT_EQ(table.LookupBulk(batch, hashes, Table::kMaxBulkLookup, values),
+            expected_found);
+  for (size_t i = 0; i < Table::kMaxBulkLookup; i++) {
+    if (i % 3 == 0) {
+      ASSERT_NE(values[i], nullptr);
+      EXPECT_EQ(*values[i], i);
+    } else {
+      EXPECT_EQ(values[i], nullptr);
+    }
+  }
+}
+
+}  // namespace flow
+}  // namespace net
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
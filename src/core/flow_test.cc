@@ -8,8 +8,11 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <array>
+#include <cstring>
 #include <random>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "channel.h"
@@ -270,6 +273,229 @@ TEST_F(FlowTest, TXQueue_PushPop) {
   EXPECT_EQ(channel_->GetFreeBufCount(), channel_->GetTotalBufCount());
 }
 
+TEST_F(FlowTest, TXQueue_SharedBuffers) {
+  // One message to two flows: each tracks its own chain of references to the
+  // same buffers (see `machnet_sendmsg_fanout()'), which are freed with the
+  // last reference.
+  std::vector<uint8_t> data(3 * channel_->GetUsableBufSize() - 1);
+  std::generate(data.begin(), data.end(), std::rand);
+  auto *shared = CreateMsg(data);
+  const uint32_t buffers_nr = 3;
+  const uint32_t free_bufs = channel_->GetFreeBufCount();
+
+  TXTracking other_tx_tracking(channel_.get());
+  for (auto *tracking : {tx_tracking_.get(), &other_tx_tracking}) {
+    shm::MsgBuf *head = nullptr, *tail = nullptr;
+    for (auto *buf = shared; buf != nullptr;
+         buf = buf->has_next() ? channel_->GetMsgBuf(buf->next()) : nullptr) {
+      auto *ref = CHECK_NOTNULL(channel_->MsgBufAlloc());
+      ref->set_flags(0);
+      ref->set_ref(buf);
+      if (head == nullptr) {
+        head = ref;
+      } else {
+        tail->set_next(ref);
+      }
+      tail = ref;
+    }
+    head->set_msg_length(data.size());
+    head->set_last(tail->index());
+    head->mark_first();
+    tail->mark_last();
+    tracking->Append(head);
+    EXPECT_EQ(tracking->NumUnsentMsgbufs(), buffers_nr);
+  }
+  for (auto *buf = shared; buf != nullptr;
+       buf = buf->has_next() ? channel_->GetMsgBuf(buf->next()) : nullptr) {
+    buf->set_refcnt(2);
+  }
+  EXPECT_EQ(channel_->GetFreeBufCount(), free_bufs - 2 * buffers_nr);
+
+  // The payload is the shared one, whichever flow sends it.
+  for (auto *tracking : {tx_tracking_.get(), &other_tx_tracking}) {
+    std::vector<uint8_t> payload;
+    for (uint32_t i = 0; i < buffers_nr; i++) {
+      auto *ref = tracking->GetAndUpdateOldestUnsent().value();
+      EXPECT_TRUE(ref->is_ref());
+      const auto *buf = channel_->GetPayloadMsgBuf(ref);
+      const auto *buf_data = buf->head_data<const uint8_t *>();
+      payload.insert(payload.end(), buf_data, buf_data + buf->length());
+    }
+    EXPECT_EQ(payload, data);
+  }
+
+  // The first flow releases its references only.
+  tx_tracking_->ReceiveAcks(buffers_nr);
+  EXPECT_EQ(tx_tracking_->NumTrackedMsgbufs(), 0);
+  EXPECT_EQ(channel_->GetFreeBufCount(), free_bufs - buffers_nr);
+  EXPECT_EQ(shared->refcnt(), 1);
+
+  // The last one releases the shared buffers too.
+  other_tx_tracking.ReceiveAcks(buffers_nr);
+  EXPECT_EQ(other_tx_tracking.NumTrackedMsgbufs(), 0);
+  EXPECT_EQ(channel_->GetFreeBufCount(), channel_->GetTotalBufCount());
+}
+
+TEST_F(FlowTest, TXQueue_DeliveryCompletions) {
+  // Three messages, of which the first and the last are to be notified, are
+  // acknowledged packet by packet.
+  const auto buf_size = channel_->GetUsableBufSize();
+  const std::vector<size_t> msg_sizes = {2 * buf_size, buf_size, 10};
+  const std::vector<uint32_t> cookies = {7, 0, 9};
+  uint32_t buffers_nr = 0;
+  for (size_t i = 0; i < msg_sizes.size(); i++) {
+    std::vector<uint8_t> data(msg_sizes[i]);
+    auto *msgbuf = CreateMsg(data);
+    if (cookies[i] != 0) {
+      msgbuf->add_flags(MACHNET_MSGBUF_NOTIFY_DELIVERY);
+      msgbuf->set_cookie(cookies[i]);
+    }
+    tx_tracking_->Append(msgbuf);
+    buffers_nr += (msg_sizes[i] + buf_size - 1) / buf_size;
+  }
+  for (uint32_t i = 0; i < buffers_nr; i++) {
+    tx_tracking_->GetAndUpdateOldestUnsent();
+  }
+
+  // Not before the last packet of a message is acknowledged.
+  uint32_t completed[4];
+  tx_tracking_->ReceiveAcks(1);
+  EXPECT_EQ(__machnet_channel_completion_ring_dequeue(channel_->ctx(), 4,
+                                                      completed),
+            0);
+  tx_tracking_->ReceiveAcks(buffers_nr - 1);
+  ASSERT_EQ(__machnet_channel_completion_ring_dequeue(channel_->ctx(), 4,
+                                                      completed),
+            2);
+  EXPECT_EQ(completed[0], cookies[0]);
+  EXPECT_EQ(completed[1], cookies[2]);
+  EXPECT_EQ(channel_->GetCompletionDropCount(), 0);
+  EXPECT_EQ(channel_->GetFreeBufCount(), channel_->GetTotalBufCount());
+}
+
+TEST_F(FlowTest, TXQueue_Chunks) {
+  // A message enqueued in two chunks (see `machnet_sendmsg_chunk()'): the
+  // second one continues the first one's message, even if it was sent (and
+  // acknowledged) before the second one was enqueued.
+  std::vector<uint8_t> data(4 * channel_->GetUsableBufSize());
+  std::generate(data.begin(), data.end(), std::rand);
+  const auto half = data.size() / 2;
+  auto create_chunk = [this](const std::vector<uint8_t> &chunk, bool first,
+                             bool last) {
+    auto *head = CreateMsg(chunk);
+    auto *tail = channel_->GetMsgBuf(head->last());
+    if (!first) head->set_flags(head->flags() & ~MACHNET_MSGBUF_FLAGS_SYN);
+    if (!last) {
+      tail->set_flags((tail->flags() & ~MACHNET_MSGBUF_FLAGS_FIN) |
+                      MACHNET_MSGBUF_FLAGS_CHAIN);
+    }
+    return head;
+  };
+
+  auto *first = create_chunk({data.begin(), data.begin() + half}, true, false);
+  auto *first_tail = channel_->GetMsgBuf(first->last());
+  tx_tracking_->Append(first);
+  auto *second = create_chunk({data.begin() + half, data.end()}, false, true);
+  tx_tracking_->Append(second);
+  EXPECT_EQ(tx_tracking_->NumUnsentMsgbufs(), 4);
+  EXPECT_TRUE(first_tail->has_next());
+  EXPECT_EQ(first_tail->next(), second->index());
+
+  // The packets carry the bounds of the message only.
+  std::vector<uint8_t> payload;
+  for (uint32_t i = 0; i < 4; i++) {
+    auto *buf = tx_tracking_->GetAndUpdateOldestUnsent().value();
+    EXPECT_EQ(buf->is_first(), i == 0);
+    EXPECT_EQ(buf->is_last(), i == 3);
+    const auto *buf_data = buf->head_data<const uint8_t *>();
+    payload.insert(payload.end(), buf_data, buf_data + buf->length());
+  }
+  EXPECT_EQ(payload, data);
+  tx_tracking_->ReceiveAcks(4);
+
+  // Once the queue drained, a chunk starts it anew.
+  for (const bool first_chunk : {true, false}) {
+    auto *chunk = create_chunk(data, first_chunk, !first_chunk);
+    tx_tracking_->Append(chunk);
+    EXPECT_EQ(tx_tracking_->GetOldestUnsentMsgBuf(), chunk);
+    for (uint32_t i = 0; i < 4; i++) tx_tracking_->GetAndUpdateOldestUnsent();
+    tx_tracking_->ReceiveAcks(4);
+  }
+  EXPECT_EQ(tx_tracking_->NumTrackedMsgbufs(), 0);
+  EXPECT_EQ(channel_->GetFreeBufCount(), channel_->GetTotalBufCount());
+}
+
+TEST_F(FlowTest, TXQueue_HeldPackets) {
+  // Packets kept for retransmissions (see `RexmitBudget'), by sequence number,
+  // across the wrap-around.
+  RexmitBudget budget(2);
+  tx_tracking_->set_rexmit_budget(&budget);
+  const uint32_t seqno = UINT32_MAX;
+  std::vector<dpdk::Packet *> packets;
+  for (uint32_t i = 0; i < 3; i++) {
+    packets.push_back(CHECK_NOTNULL(pkt_pool_->PacketAlloc()));
+    tx_tracking_->HoldPacket(seqno + i, packets.back());
+  }
+  EXPECT_EQ(budget.held(), 2);
+  EXPECT_EQ(tx_tracking_->NumHeldPackets(), 2);
+
+  // Not until the NIC is done with them.
+  EXPECT_EQ(tx_tracking_->GetIdlePacket(seqno), nullptr);
+  for (auto *packet : packets) dpdk::Packet::Free(packet);
+  EXPECT_EQ(tx_tracking_->GetIdlePacket(seqno), packets[0]);
+  EXPECT_EQ(tx_tracking_->GetIdlePacket(seqno + 1), packets[1]);
+  // Past the budget.
+  EXPECT_EQ(tx_tracking_->GetIdlePacket(seqno + 2), nullptr);
+
+  // Acknowledged packets go back to the pool.
+  const auto avail = pkt_pool_->AvailPacketsCount();
+  tx_tracking_->ReleasePackets(seqno, 1);
+  EXPECT_EQ(budget.held(), 1);
+  EXPECT_EQ(tx_tracking_->GetIdlePacket(seqno), nullptr);
+  EXPECT_EQ(pkt_pool_->AvailPacketsCount(), avail + 1);
+
+  // As do all of them, without a budget.
+  tx_tracking_->set_rexmit_budget(nullptr);
+  EXPECT_EQ(budget.held(), 0);
+  EXPECT_EQ(tx_tracking_->NumHeldPackets(), 0);
+  EXPECT_EQ(pkt_pool_->AvailPacketsCount(), avail + 2);
+  auto *packet = CHECK_NOTNULL(pkt_pool_->PacketAlloc());
+  tx_tracking_->HoldPacket(seqno, packet);
+  EXPECT_EQ(tx_tracking_->NumHeldPackets(), 0);
+  dpdk::Packet::Free(packet);
+}
+
+TEST_F(FlowTest, TXQueue_Compact) {
+  // Transmit times are allocated on the first transmission, and released
+  // with no packets in flight.
+  EXPECT_EQ(tx_tracking_->GetMemoryUsage(), 0);
+  tx_tracking_->SetSendTimeNs(1, 1000);
+  EXPECT_EQ(tx_tracking_->GetSendTimeNs(1), 1000);
+  EXPECT_GT(tx_tracking_->GetMemoryUsage(), 0);
+  tx_tracking_->Compact();
+  EXPECT_EQ(tx_tracking_->GetMemoryUsage(), 0);
+  EXPECT_EQ(tx_tracking_->GetSendTimeNs(1), 0);
+}
+
+TEST_F(FlowTest, PacketPool_Watermark) {
+  // The fewest packets sampled available, and the allocations that failed.
+  const uint32_t avail = pkt_pool_->AvailPacketsCount();
+  EXPECT_EQ(pkt_pool_->GetMinAvailPacketsCount(), pkt_pool_->Capacity());
+  std::vector<dpdk::Packet *> packets(avail);
+  ASSERT_TRUE(pkt_pool_->PacketBulkAlloc(packets.data(), avail));
+  EXPECT_EQ(pkt_pool_->GetAllocFailureCount(), 0);
+  pkt_pool_->SampleWatermark();
+  EXPECT_EQ(pkt_pool_->PacketAlloc(), nullptr);
+  dpdk::Packet *packet;
+  EXPECT_FALSE(pkt_pool_->PacketBulkAlloc(&packet, 1));
+  EXPECT_EQ(pkt_pool_->GetAllocFailureCount(), 2);
+
+  for (auto *p : packets) dpdk::Packet::Free(p);
+  pkt_pool_->SampleWatermark();
+  EXPECT_EQ(pkt_pool_->AvailPacketsCount(), avail);
+  EXPECT_EQ(pkt_pool_->GetMinAvailPacketsCount(), 0);
+}
+
 TEST_F(FlowTest, RXQueue_Push) {
   std::mt19937 engine(rng_);
   std::uniform_int_distribution<std::mt19937::result_type> dist(
@@ -298,7 +524,7 @@ TEST_F(FlowTest, RXQueue_Push) {
       EXPECT_EQ(channel_->GetFreeBufCount(),
                 channel_->GetTotalBufCount() - buffers_used);
       // All packets are in order so the reassembly queue should be empty.
-      EXPECT_TRUE(rx_tracking_->reass_q_.empty());
+      EXPECT_EQ(rx_tracking_->NumBuffered(), 0);
       EXPECT_EQ(rx_pcb.get_rcv_nxt(), prev_rcv_nxt + 1);
     }
 
@@ -335,7 +561,7 @@ TEST_F(FlowTest, RXQueue_Push_OutOfOrder1) {
   // can test for out-of-order.
   std::uniform_int_distribution<> dist(
       2 * packet_payload_size,
-      RXTracking::kReassemblyMaxSeqnoDistance * packet_payload_size);
+      net::MachnetPktHdr::kSackBitmapBits * packet_payload_size);
 
   const size_t kNumTries = 1000;
   for (size_t i = 0; i < kNumTries; i++) {
@@ -365,20 +591,27 @@ TEST_F(FlowTest, RXQueue_Push_OutOfOrder1) {
                 channel_->GetTotalBufCount() - buffers_used);
       // All packets are in order so the reassembly queue should be empty.
       if (pkt == packets.back()) {
-        EXPECT_TRUE(rx_tracking_->reass_q_.empty());
+        EXPECT_EQ(rx_tracking_->NumBuffered(), 0);
         // `rcv_nxt` should now be updated; the last packet fills the final gap.
         EXPECT_EQ(prev_rcv_nxt + buffers_used, rx_pcb.get_rcv_nxt());
         // The message should have now been delivered to the application, and
         // the reassembly queue should be empty.
-        EXPECT_TRUE(rx_tracking_->reass_q_.empty());
+        EXPECT_EQ(rx_tracking_->NumBuffered(), 0);
         EXPECT_EQ(rx_pcb.sack_bitmap_count, 0);
       } else {
         // All packets are pushed to the rassembly queue out-of-order.
-        EXPECT_FALSE(rx_tracking_->reass_q_.empty());
+        EXPECT_NE(rx_tracking_->NumBuffered(), 0);
         // rcv_nxt should not be updated.
         EXPECT_EQ(prev_rcv_nxt, rx_pcb.get_rcv_nxt());
         // The reassembly queue size should increase with each packet pushed.
         EXPECT_EQ(rx_pcb.sack_bitmap_count, buffers_used);
+        // Every buffered packet is reported in the SACK bitmap.
+        net::MachnetPktHdr machneth;
+        rx_tracking_->FillSackBitmap(&rx_pcb, &machneth);
+        size_t sacked = 0;
+        for (size_t w = 0; w < net::MachnetPktHdr::kSackBitmapWords; w++)
+          sacked += __builtin_popcountll(machneth.sack_bitmap[w].value());
+        EXPECT_EQ(sacked, buffers_used);
       }
     }
 
@@ -404,6 +637,52 @@ TEST_F(FlowTest, RXQueue_Push_OutOfOrder1) {
   }
 }
 
+TEST_F(FlowTest, RXQueue_Compact) {
+  // The reassembly buffer is only allocated once a packet arrives out of
+  // order, and released once it holds no packets again.
+  constexpr auto packet_hdr_size = sizeof(net::Ethernet) + sizeof(net::Ipv4) +
+                                   sizeof(net::Udp) +
+                                   sizeof(net::MachnetPktHdr);
+  const auto packet_payload_size =
+      dpdk::PmdRing::kDefaultFrameSize - packet_hdr_size;
+  std::vector<uint8_t> tx_message(4 * packet_payload_size);
+  std::generate(tx_message.begin(), tx_message.end(), std::rand);
+  swift::Pcb tx_pcb;
+  auto packets(CreatePacketTrain(&tx_pcb, tx_message));
+  ASSERT_GE(packets.size(), 3);
+
+  swift::Pcb rx_pcb;
+  rx_tracking_->Add(&rx_pcb, packets[0]);
+  EXPECT_EQ(rx_tracking_->GetMemoryUsage(), 0);
+  rx_tracking_->Add(&rx_pcb, packets[2]);
+  EXPECT_EQ(rx_tracking_->NumBuffered(), 1);
+  EXPECT_GT(rx_tracking_->GetMemoryUsage(), 0);
+  // Not while it holds packets.
+  rx_tracking_->Compact();
+  EXPECT_GT(rx_tracking_->GetMemoryUsage(), 0);
+  rx_tracking_->Add(&rx_pcb, packets[1]);
+  for (size_t i = 3; i < packets.size(); i++) {
+    rx_tracking_->Add(&rx_pcb, packets[i]);
+  }
+  EXPECT_EQ(rx_tracking_->NumBuffered(), 0);
+  EXPECT_EQ(rx_pcb.get_rcv_nxt(), packets.size());
+  rx_tracking_->Compact();
+  EXPECT_EQ(rx_tracking_->GetMemoryUsage(), 0);
+
+  std::vector<uint8_t> rx_message(tx_message.size());
+  MachnetIovec_t rx_iov;
+  rx_iov.base = rx_message.data();
+  rx_iov.len = rx_message.size();
+  MachnetMsgHdr_t rx_msghdr;
+  rx_msghdr.flags = 0;
+  rx_msghdr.flow_info = {0, 0, 0, 0};
+  rx_msghdr.msg_iov = &rx_iov;
+  rx_msghdr.msg_iovlen = 1;
+  EXPECT_EQ(machnet_recvmsg(channel_->ctx(), &rx_msghdr), 1);
+  EXPECT_EQ(tx_message, rx_message);
+  for (auto &pkt : packets) dpdk::Packet::Free(pkt);
+}
+
 /**
  * @brief This is a test for the RX queue's Push() method with out-of-order
  * packets. It is similar to RXQueue_Push_OutOfOrder1, but more rigorous in that
@@ -434,7 +713,7 @@ TEST_F(FlowTest, RXQueue_Push_OutOfOrder2) {
     std::unordered_set<size_t> indices;
     while (index < packets.size()) {
       std::uniform_int_distribution<size_t> dist(
-          2, juggler::net::flow::RXTracking::kReassemblyMaxSeqnoDistance);
+          2, net::MachnetPktHdr::kSackBitmapBits);
 
       auto ooo_batch_size = std::min(dist(rng_), packets.size() - index);
       std::shuffle(packets.begin() + index,
@@ -456,18 +735,18 @@ TEST_F(FlowTest, RXQueue_Push_OutOfOrder2) {
                 channel_->GetTotalBufCount() - buffers_used);
       if (pkt == packets.back()) {
         // For the last packet, the reassembly queue should be empty.
-        EXPECT_TRUE(rx_tracking_->reass_q_.empty());
+        EXPECT_EQ(rx_tracking_->NumBuffered(), 0);
         // rcv_nxt should now be updated; the last packet fills the final gap.
         EXPECT_EQ(prev_rcv_nxt + buffers_used, rx_pcb.get_rcv_nxt());
         // The message should have now been delivered to the application, and
         // the reassembly queue should be empty.
-        EXPECT_TRUE(rx_tracking_->reass_q_.empty());
+        EXPECT_EQ(rx_tracking_->NumBuffered(), 0);
         EXPECT_EQ(rx_pcb.sack_bitmap_count, 0);
       } else {
         if (indices.find(buffers_used) != indices.end()) {
           // For the last packet in an out-of-order batch, the reassembly queue
           // should be flushed, and `rcv_nxt` should be updated.
-          EXPECT_TRUE(rx_tracking_->reass_q_.empty());
+          EXPECT_EQ(rx_tracking_->NumBuffered(), 0);
           // `rcv_nxt` should be updated here.
           EXPECT_EQ(prev_rcv_nxt + buffers_used, rx_pcb.get_rcv_nxt());
           EXPECT_EQ(rx_pcb.sack_bitmap_count, 0);
@@ -503,6 +782,242 @@ TEST_F(FlowTest, RXQueue_Push_OutOfOrder2) {
   }
 }
 
+/**
+ * @brief With unordered delivery, complete messages are delivered even while
+ * an earlier message misses a packet, and the missing packet then completes
+ * (only) its own message. `rcv_nxt' still advances packet by packet.
+ */
+TEST_F(FlowTest, RXQueue_Push_Unordered) {
+  constexpr auto packet_hdr_size = sizeof(net::Ethernet) + sizeof(net::Ipv4) +
+                                   sizeof(net::Udp) +
+                                   sizeof(net::MachnetPktHdr);
+  const auto packet_payload_size =
+      dpdk::PmdRing::kDefaultFrameSize - packet_hdr_size;
+  channel_->SetUnorderedDelivery(true);
+  RXTracking rx_tracking(local_addr_.address.value(), local_port_.port.value(),
+                         remote_addr_.address.value(),
+                         remote_port_.port.value(), channel_.get());
+
+  // Three messages, of 3, 1 and 2 packets, sent back to back.
+  std::vector<std::vector<uint8_t>> tx_messages = {
+      std::vector<uint8_t>(3 * packet_payload_size - 10),
+      std::vector<uint8_t>(100), std::vector<uint8_t>(packet_payload_size + 1)};
+  swift::Pcb tx_pcb;
+  std::vector<dpdk::Packet *> packets;
+  for (auto &message : tx_messages) {
+    std::generate(message.begin(), message.end(), std::rand);
+    const auto train = CreatePacketTrain(&tx_pcb, message);
+    packets.insert(packets.end(), train.begin(), train.end());
+  }
+  ASSERT_EQ(packets.size(), 6);
+
+  auto recv = [this]() {
+    std::vector<uint8_t> rx_message(MACHNET_MSG_MAX_LEN);
+    MachnetIovec_t rx_iov;
+    rx_iov.base = rx_message.data();
+    rx_iov.len = rx_message.size();
+    MachnetMsgHdr_t rx_msghdr;
+    rx_msghdr.flags = 0;
+    rx_msghdr.flow_info = {0, 0, 0, 0};
+    rx_msghdr.msg_iov = &rx_iov;
+    rx_msghdr.msg_iovlen = 1;
+    // No message pending: return an empty one.
+    const auto ret = machnet_recvmsg(channel_->ctx(), &rx_msghdr);
+    rx_message.resize(ret == 1 ? rx_msghdr.msg_size : 0);
+    return rx_message;
+  };
+
+  // Lose the first packet of the first message.
+  swift::Pcb rx_pcb;
+  const auto rcv_nxt = rx_pcb.get_rcv_nxt();
+  for (size_t i = 1; i < packets.size(); i++) {
+    rx_tracking.Add(&rx_pcb, packets[i]);
+  }
+  // Duplicates of delivered packets are dropped.
+  rx_tracking.Add(&rx_pcb, packets[3]);
+  EXPECT_EQ(rx_pcb.get_rcv_nxt(), rcv_nxt);
+  EXPECT_EQ(rx_tracking.NumBuffered(), 5);
+  EXPECT_EQ(rx_pcb.sack_bitmap_count, 5);
+  EXPECT_EQ(recv(), tx_messages[1]);
+  EXPECT_EQ(recv(), tx_messages[2]);
+  EXPECT_TRUE(recv().empty());
+
+  // The retransmission completes the first message.
+  rx_tracking.Add(&rx_pcb, packets[0]);
+  EXPECT_EQ(rx_pcb.get_rcv_nxt(), rcv_nxt + packets.size());
+  EXPECT_EQ(rx_tracking.NumBuffered(), 0);
+  EXPECT_EQ(rx_pcb.sack_bitmap_count, 0);
+  EXPECT_EQ(recv(), tx_messages[0]);
+  EXPECT_EQ(channel_->GetFreeBufCount(), channel_->GetTotalBufCount());
+
+  for (auto &pkt : packets) dpdk::Packet::Free(pkt);
+  channel_->SetUnorderedDelivery(false);
+}
+
+/**
+ * @brief With delivery in chunks, a long message is delivered every
+ * `kStreamChunkPackets' in-order packets, and only its first and last chunks
+ * are marked as such.
+ */
+TEST_F(FlowTest, RXQueue_Push_Stream) {
+  constexpr auto packet_hdr_size = sizeof(net::Ethernet) + sizeof(net::Ipv4) +
+                                   sizeof(net::Udp) +
+                                   sizeof(net::MachnetPktHdr);
+  const auto packet_payload_size =
+      dpdk::PmdRing::kDefaultFrameSize - packet_hdr_size;
+  const auto chunk_packets = RXTracking::kStreamChunkPackets;
+  channel_->SetStreamDelivery(true);
+  RXTracking rx_tracking(local_addr_.address.value(), local_port_.port.value(),
+                         remote_addr_.address.value(),
+                         remote_port_.port.value(), channel_.get());
+
+  std::vector<uint8_t> tx_message((2 * chunk_packets + 1) *
+                                      packet_payload_size -
+                                  10);
+  std::generate(tx_message.begin(), tx_message.end(), std::rand);
+  swift::Pcb tx_pcb;
+  const auto packets = CreatePacketTrain(&tx_pcb, tx_message);
+  ASSERT_EQ(packets.size(), 2 * chunk_packets + 1);
+
+  std::vector<uint8_t> rx_message;
+  auto recv = [this, &rx_message]() {
+    std::vector<uint8_t> rx_chunk(MACHNET_MSG_MAX_LEN);
+    MachnetIovec_t rx_iov = {.base = rx_chunk.data(), .len = rx_chunk.size()};
+    MachnetMsgHdr_t rx_msghdr = {.msg_iov = &rx_iov, .msg_iovlen = 1};
+    // No chunk pending.
+    if (machnet_recvmsg(channel_->ctx(), &rx_msghdr) != 1) return -1;
+    rx_message.insert(rx_message.end(), rx_chunk.begin(),
+                      rx_chunk.begin() + rx_msghdr.msg_size);
+    return static_cast<int>(rx_msghdr.flags);
+  };
+
+  swift::Pcb rx_pcb;
+  for (size_t i = 0; i < packets.size(); i++) {
+    rx_tracking.Add(&rx_pcb, packets[i]);
+    if (i + 1 == chunk_packets) {
+      EXPECT_EQ(recv(), MACHNET_MSGBUF_FLAGS_SYN);
+      EXPECT_EQ(rx_message.size(), chunk_packets * packet_payload_size);
+    } else if (i + 1 == 2 * chunk_packets) {
+      EXPECT_EQ(recv(), 0);
+    } else if (i + 1 == packets.size()) {
+      EXPECT_EQ(recv(), MACHNET_MSGBUF_FLAGS_FIN);
+    } else {
+      EXPECT_EQ(recv(), -1) << i;
+    }
+  }
+  EXPECT_EQ(rx_message, tx_message);
+  EXPECT_EQ(channel_->GetFreeBufCount(), channel_->GetTotalBufCount());
+
+  for (auto &pkt : packets) dpdk::Packet::Free(pkt);
+  channel_->SetStreamDelivery(false);
+}
+
+/**
+ * @brief Messages that find the ring to the application full are held back
+ * (instead of crashing the stack), and the advertised window closes until the
+ * application catches up.
+ */
+TEST_F(FlowTest, RXQueue_Push_RingFull) {
+  // The ring of the channel is its tightest limit.
+  const size_t ring_slots = rx_tracking_->AdvertisedWindow();
+  EXPECT_EQ(ring_slots, channel_->GetFreeMachnetRingSlots());
+  EXPECT_LE(ring_slots, kChannelRingSize);
+
+  swift::Pcb tx_pcb;
+  swift::Pcb rx_pcb;
+  const size_t nmessages = ring_slots + 44;
+  std::vector<dpdk::Packet *> packets;
+  for (size_t i = 0; i < nmessages; i++) {
+    std::vector<uint8_t> message(64, static_cast<uint8_t>(i));
+    const auto train = CreatePacketTrain(&tx_pcb, message);
+    ASSERT_EQ(train.size(), 1);
+    rx_tracking_->Add(&rx_pcb, train[0]);
+    packets.push_back(train[0]);
+  }
+  // All the packets are acknowledged, but only a ring's worth of messages is
+  // delivered.
+  EXPECT_EQ(rx_pcb.get_rcv_nxt(), nmessages);
+  EXPECT_EQ(rx_tracking_->NumUndelivered(), nmessages - ring_slots);
+  EXPECT_EQ(rx_tracking_->AdvertisedWindow(), 0);
+
+  auto recv = [this]() {
+    std::vector<uint8_t> rx_message(64);
+    MachnetIovec_t rx_iov;
+    rx_iov.base = rx_message.data();
+    rx_iov.len = rx_message.size();
+    MachnetMsgHdr_t rx_msghdr;
+    rx_msghdr.flags = 0;
+    rx_msghdr.flow_info = {0, 0, 0, 0};
+    rx_msghdr.msg_iov = &rx_iov;
+    rx_msghdr.msg_iovlen = 1;
+    EXPECT_EQ(machnet_recvmsg(channel_->ctx(), &rx_msghdr), 1);
+    return rx_message[0];
+  };
+  for (size_t i = 0; i < 100; i++) EXPECT_EQ(recv(), static_cast<uint8_t>(i));
+  EXPECT_EQ(rx_tracking_->FlushUndelivered(), 0);
+  EXPECT_EQ(rx_tracking_->AdvertisedWindow(), 100 - 44);
+  // The messages held back come next, in order.
+  for (size_t i = 100; i < nmessages; i++) {
+    EXPECT_EQ(recv(), static_cast<uint8_t>(i));
+  }
+  EXPECT_EQ(channel_->GetFreeBufCount(), channel_->GetTotalBufCount());
+
+  for (auto &pkt : packets) dpdk::Packet::Free(pkt);
+}
+
+TEST_F(FlowTest, Cipher_Handshake) {
+  if (!crypto::Supported()) GTEST_SKIP() << "No AES-NI on this CPU";
+  const crypto::Key psk = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                           0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+  auto other_psk = psk;
+  other_psk[0] ^= 1;
+
+  // Whether a packet sealed by `from' is authentic to `to'.
+  auto keys_match = [this](Cipher *from, const Cipher &to) {
+    auto *packet = CHECK_NOTNULL(pkt_pool_->PacketAlloc());
+    const std::vector<uint8_t> message(64, 0xab);
+    CHECK_NOTNULL(packet->append<uint8_t *>(
+        Cipher::kHeadersLen + message.size() + Cipher::kTrailerSize));
+    from->Seal({packet, message.data(), static_cast<uint32_t>(message.size())});
+    const bool authentic = to.Open(packet);
+    dpdk::Packet::Free(packet);
+    return authentic;
+  };
+
+  // The handshake, with a bit of the SYN or of the SYN-ACK flipped on the way
+  // (at `syn_bit' or `syn_ack_bit', if not negative). Returns whether the
+  // initiator accepts the SYN-ACK, and whether the keys of both ends match.
+  auto handshake = [&](int syn_bit, int syn_ack_bit,
+                       const crypto::Key &responder_psk) {
+    Cipher initiator(psk);
+    Cipher responder(responder_psk);
+    auto syn = initiator.local_nonce();
+    if (syn_bit >= 0) syn[syn_bit / 8] ^= 1 << (syn_bit % 8);
+    responder.Establish(syn.data(), false);
+
+    std::array<uint8_t, Cipher::kSynAckPayloadSize> syn_ack;
+    std::memcpy(syn_ack.data(), responder.local_nonce().data(),
+                Cipher::kNonceSize);
+    const auto mac = responder.SynAckMac();
+    std::memcpy(syn_ack.data() + Cipher::kNonceSize, mac.data(),
+                Cipher::kMacSize);
+    if (syn_ack_bit >= 0) syn_ack[syn_ack_bit / 8] ^= 1 << (syn_ack_bit % 8);
+    initiator.Establish(syn_ack.data(), true);
+    const bool accepted =
+        initiator.VerifySynAckMac(syn_ack.data() + Cipher::kNonceSize);
+    return std::make_pair(accepted, keys_match(&initiator, responder));
+  };
+
+  EXPECT_EQ(handshake(-1, -1, psk), std::make_pair(true, true));
+  // A tampered nonce leaves the two ends with different keys: the initiator
+  // must not establish the flow.
+  EXPECT_EQ(handshake(0, -1, psk), std::make_pair(false, false));
+  EXPECT_EQ(handshake(127, -1, psk), std::make_pair(false, false));
+  EXPECT_EQ(handshake(-1, 5, psk), std::make_pair(false, false));
+  EXPECT_EQ(handshake(-1, 8 * Cipher::kNonceSize + 3, psk).first, false);
+  EXPECT_EQ(handshake(-1, -1, other_psk).first, false);
+}
+
 }  // namespace flow
 }  // namespace net
 }  // namespace juggler
@@ -0,0 +1,75 @@
+/**
+ * @file idle_policy_test.cc
+ *
+ * Unit tests for the IdlePolicy class.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <idle_policy.h>
+
+namespace juggler {
+
+TEST(IdlePolicyTest, BacksOffAndResumes) {
+  IdlePolicy policy(true, 2, 3, 4);
+  EXPECT_EQ(policy.OnIdle(), IdlePolicy::kPoll);
+  EXPECT_EQ(policy.OnIdle(), IdlePolicy::kPoll);
+  EXPECT_FALSE(policy.idling());
+  for (int i = 0; i < 3; i++) EXPECT_EQ(policy.OnIdle(), IdlePolicy::kPause);
+  EXPECT_TRUE(policy.idling());
+  for (int i = 0; i < 4; i++) EXPECT_EQ(policy.OnIdle(), IdlePolicy::kWait);
+  EXPECT_EQ(policy.OnIdle(), IdlePolicy::kSleep);
+  EXPECT_EQ(policy.OnIdle(), IdlePolicy::kSleep);
+
+  // Work resumes: back to polling.
+  policy.OnBusy();
+  EXPECT_FALSE(policy.idling());
+  EXPECT_EQ(policy.OnIdle(), IdlePolicy::kPoll);
+
+  // Without sleeping, the engine keeps waiting.
+  IdlePolicy no_sleep(false, 0, 0, 1);
+  for (int i = 0; i < 10; i++) EXPECT_EQ(no_sleep.OnIdle(), IdlePolicy::kWait);
+}
+
+TEST(IdlePolicyTest, PauseBurst) {
+  IdlePolicy policy(false, 0, 1 << 20, 0);
+  policy.OnIdle();
+  EXPECT_EQ(policy.PauseBurst(), 1);
+  for (uint32_t i = 0; i < IdlePolicy::kPauseBurstStep; i++) policy.OnIdle();
+  EXPECT_EQ(policy.PauseBurst(), 2);
+  for (uint32_t i = 0; i < 100 * IdlePolicy::kPauseBurstStep; i++) {
+    policy.OnIdle();
+  }
+  EXPECT_EQ(policy.PauseBurst(), IdlePolicy::kMaxPauseBurst);
+}
+
+TEST(IdlePolicyTest, WakeupStats) {
+  IdlePolicy policy(true, 0, 0, 1);
+  EXPECT_EQ(policy.OnIdle(), IdlePolicy::kWait);
+  policy.OnWait(IdlePolicy::kWait, 100);
+  policy.OnBusy();
+  EXPECT_EQ(policy.OnIdle(), IdlePolicy::kWait);
+  policy.OnWait(IdlePolicy::kWait, 300);
+  EXPECT_EQ(policy.OnIdle(), IdlePolicy::kSleep);
+  policy.OnWait(IdlePolicy::kSleep, 5000);
+  policy.OnBusy();
+  // A busy iteration right after another does not count as a wakeup.
+  policy.OnBusy();
+
+  const auto &wait = policy.stats(IdlePolicy::kWait);
+  EXPECT_EQ(wait.wakeups, 1);
+  EXPECT_EQ(wait.wait_cycles, 100);
+  const auto &sleep = policy.stats(IdlePolicy::kSleep);
+  EXPECT_EQ(sleep.wakeups, 1);
+  EXPECT_EQ(sleep.max_wait_cycles, 5000);
+
+  policy.ResetStats();
+  EXPECT_EQ(policy.stats(IdlePolicy::kWait).wakeups, 0);
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,197 @@
+/**
+ * @file kernels_bench.cc
+ *
+ * Benchmarks of the SIMD kernels (see `kernels.h') against the plain
+ * implementations they replace: `std::memcpy()', the 16-bit checksum loop, and
+ * XXH64 for flow keys.
+ */
+#include <benchmark/benchmark.h>
+#include <flow_key.h>
+#include <kernels.h>
+#include <utils.h>
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+using juggler::utils::kernels::GetKernels;
+using juggler::utils::kernels::Isa;
+
+static constexpr size_t kPoolSize = 1 << 26;
+
+// The checksum loop used before the kernels.
+static uint16_t ScalarChecksum16(const uint8_t *data, size_t length) {
+  uint32_t sum = 0;
+  const uint16_t *ptr = reinterpret_cast<const uint16_t *>(data);
+  for (; length > 1; length -= 2) sum += *ptr++;
+  if (length == 1) {
+    sum += static_cast<uint16_t>(*reinterpret_cast<const uint8_t *>(ptr) << 8);
+  }
+  while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+  return static_cast<uint16_t>(~sum);
+}
+
+static bool SkipUnsupported(benchmark::State &state, Isa isa) {
+  if (isa <= juggler::utils::kernels::DetectIsa()) return false;
+  state.SkipWithError("Instruction set not supported by this CPU.");
+  return true;
+}
+
+static void SetBytes(benchmark::State &state, size_t nbytes) {
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * nbytes);
+}
+
+static void BM_Memcpy(benchmark::State &state) {  // NOLINT
+  const size_t len = state.range(0);
+  std::vector<uint8_t> src(len, 'a'), dst(len);
+  for (auto _ : state) {
+    std::memcpy(dst.data(), src.data(), len);
+    benchmark::ClobberMemory();
+  }
+  SetBytes(state, len);
+}
+BENCHMARK(BM_Memcpy)->RangeMultiplier(2)->Range(8, 1024);
+
+static void BM_UtilsCopy(benchmark::State &state) {  // NOLINT
+  const size_t len = state.range(0);
+  std::vector<uint8_t> src(len, 'a'), dst(len);
+  for (auto _ : state) {
+    juggler::utils::Copy(dst.data(), src.data(), len);
+    benchmark::ClobberMemory();
+  }
+  SetBytes(state, len);
+}
+BENCHMARK(BM_UtilsCopy)->RangeMultiplier(2)->Range(8, 1024);
+
+// Copies of random sizes, up to that of small messages, which defeat the branch
+// predictor of the size dispatch.
+template <typename F>
+static void CopyRandomSizes(benchmark::State &state, F &&copy) {
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<size_t> dist(1, 128);
+  std::vector<size_t> sizes(4096);
+  size_t total = 0;
+  for (auto &size : sizes) total += size = dist(rng);
+  std::vector<uint8_t> src(128, 'a'), dst(128);
+  for (auto _ : state) {
+    for (auto size : sizes) copy(dst.data(), src.data(), size);
+    benchmark::ClobberMemory();
+  }
+  SetBytes(state, total);
+}
+
+static void BM_MemcpyRandomSizes(benchmark::State &state) {  // NOLINT
+  CopyRandomSizes(state, [](void *d, const void *s, size_t n) {
+    std::memcpy(d, s, n);
+  });
+}
+BENCHMARK(BM_MemcpyRandomSizes);
+
+static void BM_UtilsCopyRandomSizes(benchmark::State &state) {  // NOLINT
+  CopyRandomSizes(state, [](void *d, const void *s, size_t n) {
+    juggler::utils::Copy(d, s, n);
+  });
+}
+BENCHMARK(BM_UtilsCopyRandomSizes);
+
+// Copies of payloads into a pool of buffers much larger than the caches (as
+// the buffers of a channel), regular or non-temporal, each followed by random
+// reads of a working set of the given size (as the engine's own state). The
+// regular stores evict that working set from the caches.
+template <typename F>
+static void CopyToPool(benchmark::State &state, F &&copy) {
+  const size_t len = state.range(0);
+  const size_t nbufs = kPoolSize / len;
+  std::vector<uint8_t> src(len, 'a'), pool(nbufs * len);
+  std::vector<uint64_t> working_set(state.range(1) / sizeof(uint64_t), 1);
+  std::mt19937 rng(42);
+  std::vector<uint32_t> reads(512);
+  for (auto &read : reads) read = rng() % working_set.size();
+  size_t index = 0;
+  uint64_t sum = 0;
+  for (auto _ : state) {
+    copy(&pool[index * len], src.data(), len);
+    if (++index == nbufs) index = 0;
+    for (auto read : reads) sum += working_set[read];
+  }
+  benchmark::DoNotOptimize(sum);
+  SetBytes(state, len);
+}
+
+static void BM_MemcpyToPool(benchmark::State &state) {  // NOLINT
+  CopyToPool(state, [](void *d, const void *s, size_t n) {
+    std::memcpy(d, s, n);
+  });
+}
+BENCHMARK(BM_MemcpyToPool)
+    ->ArgsProduct({{1500, 4096, 9000}, {256 << 10, 1 << 20, 2 << 20}});
+
+static void BM_NonTemporalCopyToPool(benchmark::State &state) {  // NOLINT
+  const auto isa = static_cast<Isa>(state.range(2));
+  if (SkipUnsupported(state, isa)) return;
+  const auto &kernels = GetKernels(isa);
+  CopyToPool(state, kernels.copy_nt);
+}
+BENCHMARK(BM_NonTemporalCopyToPool)
+    ->ArgsProduct(
+        {{1500, 4096, 9000}, {256 << 10, 1 << 20, 2 << 20}, {0, 1, 2}});
+
+static void BM_ScalarChecksum(benchmark::State &state) {  // NOLINT
+  const size_t len = state.range(0);
+  std::vector<uint8_t> data(len, 0xab);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ScalarChecksum16(data.data(), len));
+  }
+  SetBytes(state, len);
+}
+BENCHMARK(BM_ScalarChecksum)->Arg(20)->Arg(64)->Arg(1500)->Arg(9000);
+
+static void BM_Checksum(benchmark::State &state) {  // NOLINT
+  const auto isa = static_cast<Isa>(state.range(1));
+  if (SkipUnsupported(state, isa)) return;
+  const auto &kernels = GetKernels(isa);
+  const size_t len = state.range(0);
+  std::vector<uint8_t> data(len, 0xab);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(kernels.checksum(data.data(), len));
+  }
+  SetBytes(state, len);
+}
+BENCHMARK(BM_Checksum)->ArgsProduct({{20, 64, 1500, 9000}, {0, 1, 2}});
+
+static std::vector<juggler::net::flow::Key> RandomKeys() {
+  std::mt19937 rng(42);
+  std::vector<juggler::net::flow::Key> keys;
+  for (int i = 0; i < 1024; i++) {
+    keys.emplace_back(static_cast<uint32_t>(rng()),
+                      static_cast<uint16_t>(rng()),
+                      static_cast<uint32_t>(rng()),
+                      static_cast<uint16_t>(rng()));
+  }
+  return keys;
+}
+
+static void BM_FlowKeyXXH64(benchmark::State &state) {  // NOLINT
+  const auto keys = RandomKeys();
+  for (auto _ : state) {
+    for (const auto &key : keys) {
+      benchmark::DoNotOptimize(juggler::utils::hash<uint64_t>(
+          reinterpret_cast<const char *>(&key), sizeof(key)));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_FlowKeyXXH64);
+
+static void BM_FlowKeyCrc32c(benchmark::State &state) {  // NOLINT
+  const auto keys = RandomKeys();
+  for (auto _ : state) {
+    for (const auto &key : keys) {
+      benchmark::DoNotOptimize(std::hash<juggler::net::flow::Key>{}(key));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_FlowKeyCrc32c);
+
+BENCHMARK_MAIN();
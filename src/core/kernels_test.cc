@@ -0,0 +1,148 @@
+/**
+ * @file kernels_test.cc
+ *
+ * Unit tests for the SIMD kernels (copies, checksums and hashes), checked
+ * against plain implementations for every instruction set of this CPU.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <kernels.h>
+#include <utils.h>
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace juggler {
+namespace utils {
+namespace kernels {
+
+// The checksum as computed before the kernels, one 16-bit word at a time.
+static uint16_t ReferenceChecksum(const uint8_t *data, size_t length) {
+  uint32_t sum = 0;
+  for (; length > 1; length -= 2, data += 2) {
+    uint16_t word;
+    std::memcpy(&word, data, sizeof(word));
+    sum += word;
+  }
+  if (length == 1) sum += static_cast<uint16_t>(*data << 8);
+  while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+  return static_cast<uint16_t>(~sum);
+}
+
+class KernelsIsaTest : public ::testing::TestWithParam<Isa> {
+ protected:
+  void SetUp() override {
+    if (GetParam() > DetectIsa()) {
+      GTEST_SKIP() << IsaName(GetParam()) << " is not supported by this CPU";
+    }
+    std::mt19937 rng(42);
+    src_.resize(kBufferSize);
+    for (auto &byte : src_) byte = rng();
+  }
+
+  static constexpr size_t kBufferSize = 10000;
+  std::vector<uint8_t> src_;
+};
+
+TEST_P(KernelsIsaTest, CopyNonTemporal) {
+  const auto &kernels = GetKernels(GetParam());
+  EXPECT_EQ(kernels.isa, GetParam());
+  for (size_t len : {256, 257, 300, 1023, 1500, 4096, 8999, 9000}) {
+    for (size_t offset : {0, 5, 64}) {
+      std::vector<uint8_t> dst(len + 2 * 64, 0);
+      kernels.copy_nt(&dst[offset + 1], &src_[offset], len);
+      ASSERT_EQ(std::memcmp(&dst[offset + 1], &src_[offset], len), 0)
+          << "len " << len << ", offset " << offset;
+      EXPECT_EQ(dst[offset], 0);
+      EXPECT_EQ(dst[offset + 1 + len], 0);
+    }
+  }
+}
+
+TEST_P(KernelsIsaTest, Checksum) {
+  const auto &kernels = GetKernels(GetParam());
+  for (size_t len = 0; len <= 1100; len++) {
+    for (size_t offset : {0, 1, 2}) {
+      ASSERT_EQ(kernels.checksum(&src_[offset], len),
+                ReferenceChecksum(&src_[offset], len))
+          << "len " << len << ", offset " << offset;
+    }
+  }
+  // Sums that carry across many words still fold the same way.
+  std::vector<uint8_t> ones(kBufferSize, 0xff);
+  EXPECT_EQ(kernels.checksum(ones.data(), ones.size()),
+            ReferenceChecksum(ones.data(), ones.size()));
+  std::vector<uint8_t> zeros(kBufferSize, 0);
+  EXPECT_EQ(kernels.checksum(zeros.data(), zeros.size()), 0xffff);
+}
+
+static std::string IsaTestName(const ::testing::TestParamInfo<Isa> &info) {
+  static constexpr const char *kNames[] = {"Sse42", "Avx2", "Avx512"};
+  return kNames[static_cast<int>(info.param)];
+}
+
+INSTANTIATE_TEST_SUITE_P(Isas, KernelsIsaTest,
+                         ::testing::Values(Isa::kSse42, Isa::kAvx2,
+                                           Isa::kAvx512),
+                         IsaTestName);
+
+TEST(KernelsTest, CopySmall) {
+  std::vector<uint8_t> src(64);
+  for (size_t i = 0; i < src.size(); i++) src[i] = i + 1;
+  for (size_t len = 0; len <= 64; len++) {
+    std::vector<uint8_t> dst(64 + 2, 0);
+    CopySmall(&dst[1], src.data(), len);
+    EXPECT_EQ(std::memcmp(&dst[1], src.data(), len), 0) << "len " << len;
+    EXPECT_EQ(dst[0], 0);
+    EXPECT_EQ(dst[1 + len], 0);
+  }
+}
+
+TEST(KernelsTest, IPv4HeaderChecksum) {
+  // An IPv4 header (RFC 1071 style example), checksum field zeroed.
+  uint8_t header[] = {0x45, 0x00, 0x00, 0x73, 0x00, 0x00, 0x40,
+                      0x00, 0x40, 0x11, 0x00, 0x00, 0xc0, 0xa8,
+                      0x00, 0x01, 0xc0, 0xa8, 0x00, 0xc7};
+  const uint16_t cksum = ComputeChecksum16(header, sizeof(header));
+  std::memcpy(&header[10], &cksum, sizeof(cksum));
+  EXPECT_EQ(header[10], 0xb8);
+  EXPECT_EQ(header[11], 0x61);
+  // A header with a valid checksum sums up to zero.
+  EXPECT_EQ(ComputeChecksum16(header, sizeof(header)), 0);
+}
+
+TEST(KernelsTest, Crc32c) {
+  // The standard check value of CRC32C.
+  const char data[] = "123456789";
+  EXPECT_EQ(Crc32c(data, 9, 0xffffffff) ^ 0xffffffff, 0xe3069283);
+  // Every length goes through the same CRC, whatever the instruction widths.
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 0; i < 9; i++) crc = Crc32c(&data[i], 1, crc);
+  EXPECT_EQ(crc, Crc32c(data, 9, 0xffffffff));
+}
+
+TEST(KernelsTest, UtilsCopy) {
+  std::vector<uint8_t> src(4096);
+  for (size_t i = 0; i < src.size(); i++) src[i] = i * 7;
+  for (size_t len : {0, 1, 15, 64, 65, 200, 1024, 1025, 4096}) {
+    std::vector<uint8_t> dst(src.size(), 0);
+    Copy(dst.data(), src.data(), len);
+    EXPECT_EQ(std::memcmp(dst.data(), src.data(), len), 0) << "len " << len;
+    std::vector<uint8_t> nt_dst(src.size(), 0);
+    CopyNonTemporal(nt_dst.data(), src.data(), len);
+    EXPECT_EQ(std::memcmp(nt_dst.data(), src.data(), len), 0) << "len " << len;
+  }
+}
+
+}  // namespace kernels
+}  // namespace utils
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
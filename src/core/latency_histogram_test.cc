@@ -0,0 +1,45 @@
+/**
+ * @file latency_histogram_test.cc
+ *
+ * Unit tests for the LatencyHistogram class.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <latency_histogram.h>
+
+namespace juggler {
+
+TEST(LatencyHistogramTest, Summary) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.GetSummary().count, 0);
+
+  // Values below 2048 are recorded exactly, with 3 significant digits.
+  for (uint64_t v = 1; v <= 1000; v++) histogram.Record(v);
+  const auto summary = histogram.GetSummary();
+  EXPECT_EQ(summary.count, 1000);
+  EXPECT_EQ(summary.min_ns, 1);
+  EXPECT_EQ(summary.p50_ns, 500);
+  EXPECT_EQ(summary.p99_ns, 990);
+  EXPECT_EQ(summary.p999_ns, 999);
+  EXPECT_EQ(summary.max_ns, 1000);
+
+  histogram.Reset();
+  EXPECT_EQ(histogram.GetCount(), 0);
+}
+
+TEST(LatencyHistogramTest, OutOfRange) {
+  LatencyHistogram histogram;
+  histogram.Record(2 * LatencyHistogram::kMaxValueNs);
+  EXPECT_EQ(histogram.GetCount(), 1);
+  const auto max_ns = histogram.GetSummary().max_ns;
+  EXPECT_GE(max_ns, LatencyHistogram::kMaxValueNs);
+  EXPECT_LE(max_ns, LatencyHistogram::kMaxValueNs * 1.001);
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
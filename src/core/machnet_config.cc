@@ -1,15 +1,32 @@
 #include "machnet_config.h"
 
 #include <algorithm>
+#include <cctype>
 #include <filesystem>
 #include <ranges>
 #include <string>
 
 #include "dpdk.h"
 #include "ether.h"
+#include "multipath.h"
+#include "capture_ring.h"
 
 namespace juggler {
 
+// Parse a key given as hex digits.
+static std::optional<crypto::Key> ParseKey(const std::string &hex) {
+  crypto::Key key;
+  if (hex.size() != 2 * key.size()) return std::nullopt;
+  for (size_t i = 0; i < key.size(); i++) {
+    const auto digits = hex.substr(2 * i, 2);
+    if (!std::isxdigit(digits[0]) || !std::isxdigit(digits[1])) {
+      return std::nullopt;
+    }
+    key[i] = static_cast<uint8_t>(std::stoi(digits, nullptr, 16));
+  }
+  return key;
+}
+
 static std::optional<std::string> GetPCIeAddressSysfs(
     const juggler::net::Ethernet::Address &l2_addr) {
   // Note: This works on Azure even after we unbind the NIC (e.g., `eth1`)
@@ -84,7 +101,21 @@ void MachnetConfigProcessor::AssertJsonValidMachnetConfig() {
     }
     for (const auto &[key, _] : interface.items()) {
       if (key != "ip" && key != "engine_threads" && key != "cpu_mask" &&
-          key != "pcie") {
+          key != "pcie" && key != "rx_pipeline" && key != "ack_every" &&
+          key != "rx_zerocopy" && key != "tx_zerocopy" &&
+          key != "tx_zerocopy_threshold" && key != "tx_scheduler" &&
+          key != "tx_budget" && key != "tx_quantum" &&
+          key != "flow_steering" && key != "rebalance_interval_ms" &&
+          key != "idle_mode" && key != "cores" && key != "hw_timestamps" &&
+          key != "mtu" && key != "pacing" && key != "pacing_burst" &&
+          key != "paths" && key != "encryption_key" &&
+          key != "neighbors" && key != "trace_sample_every" &&
+          key != "capture_records" && key != "channel_pool" &&
+          key != "direct_queues" && key != "channel_arena" &&
+          key != "rexmit_packets" && key != "rx_descriptors" &&
+          key != "tx_descriptors" && key != "rx_mbufs" &&
+          key != "tx_mbufs" && key != "mbuf_data_room" &&
+          key != "ctrl_mbufs" && key != "slow_path") {
         LOG(FATAL) << "Invalid key " << key << " in " << interface << " in "
                    << config_json_filename_;
       }
@@ -101,10 +132,35 @@ void MachnetConfigProcessor::DiscoverInterfaceConfiguration() {
     net::Ipv4::Address ip_addr;
     CHECK(ip_addr.FromString(json_val.at("ip")));
 
+    std::vector<size_t> cores;
+    if (json_val.find("cores") != json_val.end()) {
+      const std::string cores_str = json_val.at("cores");
+      const auto cpus = utils::ParseCpuList(cores_str);
+      if (!cpus.has_value() || cpus.value().empty()) {
+        LOG(FATAL) << "Invalid cores " << cores_str << " for "
+                   << l2_addr.ToString() << " in " << config_json_filename_;
+      }
+      if (json_val.find("cpu_mask") != json_val.end()) {
+        LOG(FATAL) << "Both cores and cpu_mask given for "
+                   << l2_addr.ToString() << " in " << config_json_filename_;
+      }
+      cores = cpus.value();
+      LOG(INFO) << "Using cores " << cores_str << " for "
+                << l2_addr.ToString();
+    }
+
     if (json_val.find("engine_threads") != json_val.end()) {
       engine_threads = json_val.at("engine_threads");
       LOG(INFO) << "Using " << engine_threads << " engine threads for "
                 << l2_addr.ToString();
+      if (!cores.empty() && cores.size() < engine_threads) {
+        LOG(FATAL) << "Fewer cores than engine threads for "
+                   << l2_addr.ToString() << " in " << config_json_filename_;
+      }
+    } else if (!cores.empty()) {
+      engine_threads = cores.size();
+      LOG(INFO) << "Using " << engine_threads << " engine threads (one per "
+                << "core) for " << l2_addr.ToString();
     } else {
       LOG(INFO) << "Using default engine threads = " << engine_threads
                 << " for " << l2_addr.ToString();
@@ -121,6 +177,274 @@ void MachnetConfigProcessor::DiscoverInterfaceConfiguration() {
       LOG(INFO) << "Using default CPU mask for " << l2_addr.ToString();
     }
 
+    RxPipelineMode rx_pipeline_mode = RxPipelineMode::kSequential;
+    if (json_val.find("rx_pipeline") != json_val.end()) {
+      const std::string rx_pipeline_str = json_val.at("rx_pipeline");
+      if (rx_pipeline_str == "staged") {
+        rx_pipeline_mode = RxPipelineMode::kStaged;
+      } else if (rx_pipeline_str != "sequential") {
+        LOG(FATAL) << "Invalid rx_pipeline " << rx_pipeline_str << " for "
+                   << l2_addr.ToString() << " in " << config_json_filename_;
+      }
+      LOG(INFO) << "Using " << rx_pipeline_str << " RX pipeline for "
+                << l2_addr.ToString();
+    }
+
+    uint32_t ack_every = kDefaultAckEvery;
+    if (json_val.find("ack_every") != json_val.end()) {
+      ack_every = json_val.at("ack_every");
+      LOG(INFO) << "Using ACK coalescing factor " << ack_every << " for "
+                << l2_addr.ToString();
+    }
+
+    bool rx_zerocopy = false;
+    if (json_val.find("rx_zerocopy") != json_val.end()) {
+      rx_zerocopy = json_val.at("rx_zerocopy");
+      LOG(INFO) << "Zero-copy RX " << (rx_zerocopy ? "enabled" : "disabled")
+                << " for " << l2_addr.ToString();
+    }
+
+    bool tx_zerocopy = false;
+    if (json_val.find("tx_zerocopy") != json_val.end()) {
+      tx_zerocopy = json_val.at("tx_zerocopy");
+      LOG(INFO) << "Zero-copy TX " << (tx_zerocopy ? "enabled" : "disabled")
+                << " for " << l2_addr.ToString();
+    }
+
+    uint32_t tx_zerocopy_threshold = kDefaultTxZeroCopyThreshold;
+    if (json_val.find("tx_zerocopy_threshold") != json_val.end()) {
+      tx_zerocopy_threshold = json_val.at("tx_zerocopy_threshold");
+      LOG(INFO) << "Using zero-copy TX threshold " << tx_zerocopy_threshold
+                << " for " << l2_addr.ToString();
+    }
+
+    TxSchedulerMode tx_scheduler_mode = TxSchedulerMode::kRoundRobin;
+    if (json_val.find("tx_scheduler") != json_val.end()) {
+      const std::string tx_scheduler_str = json_val.at("tx_scheduler");
+      if (tx_scheduler_str == "drr") {
+        tx_scheduler_mode = TxSchedulerMode::kDrr;
+      } else if (tx_scheduler_str != "round_robin") {
+        LOG(FATAL) << "Invalid tx_scheduler " << tx_scheduler_str << " for "
+                   << l2_addr.ToString() << " in " << config_json_filename_;
+      }
+      LOG(INFO) << "Using " << tx_scheduler_str << " TX scheduler for "
+                << l2_addr.ToString();
+    }
+
+    uint32_t tx_budget = kDefaultTxBudget;
+    if (json_val.find("tx_budget") != json_val.end()) {
+      tx_budget = json_val.at("tx_budget");
+      LOG(INFO) << "Using TX budget " << tx_budget << " for "
+                << l2_addr.ToString();
+    }
+
+    uint32_t tx_quantum = kDefaultTxQuantum;
+    if (json_val.find("tx_quantum") != json_val.end()) {
+      tx_quantum = json_val.at("tx_quantum");
+      if (tx_quantum == 0) {
+        LOG(FATAL) << "Invalid tx_quantum 0 for " << l2_addr.ToString()
+                   << " in " << config_json_filename_;
+      }
+      LOG(INFO) << "Using TX quantum " << tx_quantum << " for "
+                << l2_addr.ToString();
+    }
+
+    bool flow_steering = false;
+    if (json_val.find("flow_steering") != json_val.end()) {
+      flow_steering = json_val.at("flow_steering");
+      LOG(INFO) << "Flow steering " << (flow_steering ? "enabled" : "disabled")
+                << " for " << l2_addr.ToString();
+    }
+
+    uint32_t rebalance_interval_ms = 0;
+    if (json_val.find("rebalance_interval_ms") != json_val.end()) {
+      rebalance_interval_ms = json_val.at("rebalance_interval_ms");
+      LOG(INFO) << "Rebalancing channels every " << rebalance_interval_ms
+                << " ms for " << l2_addr.ToString();
+    }
+
+    IdleMode idle_mode = IdleMode::kBusyPoll;
+    if (json_val.find("idle_mode") != json_val.end()) {
+      const std::string idle_mode_str = json_val.at("idle_mode");
+      if (idle_mode_str == "adaptive") {
+        idle_mode = IdleMode::kAdaptive;
+      } else if (idle_mode_str == "interrupt") {
+        idle_mode = IdleMode::kInterrupt;
+      } else if (idle_mode_str != "busy_poll") {
+        LOG(FATAL) << "Invalid idle_mode " << idle_mode_str << " for "
+                   << l2_addr.ToString() << " in " << config_json_filename_;
+      }
+      LOG(INFO) << "Using " << idle_mode_str << " idle mode for "
+                << l2_addr.ToString();
+    }
+
+    bool hw_timestamps = false;
+    if (json_val.find("hw_timestamps") != json_val.end()) {
+      hw_timestamps = json_val.at("hw_timestamps");
+      LOG(INFO) << "NIC RX timestamps "
+                << (hw_timestamps ? "enabled" : "disabled") << " for "
+                << l2_addr.ToString();
+    }
+
+    uint16_t mtu = kDefaultMtu;
+    if (json_val.find("mtu") != json_val.end()) {
+      const uint32_t mtu_val = json_val.at("mtu");
+      if (mtu_val < kMinMtu || mtu_val > kMaxMtu) {
+        LOG(FATAL) << "Invalid mtu " << mtu_val << " (must be in [" << kMinMtu
+                   << ", " << kMaxMtu << "]) for " << l2_addr.ToString()
+                   << " in " << config_json_filename_;
+      }
+      mtu = mtu_val;
+      LOG(INFO) << "Using MTU " << mtu << " for " << l2_addr.ToString();
+    }
+
+    bool pacing = false;
+    if (json_val.find("pacing") != json_val.end()) {
+      pacing = json_val.at("pacing");
+      LOG(INFO) << "Pacing " << (pacing ? "enabled" : "disabled") << " for "
+                << l2_addr.ToString();
+    }
+
+    uint32_t pacing_burst = kDefaultPacingBurst;
+    if (json_val.find("pacing_burst") != json_val.end()) {
+      pacing_burst = json_val.at("pacing_burst");
+      if (pacing_burst == 0) {
+        LOG(FATAL) << "Invalid pacing_burst 0 for " << l2_addr.ToString()
+                   << " in " << config_json_filename_;
+      }
+      LOG(INFO) << "Using pacing burst " << pacing_burst << " for "
+                << l2_addr.ToString();
+    }
+
+    uint8_t paths = 1;
+    if (json_val.find("paths") != json_val.end()) {
+      const uint32_t paths_val = json_val.at("paths");
+      if (paths_val == 0 || paths_val > net::flow::Multipath::kMaxPaths) {
+        LOG(FATAL) << "Invalid paths " << paths_val << " (must be in [1, "
+                   << static_cast<int>(net::flow::Multipath::kMaxPaths)
+                   << "]) for " << l2_addr.ToString() << " in "
+                   << config_json_filename_;
+      }
+      paths = paths_val;
+      LOG(INFO) << "Spreading flows over " << static_cast<int>(paths)
+                << " paths for " << l2_addr.ToString();
+    }
+
+    std::optional<crypto::Key> encryption_key;
+    if (json_val.find("encryption_key") != json_val.end()) {
+      const std::string hex = json_val.at("encryption_key");
+      encryption_key = ParseKey(hex);
+      if (!encryption_key.has_value()) {
+        LOG(FATAL) << "Invalid encryption_key for " << l2_addr.ToString()
+                   << " in " << config_json_filename_ << " (must be "
+                   << 2 * sizeof(crypto::Key) << " hex digits)";
+      }
+      if (!crypto::Supported()) {
+        LOG(FATAL) << "Encryption requires AES-NI and PCLMULQDQ, which this "
+                   << "CPU does not have";
+      }
+      LOG(INFO) << "Encrypting flows for " << l2_addr.ToString();
+    }
+
+    std::vector<net::Ipv4::Address> neighbors;
+    if (json_val.find("neighbors") != json_val.end()) {
+      for (const std::string neighbor : json_val.at("neighbors")) {
+        net::Ipv4::Address neighbor_addr;
+        if (!neighbor_addr.FromString(neighbor)) {
+          LOG(FATAL) << "Invalid neighbor " << neighbor << " for "
+                     << l2_addr.ToString() << " in " << config_json_filename_;
+        }
+        neighbors.push_back(neighbor_addr);
+      }
+      LOG(INFO) << "Resolving " << neighbors.size() << " neighbors ahead for "
+                << l2_addr.ToString();
+    }
+
+    uint32_t trace_sample_every = 0;
+    if (json_val.find("trace_sample_every") != json_val.end()) {
+      trace_sample_every = json_val.at("trace_sample_every");
+      LOG(INFO) << "Tracing one in every " << trace_sample_every
+                << " messages for " << l2_addr.ToString();
+    }
+
+    uint32_t capture_records = capture::kDefaultRecords;
+    if (json_val.find("capture_records") != json_val.end()) {
+      capture_records = json_val.at("capture_records");
+      if (capture_records != 0 && !utils::is_power_of_two(capture_records)) {
+        LOG(FATAL) << "capture_records must be a power of two for "
+                   << l2_addr.ToString() << " in " << config_json_filename_;
+      }
+    }
+
+    uint32_t channel_pool = 0;
+    if (json_val.find("channel_pool") != json_val.end()) {
+      channel_pool = json_val.at("channel_pool");
+      LOG(INFO) << "Keeping " << channel_pool << " warm channels for "
+                << l2_addr.ToString();
+    }
+
+    uint32_t direct_queues = 0;
+    if (json_val.find("direct_queues") != json_val.end()) {
+      direct_queues = json_val.at("direct_queues");
+      // The NIC delivers the flows of a direct queue by their UDP ports alone.
+      if (direct_queues > 0 && !flow_steering) {
+        LOG(FATAL) << "direct_queues needs flow_steering for "
+                   << l2_addr.ToString() << " in " << config_json_filename_;
+      }
+      LOG(INFO) << "Setting " << direct_queues << " direct queues aside for "
+                << l2_addr.ToString();
+    }
+
+    uint32_t channel_arena = 0;
+    if (json_val.find("channel_arena") != json_val.end()) {
+      channel_arena = json_val.at("channel_arena");
+      LOG(INFO) << "Sub-allocating up to " << channel_arena
+                << " channels from an arena for " << l2_addr.ToString();
+    }
+
+    uint32_t rexmit_packets = 0;
+    if (json_val.find("rexmit_packets") != json_val.end()) {
+      rexmit_packets = json_val.at("rexmit_packets");
+      LOG(INFO) << "Keeping up to " << rexmit_packets
+                << " packets per engine for retransmissions for "
+                << l2_addr.ToString();
+    }
+
+    // Sizes of the NIC queues and of their packet pools (0: the defaults).
+    uint16_t rx_descriptors = 0, tx_descriptors = 0, mbuf_data_room = 0;
+    uint32_t rx_mbufs = 0, tx_mbufs = 0, ctrl_mbufs = 0;
+    if (json_val.find("rx_descriptors") != json_val.end()) {
+      rx_descriptors = json_val.at("rx_descriptors");
+    }
+    if (json_val.find("tx_descriptors") != json_val.end()) {
+      tx_descriptors = json_val.at("tx_descriptors");
+    }
+    if (json_val.find("rx_mbufs") != json_val.end()) {
+      rx_mbufs = json_val.at("rx_mbufs");
+    }
+    if (json_val.find("tx_mbufs") != json_val.end()) {
+      tx_mbufs = json_val.at("tx_mbufs");
+    }
+    if (json_val.find("mbuf_data_room") != json_val.end()) {
+      mbuf_data_room = json_val.at("mbuf_data_room");
+    }
+    if (json_val.find("ctrl_mbufs") != json_val.end()) {
+      ctrl_mbufs = json_val.at("ctrl_mbufs");
+      LOG(INFO) << "Sending control packets from pools of " << ctrl_mbufs
+                << " small mbufs for " << l2_addr.ToString();
+    }
+    if (rx_mbufs != 0 && rx_descriptors != 0 && rx_mbufs <= rx_descriptors) {
+      LOG(FATAL) << "rx_mbufs must exceed rx_descriptors for "
+                 << l2_addr.ToString() << " in " << config_json_filename_;
+    }
+
+    bool slow_path = false;
+    if (json_val.find("slow_path") != json_val.end()) {
+      slow_path = json_val.at("slow_path");
+      LOG(INFO) << "Slow path " << (slow_path ? "enabled" : "disabled")
+                << " for " << l2_addr.ToString();
+    }
+
     std::string pci_addr = "";
     if (json_val.find("pcie") != json_val.end()) {
       pci_addr = json_val.at("pcie");
@@ -138,7 +462,18 @@ void MachnetConfigProcessor::DiscoverInterfaceConfiguration() {
     }
 
     interfaces_config_.emplace(pci_addr, l2_addr, ip_addr, engine_threads,
-                               cpu_mask);
+                               cpu_mask, rx_pipeline_mode, ack_every,
+                               rx_zerocopy, tx_zerocopy,
+                               tx_zerocopy_threshold, tx_scheduler_mode,
+                               tx_budget, tx_quantum, flow_steering,
+                               rebalance_interval_ms, idle_mode, cores,
+                               hw_timestamps, mtu, pacing, pacing_burst,
+                               paths, encryption_key, neighbors,
+                               trace_sample_every, capture_records,
+                               channel_pool, direct_queues, channel_arena,
+                               rexmit_packets, rx_descriptors, tx_descriptors,
+                               rx_mbufs, tx_mbufs, mbuf_data_room, ctrl_mbufs,
+                               slow_path);
   }
   for (const auto &interface : interfaces_config_) {
     interface.Dump();
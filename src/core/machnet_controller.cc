@@ -6,17 +6,123 @@
 #include <utils.h>
 #include <worker.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <future>
 #include <memory>
+#include <optional>
+#include <string>
 #include <thread>
 
 namespace juggler {
 
+/**
+ * @brief Find the NUMA node of a set of CPUs from sysfs.
+ * @return The node, or -1 if it is unknown, or if the CPUs span several
+ * nodes.
+ */
+static int CpuMaskNumaNode(const cpu_set_t &mask) {
+  int node = -1;
+  for (size_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &mask)) continue;
+    const std::filesystem::path cpu_dir("/sys/devices/system/cpu/cpu" +
+                                        std::to_string(cpu));
+    std::error_code ec;
+    if (!std::filesystem::is_directory(cpu_dir, ec)) continue;
+    int cpu_node = -1;
+    for (const auto &entry :
+         std::filesystem::directory_iterator(cpu_dir, ec)) {
+      const auto name = entry.path().filename().string();
+      if (name.starts_with("node")) {
+        cpu_node = std::atoi(name.c_str() + 4);
+        break;
+      }
+    }
+    if (cpu_node < 0 || (node >= 0 && node != cpu_node)) return -1;
+    node = cpu_node;
+  }
+  return node;
+}
+
+/**
+ * @brief Find the CPUs of a NUMA node (from sysfs) that this process may run
+ * on.
+ * @return The CPUs, or std::nullopt if the node is unknown or none of its CPUs
+ * are available.
+ */
+static std::optional<cpu_set_t> NumaNodeCpuMask(int node) {
+  if (node < 0) return std::nullopt;
+  std::ifstream cpulist_file("/sys/devices/system/node/node" +
+                             std::to_string(node) + "/cpulist");
+  std::string cpulist;
+  if (!std::getline(cpulist_file, cpulist)) return std::nullopt;
+  const auto cpus = utils::ParseCpuList(cpulist);
+  if (!cpus.has_value()) return std::nullopt;
+
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return std::nullopt;
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  for (const auto cpu : cpus.value()) {
+    if (CPU_ISSET(cpu, &allowed)) CPU_SET(cpu, &mask);
+  }
+  if (CPU_COUNT(&mask) == 0) return std::nullopt;
+  return mask;
+}
+
 struct MachnetClientContext {
   bool registered;
   uuid_t uuid;
 };
 
+/**
+ * @brief Install the flow rules for port steering (see
+ * `MachnetEngineSharedState::EnablePortSteering()') on a port: the packets
+ * destined to each block of the port space go to the RX queue serving it.
+ * @param rx_queues_nr The number of RX queues that serve blocks: the first
+ * ones of the port (the slow path's, if any, comes after them).
+ * @return True on success; false if the NIC cannot offload the rules, in which
+ * case none are left installed.
+ */
+static bool InstallPortSteeringRules(dpdk::PmdPort *pmd_port,
+                                     size_t rx_queues_nr) {
+  const size_t blocks_nr =
+      MachnetEngineSharedState::PortSteeringBlocksNr(rx_queues_nr);
+  const size_t block_size =
+      MachnetEngineSharedState::PortSteeringBlockSize(rx_queues_nr);
+  const auto block_mask = static_cast<uint16_t>(~(block_size - 1));
+  std::vector<rte_flow *> rules;
+  for (size_t block = 0; block < blocks_nr; block++) {
+    auto *rule = pmd_port->AddUdpSteeringRule(
+        nullptr, block * block_size, block_mask, block % rx_queues_nr,
+        MachnetEngineSharedState::kPortSteeringRulePriority);
+    if (rule == nullptr) {
+      for (auto *r : rules) pmd_port->RemoveSteeringRule(r);
+      return false;
+    }
+    rules.push_back(rule);
+  }
+  LOG(INFO) << "Port " << pmd_port->GetPortId() << ": steering " << blocks_nr
+            << " blocks of " << block_size << " UDP ports to " << rx_queues_nr
+            << " RX queues.";
+  return true;
+}
+
+/**
+ * @brief The size of the buffers of the channels an engine serves: a buffer
+ * holds the payload of a full-sized packet on the engine's port (e.g., ~9 KB
+ * with jumbo frames), so that messages take as few packets as possible.
+ * Encrypted packets also carry a trailer (see `net::flow::Cipher').
+ */
+static size_t ChannelBufferSize(const MachnetEngine &engine) {
+  return engine.GetPmdPort()->mtu() - sizeof(net::Ipv4) - sizeof(net::Udp) -
+         sizeof(net::MachnetPktHdr) -
+         (engine.encrypted() ? net::flow::Cipher::kTrailerSize : 0);
+}
+
 MachnetController::MachnetController(const std::string &conf_file)
     : config_processor_{conf_file}, channel_manager_{} {}
 
@@ -33,6 +139,14 @@ void MachnetController::Run() {
 
   signal(SIGINT, MachnetController::sig_handler);
 
+  // Calibrate the TSC once, for the engines (which start later) and for the
+  // applications.
+  clock_page_ = time::ClockPage::Create();
+  if (clock_page_ != nullptr) {
+    clock_page_->Start();
+    time::tsc_hz = clock_page_->tsc_hz();
+  }
+
   // Initialize DPDK.
   dpdk_.InitDpdk(config_processor_.GetEalOpts());
   if (dpdk_.GetNumPmdPortsAvailable() == 0) {
@@ -58,37 +172,220 @@ void MachnetController::Run() {
     const_cast<NetworkInterfaceConfig &>(interface).set_dpdk_port_id(
         pmd_port_id.value());
 
-    // Initialize the PMD port.
-    const uint16_t rx_rings_nr = interface.engine_threads(),
-                   tx_rings_nr = interface.engine_threads();
+    // Initialize the PMD port. The direct queues come after the queues of the
+    // engines, and the queue of the slow path after them, out of RSS.
+    const uint16_t steering_queues_nr =
+        interface.engine_threads() + interface.direct_queues();
+    const uint16_t rx_rings_nr = steering_queues_nr + interface.slow_path(),
+                   tx_rings_nr = rx_rings_nr;
+    const uint16_t rx_desc_nr = interface.rx_descriptors() != 0
+                                    ? interface.rx_descriptors()
+                                    : dpdk::PmdRing::kDefaultRingDescNr;
+    const uint16_t tx_desc_nr = interface.tx_descriptors() != 0
+                                    ? interface.tx_descriptors()
+                                    : dpdk::PmdRing::kDefaultRingDescNr;
     pmd_ports_.emplace_back(std::make_shared<juggler::dpdk::PmdPort>(
-        interface.dpdk_port_id().value(), rx_rings_nr, tx_rings_nr,
-        dpdk::PmdRing::kDefaultRingDescNr, dpdk::PmdRing::kDefaultRingDescNr));
-    pmd_ports_.back()->InitDriver();
+        interface.dpdk_port_id().value(), rx_rings_nr, tx_rings_nr, rx_desc_nr,
+        tx_desc_nr));
+    if (interface.direct_queues() > 0 || interface.slow_path()) {
+      pmd_ports_.back()->ReserveQueues(interface.direct_queues() +
+                                       interface.slow_path());
+    }
+    if (interface.idle_mode() == IdleMode::kInterrupt) {
+      pmd_ports_.back()->EnableRxInterrupts();
+    }
+    if (interface.hw_timestamps()) pmd_ports_.back()->EnableRxTimestamps();
+    // The engines keep references to the packets they send.
+    if (interface.rexmit_packets() > 0) pmd_ports_.back()->DisableTxFastFree();
+    // Unless configured, the TX pools make room for the packets the engines
+    // keep on top of those in flight on the NIC.
+    dpdk::PmdPort::PoolConfig pool_config;
+    pool_config.rx_mbufs = interface.rx_mbufs();
+    pool_config.tx_mbufs =
+        interface.tx_mbufs() != 0
+            ? interface.tx_mbufs()
+            : 2 * tx_desc_nr - 1 + interface.rexmit_packets();
+    pool_config.data_room = interface.mbuf_data_room();
+    pool_config.ctrl_mbufs = interface.ctrl_mbufs();
+    pmd_ports_.back()->SetPoolConfig(pool_config);
+    pmd_ports_.back()->InitDriver(interface.mtu());
+    const int port_socket = pmd_ports_.back()->GetSocketId();
+    LOG(INFO) << "Port " << interface.dpdk_port_id().value()
+              << " is on NUMA node " << port_socket;
+
+    // Engine threads run on the configured cores, or else on the cores of the
+    // NIC's node, so that they are local to its queues and mbufs.
+    std::optional<cpu_set_t> port_cpu_mask = interface.cpu_mask();
+    if (interface.cores().empty() &&
+        CPU_EQUAL(&port_cpu_mask.value(),
+                  &NetworkInterfaceConfig::kDefaultCpuMask)) {
+      port_cpu_mask = NumaNodeCpuMask(port_socket);
+      if (!port_cpu_mask.has_value()) port_cpu_mask = interface.cpu_mask();
+    }
 
     // Create the MachnetEngineShared State.
     auto shared_state = std::make_shared<MachnetEngineSharedState>(
         pmd_ports_.back()->GetRSSKey(), pmd_ports_.back()->GetL2Addr(),
         std::vector<net::Ipv4::Address>(1, interface.ip_addr()));
-    // Create the Machnet engines.
+    // The engines send the ARP requests for the neighbors once they run.
+    for (const auto &neighbor : interface.neighbors()) {
+      shared_state->AddNeighbor(interface.ip_addr(), neighbor);
+    }
+    if (interface.flow_steering() && steering_queues_nr > 1) {
+      if (InstallPortSteeringRules(pmd_ports_.back().get(),
+                                   steering_queues_nr)) {
+        shared_state->EnablePortSteering(steering_queues_nr);
+        for (uint16_t q = interface.engine_threads(); q < steering_queues_nr;
+             q++) {
+          shared_state->ReservePortSteeringQueue(q);
+          direct_queues_.push_back({pmd_ports_.back(), shared_state,
+                                    interface.ip_addr(), q, "", {},
+                                    shared_state->NewArpTableReader()});
+        }
+      } else {
+        LOG(WARNING) << "Flow steering is not supported by port "
+                     << interface.dpdk_port_id().value()
+                     << "; falling back to RSS"
+                     << (interface.direct_queues() > 0
+                             ? ", without direct queues."
+                             : ".");
+      }
+    }
+    if (interface.slow_path()) {
+      auto slow_path = std::make_unique<SlowPath>(
+          pmd_ports_.back(), steering_queues_nr, shared_state);
+      if (slow_path->InstallSteeringRules()) {
+        slow_paths_.push_back(std::move(slow_path));
+      } else {
+        LOG(WARNING) << "Port " << interface.dpdk_port_id().value()
+                     << " cannot steer ARP, ICMP and IPv6 to a slow path; "
+                        "the engines handle them.";
+      }
+    }
+    if (interface.rebalance_interval_ms() > 0 &&
+        interface.engine_threads() > 1) {
+      port_rebalancers_.push_back(
+          {{}, std::chrono::milliseconds(interface.rebalance_interval_ms()),
+           std::chrono::steady_clock::now(),
+           std::make_unique<EngineRebalancer>(), {}, time::rdtsc()});
+    }
+    // Create the Machnet engines; those of a port share their options.
+    const MachnetEngine::Options engine_options = {
+        .rx_pipeline_mode = interface.rx_pipeline_mode(),
+        .ack_every = interface.ack_every(),
+        .rx_zerocopy = interface.rx_zerocopy(),
+        .tx_zerocopy = interface.tx_zerocopy(),
+        .tx_zerocopy_threshold = interface.tx_zerocopy_threshold(),
+        .tx_scheduler_mode = interface.tx_scheduler_mode(),
+        .tx_budget = interface.tx_budget(),
+        .tx_quantum = interface.tx_quantum(),
+        .idle_mode = interface.idle_mode(),
+        .pacing_burst = interface.pacing() ? interface.pacing_burst() : 0,
+        .num_paths = interface.paths(),
+        .encryption_key = interface.encryption_key(),
+        .trace_sample_every = interface.trace_sample_every(),
+        .capture_records = interface.capture_records(),
+        .rexmit_packets = interface.rexmit_packets(),
+    };
     for (size_t i = 0; i < interface.engine_threads(); ++i) {
       engines_.emplace_back(std::make_shared<juggler::MachnetEngine>(
-          pmd_ports_.back(), i, i, shared_state));
-      // Create the CPU mask for the engine threads.
-      cpu_masks.emplace_back(interface.cpu_mask());
+          pmd_ports_.back(), i, i, shared_state,
+          std::vector<std::shared_ptr<shm::Channel>>{}, engine_options));
+      if (interface.rebalance_interval_ms() > 0 &&
+          interface.engine_threads() > 1) {
+        port_rebalancers_.back().engines.push_back(engines_.size() - 1);
+        port_rebalancers_.back().last_load.push_back(
+            engines_.back()->GetLoadStats());
+      }
+      // Create the CPU mask for the engine thread.
+      if (!interface.cores().empty()) {
+        cpu_set_t core_mask;
+        CPU_ZERO(&core_mask);
+        CPU_SET(interface.cores()[i], &core_mask);
+        cpu_masks.emplace_back(core_mask);
+      } else {
+        cpu_masks.emplace_back(port_cpu_mask.value());
+      }
+
+      // Engines whose CPUs span NUMA nodes are taken to be local to the NIC.
+      int numa_node = CpuMaskNumaNode(cpu_masks.back());
+      if (numa_node < 0) numa_node = port_socket;
+      engine_placements_.push_back(
+          {static_cast<uint32_t>(engines_.size() - 1), numa_node,
+           utils::cpuset_to_sizet(cpu_masks.back())});
+    }
+
+    // The engines of a port share their configuration.
+    if (interface.channel_pool() > 0) {
+      const auto &engine = engines_.back();
+      channel_pools_.push_back({pmd_ports_.back(), interface.channel_pool(), 0,
+                                port_socket, ChannelBufferSize(*engine),
+                                engine->rx_zerocopy() || engine->tx_zerocopy(),
+                                {}, {}});
     }
+    if (interface.channel_arena() > 0) {
+      const auto &engine = engines_.back();
+      const std::string arena_name =
+          "machnet-arena-" + std::to_string(pmd_ports_.back()->GetPortId());
+      auto arena = ChannelManager::CreateArena(
+          arena_name.c_str(), interface.channel_arena(),
+          ChannelManager::kDefaultRingSize, ChannelManager::kDefaultRingSize,
+          ChannelManager::kDefaultBufferCount, ChannelBufferSize(*engine),
+          MACHNET_CHANNEL_RING_JRING, port_socket);
+      CHECK(arena != nullptr) << "Failed to create the channel arena of port "
+                              << pmd_ports_.back()->GetPortId();
+      // Once for all the channels of the arena.
+      if (engine->rx_zerocopy() || engine->tx_zerocopy()) {
+        CHECK(arena->RegisterMemForDMA(pmd_ports_.back()->GetDevice()));
+      }
+      channel_arenas_.push_back(
+          {pmd_ports_.back(), port_socket, std::move(arena)});
+    }
+  }
+
+  std::vector<int> numa_nodes;
+  for (const auto &placement : engine_placements_) {
+    LOG(INFO) << "Engine " << placement.engine_id << ": NUMA node "
+              << placement.numa_node << ", cpu_mask: 0x"
+              << std::hex << placement.cpu_mask << std::dec;
+    numa_nodes.push_back(placement.numa_node);
+  }
+  engine_placement_ = std::make_unique<EnginePlacement>(numa_nodes);
+
+  // Warm up the channel pools before applications can attach.
+  RefillChannelPools();
+  for (const auto &pool : channel_pools_) {
+    LOG(INFO) << "Port " << pool.pmd_port->GetPortId() << ": "
+              << pool.idle.size() << " warm channels"
+              << (pool.dma ? ", registered for DMA." : ".");
   }
 
   WorkerPool<MachnetEngine> engine_thread_pool{engines_, cpu_masks};
   engine_thread_pool.Init();
   engine_thread_pool.Launch();
+  for (auto &slow_path : slow_paths_) slow_path->Start();
+
+  if (!port_rebalancers_.empty()) {
+    rebalancer_running_ = true;
+    rebalancer_thread_ = std::thread(&MachnetController::RunRebalancer, this);
+  }
 
   // Start the controller server, wait and handle connections.
   RunController();
 
   // The previous call will block until the server is stopped (e.g. by SIGINT).
+  // Migrations need the engines running, so stop rebalancing first.
+  if (rebalancer_thread_.joinable()) {
+    {
+      const std::lock_guard<std::mutex> lock(mtx_);
+      rebalancer_running_ = false;
+    }
+    rebalancer_cv_.notify_all();
+    rebalancer_thread_.join();
+  }
   engine_thread_pool.Pause();
   engine_thread_pool.Terminate();
+  slow_paths_.clear();
 
   for (const auto &pmd_port : pmd_ports_) {
     pmd_port->DumpStats();
@@ -106,8 +403,9 @@ bool MachnetController::HandleNewConnection(UDSocket *s) {
 }
 
 void MachnetController::HandleNewMessage(UDSocket *s, const char *data,
-                                         size_t length) {
+                                         size_t length, int fd) {
   CHECK_NOTNULL(s);
+  const std::lock_guard<std::mutex> lock(mtx_);
   if (length != sizeof(machnet_ctrl_msg_t)) {
     LOG(ERROR) << "Invalid message length";
     return;
@@ -135,9 +433,10 @@ void MachnetController::HandleNewMessage(UDSocket *s, const char *data,
       LOG(INFO) << "Request to create new channel: "
                 << juggler::utils::UUIDToString(req->channel_info.channel_uuid);
       int channel_fd;
-      auto ret = CreateChannel(req->app_uuid, &req->channel_info, &channel_fd);
-
       machnet_ctrl_msg_t resp;
+      auto ret = CreateChannel(req->app_uuid, &req->channel_info, &channel_fd,
+                               &resp.channel_info);
+
       resp.type = MACHNET_CTRL_MSG_TYPE_RESPONSE;
       resp.msg_id = req->msg_id;
 
@@ -150,6 +449,76 @@ void MachnetController::HandleNewMessage(UDSocket *s, const char *data,
         resp.status = MACHNET_CTRL_STATUS_FAILURE;
         CHECK(s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)));
       }
+      // Off the critical path of the application.
+      RefillChannelPools();
+    } break;
+    case MACHNET_CTRL_MSG_TYPE_REQ_NOTIFY: {
+      LOG(INFO) << "Request to set up notifications for channel: "
+                << juggler::utils::UUIDToString(req->channel_info.channel_uuid);
+      auto ret = SetChannelNotifyFd(req->app_uuid, &req->channel_info, fd);
+      if (!ret && fd >= 0) close(fd);
+
+      machnet_ctrl_msg_t resp;
+      resp.type = MACHNET_CTRL_MSG_TYPE_RESPONSE;
+      resp.msg_id = req->msg_id;
+      resp.status =
+          ret ? MACHNET_CTRL_STATUS_SUCCESS : MACHNET_CTRL_STATUS_FAILURE;
+      CHECK(s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)));
+    } break;
+    case MACHNET_CTRL_MSG_TYPE_REQ_DETACH: {
+      LOG(INFO) << "Request to detach channel: "
+                << juggler::utils::UUIDToString(req->channel_info.channel_uuid);
+      auto ret = ReturnChannel(req->app_uuid, &req->channel_info);
+
+      machnet_ctrl_msg_t resp;
+      resp.type = MACHNET_CTRL_MSG_TYPE_RESPONSE;
+      resp.msg_id = req->msg_id;
+      resp.status =
+          ret ? MACHNET_CTRL_STATUS_SUCCESS : MACHNET_CTRL_STATUS_FAILURE;
+      CHECK(s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)));
+      RefillChannelPools();
+    } break;
+    case MACHNET_CTRL_MSG_TYPE_REQ_DIRECT_QUEUE: {
+      machnet_ctrl_msg_t resp;
+      resp.type = MACHNET_CTRL_MSG_TYPE_RESPONSE;
+      resp.msg_id = req->msg_id;
+      auto ret = GrantDirectQueue(req->app_uuid, &req->direct_queue_info,
+                                  &resp.direct_queue_info);
+      resp.status =
+          ret ? MACHNET_CTRL_STATUS_SUCCESS : MACHNET_CTRL_STATUS_FAILURE;
+      CHECK(s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)));
+    } break;
+    case MACHNET_CTRL_MSG_TYPE_REQ_DIRECT_LISTEN: {
+      machnet_ctrl_msg_t resp;
+      resp.type = MACHNET_CTRL_MSG_TYPE_RESPONSE;
+      resp.msg_id = req->msg_id;
+      auto ret = SteerDirectListener(req->app_uuid, &req->direct_addr_info);
+      resp.status =
+          ret ? MACHNET_CTRL_STATUS_SUCCESS : MACHNET_CTRL_STATUS_FAILURE;
+      CHECK(s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)));
+    } break;
+    case MACHNET_CTRL_MSG_TYPE_REQ_DIRECT_RESOLVE: {
+      machnet_ctrl_msg_t resp;
+      resp.type = MACHNET_CTRL_MSG_TYPE_RESPONSE;
+      resp.msg_id = req->msg_id;
+      auto ret = ResolveForDirectQueue(req->app_uuid, &req->direct_addr_info,
+                                       &resp.direct_addr_info);
+      resp.status =
+          ret ? MACHNET_CTRL_STATUS_SUCCESS : MACHNET_CTRL_STATUS_FAILURE;
+      CHECK(s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)));
+    } break;
+    case MACHNET_CTRL_MSG_TYPE_REQ_CLOCK: {
+      machnet_ctrl_msg_t resp;
+      resp.type = MACHNET_CTRL_MSG_TYPE_RESPONSE;
+      resp.msg_id = req->msg_id;
+      if (clock_page_ != nullptr) {
+        resp.status = MACHNET_CTRL_STATUS_SUCCESS;
+        CHECK(s->SendMsgWithFd(reinterpret_cast<char *>(&resp), sizeof(resp),
+                               clock_page_->GetFd()));
+      } else {
+        resp.status = MACHNET_CTRL_STATUS_FAILURE;
+        CHECK(s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)));
+      }
     } break;
     default:
       LOG(ERROR) << "Invalid message type.";
@@ -158,6 +527,7 @@ void MachnetController::HandleNewMessage(UDSocket *s, const char *data,
 }
 
 void MachnetController::HandlePassiveClose(UDSocket *s) {
+  const std::lock_guard<std::mutex> lock(mtx_);
   // Get client context.
   auto *client_context =
       reinterpret_cast<MachnetClientContext *>(s->GetUserData());
@@ -167,6 +537,7 @@ void MachnetController::HandlePassiveClose(UDSocket *s) {
 
     UnregisterApplication(client_context->uuid);
     client_context->registered = false;
+    RefillChannelPools();
   }
 }
 
@@ -207,14 +578,18 @@ void MachnetController::UnregisterApplication(const uuid_t app_uuid) {
   const auto &app_channels = applications_registered_[app_uuid_str];
 
   for (const auto &channel_name : app_channels) {
-    LOG(INFO) << "Destroying channel: " << channel_name;
-    auto channel = channel_manager_.GetChannel(channel_name.c_str());
-    static size_t engine_index =
-        utils::hash<size_t>(channel->GetName().c_str(),
-                            channel->GetName().size()) %
-        engines_.size();
-    engines_[engine_index]->RemoveChannel(channel);
-    channel_manager_.DestroyChannel(channel_name.c_str());
+    LOG(INFO) << "Releasing channel: " << channel_name;
+    ReleaseChannel(channel_name);
+  }
+  ReleaseDirectQueues(app_uuid_str);
+  // Its mappings are gone with it.
+  for (const auto &port_arena : channel_arenas_) {
+    port_arena.arena->ReleaseOwner(app_uuid_str);
+  }
+  for (auto &pool : channel_pools_) {
+    for (auto &returned : pool.returned) {
+      if (returned.owner == app_uuid_str) returned.owner.clear();
+    }
   }
 
   // Unregister the application.
@@ -224,7 +599,9 @@ void MachnetController::UnregisterApplication(const uuid_t app_uuid) {
 
 bool MachnetController::CreateChannel(
     const uuid_t app_uuid, const machnet_channel_info_t *channel_info,
-    int *fd) {
+    int *fd, machnet_channel_info_t *granted) {
+  *granted = *channel_info;
+  granted->flags = 0;
   const std::string app_uuid_str = juggler::utils::UUIDToString(app_uuid);
 
   // Check that this is a registered application.
@@ -242,32 +619,121 @@ bool MachnetController::CreateChannel(
     return false;
   }
 
-  // TODO(ilias): Figure out a way to dynamically infer the buffer size to be
-  // used.
-  const auto channel_buffer_size =
-      juggler::dpdk::PmdRing::kDefaultFrameSize - sizeof(juggler::net::Ipv4) -
-      sizeof(juggler::net::Udp) - sizeof(juggler::net::MachnetPktHdr);
-  if (!channel_manager_.AddChannel(
-          channel_uuid_str.c_str(), ChannelManager::kDefaultRingSize,
-          ChannelManager::kDefaultRingSize, ChannelManager::kDefaultBufferCount,
-          channel_buffer_size) != 0) {
+  // The application hints at the size of the channel it needs, so that small
+  // ones do not pin memory (and DMA mappings) they never use.
+  const auto ring_size = ChannelManager::FitSize(
+      channel_info->desc_ring_size, ChannelManager::kDefaultRingSize,
+      ChannelManager::kMinRingSize, ChannelManager::kMaxRingSize);
+  const auto buffer_count = ChannelManager::FitSize(
+      channel_info->buffer_count, ChannelManager::kDefaultBufferCount,
+      ChannelManager::kMinBufferCount, ChannelManager::kMaxBufferCount);
+  // Single-threaded applications get SPSC messaging rings, which spare the
+  // engine and the application from sharing ring head/tail cache lines.
+  const bool spsc_rings =
+      channel_info->flags & MACHNET_CHANNEL_INFO_FLAGS_SPSC_RINGS;
+  const int ring_type =
+      spsc_rings ? MACHNET_CHANNEL_RING_JRING2 : MACHNET_CHANNEL_RING_JRING;
+
+  // Place the channel on an engine, as requested by the application, and
+  // allocate its memory on the engine's NUMA node.
+  const auto engine_index = engine_placement_->Place(
+      channel_info->placement, channel_info->engine_id,
+      channel_info->numa_node);
+  if (!engine_index.has_value()) {
+    LOG(ERROR) << "Cannot place channel " << channel_uuid_str
+               << " (policy: " << channel_info->placement
+               << ", engine: " << channel_info->engine_id << ").";
+    return false;
+  }
+  const auto &placement = engine_placements_[engine_index.value()];
+
+  // Applications that attach with the default sizes get a warm channel, if
+  // there is one for the engine; it is named after its own UUID.
+  std::optional<std::string> pooled = std::nullopt;
+  if (!spsc_rings && ring_size == ChannelManager::kDefaultRingSize &&
+      buffer_count == ChannelManager::kDefaultBufferCount) {
+    pooled = TakePooledChannel(engine_index.value());
+  }
+  const std::string channel_name = pooled.value_or(channel_uuid_str);
+  if (pooled.has_value()) {
+    CHECK_EQ(uuid_parse(channel_name.c_str(), granted->channel_uuid), 0);
+    LOG(INFO) << "Handing out warm channel " << channel_name << ".";
+  } else if (!channel_manager_.AddChannel(
+                 channel_name.c_str(), ring_size, ring_size, buffer_count,
+                 ChannelBufferSize(*engines_[engine_index.value()]), ring_type,
+                 placement.numa_node,
+                 GetChannelArena(engines_[engine_index.value()]->GetPmdPort(),
+                                 placement.numa_node))) {
+    engine_placement_->Release(engine_index.value());
     return false;
   }
+  granted->desc_ring_size = ring_size;
+  granted->buffer_count = buffer_count;
+  if (spsc_rings) granted->flags |= MACHNET_CHANNEL_INFO_FLAGS_SPSC_RINGS;
+  LOG(INFO) << "Channel " << channel_name << ": " << ring_size
+            << " ring slots, " << buffer_count << " buffers"
+            << (spsc_rings ? ", SPSC rings." : ".");
+
+  granted->engine_id = placement.engine_id;
+  granted->numa_node = placement.numa_node;
+  LOG(INFO) << "Channel " << channel_name << " placed on engine "
+            << placement.engine_id << " (NUMA node " << placement.numa_node
+            << ", " << engine_placement_->load(placement.engine_id)
+            << " channels).";
 
   // Add the channel to the list of channels for this application.
-  app_channels.insert(channel_uuid_str);
+  app_channels.insert(channel_name);
+  channel_engines_.insert({channel_name, engine_index.value()});
+
+  const auto &engine = engines_[engine_index.value()];
+  auto channel =
+      CHECK_NOTNULL(channel_manager_.GetChannel(channel_name.c_str()));
+  channel->SetPlacement(placement);
+  // The application may map the slot of its channel until it is gone (warm
+  // channels are scrubbed in place instead).
+  if (channel->GetArena() != nullptr && !pooled.has_value()) {
+    channel->GetArena()->SetSlotOwner(channel->ctx(), app_uuid_str);
+    LOG(INFO) << "Channel " << channel_name << " in arena "
+              << channel->GetArena()->GetName() << ".";
+  }
+  if (channel_info->flags & MACHNET_CHANNEL_INFO_FLAGS_UNORDERED) {
+    channel->SetUnorderedDelivery(true);
+    granted->flags |= MACHNET_CHANNEL_INFO_FLAGS_UNORDERED;
+    LOG(INFO) << "Channel " << channel_name
+              << ": unordered message delivery.";
+  }
+  if (channel_info->flags & MACHNET_CHANNEL_INFO_FLAGS_STREAM) {
+    channel->SetStreamDelivery(true);
+    granted->flags |= MACHNET_CHANNEL_INFO_FLAGS_STREAM;
+    LOG(INFO) << "Channel " << channel_name << ": message delivery in chunks.";
+  }
+
+  // Zero-copy TX is negotiated: the application asks for it, and gets it if
+  // the engine allows it. Set it up before the engine serves the channel.
+  const bool tx_zerocopy =
+      engine->tx_zerocopy() &&
+      (channel_info->flags & MACHNET_CHANNEL_INFO_FLAGS_TX_ZEROCOPY);
+  if (tx_zerocopy || engine->rx_zerocopy()) {
+    // Warm channels are registered already.
+    if (!channel->IsRegisteredForDMA()) {
+      LOG(INFO) << "Registering channel buffer memory with NIC DPDK driver.";
+      auto device = engine->GetPmdPort()->GetDevice();
+      CHECK(channel->RegisterMemForDMA(device));
+    }
+    engine->EnableRxZeroCopy(channel);
+    if (tx_zerocopy &&
+        channel->EnableTxZeroCopy(engine->tx_zerocopy_threshold())) {
+      granted->flags |= MACHNET_CHANNEL_INFO_FLAGS_TX_ZEROCOPY;
+    }
+  } else {
+    LOG(INFO) << "Not registering channel buffer memory with NIC DPDK driver.";
+  }
 
   // Pass a promise to the Machnet engine and wait for the channel to be
   // activated.
   std::promise<bool> p;
   auto fstatus = p.get_future();
-  static size_t engine_index =
-      utils::hash<size_t>(channel_uuid_str.c_str(), channel_uuid_str.size()) %
-      engines_.size();
-  const auto &engine = engines_[engine_index];
-  engine->AddChannel(
-      CHECK_NOTNULL(channel_manager_.GetChannel(channel_uuid_str.c_str())),
-      std::move(p));
+  engine->AddChannel(channel, std::move(p));
 
   // TODO(ilias): Add a timeout here.
   auto status = fstatus.get();
@@ -278,18 +744,393 @@ bool MachnetController::CreateChannel(
     return false;
   }
 
-  if (kShmZeroCopyEnabled) {
-    LOG(INFO) << "Registering channel buffer memory with NIC DPDK driver.";
-    // Register channel buffer memory with NIC DPDK driver.
-    auto device = engine->GetPmdPort()->GetDevice();
-    CHECK(channel_manager_.GetChannel(channel_uuid_str.c_str())
-              ->RegisterMemForDMA(device));
-  } else {
-    LOG(INFO) << "Not registering channel buffer memory with NIC DPDK driver.";
+  *fd = channel->GetFd();
+  return status;
+}
+
+bool MachnetController::SetChannelNotifyFd(
+    const uuid_t app_uuid, const machnet_channel_info_t *channel_info,
+    int fd) {
+  if (fd < 0) {
+    LOG(ERROR) << "No eventfd in notification request.";
+    return false;
   }
 
-  *fd = channel_manager_.GetChannel(channel_uuid_str.c_str())->GetFd();
-  return status;
+  const std::string app_uuid_str = juggler::utils::UUIDToString(app_uuid);
+  const std::string channel_uuid_str =
+      juggler::utils::UUIDToString(channel_info->channel_uuid);
+  auto app = applications_registered_.find(app_uuid_str);
+  if (app == applications_registered_.end() ||
+      app->second.find(channel_uuid_str) == app->second.end()) {
+    LOG(ERROR) << "Channel " << channel_uuid_str
+               << " does not belong to application " << app_uuid_str;
+    return false;
+  }
+
+  auto channel = channel_manager_.GetChannel(channel_uuid_str.c_str());
+  if (channel == nullptr || !channel->SetNotifyFd(fd)) {
+    LOG(ERROR) << "Failed to set up notifications for channel "
+               << channel_uuid_str;
+    return false;
+  }
+  return true;
+}
+
+bool MachnetController::ReturnChannel(
+    const uuid_t app_uuid, const machnet_channel_info_t *channel_info) {
+  const std::string app_uuid_str = juggler::utils::UUIDToString(app_uuid);
+  const std::string channel_uuid_str =
+      juggler::utils::UUIDToString(channel_info->channel_uuid);
+  auto app = applications_registered_.find(app_uuid_str);
+  if (app == applications_registered_.end() ||
+      app->second.find(channel_uuid_str) == app->second.end()) {
+    LOG(ERROR) << "Channel " << channel_uuid_str
+               << " does not belong to application " << app_uuid_str;
+    return false;
+  }
+
+  ReleaseChannel(channel_uuid_str, app_uuid_str);
+  app->second.erase(channel_uuid_str);
+  LOG(INFO) << "Channel " << channel_uuid_str << " detached.";
+  return true;
+}
+
+void MachnetController::ReleaseChannel(const std::string &channel_name,
+                                       const std::string &owner) {
+  auto channel = channel_manager_.GetChannel(channel_name.c_str());
+  const auto it = channel_engines_.find(channel_name);
+  if (it != channel_engines_.end()) {
+    engines_[it->second]->RemoveChannel(channel);
+    engine_placement_->Release(it->second);
+    channel_engines_.erase(it);
+  }
+  channel_msgs_.erase(channel_name);
+
+  const auto pooled = pooled_channels_.find(channel_name);
+  if (pooled == pooled_channels_.end()) {
+    channel_manager_.DestroyChannel(channel_name.c_str());
+    return;
+  }
+  // The engine lets go of the channel on its next iteration; it is scrubbed
+  // afterwards, once its owner is gone too (see `RefillChannelPools()').
+  channel_pools_[pooled->second].returned.push_back({channel_name, owner});
+}
+
+std::optional<std::string> MachnetController::TakePooledChannel(
+    size_t engine_index) {
+  // Channels given back since the last request may be ready by now.
+  RefillChannelPools();
+  const auto &pmd_port = engines_[engine_index]->GetPmdPort();
+  const int numa_node = engine_placements_[engine_index].numa_node;
+  for (auto &pool : channel_pools_) {
+    if (pool.pmd_port != pmd_port || pool.idle.empty()) continue;
+    if (pool.numa_node >= 0 && pool.numa_node != numa_node) continue;
+    auto channel_name = std::move(pool.idle.back());
+    pool.idle.pop_back();
+    return channel_name;
+  }
+  return std::nullopt;
+}
+
+bool MachnetController::AddPooledChannel(size_t pool_index) {
+  auto &pool = channel_pools_[pool_index];
+  uuid_t uuid;
+  uuid_generate(uuid);
+  const std::string channel_name = juggler::utils::UUIDToString(uuid);
+  if (!channel_manager_.AddChannel(
+          channel_name.c_str(), ChannelManager::kDefaultRingSize,
+          ChannelManager::kDefaultRingSize, ChannelManager::kDefaultBufferCount,
+          pool.buffer_size, MACHNET_CHANNEL_RING_JRING, pool.numa_node,
+          GetChannelArena(pool.pmd_port, pool.numa_node))) {
+    return false;
+  }
+  if (pool.dma) {
+    auto channel =
+        CHECK_NOTNULL(channel_manager_.GetChannel(channel_name.c_str()));
+    if (!channel->RegisterMemForDMA(pool.pmd_port->GetDevice())) {
+      channel_manager_.DestroyChannel(channel_name.c_str());
+      return false;
+    }
+  }
+  pool.idle.push_back(channel_name);
+  pool.channels_nr++;
+  pooled_channels_.insert({channel_name, pool_index});
+  return true;
+}
+
+std::shared_ptr<shm::ChannelArena> MachnetController::GetChannelArena(
+    const std::shared_ptr<dpdk::PmdPort> &pmd_port, int numa_node) const {
+  for (const auto &port_arena : channel_arenas_) {
+    if (port_arena.pmd_port != pmd_port) continue;
+    if (numa_node >= 0 && port_arena.numa_node >= 0 &&
+        port_arena.numa_node != numa_node) {
+      return nullptr;
+    }
+    return port_arena.arena;
+  }
+  return nullptr;
+}
+
+void MachnetController::RefillChannelPools() {
+  for (size_t i = 0; i < channel_pools_.size(); i++) {
+    auto &pool = channel_pools_[i];
+    std::erase_if(pool.returned, [this, &pool](const auto &returned) {
+      // The previous application may still map the channel.
+      if (!returned.owner.empty()) return false;
+      const auto &name = returned.name;
+      auto channel = channel_manager_.GetChannel(name.c_str());
+      // Only the manager holds the channel besides us once the engine has
+      // removed it, and the NIC is done with its buffers.
+      if (channel.use_count() > 2) return false;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (channel->Recycle(ChannelManager::kDefaultRingSize,
+                           ChannelManager::kDefaultRingSize,
+                           ChannelManager::kDefaultBufferCount,
+                           pool.buffer_size, MACHNET_CHANNEL_RING_JRING)) {
+        pool.idle.push_back(name);
+      } else {
+        channel.reset();
+        channel_manager_.DestroyChannel(name.c_str());
+        pooled_channels_.erase(name);
+        pool.channels_nr--;
+      }
+      return true;
+    });
+    while (pool.channels_nr < pool.size && AddPooledChannel(i)) {
+    }
+  }
+}
+
+bool MachnetController::GrantDirectQueue(
+    const uuid_t app_uuid, const machnet_direct_queue_info_t *request,
+    machnet_direct_queue_info_t *granted) {
+  const std::string app_uuid_str = juggler::utils::UUIDToString(app_uuid);
+  if (applications_registered_.find(app_uuid_str) ==
+      applications_registered_.end()) {
+    LOG(ERROR) << "Application " << app_uuid_str << " is not registered.";
+    return false;
+  }
+
+  const net::Ipv4::Address requested_ip(request->ipv4_addr);
+  for (auto &queue : direct_queues_) {
+    if (!queue.app_uuid.empty()) continue;
+    if (request->ipv4_addr != 0 && queue.ip_addr != requested_ip) continue;
+    auto *rx_pool =
+        queue.pmd_port->GetRing<dpdk::RxRing>(queue.queue_id)->GetPacketPool();
+    auto *tx_pool =
+        queue.pmd_port->GetRing<dpdk::TxRing>(queue.queue_id)->GetPacketPool();
+    memset(granted, 0, sizeof(*granted));
+    granted->ipv4_addr = queue.ip_addr.address.value();
+    granted->port_id = queue.pmd_port->GetPortId();
+    granted->queue_id = queue.queue_id;
+    granted->queues_nr = queue.pmd_port->GetRxQueuesNr();
+    strncpy(granted->rx_mempool, rx_pool->GetPacketPoolName(),
+            sizeof(granted->rx_mempool) - 1);
+    strncpy(granted->tx_mempool, tx_pool->GetPacketPoolName(),
+            sizeof(granted->tx_mempool) - 1);
+    queue.app_uuid = app_uuid_str;
+    LOG(INFO) << "Direct queue " << queue.queue_id << " of port "
+              << granted->port_id << " granted to application "
+              << app_uuid_str;
+    return true;
+  }
+
+  LOG(ERROR) << "No direct queue available for application " << app_uuid_str;
+  return false;
+}
+
+MachnetController::DirectQueue *MachnetController::FindDirectQueue(
+    const std::string &app_uuid_str, const net::Ipv4::Address &ip_addr) {
+  for (auto &queue : direct_queues_) {
+    if (queue.app_uuid == app_uuid_str && queue.ip_addr == ip_addr) {
+      return &queue;
+    }
+  }
+  LOG(ERROR) << "Application " << app_uuid_str << " has no direct queue on "
+             << ip_addr.ToString();
+  return nullptr;
+}
+
+bool MachnetController::SteerDirectListener(
+    const uuid_t app_uuid, const machnet_direct_addr_info_t *info) {
+  const net::Ipv4::Address ip_addr(info->local_ip);
+  const net::Udp::Port port(info->port);
+  auto *queue =
+      FindDirectQueue(juggler::utils::UUIDToString(app_uuid), ip_addr);
+  if (queue == nullptr) return false;
+
+  auto &listeners = queue->listeners;
+  auto it = std::find_if(listeners.begin(), listeners.end(),
+                         [&](const auto &listener) {
+                           return std::get<0>(listener) == ip_addr &&
+                                  std::get<1>(listener) == port;
+                         });
+  if (info->flags & MACHNET_DIRECT_ADDR_INFO_FLAGS_UNLISTEN) {
+    if (it == listeners.end()) return true;
+    queue->pmd_port->RemoveSteeringRule(std::get<2>(*it));
+    queue->shared_state->UnregisterListener(ip_addr, port);
+    listeners.erase(it);
+    return true;
+  }
+
+  // The blocks of the queue are steered to it already.
+  if (queue->shared_state->PortSteeringQueue(port) == queue->queue_id) {
+    return true;
+  }
+  if (it != listeners.end() ||
+      !queue->shared_state->RegisterListener(ip_addr, port, queue->queue_id)) {
+    LOG(ERROR) << "Port " << port.port.value() << " on "
+               << ip_addr.ToString() << " is in use.";
+    return false;
+  }
+  auto *rule = queue->pmd_port->AddUdpSteeringRule(
+      &ip_addr, port.port.value(), UINT16_MAX, queue->queue_id,
+      MachnetEngineSharedState::kListenerSteeringRulePriority);
+  if (rule == nullptr) {
+    queue->shared_state->UnregisterListener(ip_addr, port);
+    return false;
+  }
+  listeners.emplace_back(ip_addr, port, rule);
+  return true;
+}
+
+bool MachnetController::ResolveForDirectQueue(
+    const uuid_t app_uuid, const machnet_direct_addr_info_t *request,
+    machnet_direct_addr_info_t *response) {
+  const net::Ipv4::Address local_ip(request->local_ip);
+  const net::Ipv4::Address remote_ip(request->remote_ip);
+  auto *queue =
+      FindDirectQueue(juggler::utils::UUIDToString(app_uuid), local_ip);
+  if (queue == nullptr) return false;
+
+  *response = *request;
+  response->flags = 0;
+  const auto l2_addr = MachnetEngineSharedState::LookupL2Addr(
+      queue->arp_reader.get(), remote_ip);
+  if (!l2_addr.has_value()) {
+    // The engines request it on the next maintenance of the table.
+    queue->shared_state->AddNeighbor(local_ip, remote_ip);
+    return true;
+  }
+  response->flags |= MACHNET_DIRECT_ADDR_INFO_FLAGS_RESOLVED;
+  juggler::utils::Copy(response->l2_addr, l2_addr->bytes,
+                       sizeof(response->l2_addr));
+  return true;
+}
+
+void MachnetController::ReleaseDirectQueues(const std::string &app_uuid_str) {
+  for (auto &queue : direct_queues_) {
+    if (queue.app_uuid != app_uuid_str) continue;
+    for (const auto &[ip_addr, port, rule] : queue.listeners) {
+      queue.pmd_port->RemoveSteeringRule(rule);
+      queue.shared_state->UnregisterListener(ip_addr, port);
+    }
+    queue.listeners.clear();
+    queue.app_uuid.clear();
+    LOG(INFO) << "Direct queue " << queue.queue_id << " of port "
+              << queue.pmd_port->GetPortId() << " released.";
+  }
+}
+
+bool MachnetController::MigrateChannel(const std::string &channel_name,
+                                       size_t engine_index) {
+  const auto it = channel_engines_.find(channel_name);
+  CHECK(it != channel_engines_.end());
+  const size_t from = it->second;
+  const auto &src = engines_[from];
+  const auto &dst = engines_[engine_index];
+  CHECK_EQ(src->GetPmdPort(), dst->GetPmdPort());
+  auto channel =
+      CHECK_NOTNULL(channel_manager_.GetChannel(channel_name.c_str()));
+
+  // Hand the channel over: the old engine stops serving it, and redirects the
+  // packets of its flows to the RX queue of the new one, which then picks it
+  // up. The application keeps using the channel meanwhile; its messages just
+  // wait in the rings.
+  MachnetEngine::ChannelHandoff handoff;
+  std::promise<bool> detached;
+  auto fdetached = detached.get_future();
+  src->DetachChannel(channel, dst->GetRxQueueId(), &handoff,
+                     std::move(detached));
+  if (!fdetached.get()) return false;
+
+  std::promise<bool> adopted;
+  auto fadopted = adopted.get_future();
+  dst->AdoptChannel(std::move(handoff), std::move(adopted));
+  CHECK(fadopted.get());
+  // The engines of a port share their configuration, so the channel memory is
+  // already registered for DMA if the new engine receives zero-copy.
+  dst->EnableRxZeroCopy(channel);
+
+  it->second = engine_index;
+  engine_placement_->Release(from);
+  CHECK(engine_placement_->Place(MACHNET_PLACEMENT_ENGINE, engine_index, -1)
+            .has_value());
+  channel->SetPlacement(engine_placements_[engine_index]);
+  LOG(INFO) << "Channel " << channel_name << " migrated from engine " << from
+            << " to engine " << engine_index << ".";
+  return true;
+}
+
+void MachnetController::RebalancePort(PortRebalancer *port) {
+  const auto now = time::rdtsc();
+  const double elapsed = now - port->last_tsc;
+  port->last_tsc = now;
+
+  // The load of each engine over the last round, and the channels it serves.
+  std::vector<EngineRebalancer::EngineLoad> loads(port->engines.size());
+  std::vector<std::vector<std::string>> channels(port->engines.size());
+  for (size_t i = 0; i < port->engines.size(); i++) {
+    const auto load = engines_[port->engines[i]]->GetLoadStats();
+    const auto busy = load.busy_cycles - port->last_load[i].busy_cycles;
+    loads[i].utilization = std::min(1.0, busy / std::max(elapsed, 1.0));
+    port->last_load[i] = load;
+  }
+  for (const auto &[channel_name, engine] : channel_engines_) {
+    const auto pos =
+        std::find(port->engines.begin(), port->engines.end(), engine);
+    if (pos == port->engines.end()) continue;
+    const size_t i = pos - port->engines.begin();
+    auto channel = channel_manager_.GetChannel(channel_name.c_str());
+    if (channel == nullptr) continue;
+    const auto msgs = channel->GetMessageCount();
+    auto &last_msgs = channel_msgs_[channel_name];
+    loads[i].channel_msgs.push_back(msgs - last_msgs);
+    last_msgs = msgs;
+    channels[i].push_back(channel_name);
+  }
+
+  const auto migration = port->rebalancer->Rebalance(loads);
+  if (!migration.has_value()) return;
+  const auto &channel_name = channels[migration->from][migration->channel];
+  LOG(INFO) << "Engine " << port->engines[migration->from] << " utilization "
+            << loads[migration->from].utilization << ", engine "
+            << port->engines[migration->to] << " utilization "
+            << loads[migration->to].utilization << ": migrating channel "
+            << channel_name << ".";
+  if (!MigrateChannel(channel_name, port->engines[migration->to])) {
+    LOG(INFO) << "Channel " << channel_name << " cannot be migrated.";
+  }
+}
+
+void MachnetController::RunRebalancer() {
+  auto interval = port_rebalancers_.front().interval;
+  for (const auto &port : port_rebalancers_) {
+    interval = std::min(interval, port.interval);
+  }
+
+  std::unique_lock<std::mutex> lock(mtx_);
+  while (rebalancer_running_) {
+    rebalancer_cv_.wait_for(lock, interval,
+                            [this] { return !rebalancer_running_; });
+    if (!rebalancer_running_) break;
+    const auto now = std::chrono::steady_clock::now();
+    for (auto &port : port_rebalancers_) {
+      if (now < port.next_round) continue;
+      RebalancePort(&port);
+      port.next_round = now + port.interval;
+    }
+  }
 }
 
 void MachnetController::RunController() {
@@ -306,7 +1147,7 @@ void MachnetController::RunController() {
   //     &MachnetController::HandlePassiveClose, this, std::placeholders::_1);
   const UDServer::on_message_cb_t on_message_cb =
       [=, this](UDSocket *socket, const char *data, size_t length, int fd) {
-        this->HandleNewMessage(socket, data, length);
+        this->HandleNewMessage(socket, data, length, fd);
       };
 
   const UDServer::on_timeout_cb_t on_timeout_cb = [=, this](UDSocket *socket) {
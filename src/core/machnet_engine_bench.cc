@@ -0,0 +1,386 @@
+/**
+ * @file machnet_engine_bench.cc
+ *
+ * Benchmarks of full iterations of `MachnetEngine::Run()':
+ *  - `BM_EngineRunRx', each over a burst of data packets received on an
+ *    established flow: RX, flow lookup, reassembly, delivery to the channel,
+ *    ACKs and the TX flush;
+ *  - `BM_EngineConnectionSetup', over bursts of connections, set up (the SYNs
+ *    and ACKs, see `AcceptPendingSyns()') and torn down (the RSTs) in turn.
+ *    Besides the connections per second (`flows/s'), it reports the heap
+ *    allocations per connection (`allocs/flow') once the flow pool of the
+ *    channel has warmed up: there should be none.
+ *
+ * The packets come from a synthetic peer, which rewrites the packets the engine
+ * receives from a `net_null' device (from an RX callback) as those of its end
+ * of the flow; only their headers are written, as a NIC would have. Besides
+ * the time, the benchmark reports the TSC cycles per packet received
+ * (`cycles/pkt').
+ * Draining the channel, as the application would, is left out.
+ */
+#include <benchmark/benchmark.h>
+#include <channel.h>
+#include <dpdk.h>
+#include <glog/logging.h>
+#include <machnet.h>
+#include <machnet_common.h>
+#include <machnet_engine.h>
+#include <packet.h>
+#include <pmd.h>
+#include <ttime.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace juggler {
+
+// Heap allocations made so far (see `operator new' below).
+static std::atomic<uint64_t> heap_allocations{0};
+
+/**
+ * @brief Class `SyntheticPeer' plays the remote end of a flow towards an
+ * engine, by rewriting the packets the engine receives (see `RxCallback()').
+ */
+class SyntheticPeer {
+ public:
+  using Ethernet = net::Ethernet;
+  using Ipv4 = net::Ipv4;
+  using Udp = net::Udp;
+  using MachnetPktHdr = net::MachnetPktHdr;
+  using MachnetFlags = MachnetPktHdr::MachnetFlags;
+  static constexpr uint32_t kInitialSeqno = 1000;
+  // The remote port of the first connection of a burst (see
+  // `SendConnections()').
+  static constexpr uint16_t kFirstConnectionPort = 10000;
+
+  SyntheticPeer(const Ethernet::Address &local_l2addr,
+                const Ipv4::Address &local_ip, const Udp::Port &local_port) {
+    auto &t = template_;
+    t.eth.dst_addr = local_l2addr;
+    t.eth.src_addr = Ethernet::Address("00:00:00:00:00:02");
+    t.eth.eth_type = be16_t(Ethernet::kIpv4);
+    t.ipv4.version_ihl = 0x45;
+    t.ipv4.time_to_live = 64;
+    t.ipv4.next_proto_id = Ipv4::Proto::kUdp;
+    t.ipv4.src_addr.FromString("10.0.0.2");
+    t.ipv4.dst_addr = local_ip;
+    t.udp.src_port = Udp::Port(888);
+    t.udp.dst_port = local_port;
+    t.machneth.magic = be16_t(MachnetPktHdr::kMagic);
+    t.machneth.rwnd = be16_t(UINT16_MAX);
+  }
+
+  // Have the next burst received carry a single control packet (e.g., a SYN,
+  // or an ACK of `ackno').
+  void SendControl(MachnetFlags flags, uint32_t ackno = 0) {
+    mode_ = Mode::kControl;
+    template_.machneth.net_flags = flags;
+    template_.machneth.ackno = be32_t(ackno);
+    payload_len_ = 0;
+  }
+
+  // Have the bursts received carry data packets, of single-packet messages of
+  // `len' bytes.
+  void SendData(uint32_t len) {
+    mode_ = Mode::kData;
+    template_.machneth.net_flags = MachnetFlags::kData;
+    template_.machneth.msg_flags =
+        MACHNET_MSGBUF_FLAGS_SYN | MACHNET_MSGBUF_FLAGS_FIN;
+    payload_len_ = len;
+  }
+
+  // Have the next burst received carry a control packet for each of `nflows'
+  // connections, each from its own remote port: their SYNs, ACKs (of `ackno')
+  // or RSTs. Every connection starts at `kInitialSeqno'.
+  void SendConnections(MachnetFlags flags, uint16_t nflows,
+                       uint32_t ackno = 0) {
+    SendControl(flags, ackno);
+    mode_ = Mode::kConnections;
+    nflows_ = nflows;
+  }
+
+  void Stop() { mode_ = Mode::kIdle; }
+
+  // Number of data packets sent so far.
+  uint64_t data_packets() const { return data_packets_; }
+
+  static uint16_t RxCallback(uint16_t port_id, uint16_t queue_id,
+                             rte_mbuf *pkts[], uint16_t nb_pkts,
+                             uint16_t max_pkts, void *arg) {
+    return static_cast<SyntheticPeer *>(arg)->Fill(
+        reinterpret_cast<dpdk::Packet **>(pkts), nb_pkts);
+  }
+
+ private:
+  enum class Mode { kIdle, kControl, kConnections, kData };
+  struct __attribute__((packed)) Headers {
+    Ethernet eth;
+    Ipv4 ipv4;
+    Udp udp;
+    MachnetPktHdr machneth;
+  };
+
+  uint16_t Fill(dpdk::Packet **pkts, uint16_t nb_pkts) {
+    const uint16_t n = mode_ == Mode::kData      ? nb_pkts
+                       : mode_ == Mode::kControl ? 1
+                       : mode_ == Mode::kConnections
+                           ? std::min(nflows_, nb_pkts)
+                           : 0;
+    for (uint16_t i = 0; i < nb_pkts; i++) {
+      if (i >= n) {
+        dpdk::Packet::Free(pkts[i]);
+      } else if (mode_ == Mode::kConnections) {
+        WriteConnection(pkts[i], i);
+      } else {
+        Write(pkts[i]);
+      }
+    }
+    if (mode_ == Mode::kData) data_packets_ += n;
+    if (mode_ == Mode::kControl || mode_ == Mode::kConnections) {
+      mode_ = Mode::kIdle;
+    }
+    return n;
+  }
+
+  // Write the control packet of the `index'-th connection of a burst.
+  void WriteConnection(dpdk::Packet *pkt, uint16_t index) {
+    const auto seqno = seqno_;
+    seqno_ = kInitialSeqno;
+    Write(pkt);
+    seqno_ = seqno;
+    auto *hdrs = pkt->head_data<Headers *>();
+    hdrs->udp.src_port = Udp::Port(kFirstConnectionPort + index);
+    // The SYN takes the first sequence number.
+    if (template_.machneth.net_flags != MachnetFlags::kSyn) {
+      hdrs->machneth.seqno = be32_t(kInitialSeqno + 1);
+    }
+  }
+
+  void Write(dpdk::Packet *pkt) {
+    rte_pktmbuf_reset(reinterpret_cast<rte_mbuf *>(pkt));
+    const uint16_t len = sizeof(Headers) + payload_len_;
+    auto *hdrs = CHECK_NOTNULL(pkt->append<Headers *>(len));
+    *hdrs = template_;
+    hdrs->ipv4.total_length = be16_t(len - sizeof(Ethernet));
+    hdrs->udp.len = be16_t(len - sizeof(Ethernet) - sizeof(Ipv4));
+    // Pure ACKs take no sequence number.
+    hdrs->machneth.seqno = be32_t(seqno_);
+    if (template_.machneth.net_flags != MachnetFlags::kAck) seqno_++;
+  }
+
+  Headers template_{};
+  Mode mode_{Mode::kIdle};
+  uint16_t payload_len_{0};
+  uint16_t nflows_{0};
+  uint32_t seqno_{kInitialSeqno};
+  uint64_t data_packets_{0};
+};
+
+static constexpr const char *kChannelName = "machnet_engine_bench";
+
+/**
+ * @brief An engine serving a channel, with a flow accepted from a synthetic
+ * peer.
+ */
+struct BenchContext {
+  using Ipv4 = net::Ipv4;
+  using Udp = net::Udp;
+  static constexpr uint16_t kLocalPort = 7000;
+
+  BenchContext()
+      : pmd_port(std::make_shared<dpdk::PmdPort>(0, 1, 1)),
+        peer(pmd_port->GetL2Addr(), LocalIp(), Udp::Port(kLocalPort)) {
+    pmd_port->InitDriver();
+    constexpr uint32_t kRingSize = 1 << 10;
+    CHECK(channel_mgr.AddChannel(kChannelName, kRingSize, kRingSize, 1 << 13,
+                                 1 << 11));
+    channel = channel_mgr.GetChannel(kChannelName);
+    const auto local_ip = LocalIp();
+    engine = std::make_unique<MachnetEngine>(
+        pmd_port, 0, 0,
+        std::make_shared<MachnetEngineSharedState>(
+            std::vector<uint8_t>{}, pmd_port->GetL2Addr(),
+            std::vector<Ipv4::Address>{local_ip}),
+        std::vector<std::shared_ptr<shm::Channel>>{channel});
+
+    // Listen on the channel, as the application would (see `machnet_listen()')
+    // but for waiting on the engine to process the request.
+    MachnetCtrlQueueEntry_t req;
+    std::memset(&req, 0, sizeof(req));
+    req.opcode = MACHNET_CTRL_OP_LISTEN;
+    req.listener_info.ip = local_ip.address.value();
+    req.listener_info.port = kLocalPort;
+    CHECK_EQ(__machnet_channel_ctrl_sq_enqueue(channel->ctx(), 1, &req), 1);
+    engine->PeriodicProcess(time::rdtsc());
+    MachnetCtrlQueueEntry_t resp;
+    CHECK_EQ(__machnet_channel_ctrl_cq_dequeue(channel->ctx(), 1, &resp), 1);
+    CHECK_EQ(resp.status, MACHNET_CTRL_STATUS_OK);
+
+    rx_callback = rte_eth_add_rx_callback(
+        pmd_port->GetPortId(), 0, SyntheticPeer::RxCallback, &peer);
+    CHECK_NOTNULL(rx_callback);
+
+    // The handshake; the SYN-ACK of the engine takes the first sequence number
+    // of its end of the flow (see `swift::Pcb').
+    peer.SendControl(SyntheticPeer::MachnetFlags::kSyn);
+    engine->Run(time::rdtsc());
+    peer.SendControl(SyntheticPeer::MachnetFlags::kAck, 1);
+    engine->Run(time::rdtsc());
+    // The flow is established once the data makes it to the application.
+    peer.SendData(64);
+    engine->Run(time::rdtsc());
+    peer.Stop();
+    CHECK_EQ(Drain(), peer.data_packets());
+  }
+
+  ~BenchContext() {
+    peer.Stop();
+    engine->RemoveChannel(channel);
+    engine->Run(time::rdtsc());
+    rte_eth_remove_rx_callback(pmd_port->GetPortId(), 0, rx_callback);
+    channel.reset();
+    channel_mgr.DestroyChannel(kChannelName);
+  }
+
+  // Receive all the messages delivered to the application; returns how many.
+  size_t Drain() {
+    static std::vector<uint8_t> buf(MACHNET_MSG_MAX_LEN);
+    MachnetFlow_t flow;
+    size_t n = 0;
+    while (machnet_recv(channel->ctx(), buf.data(), buf.size(), &flow) > 0) n++;
+    return n;
+  }
+
+  static Ipv4::Address LocalIp() {
+    Ipv4::Address addr;
+    CHECK(addr.FromString("10.0.0.1"));
+    return addr;
+  }
+
+  std::shared_ptr<dpdk::PmdPort> pmd_port;
+  SyntheticPeer peer;
+  shm::ChannelManager<shm::Channel> channel_mgr;
+  std::shared_ptr<shm::Channel> channel;
+  std::unique_ptr<MachnetEngine> engine;
+  const void *rx_callback{nullptr};
+};
+
+static BenchContext *ctx = nullptr;
+
+static void BM_EngineRunRx(benchmark::State &state) {  // NOLINT
+  auto *engine = ctx->engine.get();
+  ctx->peer.SendData(state.range(0));
+  const auto first_packet = ctx->peer.data_packets();
+  uint64_t cycles = 0;
+  for (auto _ : state) {
+    const auto start = time::rdtsc();
+    engine->Run(start);
+    cycles += time::rdtsc() - start;
+
+    state.PauseTiming();
+    ctx->Drain();
+    state.ResumeTiming();
+  }
+  ctx->peer.Stop();
+  const auto npackets = ctx->peer.data_packets() - first_packet;
+  state.counters["cycles/pkt"] =
+      npackets == 0 ? 0 : static_cast<double>(cycles) / npackets;
+  state.SetItemsProcessed(npackets);
+}
+BENCHMARK(BM_EngineRunRx)
+    ->Arg(64)
+    ->Arg(512)
+    ->Arg(dpdk::PmdRing::kDefaultFrameSize - net::flow::Flow::kDataHeadersLen);
+
+static void BM_EngineConnectionSetup(benchmark::State &state) {  // NOLINT
+  using MachnetFlags = SyntheticPeer::MachnetFlags;
+  auto *engine = ctx->engine.get();
+  const auto nflows = static_cast<uint16_t>(state.range(0));
+  // The flow of the other benchmarks stays up.
+  const auto base_flows = engine->GetFlowCount();
+
+  // Set up a burst of `nflows' connections, and tear them down.
+  auto connect = [&]() {
+    ctx->peer.SendConnections(MachnetFlags::kSyn, nflows);
+    engine->Run(time::rdtsc());
+    CHECK_EQ(engine->GetFlowCount(), base_flows + nflows);
+    ctx->peer.SendConnections(MachnetFlags::kAck, nflows, 1);
+    engine->Run(time::rdtsc());
+    ctx->peer.SendConnections(MachnetFlags::kRst, nflows);
+    // Closed flows are removed once their RTO timer fires, at the next tick
+    // of the timer wheel.
+    while (engine->GetFlowCount() != base_flows) engine->Run(time::rdtsc());
+  };
+
+  // Warm up the flow pool of the channel, and the containers of the engine.
+  connect();
+  const auto first_allocation = heap_allocations.load();
+  uint64_t cycles = 0;
+  for (auto _ : state) {
+    const auto start = time::rdtsc();
+    connect();
+    cycles += time::rdtsc() - start;
+  }
+  const auto allocations = heap_allocations.load() - first_allocation;
+  const double flows = static_cast<double>(state.iterations()) * nflows;
+  state.counters["flows/s"] =
+      benchmark::Counter(flows, benchmark::Counter::kIsRate);
+  state.counters["cycles/flow"] = flows == 0 ? 0 : cycles / flows;
+  state.counters["allocs/flow"] = flows == 0 ? 0 : allocations / flows;
+}
+BENCHMARK(BM_EngineConnectionSetup)
+    ->Arg(1)
+    ->Arg(8)
+    ->Arg(dpdk::PacketBatch::kMaxBurst);
+
+}  // namespace juggler
+
+// Count the heap allocations (see `BM_EngineConnectionSetup').
+void *operator new(size_t size) {
+  juggler::heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  void *ptr = std::malloc(size != 0 ? size : 1);
+  if (ptr == nullptr) std::abort();
+  return ptr;
+}
+
+void *operator new(size_t size, std::align_val_t align) {
+  juggler::heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  const auto alignment = static_cast<size_t>(align);
+  // The size must be a multiple of the alignment.
+  const size_t aligned_size =
+      (std::max(size, size_t{1}) + alignment - 1) & ~(alignment - 1);
+  void *ptr = std::aligned_alloc(alignment, aligned_size);
+  if (ptr == nullptr) std::abort();
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  benchmark::Initialize(&argc, argv);
+
+  // The packets are written by the synthetic peer: the device need not copy
+  // anything into them.
+  auto kEalOpts = juggler::utils::CmdLineOpts(
+      {"-c", "0x0", "-n", "6", "--proc-type=auto", "-m", "1024", "--log-level",
+       "8", "--vdev=net_null0,copy=0", "--no-pci"});
+  auto d = juggler::dpdk::Dpdk();
+  d.InitDpdk(kEalOpts);
+
+  juggler::BenchContext ctx;
+  juggler::ctx = &ctx;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
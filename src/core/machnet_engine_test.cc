@@ -11,6 +11,7 @@
 #include <packet.h>
 #include <pmd.h>
 
+#include <cstring>
 #include <memory>
 #include <numeric>
 
@@ -86,6 +87,125 @@ TEST(BasicMachnetEngineSharedStateTest, SrcPortAlloc) {
   EXPECT_FALSE(port.has_value());
 }
 
+TEST(BasicMachnetEngineSharedStateTest, SrcPortAllocSteered) {
+  using EthAddr = juggler::net::Ethernet::Address;
+  using Ipv4Addr = juggler::net::Ipv4::Address;
+  using UdpPort = juggler::net::Udp::Port;
+  using MachnetEngineSharedState = juggler::MachnetEngineSharedState;
+
+  EthAddr test_mac{"00:00:00:00:00:01"};
+  Ipv4Addr test_ip;
+  test_ip.FromString("10.0.0.1");
+
+  // 3 queues: 4 blocks of 16384 ports, the last one served by queue 0.
+  const size_t kRxQueuesNr = 3;
+  const size_t kSrcPortMin = MachnetEngineSharedState::kSrcPortMin;
+  const size_t block_size =
+      MachnetEngineSharedState::PortSteeringBlockSize(kRxQueuesNr);
+  EXPECT_EQ(MachnetEngineSharedState::PortSteeringBlocksNr(kRxQueuesNr), 4);
+  EXPECT_EQ(block_size, 16384);
+
+  MachnetEngineSharedState state({}, {test_mac}, {test_ip});
+  state.EnablePortSteering(kRxQueuesNr);
+  EXPECT_TRUE(state.IsPortSteeringEnabled());
+  // A listener in the block of queue 0.
+  EXPECT_TRUE(state.RegisterListener(test_ip, UdpPort(2000), 1));
+
+  std::vector<size_t> allocated(kRxQueuesNr, 0);
+  for (size_t q = 0; q < kRxQueuesNr; q++) {
+    do {
+      auto port = state.SrcPortAllocSteered(test_ip, q);
+      if (!port.has_value()) break;
+      const auto p = port.value().port.value();
+      EXPECT_GE(p, kSrcPortMin);
+      EXPECT_NE(p, 2000);
+      EXPECT_EQ((p / block_size) % kRxQueuesNr, q) << p;
+      allocated[q]++;
+    } while (true);
+  }
+  EXPECT_EQ(allocated[0], 2 * block_size - kSrcPortMin - 1);
+  EXPECT_EQ(allocated[1], block_size);
+  EXPECT_EQ(allocated[2], block_size);
+
+  // Released ports are found again, wherever the last search stopped.
+  state.SrcPortRelease(test_ip, UdpPort(5000));
+  state.SrcPortRelease(test_ip, UdpPort(60000));
+  EXPECT_EQ(state.SrcPortAllocSteered(test_ip, 0).value(), UdpPort(5000));
+  EXPECT_EQ(state.SrcPortAllocSteered(test_ip, 0).value(), UdpPort(60000));
+  EXPECT_FALSE(state.SrcPortAllocSteered(test_ip, 0).has_value());
+}
+
+TEST(BasicMachnetEngineSharedStateTest, DirectQueue) {
+  using EthAddr = juggler::net::Ethernet::Address;
+  using Ipv4Addr = juggler::net::Ipv4::Address;
+  using UdpPort = juggler::net::Udp::Port;
+  using MachnetEngineSharedState = juggler::MachnetEngineSharedState;
+
+  EthAddr test_mac{"00:00:00:00:00:01"};
+  EthAddr remote_mac{"00:00:00:00:00:02"};
+  Ipv4Addr test_ip, remote_ip, unknown_ip;
+  test_ip.FromString("10.0.0.1");
+  remote_ip.FromString("10.0.0.2");
+  unknown_ip.FromString("10.0.0.3");
+
+  // 2 engine queues and a direct one: the direct queue serves block 2.
+  const size_t kRxQueuesNr = 3;
+  const size_t kDirectQueue = 2;
+  MachnetEngineSharedState state({}, {test_mac}, {test_ip});
+  state.EnablePortSteering(kRxQueuesNr);
+  state.ReservePortSteeringQueue(kDirectQueue);
+  EXPECT_EQ(state.PortSteeringQueue(UdpPort(40000)), kDirectQueue);
+  EXPECT_EQ(state.PortSteeringQueue(UdpPort(60000)), 0);
+  EXPECT_FALSE(state.SrcPortAllocSteered(test_ip, kDirectQueue).has_value());
+  EXPECT_FALSE(state.RegisterListener(test_ip, UdpPort(40000), 0));
+  EXPECT_TRUE(state.SrcPortAllocSteered(test_ip, 0).has_value());
+  EXPECT_TRUE(state.SrcPortAllocSteered(test_ip, 1).has_value());
+
+  // An engine outside of the controller resolves addresses through it.
+  size_t resolves = 0;
+  bool unknown_resolved = false;
+  std::vector<std::pair<UdpPort, bool>> steered;
+  state.SetDelegate(
+      {[&](const Ipv4Addr &local_ip,
+           const Ipv4Addr &ip) -> std::optional<EthAddr> {
+         EXPECT_EQ(local_ip, test_ip);
+         resolves++;
+         if (ip == remote_ip || unknown_resolved) return remote_mac;
+         return std::nullopt;
+       },
+       [&](const Ipv4Addr &ip, const UdpPort &port, bool listen) {
+         steered.emplace_back(port, listen);
+         return true;
+       }});
+  EXPECT_TRUE(state.IsDelegated());
+
+  auto reader = state.NewArpTableReader();
+  EXPECT_EQ(state.GetL2Addr(reader.get(), nullptr, test_ip, remote_ip),
+            remote_mac);
+  EXPECT_EQ(MachnetEngineSharedState::LookupL2Addr(reader.get(), remote_ip),
+            remote_mac);
+  EXPECT_EQ(resolves, 1);
+
+  // An address that is not known yet is asked for once, and again by the
+  // maintenance of the table.
+  EXPECT_FALSE(state.GetL2Addr(reader.get(), nullptr, test_ip, unknown_ip)
+                   .has_value());
+  EXPECT_FALSE(state.GetL2Addr(reader.get(), nullptr, test_ip, unknown_ip)
+                   .has_value());
+  EXPECT_EQ(resolves, 2);
+  unknown_resolved = true;
+  state.MaintainArpTable(reader.get(), nullptr);
+  EXPECT_EQ(resolves, 3);
+  EXPECT_EQ(MachnetEngineSharedState::LookupL2Addr(reader.get(), unknown_ip),
+            remote_mac);
+
+  EXPECT_TRUE(state.SteerListener(test_ip, UdpPort(2000), true));
+  EXPECT_TRUE(state.SteerListener(test_ip, UdpPort(2000), false));
+  ASSERT_EQ(steered.size(), 2);
+  EXPECT_TRUE(steered[0].second);
+  EXPECT_FALSE(steered[1].second);
+}
+
 TEST(BasicMachnetEngineTest, BasicMachnetEngineTest) {
   using PmdPort = juggler::dpdk::PmdPort;
   using MachnetEngine = juggler::MachnetEngine;
@@ -106,8 +226,74 @@ TEST(BasicMachnetEngineTest, BasicMachnetEngineTest) {
   const uint32_t kRingDescNr = 1024;
   auto pmd_port = std::make_shared<PmdPort>(0, 1, 1, kRingDescNr, kRingDescNr);
   pmd_port->InitDriver();
-  MachnetEngine engine(pmd_port, 0, 0, shared_state, {channel});
-  EXPECT_EQ(engine.GetChannelCount(), 1);
+  {
+    MachnetEngine engine(pmd_port, 0, 0, shared_state, {channel});
+    EXPECT_EQ(engine.GetChannelCount(), 1);
+    EXPECT_FALSE(engine.tx_zerocopy());
+  }
+
+  // Options are set by name; the others keep their defaults.
+  MachnetEngine engine(pmd_port, 0, 0, shared_state, {channel},
+                       {.tx_zerocopy = true, .tx_zerocopy_threshold = 256});
+  EXPECT_TRUE(engine.tx_zerocopy());
+  EXPECT_EQ(engine.tx_zerocopy_threshold(), 256);
+  EXPECT_FALSE(engine.rx_zerocopy());
+}
+
+TEST(BasicMachnetEngineTest, IcmpEchoReply) {
+  using juggler::net::Ethernet;
+  using juggler::net::Icmp;
+  using juggler::net::Ipv4;
+
+  juggler::dpdk::PacketPool pool(64);
+  Ethernet::Address local_mac("00:00:00:00:00:01");
+  Ethernet::Address remote_mac("00:00:00:00:00:02");
+  Ipv4::Address local_ip, remote_ip;
+  local_ip.FromString("10.0.0.1");
+  remote_ip.FromString("10.0.0.2");
+
+  // A ping with a payload.
+  constexpr size_t kPayloadLen = 56;
+  constexpr size_t kLen =
+      sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Icmp) + kPayloadLen;
+  auto *request = CHECK_NOTNULL(pool.PacketAlloc());
+  auto *eh = request->append<Ethernet *>(kLen);
+  eh->dst_addr = local_mac;
+  eh->src_addr = remote_mac;
+  eh->eth_type = juggler::be16_t(Ethernet::kIpv4);
+  auto *ipv4h = reinterpret_cast<Ipv4 *>(eh + 1);
+  ipv4h->next_proto_id = Ipv4::kIcmp;
+  ipv4h->src_addr = remote_ip;
+  ipv4h->dst_addr = local_ip;
+  auto *icmph = reinterpret_cast<Icmp *>(ipv4h + 1);
+  icmph->type = Icmp::kEchoRequest;
+  icmph->id = juggler::be16_t(7);
+  icmph->seq = juggler::be16_t(3);
+  auto *payload = reinterpret_cast<uint8_t *>(icmph + 1);
+  std::iota(payload, payload + kPayloadLen, 0);
+
+  auto *reply =
+      juggler::MachnetEngine::IcmpEchoReply(request, &pool, local_mac);
+  ASSERT_NE(reply, nullptr);
+  ASSERT_EQ(reply->length(), kLen);
+  const auto *reply_eh = reply->head_data<Ethernet *>();
+  EXPECT_EQ(reply_eh->dst_addr, remote_mac);
+  EXPECT_EQ(reply_eh->src_addr, local_mac);
+  const auto *reply_ipv4h = reinterpret_cast<const Ipv4 *>(reply_eh + 1);
+  EXPECT_EQ(reply_ipv4h->src_addr, local_ip);
+  EXPECT_EQ(reply_ipv4h->dst_addr, remote_ip);
+  const auto *reply_icmph = reinterpret_cast<const Icmp *>(reply_ipv4h + 1);
+  EXPECT_EQ(reply_icmph->type, Icmp::kEchoReply);
+  EXPECT_EQ(reply_icmph->id.value(), 7);
+  EXPECT_EQ(reply_icmph->seq.value(), 3);
+  EXPECT_EQ(std::memcmp(reply_icmph + 1, payload, kPayloadLen), 0);
+  juggler::dpdk::Packet::Free(reply);
+
+  // Anything but echo requests goes unanswered.
+  icmph->type = Icmp::kEchoReply;
+  EXPECT_EQ(juggler::MachnetEngine::IcmpEchoReply(request, &pool, local_mac),
+            nullptr);
+  juggler::dpdk::Packet::Free(request);
 }
 
 int main(int argc, char **argv) {
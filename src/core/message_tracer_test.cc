@@ -0,0 +1,136 @@
+/**
+ * @file message_tracer_test.cc
+ *
+ * Unit tests for the MessageTracer class.
+ */
+#include <channel.h>
+#include <dpdk.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <machnet_common.h>
+#include <message_tracer.h>
+#include <ttime.h>
+#include <utils.h>
+
+#include <memory>
+
+namespace juggler {
+
+class MessageTracerTest : public ::testing::Test {
+ protected:
+  static constexpr const char *kChannelName = "message_tracer_test";
+
+  void SetUp() override {
+    CHECK(channel_mgr_.AddChannel(kChannelName, 1 << 8, 1 << 8, 1 << 10,
+                                  1 << 11));
+    channel_ = channel_mgr_.GetChannel(kChannelName);
+  }
+
+  void TearDown() override {
+    channel_.reset();
+    channel_mgr_.DestroyChannel(kChannelName);
+  }
+
+  shm::MsgBuf *Alloc() { return CHECK_NOTNULL(channel_->MsgBufAlloc()); }
+
+  shm::ChannelManager<shm::Channel> channel_mgr_;
+  std::shared_ptr<shm::Channel> channel_;
+};
+
+TEST_F(MessageTracerTest, Sampling) {
+  MessageTracer disabled;
+  EXPECT_FALSE(disabled.enabled());
+
+  MessageTracer tracer(4);
+  ASSERT_TRUE(tracer.enabled());
+  size_t traced = 0;
+  for (int i = 0; i < 16; i++) {
+    auto *msg = Alloc();
+    tracer.OnDequeue(msg, time::rdtsc());
+    if (msg->is_traced()) {
+      traced++;
+      EXPECT_NE(msg->trace_tsc(), 0);
+    } else {
+      EXPECT_EQ(msg->trace_tsc(), 0);
+    }
+    CHECK(channel_->MsgBufFree(msg));
+  }
+  EXPECT_EQ(traced, 4);
+}
+
+TEST_F(MessageTracerTest, Stages) {
+  MessageTracer tracer(1);
+  const uint64_t now = time::rdtsc();
+  const uint64_t kCycles = 100000;
+
+  // Not stamped by the application (e.g., an inline message): no `kAppRing'.
+  auto *msg = Alloc();
+  tracer.OnDequeue(msg, now);
+  ASSERT_TRUE(msg->is_traced());
+  tracer.OnTransmit(msg, now + kCycles);
+  // Only the first transmission counts.
+  tracer.OnTransmit(msg, now + 2 * kCycles);
+  CHECK(channel_->MsgBufFree(msg));
+
+  auto *rx = Alloc();
+  tracer.OnReceive(rx, 1000, 3000, now);
+  // Clocks out of sync: no `kWire'.
+  tracer.OnReceive(rx, 3000, 1000, now);
+  tracer.OnDeliver(rx, now + kCycles);
+  CHECK(channel_->MsgBufFree(rx));
+
+  tracer.Summarize();
+  const uint64_t expected_ns = time::cycles_to_ns(kCycles);
+  EXPECT_EQ(tracer.GetSummary(MessageTracer::kAppRing).count, 0);
+  const auto &engine_tx = tracer.GetSummary(MessageTracer::kEngineTx);
+  EXPECT_EQ(engine_tx.count, 1);
+  EXPECT_NEAR(engine_tx.max_ns, expected_ns, expected_ns / 100 + 1);
+  const auto &wire = tracer.GetSummary(MessageTracer::kWire);
+  EXPECT_EQ(wire.count, 1);
+  EXPECT_EQ(wire.max_ns, 2000);
+  EXPECT_EQ(tracer.GetSummary(MessageTracer::kReassembly).count, 1);
+
+  // The next interval starts over.
+  tracer.Summarize();
+  EXPECT_EQ(tracer.GetSummary(MessageTracer::kEngineTx).count, 0);
+}
+
+TEST_F(MessageTracerTest, AppDequeues) {
+  MessageTracer tracer(1);
+  channel_->SetTracing(true);
+  auto *ctx = channel_->ctx();
+  EXPECT_EQ(ctx->trace_ctx.enabled, 1);
+
+  // A message delivered now, and dequeued by the application right away.
+  auto *msg = Alloc();
+  tracer.OnDequeue(msg, time::rdtsc());
+  __machnet_trace_dequeue(ctx, reinterpret_cast<MachnetMsgBuf_t *>(msg));
+  ctx->trace_ctx.app_dequeue_cycles[20] += 2;
+
+  tracer.CollectAppDequeues(channel_.get());
+  tracer.Summarize();
+  const auto &summary = tracer.GetSummary(MessageTracer::kAppDequeue);
+  EXPECT_EQ(summary.count, 3);
+  // Each counts as the middle of its bucket.
+  const uint64_t expected_ns = time::cycles_to_ns((3ULL << 20) / 2);
+  EXPECT_NEAR(summary.max_ns, expected_ns, expected_ns / 100 + 1);
+  // The buckets were taken.
+  for (size_t bucket = 0; bucket < MACHNET_TRACE_BUCKETS; bucket++) {
+    EXPECT_EQ(ctx->trace_ctx.app_dequeue_cycles[bucket], 0);
+  }
+  CHECK(channel_->MsgBufFree(msg));
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+
+  auto kEalOpts = juggler::utils::CmdLineOpts(
+      {"-c", "0x0", "-n", "6", "--proc-type=auto", "-m", "1024", "--log-level",
+       "8", "--no-pci"});
+  auto d = juggler::dpdk::Dpdk();
+  d.InitDpdk(kEalOpts);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,74 @@
+/**
+ * @file multipath_test.cc
+ *
+ * Unit tests for the per-path congestion state of multipath flows.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <multipath.h>
+
+namespace juggler {
+namespace net {
+namespace flow {
+
+TEST(MultipathTest, PathPort) {
+  const uint16_t port = 4242;
+  EXPECT_EQ(Multipath::PathPort(port, 0), port);
+  for (uint8_t p = 1; p < Multipath::kMaxPaths; p++) {
+    const auto path_port = Multipath::PathPort(port, p);
+    EXPECT_NE(path_port, port);
+    EXPECT_EQ(Multipath::PathPort(path_port, p), port);
+    for (uint8_t q = 1; q < p; q++) {
+      EXPECT_NE(path_port, Multipath::PathPort(port, q));
+    }
+  }
+}
+
+TEST(MultipathTest, SpreadAndAck) {
+  Multipath multipath(2);
+  const uint32_t wnd = multipath.effective_wnd();
+  EXPECT_EQ(wnd, 2 * static_cast<uint32_t>(swift::Pcb::kInitialCwnd));
+
+  // New packets alternate between two paths of equal windows.
+  for (uint32_t seqno = 0; seqno < wnd; seqno++) {
+    multipath.OnSend(seqno, multipath.PickPath());
+  }
+  EXPECT_EQ(multipath.inflight(0), wnd / 2);
+  EXPECT_EQ(multipath.inflight(1), wnd / 2);
+  EXPECT_EQ(multipath.effective_wnd(), 0);
+
+  // A retransmission moves the packet to the path it is resent on.
+  multipath.OnSend(0, 1);
+  EXPECT_EQ(multipath.inflight(0), wnd / 2 - 1);
+  EXPECT_EQ(multipath.inflight(1), wnd / 2 + 1);
+
+  // A cumulative ACK frees the packets on the paths that carried them.
+  multipath.OnAck(1000, 0, wnd, 10000, 0, 0);
+  EXPECT_EQ(multipath.inflight(0), 0);
+  EXPECT_EQ(multipath.inflight(1), 0);
+  EXPECT_GT(multipath.effective_wnd(), 0);
+  EXPECT_EQ(multipath.path(0).srtt_ns, 10000);
+  EXPECT_EQ(multipath.path(1).srtt_ns, 0);
+}
+
+TEST(MultipathTest, LossBacksOffOnePath) {
+  Multipath multipath(2);
+  multipath.OnSend(0, 0);
+  multipath.OnSend(1, 1);
+  const auto cwnd = multipath.path(1).cwnd;
+  multipath.OnLoss(1, 1000000000, /*rto=*/true);
+  EXPECT_LT(multipath.path(1).cwnd, cwnd);
+  EXPECT_EQ(multipath.path(0).cwnd, cwnd);
+  // New packets avoid the path that backed off.
+  EXPECT_EQ(multipath.PickPath(), 0);
+}
+
+}  // namespace flow
+}  // namespace net
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,113 @@
+/**
+ * @file neighbor_table_test.cc
+ *
+ * Unit tests for the NeighborTable class.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <neighbor_table.h>
+
+#include <vector>
+
+namespace juggler {
+
+using Ipv4 = net::Ipv4;
+using Ethernet = net::Ethernet;
+
+constexpr uint64_t kSec = NeighborTable::kMaintenanceIntervalNs;
+
+static Ipv4::Address Ip(const char *str) {
+  Ipv4::Address addr;
+  CHECK(addr.FromString(str));
+  return addr;
+}
+
+class NeighborTableTest : public ::testing::Test {
+ protected:
+  // Run maintenance at `now_ns', and return the addresses it requested.
+  std::vector<Ipv4::Address> Maintain(uint64_t now_ns) {
+    std::vector<Ipv4::Address> requested;
+    table_.Maintain(reader_.get(), now_ns,
+                    [&](const Ipv4::Address &local_ip,
+                        const Ipv4::Address &ip) {
+                      EXPECT_EQ(local_ip, local_ip_);
+                      requested.push_back(ip);
+                    });
+    return requested;
+  }
+
+  const Ipv4::Address local_ip_ = Ip("10.0.0.1");
+  const Ipv4::Address peer_ = Ip("10.0.0.2");
+  const Ethernet::Address peer_l2addr_{"00:11:22:33:44:55"};
+  NeighborTable table_;
+  std::unique_ptr<NeighborTable::Reader> reader_ = table_.NewReader();
+};
+
+TEST_F(NeighborTableTest, ResolveAndLearn) {
+  EXPECT_FALSE(NeighborTable::Lookup(reader_.get(), peer_).has_value());
+  // Only the first miss sends a request.
+  EXPECT_TRUE(table_.Resolve(reader_.get(), local_ip_, peer_, kSec));
+  EXPECT_FALSE(table_.Resolve(reader_.get(), local_ip_, peer_, kSec));
+  EXPECT_FALSE(NeighborTable::Lookup(reader_.get(), peer_).has_value());
+
+  // Other readers see the reply learned by one.
+  auto other = table_.NewReader();
+  other->Get();
+  EXPECT_TRUE(table_.Learn(reader_.get(), local_ip_, peer_, peer_l2addr_,
+                           2 * kSec));
+  EXPECT_TRUE(other->Updated());
+  EXPECT_EQ(NeighborTable::Lookup(other.get(), peer_), peer_l2addr_);
+  EXPECT_FALSE(other->Updated());
+
+  // Confirmations before a refresh is due change nothing.
+  EXPECT_TRUE(table_.Learn(reader_.get(), local_ip_, peer_, peer_l2addr_,
+                           3 * kSec));
+  EXPECT_FALSE(other->Updated());
+}
+
+TEST_F(NeighborTableTest, RetryAndGiveUp) {
+  table_.Resolve(reader_.get(), local_ip_, peer_, 0);
+  EXPECT_EQ(Maintain(kSec), std::vector<Ipv4::Address>{peer_});
+  // At most once per interval, whichever threads call it.
+  EXPECT_TRUE(Maintain(kSec + kSec / 2).empty());
+  EXPECT_EQ(Maintain(2 * kSec), std::vector<Ipv4::Address>{peer_});
+  EXPECT_TRUE(Maintain(NeighborTable::kResolveTimeoutNs).empty());
+  EXPECT_TRUE(reader_->Get().empty());
+
+  // Neighbors added ahead of time keep being requested.
+  EXPECT_TRUE(table_.AddNeighbor(local_ip_, peer_, 10 * kSec));
+  EXPECT_FALSE(table_.AddNeighbor(local_ip_, peer_, 10 * kSec));
+  EXPECT_EQ(Maintain(100 * kSec), std::vector<Ipv4::Address>{peer_});
+}
+
+TEST_F(NeighborTableTest, RefreshAndExpire) {
+  table_.Learn(reader_.get(), local_ip_, peer_, peer_l2addr_, 0);
+  EXPECT_TRUE(Maintain(kSec).empty());
+  // Refreshed once due, while it still resolves.
+  const auto refresh = NeighborTable::kRefreshNs;
+  EXPECT_EQ(Maintain(refresh), std::vector<Ipv4::Address>{peer_});
+  EXPECT_EQ(NeighborTable::Lookup(reader_.get(), peer_), peer_l2addr_);
+  table_.Learn(reader_.get(), local_ip_, peer_, peer_l2addr_, refresh);
+  EXPECT_TRUE(Maintain(refresh + kSec).empty());
+
+  // Unconfirmed addresses expire.
+  const auto expiry = refresh + NeighborTable::kLifetimeNs;
+  EXPECT_EQ(Maintain(expiry - kSec), std::vector<Ipv4::Address>{peer_});
+  EXPECT_TRUE(Maintain(expiry).empty());
+  EXPECT_FALSE(NeighborTable::Lookup(reader_.get(), peer_).has_value());
+
+  // Unless added ahead of time: the last address known is kept.
+  table_.Learn(reader_.get(), local_ip_, peer_, peer_l2addr_, expiry);
+  table_.AddNeighbor(local_ip_, peer_, expiry);
+  EXPECT_EQ(Maintain(expiry + 10 * NeighborTable::kLifetimeNs),
+            std::vector<Ipv4::Address>{peer_});
+  EXPECT_EQ(NeighborTable::Lookup(reader_.get(), peer_), peer_l2addr_);
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,156 @@
+/**
+ * @file packet_capture_test.cc
+ *
+ * Unit tests for the PacketCapture and RingReader classes.
+ */
+#include <capture_ring.h>
+#include <ether.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <ipv4.h>
+#include <machnet_pkthdr.h>
+#include <packet_capture.h>
+#include <ttime.h>
+#include <udp.h>
+
+#include <array>
+#include <cstring>
+#include <vector>
+
+namespace juggler {
+namespace capture {
+
+static constexpr char kTestRingName[] = "machnet-capture-test";
+static constexpr uint32_t kLocalIp = 0x0a000001;
+static constexpr uint32_t kRemoteIp = 0x0a000002;
+
+// A Machnet packet, with a payload of `payload' bytes.
+static std::vector<uint8_t> MakePacket(uint32_t src_ip, uint16_t src_port,
+                                       uint32_t dst_ip, uint16_t dst_port,
+                                       net::MachnetPktHdr::MachnetFlags flags,
+                                       size_t payload = 0) {
+  std::vector<uint8_t> pkt(sizeof(net::Ethernet) + sizeof(net::Ipv4) +
+                               sizeof(net::Udp) + sizeof(net::MachnetPktHdr) +
+                               payload,
+                           0);
+  auto *eh = reinterpret_cast<net::Ethernet *>(pkt.data());
+  eh->eth_type = be16_t(net::Ethernet::kIpv4);
+  auto *ipv4h = reinterpret_cast<net::Ipv4 *>(eh + 1);
+  ipv4h->next_proto_id = net::Ipv4::kUdp;
+  ipv4h->src_addr = net::Ipv4::Address(src_ip);
+  ipv4h->dst_addr = net::Ipv4::Address(dst_ip);
+  auto *udph = reinterpret_cast<net::Udp *>(ipv4h + 1);
+  udph->src_port = net::Udp::Port(src_port);
+  udph->dst_port = net::Udp::Port(dst_port);
+  auto *mh = reinterpret_cast<net::MachnetPktHdr *>(udph + 1);
+  mh->magic = be16_t(net::MachnetPktHdr::kMagic);
+  mh->net_flags = flags;
+  return pkt;
+}
+
+class PacketCaptureTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    writer_ = PacketCapture::Create(kTestRingName, 16);
+    ASSERT_NE(writer_, nullptr);
+    reader_ = RingReader::Open(kTestRingName);
+    ASSERT_NE(reader_, nullptr);
+  }
+
+  void Capture(const std::vector<uint8_t> &pkt, Direction direction = kRx) {
+    writer_->Capture(pkt.data(), pkt.size(), pkt.size(), direction);
+  }
+
+  std::vector<Record> Drain() {
+    std::vector<Record> records;
+    reader_->Drain([&records](const Record &r) { records.push_back(r); });
+    return records;
+  }
+
+  std::unique_ptr<PacketCapture> writer_;
+  std::unique_ptr<RingReader> reader_;
+};
+
+TEST_F(PacketCaptureTest, Idle) {
+  using Flags = net::MachnetPktHdr::MachnetFlags;
+  writer_->BeginIteration();
+  EXPECT_FALSE(writer_->active());
+  Capture(MakePacket(kLocalIp, 1, kRemoteIp, 2, Flags::kData));
+  EXPECT_TRUE(Drain().empty());
+  EXPECT_EQ(reader_->header().captured, 0);
+}
+
+TEST_F(PacketCaptureTest, Filter) {
+  using Flags = net::MachnetPktHdr::MachnetFlags;
+  Filter filter{};
+  filter.ip[0] = kLocalIp;
+  filter.port[1] = 2;
+  filter.flags = static_cast<uint8_t>(Flags::kSyn);
+  filter.flags_mask = static_cast<uint8_t>(Flags::kSyn);
+  filter.directions = kRx;
+  reader_->Start(filter);
+  writer_->BeginIteration();
+  ASSERT_TRUE(writer_->active());
+
+  // Either way between the endpoints.
+  Capture(MakePacket(kLocalIp, 1, kRemoteIp, 2, Flags::kSyn));
+  Capture(MakePacket(kRemoteIp, 2, kLocalIp, 1, Flags::kSynAck));
+  // Wrong port, flags or direction.
+  Capture(MakePacket(kLocalIp, 1, kRemoteIp, 3, Flags::kSyn));
+  Capture(MakePacket(kLocalIp, 1, kRemoteIp, 2, Flags::kData));
+  Capture(MakePacket(kLocalIp, 1, kRemoteIp, 2, Flags::kSyn), kTx);
+
+  const auto records = Drain();
+  ASSERT_EQ(records.size(), 2);
+  EXPECT_EQ(records[0].direction, kRx);
+  EXPECT_EQ(records[0].orig_len, records[0].cap_len);
+  const auto *udph = reinterpret_cast<const net::Udp *>(
+      records[1].data + sizeof(net::Ethernet) + sizeof(net::Ipv4));
+  EXPECT_EQ(udph->src_port.port.value(), 2);
+}
+
+TEST_F(PacketCaptureTest, Limits) {
+  using Flags = net::MachnetPktHdr::MachnetFlags;
+  Filter filter{};
+  filter.sample_every = 2;
+  filter.budget = 4;
+  reader_->Start(filter);
+
+  // Snap length, sampling and budget.
+  writer_->BeginIteration();
+  const auto big = MakePacket(kLocalIp, 1, kRemoteIp, 2, Flags::kData, 1000);
+  for (int i = 0; i < 10; i++) Capture(big);
+  auto records = Drain();
+  ASSERT_EQ(records.size(), 4);
+  EXPECT_EQ(records[0].orig_len, big.size());
+  EXPECT_EQ(records[0].cap_len, Record::kSnapLen);
+  EXPECT_EQ(std::memcmp(records[0].data, big.data(), Record::kSnapLen), 0);
+  EXPECT_EQ(reader_->header().skipped, 1);
+
+  // The ring is full: the engine never waits for the reader.
+  const auto small = MakePacket(kLocalIp, 1, kRemoteIp, 2, Flags::kData);
+  for (int i = 0; i < 10; i++) {
+    writer_->BeginIteration();
+    for (int j = 0; j < 8; j++) Capture(small);
+  }
+  EXPECT_EQ(Drain().size(), 16);
+  EXPECT_EQ(reader_->header().drops, 40 - 16);
+  EXPECT_EQ(reader_->header().captured, 4 + 16);
+
+  // Stopped.
+  reader_->Stop();
+  writer_->BeginIteration();
+  EXPECT_FALSE(writer_->active());
+  Capture(small);
+  EXPECT_TRUE(Drain().empty());
+}
+
+}  // namespace capture
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  juggler::time::tsc_hz = juggler::time::estimate_tsc_hz();
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,88 @@
+/**
+ * @file rcu_test.cc
+ *
+ * Unit tests for the RcuValue class.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <rcu.h>
+
+#include <atomic>
+#include <map>
+#include <thread>
+
+namespace juggler {
+
+TEST(RcuValueTest, ReadUpdate) {
+  RcuValue<std::map<int, int>> value;
+  RcuValue<std::map<int, int>>::Reader reader(&value);
+  EXPECT_TRUE(reader.Get().empty());
+
+  value.Update([](auto &map) {
+    map[1] = 10;
+    return true;
+  });
+  EXPECT_EQ(reader.Get().at(1), 10);
+
+  // Updates that change nothing are not published.
+  const auto retired = value.GetRetiredCount();
+  value.Update([](auto &) { return false; });
+  EXPECT_EQ(value.GetRetiredCount(), retired);
+  EXPECT_EQ(reader.Get().size(), 1);
+}
+
+TEST(RcuValueTest, Reclaim) {
+  RcuValue<int> value(0);
+  RcuValue<int>::Reader reader1(&value);
+  EXPECT_EQ(reader1.Get(), 0);
+  {
+    RcuValue<int>::Reader reader2(&value);
+    EXPECT_EQ(reader2.Get(), 0);
+    value.Update([](int &v) { return ++v; });
+    // Both readers may still be using version 0.
+    EXPECT_EQ(value.GetRetiredCount(), 1);
+    EXPECT_EQ(reader1.Get(), 1);
+    value.Update([](int &v) { return ++v; });
+    // Version 0 is still in use by reader 2.
+    EXPECT_EQ(value.GetRetiredCount(), 2);
+  }
+  // Reader 2 is gone, and reader 1 moved past version 0.
+  EXPECT_EQ(value.GetRetiredCount(), 1);
+  EXPECT_EQ(reader1.Get(), 2);
+  value.Update([](int &v) { return ++v; });
+  EXPECT_EQ(value.GetRetiredCount(), 1);
+  // Without other writers, trying to update does not give up.
+  EXPECT_TRUE(value.TryUpdate([](int &) { return false; }));
+}
+
+TEST(RcuValueTest, ConcurrentReaders) {
+  RcuValue<std::vector<int>> value(std::vector<int>(16, 0));
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&value, &stop]() {
+      RcuValue<std::vector<int>>::Reader reader(&value);
+      while (!stop.load(std::memory_order_relaxed)) {
+        // Every version is consistent: all its elements are equal.
+        const auto &v = reader.Get();
+        for (const auto x : v) ASSERT_EQ(x, v.front());
+      }
+    });
+  }
+  for (int i = 1; i <= 10000; i++) {
+    value.Update([i](auto &v) {
+      std::fill(v.begin(), v.end(), i);
+      return true;
+    });
+  }
+  stop = true;
+  for (auto &thread : threads) thread.join();
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,88 @@
+/**
+ * @file slab_pool_test.cc
+ *
+ * Unit tests for the SlabPool and SlabAllocator classes.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <slab_pool.h>
+
+#include <list>
+#include <set>
+#include <vector>
+
+namespace juggler {
+
+TEST(SlabPoolTest, AllocFree) {
+  SlabPool pool(4);
+  pool.Fit(100, 8);
+  EXPECT_EQ(pool.GetCapacity(), 0);
+  EXPECT_GE(pool.GetBlockSize(), 100);
+
+  std::set<void *> blocks;
+  for (int i = 0; i < 6; i++) blocks.insert(pool.Alloc());
+  EXPECT_EQ(blocks.size(), 6);
+  EXPECT_EQ(pool.GetInUseCount(), 6);
+  EXPECT_EQ(pool.GetCapacity(), 8);
+  for (auto *block : blocks) {
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(block) % 8, 0);
+  }
+
+  // Freed blocks are reused, without growing the pool.
+  auto *block = *blocks.begin();
+  pool.Free(block);
+  EXPECT_EQ(pool.Alloc(), block);
+  for (auto *b : blocks) pool.Free(b);
+  EXPECT_EQ(pool.GetInUseCount(), 0);
+  for (int i = 0; i < 8; i++) pool.Alloc();
+  EXPECT_EQ(pool.GetCapacity(), 8);
+}
+
+TEST(SlabPoolTest, Reserve) {
+  SlabPool pool(16);
+  pool.Fit(64, 64);
+  pool.Reserve(20);
+  EXPECT_EQ(pool.GetCapacity(), 32);
+  std::vector<void *> blocks;
+  for (int i = 0; i < 20; i++) blocks.push_back(pool.Alloc());
+  EXPECT_EQ(pool.GetCapacity(), 32);
+  pool.Reserve(20);
+  EXPECT_EQ(pool.GetCapacity(), 48);
+  for (auto *block : blocks) {
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(block) % 64, 0);
+    pool.Free(block);
+  }
+}
+
+TEST(SlabAllocatorTest, List) {
+  struct Object {
+    explicit Object(int v) : value(v) {}
+    Object(const Object &) = delete;
+    int value;
+    char padding[200];
+  };
+
+  SlabPool pool(8);
+  {
+    std::list<Object, SlabAllocator<Object>> list{SlabAllocator<Object>(&pool)};
+    // The pool was fitted to the nodes of the list, which hold the objects.
+    EXPECT_GT(pool.GetBlockSize(), sizeof(Object));
+    for (int i = 0; i < 10; i++) list.emplace_back(i);
+    EXPECT_EQ(pool.GetInUseCount(), 10);
+    EXPECT_EQ(pool.GetCapacity(), 16);
+    list.pop_front();
+    list.emplace_back(10);
+    EXPECT_EQ(pool.GetCapacity(), 16);
+    int expected = 1;
+    for (const auto &object : list) EXPECT_EQ(object.value, expected++);
+  }
+  EXPECT_EQ(pool.GetInUseCount(), 0);
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
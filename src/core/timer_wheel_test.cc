@@ -0,0 +1,132 @@
+/**
+ * @file timer_wheel_test.cc
+ *
+ * Unit tests for the TimerWheel class.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <timer_wheel.h>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace juggler {
+
+constexpr uint64_t kTick = TimerWheel::kTickCycles;
+
+TEST(TimerWheelTest, FireInOrder) {
+  uint64_t now = 12345 * kTick;
+  TimerWheel wheel(now);
+  std::vector<int> fired;
+  Timer t1([&fired](uint64_t) { fired.push_back(1); });
+  Timer t2([&fired](uint64_t) { fired.push_back(2); });
+  Timer t3([&fired](uint64_t) { fired.push_back(3); });
+
+  wheel.Arm(&t2, now + 20 * kTick);
+  wheel.Arm(&t1, now + 10 * kTick);
+  wheel.Arm(&t3, now + 100000 * kTick);
+  EXPECT_EQ(wheel.size(), 3);
+
+  EXPECT_EQ(wheel.Advance(now + 5 * kTick), 0);
+  EXPECT_EQ(wheel.Advance(now + 10 * kTick), 1);
+  EXPECT_EQ(wheel.Advance(now + 50 * kTick), 1);
+  EXPECT_FALSE(t1.armed());
+  EXPECT_TRUE(t3.armed());
+  EXPECT_EQ(wheel.Advance(now + 99999 * kTick), 0);
+  EXPECT_EQ(wheel.Advance(now + 100000 * kTick), 1);
+  EXPECT_EQ(fired, std::vector<int>({1, 2, 3}));
+  EXPECT_EQ(wheel.size(), 0);
+}
+
+TEST(TimerWheelTest, DisarmAndRearm) {
+  uint64_t now = 0;
+  TimerWheel wheel(now);
+  size_t nfired = 0;
+  Timer timer([&nfired](uint64_t) { nfired++; });
+
+  wheel.Arm(&timer, now + 10 * kTick);
+  timer.Disarm();
+  EXPECT_EQ(wheel.Advance(now + 20 * kTick), 0);
+
+  // Re-arming moves the deadline.
+  wheel.Arm(&timer, now + 30 * kTick);
+  wheel.Arm(&timer, now + 1000 * kTick);
+  EXPECT_EQ(wheel.size(), 1);
+  EXPECT_EQ(wheel.Advance(now + 999 * kTick), 0);
+  EXPECT_EQ(wheel.Advance(now + 1000 * kTick), 1);
+  EXPECT_EQ(nfired, 1);
+
+  // Deadlines in the past fire on the next tick.
+  wheel.Arm(&timer, 0);
+  EXPECT_EQ(wheel.Advance(now + 1001 * kTick), 1);
+}
+
+TEST(TimerWheelTest, CallbacksRearmAndDisarm) {
+  uint64_t now = 7 * kTick;
+  TimerWheel wheel(now);
+  size_t periodic_fired = 0;
+  Timer victim([](uint64_t) { FAIL() << "Disarmed timer fired"; });
+  Timer periodic;
+  periodic.set_callback([&](uint64_t at) {
+    periodic_fired++;
+    victim.Disarm();
+    if (periodic_fired < 5) wheel.Arm(&periodic, at + 3 * kTick);
+  });
+  // Both expire in the same tick; the periodic timer (armed last) fires first
+  // and disarms the victim, which is still pending.
+  wheel.Arm(&victim, now + kTick);
+  wheel.Arm(&periodic, now + kTick);
+  for (uint64_t t = now; t < now + 100 * kTick; t += kTick) wheel.Advance(t);
+  EXPECT_EQ(periodic_fired, 5);
+  EXPECT_EQ(wheel.size(), 0);
+}
+
+TEST(TimerWheelTest, RandomDeadlines) {
+  std::mt19937_64 rng(42);
+  uint64_t now = rng() >> 8;
+  TimerWheel wheel(now);
+  const size_t kNumTimers = 4096;
+  std::vector<uint64_t> deadlines(kNumTimers);
+  std::vector<uint64_t> fired_at(kNumTimers, 0);
+  std::vector<std::unique_ptr<Timer>> timers;
+  std::uniform_int_distribution<uint64_t> dist(0, 1 << 20);
+  for (size_t i = 0; i < kNumTimers; i++) {
+    deadlines[i] = now + dist(rng) * kTick + rng() % kTick;
+    timers.emplace_back(std::make_unique<Timer>(
+        [&fired_at, i](uint64_t at) { fired_at[i] = at; }));
+    wheel.Arm(timers.back().get(), deadlines[i]);
+  }
+
+  // Advance the wheel in irregular steps.
+  const uint64_t end = now + (1 << 20) * kTick + kTick;
+  while (now < end) {
+    now += (rng() % 5000) * kTick / 16;
+    wheel.Advance(now);
+  }
+  wheel.Advance(end);
+
+  EXPECT_EQ(wheel.size(), 0);
+  for (size_t i = 0; i < kNumTimers; i++) {
+    ASSERT_NE(fired_at[i], 0);
+    // Timers never fire early, i.e., before the tick of their deadline.
+    EXPECT_GE(fired_at[i] / kTick, deadlines[i] / kTick) << i;
+  }
+}
+
+TEST(TimerWheelTest, TimerOutlivesWheel) {
+  Timer timer;
+  {
+    TimerWheel wheel(0);
+    wheel.Arm(&timer, 100 * kTick);
+  }
+  EXPECT_FALSE(timer.armed());
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
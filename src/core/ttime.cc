@@ -4,6 +4,7 @@ namespace juggler {
 namespace time {
 
 thread_local uint64_t tsc_hz;
+std::atomic<uint64_t> shared_tsc_hz{0};
 
 }  // namespace time
 }  // namespace juggler
@@ -0,0 +1,102 @@
+/**
+ * @file tx_scheduler_test.cc
+ *
+ * Unit tests for the DrrScheduler class.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <tx_scheduler.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace juggler {
+
+struct Queue {
+  TxSchedState &tx_sched_state() { return state; }
+  uint32_t tx_weight() const { return weight; }
+
+  TxSchedState state{};
+  uint32_t weight{1};
+  uint32_t backlog{0};
+  uint32_t sent{0};
+  uint32_t visits{0};
+};
+
+// Send up to `max_packets' of the backlog, in batches of at most 8 packets.
+auto Serve = [](Queue *queue, uint32_t max_packets) {
+  queue->visits++;
+  const uint32_t n = std::min({queue->backlog, max_packets, 8u});
+  queue->backlog -= n;
+  queue->sent += n;
+  return std::make_pair(n, queue->backlog != 0);
+};
+
+TEST(DrrSchedulerTest, WeightedShares) {
+  DrrScheduler<Queue> scheduler(16);
+  std::vector<Queue> queues(3);
+  for (size_t i = 0; i < queues.size(); i++) {
+    queues[i].weight = i + 1;
+    queues[i].backlog = 100000;
+    scheduler.Activate(&queues[i]);
+  }
+
+  for (int i = 0; i < 100; i++) scheduler.Run(64, Serve);
+  uint32_t total = 0;
+  for (const auto &queue : queues) total += queue.sent;
+  EXPECT_EQ(total, 6400);
+  for (size_t i = 0; i < queues.size(); i++) {
+    // Within one quantum of the fair share.
+    const double share = total * (i + 1) / 6.0;
+    EXPECT_NEAR(queues[i].sent, share, 16 * (i + 1)) << i;
+  }
+}
+
+TEST(DrrSchedulerTest, IdleQueuesAreSkipped) {
+  DrrScheduler<Queue> scheduler(16);
+  Queue busy, idle;
+  busy.backlog = 20;
+  scheduler.Activate(&busy);
+  scheduler.Activate(&busy);
+  EXPECT_EQ(scheduler.size(), 1);
+
+  EXPECT_EQ(scheduler.Run(1000, Serve), 20);
+  EXPECT_TRUE(scheduler.empty());
+  EXPECT_FALSE(busy.state.active);
+  EXPECT_EQ(idle.visits, 0);
+
+  // Nothing to do without active queues.
+  EXPECT_EQ(scheduler.Run(1000, Serve), 0);
+  EXPECT_EQ(busy.visits, 3);
+}
+
+TEST(DrrSchedulerTest, BudgetCarriesOver) {
+  DrrScheduler<Queue> scheduler(64);
+  Queue a, b;
+  a.backlog = b.backlog = 1000;
+  scheduler.Activate(&a);
+  scheduler.Activate(&b);
+
+  // The first queue is still in its turn when the budget runs out, and
+  // resumes it on the next call, without being granted a new quantum.
+  EXPECT_EQ(scheduler.Run(40, Serve), 40);
+  EXPECT_EQ(a.sent, 40);
+  EXPECT_EQ(scheduler.Run(40, Serve), 40);
+  EXPECT_EQ(a.sent, 64);
+  EXPECT_EQ(b.sent, 16);
+
+  scheduler.Remove(&b);
+  EXPECT_EQ(scheduler.size(), 1);
+  EXPECT_FALSE(b.state.active);
+  EXPECT_EQ(scheduler.Run(1000, Serve), 1000 - 64);
+  EXPECT_EQ(b.sent, 16);
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
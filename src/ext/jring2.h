@@ -82,17 +82,19 @@ static __attribute__((always_inline)) inline jring2_entry_t *__jring2_get_slot(
   return (jring2_entry_t *)(ring_slots + idx * ring->slot_size);
 }
 
-/// Internal helper function to insert an element into the next empty slot.
+/// Internal helper function to insert an element into the next empty slot,
+/// and publish it (unless `dd' is 0, in which case the caller publishes it).
 /// Check for space should be done by the caller.
-static __attribute__((always_inline)) inline void __jring2_insert(
-    jring2_t *ring, const void *obj) {
+static __attribute__((always_inline)) inline jring2_entry_t *__jring2_insert(
+    jring2_t *ring, const void *obj, uint32_t dd) {
   jring2_entry_t *slot = __jring2_get_slot(ring, ring->write_idx);
 
   // Memory copy the element.
   memcpy(slot->data, obj, ring->element_size);
   asm volatile("" ::: "memory");
-  slot->dd = 1;
+  slot->dd = dd;
   ring->write_idx = (ring->write_idx + 1) & ring->mask;
+  return slot;
 }
 
 /**
@@ -196,7 +198,7 @@ static inline __attribute__((always_inline)) uint32_t jring2_enqueue(
     }
   }
 
-  __jring2_insert(ring, obj);
+  __jring2_insert(ring, obj, 1);
   ring->free_write_cnt--;
   return 1;
 }
@@ -209,10 +211,12 @@ static inline __attribute__((always_inline)) uint32_t jring2_enqueue(
  * @param obj_table
  *   A pointer to a table of objects.
  * @return
- *   The number of objects enqueued, either 0 or n
+ *   The number of objects enqueued, either 0 or n. The objects become visible
+ *   to the reader all at once.
  */
 static inline __attribute__((always_inline)) uint32_t jring2_enqueue_bulk(
     jring2_t *ring, const void *obj_table, uint32_t n) {
+  if (n == 0) return 0;
   if (ring->free_write_cnt < n) {
     const uint32_t rd_idx = ring->read_idx;
     asm volatile("" ::: "memory");
@@ -227,22 +231,79 @@ static inline __attribute__((always_inline)) uint32_t jring2_enqueue_bulk(
     }
   }
 
+  // The first object is published last: the reader stops at the first slot
+  // that is not done, so it sees either none or all of the objects.
+  jring2_entry_t *first = __jring2_insert(ring, obj_table, 0);
+  for (uint32_t index = 1; index < n; index++) {
+    const uint8_t *src_obj = (uint8_t *)obj_table + index * ring->element_size;
+    __jring2_insert(ring, src_obj, 1);
+  }
+  asm volatile("" ::: "memory");
+  first->dd = 1;
+  ring->free_write_cnt -= n;
+
+  return n;
+}
+
+/**
+ * Enqueue up to a specific amount of objects on a ring.
+ *
+ * @param r
+ *   A pointer to the ring structure.
+ * @param obj_table
+ *   A pointer to a table of objects.
+ * @return
+ *   The number of objects enqueued, ranging [0, n].
+ */
+static inline __attribute__((always_inline)) uint32_t jring2_enqueue_burst(
+    jring2_t *ring, const void *obj_table, uint32_t n) {
+  if (n == 0) return 0;
+  if (ring->free_write_cnt < n) {
+    const uint32_t rd_idx = ring->read_idx;
+    asm volatile("" ::: "memory");
+
+    ring->free_write_cnt =
+        (rd_idx - ring->write_idx + ring->cnt - 1) & ring->mask;
+    if (ring->free_write_cnt < n) n = ring->free_write_cnt;
+    if (n == 0) return 0;
+  }
+
   uint32_t index = 0;
   do {
     const uint8_t *src_obj = (uint8_t *)obj_table + index * ring->element_size;
-    __jring2_insert(ring, src_obj);
+    __jring2_insert(ring, src_obj, 1);
   } while (++index < n);
   ring->free_write_cnt -= n;
 
   return n;
 }
 
+/**
+ * @brief Returns the number of elements enqueued in the ring, as seen by the
+ * reading thread. Unlike `jring2_count()' it does not touch the state of the
+ * writer, and it only reads the writer's index when the ring is not empty.
+ * This could be a conservative estimate (it might be stale).
+ */
+static inline __attribute__((always_inline)) uint32_t jring2_pending(
+    jring2_t *ring) {
+  const jring2_entry_t *slot = __jring2_get_slot(ring, ring->read_idx);
+  if (*(const volatile uint32_t *)&slot->dd == 0) return 0;
+  asm volatile("" ::: "memory");
+
+  // The writer publishes the descriptor before it advances its index.
+  const uint32_t wr_idx = *(const volatile uint64_t *)&ring->write_idx;
+  const uint32_t cnt = (wr_idx - ring->read_idx) & ring->mask;
+  return cnt == 0 ? 1 : cnt;
+}
+
 static __attribute__((always_inline)) inline uint32_t jring2_dequeue(
     jring2_t *ring, void *elem) {
   jring2_entry_t *slot = __jring2_get_slot(ring, ring->read_idx);
-  if (slot->dd == 0) {
+  if (*(volatile uint32_t *)&slot->dd == 0) {
     return 0;
   }
+  // Do not read the element before the descriptor.
+  asm volatile("" ::: "memory");
 
   // Memory copy the element.
   memcpy(elem, slot->data, ring->element_size);
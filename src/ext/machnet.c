@@ -11,10 +11,15 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "machnet_ctrl.h"
@@ -26,6 +31,13 @@
     _a < _b ? _a : _b;      \
   })
 
+#define MAX(a, b)           \
+  ({                        \
+    __typeof__(a) _a = (a); \
+    __typeof__(b) _b = (b); \
+    _a > _b ? _a : _b;      \
+  })
+
 // Main socket/connection to the Machnet controller.
 int g_ctrl_socket = -1;
 
@@ -36,9 +48,14 @@ char g_app_uuid_str[37];
 // Monotonically increasing counter for generating unique IDs.
 static uint32_t msg_id_counter;
 
+// The clock page of the controller, if it has one and the TSC is invariant
+// (see `machnet_clock_ns()').
+static const MachnetClockPage_t *_machnet_clock_page;
+
 /**
  * @brief Helper function to issue control requests to the Machnet controller.
  * @param req  Pointer to the request message (will be sent to the controller).
+ * @param req_fd File descriptor to pass along with the request (-1 for none).
  * @param resp Pointer to the response message buffer; response will be copied
  * there.
  * @param fd   Pointer to the file descriptor location (provided by the caller)
@@ -47,7 +64,7 @@ static uint32_t msg_id_counter;
  * @attention The caller is responsible for allocating the request and response
  * buffers. This function is thread-safe.
  */
-static int _machnet_ctrl_request(machnet_ctrl_msg_t *req,
+static int _machnet_ctrl_request(machnet_ctrl_msg_t *req, int req_fd,
                                  machnet_ctrl_msg_t *resp, int *fd) {
   // We do maintain a global socket to the controller for the duration of the
   // application's lifetime, but we rather open a new connection to the
@@ -80,6 +97,17 @@ static int _machnet_ctrl_request(machnet_ctrl_msg_t *req,
   memset(&msg, 0, sizeof(msg));
   msg.msg_iov = iov;
   msg.msg_iovlen = 1;
+  char req_buf[CMSG_SPACE(sizeof(int))];
+  if (req_fd >= 0) {
+    memset(req_buf, 0, sizeof(req_buf));
+    msg.msg_control = req_buf;
+    msg.msg_controllen = sizeof(req_buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    *((int *)CMSG_DATA(cmsg)) = req_fd;
+  }
 
   int nbytes = sendmsg(sock, &msg, 0);
   if (nbytes != sizeof(*req)) {
@@ -127,66 +155,235 @@ static int _machnet_ctrl_request(machnet_ctrl_msg_t *req,
   return 0;
 }
 
+/*
+ * Buffer caches are thread-local, so that threads sharing a channel neither
+ * race on them nor fall back to the (MP-safe) global buffer pool for every
+ * buffer. Each thread keeps a cache (per buffer size class) for the last few
+ * channels it used, which is refilled from and drained to the channel's global
+ * pools in bulk; the caches of a thread are drained when the thread (or the
+ * process) exits.
+ */
+#define MACHNET_THREAD_CACHES_NR 4
+struct MachnetThreadCtx {
+  struct {
+    MachnetChannelCtx_t *ctx;  // NULL if the slot is unused.
+    MachnetChannelAppBufferCache_t cache[MACHNET_MSGBUF_CLASSES_NR];
+  } caches[MACHNET_THREAD_CACHES_NR];
+  uint32_t next_evict;
+  int registered;  // Whether the exit handler has been set up.
+  uint64_t epoch;  // Detach epoch the caches were last checked at.
+  // Scratch table for the buffer indices of allocations.
+  MachnetRingSlot_t *index_table;
+  uint32_t index_table_size;
+};
+static __thread struct MachnetThreadCtx _machnet_thread_ctx;
+static pthread_key_t _machnet_thread_key;
+static pthread_once_t _machnet_thread_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Channels detached by the application (see `machnet_detach()'). Other threads
+ * may still cache buffers of a detached channel, which is no longer mapped:
+ * their caches must be dropped rather than drained. Each detach bumps the
+ * epoch, and threads that see a new epoch check their caches against the
+ * channels detached since they last looked (see
+ * `_machnet_thread_ctx_revalidate()').
+ */
+#define MACHNET_DETACHED_NR 64
+static struct {
+  pthread_mutex_t lock;
+  uint64_t epoch;  // Number of channels detached so far.
+  // The last channels detached, indexed by epoch.
+  const MachnetChannelCtx_t *ctx[MACHNET_DETACHED_NR];
+} _machnet_detached = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+/**
+ * @brief Returns all the buffers in the thread-local caches (one per size
+ * class) of a channel to the global pools of the channel.
+ */
+static void _machnet_cache_drain(MachnetChannelCtx_t *ctx,
+                                 MachnetChannelAppBufferCache_t *caches) {
+  for (uint32_t cls = 0; cls < MACHNET_MSGBUF_CLASSES_NR; cls++) {
+    MachnetChannelAppBufferCache_t *cache = &caches[cls];
+    if (cache->count == 0) continue;
+    if (unlikely(__machnet_channel_buf_free_bulk(ctx, cache->count,
+                                                 cache->indices) !=
+                 cache->count)) {
+      /*
+       * XXX (ilias): If we reach here, we have failed to free the buffers to
+       * the global pool and we are going to leak them. Terminate execution.
+       */
+      fprintf(stderr, "ERROR: Failed to free buffers to global pool.\n");
+      abort();
+    }
+    cache->count = 0;
+  }
+}
+
+/**
+ * @brief Drops the caches of a thread for the channels detached since it last
+ * checked. If it fell too far behind to tell, it drops all of them (leaking a
+ * few buffers of the channels still attached).
+ */
+static void _machnet_thread_ctx_revalidate(struct MachnetThreadCtx *tctx) {
+  pthread_mutex_lock(&_machnet_detached.lock);
+  const uint64_t epoch = _machnet_detached.epoch;
+  for (uint32_t i = 0; i < MACHNET_THREAD_CACHES_NR; i++) {
+    if (tctx->caches[i].ctx == NULL) continue;
+    int stale = epoch - tctx->epoch > MACHNET_DETACHED_NR;
+    for (uint64_t e = tctx->epoch; !stale && e < epoch; e++) {
+      stale = _machnet_detached.ctx[e % MACHNET_DETACHED_NR] ==
+              tctx->caches[i].ctx;
+    }
+    if (stale) tctx->caches[i].ctx = NULL;
+  }
+  tctx->epoch = epoch;
+  pthread_mutex_unlock(&_machnet_detached.lock);
+}
+
+/**
+ * @brief Drains all the caches of a thread, and releases its scratch memory.
+ */
+static void _machnet_thread_ctx_release(struct MachnetThreadCtx *tctx) {
+  _machnet_thread_ctx_revalidate(tctx);
+  for (uint32_t i = 0; i < MACHNET_THREAD_CACHES_NR; i++) {
+    if (tctx->caches[i].ctx == NULL) continue;
+    _machnet_cache_drain(tctx->caches[i].ctx, tctx->caches[i].cache);
+    tctx->caches[i].ctx = NULL;
+  }
+  free(tctx->index_table);
+  tctx->index_table = NULL;
+  tctx->index_table_size = 0;
+}
+
+static void _machnet_thread_exit(void *arg) {
+  _machnet_thread_ctx_release(arg);
+}
+
+// The main thread does not run the thread-specific destructors on `exit()'.
+static void _machnet_process_exit(void) {
+  _machnet_thread_ctx_release(&_machnet_thread_ctx);
+}
+
+static void _machnet_thread_once_init(void) {
+  if (pthread_key_create(&_machnet_thread_key, _machnet_thread_exit) != 0 ||
+      atexit(_machnet_process_exit) != 0) {
+    fprintf(stderr, "ERROR: Failed to set up thread-local buffer caches.\n");
+    abort();
+  }
+}
+
+/**
+ * @brief Returns the calling thread's buffer caches for a channel (indexed by
+ * size class), evicting the caches of another channel (round-robin) if the
+ * thread uses too many of them.
+ */
+static inline MachnetChannelAppBufferCache_t *_machnet_thread_cache(
+    MachnetChannelCtx_t *ctx) {
+  struct MachnetThreadCtx *tctx = &_machnet_thread_ctx;
+  if (unlikely(tctx->epoch !=
+               __atomic_load_n(&_machnet_detached.epoch, __ATOMIC_ACQUIRE)))
+    _machnet_thread_ctx_revalidate(tctx);
+  for (uint32_t i = 0; i < MACHNET_THREAD_CACHES_NR; i++) {
+    if (likely(tctx->caches[i].ctx == ctx)) return tctx->caches[i].cache;
+  }
+
+  if (unlikely(!tctx->registered)) {
+    pthread_once(&_machnet_thread_once, _machnet_thread_once_init);
+    pthread_setspecific(_machnet_thread_key, tctx);
+    tctx->registered = 1;
+  }
+
+  uint32_t slot = MACHNET_THREAD_CACHES_NR;
+  for (uint32_t i = 0; i < MACHNET_THREAD_CACHES_NR; i++) {
+    if (tctx->caches[i].ctx == NULL) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot == MACHNET_THREAD_CACHES_NR) {
+    slot = tctx->next_evict++ % MACHNET_THREAD_CACHES_NR;
+    _machnet_cache_drain(tctx->caches[slot].ctx, tctx->caches[slot].cache);
+  }
+  tctx->caches[slot].ctx = ctx;
+  for (uint32_t cls = 0; cls < MACHNET_MSGBUF_CLASSES_NR; cls++)
+    tctx->caches[slot].cache[cls].count = 0;
+  return tctx->caches[slot].cache;
+}
+
+/**
+ * @brief Returns the calling thread's scratch table for the indices of `cnt'
+ * buffers, or NULL if it cannot be allocated.
+ */
+static inline MachnetRingSlot_t *_machnet_thread_index_table(uint32_t cnt) {
+  struct MachnetThreadCtx *tctx = &_machnet_thread_ctx;
+  if (unlikely(cnt > tctx->index_table_size)) {
+    uint32_t size = MAX(tctx->index_table_size, 2 * NUM_CACHED_BUFS);
+    while (size < cnt) size *= 2;
+    MachnetRingSlot_t *table =
+        realloc(tctx->index_table, size * sizeof(*table));
+    if (table == NULL) return NULL;
+    tctx->index_table = table;
+    tctx->index_table_size = size;
+  }
+  return tctx->index_table;
+}
+
 /**
- * @brief Allocates a specified number of buffers for use, either directly from
- * the global pool or from the application's buffer cache.
+ * @brief Allocates a specified number of buffers of a size class for use,
+ * either directly from the global pool or from the calling thread's buffer
+ * cache.
  *
  * This function allocates `cnt` number of buffers for the Machnet channel. If
  * the count exceeds the number of cached buffers (`NUM_CACHED_BUFS`), the
  * allocation is made directly from the global pool. For smaller allocations, it
- * tries to fulfill the request from the application's buffer cache. If the
- * cache is empty, it refills the cache from the global pool. If allocation from
- * the global pool fails at any point, the function returns `NULL`.
+ * tries to fulfill the request from the thread's buffer cache. If the cache is
+ * empty, it refills the cache from the global pool. If allocation from the
+ * global pool fails at any point, the function fails without allocating any
+ * buffers.
  *
  * @param ctx Pointer to the MachnetChannelCtx_t structure that holds channel
- * context information, including the application buffer cache.
+ * context information.
+ * @param cls The size class of the buffers (`MACHNET_MSGBUF_CLASS_*`).
  * @param cnt The number of buffers to allocate.
- * @return A pointer to the first MachnetRingSlot_t element of an array
- * containing the allocated buffer indices if the allocation is successful;
- * otherwise, `NULL`.
+ * @param buffer_indices Array to hold the indices of the allocated buffers.
+ * @return 0 if the allocation is successful, -1 otherwise.
  */
-static inline MachnetRingSlot_t *_machnet_buffers_alloc(
-    MachnetChannelCtx_t *ctx, uint32_t cnt) {
-  MachnetRingSlot_t *buffer_indices = __machnet_channel_buffer_index_table(ctx);
-
+static inline int _machnet_buffers_alloc(MachnetChannelCtx_t *ctx,
+                                         uint32_t cls, uint32_t cnt,
+                                         MachnetRingSlot_t *buffer_indices) {
   if (cnt > NUM_CACHED_BUFS) {
     // This is a large bulk allocation, so we can bypass the application cache.
-    uint32_t ret =
-        __machnet_channel_buf_alloc_bulk(ctx, cnt, buffer_indices, NULL);
-    if (ret != cnt) {
-      return NULL;
-    }
-    return buffer_indices;
+    uint32_t ret = __machnet_channel_buf_class_alloc_bulk(ctx, cls, cnt,
+                                                          buffer_indices, NULL);
+    return ret == cnt ? 0 : -1;
   }
 
-  // Try to allocate from the application cache.
+  // Try to allocate from the thread's cache.
+  MachnetChannelAppBufferCache_t *cache = &_machnet_thread_cache(ctx)[cls];
   uint32_t index = 0;
   while (index < cnt) {
-    if (unlikely(ctx->app_buffer_cache.count == 0)) {
+    if (unlikely(cache->count == 0)) {
       // The cache is empty, so we need to allocate from the global pool.
-      ctx->app_buffer_cache.count += __machnet_channel_buf_alloc_bulk(
-          ctx, NUM_CACHED_BUFS, ctx->app_buffer_cache.indices, NULL);
-      if (unlikely(ctx->app_buffer_cache.count == 0)) {
+      cache->count = __machnet_channel_buf_class_alloc_bulk(
+          ctx, cls, NUM_CACHED_BUFS, cache->indices, NULL);
+      if (unlikely(cache->count == 0)) {
         // We failed to allocate from the global pool.
         goto fail;
       }
     }
 
-    buffer_indices[index++] =
-        ctx->app_buffer_cache.indices[--ctx->app_buffer_cache.count];
+    buffer_indices[index++] = cache->indices[--cache->count];
   }
 
-  return buffer_indices;
+  return 0;
 
 fail:
-  // Bulk allocation has failed; return partial allocation to the application
-  // cache.
+  // Bulk allocation has failed; return partial allocation to the cache.
   for (uint32_t i = 0; i < index; i++) {
-    ctx->app_buffer_cache.indices[ctx->app_buffer_cache.count++] =
-        buffer_indices[i];
+    cache->indices[cache->count++] = buffer_indices[i];
   }
 
-  return NULL;
+  return -1;
 }
 
 /**
@@ -194,37 +391,46 @@ fail:
  * them to the global pool.
  *
  * This function attempts to release a specified count of buffers back into the
- * Machnet channel context's application buffer cache. If the cache is full,
- * it will free half of the cached buffers to the global buffer pool. If after
- * several retries it is unable to free buffers to the global pool, the function
- * aborts the program execution.
+ * calling thread's buffer cache of their size class. If the cache is full, it
+ * will free half of the cached buffers to the global buffer pool. If it is
+ * unable to free buffers to the global pool, the function aborts the program
+ * execution.
  *
  * @param ctx Pointer to the MachnetChannelCtx_t structure that represents the
- *        channel context which holds the application buffer cache.
+ *        channel context.
  * @param cnt The number of buffers to be released.
  * @param buffer_indices Array of MachnetRingSlot_t that contains the indices of
- * the buffers that need to be released.
+ * the buffers that need to be released (of any size class).
  *
- * @warning If the function fails to free the buffers to the global pool after a
- *          certain number of retries, it will output an error message to stderr
- *          and call abort() to terminate program execution.
+ * @warning If the function fails to free the buffers to the global pool, it
+ *          will output an error message to stderr and call abort() to
+ *          terminate program execution.
  */
 static inline void _machnet_buffers_release(MachnetChannelCtx_t *ctx,
                                             uint32_t cnt,
                                             MachnetRingSlot_t *buffer_indices) {
+  if (cnt > NUM_CACHED_BUFS) {
+    // This is a large bulk release, so we can bypass the application cache.
+    if (likely(__machnet_channel_buf_free_bulk(ctx, cnt, buffer_indices) ==
+               cnt)) {
+      return;
+    }
+  }
+  if (cnt == 0) return;
+
+  MachnetChannelAppBufferCache_t *caches = _machnet_thread_cache(ctx);
   uint32_t index = 0;
   while (index < cnt) {
-    uint32_t retries = 5;
-    while (unlikely(ctx->app_buffer_cache.count == NUM_CACHED_BUFS)) {
-      // The cache is full, free to global pool.
-      uint32_t elements_to_free = ctx->app_buffer_cache.count / 2;
+    MachnetChannelAppBufferCache_t *cache =
+        &caches[__machnet_channel_buf_class(ctx, buffer_indices[index])];
+    if (unlikely(cache->count == NUM_CACHED_BUFS)) {
+      // The cache is full, free half of it to the global pool.
+      uint32_t elements_to_free = cache->count / 2;
       MachnetRingSlot_t *indices_to_free =
-          ctx->app_buffer_cache.indices + (NUM_CACHED_BUFS - elements_to_free);
-      ctx->app_buffer_cache.count -= __machnet_channel_buf_free_bulk(
-          ctx, elements_to_free, indices_to_free);
-
-      if (unlikely(retries-- == 0 &&
-                   ctx->app_buffer_cache.count == NUM_CACHED_BUFS)) {
+          cache->indices + (NUM_CACHED_BUFS - elements_to_free);
+      if (unlikely(__machnet_channel_buf_free_bulk(ctx, elements_to_free,
+                                                   indices_to_free) !=
+                   elements_to_free)) {
         /*
          * XXX (ilias): If we reach here, we have failed to free the buffers to
          * the global pool and we are going to leak them. Terminate execution.
@@ -232,11 +438,105 @@ static inline void _machnet_buffers_release(MachnetChannelCtx_t *ctx,
         fprintf(stderr, "ERROR: Failed to free buffers to global pool.\n");
         abort();
       }
+      cache->count -= elements_to_free;
     }
 
-    ctx->app_buffer_cache.indices[ctx->app_buffer_cache.count++] =
-        buffer_indices[index++];
+    cache->indices[cache->count++] = buffer_indices[index++];
+  }
+}
+
+/**
+ * @brief Returns whether a message of `msg_size' bytes fits in a small buffer
+ * (see `MACHNET_MSGBUF_CLASS_SMALL').
+ */
+static inline int _machnet_msg_is_small(const MachnetChannelCtx_t *ctx,
+                                        uint32_t msg_size) {
+  return msg_size <= ctx->data_ctx.small_buf_mss;
+}
+
+/**
+ * @brief Allocates the buffers for a batch of messages: `small_nr' small
+ * buffers (one per small message) followed by `std_nr' standard buffers. If
+ * the small buffers run out, standard buffers are used in their place; a small
+ * message fits in a single buffer of either class.
+ *
+ * @param ctx Pointer to the channel context.
+ * @param small_nr The number of small buffers.
+ * @param std_nr The number of standard buffers.
+ * @return A pointer to the array of the `small_nr + std_nr' allocated buffer
+ * indices, or `NULL' on failure. The array is private to the calling thread,
+ * and valid until its next allocation.
+ */
+static inline MachnetRingSlot_t *_machnet_msg_buffers_alloc(
+    MachnetChannelCtx_t *ctx, uint32_t small_nr, uint32_t std_nr) {
+  MachnetRingSlot_t *buffer_indices =
+      _machnet_thread_index_table(small_nr + std_nr);
+  if (unlikely(buffer_indices == NULL)) return NULL;
+
+  if (small_nr != 0 &&
+      _machnet_buffers_alloc(ctx, MACHNET_MSGBUF_CLASS_SMALL, small_nr,
+                             buffer_indices) != 0) {
+    std_nr += small_nr;
+    small_nr = 0;
+  }
+  if (std_nr != 0 &&
+      _machnet_buffers_alloc(ctx, MACHNET_MSGBUF_CLASS_STD, std_nr,
+                             buffer_indices + small_nr) != 0) {
+    _machnet_buffers_release(ctx, small_nr, buffer_indices);
+    return NULL;
+  }
+  return buffer_indices;
+}
+
+/**
+ * @brief Maps the clock page of the controller (read-only), for
+ * `machnet_clock_ns()'. Without one (e.g., with an older controller), or if
+ * the TSC is not invariant, the library falls back to `clock_gettime()'.
+ */
+static void _machnet_clock_map(void) {
+  machnet_ctrl_msg_t req = {};
+  req.type = MACHNET_CTRL_MSG_TYPE_REQ_CLOCK;
+  req.msg_id = msg_id_counter++;
+  uuid_copy(req.app_uuid, g_app_uuid);
+
+  int fd = -1;
+  machnet_ctrl_msg_t resp;
+  if (_machnet_ctrl_request(&req, -1, &resp, &fd) != 0 ||
+      resp.type != MACHNET_CTRL_MSG_TYPE_RESPONSE ||
+      resp.msg_id != req.msg_id || resp.status != MACHNET_CTRL_STATUS_SUCCESS ||
+      fd < 0) {
+    if (fd >= 0) close(fd);
+    return;
+  }
+
+  void *page = mmap(NULL, sizeof(MachnetClockPage_t), PROT_READ, MAP_SHARED,
+                    fd, 0);
+  close(fd);
+  if (page == MAP_FAILED) return;
+  if (!(((const MachnetClockPage_t *)page)->flags &
+        MACHNET_CLOCK_F_INVARIANT_TSC)) {
+    munmap(page, sizeof(MachnetClockPage_t));
+    return;
   }
+  __atomic_store_n(&_machnet_clock_page, (const MachnetClockPage_t *)page,
+                   __ATOMIC_RELEASE);
+}
+
+uint64_t machnet_clock_ns(void) {
+  const MachnetClockPage_t *page =
+      __atomic_load_n(&_machnet_clock_page, __ATOMIC_ACQUIRE);
+  if (page != NULL) return __machnet_clock_tsc_to_ns(page, __machnet_rdtsc());
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t machnet_clock_tsc_hz(void) {
+  const MachnetClockPage_t *page =
+      __atomic_load_n(&_machnet_clock_page, __ATOMIC_ACQUIRE);
+  if (page == NULL) return 0;
+  return __atomic_load_n(&page->tsc_hz, __ATOMIC_RELAXED);
 }
 
 int machnet_init() {
@@ -320,6 +620,7 @@ int machnet_init() {
   // When this application quits, the controller will detect that the socket
   // was closed and de-register the application.
 
+  if (resp.status == MACHNET_CTRL_STATUS_SUCCESS) _machnet_clock_map();
   return resp.status;
 }
 
@@ -359,6 +660,14 @@ MachnetChannelCtx_t *machnet_bind(int shm_fd, size_t *channel_size) {
     goto fail;
   }
 
+  // The layout of the channel (e.g., the type of its rings) depends on its
+  // version, so only channels of the version of this library can be used.
+  if (channel->version != MACHNET_CHANNEL_VERSION) {
+    fprintf(stderr, "Unsupported channel version: %u (expected %u)\n",
+            channel->version, MACHNET_CHANNEL_VERSION);
+    goto fail;
+  }
+
   // Success.
   if (channel_size != NULL) *channel_size = stat_buf.st_size;
 
@@ -369,7 +678,17 @@ fail:
   return NULL;
 }
 
-void *machnet_attach() {
+void *machnet_attach() { return machnet_attach_with_hints(0, 0, 0); }
+
+void *machnet_attach_with_hints(uint32_t desc_ring_size, uint32_t buffer_count,
+                                uint32_t flags) {
+  return machnet_attach_with_placement(desc_ring_size, buffer_count, flags,
+                                       MACHNET_PLACEMENT_LEAST_LOADED, 0);
+}
+
+void *machnet_attach_with_placement(uint32_t desc_ring_size,
+                                    uint32_t buffer_count, uint32_t flags,
+                                    uint32_t policy, int32_t hint) {
   uuid_t uuid;        // UUID for the shared memory channel.
   char uuid_str[37];  // 36 chars + null terminator for UUID string.
 
@@ -382,14 +701,37 @@ void *machnet_attach() {
   req.msg_id = msg_id_counter++;
   uuid_copy(req.app_uuid, g_app_uuid);
   uuid_copy(req.channel_info.channel_uuid, uuid);
-  /* Request the default. */
-  req.channel_info.desc_ring_size = MACHNET_CHANNEL_INFO_DESC_RING_SIZE_DEFAULT;
-  req.channel_info.buffer_count = MACHNET_CHANNEL_INFO_BUFFER_COUNT_DEFAULT;
+  /* Zero sizes request the controller's defaults. */
+  req.channel_info.desc_ring_size = desc_ring_size;
+  req.channel_info.buffer_count = buffer_count;
+  /* Buffers are not touched after being sent, so zero-copy TX is safe. */
+  req.channel_info.flags = MACHNET_CHANNEL_INFO_FLAGS_TX_ZEROCOPY;
+  if (flags & MACHNET_ATTACH_F_SPSC)
+    req.channel_info.flags |= MACHNET_CHANNEL_INFO_FLAGS_SPSC_RINGS;
+  if (flags & MACHNET_ATTACH_F_UNORDERED)
+    req.channel_info.flags |= MACHNET_CHANNEL_INFO_FLAGS_UNORDERED;
+  if (flags & MACHNET_ATTACH_F_STREAM)
+    req.channel_info.flags |= MACHNET_CHANNEL_INFO_FLAGS_STREAM;
+  req.channel_info.placement = policy;
+  req.channel_info.numa_node = -1;
+  if (policy == MACHNET_PLACEMENT_ENGINE) {
+    if (hint < 0) {
+      fprintf(stderr, "machnet_attach: Invalid engine: %d\n", hint);
+      return NULL;
+    }
+    req.channel_info.engine_id = hint;
+  } else if (policy == MACHNET_PLACEMENT_NUMA_LOCAL) {
+    unsigned int cpu, node;
+    if (hint >= 0)
+      req.channel_info.numa_node = hint;
+    else if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+      req.channel_info.numa_node = node;
+  }
 
   // Send the request to the Machnet control plane.
   int channel_fd;
   machnet_ctrl_msg_t resp;
-  if (_machnet_ctrl_request(&req, &resp, &channel_fd) != 0) {
+  if (_machnet_ctrl_request(&req, -1, &resp, &channel_fd) != 0) {
     fprintf(stderr, "ERROR: Failed to send request to controller.");
     return NULL;
   }
@@ -406,7 +748,66 @@ void *machnet_attach() {
     return NULL;
   }
 
-  return machnet_bind(channel_fd, NULL);
+  MachnetChannelCtx_t *ctx = machnet_bind(channel_fd, NULL);
+  // The mapping keeps the channel; the controller holds its own descriptor.
+  if (ctx != NULL) close(channel_fd);
+  return ctx;
+}
+
+/**
+ * @brief Submits a request to the control SQ of a channel (ringing its
+ * doorbell, so that Machnet serves it on the next iteration of its engine),
+ * and waits for its completion. The engine answers listen requests in a few
+ * microseconds, and connect requests after a round-trip (the handshake), so
+ * the completion is polled in short, and then growing, sleeps.
+ *
+ * @param ctx                The channel context
+ * @param req                The request
+ * @param[out] resp          Its completion
+ * @return                   0 if the request completed successfully, -1
+ *                           otherwise
+ */
+static int _machnet_channel_ctrl_call(MachnetChannelCtx_t *ctx,
+                                      const MachnetCtrlQueueEntry_t *req,
+                                      MachnetCtrlQueueEntry_t *resp) {
+  // The engine times out the requests it cannot serve after a few seconds.
+  const uint64_t kTimeoutNs = 10000000000ULL;  // 10s
+  const uint64_t kMaxSleepNs = 1000000;        // 1ms
+
+  if (__machnet_channel_ctrl_sq_enqueue(ctx, 1, req) != 1) {
+    fprintf(stderr, "ERROR: Failed to enqueue request to control queue.\n");
+    return -1;
+  }
+
+  memset(resp, 0, sizeof(*resp));
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  const uint64_t start_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  uint64_t now_ns = start_ns;
+  uint64_t sleep_ns = 1000;
+  uint32_t ret = 0;
+  while ((ret = __machnet_channel_ctrl_cq_dequeue(ctx, 1, resp)) == 0 &&
+         now_ns - start_ns < kTimeoutNs) {
+    const struct timespec delay = {.tv_sec = 0, .tv_nsec = (long)sleep_ns};
+    nanosleep(&delay, NULL);
+    if (sleep_ns < kMaxSleepNs) sleep_ns *= 2;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+  if (ret == 0) {
+    fprintf(stderr, "ERROR: Failed to dequeue response from control queue.\n");
+    return -1;
+  }
+  if (resp->id != req->id) {
+    fprintf(stderr, "ERROR: Got invalid response from control plane.\n");
+    return -1;
+  }
+
+  if (resp->status != MACHNET_CTRL_STATUS_OK) {
+    fprintf(stderr, "ERROR: Got failure response from control plane.\n");
+    return -1;
+  }
+  return 0;
 }
 
 int machnet_connect(void *channel_ctx, const char *src_ip, const char *dst_ip,
@@ -430,39 +831,130 @@ int machnet_connect(void *channel_ctx, const char *src_ip, const char *dst_ip,
   req.flow_info.dst_ip = ntohl(inet_addr(dst_ip));
   req.flow_info.dst_port = dst_port;
 
-  // Send the request to the Machnet control plane.
-  if (__machnet_channel_ctrl_sq_enqueue(ctx, 1, &req) != 1) {
-    fprintf(stderr, "ERROR: Failed to enqueue request to control queue.\n");
+  MachnetCtrlQueueEntry_t resp;
+  if (_machnet_channel_ctrl_call(ctx, &req, &resp) != 0) return -1;
+
+  *flow = resp.flow_info;
+
+  // Success.
+  return 0;
+}
+
+int machnet_resolve(void *channel_ctx, const char *local_ip,
+                    const char *remote_ip) {
+  assert(channel_ctx != NULL);
+  MachnetChannelCtx_t *ctx = channel_ctx;
+
+  if (inet_addr(local_ip) == INADDR_NONE ||
+      inet_addr(remote_ip) == INADDR_NONE) {
+    fprintf(stderr,
+            "machnet_resolve: Invalid local (%s) or remote (%s) IP address.\n",
+            local_ip, remote_ip);
     return -1;
   }
 
+  MachnetCtrlQueueEntry_t req;
+  memset(&req, 0, sizeof(req));
+  req.id = ctx->ctrl_ctx.req_id++;
+  req.opcode = MACHNET_CTRL_OP_RESOLVE;
+  req.flow_info.src_ip = ntohl(inet_addr(local_ip));
+  req.flow_info.dst_ip = ntohl(inet_addr(remote_ip));
+
   MachnetCtrlQueueEntry_t resp;
-  memset(&resp, 0, sizeof(resp));
-  uint32_t ret = 0;
-  int max_tries = 10;
-  do {
-    ret = __machnet_channel_ctrl_cq_dequeue(ctx, 1, &resp);
-    if (ret != 0) break;
-    sleep(1);
-  } while (max_tries-- > 0);
-  if (ret == 0) {
-    fprintf(stderr, "ERROR: Failed to dequeue response from control queue.\n");
-    return -1;
+  if (_machnet_channel_ctrl_call(ctx, &req, &resp) != 0) return -1;
+
+  // Success.
+  return 0;
+}
+
+int machnet_get_placement(void *channel_ctx,
+                          MachnetChannelPlacement_t *placement) {
+  assert(channel_ctx != NULL);
+  MachnetChannelCtx_t *ctx = channel_ctx;
+
+  if (placement == NULL) return -1;
+  *placement = ctx->placement;
+  return 0;
+}
+
+// Tries to read the engine-side statistics of a channel consistently.
+#define MACHNET_STATS_READ_TRIES 1000
+
+int machnet_get_stats(const void *channel_ctx,
+                      MachnetChannelEngineStats_t *stats) {
+  assert(channel_ctx != NULL);
+  const MachnetChannelStats_t *c_stats =
+      __machnet_channel_stats((const MachnetChannelCtx_t *)channel_ctx);
+
+  if (stats == NULL) return -1;
+  for (int i = 0; i < MACHNET_STATS_READ_TRIES; i++) {
+    const uint64_t seq = __atomic_load_n(&c_stats->e_seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) continue;  // The engine is updating them.
+    memcpy(stats, &c_stats->e_stats, sizeof(*stats));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&c_stats->e_seq, __ATOMIC_RELAXED) == seq) return 0;
   }
-  if (resp.id != req.id) {
-    fprintf(stderr, "ERROR: Got invalid response from control plane.\n");
-    return -1;
+  return -1;
+}
+
+static inline int __machnet_flow_matches(const MachnetFlow_t *a,
+                                         const MachnetFlow_t *b) {
+  if (a->src_ip == b->src_ip && a->src_port == b->src_port &&
+      a->dst_ip == b->dst_ip && a->dst_port == b->dst_port)
+    return 1;
+  // The flows of received messages are from the remote end.
+  return a->src_ip == b->dst_ip && a->src_port == b->dst_port &&
+         a->dst_ip == b->src_ip && a->dst_port == b->src_port;
+}
+
+int machnet_get_flow_stats(const void *channel_ctx, const MachnetFlow_t *flow,
+                           MachnetFlowStats_t *stats) {
+  assert(channel_ctx != NULL);
+  const MachnetChannelStats_t *c_stats =
+      __machnet_channel_stats((const MachnetChannelCtx_t *)channel_ctx);
+
+  if (flow == NULL || stats == NULL) return -1;
+  for (int i = 0; i < MACHNET_STATS_READ_TRIES; i++) {
+    const uint64_t seq = __atomic_load_n(&c_stats->e_seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) continue;  // The engine is updating them.
+    const uint32_t nb_flows =
+        MIN(c_stats->e_stats.nb_flows, (uint32_t)MACHNET_FLOW_STATS_MAX);
+    int found = 0;
+    for (uint32_t j = 0; j < nb_flows; j++) {
+      if (!__machnet_flow_matches(&c_stats->e_flows[j].flow, flow)) continue;
+      memcpy(stats, &c_stats->e_flows[j], sizeof(*stats));
+      found = 1;
+      break;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&c_stats->e_seq, __ATOMIC_RELAXED) == seq)
+      return found ? 0 : -1;
   }
+  return -1;
+}
 
-  if (resp.status != MACHNET_CTRL_STATUS_OK) {
-    fprintf(stderr, "ERROR: Got failure response from control plane.\n");
+int machnet_set_tx_weight(void *channel_ctx, uint16_t weight) {
+  assert(channel_ctx != NULL);
+  MachnetChannelCtx_t *ctx = channel_ctx;
+
+  if (weight == 0 || weight > MACHNET_CHANNEL_TX_WEIGHT_MAX) {
+    fprintf(stderr, "machnet_set_tx_weight: Invalid weight: %hu\n", weight);
     return -1;
   }
+  __atomic_store_n(&ctx->tx_weight, weight, __ATOMIC_RELAXED);
+  return 0;
+}
 
-  *flow = resp.flow_info;
+void machnet_release_cached_buffers(void *channel_ctx) {
+  assert(channel_ctx != NULL);
+  MachnetChannelCtx_t *ctx = channel_ctx;
+  struct MachnetThreadCtx *tctx = &_machnet_thread_ctx;
 
-  // Success.
-  return 0;
+  for (uint32_t i = 0; i < MACHNET_THREAD_CACHES_NR; i++) {
+    if (tctx->caches[i].ctx != ctx) continue;
+    _machnet_cache_drain(ctx, tctx->caches[i].cache);
+    tctx->caches[i].ctx = NULL;
+  }
 }
 
 int machnet_listen(void *channel_ctx, const char *local_ip,
@@ -482,34 +974,8 @@ int machnet_listen(void *channel_ctx, const char *local_ip,
   req.listener_info.ip = ntohl(inet_addr(local_ip));
   req.listener_info.port = local_port;
 
-  // Send the request to the Machnet control plane.
-  if (__machnet_channel_ctrl_sq_enqueue(ctx, 1, &req) != 1) {
-    fprintf(stderr, "ERROR: Failed to enqueue request to control queue.\n");
-    return -1;
-  }
-
   MachnetCtrlQueueEntry_t resp;
-  memset(&resp, 0, sizeof(resp));
-  uint32_t ret = 0;
-  int max_tries = 10;
-  do {
-    ret = __machnet_channel_ctrl_cq_dequeue(ctx, 1, &resp);
-    if (ret != 0) break;
-    sleep(1);
-  } while (max_tries-- > 0);
-  if (ret == 0) {
-    fprintf(stderr, "ERROR: Failed to dequeue response from control queue.\n");
-    return -1;
-  }
-  if (resp.id != req.id) {
-    fprintf(stderr, "ERROR: Got invalid response from control plane.\n");
-    return -1;
-  }
-
-  if (resp.status != MACHNET_CTRL_STATUS_OK) {
-    fprintf(stderr, "ERROR: Got failure response from control plane.\n");
-    return -1;
-  }
+  if (_machnet_channel_ctrl_call(ctx, &req, &resp) != 0) return -1;
 
   // Success.
   return 0;
@@ -531,30 +997,23 @@ int machnet_send(const void *channel_ctx, MachnetFlow_t flow, const void *buf,
   return machnet_sendmsg(channel_ctx, &msghdr);
 }
 
-int machnet_sendmsg(const void *channel_ctx, const MachnetMsgHdr_t *msghdr) {
-  assert(channel_ctx != NULL);
-  assert(msghdr != NULL);
-  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
-
-  // Sanity checks on the full message size.
-  if (unlikely(msghdr->msg_size > MACHNET_MSG_MAX_LEN || msghdr->msg_size == 0))
-    return -1;
-
-  // Get the maximum payload size of a message buffer.
-  // This is dictated by the stack, during the channel creation.
-  const uint32_t kMsgBufPayloadMax = ctx->data_ctx.buf_mss;
-
-  // Calculate how many buffers we need to hold the message, and bulk allocate
-  // them.
-  const uint32_t buffers_nr =
-      (msghdr->msg_size + kMsgBufPayloadMax - 1) / kMsgBufPayloadMax;
-  MachnetRingSlot_t *buf_index_table = _machnet_buffers_alloc(ctx, buffers_nr);
-  if (buf_index_table == NULL) {
-    // We failed to allocate the buffers.
-    return -1;
-  }
-
-  // Gather all message segments.
+/**
+ * @brief Copy a chunk of a message into a number of buffers, and link them into
+ * a chain of buffers ready to be enqueued to the channel.
+ *
+ * @param ctx The channel context.
+ * @param msghdr The descriptor of the chunk.
+ * @param buf_index_table The indices of the `buffers_nr' buffers to use.
+ * @param buffers_nr The number of buffers the chunk needs.
+ * @param bounds `MACHNET_MSGBUF_FLAGS_SYN' if the chunk starts the message,
+ * and `MACHNET_MSGBUF_FLAGS_FIN' if it ends it (both for a whole message).
+ */
+static inline void _machnet_chunk_fill(MachnetChannelCtx_t *ctx,
+                                       const MachnetMsgHdr_t *msghdr,
+                                       const MachnetRingSlot_t *buf_index_table,
+                                       uint32_t buffers_nr, uint8_t bounds) {
+  // Gather all message segments. High priority is marked in every buffer.
+  const uint8_t prio_flag = msghdr->flags & MACHNET_MSGBUF_FLAGS_PRIO;
   uint32_t buffer_cur_index = 0;
   uint32_t total_bytes_copied = 0;
   uint32_t new_buffer = 1;
@@ -571,6 +1030,7 @@ int machnet_sendmsg(const void *channel_ctx, const MachnetMsgHdr_t *msghdr) {
       if (unlikely(buffer->magic != MACHNET_MSGBUF_MAGIC)) abort();
       if (new_buffer) {
         __machnet_channel_buf_init(buffer);
+        buffer->flags = prio_flag;
         new_buffer = 0;
       }
       // Copy the data.
@@ -597,47 +1057,354 @@ int machnet_sendmsg(const void *channel_ctx, const MachnetMsgHdr_t *msghdr) {
   assert(total_bytes_copied == msghdr->msg_size);
   if (unlikely(total_bytes_copied != msghdr->msg_size)) abort();
 
-  // For the last buffer, we need to mark it as the tail of the message.
+  // For the last buffer, we need to mark it as the tail of the message, or,
+  // if more chunks follow, as chained to the next one.
   MachnetMsgBuf_t *last =
       __machnet_channel_buf(ctx, buf_index_table[buffers_nr - 1]);
-  last->flags |= MACHNET_MSGBUF_FLAGS_FIN;
+  last->flags |= (bounds & MACHNET_MSGBUF_FLAGS_FIN)
+                     ? MACHNET_MSGBUF_FLAGS_FIN
+                     : MACHNET_MSGBUF_FLAGS_CHAIN;
   last->flags &= ~(MACHNET_MSGBUF_FLAGS_SG);
 
   // We have finished copying over the message. Now we need to update the
   // message metadata.
   // Mark the first buffer of the message as the head of the message, and also
   // piggyback any flags requested by the application (e.g., delivery
-  // notification).
+  // notification). The head of every chunk holds the metadata of the chunk.
   MachnetMsgBuf_t *first = __machnet_channel_buf(ctx, buf_index_table[0]);
-  first->flags |= MACHNET_MSGBUF_FLAGS_SYN;
+  first->flags |= (bounds & MACHNET_MSGBUF_FLAGS_SYN);
   first->flags |= (msghdr->flags & MACHNET_MSGBUF_NOTIFY_DELIVERY);
+  if (msghdr->flags & MACHNET_MSGBUF_NOTIFY_DELIVERY)
+    first->cookie = msghdr->cookie;
   first->flow = msghdr->flow_info;
   first->msg_len = msghdr->msg_size;
   first->last = buf_index_table[buffers_nr - 1];  // Link to the last buffer.
+  // Stamp the message, in case the engine samples it for tracing.
+  if (__atomic_load_n(&ctx->trace_ctx.enabled, __ATOMIC_RELAXED))
+    first->trace_tsc = __machnet_trace_stamp();
+}
+
+/**
+ * @brief Copy a (whole) message into a number of buffers, and link them into a
+ * chain of buffers ready to be enqueued to the channel.
+ *
+ * @param ctx The channel context.
+ * @param msghdr The message descriptor.
+ * @param buf_index_table The indices of the `buffers_nr' buffers to use.
+ * @param buffers_nr The number of buffers the message needs.
+ */
+static inline void _machnet_msg_fill(MachnetChannelCtx_t *ctx,
+                                     const MachnetMsgHdr_t *msghdr,
+                                     const MachnetRingSlot_t *buf_index_table,
+                                     uint32_t buffers_nr) {
+  _machnet_chunk_fill(ctx, msghdr, buf_index_table, buffers_nr,
+                      MACHNET_MSGBUF_FLAGS_SYN | MACHNET_MSGBUF_FLAGS_FIN);
+}
+
+/**
+ * @brief Send a message of up to `MACHNET_MSG_INLINE_MAX' bytes inline, i.e.,
+ * in the slots of the App->Machnet ring (see `MachnetInlineMsg').
+ *
+ * @param ctx The channel context.
+ * @param msghdr The message descriptor.
+ * @return 0 on success, -1 on failure (the ring is full).
+ */
+static inline int _machnet_sendmsg_inline(MachnetChannelCtx_t *ctx,
+                                          const MachnetMsgHdr_t *msghdr) {
+  MachnetChannelAppStats_t *stats = &__machnet_channel_stats(ctx)->a_stats;
+  assert(msghdr->msg_size <= MACHNET_MSG_INLINE_MAX);
+
+  MachnetInlineMsg_t msg;
+  msg.hdr = __machnet_inline_msg_hdr(msghdr->msg_size,
+                                     msghdr->flags & MACHNET_MSGBUF_FLAGS_PRIO);
+  msg.flow = msghdr->flow_info;
+  uint32_t total_bytes_copied = 0;
+  for (size_t iov_index = 0; iov_index < msghdr->msg_iovlen; iov_index++) {
+    const MachnetIovec_t *segment_desc = &msghdr->msg_iov[iov_index];
+    if (unlikely(segment_desc->len > msghdr->msg_size - total_bytes_copied))
+      abort();
+    memcpy(msg.data + total_bytes_copied, segment_desc->base,
+           segment_desc->len);
+    total_bytes_copied += segment_desc->len;
+  }
+  if (unlikely(total_bytes_copied != msghdr->msg_size)) abort();
+
+  const uint32_t slots_nr = __machnet_inline_msg_slots_nr(msghdr->msg_size);
+  if (__machnet_channel_app_ring_enqueue_prio(
+          ctx, __machnet_msg_prio(msghdr->flags), slots_nr,
+          (MachnetRingSlot_t *)&msg) != slots_nr) {
+    stats->tx_msg_drops++;
+    return -1;
+  }
+
+  stats->tx_msg_success++;
+  stats->tx_bytes_success += msghdr->msg_size;
+  return 0;
+}
+
+/**
+ * @brief Send a chunk of a message (see `_machnet_chunk_fill()') in channel
+ * buffers.
+ *
+ * @param ctx The channel context.
+ * @param msghdr The descriptor of the chunk.
+ * @param bounds The bounds of the message that the chunk holds.
+ * @return 0 on success, -1 on failure.
+ */
+static int _machnet_sendmsg_buffers(MachnetChannelCtx_t *ctx,
+                                    const MachnetMsgHdr_t *msghdr,
+                                    uint8_t bounds) {
+  MachnetChannelAppStats_t *stats = &__machnet_channel_stats(ctx)->a_stats;
+
+  // Get the maximum payload size of a message buffer.
+  // This is dictated by the stack, during the channel creation.
+  const uint32_t kMsgBufPayloadMax = ctx->data_ctx.buf_mss;
+
+  // Calculate how many buffers we need to hold the message, and bulk allocate
+  // them. Small messages fit in a single (small) buffer.
+  const uint32_t buffers_nr =
+      (msghdr->msg_size + kMsgBufPayloadMax - 1) / kMsgBufPayloadMax;
+  MachnetRingSlot_t *buf_index_table =
+      _machnet_msg_is_small(ctx, msghdr->msg_size)
+          ? _machnet_msg_buffers_alloc(ctx, 1, 0)
+          : _machnet_msg_buffers_alloc(ctx, 0, buffers_nr);
+  if (buf_index_table == NULL) {
+    // We failed to allocate the buffers.
+    stats->tx_msg_drops++;
+    return -1;
+  }
+
+  _machnet_chunk_fill(ctx, msghdr, buf_index_table, buffers_nr, bounds);
 
   // Finally, send the message.
-  // TODO(ilias): Add retries if the ring is full, and add statistics.
-  if (__machnet_channel_app_ring_enqueue(ctx, 1, buf_index_table) != 1) {
+  // TODO(ilias): Add retries if the ring is full.
+  if (__machnet_channel_app_ring_enqueue_prio(
+          ctx, __machnet_msg_prio(msghdr->flags), 1, buf_index_table) != 1) {
+    _machnet_buffers_release(ctx, buffers_nr, buf_index_table);
+    stats->tx_msg_drops++;
     return -1;
   }
 
+  // A message sent in chunks counts once, with its last chunk.
+  if (bounds & MACHNET_MSGBUF_FLAGS_FIN) stats->tx_msg_success++;
+  stats->tx_bytes_success += msghdr->msg_size;
   return 0;
 }
 
+int machnet_sendmsg(const void *channel_ctx, const MachnetMsgHdr_t *msghdr) {
+  assert(channel_ctx != NULL);
+  assert(msghdr != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  // Sanity checks on the full message size.
+  if (unlikely(msghdr->msg_size > MACHNET_MSG_MAX_LEN || msghdr->msg_size == 0))
+    return -1;
+
+  // Tiny messages do not need a buffer, unless their delivery is notified
+  // (inline messages have no room for the cookie).
+  if (msghdr->msg_size <= MACHNET_MSG_INLINE_MAX &&
+      !(msghdr->flags & MACHNET_MSGBUF_NOTIFY_DELIVERY))
+    return _machnet_sendmsg_inline(ctx, msghdr);
+
+  return _machnet_sendmsg_buffers(
+      ctx, msghdr, MACHNET_MSGBUF_FLAGS_SYN | MACHNET_MSGBUF_FLAGS_FIN);
+}
+
+int machnet_sendmsg_chunk(const void *channel_ctx,
+                          const MachnetMsgHdr_t *msghdr) {
+  assert(channel_ctx != NULL);
+  assert(msghdr != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  // Sanity checks on the chunk size.
+  if (unlikely(msghdr->msg_size > MACHNET_MSG_MAX_LEN || msghdr->msg_size == 0))
+    return -1;
+
+  // Chunks always take buffers: inline messages are whole ones.
+  const uint8_t bounds =
+      msghdr->flags & (MACHNET_MSGBUF_FLAGS_SYN | MACHNET_MSGBUF_FLAGS_FIN);
+  return _machnet_sendmsg_buffers(ctx, msghdr, bounds);
+}
+
 int machnet_sendmmsg(const void *channel_ctx,
                      const MachnetMsgHdr_t *msghdr_iovec, int vlen) {
+  assert(channel_ctx != NULL);
+  assert(msghdr_iovec != NULL);
+  if (vlen <= 0) return 0;
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+  MachnetChannelAppStats_t *stats = &__machnet_channel_stats(ctx)->a_stats;
+  const uint32_t kMsgBufPayloadMax = ctx->data_ctx.buf_mss;
+  // Messages are sent in batches of up to `kBatchSize': the buffers of a batch
+  // are allocated at once, and its messages are enqueued at once.
+  const uint32_t kBatchSize = 32;
+  MachnetRingSlot_t msg_heads[kBatchSize];
+  uint32_t msg_buffers_nr[kBatchSize];
+  uint32_t msg_buffers_ofs[kBatchSize];
+  uint8_t msg_is_small[kBatchSize];
+
   int msg_sent = 0;
+  while (msg_sent < vlen) {
+    // Size the batch; it ends before the first invalid message, if any, and
+    // at a change of priority class, as it is enqueued to a single ring.
+    uint32_t batch_size = 0;
+    uint32_t small_buffers_nr = 0;
+    uint32_t std_buffers_nr = 0;
+    const uint32_t prio = __machnet_msg_prio(msghdr_iovec[msg_sent].flags);
+    while (batch_size < kBatchSize && msg_sent + (int)batch_size < vlen) {
+      const MachnetMsgHdr_t *msghdr = &msghdr_iovec[msg_sent + batch_size];
+      assert(msghdr->msg_iov != NULL);
+      if (unlikely(msghdr->msg_size > MACHNET_MSG_MAX_LEN ||
+                   msghdr->msg_size == 0))
+        break;
+      if (__machnet_msg_prio(msghdr->flags) != prio) break;
+      msg_buffers_nr[batch_size] =
+          (msghdr->msg_size + kMsgBufPayloadMax - 1) / kMsgBufPayloadMax;
+      msg_is_small[batch_size] = _machnet_msg_is_small(ctx, msghdr->msg_size);
+      if (msg_is_small[batch_size])
+        small_buffers_nr++;
+      else
+        std_buffers_nr += msg_buffers_nr[batch_size];
+      batch_size++;
+    }
+    if (batch_size == 0) break;
+
+    // Out of buffers: shrink the batch, down to a single message.
+    MachnetRingSlot_t *buf_index_table = NULL;
+    while ((buf_index_table = _machnet_msg_buffers_alloc(
+                ctx, small_buffers_nr, std_buffers_nr)) == NULL &&
+           batch_size > 1) {
+      batch_size--;
+      if (msg_is_small[batch_size])
+        small_buffers_nr--;
+      else
+        std_buffers_nr -= msg_buffers_nr[batch_size];
+    }
+    if (buf_index_table == NULL) break;
+
+    // Copy all the messages, and enqueue them with a single ring operation.
+    // The buffers of small messages come first in the table.
+    uint32_t small_ofs = 0;
+    uint32_t std_ofs = small_buffers_nr;
+    for (uint32_t i = 0; i < batch_size; i++) {
+      if (msg_is_small[i]) {
+        msg_buffers_ofs[i] = small_ofs++;
+      } else {
+        msg_buffers_ofs[i] = std_ofs;
+        std_ofs += msg_buffers_nr[i];
+      }
+      _machnet_msg_fill(ctx, &msghdr_iovec[msg_sent + i],
+                        &buf_index_table[msg_buffers_ofs[i]],
+                        msg_buffers_nr[i]);
+      msg_heads[i] = buf_index_table[msg_buffers_ofs[i]];
+    }
+    const uint32_t enqueued = __machnet_channel_app_ring_enqueue_burst_prio(
+        ctx, prio, batch_size, msg_heads);
 
-  for (int msg_index = 0; msg_index < vlen; msg_index++) {
-    const MachnetMsgHdr_t *msghdr = &msghdr_iovec[msg_index];
-    assert(msghdr->msg_iov != NULL);
-    if (machnet_sendmsg(channel_ctx, msghdr) != 0) return msg_sent;
-    msg_sent++;
+    for (uint32_t i = 0; i < enqueued; i++) {
+      stats->tx_bytes_success += msghdr_iovec[msg_sent + i].msg_size;
+    }
+    stats->tx_msg_success += enqueued;
+    msg_sent += enqueued;
+
+    if (enqueued < batch_size) {
+      // The ring is full; return the buffers of the messages left behind.
+      for (uint32_t i = enqueued; i < batch_size; i++) {
+        _machnet_buffers_release(ctx, msg_buffers_nr[i],
+                                 &buf_index_table[msg_buffers_ofs[i]]);
+      }
+      break;
+    }
   }
 
+  // The messages not sent (because of invalid sizes, or backpressure) are
+  // dropped; it is up to the application to retry them.
+  stats->tx_msg_drops += vlen - msg_sent;
   return msg_sent;
 }
 
+int machnet_sendmsg_fanout(const void *channel_ctx,
+                           const MachnetMsgHdr_t *msghdr,
+                           const MachnetFlow_t *flows, uint32_t flows_nr) {
+  assert(channel_ctx != NULL);
+  assert(msghdr != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+  MachnetChannelAppStats_t *stats = &__machnet_channel_stats(ctx)->a_stats;
+
+  if (unlikely(msghdr->msg_size > MACHNET_MSG_MAX_LEN ||
+               msghdr->msg_size == 0 || flows_nr == 0 ||
+               flows_nr > MACHNET_FANOUT_MAX)) {
+    stats->tx_msg_drops += flows_nr;
+    return -1;
+  }
+
+  // The message takes `buffers_nr' shared buffers, and each flow as many
+  // references to them. References carry no payload, so they are small
+  // buffers; they come first in the table.
+  const uint32_t kMsgBufPayloadMax = ctx->data_ctx.buf_mss;
+  const uint32_t buffers_nr =
+      (msghdr->msg_size + kMsgBufPayloadMax - 1) / kMsgBufPayloadMax;
+  const uint32_t refs_nr = flows_nr * buffers_nr;
+  const int is_small = _machnet_msg_is_small(ctx, msghdr->msg_size);
+  MachnetRingSlot_t *buf_index_table =
+      is_small ? _machnet_msg_buffers_alloc(ctx, refs_nr + 1, 0)
+               : _machnet_msg_buffers_alloc(ctx, refs_nr, buffers_nr);
+  if (buf_index_table == NULL) {
+    stats->tx_msg_drops += flows_nr;
+    return -1;
+  }
+  MachnetRingSlot_t *shared_indices = &buf_index_table[refs_nr];
+  _machnet_msg_fill(ctx, msghdr, shared_indices, buffers_nr);
+  const MachnetMsgBuf_t *shared_first =
+      __machnet_channel_buf(ctx, shared_indices[0]);
+
+  // The heads of the messages of the flows. Cleared first: the ring may copy
+  // its elements as wider words (see `jring_elem_private.h'), which the
+  // compiler would otherwise take for reads of uninitialized memory.
+  MachnetRingSlot_t msg_heads[MACHNET_FANOUT_MAX];
+  memset(msg_heads, 0, flows_nr * sizeof(msg_heads[0]));
+
+  // Chain the references of each flow, mirroring the shared buffers.
+  for (uint32_t i = 0; i < buffers_nr; i++) {
+    MachnetMsgBuf_t *shared = __machnet_channel_buf(ctx, shared_indices[i]);
+    shared->refcnt = flows_nr;
+    for (uint32_t f = 0; f < flows_nr; f++) {
+      MachnetMsgBuf_t *ref =
+          __machnet_channel_buf(ctx, buf_index_table[f * buffers_nr + i]);
+      if (unlikely(ref->magic != MACHNET_MSGBUF_MAGIC)) abort();
+      __machnet_channel_buf_init(ref);
+      // The cookie would be in the place of the reference: no notification.
+      ref->flags = (shared->flags & ~MACHNET_MSGBUF_NOTIFY_DELIVERY) |
+                   MACHNET_MSGBUF_FLAGS_REF;
+      ref->ref = shared->index;
+      if (i + 1 < buffers_nr)
+        ref->next = buf_index_table[f * buffers_nr + i + 1];
+    }
+  }
+  for (uint32_t f = 0; f < flows_nr; f++) {
+    MachnetMsgBuf_t *first =
+        __machnet_channel_buf(ctx, buf_index_table[f * buffers_nr]);
+    first->flow = flows[f];
+    first->msg_len = shared_first->msg_len;
+    first->last = buf_index_table[f * buffers_nr + buffers_nr - 1];
+    first->trace_tsc = shared_first->trace_tsc;
+    msg_heads[f] = buf_index_table[f * buffers_nr];
+  }
+
+  // The references are enqueued at once, or not at all, so that the reference
+  // counts are final before Machnet sees any of them.
+  if (__machnet_channel_app_ring_enqueue_prio(
+          ctx, __machnet_msg_prio(msghdr->flags), flows_nr, msg_heads) !=
+      flows_nr) {
+    _machnet_buffers_release(ctx, refs_nr + buffers_nr, buf_index_table);
+    stats->tx_msg_drops += flows_nr;
+    return -1;
+  }
+
+  stats->tx_msg_success += flows_nr;
+  stats->tx_bytes_success += (uint64_t)msghdr->msg_size * flows_nr;
+  return 0;
+}
+
 ssize_t machnet_recv(const void *channel_ctx, void *buf, size_t len,
                      MachnetFlow_t *flow) {
   MachnetMsgHdr_t msghdr;
@@ -654,30 +1421,39 @@ ssize_t machnet_recv(const void *channel_ctx, void *buf, size_t len,
   return msghdr.msg_size;
 }
 
-int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr) {
-  assert(channel_ctx != NULL);
-  assert(msghdr != NULL);
-  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
-
-  const uint32_t kBufferBatchSize = 16;
-
-  // Deque a message from the ring.
-  MachnetRingSlot_t buffer_index;
-  uint32_t n = __machnet_channel_machnet_ring_dequeue(ctx, 1, &buffer_index);
-  if (n != 1) return 0;  // No message available.
-
+/**
+ * @brief Copies a message, starting at the given head buffer, to the
+ * locations described by `msghdr', and marks all the buffers of the message
+ * for release in `buffer_indices'. The pending release list is flushed
+ * whenever it reaches `buffer_indices_cap' entries.
+ *
+ * @param ctx Pointer to the channel context.
+ * @param buffer_index Index of the first buffer of the message.
+ * @param msghdr The message descriptor to fill in.
+ * @param buffer_indices Array of buffer indices pending release.
+ * @param buffer_indices_cnt Number of entries in `buffer_indices' (updated).
+ * @param buffer_indices_cap Capacity of `buffer_indices'.
+ * @return 0 on success, -1 if the message did not fit in the provided
+ * segments (the message is dropped).
+ */
+static inline int _machnet_msg_copyout(MachnetChannelCtx_t *ctx,
+                                       MachnetRingSlot_t buffer_index,
+                                       MachnetMsgHdr_t *msghdr,
+                                       MachnetRingSlot_t *buffer_indices,
+                                       uint32_t *buffer_indices_cnt,
+                                       uint32_t buffer_indices_cap) {
   MachnetMsgBuf_t *buffer;
   buffer = __machnet_channel_buf(ctx, buffer_index);
+  __machnet_trace_dequeue(ctx, buffer);
   MachnetFlow_t flow_info = buffer->flow;
+  // The bounds of the message in it, if it is a chunk of one (see
+  // `MACHNET_ATTACH_F_STREAM').
+  uint16_t bounds = buffer->flags & MACHNET_MSGBUF_FLAGS_SYN;
   uint32_t buf_data_ofs = 0;
   size_t iov_index = 0;
   uint32_t seg_data_ofs = 0;
   uint32_t total_bytes_copied = 0;
-
-  // `buffer_indices' array is being used to track used buffers, for later
-  // release.
-  MachnetRingSlot_t buffer_indices[kBufferBatchSize];
-  uint32_t buffer_indices_index = 0;
+  uint32_t buffer_indices_index = *buffer_indices_cnt;
 
   while (buffer != NULL &&
          __machnet_channel_buf_data_len(buffer) > buf_data_ofs) {
@@ -718,6 +1494,7 @@ int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr) {
     if (buf_data_ofs == __machnet_channel_buf_data_len(buffer)) {
       // Mark the buffer for later release.
       buffer_indices[buffer_indices_index++] = buffer_index;
+      bounds |= buffer->flags & MACHNET_MSGBUF_FLAGS_FIN;
 
       // Get the next buffer index, if any.
       if (buffer->flags & MACHNET_MSGBUF_FLAGS_SG) {
@@ -728,7 +1505,7 @@ int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr) {
       }
 
       // Do a batch buffer release if we reached the threshold.
-      if (buffer_indices_index == kBufferBatchSize) {
+      if (buffer_indices_index == buffer_indices_cap) {
         // release to the buf_ring
         _machnet_buffers_release(ctx, buffer_indices_index, buffer_indices);
         buffer_indices_index = 0;
@@ -745,12 +1522,11 @@ int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr) {
   // We have finished copying over the message. Now add the control data.
   msghdr->msg_size = total_bytes_copied;
   msghdr->flow_info = flow_info;
-
-  // Free up any remaining buffers.
-  _machnet_buffers_release(ctx, buffer_indices_index, buffer_indices);
+  msghdr->flags = bounds;
+  *buffer_indices_cnt = buffer_indices_index;
 
   // Success.
-  return 1;
+  return 0;
 
 fail:
   while (buffer != NULL) {
@@ -761,13 +1537,423 @@ fail:
     } else {
       buffer = NULL;
     }
-    if (buffer == NULL || buffer_indices_index == kBufferBatchSize) {
+    if (buffer_indices_index == buffer_indices_cap) {
       _machnet_buffers_release(ctx, buffer_indices_index, buffer_indices);
       buffer_indices_index = 0;
     }
   }
+  *buffer_indices_cnt = buffer_indices_index;
 
   return -1;
 }
 
-void machnet_detach(const MachnetChannelCtx_t *ctx) {}
+int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr) {
+  assert(channel_ctx != NULL);
+  assert(msghdr != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  const uint32_t kBufferBatchSize = 16;
+
+  // Deque a message from the ring.
+  MachnetRingSlot_t buffer_index;
+  uint32_t n = __machnet_channel_machnet_ring_dequeue(ctx, 1, &buffer_index);
+  if (n != 1) return 0;  // No message available.
+
+  // `buffer_indices' array is being used to track used buffers, for later
+  // release.
+  MachnetRingSlot_t buffer_indices[kBufferBatchSize];
+  uint32_t buffer_indices_index = 0;
+
+  const int ret =
+      _machnet_msg_copyout(ctx, buffer_index, msghdr, buffer_indices,
+                           &buffer_indices_index, kBufferBatchSize);
+
+  // Free up any remaining buffers.
+  _machnet_buffers_release(ctx, buffer_indices_index, buffer_indices);
+
+  return ret == 0 ? 1 : -1;
+}
+
+int machnet_recv_completions(const void *channel_ctx, uint32_t *cookies,
+                             uint32_t n) {
+  assert(channel_ctx != NULL);
+  assert(cookies != NULL);
+  if (n == 0) return 0;
+  return __machnet_channel_completion_ring_dequeue(
+      (const MachnetChannelCtx_t *)channel_ctx, n, cookies);
+}
+
+int machnet_recvmmsg(const void *channel_ctx, MachnetMsgHdr_t *msgvec,
+                     int vlen) {
+  assert(channel_ctx != NULL);
+  assert(msgvec != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  // Messages are dequeued in batches with a single ring operation each, and
+  // the buffers of a batch are released together; single-buffer messages fill
+  // the release list only once every `kBatchSize' messages.
+  const uint32_t kBatchSize = 32;
+  const uint32_t kBufferBatchSize = 4 * kBatchSize;
+
+  MachnetRingSlot_t heads[kBatchSize];
+  MachnetRingSlot_t buffer_indices[kBufferBatchSize];
+  uint32_t buffer_indices_index = 0;
+
+  int msg_received = 0;
+  while (msg_received < vlen) {
+    const uint32_t batch = MIN((uint32_t)(vlen - msg_received), kBatchSize);
+    const uint32_t n =
+        __machnet_channel_machnet_ring_dequeue(ctx, batch, heads);
+
+    for (uint32_t i = 0; i < n; i++) {
+      MachnetMsgHdr_t *msghdr = &msgvec[msg_received + i];
+      if (unlikely(_machnet_msg_copyout(ctx, heads[i], msghdr, buffer_indices,
+                                        &buffer_indices_index,
+                                        kBufferBatchSize) != 0)) {
+        // The message did not fit and was dropped.
+        msghdr->msg_size = 0;
+      }
+    }
+    msg_received += n;
+
+    if (n < batch) break;  // No more messages pending.
+  }
+
+  // Free up any remaining buffers.
+  _machnet_buffers_release(ctx, buffer_indices_index, buffer_indices);
+
+  return msg_received;
+}
+
+/**
+ * @brief Sets up receive notifications for a channel: creates an eventfd and
+ * passes it to the controller, which hands it over to the Machnet engine that
+ * serves the channel.
+ *
+ * @param ctx Pointer to the channel context.
+ * @return 0 on success, -1 on failure.
+ */
+static int _machnet_notify_setup(MachnetChannelCtx_t *ctx) {
+  int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (efd < 0) {
+    perror("eventfd");
+    return -1;
+  }
+
+  machnet_ctrl_msg_t req = {};
+  req.type = MACHNET_CTRL_MSG_TYPE_REQ_NOTIFY;
+  req.msg_id = msg_id_counter++;
+  uuid_copy(req.app_uuid, g_app_uuid);
+  // Channels are named after their UUID.
+  if (uuid_parse(ctx->name, req.channel_info.channel_uuid) != 0) {
+    fprintf(stderr, "ERROR: Invalid channel name %s.\n", ctx->name);
+    close(efd);
+    return -1;
+  }
+
+  machnet_ctrl_msg_t resp;
+  if (_machnet_ctrl_request(&req, efd, &resp, NULL) != 0 ||
+      resp.type != MACHNET_CTRL_MSG_TYPE_RESPONSE ||
+      resp.msg_id != req.msg_id ||
+      resp.status != MACHNET_CTRL_STATUS_SUCCESS) {
+    fprintf(stderr, "ERROR: Failed to set up channel notifications.\n");
+    close(efd);
+    return -1;
+  }
+
+  // The controller holds its own copy of the file descriptor.
+  ctx->notify_ctx.app_fd = efd;
+  return 0;
+}
+
+int machnet_wait(void *channel_ctx, int timeout_ms) {
+  assert(channel_ctx != NULL);
+  MachnetChannelCtx_t *ctx = channel_ctx;
+  // Spin for a short while before blocking, so that an application receiving
+  // at a high rate never pays for the syscalls (or the engine for the
+  // wakeups); only an idle channel falls back to notifications.
+  const uint64_t kSpinNs = 20000;
+
+  if (__machnet_channel_machnet_ring_pending(ctx) != 0) return 1;
+  if (timeout_ms == 0) return 0;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  const uint64_t spin_start_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  uint64_t now_ns = spin_start_ns;
+  while (now_ns - spin_start_ns < kSpinNs) {
+    if (__machnet_channel_machnet_ring_pending(ctx) != 0) return 1;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+  if (unlikely(ctx->notify_ctx.app_fd < 0) && _machnet_notify_setup(ctx) != 0)
+    return -1;
+
+  // Drop any stale signal (e.g., of a message already received by polling).
+  uint64_t val;
+  if (read(ctx->notify_ctx.app_fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+    perror("read");
+
+  // Arm the notifications, and check the ring once more: a message delivered
+  // before the engine could see them armed would not be signaled.
+  __atomic_store_n(&ctx->notify_ctx.armed, 1, __ATOMIC_SEQ_CST);
+  int ret = 1;
+  if (__machnet_channel_machnet_ring_pending(ctx) == 0) {
+    struct pollfd pfd = {.fd = ctx->notify_ctx.app_fd, .events = POLLIN};
+    int nfds = poll(&pfd, 1, timeout_ms);
+    if (nfds < 0 && errno != EINTR) {
+      perror("poll");
+      ret = -1;
+    } else if (nfds > 0) {
+      if (read(ctx->notify_ctx.app_fd, &val, sizeof(val)) < 0 &&
+          errno != EAGAIN) {
+        perror("read");
+      }
+    }
+  }
+  __atomic_store_n(&ctx->notify_ctx.armed, 0, __ATOMIC_RELEASE);
+
+  if (ret < 0) return ret;
+  return __machnet_channel_machnet_ring_pending(ctx) != 0;
+}
+
+MachnetMsgBuf_t *machnet_msg_alloc(const void *channel_ctx,
+                                   uint32_t msg_size) {
+  assert(channel_ctx != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+  if (unlikely(msg_size > MACHNET_MSG_MAX_LEN || msg_size == 0)) return NULL;
+
+  const uint32_t kMsgBufPayloadMax = ctx->data_ctx.buf_mss;
+  const uint32_t buffers_nr =
+      (msg_size + kMsgBufPayloadMax - 1) / kMsgBufPayloadMax;
+  MachnetRingSlot_t *buf_index_table =
+      _machnet_msg_is_small(ctx, msg_size)
+          ? _machnet_msg_buffers_alloc(ctx, 1, 0)
+          : _machnet_msg_buffers_alloc(ctx, 0, buffers_nr);
+  if (buf_index_table == NULL) return NULL;
+
+  // Reserve the payload space in each buffer, and link them together in the
+  // same layout that `_machnet_msg_fill()' produces.
+  uint32_t remaining_bytes = msg_size;
+  for (uint32_t i = 0; i < buffers_nr; i++) {
+    MachnetMsgBuf_t *buffer = __machnet_channel_buf(ctx, buf_index_table[i]);
+    if (unlikely(buffer->magic != MACHNET_MSGBUF_MAGIC)) abort();
+    __machnet_channel_buf_init(buffer);
+    const uint32_t nbytes = MIN(remaining_bytes, kMsgBufPayloadMax);
+    __machnet_channel_buf_append(buffer, nbytes);
+    remaining_bytes -= nbytes;
+    if (i + 1 < buffers_nr) {
+      buffer->flags |= MACHNET_MSGBUF_FLAGS_SG;
+      buffer->next = buf_index_table[i + 1];
+    } else {
+      buffer->flags |= MACHNET_MSGBUF_FLAGS_FIN;
+    }
+  }
+  assert(remaining_bytes == 0);
+
+  MachnetMsgBuf_t *first = __machnet_channel_buf(ctx, buf_index_table[0]);
+  first->flags |= MACHNET_MSGBUF_FLAGS_SYN;
+  first->msg_len = msg_size;
+  first->last = buf_index_table[buffers_nr - 1];
+  return first;
+}
+
+/**
+ * @brief Mark (or unmark) all the buffers of a message as of high priority
+ * (see `MACHNET_MSGBUF_FLAGS_PRIO').
+ */
+static inline void _machnet_msg_mark_prio(const MachnetChannelCtx_t *ctx,
+                                          MachnetMsgBuf_t *msg, int prio) {
+  for (MachnetMsgBuf_t *buf = msg;;
+       buf = __machnet_channel_buf(ctx, buf->next)) {
+    if (prio)
+      buf->flags |= MACHNET_MSGBUF_FLAGS_PRIO;
+    else
+      buf->flags &= ~MACHNET_MSGBUF_FLAGS_PRIO;
+    if (!(buf->flags & MACHNET_MSGBUF_FLAGS_SG)) break;
+  }
+}
+
+int machnet_msg_send(const void *channel_ctx, MachnetFlow_t flow,
+                     MachnetMsgBuf_t *msg, uint16_t flags) {
+  assert(channel_ctx != NULL);
+  assert(msg != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+  MachnetChannelAppStats_t *stats = &__machnet_channel_stats(ctx)->a_stats;
+  if (unlikely(msg->magic != MACHNET_MSGBUF_MAGIC ||
+               !(msg->flags & MACHNET_MSGBUF_FLAGS_SYN)))
+    return -1;
+
+  msg->flow = flow;
+  msg->flags |= (flags & MACHNET_MSGBUF_NOTIFY_DELIVERY);
+  if (__atomic_load_n(&ctx->trace_ctx.enabled, __ATOMIC_RELAXED))
+    msg->trace_tsc = __machnet_trace_stamp();
+  const uint32_t prio = __machnet_msg_prio(flags);
+  if (prio == MACHNET_PRIO_HIGH) _machnet_msg_mark_prio(ctx, msg, 1);
+
+  // TODO(ilias): Add retries if the ring is full.
+  if (__machnet_channel_app_ring_enqueue_prio(ctx, prio, 1, &msg->index) != 1) {
+    // The application keeps ownership of the message on failure.
+    msg->flags &= ~(MACHNET_MSGBUF_NOTIFY_DELIVERY);
+    if (prio == MACHNET_PRIO_HIGH) _machnet_msg_mark_prio(ctx, msg, 0);
+    stats->tx_msg_drops++;
+    return -1;
+  }
+
+  stats->tx_msg_success++;
+  stats->tx_bytes_success += msg->msg_len;
+  return 0;
+}
+
+int machnet_recv_zc(const void *channel_ctx, const MachnetMsgBuf_t **msg,
+                    MachnetFlow_t *flow) {
+  assert(channel_ctx != NULL);
+  assert(msg != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  MachnetRingSlot_t buffer_index;
+  if (__machnet_channel_machnet_ring_dequeue(ctx, 1, &buffer_index) != 1)
+    return 0;  // No message available.
+
+  *msg = __machnet_channel_buf(ctx, buffer_index);
+  __machnet_trace_dequeue(ctx, *msg);
+  if (flow != NULL) *flow = (*msg)->flow;
+  return 1;
+}
+
+void machnet_msg_release(const void *channel_ctx, const MachnetMsgBuf_t *msg) {
+  assert(channel_ctx != NULL);
+  if (msg == NULL) return;
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  const uint32_t kBufferBatchSize = 16;
+  MachnetRingSlot_t buffer_indices[kBufferBatchSize];
+  uint32_t buffer_indices_index = 0;
+  while (msg != NULL) {
+    buffer_indices[buffer_indices_index++] = msg->index;
+    msg = machnet_msgbuf_next(channel_ctx, msg);
+    if (msg == NULL || buffer_indices_index == kBufferBatchSize) {
+      _machnet_buffers_release(ctx, buffer_indices_index, buffer_indices);
+      buffer_indices_index = 0;
+    }
+  }
+}
+
+void *machnet_msgbuf_data(const MachnetMsgBuf_t *buf) {
+  assert(buf != NULL);
+  return __machnet_channel_buf_data(buf);
+}
+
+uint32_t machnet_msgbuf_len(const MachnetMsgBuf_t *buf) {
+  assert(buf != NULL);
+  return __machnet_channel_buf_data_len(buf);
+}
+
+MachnetMsgBuf_t *machnet_msgbuf_next(const void *channel_ctx,
+                                     const MachnetMsgBuf_t *buf) {
+  assert(channel_ctx != NULL);
+  assert(buf != NULL);
+  if (!(buf->flags & MACHNET_MSGBUF_FLAGS_SG)) return NULL;
+  return __machnet_channel_buf((const MachnetChannelCtx_t *)channel_ctx,
+                               buf->next);
+}
+
+int machnet_detach(void *channel_ctx) {
+  assert(channel_ctx != NULL);
+  MachnetChannelCtx_t *ctx = channel_ctx;
+  machnet_release_cached_buffers(ctx);
+
+  machnet_ctrl_msg_t req = {};
+  req.type = MACHNET_CTRL_MSG_TYPE_REQ_DETACH;
+  req.msg_id = msg_id_counter++;
+  uuid_copy(req.app_uuid, g_app_uuid);
+  // Channels are named after their UUID.
+  int ret = uuid_parse(ctx->name, req.channel_info.channel_uuid) == 0 ? 0 : -1;
+  if (ctx->notify_ctx.app_fd >= 0) close(ctx->notify_ctx.app_fd);
+
+  // Unmap the channel before giving it back, as the controller scrubs it for
+  // another application.
+  const size_t size = ctx->size;
+  pthread_mutex_lock(&_machnet_detached.lock);
+  _machnet_detached.ctx[_machnet_detached.epoch % MACHNET_DETACHED_NR] = ctx;
+  __atomic_store_n(&_machnet_detached.epoch, _machnet_detached.epoch + 1,
+                   __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&_machnet_detached.lock);
+  munmap(ctx, size);
+  if (ret != 0) {
+    fprintf(stderr, "ERROR: Invalid channel name.\n");
+    return -1;
+  }
+
+  machnet_ctrl_msg_t resp;
+  if (_machnet_ctrl_request(&req, -1, &resp, NULL) != 0 ||
+      resp.type != MACHNET_CTRL_MSG_TYPE_RESPONSE ||
+      resp.msg_id != req.msg_id ||
+      resp.status != MACHNET_CTRL_STATUS_SUCCESS) {
+    fprintf(stderr, "ERROR: Failed to detach the channel.\n");
+    return -1;
+  }
+  return 0;
+}
+
+// Sends a request about a direct queue to the controller, and checks the
+// response, which is left in `resp'.
+static int _machnet_direct_request(machnet_ctrl_msg_t *req,
+                                   machnet_ctrl_msg_t *resp) {
+  req->msg_id = msg_id_counter++;
+  uuid_copy(req->app_uuid, g_app_uuid);
+  if (_machnet_ctrl_request(req, -1, resp, NULL) != 0 ||
+      resp->type != MACHNET_CTRL_MSG_TYPE_RESPONSE ||
+      resp->msg_id != req->msg_id) {
+    fprintf(stderr, "ERROR: Failed to send request to controller.\n");
+    return -1;
+  }
+  return resp->status == MACHNET_CTRL_STATUS_SUCCESS ? 0 : -1;
+}
+
+int machnet_direct_queue(machnet_direct_queue_info_t *info) {
+  assert(info != NULL);
+  machnet_ctrl_msg_t req = {};
+  req.type = MACHNET_CTRL_MSG_TYPE_REQ_DIRECT_QUEUE;
+  req.direct_queue_info.ipv4_addr = info->ipv4_addr;
+
+  machnet_ctrl_msg_t resp;
+  if (_machnet_direct_request(&req, &resp) != 0) {
+    fprintf(stderr, "ERROR: No direct queue available.\n");
+    return -1;
+  }
+  *info = resp.direct_queue_info;
+  info->rx_mempool[sizeof(info->rx_mempool) - 1] = '\0';
+  info->tx_mempool[sizeof(info->tx_mempool) - 1] = '\0';
+  return 0;
+}
+
+int machnet_direct_listen(uint32_t local_ip, uint16_t port, int listen) {
+  machnet_ctrl_msg_t req = {};
+  req.type = MACHNET_CTRL_MSG_TYPE_REQ_DIRECT_LISTEN;
+  req.direct_addr_info.local_ip = local_ip;
+  req.direct_addr_info.port = port;
+  if (!listen) {
+    req.direct_addr_info.flags = MACHNET_DIRECT_ADDR_INFO_FLAGS_UNLISTEN;
+  }
+
+  machnet_ctrl_msg_t resp;
+  return _machnet_direct_request(&req, &resp);
+}
+
+int machnet_direct_resolve(uint32_t local_ip, uint32_t remote_ip,
+                           uint8_t l2_addr[6]) {
+  machnet_ctrl_msg_t req = {};
+  req.type = MACHNET_CTRL_MSG_TYPE_REQ_DIRECT_RESOLVE;
+  req.direct_addr_info.local_ip = local_ip;
+  req.direct_addr_info.remote_ip = remote_ip;
+
+  machnet_ctrl_msg_t resp;
+  if (_machnet_direct_request(&req, &resp) != 0) return -1;
+  const uint16_t flags = resp.direct_addr_info.flags;
+  if (!(flags & MACHNET_DIRECT_ADDR_INFO_FLAGS_RESOLVED)) return 0;
+  memcpy(l2_addr, resp.direct_addr_info.l2_addr,
+         sizeof(resp.direct_addr_info.l2_addr));
+  return 1;
+}
@@ -45,7 +45,19 @@ struct MachnetMsgHdr {
   MachnetFlow_t flow_info;
   MachnetIovec_t *msg_iov;
   size_t msg_iovlen;
+  // `MACHNET_MSGBUF_NOTIFY_DELIVERY`, and `MACHNET_MSGBUF_FLAGS_PRIO` for a
+  // latency-critical message: it is served before the normal priority
+  // messages of the channel, and its packets are marked with
+  // `MACHNET_DSCP_PRIO` for the network to prioritize them too.
+  // For a chunk of a message (see `machnet_sendmsg_chunk()'),
+  // `MACHNET_MSGBUF_FLAGS_SYN` if it starts the message and
+  // `MACHNET_MSGBUF_FLAGS_FIN` if it ends it; received messages have both set,
+  // unless they are chunks of a longer one (see `MACHNET_ATTACH_F_STREAM`).
   uint16_t flags;
+  // With `MACHNET_MSGBUF_NOTIFY_DELIVERY`, the cookie to post to the
+  // completion ring once the message is delivered (see
+  // `machnet_recv_completions()`).
+  uint32_t cookie;
 };
 typedef struct MachnetMsgHdr MachnetMsgHdr_t;
 
@@ -85,6 +97,188 @@ MachnetChannelCtx_t *machnet_bind(int shm_fd, size_t *channel_size);
  */
 void *machnet_attach();
 
+// The application sends on the channel from a single thread, and receives from
+// a single (possibly different) thread. Machnet then uses single-producer,
+// single-consumer message rings, which are cheaper for both sides.
+#define MACHNET_ATTACH_F_SPSC (1 << 0)
+
+// Messages received on the channel's flows are delivered as soon as they are
+// complete, rather than in the order they were sent: a message held back by a
+// lost packet does not hold back the (complete) messages sent after it on the
+// same flow. Suits RPC workloads, whose messages are independent.
+#define MACHNET_ATTACH_F_UNORDERED (1 << 1)
+
+// Long messages received on the channel's flows are delivered in chunks, as
+// their packets arrive in order, rather than once complete (see
+// `machnet_sendmsg_chunk()'): the receiver does not have to hold a message in
+// channel buffers in full, and starts consuming it before it has arrived.
+#define MACHNET_ATTACH_F_STREAM (1 << 2)
+
+/**
+ * @brief Like `machnet_attach()', but with hints on the size of the channel, so
+ * that applications with little traffic do not hold on to memory they do not
+ * need, and busy ones get deeper rings and more buffers. The controller rounds
+ * the sizes up to a power of 2, and clamps them to its limits.
+ *
+ * @param desc_ring_size The depth of the message rings in each direction (0
+ * for the default).
+ * @param buffer_count The number of buffers in the buffer pool (0 for the
+ * default).
+ * @param flags Options for the channel (`MACHNET_ATTACH_F_*'), 0 for none.
+ * @return A pointer to the channel context on success, NULL otherwise.
+ */
+void *machnet_attach_with_hints(uint32_t desc_ring_size, uint32_t buffer_count,
+                                uint32_t flags);
+
+/**
+ * @brief Like `machnet_attach_with_hints()', but also picks the engine that
+ * serves the channel, e.g., one on the NUMA node of the application.
+ *
+ * @param desc_ring_size See `machnet_attach_with_hints()'.
+ * @param buffer_count See `machnet_attach_with_hints()'.
+ * @param flags See `machnet_attach_with_hints()'.
+ * @param policy The placement policy (`MACHNET_PLACEMENT_*').
+ * @param hint The engine for `MACHNET_PLACEMENT_ENGINE'; the NUMA node for
+ * `MACHNET_PLACEMENT_NUMA_LOCAL', or -1 for the node of the calling thread.
+ * Ignored otherwise.
+ * @return A pointer to the channel context on success, NULL otherwise (e.g.,
+ * if the requested engine does not exist).
+ */
+void *machnet_attach_with_placement(uint32_t desc_ring_size,
+                                    uint32_t buffer_count, uint32_t flags,
+                                    uint32_t policy, int32_t hint);
+
+/**
+ * @brief Gives a channel back to the Machnet controller: its flows and
+ * listeners are closed, and the channel is unmapped, so that the controller
+ * can reuse its memory for the next application that attaches (channels are
+ * also given back when the application exits). The channel context, and any
+ * buffer of the channel, must not be used afterwards.
+ *
+ * @param[in] channel_ctx The Machnet channel context.
+ * @return 0 on success, -1 on failure (the channel is unmapped regardless).
+ */
+int machnet_detach(void *channel_ctx);
+
+struct machnet_direct_queue_info;
+
+/**
+ * @brief Takes a queue pair of a NIC from the Machnet controller, for a
+ * trusted application that runs the Machnet engine itself, as a DPDK
+ * secondary process of the controller (see `juggler::DirectEngine'). The
+ * queue is the application's until it exits. The interface must be
+ * configured with `direct_queues' (and `flow_steering').
+ *
+ * @param[in,out] info The local address of the interface (0 for any); the
+ * queue granted, on success (see `machnet_direct_queue_info_t').
+ * @return 0 on success, -1 on failure (e.g., no queue is free).
+ */
+int machnet_direct_queue(struct machnet_direct_queue_info *info);
+
+/**
+ * @brief Has the controller steer the packets to a listening port to the
+ * direct queue of the application (see `machnet_direct_queue()'), or stop
+ * doing so.
+ *
+ * @param local_ip The local address (in host byte order).
+ * @param port The listening port.
+ * @param listen Non-zero to steer the port to the queue, zero to stop.
+ * @return 0 on success, -1 on failure (e.g., the port is taken).
+ */
+int machnet_direct_listen(uint32_t local_ip, uint16_t port, int listen);
+
+/**
+ * @brief Asks the controller for the MAC address of a remote host, for the
+ * engine of a direct queue (see `machnet_direct_queue()'), whose queue gets
+ * no ARP replies. If the address is not known yet, the controller resolves
+ * it, and keeps it resolved from then on.
+ *
+ * @param local_ip The local address (in host byte order).
+ * @param remote_ip The address to resolve (in host byte order).
+ * @param[out] l2_addr The MAC address, if it is resolved.
+ * @return 1 if the address is resolved, 0 if not yet (ask again later), -1
+ * on failure.
+ */
+int machnet_direct_resolve(uint32_t local_ip, uint32_t remote_ip,
+                           uint8_t l2_addr[6]);
+
+/**
+ * @brief Returns the current time in nanoseconds (of `CLOCK_MONOTONIC_RAW'),
+ * read off the TSC with the calibration that the controller publishes (see
+ * `MachnetClockPage'): without a system call, and consistent with the
+ * timestamps of the engines and of the other applications. Falls back to
+ * `clock_gettime()' before `machnet_init()', or if the controller has no
+ * clock page or the TSC is not invariant.
+ */
+uint64_t machnet_clock_ns(void);
+
+/**
+ * @brief Returns the TSC frequency (in Hz) as calibrated by the controller, so
+ * that applications can convert TSC intervals like the engines do, or 0 if it
+ * is not available (see `machnet_clock_ns()').
+ */
+uint64_t machnet_clock_tsc_hz(void);
+
+/**
+ * @brief Gets the placement of a channel: the engine serving it, the NUMA node
+ * and the CPUs that engine runs on. Applications can use it to run their
+ * threads next to the engine (e.g., on CPUs that share its L3).
+ * @param[in] channel_ctx The Machnet channel context.
+ * @param[out] placement The placement of the channel.
+ * @return 0 on success, -1 on failure.
+ */
+int machnet_get_placement(void *channel_ctx,
+                          MachnetChannelPlacement_t *placement);
+
+/**
+ * @brief Gets the engine-side statistics of a channel: the messages the engine
+ * exchanged with the application, and those it dropped. The engine publishes
+ * them in the channel every stats interval (100ms); reading them takes no
+ * round trip to it.
+ * @param[in] channel_ctx The Machnet channel context.
+ * @param[out] stats The statistics of the channel (`timestamp_ns' is 0 if the
+ * engine has not published any yet).
+ * @return 0 on success, -1 on failure (e.g., if no consistent copy could be
+ * read while the engine was updating them).
+ */
+int machnet_get_stats(const void *channel_ctx,
+                      MachnetChannelEngineStats_t *stats);
+
+/**
+ * @brief Gets the engine-side statistics of a flow of a channel (e.g., its RTT,
+ * congestion window and retransmissions), as of the last update of the
+ * statistics of the channel (see `machnet_get_stats()').
+ * @param[in] channel_ctx The Machnet channel context.
+ * @param[in] flow The flow, as returned by `machnet_connect()' or
+ * `machnet_recv()' (i.e., from either end).
+ * @param[out] stats The statistics of the flow.
+ * @return 0 on success, -1 on failure (e.g., if the flow has no record: it
+ * does not exist, or the channel has more than `MACHNET_FLOW_STATS_MAX').
+ */
+int machnet_get_flow_stats(const void *channel_ctx, const MachnetFlow_t *flow,
+                           MachnetFlowStats_t *stats);
+
+/**
+ * @brief Sets the scheduling weight of a channel: when multiple channels of an
+ * engine have messages to send, each one gets a share of the engine's TX
+ * capacity proportional to its weight. Takes effect immediately.
+ * @param[in] channel_ctx The Machnet channel context.
+ * @param[in] weight The weight, in [1, MACHNET_CHANNEL_TX_WEIGHT_MAX]
+ * (default: MACHNET_CHANNEL_TX_WEIGHT_DEFAULT).
+ * @return 0 on success, -1 on failure.
+ */
+int machnet_set_tx_weight(void *channel_ctx, uint16_t weight);
+
+/**
+ * @brief Returns the buffers cached by the calling thread for a channel to the
+ * channel's pool. Each thread caches a few buffers per channel it uses, so
+ * that threads sharing a channel do not contend on its pool; the caches are
+ * released automatically when the thread exits, so this is only needed when a
+ * thread stops using a channel early.
+ * @param[in] channel_ctx The Machnet channel context.
+ */
+void machnet_release_cached_buffers(void *channel_ctx);
+
 /**
  * @brief Listens for incoming messages on a specific IP and port.
  * @param[in] channel The channel associated to the listener.
@@ -109,6 +303,20 @@ int machnet_connect(void *channel_ctx, const char *local_ip,
                     const char *remote_ip, uint16_t remote_port,
                     MachnetFlow_t *flow);
 
+/**
+ * @brief Resolves the MAC address of a remote peer ahead of time, so that the
+ * first connection to it does not wait for ARP. Returns once the request is
+ * taken; the address is then resolved in the background, and kept resolved
+ * (see the `neighbors` key of the Machnet configuration for the equivalent at
+ * startup).
+ * @param[in] channel     The channel to issue the request on.
+ * @param[in] local_ip    The local IP address.
+ * @param[in] remote_ip   The remote IP address.
+ * @return 0 on success, -1 on failure.
+ */
+int machnet_resolve(void *channel_ctx, const char *local_ip,
+                    const char *remote_ip);
+
 /**
  * Enqueue one message for transmission to a remote peer over the network.
  *
@@ -126,7 +334,8 @@ int machnet_send(const void *channel_ctx, MachnetFlow_t flow, const void *buf,
  * peer) address. Machnet is responsible for end-to-end encrypted, reliable
  * delivery of each message to the relevant receiver. This function supports
  * SG collection of a message's buffers from the application's address
- * space.
+ * space. Messages of up to `MACHNET_MSG_INLINE_MAX' bytes are copied into the
+ * channel's ring directly, without allocating a buffer.
  *
  * @param[in] channel_ctx        The Machnet channel context
  * @param[in] msghdr             An `MachnetMsgHdr' descriptor
@@ -151,6 +360,57 @@ int machnet_sendmsg(const void *channel_ctx, const MachnetMsgHdr_t *msghdr);
 int machnet_sendmmsg(const void *channel_ctx,
                      const MachnetMsgHdr_t *msghdr_iovec, int vlen);
 
+/**
+ * This function sends a chunk of a message, which can then be sent as it is
+ * produced rather than once in full: Machnet transmits each chunk as soon as
+ * it is enqueued, and the message is not limited to `MACHNET_MSG_MAX_LEN'
+ * bytes (each chunk is). On the wire, and to a receiver that does not opt
+ * into chunks (see `MACHNET_ATTACH_F_STREAM'), the chunks are one message.
+ *
+ * The chunks of a message are sent in order, on the same flow and with the
+ * same priority, and no other message is sent on the flow in between. Chunks
+ * take channel buffers until the receiver acknowledges them, and the receiver
+ * advertises a window of the buffers it has free, so a chunk is refused (and
+ * can be retried) while the receiver is not keeping up.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in] msghdr             An `MachnetMsgHdr' descriptor of the chunk;
+ *                               its `flags` have `MACHNET_MSGBUF_FLAGS_SYN`
+ *                               set for the first chunk of the message, and
+ *                               `MACHNET_MSGBUF_FLAGS_FIN` for the last one
+ * @return                       0 on success, -1 on failure
+ */
+int machnet_sendmsg_chunk(const void *channel_ctx,
+                          const MachnetMsgHdr_t *msghdr);
+
+/**
+ * Maximum number of destinations of a message sent with
+ * `machnet_sendmsg_fanout()`.
+ */
+#define MACHNET_FANOUT_MAX 256
+
+/**
+ * This function sends one message to a number of remote peers (e.g., the
+ * subscribers of a topic). The payload is copied once into channel buffers
+ * that are shared by all the destinations, instead of once per destination:
+ * each flow is handed a chain of references to them (see
+ * `MACHNET_MSGBUF_FLAGS_REF`), and the shared buffers are freed once the last
+ * flow has had them acknowledged. It is up to Machnet to copy the payload into
+ * the packets of each flow.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in] msghdr             An `MachnetMsgHdr' descriptor; its `flow_info`
+ *                               member is ignored
+ * @param[in] flows              The flows to send the message to
+ * @param[in] flows_nr           Length of the `flows` array (at most
+ *                               `MACHNET_FANOUT_MAX`)
+ * @return                       0 if the message was sent to all of the flows,
+ *                               -1 if it was sent to none of them
+ */
+int machnet_sendmsg_fanout(const void *channel_ctx,
+                           const MachnetMsgHdr_t *msghdr,
+                           const MachnetFlow_t *flows, uint32_t flows_nr);
+
 /**
  * Receive a pending message from some remote peer over the network.
  *
@@ -178,12 +438,152 @@ ssize_t machnet_recv(const void *channel_ctx, void *buf, size_t len,
  *                               members, which describe the locations of the
  *                               buffers to which the message should be copied
  *                               to. The `flow_info` member is set by Machnet to
- *                               indicate the flow that the message belongs to.
+ *                               indicate the flow that the message belongs to,
+ *                               and the `flags` to tell chunks of a message
+ *                               apart (see `MachnetMsgHdr::flags`).
  * @return                       0 if no pending message, 1 if a message is
  *                               received, -1 on failure
  */
 int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr);
 
+/**
+ * This function receives up to `vlen` pending messages from the Machnet
+ * Channel, in batches, each dequeued with a single ring operation. The
+ * buffers of all received messages are released to the pool together.
+ *
+ * @param[in] ctx                The Machnet channel context
+ * @param[in, out] msgvec        An array of `vlen` `MachnetMsgHdr' descriptors,
+ *                               filled in as in `machnet_recvmsg()`. A message
+ *                               that does not fit in the buffers of its
+ *                               descriptor is dropped, and its `msg_size` is
+ *                               set to 0.
+ * @param[in] vlen               The number of descriptors in `msgvec`
+ * @return                       The number of (leading) descriptors in `msgvec`
+ *                               that were consumed, 0 if no pending message
+ */
+int machnet_recvmmsg(const void *channel_ctx, MachnetMsgHdr_t *msgvec,
+                     int vlen);
+
+/**
+ * This function retrieves the cookies of messages sent with
+ * `MACHNET_MSGBUF_NOTIFY_DELIVERY` (see `MachnetMsgHdr::cookie`) that their
+ * receivers acknowledged, e.g., so that the application can release its own
+ * copies of them. Machnet posts the cookies to the channel's completion ring
+ * in batches, as acknowledgments come in, in the order each flow sent its
+ * messages. The ring is as deep as the one of received messages, and cookies
+ * that do not fit are dropped (see `MachnetChannelEngineStats::
+ * completion_drops`), so the application drains it about as often.
+ * Messages sent with `machnet_sendmsg_fanout()` are not notified.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[out] cookies           An array of (at least) `n` cookies
+ * @param[in] n                  Maximum number of cookies to retrieve
+ * @return                       # of cookies retrieved (0 if none pending)
+ */
+int machnet_recv_completions(const void *channel_ctx, uint32_t *cookies,
+                             uint32_t n);
+
+/**
+ * Wait until a message is pending on the channel, without busy-polling for
+ * longer than a few microseconds. If the channel is idle, the application
+ * blocks on an eventfd that Machnet signals when it delivers the next message.
+ * Notifications are only armed while the application blocks, so receiving at
+ * a high rate costs no syscalls on either side. The eventfd is set up (through
+ * the controller) on the first call that blocks.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in] timeout_ms         Maximum time to wait in milliseconds (-1 waits
+ *                               indefinitely, 0 returns immediately)
+ * @return                       1 if a message is pending, 0 on timeout, -1 on
+ *                               failure
+ * @attention Only one thread may wait on a channel at a time.
+ */
+int machnet_wait(void *channel_ctx, int timeout_ms);
+
+/**
+ * Zero-copy send: allocate a message of `msg_size` bytes directly in channel
+ * buffers, so that the application can build its payload in place instead of
+ * having it copied by `machnet_sendmsg()`. The message is a chain of buffers,
+ * each with room reserved for its share of the payload; walk it with
+ * `machnet_msgbuf_next()`, and write each buffer's data through
+ * `machnet_msgbuf_data()` (up to `machnet_msgbuf_len()` bytes).
+ *
+ * The message is owned by the application until it is sent with
+ * `machnet_msg_send()`, or dropped with `machnet_msg_release()`.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in] msg_size           The size of the message payload in bytes
+ * @return                       The first buffer of the message, NULL on
+ *                               failure (invalid size, or out of buffers)
+ */
+MachnetMsgBuf_t *machnet_msg_alloc(const void *channel_ctx, uint32_t msg_size);
+
+/**
+ * Send a message allocated with `machnet_msg_alloc()`, without copying it. On
+ * success, ownership of the message passes to Machnet, and the application
+ * must not touch its buffers anymore.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in] flow               The flow to send the message to
+ * @param[in] msg                The first buffer of the message
+ * @param[in] flags              Message flags (e.g.,
+ *                               `MACHNET_MSGBUF_NOTIFY_DELIVERY`, see
+ *                               `MachnetMsgHdr::flags`; its cookie is the
+ *                               `cookie` of the first buffer)
+ * @return                       0 on success, -1 on failure (the application
+ *                               still owns the message)
+ */
+int machnet_msg_send(const void *channel_ctx, MachnetFlow_t flow,
+                     MachnetMsgBuf_t *msg, uint16_t flags);
+
+/**
+ * Zero-copy receive: get a read-only view of a pending message, in the
+ * channel buffers it was delivered in. The total size of the message is
+ * `msg->msg_len`; walk its buffers with `machnet_msgbuf_next()`. The buffers
+ * are borrowed by the application until it returns them with
+ * `machnet_msg_release()`; keeping many messages unreleased drains the
+ * channel's buffer pool.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[out] msg               Set to the first buffer of the message
+ * @param[out] flow              (Optional: NULL) The flow information of the
+ *                               sender
+ * @return                       0 if no pending message, 1 if a message is
+ *                               received
+ */
+int machnet_recv_zc(const void *channel_ctx, const MachnetMsgBuf_t **msg,
+                    MachnetFlow_t *flow);
+
+/**
+ * Return all the buffers of a message (received with `machnet_recv_zc()`, or
+ * allocated with `machnet_msg_alloc()` and not sent) to the channel.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in] msg                The first buffer of the message (may be NULL)
+ */
+void machnet_msg_release(const void *channel_ctx, const MachnetMsgBuf_t *msg);
+
+/**
+ * @param[in] buf                A buffer of a zero-copy message
+ * @return                       A pointer to the data of the buffer
+ */
+void *machnet_msgbuf_data(const MachnetMsgBuf_t *buf);
+
+/**
+ * @param[in] buf                A buffer of a zero-copy message
+ * @return                       The length of the data of the buffer in bytes
+ */
+uint32_t machnet_msgbuf_len(const MachnetMsgBuf_t *buf);
+
+/**
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in] buf                A buffer of a zero-copy message
+ * @return                       The next buffer of the message, NULL if `buf`
+ *                               is the last one
+ */
+MachnetMsgBuf_t *machnet_msgbuf_next(const void *channel_ctx,
+                                     const MachnetMsgBuf_t *buf);
+
 #ifdef __cplusplus
 }
 #endif
@@ -83,7 +83,8 @@ static void BM_machnet_sendmsg(benchmark::State &state) {  // NOLINT
   int channel_fd;
   MachnetChannelCtx_t *channel_ctx = __machnet_channel_create(
       channel_name, kRingSlotEntries, kRingSlotEntries, kRingSlotEntries,
-      kBufferSize, &channel_size, &is_posix_shm, &channel_fd);
+      kBufferSize, MACHNET_CHANNEL_RING_JRING, &channel_size, &is_posix_shm,
+      &channel_fd);
   if (channel_ctx == nullptr) {
     state.SkipWithError("Failed to create channel.");
     return;
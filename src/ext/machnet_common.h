@@ -22,12 +22,16 @@ extern "C" {
  *     [Ring0: Stack->Application]
  *     [Ring1: Application->Stack]
  *     [Ring2: FreeBuffers]
+ *     [Ring3: FreeSmallBuffers]
  *     [BufferIndexTable]
  *     [HUGE_PAGE_2M_SIZE aligned]
  *     [Buf#0]
  *     [Buf#1]
  *     [...]
- *     [Buf#N]
+ *     [Buf#N-1]
+ *     [SmallBuf#N]
+ *     [...]
+ *     [SmallBuf#N+M-1]
  *
  *     ControlRing(SQ) is used for communicating control messages from the
  *     application to the stack; completions are emitted by the stack in the
@@ -35,8 +39,15 @@ extern "C" {
  *     listening, etc.
  *
  *     Ring0 is used for communicating received messages from the stack to the
- *     application, and Ring1 for the opposite direction.
- *     Ring2 serves as the global pool of buffers.
+ *     application, and Ring1 for the opposite direction. They are either
+ *     `jring' rings (multi-producer/multi-consumer capable), or, for
+ *     applications that use a single sending and a single receiving thread,
+ *     descriptor-based SPSC `jring2' rings (see `data_ctx.ring_type'), whose
+ *     reader polls the slots instead of the writer's tail.
+ *     Ring2 serves as the global pool of buffers, and Ring3 as the global pool
+ *     of small buffers (see `MACHNET_MSGBUF_CLASS_SMALL'). Small buffers
+ *     follow the standard ones, and share their index space: the indices of
+ *     standard buffers are in [0, N), and those of small buffers in [N, N+M).
  *
  *     [BufferIndexTable] is a table of `MachnetRingSlot`-wide objects to be
  *     used as a temporary/scratch space for the application to allocate
@@ -46,10 +57,12 @@ extern "C" {
 
 #include <assert.h>
 #include <fcntl.h> /* For O_* constants */
+#include <stddef.h>
 #include <sys/mman.h>
 #include <sys/stat.h> /* For mode constants */
 
 #include "jring.h"
+#include "jring2.h"
 
 #define KB (1 << 10)
 #define MB (KB * KB)
@@ -59,6 +72,17 @@ extern "C" {
 #define MACHNET_MSG_MAX_LEN (8 * MB)
 #define NUM_CACHED_BUFS 64
 
+/*
+ * Buffer size classes. Standard buffers hold a full MSS worth of payload, and
+ * small buffers (of `MACHNET_MSGBUF_SMALL_SIZE' bytes in total, including the
+ * header and headroom) hold messages that fit in them. A message uses buffers
+ * of a single class, so small messages are always single-buffer ones.
+ */
+#define MACHNET_MSGBUF_CLASS_STD 0
+#define MACHNET_MSGBUF_CLASS_SMALL 1
+#define MACHNET_MSGBUF_CLASSES_NR 2
+#define MACHNET_MSGBUF_SMALL_SIZE 512
+
 #ifndef likely
 #define likely(x) __builtin_expect((x), 1)
 #endif
@@ -93,31 +117,117 @@ struct MachnetListenerInfo {
 };
 typedef struct MachnetListenerInfo MachnetListenerInfo_t;
 
+/*
+ * Inline messages. Messages of up to `MACHNET_MSG_INLINE_MAX' bytes travel in
+ * the App->Machnet ring itself, instead of in a buffer: the first slot of such
+ * a message is a header (with `MACHNET_RING_SLOT_INLINE' set, and the length
+ * and flags of the message), followed by the flow and the payload, padded to a
+ * whole number of slots (see `MachnetInlineMsg'). All the slots of a message
+ * are enqueued in bulk, so they become visible to Machnet at once. This spares
+ * the application a buffer allocation, and Machnet the misses on the header
+ * and the data of a buffer last written by another core.
+ */
+#define MACHNET_RING_SLOT_INLINE (1u << 31)
+#define MACHNET_MSG_INLINE_MAX 48
+struct MachnetInlineMsg {
+  MachnetRingSlot_t hdr;
+  MachnetFlow_t flow;
+  uint8_t data[MACHNET_MSG_INLINE_MAX];
+};
+typedef struct MachnetInlineMsg MachnetInlineMsg_t;
+static_assert(sizeof(MachnetInlineMsg_t) % sizeof(MachnetRingSlot_t) == 0,
+              "MachnetInlineMsg_t must be a whole number of ring slots");
+#define MACHNET_MSG_INLINE_SLOTS_MAX \
+  (sizeof(MachnetInlineMsg_t) / sizeof(MachnetRingSlot_t))
+
+static inline __attribute__((always_inline)) MachnetRingSlot_t
+__machnet_inline_msg_hdr(uint32_t len, uint8_t flags) {
+  assert(len <= MACHNET_MSG_INLINE_MAX);
+  return MACHNET_RING_SLOT_INLINE | ((uint32_t)flags << 16) | len;
+}
+
+static inline __attribute__((always_inline)) int __machnet_ring_slot_is_inline(
+    MachnetRingSlot_t slot) {
+  return (slot & MACHNET_RING_SLOT_INLINE) != 0;
+}
+
+static inline __attribute__((always_inline)) uint32_t __machnet_inline_msg_len(
+    MachnetRingSlot_t hdr) {
+  return hdr & 0xFFFF;
+}
+
+static inline __attribute__((always_inline)) uint8_t
+__machnet_inline_msg_flags(MachnetRingSlot_t hdr) {
+  return (hdr >> 16) & 0xFF;
+}
+
+/**
+ * Return the number of ring slots of an inline message.
+ *
+ * @param len                Length of the message (payload).
+ * @return                   Number of ring slots (header included).
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_inline_msg_slots_nr(uint32_t len) {
+  return (offsetof(MachnetInlineMsg_t, data) + len +
+          sizeof(MachnetRingSlot_t) - 1) /
+         sizeof(MachnetRingSlot_t);
+}
+
+/*
+ * Priority classes of the messages sent by an application (see
+ * `MACHNET_MSGBUF_FLAGS_PRIO'). Each class has an App->Machnet ring of its own,
+ * and Machnet serves the rings in strict priority order.
+ */
+#define MACHNET_PRIO_NORMAL 0
+#define MACHNET_PRIO_HIGH 1
+#define MACHNET_PRIO_CLASSES_NR 2
+// The DSCP the packets of high priority messages are marked with: Expedited
+// Forwarding (RFC 3246).
+#define MACHNET_DSCP_PRIO 46
+
 struct MachnetChannelDataCtx {
+// The type of the messaging rings (Ring0, Ring1). The control and the buffer
+// rings are always `jring' ones.
+#define MACHNET_CHANNEL_RING_JRING 0
+#define MACHNET_CHANNEL_RING_JRING2 1
+  uint32_t ring_type;
   size_t stats_ofs;
   size_t ctrl_sq_ring_ofs;
   size_t ctrl_cq_ring_ofs;
   size_t machnet_ring_ofs;
   size_t app_ring_ofs;
+  size_t app_prio_ring_ofs;  // App->Machnet ring of `MACHNET_PRIO_HIGH'.
+  size_t completion_ring_ofs;  // Machnet->App ring of delivery completions.
   size_t buf_ring_ofs;
+  size_t small_buf_ring_ofs;
   size_t buffer_index_table_ofs;
   size_t buf_pool_ofs;
-  size_t buf_pool_mask;
+  size_t buf_pool_mask;  // Number of standard buffers.
   uint32_t buf_size;
   uint32_t buf_mss;
+  size_t small_buf_pool_ofs;
+  uint32_t small_buf_nr;  // Number of small buffers (0 if there are none).
+  uint32_t small_buf_size;
+  uint32_t small_buf_mss;
 } __attribute__((aligned(CACHE_LINE_SIZE)));
 typedef struct MachnetChannelDataCtx MachnetChannelDataCtx_t;
 
 struct MachnetChannelCtrlCtx {
   // Mutex for protecting the control queue.
   size_t req_id;
+  // Doorbell of the control SQ: the number of requests the application ever
+  // submitted. Machnet checks it on every iteration of its engines, and serves
+  // the requests right away (see `__machnet_channel_ctrl_sq_enqueue()').
+  uint32_t sq_doorbell;
 } __attribute__((aligned(CACHE_LINE_SIZE)));
 typedef struct MachnetChannelCtrlCtx MachnetChannelCtrlCtx_t;
 
 /*
- * This data structure is used to implement a small cache of buffer indices
- * used exclusively by the application. This reduces contention on the global
- * buffer pool (which uses atomic operations for MP-safety).
+ * This data structure is used to implement a small cache of buffer indices (of
+ * a single size class) used exclusively by an application thread (it is
+ * thread-local, see `machnet.c'). This reduces contention on the global buffer
+ * pool (which uses atomic operations for MP-safety).
  */
 struct MachnetChannelAppBufferCache {
   uint32_t count;
@@ -125,6 +235,57 @@ struct MachnetChannelAppBufferCache {
 };
 typedef struct MachnetChannelAppBufferCache MachnetChannelAppBufferCache_t;
 
+/*
+ * Receive notifications (see `machnet_wait()'). The application arms them
+ * before it blocks on its eventfd, and Machnet signals the eventfd (and disarms
+ * them) when it delivers a message to an armed channel. This lives in a cache
+ * line of its own, as Machnet reads it on every delivery.
+ */
+struct MachnetChannelNotifyCtx {
+  uint32_t armed;
+  int app_fd;  // The application's eventfd (-1 if not set up yet).
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+typedef struct MachnetChannelNotifyCtx MachnetChannelNotifyCtx_t;
+
+/*
+ * Placement policies for new channels (see `machnet_attach_with_placement()').
+ */
+// The engine serving the fewest channels.
+#define MACHNET_PLACEMENT_LEAST_LOADED 0
+// The least loaded engine on the NUMA node of the application.
+#define MACHNET_PLACEMENT_NUMA_LOCAL 1
+// An engine picked by the application.
+#define MACHNET_PLACEMENT_ENGINE 2
+
+/*
+ * The engine a channel is placed on, so that applications can run their
+ * threads close to it (e.g., on the same NUMA node, or sharing its L3). Set by
+ * Machnet when it creates the channel (see `machnet_get_placement()').
+ */
+struct MachnetChannelPlacement {
+  uint32_t engine_id;  // Index of the engine serving the channel.
+  int32_t numa_node;   // NUMA node of the engine (-1 if unknown).
+  uint64_t cpu_mask;   // CPUs the engine runs on.
+};
+typedef struct MachnetChannelPlacement MachnetChannelPlacement_t;
+
+/*
+ * Tracing of a sample of the messages through the stack (see `MessageTracer'
+ * in the engine). Machnet sets `enabled' if the engine serving the channel
+ * traces messages: the application then stamps the messages it sends (see
+ * `MachnetMsgBuf::trace_tsc'), and counts the time from delivery to dequeue of
+ * the traced messages it receives (`MACHNET_MSGBUF_FLAGS_TRACE'), in TSC
+ * cycles: bucket `i' of `app_dequeue_cycles' counts delays in [2^i, 2^(i+1)).
+ * Machnet takes the counts (resetting them) as it collects them.
+ */
+#define MACHNET_TRACE_BUCKETS 32
+struct MachnetChannelTraceCtx {
+  uint32_t enabled;
+  uint32_t reserved;
+  uint64_t app_dequeue_cycles[MACHNET_TRACE_BUCKETS];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+typedef struct MachnetChannelTraceCtx MachnetChannelTraceCtx_t;
+
 /**
  * The `MachnetChannelCtx' holds all the metadata information (context) of an
  * Machnet Channel.
@@ -134,14 +295,27 @@ typedef struct MachnetChannelAppBufferCache MachnetChannelAppBufferCache_t;
 struct MachnetChannelCtx {
 #define MACHNET_CHANNEL_CTX_MAGIC 0xA5A5A5A5
   uint32_t magic;  // Magic value tagged after initialization.
-#define MACHNET_CHANNEL_VERSION 0x01
+// Version 2 added the choice of messaging ring type (`data_ctx.ring_type'),
+// version 3 the placement of the channel (`placement'), version 4 message
+// tracing (`trace_ctx'), version 5 the engine-side statistics
+// (`MachnetChannelStats::e_stats'), version 6 the control SQ doorbell
+// (`ctrl_ctx.sq_doorbell'), version 7 the high priority App->Machnet ring
+// (`data_ctx.app_prio_ring_ofs'), version 8 the delivery completion ring
+// (`data_ctx.completion_ring_ofs').
+#define MACHNET_CHANNEL_VERSION 0x08
   uint16_t version;
+#define MACHNET_CHANNEL_TX_WEIGHT_DEFAULT 1
+#define MACHNET_CHANNEL_TX_WEIGHT_MAX 64
+  uint16_t tx_weight;  // Share of the engine's TX capacity (see
+                       // `machnet_set_tx_weight()').
   uint64_t size;  // Size of the Channel's memory, including this context.
 #define MACHNET_CHANNEL_NAME_MAX_LEN 256
   char name[MACHNET_CHANNEL_NAME_MAX_LEN];
   MachnetChannelCtrlCtx_t ctrl_ctx;  // Control channel's specific metadata.
   MachnetChannelDataCtx_t data_ctx;  // Dataplane channel's specific metadata.
-  MachnetChannelAppBufferCache_t app_buffer_cache;
+  MachnetChannelNotifyCtx_t notify_ctx;
+  MachnetChannelPlacement_t placement;
+  MachnetChannelTraceCtx_t trace_ctx;
 } __attribute__((aligned(CACHE_LINE_SIZE)));
 typedef struct MachnetChannelCtx MachnetChannelCtx_t;
 
@@ -155,13 +329,69 @@ struct MachnetChannelAppStats {
 };
 typedef struct MachnetChannelAppStats MachnetChannelAppStats_t;
 
+/*
+ * Engine-side statistics of a flow (see `machnet_get_flow_stats()').
+ */
+// Flow states (`MachnetFlowStats::state').
+#define MACHNET_FLOW_STATE_CLOSED 0
+#define MACHNET_FLOW_STATE_SYN_SENT 1
+#define MACHNET_FLOW_STATE_SYN_RECEIVED 2
+#define MACHNET_FLOW_STATE_ESTABLISHED 3
+struct MachnetFlowStats {
+  MachnetFlow_t flow;  // From the application's side (`src' is local).
+  uint32_t state;      // `MACHNET_FLOW_STATE_*'.
+  double cwnd;         // Congestion window, in packets.
+  // Smoothed RTT, RTT variation and minimum RTT (0 until the first sample).
+  uint64_t srtt_ns;
+  uint64_t rttvar_ns;
+  uint64_t min_rtt_ns;
+  uint32_t snd_nxt;
+  uint32_t snd_una;
+  uint32_t rcv_nxt;
+  uint32_t rwnd;             // Receive window of the remote end, in packets.
+  uint32_t pending_msgbufs;  // Message buffers queued, not yet sent.
+  // Packets retransmitted on loss detection (modulo 2^16), retransmission
+  // timeouts since the last progress, and tail loss probes sent.
+  uint16_t fast_rexmits;
+  uint16_t rto_rexmits;
+  uint16_t tlp_probes;
+  uint16_t reserved[3];
+};
+typedef struct MachnetFlowStats MachnetFlowStats_t;
+
+/*
+ * Engine-side statistics of a channel (see `machnet_get_stats()').
+ */
+struct MachnetChannelEngineStats {
+  uint64_t timestamp_ns;  // Last update (CLOCK_REALTIME; 0 if none yet).
+  uint64_t rx_msgs;       // Messages delivered to the application.
+  uint64_t tx_msgs;       // Messages taken from the application.
+  // Packets and messages dropped as the channel was out of buffers.
+  uint64_t buf_drops;
+  uint32_t nb_flows;         // Flows with a record in `e_flows'.
+  uint32_t flows_truncated;  // Flows left out (over MACHNET_FLOW_STATS_MAX).
+  // Delivery completions lost as the completion ring was full.
+  uint64_t completion_drops;
+  uint64_t reserved[2];
+};
+typedef struct MachnetChannelEngineStats MachnetChannelEngineStats_t;
+
 /**
  * Machnet channel statistics.
  *
- * TODO(ilias): At the moment it contains statistics for the application side.
+ * The application side counts the messages it sends (`a_stats'). The engine
+ * serving the channel publishes its own counters, and those of (up to
+ * `MACHNET_FLOW_STATS_MAX') flows of the channel, every stats interval
+ * (100ms), so that applications read them without a control round trip. The
+ * engine never waits for the application: updates are published under a
+ * sequence lock, `e_seq' being odd while one is in progress.
  */
+#define MACHNET_FLOW_STATS_MAX 64
 struct MachnetChannelStats {
   MachnetChannelAppStats_t a_stats;
+  uint64_t e_seq __attribute__((aligned(CACHE_LINE_SIZE)));
+  MachnetChannelEngineStats_t e_stats;
+  MachnetFlowStats_t e_flows[MACHNET_FLOW_STATS_MAX];
 } __attribute__((aligned(CACHE_LINE_SIZE)));
 typedef struct MachnetChannelStats MachnetChannelStats_t;
 
@@ -171,6 +401,7 @@ struct MachnetCtrlQueueEntry {
 #define MACHNET_CTRL_OP_DESTROY_FLOW 0x0002
 #define MACHNET_CTRL_OP_LISTEN 0x0003
 #define MACHNET_CTRL_OP_STATUS 0x0004;
+#define MACHNET_CTRL_OP_RESOLVE 0x0005
   uint32_t opcode;
 #define MACHNET_CTRL_STATUS_OK 0x0000
 #define MACHNET_CTRL_STATUS_ERROR 0x0001
@@ -193,13 +424,42 @@ struct MachnetMsgBuf {
   const uint32_t magic;  // Magic value tagged after initialization.
   const uint32_t index;  // Index of the buffer in the buffer pool.
   const uint32_t size;   // Absolute static size of the buffer.
+  union {
+    // Index of the buffer holding the payload of a reference
+    // (`MACHNET_MSGBUF_FLAGS_REF').
+    uint32_t ref;
+    // Cookie of a message to notify the delivery of
+    // (`MACHNET_MSGBUF_NOTIFY_DELIVERY'), in its first buffer.
+    uint32_t cookie;
+  };
   const uintptr_t iova;  // IOVA address of the buffer.
 #define MACHNET_MSGBUF_FLAGS_SYN (1 << 0)
 #define MACHNET_MSGBUF_FLAGS_SG (1 << 1)
 #define MACHNET_MSGBUF_FLAGS_FIN (1 << 2)
+// The buffer is followed by the first buffer of another message (in the
+// transmit queue of a flow), or, if it is not the last of its message, by the
+// next chunk of the message, enqueued separately (see
+// `machnet_sendmsg_chunk()').
 #define MACHNET_MSGBUF_FLAGS_CHAIN (1 << 3)
+// The message is traced (see `MachnetChannelTraceCtx'); set in its first
+// buffer.
+#define MACHNET_MSGBUF_FLAGS_TRACE (1 << 4)
+// The buffer carries no payload of its own, but refers to the buffer at index
+// `ref' instead, which is shared with other references to it (see
+// `machnet_sendmsg_fanout()'). Never sent on the wire.
+#define MACHNET_MSGBUF_FLAGS_REF (1 << 5)
+// The message is of the high priority class (`MACHNET_PRIO_HIGH'); set in all
+// of its buffers, as its packets are marked on the wire too.
+#define MACHNET_MSGBUF_FLAGS_PRIO (1 << 6)
+// Post the cookie of the message to the completion ring of the channel once
+// the message is acknowledged by the receiver (see
+// `machnet_recv_completions()'); set in its first buffer.
 #define MACHNET_MSGBUF_NOTIFY_DELIVERY (1 << 7)
   uint8_t flags;
+  // Number of references to a shared buffer that are yet to be released; the
+  // buffer is freed with the last one. Only updated by the engine of the
+  // channel once the references are enqueued, so no atomics are needed.
+  uint16_t refcnt;
   MachnetFlow_t flow;  // Network flow info.
   uint32_t msg_len;    // This is the total length of the message (could be
                        // larger than the buffer size). Set in the first buffer.
@@ -210,9 +470,20 @@ struct MachnetMsgBuf {
   // If multi-buffer message (SG), last points to the last buffer index.
   // This is only set in the first buffer of the message.
   uint32_t last;
-  uint32_t reserved1[1];
+  // Low 32 bits of the TSC at the last stage of a traced message (see
+  // `MachnetChannelTraceCtx'), in its first buffer; 0 if not stamped.
+  uint32_t trace_tsc;
 } __attribute__((aligned(CACHE_LINE_SIZE)));
 typedef struct MachnetMsgBuf MachnetMsgBuf_t;
+
+/**
+ * The priority class (`MACHNET_PRIO_*') of a message with flags `flags'.
+ */
+static inline __attribute__((always_inline)) uint32_t __machnet_msg_prio(
+    uint32_t flags) {
+  return (flags & MACHNET_MSGBUF_FLAGS_PRIO) ? MACHNET_PRIO_HIGH
+                                             : MACHNET_PRIO_NORMAL;
+}
 #define MACHNET_MSGBUF_SPACE_RESERVED (sizeof(MachnetMsgBuf_t))
 static_assert(MACHNET_MSGBUF_SPACE_RESERVED == CACHE_LINE_SIZE,
               "MachnetMsgBuf_t is not aligned");
@@ -222,6 +493,7 @@ static inline __attribute__((always_inline)) void __machnet_channel_buf_init(
     MachnetMsgBuf_t *buf) {
   // Do not set the magic here. Should be set in initialization only.
   buf->flags = 0;
+  buf->refcnt = 0;
   buf->flow.src_ip = 0;
   buf->flow.dst_ip = 0;
   buf->flow.src_port = 0;
@@ -231,6 +503,96 @@ static inline __attribute__((always_inline)) void __machnet_channel_buf_init(
   buf->data_ofs = MACHNET_MSGBUF_HEADROOM_MAX;
   buf->next = UINT32_MAX;
   buf->last = UINT32_MAX;
+  buf->trace_tsc = 0;
+}
+
+// Read the TSC.
+static inline __attribute__((always_inline)) uint64_t __machnet_rdtsc(void) {
+  uint32_t hi, lo;
+  __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+  return (uint64_t)lo | ((uint64_t)hi << 32);
+}
+
+/**
+ * Stamp of the current time, for traced messages (see
+ * `MachnetMsgBuf::trace_tsc'): the low 32 bits of the TSC, never 0.
+ */
+static inline __attribute__((always_inline)) uint32_t __machnet_trace_stamp(
+    void) {
+  return (uint32_t)__machnet_rdtsc() | 1;
+}
+
+/**
+ * Account the time from delivery to dequeue of a traced message, in the
+ * buckets of the channel (see `MachnetChannelTraceCtx').
+ *
+ * @param ctx                Channel's context.
+ * @param buf                First buffer of the message.
+ */
+static inline __attribute__((always_inline)) void __machnet_trace_dequeue(
+    MachnetChannelCtx_t *ctx, const MachnetMsgBuf_t *buf) {
+  if (!(buf->flags & MACHNET_MSGBUF_FLAGS_TRACE) || buf->trace_tsc == 0)
+    return;
+  const uint32_t cycles = __machnet_trace_stamp() - buf->trace_tsc;
+  const uint32_t bucket = 31 - __builtin_clz(cycles | 1);
+  __atomic_fetch_add(&ctx->trace_ctx.app_dequeue_cycles[bucket], 1,
+                     __ATOMIC_RELAXED);
+}
+
+/*
+ * The clock page that the controller publishes (see `ClockPage' in Machnet,
+ * and `machnet_clock_ns()'), so that the engines and the applications read
+ * cheap timestamps, off the TSC, that are consistent with each other: the time
+ * at TSC value `tsc' is, in nanoseconds of `CLOCK_MONOTONIC_RAW',
+ *
+ *   base_ns + ((tsc - base_tsc) * mult) >> MACHNET_CLOCK_SHIFT
+ *
+ * The controller refines the calibration over time, and updates the page
+ * under the `seq' lock (odd while it writes it), so that readers retry
+ * instead of mixing old and new fields (see `__machnet_clock_tsc_to_ns()').
+ * The page is only usable if the TSC is invariant
+ * (`MACHNET_CLOCK_F_INVARIANT_TSC'), i.e., ticks at the same rate on all the
+ * cores and in all the power states.
+ */
+#define MACHNET_CLOCK_SHIFT 32
+#define MACHNET_CLOCK_F_INVARIANT_TSC (1 << 0)
+struct MachnetClockPage {
+  uint32_t seq;
+  uint32_t flags;
+  uint64_t tsc_hz;    // As calibrated so far.
+  uint64_t base_tsc;  // The TSC at the last refinement.
+  uint64_t base_ns;   // The time at `base_tsc'.
+  uint64_t mult;      // Nanoseconds per cycle, << `MACHNET_CLOCK_SHIFT'.
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+typedef struct MachnetClockPage MachnetClockPage_t;
+
+/**
+ * Convert a TSC value into nanoseconds (of `CLOCK_MONOTONIC_RAW'), with the
+ * calibration of a clock page (see `MachnetClockPage').
+ *
+ * @param page               The clock page.
+ * @param tsc                The TSC value.
+ * @return                   The time at `tsc', in nanoseconds.
+ */
+static inline uint64_t __machnet_clock_tsc_to_ns(const MachnetClockPage_t *page,
+                                                 uint64_t tsc) {
+  uint32_t seq;
+  uint64_t base_tsc, base_ns, mult;
+  do {
+    seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+    base_tsc = __atomic_load_n(&page->base_tsc, __ATOMIC_RELAXED);
+    base_ns = __atomic_load_n(&page->base_ns, __ATOMIC_RELAXED);
+    mult = __atomic_load_n(&page->mult, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) || seq != __atomic_load_n(&page->seq, __ATOMIC_RELAXED));
+
+  // The TSC may have been read before the last refinement.
+  if (tsc >= base_tsc) {
+    return base_ns + (uint64_t)(((unsigned __int128)(tsc - base_tsc) * mult) >>
+                                MACHNET_CLOCK_SHIFT);
+  }
+  return base_ns - (uint64_t)(((unsigned __int128)(base_tsc - tsc) * mult) >>
+                              MACHNET_CLOCK_SHIFT);
 }
 
 /**
@@ -283,14 +645,107 @@ __machnet_channel_machnet_ring(const MachnetChannelCtx_t *ctx) {
 }
 
 /**
- * Get a pointer to the `App' ring (Application->Machnet).
+ * Get a pointer to the completion ring (Machnet->Application), of the cookies
+ * of the messages delivered (see `MACHNET_MSGBUF_NOTIFY_DELIVERY').
+ *
+ * @param ctx                Channel's context.
+ * @return                   A pointer to the completion ring.
+ */
+static inline __attribute__((always_inline)) jring_t *
+__machnet_channel_completion_ring(const MachnetChannelCtx_t *ctx) {
+  return (jring_t *)__machnet_channel_mem_ofs(
+      ctx, ctx->data_ctx.completion_ring_ofs);
+}
+
+/**
+ * Get the offset of the `App' ring (Application->Machnet) of a priority class.
+ *
+ * @param ctx                Channel's context.
+ * @param prio               The priority class (`MACHNET_PRIO_*').
+ */
+static inline __attribute__((always_inline)) size_t
+__machnet_channel_app_ring_ofs(const MachnetChannelCtx_t *ctx, uint32_t prio) {
+  return prio == MACHNET_PRIO_HIGH ? ctx->data_ctx.app_prio_ring_ofs
+                                   : ctx->data_ctx.app_ring_ofs;
+}
+
+/**
+ * Get a pointer to the `App' ring (Application->Machnet) of a priority class.
+ *
+ * @param ctx                Channel's context.
+ * @param prio               The priority class (`MACHNET_PRIO_*').
+ * @return                   A pointer to the Application Ring.
+ */
+static inline __attribute__((always_inline)) jring_t *
+__machnet_channel_app_prio_ring(const MachnetChannelCtx_t *ctx,
+                                uint32_t prio) {
+  return (jring_t *)__machnet_channel_mem_ofs(
+      ctx, __machnet_channel_app_ring_ofs(ctx, prio));
+}
+
+/**
+ * Get a pointer to the `App' ring (Application->Machnet) of the normal
+ * priority class.
  *
  * @param ctx                Channel's context.
  * @return                   A pointer to the Application Ring.
  */
 static inline __attribute__((always_inline)) jring_t *
 __machnet_channel_app_ring(const MachnetChannelCtx_t *ctx) {
-  return (jring_t *)__machnet_channel_mem_ofs(ctx, ctx->data_ctx.app_ring_ofs);
+  return __machnet_channel_app_prio_ring(ctx, MACHNET_PRIO_NORMAL);
+}
+
+/**
+ * Get a pointer to the `Machnet' ring (Machnet->Application) of a channel with
+ * SPSC messaging rings (`MACHNET_CHANNEL_RING_JRING2').
+ *
+ * @param ctx                Channel's context.
+ * @return                   A pointer to the Machnet Ring.
+ */
+static inline __attribute__((always_inline)) jring2_t *
+__machnet_channel_machnet_ring2(const MachnetChannelCtx_t *ctx) {
+  assert(ctx->data_ctx.ring_type == MACHNET_CHANNEL_RING_JRING2);
+  return (jring2_t *)__machnet_channel_mem_ofs(ctx,
+                                               ctx->data_ctx.machnet_ring_ofs);
+}
+
+/**
+ * Get a pointer to the `App' ring (Application->Machnet) of a priority class,
+ * of a channel with SPSC messaging rings (`MACHNET_CHANNEL_RING_JRING2').
+ *
+ * @param ctx                Channel's context.
+ * @param prio               The priority class (`MACHNET_PRIO_*').
+ * @return                   A pointer to the Application Ring.
+ */
+static inline __attribute__((always_inline)) jring2_t *
+__machnet_channel_app_prio_ring2(const MachnetChannelCtx_t *ctx,
+                                 uint32_t prio) {
+  assert(ctx->data_ctx.ring_type == MACHNET_CHANNEL_RING_JRING2);
+  return (jring2_t *)__machnet_channel_mem_ofs(
+      ctx, __machnet_channel_app_ring_ofs(ctx, prio));
+}
+
+/**
+ * Get a pointer to the `App' ring (Application->Machnet) of the normal
+ * priority class, of a channel with SPSC messaging rings
+ * (`MACHNET_CHANNEL_RING_JRING2').
+ *
+ * @param ctx                Channel's context.
+ * @return                   A pointer to the Application Ring.
+ */
+static inline __attribute__((always_inline)) jring2_t *
+__machnet_channel_app_ring2(const MachnetChannelCtx_t *ctx) {
+  return __machnet_channel_app_prio_ring2(ctx, MACHNET_PRIO_NORMAL);
+}
+
+/**
+ * Whether the messaging rings of a channel are SPSC `jring2' ones.
+ *
+ * @param ctx                Channel's context.
+ */
+static inline __attribute__((always_inline)) int __machnet_channel_is_spsc(
+    const MachnetChannelCtx_t *ctx) {
+  return ctx->data_ctx.ring_type == MACHNET_CHANNEL_RING_JRING2;
 }
 
 /**
@@ -304,6 +759,34 @@ __machnet_channel_buf_ring(const MachnetChannelCtx_t *ctx) {
   return (jring_t *)__machnet_channel_mem_ofs(ctx, ctx->data_ctx.buf_ring_ofs);
 }
 
+/**
+ * Get a pointer to the `MsgBuf' ring of small buffers (allocator pool).
+ *
+ * @param ctx                Channel's context.
+ * @return                   A pointer to the small MsgBuf Ring.
+ */
+static inline __attribute__((always_inline)) jring_t *
+__machnet_channel_small_buf_ring(const MachnetChannelCtx_t *ctx) {
+  return (jring_t *)__machnet_channel_mem_ofs(ctx,
+                                              ctx->data_ctx.small_buf_ring_ofs);
+}
+
+/**
+ * Get a pointer to the `MsgBuf' ring of a size class.
+ *
+ * @param ctx                Channel's context.
+ * @param cls                Size class (`MACHNET_MSGBUF_CLASS_*').
+ * @return                   A pointer to the MsgBuf Ring of the class.
+ */
+static inline __attribute__((always_inline)) jring_t *
+__machnet_channel_buf_class_ring(const MachnetChannelCtx_t *ctx,
+                                 uint32_t cls) {
+  assert(cls < MACHNET_MSGBUF_CLASSES_NR);
+  return cls == MACHNET_MSGBUF_CLASS_SMALL
+             ? __machnet_channel_small_buf_ring(ctx)
+             : __machnet_channel_buf_ring(ctx);
+}
+
 /**
  * Get a pointer to the end of the `Machnet' channel.
  * @param ctx                Channel's context.
@@ -320,6 +803,17 @@ static inline MachnetRingSlot_t *__machnet_channel_buffer_index_table(
       ctx, ctx->data_ctx.buffer_index_table_ofs);
 }
 
+/**
+ * Get a pointer to the statistics of the channel.
+ * @param ctx                Channel's context.
+ * @return                   A pointer to the channel statistics.
+ */
+static inline __attribute__((always_inline)) MachnetChannelStats_t *
+__machnet_channel_stats(const MachnetChannelCtx_t *ctx) {
+  return (MachnetChannelStats_t *)__machnet_channel_mem_ofs(
+      ctx, ctx->data_ctx.stats_ofs);
+}
+
 /**
  * Get a pointer to the beginning of the buffer pool (i.e., the first MsgBuf).
  * @param ctx                Channel's context.
@@ -330,9 +824,28 @@ __machnet_channel_buf_pool(const MachnetChannelCtx_t *ctx) {
   return (uchar_t *)__machnet_channel_mem_ofs(ctx, ctx->data_ctx.buf_pool_ofs);
 }
 
+/**
+ * Get the size of the buffer pool in bytes (small buffers included).
+ * @param ctx                Channel's context.
+ * @return                   The size of the buffer pool.
+ */
 static inline __attribute__((always_inline)) size_t
 __machnet_channel_buf_pool_size(const MachnetChannelCtx_t *ctx) {
-  return ctx->data_ctx.buf_pool_mask * ctx->data_ctx.buf_size;
+  return ctx->data_ctx.buf_pool_mask * ctx->data_ctx.buf_size +
+         (size_t)ctx->data_ctx.small_buf_nr * ctx->data_ctx.small_buf_size;
+}
+
+/**
+ * Get the size class of the buffer at a particular index.
+ *
+ * @param ctx                Channel's context.
+ * @param index              Index of the buffer.
+ * @return                   The size class (`MACHNET_MSGBUF_CLASS_*').
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_buf_class(const MachnetChannelCtx_t *ctx, uint32_t index) {
+  return index < ctx->data_ctx.buf_pool_mask ? MACHNET_MSGBUF_CLASS_STD
+                                             : MACHNET_MSGBUF_CLASS_SMALL;
 }
 
 /**
@@ -344,8 +857,15 @@ __machnet_channel_buf_pool_size(const MachnetChannelCtx_t *ctx) {
  */
 static inline __attribute__((always_inline)) MachnetMsgBuf_t *
 __machnet_channel_buf(const MachnetChannelCtx_t *ctx, uint32_t index) {
-  size_t buf_ofs =
-      ctx->data_ctx.buf_pool_ofs + (size_t)index * ctx->data_ctx.buf_size;
+  size_t buf_ofs;
+  if (likely(index < ctx->data_ctx.buf_pool_mask)) {
+    buf_ofs =
+        ctx->data_ctx.buf_pool_ofs + (size_t)index * ctx->data_ctx.buf_size;
+  } else {
+    buf_ofs = ctx->data_ctx.small_buf_pool_ofs +
+              (size_t)(index - ctx->data_ctx.buf_pool_mask) *
+                  ctx->data_ctx.small_buf_size;
+  }
   return (MachnetMsgBuf_t *)__machnet_channel_mem_ofs(ctx, buf_ofs);
 }
 
@@ -362,14 +882,19 @@ __machnet_channel_buf_index(const MachnetChannelCtx_t *ctx,
                             const MachnetMsgBuf_t *buf) {
   assert(ctx != NULL);
   assert(buf != NULL);
-  const uint32_t buf_size = ctx->data_ctx.buf_size;
-  const size_t buf_pool_ofs = ctx->data_ctx.buf_pool_ofs;
+  const size_t buf_ofs =
+      (uintptr_t)buf - (uintptr_t)__machnet_channel_mem_ofs(ctx, 0);
+  if (likely(buf_ofs < ctx->data_ctx.small_buf_pool_ofs)) {
+    MachnetRingSlot_t index =
+        (buf_ofs - ctx->data_ctx.buf_pool_ofs) / ctx->data_ctx.buf_size;
+    assert(index < ctx->data_ctx.buf_pool_mask);
+    return index;
+  }
   MachnetRingSlot_t index =
-      ((uintptr_t)buf -
-       (uintptr_t)__machnet_channel_mem_ofs(ctx, buf_pool_ofs)) /
-      buf_size;
-  assert(index <= ctx->data_ctx.buf_pool_mask);
-  return index;
+      (buf_ofs - ctx->data_ctx.small_buf_pool_ofs) /
+      ctx->data_ctx.small_buf_size;
+  assert(index < ctx->data_ctx.small_buf_nr);
+  return ctx->data_ctx.buf_pool_mask + index;
 }
 
 /**
@@ -490,9 +1015,11 @@ __machnet_channel_buf_append(MachnetMsgBuf_t *buf, uint32_t len) {
 }
 
 /**
- * Allocate a number of `MsgBuf' buffers from the channel's pool.
+ * Allocate a number of `MsgBuf' buffers of a size class from the channel's
+ * pool.
  *
  * @param ctx                Channel's context.
+ * @param cls                Size class (`MACHNET_MSGBUF_CLASS_*').
  * @param n                  Number of buffers to allocate.
  * @param indices            Pointer to an array that can hold at least `n'
  *                           `MachnetRingSlot_t'-sized objects to store the
@@ -503,19 +1030,20 @@ __machnet_channel_buf_append(MachnetMsgBuf_t *buf, uint32_t len) {
  * @return                   Number of buffers allocated, either 0 or `n'.
  */
 static inline __attribute__((always_inline)) unsigned int
-__machnet_channel_buf_alloc_bulk(const MachnetChannelCtx_t *ctx, uint32_t n,
-                                 MachnetRingSlot_t *indices,
-                                 MachnetMsgBuf_t **bufs) {
+__machnet_channel_buf_class_alloc_bulk(const MachnetChannelCtx_t *ctx,
+                                       uint32_t cls, uint32_t n,
+                                       MachnetRingSlot_t *indices,
+                                       MachnetMsgBuf_t **bufs) {
   assert(ctx != NULL);
   assert(indices != NULL);
 
-  jring_t *buf_ring = __machnet_channel_buf_ring(ctx);
+  jring_t *buf_ring = __machnet_channel_buf_class_ring(ctx, cls);
 
   // Both sides can allocate buffers concurrently, so use directly the
   // multi-consumer function.
   uint32_t ret = jring_mc_dequeue_bulk(buf_ring, indices, n, NULL);
   for (uint32_t i = 0; i < ret; i++) {
-    assert(indices[i] < buf_ring->capacity);
+    assert(__machnet_channel_buf_class(ctx, indices[i]) == cls);
     // Initialize all buffers in the allocated batch.
     MachnetMsgBuf_t *msg_buf = __machnet_channel_buf(ctx, indices[i]);
     __machnet_channel_buf_init(msg_buf);
@@ -526,14 +1054,37 @@ __machnet_channel_buf_alloc_bulk(const MachnetChannelCtx_t *ctx, uint32_t n,
 }
 
 /**
- * Release a number of `MsgBuf' buffers back to the channel's pool.
+ * Allocate a number of standard `MsgBuf' buffers from the channel's pool.
+ *
+ * @param ctx                Channel's context.
+ * @param n                  Number of buffers to allocate.
+ * @param indices            Pointer to an array that can hold at least `n'
+ *                           `MachnetRingSlot_t'-sized objects to store the
+ *                           allocated buffer indexes.
+ * @param bufs               (Optional: NULL) Pointer to an array that can hold
+ *                           at least `n' pointers to `MachnetMsgBuf_t' objects
+ * to store the allocated buffer pointers.
+ * @return                   Number of buffers allocated, either 0 or `n'.
+ */
+static inline __attribute__((always_inline)) unsigned int
+__machnet_channel_buf_alloc_bulk(const MachnetChannelCtx_t *ctx, uint32_t n,
+                                 MachnetRingSlot_t *indices,
+                                 MachnetMsgBuf_t **bufs) {
+  return __machnet_channel_buf_class_alloc_bulk(ctx, MACHNET_MSGBUF_CLASS_STD,
+                                                n, indices, bufs);
+}
+
+/**
+ * Release a number of `MsgBuf' buffers back to the channel's pool. The buffers
+ * may be of any size class; each run of buffers of the same class is released
+ * to the pool of the class in bulk.
  *
  * @param ctx                Channel's context.
  * @param n                  Number of buffers to release.
  * @param bufs               Pointer to an array of `n'
  * `MachnetRingSlot_t'-sized objects that contain the indices of the buffers to
  *                           be freed.
- * @return                   Number of buffers freed, either 0 or `n'.
+ * @return                   Number of buffers freed, `n' on success.
  *                           NOTE: With correct use, this fuction must always
  *                           succeed (i.e, return `n').
  */
@@ -543,30 +1094,57 @@ __machnet_channel_buf_free_bulk(const MachnetChannelCtx_t *ctx, uint32_t n,
   assert(ctx != NULL);
   assert(bufs != NULL);
 
-  jring_t *buf_ring = __machnet_channel_buf_ring(ctx);
-
 #ifndef NDEBUG
   for (uint32_t i = 0; i < n; i++) {
-    assert(bufs[i] < buf_ring->capacity);
+    assert(bufs[i] < ctx->data_ctx.buf_pool_mask + ctx->data_ctx.small_buf_nr);
   }
 #endif
   // Both sides can release buffers concurrently, so use directly the
-  // multi-consumer function.
-  return jring_mp_enqueue_bulk(buf_ring, bufs, n, NULL);
+  // multi-producer function.
+  uint32_t freed = 0;
+  while (freed < n) {
+    const uint32_t cls = __machnet_channel_buf_class(ctx, bufs[freed]);
+    uint32_t run = 1;
+    while (freed + run < n &&
+           __machnet_channel_buf_class(ctx, bufs[freed + run]) == cls)
+      run++;
+    if (jring_mp_enqueue_bulk(__machnet_channel_buf_class_ring(ctx, cls),
+                              bufs + freed, run, NULL) != run)
+      break;
+    freed += run;
+  }
+  return freed;
 }
 
 /**
- * Return the number of free buffers in the channel's pool.
+ * Return the number of free buffers of a size class in the channel's pool.
+ * This does not count the free buffers cached by application threads (up to
+ * `NUM_CACHED_BUFS' per thread and class), which return to the pool when the
+ * threads exit.
  *
  * @param ctx                Channel's context.
+ * @param cls                Size class (`MACHNET_MSGBUF_CLASS_*').
  * @return                   Number of items free.
  */
 static inline __attribute__((always_inline)) uint32_t
-__machnet_channel_buffers_avail(const MachnetChannelCtx_t *ctx) {
+__machnet_channel_buf_class_avail(const MachnetChannelCtx_t *ctx,
+                                  uint32_t cls) {
   assert(ctx != NULL);
+  return jring_count(__machnet_channel_buf_class_ring(ctx, cls));
+}
 
-  jring_t *buf_ring = __machnet_channel_buf_ring(ctx);
-  return ctx->app_buffer_cache.count + jring_count(buf_ring);
+/**
+ * Return the number of free standard buffers in the channel's pool. This does
+ * not count the free buffers cached by application threads (up to
+ * `NUM_CACHED_BUFS' per thread), which return to the pool when the threads
+ * exit.
+ *
+ * @param ctx                Channel's context.
+ * @return                   Number of items free.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_buffers_avail(const MachnetChannelCtx_t *ctx) {
+  return __machnet_channel_buf_class_avail(ctx, MACHNET_MSGBUF_CLASS_STD);
 }
 
 /**
@@ -579,27 +1157,68 @@ static inline __attribute__((always_inline)) uint32_t
 __machnet_channel_machnet_ring_pending(const MachnetChannelCtx_t *ctx) {
   assert(ctx != NULL);
 
+  if (__machnet_channel_is_spsc(ctx))
+    return jring2_pending(__machnet_channel_machnet_ring2(ctx));
   jring_t *machnet_ring = __machnet_channel_machnet_ring(ctx);
   return jring_count(machnet_ring);
 }
 
 /**
- * Return the number of pending items in the application ring.
+ * Return the number of free slots in the Machnet ring.
+ *
+ * @attention Must only be called by the producer of the ring (i.e., Machnet).
+ *
+ * @param ctx                Channel's context.
+ * @return                   Number of free slots.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_machnet_ring_free(const MachnetChannelCtx_t *ctx) {
+  assert(ctx != NULL);
+
+  if (__machnet_channel_is_spsc(ctx)) {
+    jring2_t *machnet_ring = __machnet_channel_machnet_ring2(ctx);
+    // Refreshes the producer's count of free slots from the consumer index.
+    jring2_count(machnet_ring);
+    return machnet_ring->free_write_cnt;
+  }
+  return jring_free_count(__machnet_channel_machnet_ring(ctx));
+}
+
+/**
+ * Return the number of pending items in the application ring of a priority
+ * class.
  *
  * @param ctx                Channel's context.
+ * @param prio               The priority class (`MACHNET_PRIO_*').
  * @return                   Number of items pending.
  */
 static inline __attribute__((always_inline)) uint32_t
-__machnet_channel_app_ring_pending(const MachnetChannelCtx_t *ctx) {
+__machnet_channel_app_ring_pending_prio(const MachnetChannelCtx_t *ctx,
+                                        uint32_t prio) {
   assert(ctx != NULL);
 
-  jring_t *app_ring = __machnet_channel_app_ring(ctx);
+  if (__machnet_channel_is_spsc(ctx))
+    return jring2_pending(__machnet_channel_app_prio_ring2(ctx, prio));
+  jring_t *app_ring = __machnet_channel_app_prio_ring(ctx, prio);
   return jring_count(app_ring);
 }
 
+/**
+ * Return the number of pending items in the application rings (of all the
+ * priority classes).
+ *
+ * @param ctx                Channel's context.
+ * @return                   Number of items pending.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_app_ring_pending(const MachnetChannelCtx_t *ctx) {
+  return __machnet_channel_app_ring_pending_prio(ctx, MACHNET_PRIO_NORMAL) +
+         __machnet_channel_app_ring_pending_prio(ctx, MACHNET_PRIO_HIGH);
+}
+
 /**
  * @brief Enqueue a number of `MachnetQueueEntry' objects in the control
- * Submission Queue.
+ * Submission Queue, and ring its doorbell.
  *
  * @param ctx                Channel's context.
  * @param n                  Number of entries to enqueue.
@@ -615,7 +1234,24 @@ __machnet_channel_ctrl_sq_enqueue(const MachnetChannelCtx_t *ctx,
   assert(op != NULL);
 
   jring_t *ctrl_sq = __machnet_channel_ctrl_sq_ring(ctx);
-  return jring_enqueue_bulk(ctrl_sq, op, n, NULL);
+  const uint32_t ret = jring_enqueue_bulk(ctrl_sq, op, n, NULL);
+  if (ret != 0) {
+    __atomic_fetch_add((uint32_t *)&ctx->ctrl_ctx.sq_doorbell, ret,
+                       __ATOMIC_RELEASE);
+  }
+  return ret;
+}
+
+/**
+ * @brief The doorbell of the control Submission Queue: the number of entries
+ * ever enqueued in it.
+ *
+ * @param ctx                Channel's context.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_ctrl_sq_doorbell(const MachnetChannelCtx_t *ctx) {
+  assert(ctx != NULL);
+  return __atomic_load_n(&ctx->ctrl_ctx.sq_doorbell, __ATOMIC_ACQUIRE);
 }
 
 /**
@@ -678,13 +1314,54 @@ __machnet_channel_ctrl_cq_dequeue(const MachnetChannelCtx_t *ctx,
   return jring_dequeue_burst(ctrl_cq, op, n, NULL);
 }
 
+/**
+ * Post the cookies of a number of messages delivered to their receivers (see
+ * `MACHNET_MSGBUF_NOTIFY_DELIVERY'), as many as fit.
+ *
+ * @attention Must only be called by the producer of the ring (i.e., Machnet).
+ *
+ * @param ctx                Channel's context.
+ * @param n                  Number of cookies to post.
+ * @param cookies            Pointer to an array of `n' cookies.
+ * @return                   Number of cookies posted.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_completion_ring_enqueue(const MachnetChannelCtx_t *ctx,
+                                          unsigned int n,
+                                          const uint32_t *cookies) {
+  assert(ctx != NULL);
+  assert(cookies != NULL);
+
+  jring_t *completion_ring = __machnet_channel_completion_ring(ctx);
+  return jring_sp_enqueue_burst(completion_ring, cookies, n, NULL);
+}
+
+/**
+ * Dequeue up to `n' cookies of delivered messages from the completion ring.
+ *
+ * @param ctx                Channel's context.
+ * @param n                  Maximum number of cookies to dequeue.
+ * @param cookies            Pointer to an array that can hold `n' cookies.
+ * @return                   Number of cookies dequeued.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_completion_ring_dequeue(const MachnetChannelCtx_t *ctx,
+                                          unsigned int n, uint32_t *cookies) {
+  assert(ctx != NULL);
+  assert(cookies != NULL);
+
+  jring_t *completion_ring = __machnet_channel_completion_ring(ctx);
+  return jring_dequeue_burst(completion_ring, cookies, n, NULL);
+}
+
 /**
  * Enqueue a number of messages/`MsgBuf' buffers sent from the application to
- * the Machnet.
+ * the Machnet, in the ring of a priority class.
  * NOTE: For messages that span over multiple buffers, the caller is respnsible
  * can construct a "linked list" using the appropriate fields in `MsgBuf_t'.
  *
  * @param ctx                Channel's context.
+ * @param prio               The priority class (`MACHNET_PRIO_*').
  * @param n                  Number of buffers to enqueue.
  * @param bufs               Pointer to an array of `n'
  * `MachnetRingSlot_t'-sized objects that contain the indices of the buffers to
@@ -692,23 +1369,84 @@ __machnet_channel_ctrl_cq_dequeue(const MachnetChannelCtx_t *ctx,
  * @return                   Number of buffers sent, either 0 or `n'.
  */
 static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_app_ring_enqueue_prio(const MachnetChannelCtx_t *ctx,
+                                        uint32_t prio, unsigned int n,
+                                        const MachnetRingSlot_t *bufs) {
+  assert(ctx != NULL);
+  assert(bufs != NULL);
+
+  if (__machnet_channel_is_spsc(ctx))
+    return jring2_enqueue_bulk(__machnet_channel_app_prio_ring2(ctx, prio),
+                               bufs, n);
+
+  jring_t *app_ring = __machnet_channel_app_prio_ring(ctx, prio);
+
+  // Multiple application threads might be enqueuing concurrently.
+  return jring_mp_enqueue_bulk(app_ring, bufs, n, NULL);
+}
+
+/**
+ * Enqueue a number of messages/`MsgBuf' buffers sent from the application to
+ * the Machnet, at normal priority (see
+ * `__machnet_channel_app_ring_enqueue_prio()').
+ */
+static inline __attribute__((always_inline)) uint32_t
 __machnet_channel_app_ring_enqueue(const MachnetChannelCtx_t *ctx,
                                    unsigned int n,
                                    const MachnetRingSlot_t *bufs) {
+  return __machnet_channel_app_ring_enqueue_prio(ctx, MACHNET_PRIO_NORMAL, n,
+                                                 bufs);
+}
+
+/**
+ * Enqueue up to a number of messages/`MsgBuf' buffers sent from the
+ * application to the Machnet, in the ring of a priority class (see
+ * `__machnet_channel_app_ring_enqueue_prio()').
+ *
+ * @param ctx                Channel's context.
+ * @param prio               The priority class (`MACHNET_PRIO_*').
+ * @param n                  Maximum number of buffers to enqueue.
+ * @param bufs               Pointer to an array of `n'
+ * `MachnetRingSlot_t'-sized objects that contain the indices of the buffers to
+ *                           be sent.
+ * @return                   Number of buffers sent, ranging [0, n].
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_app_ring_enqueue_burst_prio(const MachnetChannelCtx_t *ctx,
+                                              uint32_t prio, unsigned int n,
+                                              const MachnetRingSlot_t *bufs) {
   assert(ctx != NULL);
   assert(bufs != NULL);
 
-  jring_t *app_ring = __machnet_channel_app_ring(ctx);
+  if (__machnet_channel_is_spsc(ctx))
+    return jring2_enqueue_burst(__machnet_channel_app_prio_ring2(ctx, prio),
+                                bufs, n);
+
+  jring_t *app_ring = __machnet_channel_app_prio_ring(ctx, prio);
 
   // Multiple application threads might be enqueuing concurrently.
-  return jring_mp_enqueue_bulk(app_ring, bufs, n, NULL);
+  return jring_mp_enqueue_burst(app_ring, bufs, n, NULL);
 }
 
 /**
- * Dequeue a number of pending messages/`MsgBuf' buffers destined for the
- * application.
+ * Enqueue up to a number of messages/`MsgBuf' buffers sent from the
+ * application to the Machnet, at normal priority (see
+ * `__machnet_channel_app_ring_enqueue_burst_prio()').
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_app_ring_enqueue_burst(const MachnetChannelCtx_t *ctx,
+                                         unsigned int n,
+                                         const MachnetRingSlot_t *bufs) {
+  return __machnet_channel_app_ring_enqueue_burst_prio(
+      ctx, MACHNET_PRIO_NORMAL, n, bufs);
+}
+
+/**
+ * Dequeue a number of pending messages/`MsgBuf' buffers sent by the
+ * application, from the ring of a priority class.
  *
  * @param ctx                Channel's context.
+ * @param prio               The priority class (`MACHNET_PRIO_*').
  * @param n                  Maximum number of `MsgBuf_t' to dequeue.
  * @param bufs               Pointer to an array that can hold up to `n'
  *                           `MachnetRingSlot_t'-sized objects that contain the
@@ -716,15 +1454,32 @@ __machnet_channel_app_ring_enqueue(const MachnetChannelCtx_t *ctx,
  * @return                   Number of buffers received, ranging [0, n].
  */
 static inline __attribute__((always_inline)) uint32_t
-__machnet_channel_app_ring_dequeue(const MachnetChannelCtx_t *ctx,
-                                   unsigned int n, MachnetRingSlot_t *bufs) {
-  jring_t *app_ring = __machnet_channel_app_ring(ctx);
+__machnet_channel_app_ring_dequeue_prio(const MachnetChannelCtx_t *ctx,
+                                        uint32_t prio, unsigned int n,
+                                        MachnetRingSlot_t *bufs) {
+  if (__machnet_channel_is_spsc(ctx))
+    return jring2_dequeue_burst(__machnet_channel_app_prio_ring2(ctx, prio),
+                                bufs, n);
+
+  jring_t *app_ring = __machnet_channel_app_prio_ring(ctx, prio);
 
   // Multiple application threads might be enqueuing concurrently.
   // Burst deque elements.
   return jring_mc_dequeue_burst(app_ring, bufs, n, NULL);
 }
 
+/**
+ * Dequeue a number of pending messages/`MsgBuf' buffers sent by the
+ * application at normal priority (see
+ * `__machnet_channel_app_ring_dequeue_prio()').
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_app_ring_dequeue(const MachnetChannelCtx_t *ctx,
+                                   unsigned int n, MachnetRingSlot_t *bufs) {
+  return __machnet_channel_app_ring_dequeue_prio(ctx, MACHNET_PRIO_NORMAL, n,
+                                                 bufs);
+}
+
 /**
  * Enqueue a number of messages/`MsgBuf' buffers sent from Machnet to the
  * application.
@@ -746,6 +1501,9 @@ __machnet_channel_machnet_ring_enqueue(const MachnetChannelCtx_t *ctx,
   assert(ctx != NULL);
   assert(bufs != NULL);
 
+  if (__machnet_channel_is_spsc(ctx))
+    return jring2_enqueue_bulk(__machnet_channel_machnet_ring2(ctx), bufs, n);
+
   jring_t *machnet_ring = __machnet_channel_machnet_ring(ctx);
 
   // Multiple application threads might be enqueuing concurrently.
@@ -767,6 +1525,9 @@ static inline __attribute__((always_inline)) uint32_t
 __machnet_channel_machnet_ring_dequeue(const MachnetChannelCtx_t *ctx,
                                        unsigned int n,
                                        MachnetRingSlot_t *bufs) {
+  if (__machnet_channel_is_spsc(ctx))
+    return jring2_dequeue_burst(__machnet_channel_machnet_ring2(ctx), bufs, n);
+
   jring_t *machnet_ring = __machnet_channel_machnet_ring(ctx);
 
   // Multiple application threads might be enqueuing concurrently.
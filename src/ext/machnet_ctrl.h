@@ -29,18 +29,101 @@ typedef struct machnet_app_info machnet_app_info_t;
  * @var machnet_channel_info::channel_uuid     The UUID of the application that
  * is requesting a new channel.
  * @var machnet_channel_info::desc_ring_size   The depth of the descriptor rings
- * (Machnet, App).
- * @var machnet_channel_info::buffer_count     The size of the buffer pool.
+ * (Machnet, App); 0 for the controller's default.
+ * @var machnet_channel_info::buffer_count     The size of the buffer pool; 0
+ * for the controller's default.
+ * @var machnet_channel_info::flags            Optional features requested for
+ * the channel; the response carries the ones that were granted.
+ * @var machnet_channel_info::placement        The placement policy
+ * (`MACHNET_PLACEMENT_*') for the channel.
+ * @var machnet_channel_info::engine_id        The requested engine
+ * (`MACHNET_PLACEMENT_ENGINE'); the response carries the chosen one.
+ * @var machnet_channel_info::numa_node        The NUMA node of the application
+ * (`MACHNET_PLACEMENT_NUMA_LOCAL', -1 if unknown); the response carries the
+ * node of the chosen engine.
+ *
+ * The sizes are hints: the response carries the ones the channel was created
+ * with. The controller may also hand out one of its warm channels, named after
+ * another UUID; the response carries the UUID of the channel (which is also its
+ * name, see `MachnetChannelCtx::name').
  */
 struct machnet_channel_info {
   uuid_t channel_uuid;
-#define MACHNET_CHANNEL_INFO_DESC_RING_SIZE_DEFAULT 1024
+#define MACHNET_CHANNEL_INFO_DESC_RING_SIZE_DEFAULT 256
   uint32_t desc_ring_size;
 #define MACHNET_CHANNEL_INFO_BUFFER_COUNT_DEFAULT 4096
   uint32_t buffer_count;
+// Send payloads directly from the channel buffers (zero-copy TX).
+#define MACHNET_CHANNEL_INFO_FLAGS_TX_ZEROCOPY (1 << 0)
+// The application sends and receives with (at most) one thread each, so the
+// messaging rings can be SPSC ones (`MACHNET_CHANNEL_RING_JRING2').
+#define MACHNET_CHANNEL_INFO_FLAGS_SPSC_RINGS (1 << 1)
+// Deliver received messages as soon as they are complete, in any order (see
+// `MACHNET_ATTACH_F_UNORDERED').
+#define MACHNET_CHANNEL_INFO_FLAGS_UNORDERED (1 << 2)
+// Deliver long received messages in chunks, as they arrive in order (see
+// `MACHNET_ATTACH_F_STREAM').
+#define MACHNET_CHANNEL_INFO_FLAGS_STREAM (1 << 3)
+  uint32_t flags;
+  uint32_t placement;
+  uint32_t engine_id;
+  int32_t numa_node;
 } __attribute__((packed));
 typedef struct machnet_channel_info machnet_channel_info_t;
 
+/**
+ * @struct machnet_direct_queue_info
+ * @brief A queue pair of a NIC that the controller sets aside for a trusted
+ * application that runs its own engine, as a DPDK secondary process (see
+ * `machnet_direct_queue()').
+ *
+ * @var machnet_direct_queue_info::ipv4_addr    The local address (in host
+ * byte order) of the interface to take a queue of, 0 for any; the response
+ * carries the address of the granted one.
+ * @var machnet_direct_queue_info::port_id      The DPDK port of the interface.
+ * @var machnet_direct_queue_info::queue_id     The granted RX and TX queue.
+ * @var machnet_direct_queue_info::queues_nr    The number of RX queues of the
+ * port, which split the UDP ports among them (see port steering).
+ * @var machnet_direct_queue_info::rx_mempool   The packet pool of the RX queue.
+ * @var machnet_direct_queue_info::tx_mempool   The packet pool of the TX queue.
+ */
+struct machnet_direct_queue_info {
+  uint32_t ipv4_addr;
+  uint16_t port_id;
+  uint16_t queue_id;
+  uint16_t queues_nr;
+#define MACHNET_DIRECT_QUEUE_INFO_MEMPOOL_NAME_LEN 32
+  char rx_mempool[MACHNET_DIRECT_QUEUE_INFO_MEMPOOL_NAME_LEN];
+  char tx_mempool[MACHNET_DIRECT_QUEUE_INFO_MEMPOOL_NAME_LEN];
+} __attribute__((packed));
+typedef struct machnet_direct_queue_info machnet_direct_queue_info_t;
+
+/**
+ * @struct machnet_direct_addr_info
+ * @brief A request of an application that holds a direct queue, for the
+ * controller to steer a listening port to the queue
+ * (`MACHNET_CTRL_MSG_TYPE_REQ_DIRECT_LISTEN'), or to resolve the MAC address
+ * of a remote host (`MACHNET_CTRL_MSG_TYPE_REQ_DIRECT_RESOLVE').
+ *
+ * @var machnet_direct_addr_info::local_ip   The local address (host order).
+ * @var machnet_direct_addr_info::remote_ip  The address to resolve.
+ * @var machnet_direct_addr_info::port       The listening port.
+ * @var machnet_direct_addr_info::flags      `MACHNET_DIRECT_ADDR_INFO_FLAGS_*'.
+ * @var machnet_direct_addr_info::l2_addr    The MAC address (response).
+ */
+struct machnet_direct_addr_info {
+  uint32_t local_ip;
+  uint32_t remote_ip;
+  uint16_t port;
+// Stop steering the listening port to the queue.
+#define MACHNET_DIRECT_ADDR_INFO_FLAGS_UNLISTEN (1 << 0)
+// The address is resolved, and `l2_addr' holds it (response).
+#define MACHNET_DIRECT_ADDR_INFO_FLAGS_RESOLVED (1 << 1)
+  uint16_t flags;
+  uint8_t l2_addr[6];
+} __attribute__((packed));
+typedef struct machnet_direct_addr_info machnet_direct_addr_info_t;
+
 /**
  * @struct machnet_ctrl_resp
  */
@@ -60,6 +143,20 @@ struct machnet_ctrl_msg {
 #define MACHNET_CTRL_MSG_TYPE_REQ_CHANNEL 0x02
 #define MACHNET_CTRL_MSG_TYPE_REQ_FLOW 0x03
 #define MACHNET_CTRL_MSG_TYPE_REQ_LISTEN 0x04
+// Register the eventfd (carried with the request) for receive notifications
+// on the channel in `channel_info'.
+#define MACHNET_CTRL_MSG_TYPE_REQ_NOTIFY 0x05
+// Give the channel in `channel_info' back to the controller (see
+// `machnet_detach()').
+#define MACHNET_CTRL_MSG_TYPE_REQ_DETACH 0x06
+// Take a direct queue (see `machnet_direct_queue_info'), and steer a
+// listening port to it, or resolve an address for its engine.
+#define MACHNET_CTRL_MSG_TYPE_REQ_DIRECT_QUEUE 0x07
+#define MACHNET_CTRL_MSG_TYPE_REQ_DIRECT_LISTEN 0x08
+#define MACHNET_CTRL_MSG_TYPE_REQ_DIRECT_RESOLVE 0x09
+// Map the clock page of the controller (see `MachnetClockPage'), whose file
+// descriptor comes with the response.
+#define MACHNET_CTRL_MSG_TYPE_REQ_CLOCK 0x0A
 #define MACHNET_CTRL_MSG_TYPE_RESPONSE 0x10
   uint16_t type;
   uint32_t msg_id;
@@ -68,6 +165,8 @@ struct machnet_ctrl_msg {
   union {
     machnet_app_info_t app_info;
     machnet_channel_info_t channel_info;
+    machnet_direct_queue_info_t direct_queue_info;
+    machnet_direct_addr_info_t direct_addr_info;
   };
 } __attribute__((packed));
 typedef struct machnet_ctrl_msg machnet_ctrl_msg_t;
@@ -33,12 +33,56 @@ extern "C" {
 // Macro to round up to next power of 2.
 #define ROUNDUP_U64_POW2(x) (1ULL << (64 - __builtin_clzll(((uint64_t)x) - 1)))
 
+/**
+ * Calculate the total size of each buffer of a channel (incl. metadata).
+ *
+ * @param buffer_size        The usable size of each buffer.
+ * @return                   The total size of each buffer.
+ */
+static inline size_t __machnet_channel_total_buf_size(size_t buffer_size) {
+  return ROUNDUP_U64_POW2(buffer_size + MACHNET_MSGBUF_SPACE_RESERVED +
+                          MACHNET_MSGBUF_HEADROOM_MAX);
+}
+
+/**
+ * Calculate the number of small buffers of a channel (see
+ * `MACHNET_MSGBUF_CLASS_SMALL'). Channels have as many small buffers as
+ * standard ones, unless the standard buffers are not larger than small ones.
+ *
+ * @param buf_ring_slot_nr   The number of buffers + 1 in the pool.
+ * @param buffer_size        The usable size of each (standard) buffer.
+ * @return                   The number of small buffers.
+ */
+static inline size_t __machnet_channel_small_buf_nr(size_t buf_ring_slot_nr,
+                                                    size_t buffer_size) {
+  if (__machnet_channel_total_buf_size(buffer_size) <=
+      MACHNET_MSGBUF_SMALL_SIZE)
+    return 0;
+  return buf_ring_slot_nr - 1;
+}
+
+/**
+ * Calculate the memory size needed for a messaging ring of a channel.
+ *
+ * @param slot_nr            The number of slots (must be power of 2).
+ * @param ring_type          The type of the ring (`MACHNET_CHANNEL_RING_*').
+ * @return                   The size of the ring, or (size_t)-1 on failure.
+ */
+static inline size_t __machnet_channel_msg_ring_size(size_t slot_nr,
+                                                     int ring_type) {
+  if (ring_type == MACHNET_CHANNEL_RING_JRING2)
+    return jring2_get_buf_ring_size(sizeof(MachnetRingSlot_t), slot_nr);
+  return jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), slot_nr);
+}
+
 /**
  * Calculate the memory size needed for an Machnet Dataplane channel.
  *
- * An Machnet Dataplane channel contains two rings for message passing in each
- * direction (Machnet -> Application, Application -> NSaas), and one ring that
- * holds free buffers (used for allocations).
+ * An Machnet Dataplane channel contains rings for message passing in each
+ * direction (Machnet -> Application, and Application -> NSaas, one per
+ * priority class), a ring of delivery completions (Machnet -> Application,
+ * as deep as the Machnet ring), and two rings that hold free buffers (used
+ * for allocations), one per buffer size class.
  *
  * This function returns the number of bytes needed for the channel area, given
  * the number of elements in each of the rings of the channel and the desired
@@ -46,28 +90,33 @@ extern "C" {
  *
  * @param machnet_ring_slot_nr The number of Machnet->App messaging ring slots
  * (must be power of 2).
- * @param app_ring_slot_nr   The number of App->Machnet messaging ring slots
- * (must be power of 2).
+ * @param app_ring_slot_nr   The number of slots of each App->Machnet messaging
+ * ring (must be power of 2).
  * @param buf_ring_slot_nr   The number of buffers + 1 in the pool (must be
  *                           power of 2).
  * @param buffer_size        The usable size of each buffer.
+ * @param ring_type          The type of the messaging rings
+ *                           (`MACHNET_CHANNEL_RING_*').
  * @param is_posix_shm       Whether the channel will be a POSIX shared memory.
  * @return
  *   - The memory size in bytes needed for the Machnet channel on success.
  *   - (size_t)-1 - Some parameter is not a power of 2, or the buffer size is
- *                  bad (too big).
+ *                  bad (too big), or the ring type is unknown.
  */
 static inline size_t __machnet_channel_dataplane_calculate_size(
     size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
-    size_t buf_ring_slot_nr, size_t buffer_size, int is_posix_shm) {
+    size_t buf_ring_slot_nr, size_t buffer_size, int ring_type,
+    int is_posix_shm) {
   // Check that all parameters are power of 2.
   if (!IS_POW2(machnet_ring_slot_nr) || !IS_POW2(app_ring_slot_nr) ||
       !IS_POW2(buf_ring_slot_nr))
     return -1;
+  if (ring_type != MACHNET_CHANNEL_RING_JRING &&
+      ring_type != MACHNET_CHANNEL_RING_JRING2)
+    return -1;
 
   const size_t total_buffer_size =
-      ROUNDUP_U64_POW2(buffer_size + MACHNET_MSGBUF_SPACE_RESERVED +
-                       MACHNET_MSGBUF_HEADROOM_MAX);
+      __machnet_channel_total_buf_size(buffer_size);
 
   const size_t kPageSize = (is_posix_shm ? getpagesize() : HUGE_PAGE_2M_SIZE);
   if (buffer_size > kPageSize) return -1;
@@ -88,9 +137,26 @@ static inline size_t __machnet_channel_dataplane_calculate_size(
     total_size += acc;
   }
 
-  // Add the size of the rings (Machnet, Application, BufferRing).
-  size_t data_ring_sizes[] = {machnet_ring_slot_nr, app_ring_slot_nr,
-                              buf_ring_slot_nr};
+  // Add the size of the messaging rings (Machnet, Application per priority
+  // class).
+  size_t msg_ring_sizes[] = {machnet_ring_slot_nr, app_ring_slot_nr,
+                             app_ring_slot_nr};
+  static_assert(COUNT_OF(msg_ring_sizes) == 1 + MACHNET_PRIO_CLASSES_NR,
+                "One App->Machnet ring per priority class");
+  for (size_t i = 0; i < COUNT_OF(msg_ring_sizes); i++) {
+    size_t acc = __machnet_channel_msg_ring_size(msg_ring_sizes[i], ring_type);
+    if (acc == (size_t)-1) return -1;
+    total_size += acc;
+  }
+
+  // Add the size of the completion ring, which is always a `jring'.
+  const size_t completion_ring_size =
+      jring_get_buf_ring_size(sizeof(uint32_t), machnet_ring_slot_nr);
+  if (completion_ring_size == (size_t)-1) return -1;
+  total_size += completion_ring_size;
+
+  // Add the size of the buffer rings (BufferRing, SmallBufferRing).
+  size_t data_ring_sizes[] = {buf_ring_slot_nr, buf_ring_slot_nr};
   for (size_t i = 0; i < COUNT_OF(data_ring_sizes); i++) {
     size_t acc =
         jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), data_ring_sizes[i]);
@@ -106,8 +172,10 @@ static inline size_t __machnet_channel_dataplane_calculate_size(
   // Align to page boundary.
   total_size = ALIGN_TO_BOUNDARY(total_size, kPageSize);
 
-  // Add the size of the buffers.
+  // Add the size of the buffers. The small buffers follow the standard ones.
   total_size += buf_ring_slot_nr * total_buffer_size;
+  total_size += __machnet_channel_small_buf_nr(buf_ring_slot_nr, buffer_size) *
+                MACHNET_MSGBUF_SMALL_SIZE;
 
   // Align to page boundary.
   total_size = ALIGN_TO_BOUNDARY(total_size, kPageSize);
@@ -132,6 +200,8 @@ static inline size_t __machnet_channel_dataplane_calculate_size(
  * @param buf_ring_slot_nr   The number of buffers + 1 to be used in this
  *                           channel (must sum up to a power of 2).
  * @param buffer_size        The size of each buffer.
+ * @param ring_type          The type of the messaging rings
+ *                           (`MACHNET_CHANNEL_RING_*').
  * @param is_multithread     1 if Machnet is using multiple threads per channel,
  * 0 otherwise.
  * @return                   '0' on success, '-1' on failure.
@@ -139,10 +209,11 @@ static inline size_t __machnet_channel_dataplane_calculate_size(
 static inline int __machnet_channel_dataplane_init(
     uchar_t *shm, size_t shm_size, int is_posix_shm, const char *name,
     size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
-    size_t buf_ring_slot_nr, size_t buffer_size, int is_multithread) {
+    size_t buf_ring_slot_nr, size_t buffer_size, int ring_type,
+    int is_multithread) {
   size_t total_size = __machnet_channel_dataplane_calculate_size(
       machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buffer_size,
-      is_posix_shm);
+      ring_type, is_posix_shm);
   // Guard against mismatches.
   if (total_size > shm_size || total_size == (size_t)-1) return -1;
 
@@ -153,15 +224,27 @@ static inline int __machnet_channel_dataplane_init(
   // Initialize the channel context.
   MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)shm;
   ctx->version = MACHNET_CHANNEL_VERSION;
+  ctx->data_ctx.ring_type = ring_type;
+  ctx->tx_weight = MACHNET_CHANNEL_TX_WEIGHT_DEFAULT;
   ctx->size = total_size;
   strncpy(ctx->name, name, sizeof(ctx->name));
   ctx->name[sizeof(ctx->name) - 1] = '\0';
 
   // Initiliaze the ctrl context.
   ctx->ctrl_ctx.req_id = 0;
+  ctx->ctrl_ctx.sq_doorbell = 0;
+
+  // Receive notifications are off until the application sets them up.
+  ctx->notify_ctx.armed = 0;
+  ctx->notify_ctx.app_fd = -1;
 
-  // Initialize buffer cache
-  ctx->app_buffer_cache.count = 0;
+  // Not placed on an engine yet.
+  ctx->placement.engine_id = 0;
+  ctx->placement.numa_node = -1;
+  ctx->placement.cpu_mask = 0;
+
+  // Not traced until an engine asks for it.
+  memset(&ctx->trace_ctx, 0, sizeof(ctx->trace_ctx));
 
   // Clear out statatistics.
   ctx->data_ctx.stats_ofs = sizeof(*ctx);
@@ -195,24 +278,50 @@ static inline int __machnet_channel_dataplane_init(
       jring_get_buf_ring_size(sizeof(MachnetCtrlQueueEntry_t),
                               MACHNET_CHANNEL_CTRL_CQ_SLOT_NR);
 
-  jring_t *machnet_ring = __machnet_channel_machnet_ring(ctx);
-  ret = jring_init(machnet_ring, machnet_ring_slot_nr,
-                   sizeof(MachnetRingSlot_t), is_multithread, kMultiThread);
-  if (ret != 0) return ret;
-
-  // App->Machnet ring follows immediately after the Machnet->App ring.
+  // App->Machnet ring follows immediately after the Machnet->App ring, and
+  // the one of high priority after it.
   ctx->data_ctx.app_ring_ofs =
       ctx->data_ctx.machnet_ring_ofs +
-      jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), machnet_ring_slot_nr);
-  jring_t *app_ring = __machnet_channel_app_ring(ctx);
-  ret = jring_init(app_ring, app_ring_slot_nr, sizeof(MachnetRingSlot_t),
-                   kMultiThread, is_multithread);
+      __machnet_channel_msg_ring_size(machnet_ring_slot_nr, ring_type);
+  ctx->data_ctx.app_prio_ring_ofs =
+      ctx->data_ctx.app_ring_ofs +
+      __machnet_channel_msg_ring_size(app_ring_slot_nr, ring_type);
+
+  if (ring_type == MACHNET_CHANNEL_RING_JRING2) {
+    ret = jring2_init(__machnet_channel_machnet_ring2(ctx),
+                      machnet_ring_slot_nr, sizeof(MachnetRingSlot_t));
+    if (ret != 0) return ret;
+    for (uint32_t prio = 0; prio < MACHNET_PRIO_CLASSES_NR; prio++) {
+      ret = jring2_init(__machnet_channel_app_prio_ring2(ctx, prio),
+                        app_ring_slot_nr, sizeof(MachnetRingSlot_t));
+      if (ret != 0) return ret;
+    }
+  } else {
+    jring_t *machnet_ring = __machnet_channel_machnet_ring(ctx);
+    ret = jring_init(machnet_ring, machnet_ring_slot_nr,
+                     sizeof(MachnetRingSlot_t), is_multithread, kMultiThread);
+    if (ret != 0) return ret;
+    for (uint32_t prio = 0; prio < MACHNET_PRIO_CLASSES_NR; prio++) {
+      jring_t *app_ring = __machnet_channel_app_prio_ring(ctx, prio);
+      ret = jring_init(app_ring, app_ring_slot_nr, sizeof(MachnetRingSlot_t),
+                       kMultiThread, is_multithread);
+      if (ret != 0) return ret;
+    }
+  }
+
+  // The completion ring follows the App->Machnet rings. Machnet is its only
+  // producer.
+  // __machnet_channel_msg_ring_size() cannot fail here.
+  ctx->data_ctx.completion_ring_ofs =
+      ctx->data_ctx.app_prio_ring_ofs +
+      __machnet_channel_msg_ring_size(app_ring_slot_nr, ring_type);
+  ret = jring_init(__machnet_channel_completion_ring(ctx), machnet_ring_slot_nr,
+                   sizeof(uint32_t), 0, is_multithread);
   if (ret != 0) return ret;
 
-  // jring_get_buf_ring_size() cannot fail here.
   ctx->data_ctx.buf_ring_ofs =
-      ctx->data_ctx.app_ring_ofs +
-      jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), app_ring_slot_nr);
+      ctx->data_ctx.completion_ring_ofs +
+      jring_get_buf_ring_size(sizeof(uint32_t), machnet_ring_slot_nr);
 
   // Initialize the buffer ring.
   jring_t *buf_ring = __machnet_channel_buf_ring(ctx);
@@ -220,10 +329,19 @@ static inline int __machnet_channel_dataplane_init(
                    kMultiThread, kMultiThread);
   if (ret != 0) return ret;
 
-  // Offset in memory channel where the final ring ends (buf_ring).
-  size_t buf_ring_end_ofs =
+  // The ring of small buffers follows immediately after the buffer ring.
+  ctx->data_ctx.small_buf_ring_ofs =
       ctx->data_ctx.buf_ring_ofs +
       jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), buf_ring_slot_nr);
+  jring_t *small_buf_ring = __machnet_channel_small_buf_ring(ctx);
+  ret = jring_init(small_buf_ring, buf_ring_slot_nr, sizeof(MachnetRingSlot_t),
+                   kMultiThread, kMultiThread);
+  if (ret != 0) return ret;
+
+  // Offset in memory channel where the final ring ends (small_buf_ring).
+  size_t buf_ring_end_ofs =
+      ctx->data_ctx.small_buf_ring_ofs +
+      jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), buf_ring_slot_nr);
 
   // Offset in memory, of the scratch buffer index table.
   ctx->data_ctx.buffer_index_table_ofs =
@@ -233,9 +351,7 @@ static inline int __machnet_channel_dataplane_init(
       buf_ring_slot_nr * sizeof(MachnetRingSlot_t);
 
   // Calculate the actual buffer size (incl. metadata).
-  const size_t kTotalBufSize =
-      ROUNDUP_U64_POW2(buffer_size + MACHNET_MSGBUF_SPACE_RESERVED +
-                       MACHNET_MSGBUF_HEADROOM_MAX);
+  const size_t kTotalBufSize = __machnet_channel_total_buf_size(buffer_size);
 
   // Initialize the buffers. Note that the buffer pool start is aligned to the
   // page_size boundary.
@@ -246,29 +362,51 @@ static inline int __machnet_channel_dataplane_init(
   ctx->data_ctx.buf_size = kTotalBufSize;
   ctx->data_ctx.buf_mss = buffer_size;
 
+  // The small buffers follow the standard ones, so that the whole pool is a
+  // single contiguous area (e.g., for DMA registration).
+  ctx->data_ctx.small_buf_pool_ofs =
+      ctx->data_ctx.buf_pool_ofs + buf_ring->capacity * kTotalBufSize;
+  ctx->data_ctx.small_buf_nr =
+      __machnet_channel_small_buf_nr(buf_ring_slot_nr, buffer_size);
+  ctx->data_ctx.small_buf_size = MACHNET_MSGBUF_SMALL_SIZE;
+  ctx->data_ctx.small_buf_mss = ctx->data_ctx.small_buf_nr == 0
+                                    ? 0
+                                    : MACHNET_MSGBUF_SMALL_SIZE -
+                                          MACHNET_MSGBUF_SPACE_RESERVED -
+                                          MACHNET_MSGBUF_HEADROOM_MAX;
+
   // Initialize the message header of each buffer.
-  for (uint32_t i = 0; i < buf_ring->capacity; i++) {
+  const uint32_t buffers_nr = buf_ring->capacity + ctx->data_ctx.small_buf_nr;
+  for (uint32_t i = 0; i < buffers_nr; i++) {
     MachnetMsgBuf_t *buf = __machnet_channel_buf(ctx, i);
+    const uint32_t mss = i < buf_ring->capacity ? ctx->data_ctx.buf_mss
+                                                : ctx->data_ctx.small_buf_mss;
     __machnet_channel_buf_init(buf);
     // The following fields should only be initialized once here.
     *__DECONST(uint32_t *, &buf->magic) = MACHNET_MSGBUF_MAGIC;
     *__DECONST(uint32_t *, &buf->index) = i;
-    *__DECONST(uint32_t *, &buf->size) =
-        buffer_size + MACHNET_MSGBUF_HEADROOM_MAX;
+    *__DECONST(uint32_t *, &buf->size) = mss + MACHNET_MSGBUF_HEADROOM_MAX;
   }
 
   // Initialize the buffer index table, and make all these buffers available.
-  MachnetRingSlot_t *buf_index_table = (MachnetRingSlot_t *)malloc(
-      buf_ring->capacity * sizeof(MachnetRingSlot_t));
+  MachnetRingSlot_t *buf_index_table =
+      (MachnetRingSlot_t *)malloc(buffers_nr * sizeof(MachnetRingSlot_t));
   if (buf_index_table == NULL) return -1;
 
-  for (size_t i = 0; i < buf_ring->capacity; i++) buf_index_table[i] = i;
+  for (size_t i = 0; i < buffers_nr; i++) buf_index_table[i] = i;
 
   unsigned int free_space;
   int enqueued = jring_enqueue_bulk(buf_ring, buf_index_table,
                                     buf_ring->capacity, &free_space);
+  if (((size_t)enqueued != buf_ring->capacity) || (free_space != 0)) {
+    free(buf_index_table);
+    return -1;  // Enqueue has failed.
+  }
+  enqueued = jring_enqueue_bulk(small_buf_ring,
+                                buf_index_table + buf_ring->capacity,
+                                ctx->data_ctx.small_buf_nr, NULL);
   free(buf_index_table);
-  if (((size_t)enqueued != buf_ring->capacity) || (free_space != 0))
+  if ((size_t)enqueued != ctx->data_ctx.small_buf_nr)
     return -1;  // Enqueue has failed.
 
   // Set the header magic at the end.
@@ -452,6 +590,9 @@ static inline void __machnet_channel_destroy(void *mapped_mem,
  * @param[in] machnet_ring_slot_nr     Number of slots in the Machnet ring.
  * @param[in] app_ring_slot_nr       Number of slots in the application ring.
  * @param[in] buf_ring_slot_nr       Number of slots in the buffer ring.
+ * @param[in] buffer_size            The usable size of each buffer.
+ * @param[in] ring_type              The type of the messaging rings
+ *                                   (`MACHNET_CHANNEL_RING_*').
  * @param[out] channel_mem_size      (ptr) The real size of the underlying
  * shared memory segment. Can differ from `channel_size` because of alignment
  * reasons (e.g, 4K or 2MB).
@@ -465,7 +606,7 @@ static inline void __machnet_channel_destroy(void *mapped_mem,
 static inline MachnetChannelCtx_t *__machnet_channel_create(
     const char *channel_name, size_t machnet_ring_slot_nr,
     size_t app_ring_slot_nr, size_t buf_ring_slot_nr, size_t buffer_size,
-    size_t *channel_mem_size, int *is_posix_shm, int *shm_fd) {
+    int ring_type, size_t *channel_mem_size, int *is_posix_shm, int *shm_fd) {
   assert(channel_name != NULL);
   assert(shm_fd != NULL);
   assert(channel_mem_size != NULL);
@@ -476,7 +617,7 @@ static inline MachnetChannelCtx_t *__machnet_channel_create(
   *is_posix_shm = 0;
   *channel_mem_size = __machnet_channel_dataplane_calculate_size(
       machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buffer_size,
-      *is_posix_shm);
+      ring_type, *is_posix_shm);
   // Try creating and mapping a hugetlbfs backed shared memory segment.
   channel = __machnet_channel_hugetlbfs_create(channel_name, *channel_mem_size,
                                                shm_fd);
@@ -491,7 +632,7 @@ static inline MachnetChannelCtx_t *__machnet_channel_create(
   *is_posix_shm = 1;
   *channel_mem_size = __machnet_channel_dataplane_calculate_size(
       machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buffer_size,
-      *is_posix_shm);
+      ring_type, *is_posix_shm);
   channel =
       __machnet_channel_posix_create(channel_name, *channel_mem_size, shm_fd);
   if (channel != NULL) goto out;
@@ -503,7 +644,8 @@ out:
   // The shared memory segment is created and mapped. Initialize it.
   int ret = __machnet_channel_dataplane_init(
       (uchar_t *)channel, *channel_mem_size, *is_posix_shm, channel_name,
-      machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buffer_size, 0);
+      machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buffer_size,
+      ring_type, 0);
   if (ret != 0) {
     __machnet_channel_destroy((void *)channel, *channel_mem_size, shm_fd,
                               *is_posix_shm, channel_name);
@@ -519,9 +661,7 @@ static inline __attribute__((always_inline)) uint32_t __machnet_channel_enqueue(
     const MachnetChannelCtx_t *ctx, unsigned int n,
     const MachnetRingSlot_t *bufs) {
   assert(ctx != NULL);
-  jring_t *machnet_ring = __machnet_channel_machnet_ring(ctx);
-
-  return jring_enqueue_bulk(machnet_ring, bufs, n, NULL);
+  return __machnet_channel_machnet_ring_enqueue(ctx, n, bufs);
 }
 
 #ifdef __cplusplus
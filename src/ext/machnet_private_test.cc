@@ -11,7 +11,8 @@ TEST(MachnetPrivateTest, NSaasChannelCalcShMemSize) {
   auto calc_func = [](size_t machnet_r_slots, size_t app_r_slots,
                       size_t buf_r_slots, size_t buffer_size) {
     return __machnet_channel_dataplane_calculate_size(
-        machnet_r_slots, app_r_slots, buf_r_slots, buffer_size, 0);
+        machnet_r_slots, app_r_slots, buf_r_slots, buffer_size,
+        MACHNET_CHANNEL_RING_JRING, 0);
   };
 
   const uint32_t kMaxCount = std::min(65536u, RING_SZ_MASK);
@@ -41,7 +42,8 @@ TEST(MachnetPrivateTest, NSaasChannelCreateDestroy) {
   int channel_fd;
   MachnetChannelCtx_t *channel_ctx = __machnet_channel_create(
       channel_name.c_str(), kChannelRingSize, kChannelRingSize,
-      kChannelRingSize, kBufferSize, &channel_size, &is_posix_shm, &channel_fd);
+      kChannelRingSize, kBufferSize, MACHNET_CHANNEL_RING_JRING, &channel_size,
+      &is_posix_shm, &channel_fd);
   EXPECT_NE(channel_ctx, nullptr);
 
   // Destroy the channel (should succeed).
@@ -61,7 +63,8 @@ TEST(MachnetPrivateTest, NSaasChannelDataplaneInit) {
   int channel_fd;
   MachnetChannelCtx_t *channel_ctx = __machnet_channel_create(
       channel_name.c_str(), kChannelRingSize, kChannelRingSize,
-      kChannelRingSize, kBufferSize, &channel_size, &is_posix_shm, &channel_fd);
+      kChannelRingSize, kBufferSize, MACHNET_CHANNEL_RING_JRING, &channel_size,
+      &is_posix_shm, &channel_fd);
   EXPECT_NE(channel_ctx, nullptr);
   EXPECT_EQ(channel_ctx->magic, MACHNET_CHANNEL_CTX_MAGIC);
   EXPECT_EQ(std::string(channel_ctx->name), channel_name);
@@ -84,7 +87,8 @@ TEST(MachnetPrivateTest, NSaasChannelBufAllocFree) {
   int channel_fd;
   auto *channel = __machnet_channel_create(
       channel_name.c_str(), kChannelRingSize, kChannelRingSize,
-      kChannelRingSize, kBufferSize, &channel_size, &is_posix_shm, &channel_fd);
+      kChannelRingSize, kBufferSize, MACHNET_CHANNEL_RING_JRING, &channel_size,
+      &is_posix_shm, &channel_fd);
   EXPECT_NE(channel, nullptr);
   EXPECT_EQ(channel->magic, MACHNET_CHANNEL_CTX_MAGIC);
   EXPECT_EQ(std::string(channel->name), channel_name);
@@ -149,7 +153,8 @@ TEST(MachnetBufferPool, Concurrency) {
   int channel_fd;
   auto *channel = __machnet_channel_create(
       channel_name.c_str(), kChannelRingSize, kChannelRingSize,
-      kChannelRingSize, kBufferSize, &channel_size, &is_posix_shm, &channel_fd);
+      kChannelRingSize, kBufferSize, MACHNET_CHANNEL_RING_JRING, &channel_size,
+      &is_posix_shm, &channel_fd);
   EXPECT_NE(channel, nullptr);
   EXPECT_EQ(channel->magic, MACHNET_CHANNEL_CTX_MAGIC);
   EXPECT_EQ(std::string(channel->name), channel_name);
@@ -0,0 +1,565 @@
+/**
+ * @file machnet_rpc.h
+ * @brief A lightweight RPC layer on top of Machnet channels: request IDs,
+ * response matching, timeouts and dispatch to handlers, without per-request
+ * allocations or locks.
+ *
+ * An `rpc::Endpoint' serves a channel from a single thread (e.g., one
+ * endpoint and channel per worker thread): it is a client, a server, or both.
+ * Clients issue calls with `Call()' (with a callback) or `AsyncCall()' (from a
+ * C++20 coroutine), and servers register handlers by request type; both are
+ * run by `Poll()', which receives a batch of messages, completes the calls
+ * they answer, runs the handlers of the requests to completion, and sends the
+ * responses in a batch.
+ *
+ * Each message starts with an `rpc::Header'. A call takes one of a fixed
+ * number of slots of the endpoint, preallocated with room for its callback;
+ * the response names the slot and its generation (a new one for each call),
+ * so matching it is a lookup in an array, and a late response to a call that
+ * timed out is told apart from the one of the next call of the slot.
+ */
+#ifndef SRC_EXT_MACHNET_RPC_H_
+#define SRC_EXT_MACHNET_RPC_H_
+
+#include <assert.h>
+#include <machnet.h>
+
+#include <algorithm>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace juggler {
+namespace rpc {
+
+/**
+ * @brief The header of each RPC message.
+ */
+struct __attribute__((packed)) Header {
+  static constexpr uint16_t kMagic = 0x5250;  // "RP"
+  enum Kind : uint8_t {
+    kRequest = 0,
+    kResponse = 1,
+  };
+
+  uint16_t magic;
+  uint8_t kind;
+  // The request type, which selects the handler (echoed in the response).
+  uint8_t type;
+  // The `Status' of a response.
+  uint16_t status;
+  uint16_t reserved;
+  // The slot of the call at the client, and its generation.
+  uint32_t slot;
+  uint32_t gen;
+};
+static_assert(sizeof(Header) == 16);
+
+enum class Status : uint16_t {
+  kOk = 0,
+  // No response came within the timeout of the endpoint.
+  kTimeout = 1,
+  // The server has no handler for the request type.
+  kNoHandler = 2,
+  // The response did not fit in a message.
+  kTooLarge = 3,
+  // All the slots of the endpoint were taken (see `AsyncCall()').
+  kNoSlot = 4,
+};
+
+/**
+ * @brief The outcome of a call, for its callback. The payload points into a
+ * buffer of the endpoint, and is only valid until the callback returns (or
+ * until the coroutine of `AsyncCall()' suspends again).
+ */
+struct Result {
+  Status status;
+  std::span<const uint8_t> payload;
+};
+
+/**
+ * @brief A request received by a server, for its handler. The payload is only
+ * valid until the handler returns.
+ */
+struct Request {
+  MachnetFlow_t flow;
+  uint8_t type;
+  std::span<const uint8_t> payload;
+};
+
+/**
+ * @brief The response to a request, filled in by its handler: either written
+ * into the buffer of the endpoint (`data()', up to `capacity()' bytes, then
+ * `set_size()'), or pointing to memory of the handler's (`Reference()'),
+ * which must stay valid until the endpoint sends the response, i.e., until
+ * `Poll()' returns.
+ */
+class Response {
+ public:
+  uint8_t *data() { return buffer_; }
+  size_t capacity() const { return capacity_; }
+  void set_size(size_t size) {
+    assert(size <= capacity_);
+    payload_ = buffer_;
+    size_ = size;
+  }
+  void Reference(const void *payload, size_t size) {
+    payload_ = payload;
+    size_ = size;
+  }
+  size_t size() const { return size_; }
+  const void *payload() const { return payload_; }
+
+ private:
+  friend class Endpoint;
+  void Reset(uint8_t *buffer, size_t capacity) {
+    buffer_ = buffer;
+    capacity_ = capacity;
+    payload_ = buffer;
+    size_ = 0;
+  }
+
+  uint8_t *buffer_{nullptr};
+  size_t capacity_{0};
+  const void *payload_{nullptr};
+  size_t size_{0};
+};
+
+/**
+ * @brief The callback of a call, held in place in its slot: callables of up
+ * to `kInlineSize' bytes (e.g., lambdas capturing a few pointers) are stored
+ * without allocating.
+ */
+class Callback {
+ public:
+  static constexpr size_t kInlineSize = 48;
+
+  Callback() = default;
+  Callback(const Callback &) = delete;
+  Callback &operator=(const Callback &) = delete;
+  ~Callback() { Reset(); }
+
+  template <typename F>
+  void Emplace(F &&f) {
+    using Fn = std::decay_t<F>;
+    static_assert(sizeof(Fn) <= kInlineSize,
+                  "The callback captures too much: capture a pointer instead");
+    static_assert(alignof(Fn) <= alignof(std::max_align_t));
+    Reset();
+    new (storage_) Fn(std::forward<F>(f));
+    invoke_ = [](void *fn, const Result &result) {
+      (*static_cast<Fn *>(fn))(result);
+    };
+    destroy_ = [](void *fn) { static_cast<Fn *>(fn)->~Fn(); };
+  }
+
+  // Call the callback once, and destroy it.
+  void Complete(const Result &result) {
+    assert(invoke_ != nullptr);
+    invoke_(storage_, result);
+    Reset();
+  }
+
+ private:
+  void Reset() {
+    if (destroy_ != nullptr) destroy_(storage_);
+    invoke_ = nullptr;
+    destroy_ = nullptr;
+  }
+
+  alignas(std::max_align_t) unsigned char storage_[kInlineSize];
+  void (*invoke_)(void *, const Result &){nullptr};
+  void (*destroy_)(void *){nullptr};
+};
+
+/**
+ * @brief The return type of coroutines that issue calls with `AsyncCall()':
+ * they start right away, run inside `Poll()' once resumed, and free their
+ * state when they return. The endpoint must outlive them.
+ */
+struct Task {
+  struct promise_type {
+    Task get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::abort(); }
+  };
+};
+
+struct Options {
+  // The number of calls in flight, at most.
+  uint32_t slots = 256;
+  // The number of messages received (and sent) at a time.
+  uint32_t batch_size = 32;
+  // The size of the largest message (header included) received or sent.
+  uint32_t max_msg_size = 8192;
+  // Calls with no response by then complete with `Status::kTimeout' (0: they
+  // never time out).
+  uint64_t timeout_ns = 1'000'000'000;
+  // The `MachnetMsgHdr::flags' of the messages sent (e.g.,
+  // `MACHNET_MSGBUF_FLAGS_PRIO').
+  uint16_t msg_flags = 0;
+};
+
+struct Stats {
+  uint64_t calls = 0;
+  uint64_t completions = 0;
+  uint64_t timeouts = 0;
+  // Responses to calls that had already completed (e.g., timed out).
+  uint64_t stale_responses = 0;
+  uint64_t requests = 0;
+  // Received messages that were not RPC messages, or did not fit.
+  uint64_t rx_invalid = 0;
+  // Times the channel was full when sending.
+  uint64_t tx_backpressure = 0;
+};
+
+/**
+ * @brief Class `Endpoint' runs RPCs over a channel (see the top of the file).
+ *
+ * @attention Not thread-safe: an endpoint is used by a single thread, and
+ * callbacks, handlers and coroutines run in that thread, inside `Poll()'.
+ * They may issue calls, but must not call `Poll()' themselves. The callbacks
+ * of the calls still in flight when the endpoint is destroyed are not called
+ * (and their coroutines are not resumed).
+ */
+class Endpoint {
+ public:
+  using Handler = std::function<void(const Request &, Response *)>;
+  // Handles the `n' consecutive requests of a type in a received batch at
+  // once (e.g., to look their keys up together).
+  using BatchHandler =
+      std::function<void(const Request *, Response *, size_t n)>;
+
+  explicit Endpoint(void *channel_ctx, const Options &options = Options())
+      : channel_ctx_(channel_ctx),
+        options_(options),
+        msg_stride_((options.max_msg_size + 63) & ~size_t{63}),
+        slots_(options.slots),
+        rx_buffers_(msg_stride_ * options.batch_size),
+        rx_iov_(options.batch_size),
+        rx_msghdr_(options.batch_size),
+        requests_(options.batch_size),
+        request_msgs_(options.batch_size),
+        responses_(options.batch_size),
+        response_buffers_(msg_stride_ * options.batch_size),
+        tx_capacity_(2 * options.batch_size),
+        tx_hdr_(tx_capacity_),
+        tx_iov_(2 * tx_capacity_),
+        tx_msghdr_(tx_capacity_) {
+    assert(channel_ctx_ != nullptr);
+    assert(options.slots > 0 && options.batch_size > 0);
+    assert(options.max_msg_size > sizeof(Header) &&
+           options.max_msg_size <= MACHNET_MSG_MAX_LEN);
+    free_slots_.reserve(options.slots);
+    for (uint32_t i = options.slots; i > 0; i--) free_slots_.push_back(i - 1);
+    for (uint32_t i = 0; i < options.batch_size; i++) {
+      rx_iov_[i].base = &rx_buffers_[i * msg_stride_];
+      rx_iov_[i].len = options.max_msg_size;
+    }
+  }
+  Endpoint(const Endpoint &) = delete;
+  Endpoint &operator=(const Endpoint &) = delete;
+
+  // Register a handler for the requests of a type (replacing any).
+  void Register(uint8_t type, Handler handler) {
+    handlers_[type] = {std::move(handler), nullptr};
+  }
+  void RegisterBatch(uint8_t type, BatchHandler handler) {
+    handlers_[type] = {nullptr, std::move(handler)};
+  }
+
+  /**
+   * @brief Issue a call: the request is sent by the next `Flush()' (or
+   * `Poll()'), and `callback' is called with the `Result' by the `Poll()'
+   * that receives the response, or finds that it timed out.
+   *
+   * @param flow The flow to the server.
+   * @param type The request type.
+   * @param payload The request, which must stay valid until it is sent.
+   * @return False if all the slots are taken, or the request is too large;
+   * the callback is then not called.
+   */
+  template <typename F>
+  bool Call(const MachnetFlow_t &flow, uint8_t type,
+            std::span<const uint8_t> payload, F &&callback) {
+    if (free_slots_.empty() ||
+        payload.size() > options_.max_msg_size - sizeof(Header)) {
+      return false;
+    }
+    const uint32_t index = free_slots_.back();
+    free_slots_.pop_back();
+    auto &slot = slots_[index];
+    slot.busy = true;
+    slot.gen++;
+    slot.deadline_ns =
+        options_.timeout_ns != 0 ? machnet_clock_ns() + options_.timeout_ns : 0;
+    slot.callback.Emplace(std::forward<F>(callback));
+    Enqueue(flow, {Header::kMagic, Header::kRequest, type, 0, 0, index,
+                   slot.gen},
+            payload.data(), payload.size());
+    stats_.calls++;
+    return true;
+  }
+
+  /**
+   * @brief Issue a call from a coroutine (see `Task'): `co_await' it for the
+   * `Result', e.g., `auto result = co_await endpoint.AsyncCall(...);'. If no
+   * slot is free (or the request is too large), it completes right away with
+   * `Status::kNoSlot'.
+   */
+  class CallAwaiter {
+   public:
+    bool await_ready() const { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) {
+      return endpoint_->Call(flow_, type_, payload_,
+                             [this, handle](const Result &result) {
+                               result_ = result;
+                               handle.resume();
+                             });
+    }
+    Result await_resume() const { return result_; }
+
+   private:
+    friend class Endpoint;
+    CallAwaiter(Endpoint *endpoint, const MachnetFlow_t &flow, uint8_t type,
+                std::span<const uint8_t> payload)
+        : endpoint_(endpoint), flow_(flow), type_(type), payload_(payload) {}
+
+    Endpoint *const endpoint_;
+    const MachnetFlow_t flow_;
+    const uint8_t type_;
+    const std::span<const uint8_t> payload_;
+    Result result_{Status::kNoSlot, {}};
+  };
+  CallAwaiter AsyncCall(const MachnetFlow_t &flow, uint8_t type,
+                        std::span<const uint8_t> payload) {
+    return CallAwaiter(this, flow, type, payload);
+  }
+
+  /**
+   * @brief Receive a batch of messages and handle them: complete the calls
+   * they answer, and run the handlers of the requests and send their
+   * responses. Then time calls out, and send the pending messages.
+   * @return The number of messages received.
+   */
+  size_t Poll() {
+    for (uint32_t i = 0; i < options_.batch_size; i++) {
+      rx_msghdr_[i].msg_size = 0;
+      rx_msghdr_[i].msg_iov = &rx_iov_[i];
+      rx_msghdr_[i].msg_iovlen = 1;
+    }
+    const int nb_rx = machnet_recvmmsg(channel_ctx_, rx_msghdr_.data(),
+                                       static_cast<int>(options_.batch_size));
+    size_t nb_requests = 0;
+    for (int i = 0; i < nb_rx; i++) {
+      const auto &msghdr = rx_msghdr_[i];
+      const auto *data = static_cast<const uint8_t *>(rx_iov_[i].base);
+      Header hdr;
+      if (msghdr.msg_size < sizeof(hdr)) [[unlikely]] {  // NOLINT
+        stats_.rx_invalid++;
+        continue;
+      }
+      std::memcpy(&hdr, data, sizeof(hdr));
+      if (hdr.magic != Header::kMagic ||
+          hdr.kind > Header::kResponse) [[unlikely]] {  // NOLINT
+        stats_.rx_invalid++;
+        continue;
+      }
+      const std::span<const uint8_t> payload(data + sizeof(hdr),
+                                             msghdr.msg_size - sizeof(hdr));
+      if (hdr.kind == Header::kResponse) {
+        CompleteCall(hdr, payload);
+        continue;
+      }
+      requests_[nb_requests] = {msghdr.flow_info, hdr.type, payload};
+      request_msgs_[nb_requests++] = hdr;
+    }
+    if (nb_requests != 0) ServeRequests(nb_requests);
+
+    if (options_.timeout_ns != 0 && GetPendingCount() != 0) {
+      const uint64_t now = machnet_clock_ns();
+      if (now >= next_timeout_scan_ns_) {
+        TimeOutCalls(now);
+        next_timeout_scan_ns_ = now + options_.timeout_ns / kTimeoutScansNr;
+      }
+    }
+    Flush();
+    return std::max(nb_rx, 0);
+  }
+
+  /**
+   * @brief Send the pending requests and responses, in batches. If the
+   * channel is full, wait for room (i.e., for Machnet to drain it).
+   */
+  void Flush() {
+    size_t sent = 0;
+    while (sent < tx_cnt_) {
+      const int ret = machnet_sendmmsg(channel_ctx_, &tx_msghdr_[sent],
+                                       static_cast<int>(tx_cnt_ - sent));
+      if (ret <= 0) {
+        stats_.tx_backpressure++;
+        continue;
+      }
+      sent += ret;
+    }
+    tx_cnt_ = 0;
+  }
+
+  // The number of calls in flight.
+  uint32_t GetPendingCount() const {
+    return options_.slots - static_cast<uint32_t>(free_slots_.size());
+  }
+  const Stats &stats() const { return stats_; }
+  const Options &options() const { return options_; }
+
+ private:
+  // The slots are scanned for timed-out calls this many times per timeout.
+  static constexpr uint64_t kTimeoutScansNr = 8;
+
+  struct Slot {
+    bool busy{false};
+    uint32_t gen{0};
+    uint64_t deadline_ns{0};
+    Callback callback{};
+  };
+
+  struct Handlers {
+    Handler single;
+    BatchHandler batch;
+  };
+
+  // Buffer a message for `Flush()', sending the buffered ones first if there
+  // is no room.
+  void Enqueue(const MachnetFlow_t &flow, const Header &hdr,
+               const void *payload, size_t size) {
+    if (tx_cnt_ == tx_capacity_) Flush();
+    const size_t i = tx_cnt_++;
+    tx_hdr_[i] = hdr;
+    tx_iov_[2 * i] = {&tx_hdr_[i], sizeof(Header)};
+    tx_iov_[2 * i + 1] = {const_cast<void *>(payload), size};
+    auto &msghdr = tx_msghdr_[i];
+    msghdr.msg_size = static_cast<uint32_t>(sizeof(Header) + size);
+    msghdr.flow_info = flow;
+    msghdr.msg_iov = &tx_iov_[2 * i];
+    msghdr.msg_iovlen = size != 0 ? 2 : 1;
+    msghdr.flags = options_.msg_flags;
+    msghdr.cookie = 0;
+  }
+
+  void CompleteCall(const Header &hdr, std::span<const uint8_t> payload) {
+    if (hdr.slot >= slots_.size() || !slots_[hdr.slot].busy ||
+        slots_[hdr.slot].gen != hdr.gen) [[unlikely]] {  // NOLINT
+      stats_.stale_responses++;
+      return;
+    }
+    stats_.completions++;
+    Complete(hdr.slot, {static_cast<Status>(hdr.status), payload});
+  }
+
+  // Run the callback of a call, and free its slot. The slot stays taken while
+  // the callback runs, so that the calls it issues do not reuse it.
+  void Complete(uint32_t index, const Result &result) {
+    auto &slot = slots_[index];
+    slot.callback.Complete(result);
+    slot.busy = false;
+    free_slots_.push_back(index);
+  }
+
+  void TimeOutCalls(uint64_t now) {
+    for (uint32_t i = 0; i < slots_.size(); i++) {
+      auto &slot = slots_[i];
+      if (!slot.busy || slot.deadline_ns > now) continue;
+      stats_.timeouts++;
+      Complete(i, {Status::kTimeout, {}});
+    }
+  }
+
+  // Run the handlers of the requests received, and buffer their responses.
+  void ServeRequests(size_t n) {
+    stats_.requests += n;
+    const size_t capacity = options_.max_msg_size - sizeof(Header);
+    for (size_t i = 0; i < n; i++) {
+      responses_[i].Reset(&response_buffers_[i * msg_stride_], capacity);
+    }
+    for (size_t i = 0; i < n;) {
+      const uint8_t type = requests_[i].type;
+      const auto &handlers = handlers_[type];
+      if (handlers.batch) {
+        size_t end = i + 1;
+        while (end < n && requests_[end].type == type) end++;
+        handlers.batch(&requests_[i], &responses_[i], end - i);
+        for (; i < end; i++) Respond(i, Status::kOk);
+      } else if (handlers.single) {
+        handlers.single(requests_[i], &responses_[i]);
+        Respond(i++, Status::kOk);
+      } else {
+        responses_[i].set_size(0);
+        Respond(i++, Status::kNoHandler);
+      }
+    }
+  }
+
+  void Respond(size_t i, Status status) {
+    const auto &request = requests_[i];
+    const auto &response = responses_[i];
+    const Header &req_hdr = request_msgs_[i];
+    // Back over the flow the request came in on.
+    const MachnetFlow_t flow{.src_ip = request.flow.dst_ip,
+                             .dst_ip = request.flow.src_ip,
+                             .src_port = request.flow.dst_port,
+                             .dst_port = request.flow.src_port};
+    uint16_t code = static_cast<uint16_t>(status);
+    size_t size = response.size();
+    if (size > options_.max_msg_size - sizeof(Header)) [[unlikely]] {  // NOLINT
+      code = static_cast<uint16_t>(Status::kTooLarge);
+      size = 0;
+    }
+    Enqueue(flow,
+            {Header::kMagic, Header::kResponse, req_hdr.type, code, 0,
+             req_hdr.slot, req_hdr.gen},
+            response.payload(), size);
+  }
+
+  void *const channel_ctx_;
+  const Options options_;
+  const size_t msg_stride_;
+  Stats stats_{};
+
+  // The calls, and the indices of the free slots (a stack: the most recently
+  // used slots are warm in the cache).
+  std::vector<Slot> slots_;
+  std::vector<uint32_t> free_slots_{};
+  uint64_t next_timeout_scan_ns_{0};
+
+  // Received messages, and the requests among them.
+  std::vector<uint8_t> rx_buffers_;
+  std::vector<MachnetIovec_t> rx_iov_;
+  std::vector<MachnetMsgHdr_t> rx_msghdr_;
+  std::vector<Request> requests_;
+  std::vector<Header> request_msgs_;
+  std::vector<Response> responses_;
+  std::vector<uint8_t> response_buffers_;
+  Handlers handlers_[256]{};
+
+  // Messages to send: each has its header and payload as two buffers.
+  const size_t tx_capacity_;
+  size_t tx_cnt_{0};
+  std::vector<Header> tx_hdr_;
+  std::vector<MachnetIovec_t> tx_iov_;
+  std::vector<MachnetMsgHdr_t> tx_msghdr_;
+};
+
+}  // namespace rpc
+}  // namespace juggler
+
+#endif  // SRC_EXT_MACHNET_RPC_H_
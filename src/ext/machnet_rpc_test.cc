@@ -0,0 +1,289 @@
+/**
+ * @file  machnet_rpc_test.cc
+ * @brief Unit tests for the RPC layer (see `machnet_rpc.h').
+ *
+ * There is no Machnet engine: the messages that an endpoint sends are bounced
+ * back to its own channel, so that it serves its own requests and the
+ * responses come back to it.
+ */
+
+#include "machnet_rpc.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstring>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include "machnet.h"
+#include "machnet_private.h"
+
+namespace juggler {
+namespace rpc {
+
+constexpr const char *kChannelName = "machnet_rpc_test";
+MachnetChannelCtx_t *g_channel_ctx = nullptr;
+
+constexpr uint8_t kEcho = 1;
+constexpr uint8_t kSum = 2;
+const MachnetFlow_t kFlow = {
+    .src_ip = 0x0a000001, .dst_ip = 0x0a000002, .src_port = 1, .dst_port = 2};
+
+// Moves the messages the application sent to the channel's receive ring
+// (copying inline ones into buffers), as if the engine had delivered them.
+uint32_t Bounce(const MachnetChannelCtx_t *ctx) {
+  std::vector<MachnetRingSlot_t> msgs;
+  while (true) {
+    MachnetInlineMsg_t inline_msg;
+    uint32_t prio = MACHNET_PRIO_HIGH;
+    if (__machnet_channel_app_ring_dequeue_prio(ctx, prio, 1,
+                                                &inline_msg.hdr) != 1) {
+      prio = MACHNET_PRIO_NORMAL;
+      if (__machnet_channel_app_ring_dequeue_prio(ctx, prio, 1,
+                                                  &inline_msg.hdr) != 1) {
+        break;
+      }
+    }
+    if (!__machnet_ring_slot_is_inline(inline_msg.hdr)) {
+      msgs.push_back(inline_msg.hdr);
+      continue;
+    }
+    const uint32_t len = __machnet_inline_msg_len(inline_msg.hdr);
+    const uint32_t rest = __machnet_inline_msg_slots_nr(len) - 1;
+    CHECK_EQ(__machnet_channel_app_ring_dequeue_prio(
+                 ctx, prio, rest,
+                 reinterpret_cast<MachnetRingSlot_t *>(&inline_msg) + 1),
+             rest);
+    MachnetRingSlot_t index;
+    MachnetMsgBuf_t *buf = nullptr;
+    CHECK_EQ(__machnet_channel_buf_class_alloc_bulk(
+                 ctx, MACHNET_MSGBUF_CLASS_SMALL, 1, &index, &buf),
+             1);
+    __machnet_channel_buf_init(buf);
+    memcpy(__machnet_channel_buf_append(buf, len), inline_msg.data, len);
+    buf->flags = MACHNET_MSGBUF_FLAGS_SYN | MACHNET_MSGBUF_FLAGS_FIN;
+    buf->flow = inline_msg.flow;
+    buf->msg_len = len;
+    buf->last = index;
+    msgs.push_back(index);
+  }
+  if (msgs.empty()) return 0;
+  CHECK_EQ(__machnet_channel_machnet_ring_enqueue(ctx, msgs.size(),
+                                                  msgs.data()),
+           msgs.size());
+  return msgs.size();
+}
+
+// A round trip: the requests go out, are served, and their responses come
+// back.
+void RoundTrip(Endpoint *endpoint) {
+  endpoint->Flush();
+  for (int i = 0; i < 2; i++) {
+    Bounce(g_channel_ctx);
+    endpoint->Poll();
+  }
+}
+
+void RegisterEcho(Endpoint *endpoint) {
+  endpoint->Register(kEcho, [](const Request &request, Response *response) {
+    std::memcpy(response->data(), request.payload.data(),
+                request.payload.size());
+    response->set_size(request.payload.size());
+  });
+}
+
+TEST(MachnetRpcTest, Call) {
+  Endpoint endpoint(g_channel_ctx);
+  RegisterEcho(&endpoint);
+
+  // Large enough not to be sent inline.
+  std::vector<uint8_t> request(1000);
+  std::iota(request.begin(), request.end(), 0);
+  std::vector<uint8_t> response;
+  Status status = Status::kTimeout;
+  ASSERT_TRUE(endpoint.Call(kFlow, kEcho, request,
+                            [&status, &response](const Result &result) {
+                              status = result.status;
+                              response.assign(result.payload.begin(),
+                                              result.payload.end());
+                            }));
+  EXPECT_EQ(endpoint.GetPendingCount(), 1);
+  RoundTrip(&endpoint);
+  EXPECT_EQ(status, Status::kOk);
+  EXPECT_EQ(response, request);
+  EXPECT_EQ(endpoint.GetPendingCount(), 0);
+  EXPECT_EQ(endpoint.stats().calls, 1);
+  EXPECT_EQ(endpoint.stats().requests, 1);
+  EXPECT_EQ(endpoint.stats().completions, 1);
+
+  // Empty requests, and requests with no handler.
+  int completed = 0;
+  ASSERT_TRUE(endpoint.Call(kFlow, kEcho, {}, [&](const Result &result) {
+    EXPECT_EQ(result.status, Status::kOk);
+    EXPECT_TRUE(result.payload.empty());
+    completed++;
+  }));
+  ASSERT_TRUE(endpoint.Call(kFlow, kSum, request, [&](const Result &result) {
+    EXPECT_EQ(result.status, Status::kNoHandler);
+    completed++;
+  }));
+  RoundTrip(&endpoint);
+  EXPECT_EQ(completed, 2);
+}
+
+TEST(MachnetRpcTest, BatchHandler) {
+  Options options;
+  options.batch_size = 8;
+  Endpoint endpoint(g_channel_ctx, options);
+  // Answers each request with its first byte, and the size of its batch.
+  std::vector<size_t> batches;
+  endpoint.RegisterBatch(kSum, [&batches](const Request *requests,
+                                          Response *responses, size_t n) {
+    batches.push_back(n);
+    for (size_t i = 0; i < n; i++) {
+      const uint32_t answer[] = {requests[i].payload[0],
+                                 static_cast<uint32_t>(n)};
+      std::memcpy(responses[i].data(), answer, sizeof(answer));
+      responses[i].set_size(sizeof(answer));
+    }
+  });
+
+  constexpr uint8_t kCalls = 20;
+  std::vector<uint8_t> requests(kCalls);
+  std::iota(requests.begin(), requests.end(), 0);
+  std::vector<uint32_t> answers(kCalls, UINT32_MAX);
+  for (uint8_t i = 0; i < kCalls; i++) {
+    ASSERT_TRUE(endpoint.Call(kFlow, kSum, {&requests[i], 1},
+                              [&answers, i](const Result &result) {
+                                ASSERT_EQ(result.payload.size(), 8);
+                                uint32_t answer[2];
+                                std::memcpy(answer, result.payload.data(), 8);
+                                answers[i] = answer[0];
+                              }));
+  }
+  endpoint.Flush();
+  for (int i = 0; i < 8; i++) {
+    Bounce(g_channel_ctx);
+    endpoint.Poll();
+  }
+  for (uint8_t i = 0; i < kCalls; i++) EXPECT_EQ(answers[i], i);
+  // Served in batches of up to `batch_size'.
+  EXPECT_EQ(std::accumulate(batches.begin(), batches.end(), size_t{0}),
+            kCalls);
+  EXPECT_EQ(batches.front(), options.batch_size);
+}
+
+TEST(MachnetRpcTest, TimeoutAndStaleResponse) {
+  Options options;
+  options.timeout_ns = 1'000'000;
+  Endpoint endpoint(g_channel_ctx, options);
+  RegisterEcho(&endpoint);
+
+  const uint8_t request[] = {1, 2, 3};
+  Status status = Status::kOk;
+  ASSERT_TRUE(endpoint.Call(kFlow, kEcho, request,
+                            [&status](const Result &result) {
+                              status = result.status;
+                            }));
+  endpoint.Flush();
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  endpoint.Poll();
+  EXPECT_EQ(status, Status::kTimeout);
+  EXPECT_EQ(endpoint.stats().timeouts, 1);
+  EXPECT_EQ(endpoint.GetPendingCount(), 0);
+
+  // The response comes in late, once the slot has a new call.
+  bool completed = false;
+  ASSERT_TRUE(endpoint.Call(kFlow, kSum, request,
+                            [&completed](const Result &) {
+                              completed = true;
+                            }));
+  endpoint.Flush();
+  Bounce(g_channel_ctx);
+  endpoint.Poll();  // Serves both requests.
+  Bounce(g_channel_ctx);
+  endpoint.Poll();
+  EXPECT_EQ(endpoint.stats().stale_responses, 1);
+  EXPECT_TRUE(completed);
+}
+
+TEST(MachnetRpcTest, SlotsExhausted) {
+  Options options;
+  options.slots = 2;
+  Endpoint endpoint(g_channel_ctx, options);
+  RegisterEcho(&endpoint);
+
+  int completed = 0;
+  const auto callback = [&completed](const Result &) { completed++; };
+  EXPECT_TRUE(endpoint.Call(kFlow, kEcho, {}, callback));
+  EXPECT_TRUE(endpoint.Call(kFlow, kEcho, {}, callback));
+  EXPECT_FALSE(endpoint.Call(kFlow, kEcho, {}, callback));
+  // Too large, whatever the slots.
+  std::vector<uint8_t> large(options.max_msg_size);
+  EXPECT_FALSE(endpoint.Call(kFlow, kEcho, large, callback));
+  RoundTrip(&endpoint);
+  EXPECT_EQ(completed, 2);
+  EXPECT_TRUE(endpoint.Call(kFlow, kEcho, {}, callback));
+  RoundTrip(&endpoint);
+  EXPECT_EQ(completed, 3);
+}
+
+// Issues `n' echo calls in turn, and counts the responses that match.
+Task EchoClient(Endpoint *endpoint, int n, int *matched, bool *done) {
+  for (int i = 0; i < n; i++) {
+    const uint8_t request[] = {static_cast<uint8_t>(i), 42};
+    const auto result = co_await endpoint->AsyncCall(kFlow, kEcho, request);
+    if (result.status == Status::kOk && result.payload.size() == 2 &&
+        result.payload[0] == i) {
+      (*matched)++;
+    }
+  }
+  *done = true;
+}
+
+TEST(MachnetRpcTest, Coroutines) {
+  Endpoint endpoint(g_channel_ctx);
+  RegisterEcho(&endpoint);
+
+  constexpr int kClients = 4, kCalls = 5;
+  int matched[kClients] = {};
+  bool done[kClients] = {};
+  for (int c = 0; c < kClients; c++) {
+    EchoClient(&endpoint, kCalls, &matched[c], &done[c]);
+  }
+  EXPECT_EQ(endpoint.GetPendingCount(), kClients);
+  for (int i = 0; i < kCalls; i++) RoundTrip(&endpoint);
+  for (int c = 0; c < kClients; c++) {
+    EXPECT_TRUE(done[c]);
+    EXPECT_EQ(matched[c], kCalls);
+  }
+  EXPECT_EQ(endpoint.GetPendingCount(), 0);
+}
+
+}  // namespace rpc
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+
+  size_t channel_size;
+  int is_posix_shm;
+  int channel_fd;
+  juggler::rpc::g_channel_ctx = __machnet_channel_create(
+      juggler::rpc::kChannelName, 1 << 9, 1 << 9, 1 << 13, 1 << 11,
+      MACHNET_CHANNEL_RING_JRING, &channel_size, &is_posix_shm, &channel_fd);
+  if (juggler::rpc::g_channel_ctx == nullptr) return -1;
+
+  int ret = RUN_ALL_TESTS();
+
+  // The buffers cached by this thread go back before the channel goes away.
+  machnet_release_cached_buffers(juggler::rpc::g_channel_ctx);
+  __machnet_channel_destroy(juggler::rpc::g_channel_ctx, channel_size,
+                            &channel_fd, is_posix_shm,
+                            juggler::rpc::kChannelName);
+  return ret;
+}
@@ -9,9 +9,12 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <utils.h>
+#include <uuid/uuid.h>
 
 #include <algorithm>
+#include <chrono>
 #include <random>
+#include <thread>
 #include <unordered_set>
 
 #include "machnet_private.h"
@@ -113,6 +116,7 @@ void prepare_tx_msg(MachnetFlow_t *flow_info,
   tx_msghdr->msg_iov = tx_iov->data();
   tx_msghdr->msg_iovlen = tx_iov->size();
   tx_msghdr->flags = -1;
+  tx_msghdr->cookie = 0;
 }
 
 /**
@@ -142,20 +146,58 @@ void prepare_rx_msg(std::vector<MachnetIovec_t> *rx_iov,
   rx_msghdr->msg_iovlen = rx_iov->size();
 }
 
+// Dequeues a message enqueued by the application to Machnet. Like Machnet,
+// it copies inline messages into buffers, and serves the high priority
+// messages first. Returns false if there is none.
+bool dequeue_app_msg(const MachnetChannelCtx_t *ctx, MachnetRingSlot_t *index) {
+  MachnetInlineMsg_t inline_msg;
+  uint32_t prio = MACHNET_PRIO_HIGH;
+  if (__machnet_channel_app_ring_dequeue_prio(ctx, prio, 1, &inline_msg.hdr) !=
+      1) {
+    prio = MACHNET_PRIO_NORMAL;
+    if (__machnet_channel_app_ring_dequeue_prio(ctx, prio, 1,
+                                                &inline_msg.hdr) != 1)
+      return false;
+  }
+  if (!__machnet_ring_slot_is_inline(inline_msg.hdr)) {
+    *index = inline_msg.hdr;
+    return true;
+  }
+
+  const uint32_t len = __machnet_inline_msg_len(inline_msg.hdr);
+  const uint32_t rest = __machnet_inline_msg_slots_nr(len) - 1;
+  if (__machnet_channel_app_ring_dequeue_prio(
+          ctx, prio, rest,
+          reinterpret_cast<MachnetRingSlot_t *>(&inline_msg) + 1) != rest)
+    return false;
+
+  MachnetMsgBuf_t *buf;
+  if (__machnet_channel_buf_class_alloc_bulk(ctx, MACHNET_MSGBUF_CLASS_SMALL, 1,
+                                             index, &buf) != 1)
+    return false;
+  __machnet_channel_buf_init(buf);
+  memcpy(__machnet_channel_buf_append(buf, len), inline_msg.data, len);
+  buf->flags = MACHNET_MSGBUF_FLAGS_SYN | MACHNET_MSGBUF_FLAGS_FIN |
+               __machnet_inline_msg_flags(inline_msg.hdr);
+  buf->flow = inline_msg.flow;
+  buf->msg_len = len;
+  buf->last = *index;
+  return true;
+}
+
 // This function bounces messages originally enqueud by the application to
 // Machnet, back to the application.
 uint32_t bounce_machnet_to_app(const MachnetChannelCtx_t *ctx) {
   std::vector<MachnetRingSlot_t> msgs;
 
   // Dequeue any messages from the application.
-  msgs.resize(__machnet_channel_app_ring_pending(ctx));
-  uint32_t ret =
-      __machnet_channel_app_ring_dequeue(ctx, msgs.size(), msgs.data());
-  if (ret != msgs.size())  // This should not happen.
-    return -1;
+  MachnetRingSlot_t index;
+  while (dequeue_app_msg(ctx, &index)) msgs.push_back(index);
+  if (msgs.empty()) return 0;
 
   // Now bounce the dequeued messages back to the application.
-  ret = __machnet_channel_machnet_ring_enqueue(ctx, msgs.size(), msgs.data());
+  uint32_t ret =
+      __machnet_channel_machnet_ring_enqueue(ctx, msgs.size(), msgs.data());
   if (ret != msgs.size())  // This should not happen.
     return -1;
 
@@ -168,22 +210,23 @@ uint32_t bounce_machnet_to_app(const MachnetChannelCtx_t *ctx) {
 // a valid state.
 bool check_buffer_pool(const MachnetChannelCtx_t *ctx) {
   // Release cached buffers to the pool
-  if (__machnet_channel_buf_free_bulk(ctx, ctx->app_buffer_cache.count,
-                                      ctx->app_buffer_cache.indices) !=
-      ctx->app_buffer_cache.count) {
-    return false;
-  }
-  *__DECONST(uint32_t *, &ctx->app_buffer_cache.count) = 0;
-
-  jring_t *buf_ring = __machnet_channel_buf_ring(ctx);
-  auto nbuffers = buf_ring->capacity;
-
-  std::vector<MachnetRingSlot_t> buffers(nbuffers);
-
-  // Dequeue all the buffers from the pool.
-  if (__machnet_channel_buf_alloc_bulk(ctx, buffers.size(), buffers.data(),
-                                       nullptr) != buffers.size()) {
-    return false;
+  machnet_release_cached_buffers(__DECONST(void *, ctx));
+
+  std::vector<MachnetRingSlot_t> buffers;
+  for (uint32_t cls = 0; cls < MACHNET_MSGBUF_CLASSES_NR; cls++) {
+    jring_t *buf_ring = __machnet_channel_buf_class_ring(ctx, cls);
+    const uint32_t nbuffers = cls == MACHNET_MSGBUF_CLASS_SMALL
+                                  ? ctx->data_ctx.small_buf_nr
+                                  : buf_ring->capacity;
+    if (jring_count(buf_ring) != nbuffers) return false;
+
+    // Dequeue all the buffers from the pool.
+    buffers.resize(buffers.size() + nbuffers);
+    if (__machnet_channel_buf_class_alloc_bulk(
+            ctx, cls, nbuffers, buffers.data() + buffers.size() - nbuffers,
+            nullptr) != nbuffers) {
+      return false;
+    }
   }
 
   // Release all the buffers back to the pool.
@@ -225,7 +268,7 @@ TEST(MachnetTest, Bind) {
   // Create a POSIX shm channel.
   size_t expected_channel_size = __machnet_channel_dataplane_calculate_size(
       FLAGS_machnet_slots_nr, FLAGS_app_slots_nr, FLAGS_buffers_nr,
-      FLAGS_buffer_size, 1);
+      FLAGS_buffer_size, MACHNET_CHANNEL_RING_JRING, 1);
   ctx = __machnet_channel_posix_create(channel_name, expected_channel_size,
                                        &shm_fd);
   EXPECT_NE(ctx, nullptr);
@@ -280,6 +323,212 @@ TEST(MachnetTest, SimpleSendRecvMsg) {
   EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
 }
 
+TEST(MachnetTest, BufferSizeClasses) {
+  const MachnetChannelDataCtx_t *data_ctx = &g_channel_ctx->data_ctx;
+  ASSERT_GT(data_ctx->small_buf_nr, 0);
+  ASSERT_LT(data_ctx->small_buf_mss, data_ctx->buf_mss);
+  MachnetFlow_t flow = {};
+
+  // Messages that fit in a small buffer use one; larger ones use standard
+  // buffers.
+  const std::vector<uint32_t> msg_sizes = {MACHNET_MSG_INLINE_MAX + 1,
+                                           data_ctx->small_buf_mss,
+                                           data_ctx->small_buf_mss + 1};
+  std::vector<MachnetMsgHdr_t> msghdrs(msg_sizes.size());
+  std::vector<MachnetIovec_t> iovs(msg_sizes.size());
+  std::vector<std::vector<uint8_t>> data(msg_sizes.size());
+  for (size_t i = 0; i < msg_sizes.size(); i++) {
+    data[i].resize(msg_sizes[i]);
+    std::iota(data[i].begin(), data[i].end(), i);
+    iovs[i] = {.base = data[i].data(), .len = data[i].size()};
+    msghdrs[i] = {.msg_size = msg_sizes[i],
+                  .flow_info = flow,
+                  .msg_iov = &iovs[i],
+                  .msg_iovlen = 1};
+  }
+  EXPECT_EQ(machnet_sendmmsg(g_channel_ctx, msghdrs.data(), msghdrs.size()),
+            msghdrs.size());
+
+  const bool expect_small[] = {true, true, false};
+  for (size_t i = 0; i < msg_sizes.size(); i++) {
+    MachnetRingSlot_t index;
+    ASSERT_EQ(__machnet_channel_app_ring_dequeue(g_channel_ctx, 1, &index), 1);
+    const uint32_t cls = __machnet_channel_buf_class(g_channel_ctx, index);
+    EXPECT_EQ(cls == MACHNET_MSGBUF_CLASS_SMALL, expect_small[i]) << i;
+    const MachnetMsgBuf_t *buf = __machnet_channel_buf(g_channel_ctx, index);
+    EXPECT_EQ(__machnet_channel_buf_index(g_channel_ctx, buf), index);
+    EXPECT_EQ(buf->msg_len, msg_sizes[i]);
+    ASSERT_EQ(__machnet_channel_machnet_ring_enqueue(g_channel_ctx, 1, &index),
+              1);
+  }
+
+  for (size_t i = 0; i < msg_sizes.size(); i++) {
+    std::vector<uint8_t> recv_data(msg_sizes[i]);
+    MachnetIovec_t iov = {.base = recv_data.data(), .len = recv_data.size()};
+    MachnetMsgHdr_t msghdr = {.msg_iov = &iov, .msg_iovlen = 1};
+    EXPECT_EQ(machnet_recvmsg(g_channel_ctx, &msghdr), 1);
+    EXPECT_EQ(recv_data, data[i]);
+  }
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+}
+
+TEST(MachnetTest, InlineSendRecv) {
+  MachnetFlow_t flow = {
+      .src_ip = 1, .dst_ip = 2, .src_port = 3, .dst_port = 4};
+  const std::vector<uint32_t> msg_sizes = {1, 4, 5, MACHNET_MSG_INLINE_MAX};
+  std::vector<std::vector<uint8_t>> data(msg_sizes.size());
+  uint32_t slots_nr = 0;
+  for (size_t i = 0; i < msg_sizes.size(); i++) {
+    data[i].resize(msg_sizes[i]);
+    std::iota(data[i].begin(), data[i].end(), i);
+    ASSERT_EQ(machnet_send(g_channel_ctx, flow, data[i].data(), data[i].size()),
+              0);
+    slots_nr += __machnet_inline_msg_slots_nr(msg_sizes[i]);
+  }
+  EXPECT_EQ(slots_nr, 5 + 5 + 6 + MACHNET_MSG_INLINE_SLOTS_MAX);
+
+  // The messages are carried in the ring, and take no buffers.
+  EXPECT_EQ(__machnet_channel_app_ring_pending(g_channel_ctx), slots_nr);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), msg_sizes.size());
+  for (size_t i = 0; i < msg_sizes.size(); i++) {
+    std::vector<uint8_t> recv_data(msg_sizes[i]);
+    MachnetFlow_t recv_flow;
+    EXPECT_EQ(machnet_recv(g_channel_ctx, recv_data.data(), recv_data.size(),
+                           &recv_flow),
+              msg_sizes[i]);
+    EXPECT_EQ(recv_data, data[i]);
+    EXPECT_EQ(recv_flow.src_ip, flow.src_ip);
+    EXPECT_EQ(recv_flow.dst_port, flow.dst_port);
+  }
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+}
+
+TEST(MachnetTest, PriorityClasses) {
+  // A bulk message, then a latency-critical one (multi-buffer), and a tiny
+  // latency-critical one (inline), all on the same channel.
+  const std::vector<uint32_t> msg_sizes = {
+      static_cast<uint32_t>(FLAGS_buffer_size),
+      static_cast<uint32_t>(2 * FLAGS_buffer_size + 1), 8};
+  const std::vector<uint16_t> msg_flags = {0, MACHNET_MSGBUF_FLAGS_PRIO,
+                                           MACHNET_MSGBUF_FLAGS_PRIO};
+  std::vector<std::vector<uint8_t>> data(msg_sizes.size());
+  std::vector<MachnetIovec_t> iovs(msg_sizes.size());
+  for (size_t i = 0; i < msg_sizes.size(); i++) {
+    data[i].resize(msg_sizes[i]);
+    std::iota(data[i].begin(), data[i].end(), i);
+    iovs[i] = {.base = data[i].data(), .len = data[i].size()};
+    MachnetMsgHdr_t msghdr = {.msg_size = msg_sizes[i],
+                              .flow_info = {},
+                              .msg_iov = &iovs[i],
+                              .msg_iovlen = 1,
+                              .flags = msg_flags[i]};
+    ASSERT_EQ(machnet_sendmsg(g_channel_ctx, &msghdr), 0);
+  }
+  EXPECT_EQ(__machnet_channel_app_ring_pending_prio(g_channel_ctx,
+                                                    MACHNET_PRIO_NORMAL),
+            1);
+  EXPECT_GT(__machnet_channel_app_ring_pending_prio(g_channel_ctx,
+                                                    MACHNET_PRIO_HIGH),
+            1);
+
+  // The latency-critical messages overtake the bulk one, and all of their
+  // buffers are marked.
+  for (const size_t i : {1, 2, 0}) {
+    MachnetRingSlot_t index;
+    ASSERT_TRUE(dequeue_app_msg(g_channel_ctx, &index));
+    const MachnetMsgBuf_t *buf = __machnet_channel_buf(g_channel_ctx, index);
+    EXPECT_EQ(buf->msg_len, msg_sizes[i]);
+    std::vector<MachnetRingSlot_t> indices;
+    while (true) {
+      indices.push_back(buf->index);
+      EXPECT_EQ(buf->flags & MACHNET_MSGBUF_FLAGS_PRIO, msg_flags[i]) << i;
+      if (!(buf->flags & MACHNET_MSGBUF_FLAGS_SG)) break;
+      buf = __machnet_channel_buf(g_channel_ctx, buf->next);
+    }
+    EXPECT_EQ(indices.size(), i == 1 ? 3 : 1);
+    ASSERT_EQ(__machnet_channel_buf_free_bulk(g_channel_ctx, indices.size(),
+                                              indices.data()),
+              indices.size());
+  }
+  EXPECT_EQ(__machnet_channel_app_ring_pending(g_channel_ctx), 0);
+
+  // A batch goes out in runs of the same priority, each to its ring.
+  std::vector<MachnetMsgHdr_t> msghdrs;
+  for (const uint16_t flags : {0, 0, MACHNET_MSGBUF_FLAGS_PRIO, 0}) {
+    msghdrs.push_back({.msg_size = msg_sizes[0],
+                       .flow_info = {},
+                       .msg_iov = &iovs[0],
+                       .msg_iovlen = 1,
+                       .flags = flags});
+  }
+  EXPECT_EQ(machnet_sendmmsg(g_channel_ctx, msghdrs.data(), msghdrs.size()),
+            msghdrs.size());
+  EXPECT_EQ(__machnet_channel_app_ring_pending_prio(g_channel_ctx,
+                                                    MACHNET_PRIO_NORMAL),
+            3);
+  EXPECT_EQ(__machnet_channel_app_ring_pending_prio(g_channel_ctx,
+                                                    MACHNET_PRIO_HIGH),
+            1);
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), msghdrs.size());
+  for (size_t i = 0; i < msghdrs.size(); i++) {
+    std::vector<uint8_t> rx_data(msg_sizes[0]);
+    MachnetIovec_t rx_iov = {.base = rx_data.data(), .len = rx_data.size()};
+    MachnetMsgHdr_t rx_msghdr = {.msg_iov = &rx_iov, .msg_iovlen = 1};
+    EXPECT_EQ(machnet_recvmsg(g_channel_ctx, &rx_msghdr), 1);
+    EXPECT_EQ(rx_data, data[0]);
+  }
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+}
+
+TEST(MachnetTest, SpscRingsSendRecv) {
+  const char *spsc_channel_name = "machnet_test_spsc_channel";
+  size_t channel_size;
+  int is_posix_shm;
+  int channel_fd;
+  MachnetChannelCtx_t *ctx = __machnet_channel_create(
+      spsc_channel_name, FLAGS_machnet_slots_nr, FLAGS_app_slots_nr,
+      FLAGS_buffers_nr, FLAGS_buffer_size, MACHNET_CHANNEL_RING_JRING2,
+      &channel_size, &is_posix_shm, &channel_fd);
+  ASSERT_NE(ctx, nullptr);
+  EXPECT_EQ(ctx->version, MACHNET_CHANNEL_VERSION);
+  EXPECT_TRUE(__machnet_channel_is_spsc(ctx));
+
+  // Go around the rings a few times; each round fills the application ring.
+  // The messages are too large to be sent inline, so each takes one slot.
+  MachnetFlow_t flow = {};
+  const uint32_t ring_capacity = FLAGS_app_slots_nr - 1;
+  std::array<uint32_t, 16> msg = {};
+  static_assert(sizeof(msg) > MACHNET_MSG_INLINE_MAX);
+  for (uint32_t round = 0; round < 4; round++) {
+    std::vector<uint32_t> sent;
+    for (uint32_t i = 0;; i++) {
+      msg[0] = round * ring_capacity + i;
+      if (machnet_send(ctx, flow, msg.data(), sizeof(msg)) != 0) break;
+      sent.push_back(msg[0]);
+    }
+    EXPECT_EQ(sent.size(), ring_capacity);
+    EXPECT_EQ(__machnet_channel_app_ring_pending(ctx), ring_capacity);
+    EXPECT_EQ(bounce_machnet_to_app(ctx), ring_capacity);
+    EXPECT_EQ(__machnet_channel_app_ring_pending(ctx), 0);
+
+    for (const auto value : sent) {
+      std::array<uint32_t, 16> recv_msg;
+      MachnetFlow_t recv_flow;
+      ASSERT_EQ(
+          machnet_recv(ctx, recv_msg.data(), sizeof(recv_msg), &recv_flow),
+          sizeof(recv_msg));
+      EXPECT_EQ(recv_msg[0], value);
+    }
+    EXPECT_EQ(__machnet_channel_machnet_ring_pending(ctx), 0);
+  }
+  EXPECT_TRUE(check_buffer_pool(ctx));
+
+  __machnet_channel_destroy(ctx, channel_size, &channel_fd, is_posix_shm,
+                            spsc_channel_name);
+}
+
 TEST(MachnetTest, MultiBufferSendRecvMsg) {
   // Prepare a generator for msg lengths.
   std::mt19937 mersenne_engine{rnd_device()};
@@ -376,6 +625,487 @@ TEST(MachnetTest, MultiBufferSGSendRecvMsg) {
   }
 }
 
+TEST(MachnetTest, SendMmsgBatch) {
+  const MachnetChannelAppStats_t *stats =
+      &__machnet_channel_stats(g_channel_ctx)->a_stats;
+  // Twice as many messages as the app ring can hold, of varying sizes; the
+  // tail of the batch is dropped on backpressure.
+  const size_t nr_msgs = 2 * FLAGS_app_slots_nr;
+  std::uniform_int_distribution<uint32_t> msg_len{
+      2, static_cast<uint32_t>(3 * FLAGS_buffer_size)};
+  std::vector<std::vector<std::vector<uint8_t>>> tx_msg_data(nr_msgs);
+  std::vector<std::vector<MachnetIovec_t>> tx_iov(nr_msgs);
+  std::vector<MachnetMsgHdr_t> tx_msghdr(nr_msgs);
+  for (size_t i = 0; i < nr_msgs; i++) {
+    const uint32_t msg_size = msg_len(mersenne_engine);
+    MachnetFlow_t flow;
+    prepare_segments(msg_size, 1, &tx_msg_data[i]);
+    prepare_tx_msg(&flow, &tx_iov[i], &tx_msghdr[i], &tx_msg_data[i], msg_size);
+  }
+
+  const auto prev_success = stats->tx_msg_success;
+  const auto prev_drops = stats->tx_msg_drops;
+  const int sent = machnet_sendmmsg(g_channel_ctx, tx_msghdr.data(), nr_msgs);
+  const auto ring_capacity =
+      __machnet_channel_app_ring(g_channel_ctx)->capacity;
+  EXPECT_EQ(sent, ring_capacity);
+  EXPECT_EQ(__machnet_channel_app_ring_pending(g_channel_ctx), sent);
+  EXPECT_EQ(stats->tx_msg_success - prev_success, sent);
+  EXPECT_EQ(stats->tx_msg_drops - prev_drops, nr_msgs - sent);
+
+  // The messages that were sent arrive intact, and in order.
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), sent);
+  for (int i = 0; i < sent; i++) {
+    const uint32_t msg_size = tx_msghdr[i].msg_size;
+    std::vector<MachnetIovec_t> rx_iov;
+    MachnetMsgHdr_t rx_msghdr;
+    std::vector<std::vector<uint8_t>> rx_msg_data;
+    prepare_segments(msg_size, 1, &rx_msg_data);
+    prepare_rx_msg(&rx_iov, &rx_msghdr, &rx_msg_data, msg_size);
+    EXPECT_EQ(machnet_recvmsg(g_channel_ctx, &rx_msghdr), 1);
+    EXPECT_EQ(rx_msg_data, tx_msg_data[i]) << "Msg: " << i;
+  }
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+}
+
+TEST(MachnetTest, SendMsgFanout) {
+  const MachnetChannelAppStats_t *stats =
+      &__machnet_channel_stats(g_channel_ctx)->a_stats;
+  // A multi-buffer message, to a few flows.
+  const uint32_t msg_size = 2 * FLAGS_buffer_size + FLAGS_buffer_size / 2;
+  std::vector<std::vector<uint8_t>> tx_msg_data;
+  std::vector<MachnetIovec_t> tx_iov;
+  MachnetMsgHdr_t tx_msghdr;
+  MachnetFlow_t flow;
+  prepare_segments(msg_size, 2, &tx_msg_data);
+  prepare_tx_msg(&flow, &tx_iov, &tx_msghdr, &tx_msg_data, msg_size);
+  std::vector<uint8_t> orig_data;
+  for (const auto &seg : tx_msg_data)
+    orig_data.insert(orig_data.end(), seg.begin(), seg.end());
+
+  const uint32_t flows_nr = 5;
+  std::vector<MachnetFlow_t> flows(flows_nr);
+  for (uint32_t i = 0; i < flows_nr; i++) {
+    flows[i] = {.src_ip = 1, .dst_ip = 2 + i, .src_port = 3, .dst_port = 4};
+  }
+  const auto prev_success = stats->tx_msg_success;
+  ASSERT_EQ(machnet_sendmsg_fanout(g_channel_ctx, &tx_msghdr, flows.data(),
+                                   flows_nr),
+            0);
+  EXPECT_EQ(stats->tx_msg_success - prev_success, flows_nr);
+  EXPECT_EQ(__machnet_channel_app_ring_pending(g_channel_ctx), flows_nr);
+
+  // Each flow gets a chain of references to the same buffers, which hold the
+  // payload once; release them as the engine does when they are acknowledged.
+  std::unordered_set<uint32_t> shared_buffers;
+  for (uint32_t i = 0; i < flows_nr; i++) {
+    MachnetRingSlot_t index;
+    ASSERT_TRUE(dequeue_app_msg(g_channel_ctx, &index));
+    MachnetMsgBuf_t *ref = __machnet_channel_buf(g_channel_ctx, index);
+    EXPECT_EQ(ref->flow.dst_ip, flows[i].dst_ip);
+    EXPECT_EQ(ref->msg_len, msg_size);
+    std::vector<uint8_t> rx_data;
+    while (true) {
+      ASSERT_TRUE(ref->flags & MACHNET_MSGBUF_FLAGS_REF);
+      ASSERT_EQ(ref->data_len, 0);
+      MachnetMsgBuf_t *shared = __machnet_channel_buf(g_channel_ctx, ref->ref);
+      EXPECT_EQ(shared->refcnt, flows_nr - i);
+      shared_buffers.insert(shared->index);
+      const auto *data = __machnet_channel_buf_data(shared);
+      rx_data.insert(rx_data.end(), data, data + shared->data_len);
+
+      const bool last = ref->flags & MACHNET_MSGBUF_FLAGS_FIN;
+      const MachnetRingSlot_t next = ref->next;
+      MachnetRingSlot_t to_free[2] = {ref->index, shared->index};
+      const uint32_t to_free_nr = --shared->refcnt == 0 ? 2 : 1;
+      ASSERT_EQ(
+          __machnet_channel_buf_free_bulk(g_channel_ctx, to_free_nr, to_free),
+          to_free_nr);
+      if (last) break;
+      ref = __machnet_channel_buf(g_channel_ctx, next);
+    }
+    EXPECT_EQ(rx_data, orig_data) << "Flow: " << i;
+  }
+  EXPECT_EQ(shared_buffers.size(), 3);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+
+  // The message goes to all of the flows, or none of them.
+  EXPECT_EQ(machnet_sendmsg_fanout(g_channel_ctx, &tx_msghdr, flows.data(), 0),
+            -1);
+  EXPECT_EQ(machnet_sendmsg_fanout(g_channel_ctx, &tx_msghdr, flows.data(),
+                                   MACHNET_FANOUT_MAX + 1),
+            -1);
+  EXPECT_EQ(__machnet_channel_app_ring_pending(g_channel_ctx), 0);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+}
+
+TEST(MachnetTest, SendRecvMsgChunks) {
+  const MachnetChannelAppStats_t *stats =
+      &__machnet_channel_stats(g_channel_ctx)->a_stats;
+  const uint64_t tx_msg_success = stats->tx_msg_success;
+
+  // A message sent in three chunks, of one or more buffers each.
+  const uint32_t bs = FLAGS_buffer_size;
+  const std::vector<uint32_t> chunk_sizes = {bs + 1, 8, 2 * bs};
+  const std::vector<uint16_t> chunk_flags = {MACHNET_MSGBUF_FLAGS_SYN, 0,
+                                             MACHNET_MSGBUF_FLAGS_FIN};
+  std::vector<std::vector<uint8_t>> data(chunk_sizes.size());
+  for (size_t i = 0; i < chunk_sizes.size(); i++) {
+    data[i].resize(chunk_sizes[i]);
+    std::iota(data[i].begin(), data[i].end(), i);
+    MachnetIovec_t iov = {.base = data[i].data(), .len = data[i].size()};
+    MachnetMsgHdr_t msghdr = {.msg_size = chunk_sizes[i],
+                              .flow_info = {},
+                              .msg_iov = &iov,
+                              .msg_iovlen = 1,
+                              .flags = chunk_flags[i]};
+    ASSERT_EQ(machnet_sendmsg_chunk(g_channel_ctx, &msghdr), 0);
+  }
+  EXPECT_EQ(stats->tx_msg_success, tx_msg_success + 1);
+
+  // Each chunk is enqueued with its own metadata; only the first one is marked
+  // first, and only the last one last, the others being chained to the next.
+  std::vector<MachnetRingSlot_t> heads;
+  for (size_t i = 0; i < chunk_sizes.size(); i++) {
+    MachnetRingSlot_t index;
+    ASSERT_TRUE(dequeue_app_msg(g_channel_ctx, &index));
+    heads.push_back(index);
+    const MachnetMsgBuf_t *head = __machnet_channel_buf(g_channel_ctx, index);
+    const MachnetMsgBuf_t *last =
+        __machnet_channel_buf(g_channel_ctx, head->last);
+    EXPECT_EQ(head->msg_len, chunk_sizes[i]);
+    EXPECT_EQ(head->flags & MACHNET_MSGBUF_FLAGS_SYN,
+              chunk_flags[i] & MACHNET_MSGBUF_FLAGS_SYN);
+    EXPECT_EQ(last->flags & MACHNET_MSGBUF_FLAGS_FIN,
+              chunk_flags[i] & MACHNET_MSGBUF_FLAGS_FIN);
+    EXPECT_EQ((last->flags & MACHNET_MSGBUF_FLAGS_CHAIN) != 0,
+              i + 1 < chunk_sizes.size());
+    EXPECT_FALSE(last->flags & MACHNET_MSGBUF_FLAGS_SG);
+  }
+
+  // Delivered as chunks, they are received as such.
+  ASSERT_EQ(__machnet_channel_machnet_ring_enqueue(g_channel_ctx, heads.size(),
+                                                   heads.data()),
+            heads.size());
+  for (size_t i = 0; i < chunk_sizes.size(); i++) {
+    std::vector<uint8_t> rx_data(chunk_sizes[i]);
+    MachnetIovec_t rx_iov = {.base = rx_data.data(), .len = rx_data.size()};
+    MachnetMsgHdr_t rx_msghdr = {.msg_iov = &rx_iov, .msg_iovlen = 1};
+    EXPECT_EQ(machnet_recvmsg(g_channel_ctx, &rx_msghdr), 1);
+    EXPECT_EQ(rx_msghdr.msg_size, chunk_sizes[i]);
+    EXPECT_EQ(rx_msghdr.flags, chunk_flags[i]);
+    EXPECT_EQ(rx_data, data[i]);
+  }
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+
+  // A whole message is received as both the first and the last chunk.
+  MachnetIovec_t iov = {.base = data[2].data(), .len = data[2].size()};
+  MachnetMsgHdr_t msghdr = {.msg_size = chunk_sizes[2],
+                            .flow_info = {},
+                            .msg_iov = &iov,
+                            .msg_iovlen = 1,
+                            .flags = 0};
+  ASSERT_EQ(machnet_sendmsg(g_channel_ctx, &msghdr), 0);
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 1);
+  std::vector<uint8_t> rx_data(chunk_sizes[2]);
+  MachnetIovec_t rx_iov = {.base = rx_data.data(), .len = rx_data.size()};
+  MachnetMsgHdr_t rx_msghdr = {.msg_iov = &rx_iov, .msg_iovlen = 1};
+  EXPECT_EQ(machnet_recvmsg(g_channel_ctx, &rx_msghdr), 1);
+  EXPECT_EQ(rx_msghdr.flags,
+            MACHNET_MSGBUF_FLAGS_SYN | MACHNET_MSGBUF_FLAGS_FIN);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+}
+
+TEST(MachnetTest, DeliveryCompletions) {
+  // A notified message takes a buffer, even if tiny, to carry its cookie.
+  std::vector<uint8_t> data(8);
+  MachnetIovec_t iov = {.base = data.data(), .len = data.size()};
+  MachnetMsgHdr_t msghdr = {.msg_size = static_cast<uint32_t>(data.size()),
+                            .flow_info = {},
+                            .msg_iov = &iov,
+                            .msg_iovlen = 1,
+                            .flags = MACHNET_MSGBUF_NOTIFY_DELIVERY,
+                            .cookie = 42};
+  ASSERT_EQ(machnet_sendmsg(g_channel_ctx, &msghdr), 0);
+  MachnetRingSlot_t index;
+  ASSERT_EQ(__machnet_channel_app_ring_dequeue_prio(
+                g_channel_ctx, MACHNET_PRIO_NORMAL, 1, &index),
+            1);
+  ASSERT_FALSE(__machnet_ring_slot_is_inline(index));
+  const MachnetMsgBuf_t *buf = __machnet_channel_buf(g_channel_ctx, index);
+  EXPECT_TRUE(buf->flags & MACHNET_MSGBUF_NOTIFY_DELIVERY);
+  EXPECT_EQ(buf->cookie, 42);
+  ASSERT_EQ(__machnet_channel_buf_free_bulk(g_channel_ctx, 1, &index), 1);
+
+  // The cookies that Machnet posts are retrieved in batches.
+  uint32_t cookies[4];
+  EXPECT_EQ(machnet_recv_completions(g_channel_ctx, cookies, 4), 0);
+  const std::vector<uint32_t> posted = {42, 43, 44, 45, 46};
+  ASSERT_EQ(__machnet_channel_completion_ring_enqueue(
+                g_channel_ctx, posted.size(), posted.data()),
+            posted.size());
+  ASSERT_EQ(machnet_recv_completions(g_channel_ctx, cookies, 4), 4);
+  EXPECT_EQ(std::vector<uint32_t>(cookies, cookies + 4),
+            std::vector<uint32_t>(posted.begin(), posted.begin() + 4));
+  ASSERT_EQ(machnet_recv_completions(g_channel_ctx, cookies, 4), 1);
+  EXPECT_EQ(cookies[0], posted[4]);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+}
+
+TEST(MachnetTest, RecvMmsgBatch) {
+  // More messages than a single dequeue batch, with one receive buffer that
+  // is too small; that message is dropped without affecting the rest.
+  const size_t nr_msgs = 100;
+  const size_t short_msg = 42;
+  std::uniform_int_distribution<uint32_t> msg_len{
+      3, static_cast<uint32_t>(3 * FLAGS_buffer_size)};
+  std::vector<std::vector<std::vector<uint8_t>>> tx_msg_data(nr_msgs);
+  std::vector<std::vector<MachnetIovec_t>> tx_iov(nr_msgs);
+  std::vector<MachnetMsgHdr_t> tx_msghdr(nr_msgs);
+  std::vector<std::vector<std::vector<uint8_t>>> rx_msg_data(nr_msgs + 1);
+  std::vector<std::vector<MachnetIovec_t>> rx_iov(nr_msgs + 1);
+  std::vector<MachnetMsgHdr_t> rx_msghdr(nr_msgs + 1);
+  for (size_t i = 0; i < nr_msgs; i++) {
+    const uint32_t msg_size = msg_len(mersenne_engine);
+    MachnetFlow_t flow;
+    prepare_segments(msg_size, 1, &tx_msg_data[i]);
+    prepare_tx_msg(&flow, &tx_iov[i], &tx_msghdr[i], &tx_msg_data[i], msg_size);
+    const uint32_t rx_size = i == short_msg ? msg_size - 1 : msg_size;
+    prepare_segments(rx_size, 1, &rx_msg_data[i]);
+    prepare_rx_msg(&rx_iov[i], &rx_msghdr[i], &rx_msg_data[i], rx_size);
+  }
+  prepare_segments(2, 1, &rx_msg_data[nr_msgs]);
+  prepare_rx_msg(&rx_iov[nr_msgs], &rx_msghdr[nr_msgs], &rx_msg_data[nr_msgs],
+                 2);
+
+  ASSERT_EQ(machnet_sendmmsg(g_channel_ctx, tx_msghdr.data(), nr_msgs),
+            nr_msgs);
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), nr_msgs);
+
+  // Only the pending messages are consumed.
+  EXPECT_EQ(
+      machnet_recvmmsg(g_channel_ctx, rx_msghdr.data(), rx_msghdr.size()),
+      nr_msgs);
+  for (size_t i = 0; i < nr_msgs; i++) {
+    if (i == short_msg) {
+      EXPECT_EQ(rx_msghdr[i].msg_size, 0);
+      continue;
+    }
+    EXPECT_EQ(rx_msghdr[i].msg_size, tx_msghdr[i].msg_size) << "Msg: " << i;
+    EXPECT_EQ(rx_msg_data[i], tx_msg_data[i]) << "Msg: " << i;
+  }
+  EXPECT_EQ(machnet_recvmmsg(g_channel_ctx, rx_msghdr.data(), 1), 0);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+}
+
+TEST(MachnetTest, ZeroCopySendRecv) {
+  // A multi-buffer message, built in place and received without copies.
+  const uint32_t msg_size = 2 * FLAGS_buffer_size + FLAGS_buffer_size / 2;
+  MachnetMsgBuf_t *msg = machnet_msg_alloc(g_channel_ctx, msg_size);
+  ASSERT_NE(msg, nullptr);
+  uint32_t ofs = 0, buffers_nr = 0;
+  for (MachnetMsgBuf_t *buf = msg; buf != nullptr;
+       buf = machnet_msgbuf_next(g_channel_ctx, buf)) {
+    auto *data = static_cast<uint8_t *>(machnet_msgbuf_data(buf));
+    for (uint32_t i = 0; i < machnet_msgbuf_len(buf); i++) data[i] = ofs++;
+    buffers_nr++;
+  }
+  EXPECT_EQ(ofs, msg_size);
+  EXPECT_EQ(buffers_nr, 3);
+
+  const MachnetFlow_t flow = {
+      .src_ip = 1, .dst_ip = 2, .src_port = 3, .dst_port = 4};
+  ASSERT_EQ(machnet_msg_send(g_channel_ctx, flow, msg, 0), 0);
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 1);
+
+  const MachnetMsgBuf_t *rx_msg = nullptr;
+  MachnetFlow_t rx_flow;
+  ASSERT_EQ(machnet_recv_zc(g_channel_ctx, &rx_msg, &rx_flow), 1);
+  EXPECT_EQ(rx_msg->msg_len, msg_size);
+  EXPECT_EQ(rx_flow.dst_port, flow.dst_port);
+  ofs = 0;
+  for (const MachnetMsgBuf_t *buf = rx_msg; buf != nullptr;
+       buf = machnet_msgbuf_next(g_channel_ctx, buf)) {
+    const auto *data = static_cast<const uint8_t *>(machnet_msgbuf_data(buf));
+    for (uint32_t i = 0; i < machnet_msgbuf_len(buf); i++, ofs++)
+      ASSERT_EQ(data[i], static_cast<uint8_t>(ofs)) << "Offset: " << ofs;
+  }
+  EXPECT_EQ(ofs, msg_size);
+  EXPECT_EQ(machnet_recv_zc(g_channel_ctx, &rx_msg, nullptr), 0);
+  machnet_msg_release(g_channel_ctx, rx_msg);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+
+  // Unsent messages can be dropped.
+  EXPECT_EQ(machnet_msg_alloc(g_channel_ctx, 0), nullptr);
+  machnet_msg_release(g_channel_ctx, machnet_msg_alloc(g_channel_ctx, 1));
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+}
+
+TEST(MachnetTest, MultiThreadedBufferCaches) {
+  // Threads sharing the channel allocate and release buffers concurrently,
+  // through their own caches; the caches are drained when the threads exit.
+  const size_t nr_threads = 4;
+  const size_t nr_iterations = 10000;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < nr_threads; i++) {
+    threads.emplace_back([]() {
+      std::vector<MachnetMsgBuf_t *> msgs;
+      for (size_t j = 0; j < nr_iterations; j++) {
+        // Hold a few messages at a time, of up to 3 buffers each.
+        const uint32_t msg_size = 1 + (j * 7919) % (3 * FLAGS_buffer_size);
+        auto *msg = machnet_msg_alloc(g_channel_ctx, msg_size);
+        ASSERT_NE(msg, nullptr);
+        msgs.push_back(msg);
+        if (msgs.size() == 8) {
+          for (auto *m : msgs) machnet_msg_release(g_channel_ctx, m);
+          msgs.clear();
+        }
+      }
+      for (auto *m : msgs) machnet_msg_release(g_channel_ctx, m);
+    });
+  }
+  for (auto &thread : threads) thread.join();
+
+  EXPECT_EQ(jring_full(__machnet_channel_buf_ring(g_channel_ctx)), 1);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+}
+
+TEST(MachnetTest, DetachDropsStaleCaches) {
+  // Map a second channel, as `machnet_attach()' does.
+  // Channels are named after their UUID.
+  uuid_t uuid;
+  char detached_name[37];
+  uuid_generate(uuid);
+  uuid_unparse(uuid, detached_name);
+  size_t channel_size;
+  int is_posix_shm;
+  int channel_fd;
+  auto *owner_ctx = __machnet_channel_create(
+      detached_name, FLAGS_machnet_slots_nr, FLAGS_app_slots_nr,
+      FLAGS_buffers_nr, FLAGS_buffer_size, MACHNET_CHANNEL_RING_JRING,
+      &channel_size, &is_posix_shm, &channel_fd);
+  ASSERT_NE(owner_ctx, nullptr);
+  const int fd = dup(channel_fd);
+  MachnetChannelCtx_t *ctx = machnet_bind(fd, nullptr);
+  ASSERT_NE(ctx, nullptr);
+  close(fd);
+
+  // Another thread caches buffers of the channel while it is detached; it
+  // must drop them when it exits, rather than touch the unmapped channel.
+  std::atomic<int> step{0};
+  std::thread thread([&]() {
+    auto *msg = machnet_msg_alloc(ctx, FLAGS_buffer_size);
+    ASSERT_NE(msg, nullptr);
+    machnet_msg_release(ctx, msg);
+    step = 1;
+    while (step != 2) std::this_thread::yield();
+  });
+  while (step != 1) std::this_thread::yield();
+  EXPECT_EQ(machnet_detach(ctx), -1);  // There is no controller.
+  step = 2;
+  thread.join();
+
+  // The buffers cached by the thread are lost to the channel.
+  EXPECT_LT(jring_count(__machnet_channel_buf_ring(owner_ctx)),
+            __machnet_channel_buf_ring(owner_ctx)->capacity);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+  __machnet_channel_destroy(owner_ctx, channel_size, &channel_fd, is_posix_shm,
+                            detached_name);
+}
+
+TEST(MachnetTest, EngineStats) {
+  MachnetChannelStats_t *stats = __machnet_channel_stats(g_channel_ctx);
+  MachnetChannelEngineStats_t e_stats;
+  MachnetFlowStats_t f_stats;
+  const MachnetFlow_t flow = {0x0a000001, 0x0a000002, 1000, 2000};
+  const MachnetFlow_t reverse = {0x0a000002, 0x0a000001, 2000, 1000};
+
+  // Nothing published yet.
+  ASSERT_EQ(machnet_get_stats(g_channel_ctx, &e_stats), 0);
+  EXPECT_EQ(e_stats.timestamp_ns, 0);
+  EXPECT_EQ(machnet_get_flow_stats(g_channel_ctx, &flow, &f_stats), -1);
+
+  // Publish them as the engine does.
+  stats->e_seq++;
+  stats->e_stats.timestamp_ns = 1;
+  stats->e_stats.rx_msgs = 10;
+  stats->e_stats.buf_drops = 2;
+  stats->e_stats.nb_flows = 2;
+  stats->e_flows[0] = {};
+  stats->e_flows[1] = {};
+  stats->e_flows[1].flow = flow;
+  stats->e_flows[1].state = MACHNET_FLOW_STATE_ESTABLISHED;
+  stats->e_flows[1].srtt_ns = 12345;
+  stats->e_flows[1].fast_rexmits = 3;
+
+  // An update is in progress.
+  EXPECT_EQ(machnet_get_stats(g_channel_ctx, &e_stats), -1);
+  EXPECT_EQ(machnet_get_flow_stats(g_channel_ctx, &flow, &f_stats), -1);
+
+  stats->e_seq++;
+  ASSERT_EQ(machnet_get_stats(g_channel_ctx, &e_stats), 0);
+  EXPECT_EQ(e_stats.rx_msgs, 10);
+  EXPECT_EQ(e_stats.buf_drops, 2);
+  EXPECT_EQ(e_stats.nb_flows, 2);
+  // The flow is found from either end.
+  for (const auto *f : {&flow, &reverse}) {
+    ASSERT_EQ(machnet_get_flow_stats(g_channel_ctx, f, &f_stats), 0);
+    EXPECT_EQ(f_stats.state, MACHNET_FLOW_STATE_ESTABLISHED);
+    EXPECT_EQ(f_stats.srtt_ns, 12345);
+    EXPECT_EQ(f_stats.fast_rexmits, 3);
+  }
+  const MachnetFlow_t other = {0x0a000001, 0x0a000002, 1000, 2001};
+  EXPECT_EQ(machnet_get_flow_stats(g_channel_ctx, &other, &f_stats), -1);
+
+  memset(&stats->e_stats, 0, sizeof(stats->e_stats));
+}
+
+TEST(MachnetTest, CtrlDoorbell) {
+  const auto doorbell = __machnet_channel_ctrl_sq_doorbell(g_channel_ctx);
+
+  // Serve a single request as the engine does: as soon as the doorbell rings.
+  std::thread engine([doorbell]() {
+    while (__machnet_channel_ctrl_sq_doorbell(g_channel_ctx) == doorbell) {
+    }
+    MachnetCtrlQueueEntry_t req, resp;
+    ASSERT_EQ(__machnet_channel_ctrl_sq_dequeue(g_channel_ctx, 1, &req), 1);
+    EXPECT_EQ(req.opcode, MACHNET_CTRL_OP_LISTEN);
+    EXPECT_EQ(req.listener_info.port, 888);
+    resp.id = req.id;
+    resp.opcode = MACHNET_CTRL_OP_STATUS;
+    resp.status = MACHNET_CTRL_STATUS_OK;
+    ASSERT_EQ(__machnet_channel_ctrl_cq_enqueue(g_channel_ctx, 1, &resp), 1);
+  });
+
+  // The completion is picked up right away.
+  const auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(machnet_listen(g_channel_ctx, "10.0.0.1", 888), 0);
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(100));
+  engine.join();
+  EXPECT_EQ(__machnet_channel_ctrl_sq_doorbell(g_channel_ctx), doorbell + 1);
+}
+
+TEST(MachnetTest, Clock) {
+  // Without a controller, the library's clock is the system's.
+  EXPECT_EQ(machnet_clock_tsc_hz(), 0);
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  const uint64_t now = machnet_clock_ns();
+  EXPECT_GE(now, ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+  EXPECT_GE(machnet_clock_ns(), now);
+
+  // A page of a 2GHz TSC.
+  MachnetClockPage_t page{};
+  page.tsc_hz = 2000000000;
+  page.base_tsc = 1000000;
+  page.base_ns = 5000;
+  page.mult = (1ULL << MACHNET_CLOCK_SHIFT) / 2;
+  EXPECT_EQ(__machnet_clock_tsc_to_ns(&page, page.base_tsc), 5000);
+  EXPECT_EQ(__machnet_clock_tsc_to_ns(&page, page.base_tsc + 2000), 6000);
+  EXPECT_EQ(__machnet_clock_tsc_to_ns(&page, page.base_tsc - 2000), 4000);
+}
+
 TEST(MachnetTest, InvalidSendRecv) {
   // Message length generator.
   std::uniform_int_distribution<uint32_t> invalid_msg_len{
@@ -445,10 +1175,10 @@ int main(int argc, char **argv) {
   size_t channel_size;
   int is_posix_shm;
   int channel_fd;
-  g_channel_ctx = __machnet_channel_create(channel_name, FLAGS_machnet_slots_nr,
-                                           FLAGS_app_slots_nr, FLAGS_buffers_nr,
-                                           FLAGS_buffer_size, &channel_size,
-                                           &is_posix_shm, &channel_fd);
+  g_channel_ctx = __machnet_channel_create(
+      channel_name, FLAGS_machnet_slots_nr, FLAGS_app_slots_nr,
+      FLAGS_buffers_nr, FLAGS_buffer_size, MACHNET_CHANNEL_RING_JRING,
+      &channel_size, &is_posix_shm, &channel_fd);
   if (g_channel_ctx == nullptr) return -1;
 
   int ret = RUN_ALL_TESTS();
@@ -0,0 +1,337 @@
+/**
+ * @file aes_gcm.h
+ * @brief AES-128-GCM authenticated encryption (`AEAD_AES_128_GCM' of RFC
+ * 5116), with AES-NI and carry-less multiplications.
+ *
+ * Counter blocks go through the AES rounds four at a time, to hide the latency
+ * of `aesenc', and GHASH folds four blocks per reduction, with the powers `H'
+ * to `H^4' of the hash key. The tree is built for SSE4.2 (see `-msse4.2'): the
+ * functions that need AES-NI and PCLMULQDQ are compiled with function-level
+ * target attributes, and must only be called if `Supported()'.
+ */
+#ifndef SRC_INCLUDE_AES_GCM_H_
+#define SRC_INCLUDE_AES_GCM_H_
+
+#include <immintrin.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace juggler {
+namespace crypto {
+
+// A 128-bit AES key.
+using Key = std::array<uint8_t, 16>;
+
+// Whether this CPU has the instructions the ciphers need (checked with
+// `cpuid').
+static inline bool Supported() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul");
+}
+
+/**
+ * @brief Class `Aes128' is the AES-128 block cipher (encryption only, as for
+ * the counter mode of GCM).
+ */
+class Aes128 {
+ public:
+  static constexpr size_t kBlockSize = 16;
+  static constexpr size_t kRounds = 10;
+
+  Aes128() = default;
+  explicit Aes128(const Key &key) { SetKey(key); }
+
+  __attribute__((target("aes"))) void SetKey(const Key &key) {
+    auto &rk = round_keys_;
+    rk[0] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key.data()));
+    rk[1] = ExpandStep<0x01>(rk[0]);
+    rk[2] = ExpandStep<0x02>(rk[1]);
+    rk[3] = ExpandStep<0x04>(rk[2]);
+    rk[4] = ExpandStep<0x08>(rk[3]);
+    rk[5] = ExpandStep<0x10>(rk[4]);
+    rk[6] = ExpandStep<0x20>(rk[5]);
+    rk[7] = ExpandStep<0x40>(rk[6]);
+    rk[8] = ExpandStep<0x80>(rk[7]);
+    rk[9] = ExpandStep<0x1b>(rk[8]);
+    rk[10] = ExpandStep<0x36>(rk[9]);
+  }
+
+  __attribute__((target("aes"))) __m128i Encrypt(__m128i block) const {
+    block = _mm_xor_si128(block, round_keys_[0]);
+    for (size_t r = 1; r < kRounds; r++) {
+      block = _mm_aesenc_si128(block, round_keys_[r]);
+    }
+    return _mm_aesenclast_si128(block, round_keys_[kRounds]);
+  }
+
+  // Encrypt four blocks, with their rounds interleaved.
+  __attribute__((target("aes"))) void Encrypt4(__m128i *b) const {
+    const auto &rk = round_keys_;
+    for (size_t i = 0; i < 4; i++) b[i] = _mm_xor_si128(b[i], rk[0]);
+    for (size_t r = 1; r < kRounds; r++) {
+      b[0] = _mm_aesenc_si128(b[0], rk[r]);
+      b[1] = _mm_aesenc_si128(b[1], rk[r]);
+      b[2] = _mm_aesenc_si128(b[2], rk[r]);
+      b[3] = _mm_aesenc_si128(b[3], rk[r]);
+    }
+    for (size_t i = 0; i < 4; i++) {
+      b[i] = _mm_aesenclast_si128(b[i], rk[kRounds]);
+    }
+  }
+
+  // Encrypt a block in memory (`in' and `out' may be the same).
+  __attribute__((target("aes"))) void Encrypt(const uint8_t *in,
+                                              uint8_t *out) const {
+    const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), Encrypt(block));
+  }
+
+ private:
+  template <int kRcon>
+  __attribute__((target("aes"))) static __m128i ExpandStep(__m128i key) {
+    const __m128i assist =
+        _mm_shuffle_epi32(_mm_aeskeygenassist_si128(key, kRcon), 0xff);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+  }
+
+  __m128i round_keys_[kRounds + 1];
+};
+
+/**
+ * @brief Class `AesGcm' seals and opens messages with AES-128-GCM, under a
+ * 96-bit IV and with a 128-bit tag. The IV must never repeat under a key.
+ *
+ * GHASH works on byte-reflected blocks, so that the carry-less products of
+ * PCLMULQDQ need no bit reflection (see Gueron and Kounavis, "Intel
+ * Carry-Less Multiplication Instruction and its Usage for Computing the GCM
+ * Mode").
+ */
+class AesGcm {
+ public:
+  static constexpr size_t kIvSize = 12;
+  static constexpr size_t kTagSize = 16;
+
+  AesGcm() = default;
+  explicit AesGcm(const Key &key) { SetKey(key); }
+
+  __attribute__((target("aes,pclmul"))) void SetKey(const Key &key) {
+    aes_.SetKey(key);
+    h_[0] = Reflect(aes_.Encrypt(_mm_setzero_si128()));
+    for (size_t i = 1; i < 4; i++) h_[i] = Multiply(h_[i - 1], h_[0]);
+  }
+
+  /**
+   * @brief Encrypt `len' bytes from `src' to `dst' (which may be the same),
+   * and authenticate them along with `aad_len' bytes of `aad'.
+   *
+   * @param iv  The `kIvSize' bytes of the IV.
+   * @param tag Where to write the `kTagSize' bytes of the tag.
+   */
+  __attribute__((target("aes,pclmul"))) void Seal(
+      const uint8_t *iv, const void *aad, size_t aad_len, const void *src,
+      void *dst, size_t len, uint8_t *tag) const {
+    const __m128i t = Crypt<true>(iv, static_cast<const uint8_t *>(aad),
+                                  aad_len, static_cast<const uint8_t *>(src),
+                                  static_cast<uint8_t *>(dst), len);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(tag), t);
+  }
+
+  /**
+   * @brief Decrypt `len' bytes from `src' to `dst' (which may be the same),
+   * and check them and the `aad_len' bytes of `aad' against `tag'.
+   *
+   * @return Whether the message is authentic; if not, the contents of `dst'
+   * are undefined.
+   */
+  __attribute__((target("aes,pclmul"))) bool Open(
+      const uint8_t *iv, const void *aad, size_t aad_len, const void *src,
+      void *dst, size_t len, const uint8_t *tag) const {
+    const __m128i t = Crypt<false>(iv, static_cast<const uint8_t *>(aad),
+                                   aad_len, static_cast<const uint8_t *>(src),
+                                   static_cast<uint8_t *>(dst), len);
+    // Compare in constant time.
+    const __m128i diff = _mm_xor_si128(
+        t, _mm_loadu_si128(reinterpret_cast<const __m128i *>(tag)));
+    return _mm_testz_si128(diff, diff);
+  }
+
+  const Aes128 &aes() const { return aes_; }
+
+ private:
+  static __m128i Reflect(__m128i x) {
+    const __m128i kReverse =
+        _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    return _mm_shuffle_epi8(x, kReverse);
+  }
+
+  static __m128i Load(const uint8_t *p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  }
+
+  static void Store(uint8_t *p, __m128i x) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(p), x);
+  }
+
+  // Accumulate the (unreduced) carry-less product of `a' and `b'.
+  __attribute__((target("pclmul"))) static void MulAcc(__m128i a, __m128i b,
+                                                       __m128i *lo,
+                                                       __m128i *mid,
+                                                       __m128i *hi) {
+    *lo = _mm_xor_si128(*lo, _mm_clmulepi64_si128(a, b, 0x00));
+    *hi = _mm_xor_si128(*hi, _mm_clmulepi64_si128(a, b, 0x11));
+    *mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x10));
+    *mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x01));
+  }
+
+  // Reduce a 256-bit product modulo the GCM polynomial, after shifting it by a
+  // bit to account for the reflection.
+  static __m128i Reduce(__m128i lo, __m128i mid, __m128i hi) {
+    lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+    hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+    // Shift the product left by one bit.
+    __m128i carry_lo = _mm_srli_epi32(lo, 31);
+    __m128i carry_hi = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    const __m128i carry_mid = _mm_srli_si128(carry_lo, 12);
+    carry_hi = _mm_slli_si128(carry_hi, 4);
+    carry_lo = _mm_slli_si128(carry_lo, 4);
+    lo = _mm_or_si128(lo, carry_lo);
+    hi = _mm_or_si128(hi, carry_hi);
+    hi = _mm_or_si128(hi, carry_mid);
+
+    // Reduce modulo x^128 + x^7 + x^2 + x + 1.
+    __m128i a = _mm_slli_epi32(lo, 31);
+    a = _mm_xor_si128(a, _mm_slli_epi32(lo, 30));
+    a = _mm_xor_si128(a, _mm_slli_epi32(lo, 25));
+    const __m128i b = _mm_srli_si128(a, 4);
+    lo = _mm_xor_si128(lo, _mm_slli_si128(a, 12));
+    __m128i c = _mm_srli_epi32(lo, 1);
+    c = _mm_xor_si128(c, _mm_srli_epi32(lo, 2));
+    c = _mm_xor_si128(c, _mm_srli_epi32(lo, 7));
+    c = _mm_xor_si128(c, b);
+    lo = _mm_xor_si128(lo, c);
+    return _mm_xor_si128(hi, lo);
+  }
+
+  __attribute__((target("pclmul"))) static __m128i Multiply(__m128i a,
+                                                            __m128i b) {
+    __m128i lo = _mm_setzero_si128(), mid = lo, hi = lo;
+    MulAcc(a, b, &lo, &mid, &hi);
+    return Reduce(lo, mid, hi);
+  }
+
+  // Hash four (reflected) blocks into `y', with a single reduction.
+  __attribute__((target("pclmul"))) __m128i Ghash4(__m128i y,
+                                                   const __m128i *x) const {
+    __m128i lo = _mm_setzero_si128(), mid = lo, hi = lo;
+    MulAcc(_mm_xor_si128(y, x[0]), h_[3], &lo, &mid, &hi);
+    MulAcc(x[1], h_[2], &lo, &mid, &hi);
+    MulAcc(x[2], h_[1], &lo, &mid, &hi);
+    MulAcc(x[3], h_[0], &lo, &mid, &hi);
+    return Reduce(lo, mid, hi);
+  }
+
+  __attribute__((target("pclmul"))) __m128i Ghash(__m128i y, __m128i x) const {
+    return Multiply(_mm_xor_si128(y, x), h_[0]);
+  }
+
+  // Hash bytes (zero-padded to whole blocks) into `y'.
+  __attribute__((target("pclmul"))) __m128i GhashBytes(__m128i y,
+                                                       const uint8_t *data,
+                                                       size_t len) const {
+    for (; len >= 4 * 16; len -= 4 * 16, data += 4 * 16) {
+      const __m128i x[4] = {Reflect(Load(data)), Reflect(Load(data + 16)),
+                            Reflect(Load(data + 32)),
+                            Reflect(Load(data + 48))};
+      y = Ghash4(y, x);
+    }
+    for (; len >= 16; len -= 16, data += 16) y = Ghash(y, Reflect(Load(data)));
+    if (len != 0) {
+      uint8_t block[16] = {};
+      std::memcpy(block, data, len);
+      y = Ghash(y, Reflect(Load(block)));
+    }
+    return y;
+  }
+
+  /**
+   * @brief Encrypt (or decrypt) `src' into `dst' in counter mode, and hash
+   * the AAD and the ciphertext.
+   * @return The tag.
+   */
+  template <bool kEncrypt>
+  __attribute__((target("aes,pclmul"))) __m128i Crypt(const uint8_t *iv,
+                                                      const uint8_t *aad,
+                                                      size_t aad_len,
+                                                      const uint8_t *src,
+                                                      uint8_t *dst,
+                                                      size_t len) const {
+    // The pre-counter block is the IV followed by a 32-bit counter of 1; the
+    // counter is incremented in the reflected block, where it is the lowest
+    // 32-bit lane.
+    uint8_t j0[16] = {};
+    std::memcpy(j0, iv, kIvSize);
+    j0[15] = 1;
+    const __m128i j0_block = Load(j0);
+    __m128i ctr = Reflect(j0_block);
+    const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+
+    __m128i y = GhashBytes(_mm_setzero_si128(), aad, aad_len);
+    const size_t total = len;
+    for (; len >= 4 * 16; len -= 4 * 16, src += 4 * 16, dst += 4 * 16) {
+      __m128i ks[4];
+      for (size_t i = 0; i < 4; i++) {
+        ctr = _mm_add_epi32(ctr, one);
+        ks[i] = Reflect(ctr);
+      }
+      aes_.Encrypt4(ks);
+      __m128i x[4];
+      for (size_t i = 0; i < 4; i++) {
+        const __m128i in = Load(src + 16 * i);
+        const __m128i out = _mm_xor_si128(in, ks[i]);
+        Store(dst + 16 * i, out);
+        x[i] = Reflect(kEncrypt ? out : in);
+      }
+      y = Ghash4(y, x);
+    }
+    for (; len >= 16; len -= 16, src += 16, dst += 16) {
+      ctr = _mm_add_epi32(ctr, one);
+      const __m128i in = Load(src);
+      const __m128i out = _mm_xor_si128(in, aes_.Encrypt(Reflect(ctr)));
+      Store(dst, out);
+      y = Ghash(y, Reflect(kEncrypt ? out : in));
+    }
+    if (len != 0) {
+      ctr = _mm_add_epi32(ctr, one);
+      uint8_t in[16] = {}, out[16];
+      std::memcpy(in, src, len);
+      Store(out, _mm_xor_si128(Load(in), aes_.Encrypt(Reflect(ctr))));
+      std::memcpy(dst, out, len);
+      std::memset(out + len, 0, sizeof(out) - len);
+      y = Ghash(y, Reflect(Load(kEncrypt ? out : in)));
+    }
+
+    // The lengths block, in bits (already reflected).
+    const __m128i lengths = _mm_set_epi64x(static_cast<int64_t>(aad_len * 8),
+                                           static_cast<int64_t>(total * 8));
+    y = Ghash(y, lengths);
+    return _mm_xor_si128(Reflect(y), aes_.Encrypt(j0_block));
+  }
+
+  Aes128 aes_;
+  // Powers `H', `H^2', `H^3' and `H^4' of the hash key, reflected.
+  __m128i h_[4];
+};
+
+}  // namespace crypto
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_AES_GCM_H_
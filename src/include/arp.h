@@ -13,7 +13,9 @@
 #include <packet.h>
 #include <pmd.h>
 
+#include <optional>
 #include <unordered_set>
+#include <utility>
 
 namespace juggler {
 namespace net {
@@ -69,7 +71,9 @@ static_assert(sizeof(Arp) == 28, "Arp size mismatch");
  * @brief This class implements a minimal ARP layer. It is used to resolve IP
  * addresses to MAC addresses.
  *
- * This class is not thread-safe.
+ * This class is not thread-safe, except for its const methods, which do not
+ * touch the ARP table: callers that share the handler among threads keep the
+ * table themselves (see `HandleArpPacket()').
  *
  * NOTE: No IPv6 support yet.
  */
@@ -109,10 +113,10 @@ class ArpHandler {
    * @param target_ip The IP address of the target machine.
    */
   void RequestL2Addr(const dpdk::TxRing *txring, const Ipv4::Address &local_ip,
-                     const Ipv4::Address &target_ip) {
+                     const Ipv4::Address &target_ip) const {
     DCHECK_NOTNULL(txring);
-    DCHECK_NOTNULL(txring->GetPacketPool());
-    auto *packet = txring->GetPacketPool()->PacketAlloc();
+    DCHECK_NOTNULL(txring->GetCtrlPacketPool());
+    auto *packet = txring->GetCtrlPacketPool()->PacketAlloc();
     CHECK_NOTNULL(packet);
 
     auto *eh = packet->append<Ethernet *>(sizeof(Ethernet) + sizeof(Arp));
@@ -151,8 +155,8 @@ class ArpHandler {
   void Reply(const dpdk::TxRing *txring, const Arp *rx_arph,
              const Ipv4::Address &local_ip) const {
     DCHECK_NOTNULL(txring);
-    DCHECK_NOTNULL(txring->GetPacketPool());
-    auto *packet = txring->GetPacketPool()->PacketAlloc();
+    DCHECK_NOTNULL(txring->GetCtrlPacketPool());
+    auto *packet = txring->GetCtrlPacketPool()->PacketAlloc();
     CHECK_NOTNULL(packet);
 
     auto *eh = packet->append<Ethernet *>(sizeof(Ethernet) + sizeof(Arp));
@@ -209,6 +213,22 @@ class ArpHandler {
    * @param arph The ARP header.
    */
   void ProcessArpPacket(dpdk::TxRing *txring, const Arp *arph) {
+    const auto entry = HandleArpPacket(txring, arph);
+    // Update the cache.
+    if (entry.has_value()) arp_table_[entry->first] = entry->second;
+  }
+
+  /**
+   * @brief Handle a received ARP packet, without updating the ARP table:
+   * requests for local addresses are replied to, and replies to them are
+   * returned to the caller.
+   *
+   * @param arph The ARP header.
+   * @return The IP and MAC addresses of the sender of an ARP reply for us, or
+   * `std::nullopt' otherwise.
+   */
+  std::optional<std::pair<Ipv4::Address, Ethernet::Address>> HandleArpPacket(
+      const dpdk::TxRing *txring, const Arp *arph) const {
     DCHECK(arph != nullptr);
 
     // We do not need to do any L2 processing; already took place.
@@ -217,13 +237,13 @@ class ArpHandler {
         [[unlikely]] {                                     // NOLINT
       LOG(WARNING) << "Received ARP packet with invalid hardware type: "
                    << arph->htype.value();
-      return;
+      return std::nullopt;
     }
 
     if (arph->ptype.value() != Ethernet::EthType::kIpv4)  // NOLINT
         [[unlikely]] {                                    // NOLINT
       LOG(WARNING) << "Received a non-ipv4 ARP packet.";
-      return;
+      return std::nullopt;
     }
 
     if (arph->hlen != Arp::ArpHlen::kEthernetLen ||  // NOLINT
@@ -231,7 +251,7 @@ class ArpHandler {
         [[unlikely]] {                               // NOLINT
       LOG(WARNING) << "Received ARP packet with invalid hardware or protocol "
                    << "address length.";
-      return;
+      return std::nullopt;
     }
 
     static const Ipv4::Address zero_addr(0u);
@@ -246,13 +266,13 @@ class ArpHandler {
       case Arp::ArpOp::kReply:
         // Check if the ARP reply is for us.
         if (local_ip_addrs_.find(target_ip) == local_ip_addrs_.end()) break;
-        // Update the cache.
-        arp_table_[arph->ipv4_data.spa] = arph->ipv4_data.sha;
-        break;
+        return std::make_pair(Ipv4::Address(arph->ipv4_data.spa),
+                              Ethernet::Address(arph->ipv4_data.sha));
       default:
         LOG(WARNING) << "Received ARP packet with unsupported operation.";
-        return;
+        break;
     }
+    return std::nullopt;
   }
 
   std::vector<std::tuple<std::string, std::string>> GetArpTableEntries() const {
@@ -0,0 +1,159 @@
+/**
+ * @file bench_results.h
+ * @brief Machine-readable results of benchmarks, as CSV or JSON lines (see
+ * `BenchResults').
+ */
+#ifndef SRC_INCLUDE_BENCH_RESULTS_H_
+#define SRC_INCLUDE_BENCH_RESULTS_H_
+
+#include <glog/logging.h>
+#include <utils.h>
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace juggler {
+
+/**
+ * @brief Class `BenchResults' collects the results of a benchmark, one row per
+ * configuration it ran (e.g., a point of a parameter sweep), as named fields,
+ * and writes them in a format for scripts to compare and tabulate:
+ *
+ * - CSV, with a header line of the names of the fields of the first row;
+ * - JSON lines, one object per row.
+ *
+ * Both formats can be appended to (see `Append()'), for successive runs (e.g.,
+ * of `msg_gen', with different flags) to accumulate in one file. The rows are
+ * expected to have the same fields, in the same order.
+ */
+class BenchResults {
+ public:
+  enum class Format { kCsv, kJson };
+  using Value = std::variant<uint64_t, double, std::string>;
+  using Row = std::vector<std::pair<std::string, Value>>;
+
+  void Add(Row row) { rows_.emplace_back(std::move(row)); }
+  const std::vector<Row> &rows() const { return rows_; }
+
+  // The format for a file: CSV for `.csv' files, JSON lines otherwise.
+  static Format FormatOf(const std::string &path) {
+    const std::string kCsvExt = ".csv";
+    return path.size() >= kCsvExt.size() &&
+                   path.compare(path.size() - kCsvExt.size(), kCsvExt.size(),
+                                kCsvExt) == 0
+               ? Format::kCsv
+               : Format::kJson;
+  }
+
+  /**
+   * @brief Write the rows.
+   * @param header Whether to start with the CSV header (ignored for JSON).
+   */
+  void Write(std::ostream &out, Format format, bool header = true) const {
+    if (format == Format::kCsv && header && !rows_.empty()) {
+      out << CsvHeader(rows_.front()) << "\n";
+    }
+    for (const auto &row : rows_) {
+      out << (format == Format::kCsv ? ToCsv(row) : ToJson(row)) << "\n";
+    }
+  }
+
+  /**
+   * @brief Append the rows to a file (see `FormatOf()'), creating it if need
+   * be; CSV files get a header when created.
+   * @return True on success.
+   */
+  bool Append(const std::string &path) const {
+    const auto format = FormatOf(path);
+    const bool empty = !std::ifstream(path).good() ||
+                       std::ifstream(path, std::ios::ate).tellg() == 0;
+    std::ofstream out(path, std::ios::app);
+    if (!out.is_open()) {
+      LOG(ERROR) << "Failed to open " << path;
+      return false;
+    }
+    Write(out, format, empty);
+    return out.good();
+  }
+
+  static std::string CsvHeader(const Row &row) {
+    std::string line;
+    for (const auto &[name, _] : row) {
+      if (!line.empty()) line += ",";
+      line += CsvField(name);
+    }
+    return line;
+  }
+
+  static std::string ToCsv(const Row &row) {
+    std::string line;
+    for (size_t i = 0; i < row.size(); i++) {
+      if (i != 0) line += ",";
+      const auto &value = row[i].second;
+      line += std::holds_alternative<std::string>(value)
+                  ? CsvField(std::get<std::string>(value))
+                  : ToString(value);
+    }
+    return line;
+  }
+
+  static std::string ToJson(const Row &row) {
+    std::string line = "{";
+    for (size_t i = 0; i < row.size(); i++) {
+      if (i != 0) line += ", ";
+      const auto &[name, value] = row[i];
+      line += JsonString(name) + ": ";
+      line += std::holds_alternative<std::string>(value)
+                  ? JsonString(std::get<std::string>(value))
+                  : ToString(value);
+    }
+    return line + "}";
+  }
+
+ private:
+  // A number (`null' if not finite).
+  static std::string ToString(const Value &value) {
+    if (std::holds_alternative<uint64_t>(value)) {
+      return std::to_string(std::get<uint64_t>(value));
+    }
+    const auto d = std::get<double>(value);
+    return std::isfinite(d) ? utils::Format("%.9g", d) : "null";
+  }
+
+  static std::string CsvField(const std::string &str) {
+    if (str.find_first_of(",\"\n") == std::string::npos) return str;
+    std::string quoted = "\"";
+    for (const auto c : str) {
+      if (c == '"') quoted += '"';
+      quoted += c;
+    }
+    return quoted + "\"";
+  }
+
+  static std::string JsonString(const std::string &str) {
+    std::string quoted = "\"";
+    for (const auto c : str) {
+      if (c == '"' || c == '\\') {
+        quoted += '\\';
+        quoted += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        quoted += utils::Format("\\u%04x", c);
+      } else {
+        quoted += c;
+      }
+    }
+    return quoted + "\"";
+  }
+
+  std::vector<Row> rows_;
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_BENCH_RESULTS_H_
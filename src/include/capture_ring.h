@@ -0,0 +1,372 @@
+/**
+ * @file capture_ring.h
+ * @brief Layout of the capture rings of the engines, and their reader side
+ * (see `packet_capture.h').
+ */
+#ifndef SRC_INCLUDE_CAPTURE_RING_H_
+#define SRC_INCLUDE_CAPTURE_RING_H_
+
+#include <common.h>
+#include <ether.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <ipv4.h>
+#include <machnet_pkthdr.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <udp.h>
+#include <unistd.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+namespace juggler {
+namespace capture {
+
+/*
+ * Layout of a capture ring: a `RingHeader', followed by `nb_records'
+ * `Record' entries. External tools rely on it: any change to the layout must
+ * bump `kRingVersion'.
+ */
+static constexpr uint32_t kRingMagic = 0x4d4e4350;  // "MNCP"
+static constexpr uint32_t kRingVersion = 1;
+// Capture rings are files on hugetlbfs if it is mounted there, or else POSIX
+// shared memory objects, named after this prefix.
+static constexpr char kRingNamePrefix[] = "machnet-capture";
+static constexpr char kHugePageDir[] = "/dev/hugepages";
+static constexpr size_t kHugePageSize = 2 << 20;
+static constexpr uint32_t kDefaultRecords = 8192;
+
+// Directions of the packets, as a mask (see `Filter::directions').
+enum Direction : uint8_t {
+  kRx = 0b01,
+  kTx = 0b10,
+};
+
+/**
+ * @brief What to capture, as set by the capture tool. A packet is captured if
+ * it matches all the conditions of the filter; endpoints and flags only match
+ * Machnet packets (IPv4/UDP).
+ */
+struct Filter {
+  // Capture one in every `sample_every' matching packets (0 counts as 1).
+  uint32_t sample_every;
+  // Maximum number of packets captured per iteration of the engine; the
+  // packets over it are skipped (see `RingHeader::skipped').
+  uint32_t budget;
+  // Endpoints, in host byte order (0 is a wildcard): a packet matches if it
+  // goes from `ip[0]:port[0]' to `ip[1]:port[1]', or the other way around.
+  uint32_t ip[2];
+  uint16_t port[2];
+  // Machnet flags (`MachnetPktHdr::net_flags'): a packet matches if
+  // `(net_flags & flags_mask) == flags'.
+  uint8_t flags;
+  uint8_t flags_mask;
+  // `Direction's captured (0 counts as both).
+  uint8_t directions;
+  uint8_t reserved;
+};
+
+// A captured packet.
+struct Record {
+  static constexpr uint16_t kSnapLen = 240;
+  // TSC at capture (see `RingHeader::tsc_hz').
+  uint64_t tsc;
+  // Length of the packet, and of the bytes captured (at most `kSnapLen').
+  uint16_t orig_len;
+  uint16_t cap_len;
+  uint8_t direction;
+  uint8_t reserved[3];
+  uint8_t data[kSnapLen];
+};
+static_assert(sizeof(Record) == 256);
+
+struct RingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t nb_records;
+  uint32_t record_size;
+  // TSC frequency, and a TSC reading at a wall-clock time (refreshed whenever
+  // a capture starts), to convert the timestamps of the records.
+  uint64_t tsc_hz;
+  uint64_t anchor_tsc;
+  uint64_t anchor_ns;
+  // Control, written by the capture tool: the filter, and a generation number
+  // set once it is written (0 while there is no capture).
+  alignas(hardware_constructive_interference_size) Filter filter;
+  uint32_t generation;
+  // Producer (the engine): records written, and packets captured, dropped as
+  // the ring was full, and skipped as over the budget of the iteration.
+  alignas(hardware_constructive_interference_size) uint64_t head;
+  uint64_t captured;
+  uint64_t drops;
+  uint64_t skipped;
+  // Consumer (the capture tool): records read.
+  alignas(hardware_constructive_interference_size) uint64_t tail;
+};
+
+/**
+ * @brief Name of the capture ring of the engine of an RX queue.
+ */
+static inline std::string RingName(uint16_t port_id, uint16_t rx_queue_id) {
+  return utils::Format("%s-p%u-q%u", kRingNamePrefix, port_id, rx_queue_id);
+}
+
+static inline std::string HugePagePath(const std::string &name) {
+  return std::string(kHugePageDir) + "/" + name;
+}
+
+static inline size_t RingSize(uint32_t nb_records) {
+  return sizeof(RingHeader) + nb_records * sizeof(Record);
+}
+
+/**
+ * @brief Whether a packet goes from `src' to `dst' (addresses and ports in
+ * host byte order) or the other way around, as far as the filter is concerned.
+ */
+static inline bool MatchEndpoints(const Filter &filter, uint32_t src_ip,
+                                  uint16_t src_port, uint32_t dst_ip,
+                                  uint16_t dst_port) {
+  auto match = [&filter](size_t i, uint32_t ip, uint16_t port) {
+    return (filter.ip[i] == 0 || filter.ip[i] == ip) &&
+           (filter.port[i] == 0 || filter.port[i] == port);
+  };
+  return (match(0, src_ip, src_port) && match(1, dst_ip, dst_port)) ||
+         (match(0, dst_ip, dst_port) && match(1, src_ip, src_port));
+}
+
+/**
+ * @brief Whether a packet matches a filter, but for its direction (see
+ * `Filter').
+ */
+static inline bool Match(const Filter &filter, const uint8_t *data,
+                         uint16_t len) {
+  const bool endpoints = filter.ip[0] != 0 || filter.ip[1] != 0 ||
+                         filter.port[0] != 0 || filter.port[1] != 0;
+  if (!endpoints && filter.flags_mask == 0) return true;
+
+  using net::Ethernet;
+  using net::Ipv4;
+  using net::MachnetPktHdr;
+  using net::Udp;
+  if (len < sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp)) return false;
+  const auto *eh = reinterpret_cast<const Ethernet *>(data);
+  if (eh->eth_type.value() != Ethernet::kIpv4) return false;
+  const auto *ipv4h = reinterpret_cast<const Ipv4 *>(eh + 1);
+  if (ipv4h->next_proto_id != Ipv4::kUdp) return false;
+  const auto *udph = reinterpret_cast<const Udp *>(ipv4h + 1);
+  if (endpoints &&
+      !MatchEndpoints(filter, ipv4h->src_addr.address.value(),
+                      udph->src_port.port.value(),
+                      ipv4h->dst_addr.address.value(),
+                      udph->dst_port.port.value())) {
+    return false;
+  }
+  if (filter.flags_mask == 0) return true;
+  if (len < sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp) +
+                sizeof(MachnetPktHdr)) {
+    return false;
+  }
+  const auto *mh = reinterpret_cast<const MachnetPktHdr *>(udph + 1);
+  if (mh->magic.value() != MachnetPktHdr::kMagic) return false;
+  return (static_cast<uint8_t>(mh->net_flags) & filter.flags_mask) ==
+         filter.flags;
+}
+
+/**
+ * @brief The memory of a capture ring: a file on hugetlbfs (see
+ * `kHugePageDir'), or else a POSIX shared memory object.
+ */
+class RingMemory {
+ public:
+  /**
+   * @brief Create the memory of a ring (replacing a stale one of the same
+   * name), or open an existing one (`create' false).
+   * @return The memory, or `nullptr' on failure.
+   */
+  static std::unique_ptr<RingMemory> Map(const std::string &name, size_t size,
+                                         bool create) {
+    if (create) {
+      unlink(HugePagePath(name).c_str());
+      shm_unlink(name.c_str());
+    }
+    // Huge pages first: the ring then takes few TLB entries.
+    auto memory = TryMap(name, size, create, true);
+    if (memory == nullptr) memory = TryMap(name, size, create, false);
+    return memory;
+  }
+
+  RingMemory(const RingMemory &) = delete;
+  RingMemory &operator=(const RingMemory &) = delete;
+  ~RingMemory() {
+    munmap(mem_, size_);
+    if (!owner_) return;
+    if (hugepages_) {
+      unlink(HugePagePath(name_).c_str());
+    } else {
+      shm_unlink(name_.c_str());
+    }
+  }
+
+  void *mem() const { return mem_; }
+  size_t size() const { return size_; }
+  bool hugepages() const { return hugepages_; }
+
+ private:
+  static std::unique_ptr<RingMemory> TryMap(const std::string &name,
+                                            size_t size, bool create,
+                                            bool hugepages) {
+    const auto path = HugePagePath(name);
+    auto remove = [&]() {
+      if (!create) return;
+      if (hugepages) {
+        unlink(path.c_str());
+      } else {
+        shm_unlink(name.c_str());
+      }
+    };
+    const int flags = create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR;
+    const int fd = hugepages ? open(path.c_str(), flags, 0660)
+                             : shm_open(name.c_str(), flags, 0660);
+    if (fd == -1) return nullptr;
+    const size_t file_size =
+        hugepages ? utils::align_size(size, kHugePageSize) : size;
+    struct stat st;
+    if ((create && ftruncate(fd, file_size) != 0) || fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < size) {
+      close(fd);
+      remove();
+      return nullptr;
+    }
+    const size_t map_size = st.st_size;
+    void *mem = mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+      remove();
+      return nullptr;
+    }
+    return std::unique_ptr<RingMemory>(
+        new RingMemory(name, mem, map_size, hugepages, create));
+  }
+
+  RingMemory(const std::string &name, void *mem, size_t size, bool hugepages,
+             bool owner)
+      : name_(name),
+        mem_(mem),
+        size_(size),
+        hugepages_(hugepages),
+        owner_(owner) {}
+
+  const std::string name_;
+  void *const mem_;
+  const size_t size_;
+  const bool hugepages_;
+  // Whether to remove the ring when done (the engine that created it).
+  const bool owner_;
+};
+
+/**
+ * @brief Class `RingReader' is the reader side of a capture ring, for the
+ * capture tool: it starts and stops captures, and drains the records.
+ *
+ * @attention A ring must have a single reader at a time.
+ */
+class RingReader {
+ public:
+  /**
+   * @brief Open a capture ring.
+   * @return The reader, or `nullptr' if the ring does not exist or its layout
+   * is not supported.
+   */
+  static std::unique_ptr<RingReader> Open(const std::string &name) {
+    auto memory = RingMemory::Map(name, sizeof(RingHeader), false);
+    if (memory == nullptr) return nullptr;
+    const auto *header = static_cast<const RingHeader *>(memory->mem());
+    if (header->magic != kRingMagic || header->version != kRingVersion ||
+        header->record_size != sizeof(Record) ||
+        !utils::is_power_of_two(header->nb_records) ||
+        RingSize(header->nb_records) > memory->size()) {
+      LOG(WARNING) << "Unsupported capture ring " << name;
+      return nullptr;
+    }
+    return std::unique_ptr<RingReader>(new RingReader(std::move(memory)));
+  }
+
+  RingReader(const RingReader &) = delete;
+  RingReader &operator=(const RingReader &) = delete;
+  ~RingReader() { Stop(); }
+
+  /**
+   * @brief Start a capture: records still in the ring (e.g., from an earlier
+   * capture) are discarded.
+   */
+  void Start(const Filter &filter) {
+    Stop();
+    std::memcpy(&header_->filter, &filter, sizeof(filter));
+    std::atomic_ref<uint64_t>(header_->tail)
+        .store(std::atomic_ref<uint64_t>(header_->head)
+                   .load(std::memory_order_acquire),
+               std::memory_order_release);
+    generation_ = std::max(1u, generation_ + 1);
+    std::atomic_ref<uint32_t>(header_->generation)
+        .store(generation_, std::memory_order_release);
+  }
+
+  // Stop the capture, if any.
+  void Stop() {
+    std::atomic_ref<uint32_t>(header_->generation)
+        .store(0, std::memory_order_release);
+  }
+
+  /**
+   * @brief Hand the records written since the last call to `f', oldest first,
+   * and release them.
+   * @return The number of records.
+   */
+  template <typename F>
+  size_t Drain(F &&f) {
+    const auto head = std::atomic_ref<uint64_t>(header_->head)
+                          .load(std::memory_order_acquire);
+    std::atomic_ref<uint64_t> tail(header_->tail);
+    const auto start = tail.load(std::memory_order_relaxed);
+    for (auto i = start; i != head; i++) {
+      f(records_[i & (header_->nb_records - 1)]);
+    }
+    tail.store(head, std::memory_order_release);
+    return head - start;
+  }
+
+  const RingHeader &header() const { return *header_; }
+
+  // Wall-clock time (ns since the epoch) of a record.
+  uint64_t TimestampNs(const Record &record) const {
+    const double ns = static_cast<double>(static_cast<int64_t>(
+                          record.tsc - header_->anchor_tsc)) *
+                      1E9 / header_->tsc_hz;
+    return header_->anchor_ns + static_cast<int64_t>(ns);
+  }
+
+ private:
+  explicit RingReader(std::unique_ptr<RingMemory> memory)
+      : memory_(std::move(memory)),
+        header_(static_cast<RingHeader *>(memory_->mem())),
+        records_(reinterpret_cast<const Record *>(header_ + 1)),
+        generation_(std::atomic_ref<uint32_t>(header_->generation)
+                        .load(std::memory_order_relaxed)) {}
+
+  const std::unique_ptr<RingMemory> memory_;
+  RingHeader *const header_;
+  const Record *const records_;
+  uint32_t generation_;
+};
+
+}  // namespace capture
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_CAPTURE_RING_H_
@@ -5,8 +5,11 @@
 #ifndef SRC_INCLUDE_CC_H_
 #define SRC_INCLUDE_CC_H_
 
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <string>
 #include <vector>
 
 #include "utils.h"
@@ -33,20 +36,94 @@ constexpr bool seqno_gt(uint32_t a, uint32_t b) {
 
 /**
  * @brief Swift Congestion Control (SWCC) protocol control block.
+ *
+ * Swift is a delay-based congestion control scheme (Kumar et al., SIGCOMM
+ * 2020). The sender samples the RTT of every acknowledged packet through header
+ * timestamps, and splits it into the endpoint delay (the time the packet spent
+ * at the receiver before being acknowledged) and the fabric delay (the rest).
+ * Each delay drives its own window with additive-increase/multiplicative-
+ * decrease (AIMD) against a target delay, and the effective congestion window
+ * is the minimum of the two. The fabric target delay grows for flows with small
+ * windows (flow-based scaling), so that many competing flows converge to a
+ * fair share without overshooting the fabric.
+ *
+ * The window is fractional: when it drops below one packet, the flow keeps at
+ * most one packet in flight and paces its transmissions to one every
+ * `rtt / cwnd' (see `pacing_delay_ns()').
+ *
+ * All timestamps and delays are in nanoseconds.
  */
-// TODO(ilias): First-cut implementation. Needs a lot of work.
 struct Pcb {
-  static constexpr std::size_t kInitialCwnd = 32;
-  static constexpr std::size_t kRexmitThreshold = 3;
-  static constexpr int kRtoThresholdInTicks = 3;  // in slow timer ticks.
-  static constexpr int kRtoDisabled = -1;
+  static constexpr double kInitialCwnd = 32.0;
+  static constexpr double kMinCwnd = 0.01;
+  // Maximum number of packets in flight (i.e., `snd_nxt - snd_una'); the
+  // receiver buffers out-of-order packets up to this far ahead of `rcv_nxt'.
+  static constexpr uint32_t kReassemblyWindow = 1024;
+  // Bounded by the size of the reassembly buffer at the receiver.
+  static constexpr double kMaxCwnd = 512.0;
+  // Additive increment (packets per RTT).
+  static constexpr double kAdditiveIncrement = 1.0;
+  // Multiplicative decrease factor, per unit of relative excess delay.
+  static constexpr double kBeta = 0.8;
+  // Maximum multiplicative decrease (per RTT).
+  static constexpr double kMaxMdf = 0.5;
+  // Endpoint target delay.
+  static constexpr uint64_t kEndpointTargetDelayNs = 25000;
+  // Fabric base target delay, and the range of flow-based scaling on top of
+  // it, applied progressively as the window drops from `kFsMaxCwnd' to
+  // `kFsMinCwnd'.
+  static constexpr uint64_t kFabricBaseTargetDelayNs = 50000;
+  static constexpr uint64_t kFsRangeNs = 4 * kFabricBaseTargetDelayNs;
+  static constexpr double kFsMinCwnd = 0.1;
+  static constexpr double kFsMaxCwnd = 64.0;
+  // RTT assumed before the first sample is taken.
+  static constexpr uint64_t kInitialRttNs = 100000;
+  // EWMA gain of the smoothed RTT.
+  static constexpr double kSrttGain = 0.125;
+  // Lower bound of the probe timeout of tail loss probes (see `pto_ns()').
+  static constexpr uint64_t kMinPtoNs = 10000;
+  // Consecutive RTO retransmissions before giving up on the flow.
+  static constexpr std::size_t kMaxRtoRexmits = 12;
+  // RTO bounds, and the RTO used before an RTT sample is available.
+  static constexpr uint64_t kMinRtoNs = 1000000;
+  static constexpr uint64_t kMaxRtoNs = 1000000000;
+  static constexpr uint64_t kInitialRtoNs = 10000000;
+  // EWMA gain of the RTT variation.
+  static constexpr double kRttvarGain = 0.25;
   Pcb() {}
   // Return the sender effective window in # of packets.
   uint32_t effective_wnd() const {
-    uint32_t effective_wnd = cwnd - (snd_nxt - snd_una - snd_ooo_acks);
-    return effective_wnd > cwnd ? 0 : effective_wnd;
+    // With a fractional window we still allow for one packet in flight;
+    // transmissions are then paced instead.
+    const uint32_t wnd = cwnd < 1.0 ? 1 : static_cast<uint32_t>(cwnd);
+    const uint32_t inflight = snd_nxt - snd_una;
+    uint32_t effective_wnd = wnd - (inflight - snd_ooo_acks);
+    if (effective_wnd > wnd) return 0;
+    return std::min(effective_wnd, receiver_wnd());
   }
 
+  /**
+   * @return Number of packets the receiver has room for right now, regardless
+   * of the congestion window (e.g., for multipath flows, whose paths have
+   * windows of their own).
+   */
+  uint32_t receiver_wnd() const {
+    // Never send beyond the room advertised by the receiver, nor beyond its
+    // reassembly buffer. SACKed packets still hold buffers at the receiver, so
+    // they count against it. A zero window still lets one packet out, to probe
+    // the receiver for a window update (see `zero_window()').
+    const uint32_t inflight = snd_nxt - snd_una;
+    const uint32_t limit = std::max(std::min(rwnd, kReassemblyWindow), 1u);
+    return inflight >= limit ? 0 : limit - inflight;
+  }
+
+  /**
+   * @return Whether the receiver has advertised that it has no room for more
+   * packets (e.g., its application is not keeping up). Retransmissions are
+   * then window probes, not losses.
+   */
+  bool zero_window() const { return rwnd == 0; }
+
   uint32_t seqno() const { return snd_nxt; }
   uint32_t get_snd_nxt() {
     uint32_t seqno = snd_nxt;
@@ -55,46 +132,217 @@ struct Pcb {
   }
 
   std::string ToString() const {
-    std::string s;
-    s += "[CC] snd_nxt: " + std::to_string(snd_nxt) +
-         ", snd_una: " + std::to_string(snd_una) +
-         ", rcv_nxt: " + std::to_string(rcv_nxt) +
-         ", cwnd: " + std::to_string(cwnd) +
-         ", fast_rexmits: " + std::to_string(fast_rexmits) +
-         ", rto_rexmits: " + std::to_string(rto_rexmits);
-    return s;
+    return utils::Format(
+        "[CC] snd_nxt: %u, snd_una: %u, rcv_nxt: %u, cwnd: %.3f (fabric: "
+        "%.3f, endpoint: %.3f), rwnd: %u, srtt_us: %.1f, fabric_delay_us: "
+        "%.1f, endpoint_delay_us: %.1f, fast_rexmits: %u, rto_rexmits: %u, "
+        "tlp_probes: %u",
+        snd_nxt, snd_una, rcv_nxt, cwnd, fabric_cwnd, endpoint_cwnd, rwnd,
+        srtt_ns / 1E3, fabric_delay_ns / 1E3, endpoint_delay_ns / 1E3,
+        fast_rexmits, rto_rexmits, tlp_probes);
   }
 
   uint32_t ackno() const { return rcv_nxt; }
-  bool max_rexmits_reached() const { return rto_rexmits >= kRexmitThreshold; }
-  bool rto_disabled() const { return rto_timer == kRtoDisabled; }
-  bool rto_expired() const { return rto_timer >= kRtoThresholdInTicks; }
+  bool max_rexmits_reached() const { return rto_rexmits >= kMaxRtoRexmits; }
 
   uint32_t get_rcv_nxt() const { return rcv_nxt; }
   void advance_rcv_nxt() { rcv_nxt++; }
-  void rto_enable() { rto_timer = 0; }
-  void rto_disable() { rto_timer = kRtoDisabled; }
-  void rto_reset() { rto_enable(); }
-  void rto_maybe_reset() {
-    if (snd_una == snd_nxt)
-      rto_disable();
-    else
-      rto_reset();
+
+  /**
+   * @brief Retransmission timeout: `srtt + 4 * rttvar' (RFC 6298), bounded,
+   * and backed off exponentially for consecutive RTO retransmissions.
+   */
+  uint64_t rto_ns() const {
+    const uint64_t rto =
+        srtt_ns == 0 ? kInitialRtoNs
+                     : std::clamp(srtt_ns + 4 * rttvar_ns, kMinRtoNs, kMaxRtoNs);
+    const auto backoff = std::min<uint32_t>(rto_rexmits, 16);
+    return std::min(rto << backoff, kMaxRtoNs);
+  }
+
+  /**
+   * @brief RACK reordering window (RFC 8985): how much earlier than the most
+   * recently sent packet known to be delivered a packet must have been sent to
+   * be deemed lost, rather than reordered. A quarter of the minimum RTT.
+   */
+  uint64_t reorder_window_ns() const {
+    return (min_rtt_ns == 0 ? kInitialRttNs : min_rtt_ns) / 4;
+  }
+
+  /**
+   * @brief Probe timeout of tail loss probes: two RTTs without an ACK while
+   * data is in flight. There is no delayed ACK timer to allow for, as
+   * receivers ACK by the end of each RX burst at the latest.
+   */
+  uint64_t pto_ns() const {
+    const auto rtt_ns = srtt_ns == 0 ? kInitialRttNs : srtt_ns;
+    return std::min(std::max(2 * rtt_ns, kMinPtoNs), rto_ns());
+  }
+
+  /**
+   * @brief Fabric target delay for the current window (base target plus
+   * flow-based scaling).
+   */
+  uint64_t fabric_target_delay_ns() const {
+    // alpha / sqrt(cwnd) + beta, with alpha and beta picked so that the
+    // scaling ranges from 0 at `kFsMaxCwnd' to `kFsRangeNs' at `kFsMinCwnd'.
+    static const double kFsAlpha =
+        kFsRangeNs / (1.0 / std::sqrt(kFsMinCwnd) - 1.0 / std::sqrt(kFsMaxCwnd));
+    static const double kFsBeta = -kFsAlpha / std::sqrt(kFsMaxCwnd);
+    const double scaling = std::clamp(kFsAlpha / std::sqrt(cwnd) + kFsBeta,
+                                      0.0, static_cast<double>(kFsRangeNs));
+    return kFabricBaseTargetDelayNs + static_cast<uint64_t>(scaling);
+  }
+
+  /**
+   * @brief Update the RTT estimate and the congestion window on the receipt of
+   * an ACK for new data.
+   *
+   * @param now_ns            Current time.
+   * @param num_acked         Number of newly acknowledged packets.
+   * @param rtt_ns            RTT sample (0 if no sample is available).
+   * @param remote_delay_ns   Endpoint delay reported by the receiver for the
+   *                          sampled packet.
+   */
+  void OnAck(uint64_t now_ns, uint32_t num_acked, uint64_t rtt_ns,
+             uint64_t remote_delay_ns) {
+    if (rtt_ns != 0) {
+      if (min_rtt_ns == 0 || rtt_ns < min_rtt_ns) min_rtt_ns = rtt_ns;
+      if (srtt_ns == 0) {
+        srtt_ns = rtt_ns;
+        rttvar_ns = rtt_ns / 2;
+      } else {
+        const auto deviation = srtt_ns > rtt_ns ? srtt_ns - rtt_ns
+                                                : rtt_ns - srtt_ns;
+        rttvar_ns = static_cast<uint64_t>((1 - kRttvarGain) * rttvar_ns +
+                                          kRttvarGain * deviation);
+        srtt_ns = static_cast<uint64_t>((1 - kSrttGain) * srtt_ns +
+                                        kSrttGain * rtt_ns);
+      }
+      endpoint_delay_ns = std::min(remote_delay_ns, rtt_ns);
+      fabric_delay_ns = rtt_ns - endpoint_delay_ns;
+    }
+    if (srtt_ns == 0 || num_acked == 0) return;
+
+    const bool can_decrease = this->can_decrease(now_ns);
+    const bool fabric_decreased =
+        UpdateWindow(&fabric_cwnd, fabric_delay_ns, fabric_target_delay_ns(),
+                     num_acked, can_decrease);
+    const bool endpoint_decreased =
+        UpdateWindow(&endpoint_cwnd, endpoint_delay_ns, kEndpointTargetDelayNs,
+                     num_acked, can_decrease);
+    if (fabric_decreased || endpoint_decreased) t_last_decrease_ns = now_ns;
+    UpdateCwnd();
+  }
+
+  /**
+   * @brief Reduce the window on a fast retransmission, i.e., losses detected
+   * before the RTO (at most once per RTT).
+   */
+  void OnFastRetransmit(uint64_t now_ns) { DecreaseOnLoss(now_ns); }
+
+  /**
+   * @brief Reduce the window on a retransmission timeout (at most once per
+   * RTT).
+   */
+  void OnRto(uint64_t now_ns) { DecreaseOnLoss(now_ns); }
+
+  /**
+   * @return Whether transmissions need to be paced (fractional window).
+   */
+  bool pacing_enabled() const { return cwnd < 1.0; }
+
+  /**
+   * @return The inter-packet gap when pacing is enabled (i.e., `srtt / cwnd').
+   */
+  uint64_t pacing_delay_ns() const {
+    const auto rtt_ns = srtt_ns == 0 ? kInitialRttNs : srtt_ns;
+    return static_cast<uint64_t>(rtt_ns / cwnd);
   }
-  void rto_advance() { rto_timer++; }
 
-  uint32_t target_delay{0};
   uint32_t snd_nxt{0};
   uint32_t snd_una{0};
   uint32_t snd_ooo_acks{0};
   uint32_t rcv_nxt{0};
-  uint64_t sack_bitmap{0};
-  uint8_t sack_bitmap_count{0};
-  uint16_t cwnd{kInitialCwnd};
-  uint16_t duplicate_acks{0};
-  int rto_timer{kRtoDisabled};
+  // Number of out-of-order packets buffered by the receiver.
+  uint16_t sack_bitmap_count{0};
+  // Receive window advertised by the remote end: the number of packets from
+  // `snd_una' on that it has room for.
+  uint32_t rwnd{kReassemblyWindow};
+  // RACK loss detection state: the transmit time of the most recently sent
+  // packet known to be delivered (echoed back by the receiver), and one past
+  // the highest sequence number retransmitted; the packets from it on were
+  // sent once, in sequence order.
+  uint64_t rack_xmit_ns{0};
+  uint32_t rexmit_end{0};
   uint16_t fast_rexmits{0};
   uint16_t rto_rexmits{0};
+  uint16_t tlp_probes{0};
+  // Congestion window (in packets); the minimum of the fabric and endpoint
+  // windows.
+  double cwnd{kInitialCwnd};
+  double fabric_cwnd{kInitialCwnd};
+  double endpoint_cwnd{kInitialCwnd};
+  // Smoothed RTT and RTT variation, and the latest fabric/endpoint delay
+  // samples.
+  uint64_t srtt_ns{0};
+  uint64_t rttvar_ns{0};
+  uint64_t fabric_delay_ns{0};
+  uint64_t endpoint_delay_ns{0};
+  // Minimum RTT sample so far.
+  uint64_t min_rtt_ns{0};
+  // Time of the last window decrease.
+  uint64_t t_last_decrease_ns{0};
+  // Earliest time the next packet may be sent, when pacing.
+  uint64_t next_tx_ns{0};
+  // Timestamp of the last data packet received, and the local time it was
+  // received at; echoed back to the sender in ACKs for RTT sampling.
+  uint64_t ts_echo{0};
+  uint64_t ts_echo_rx_ns{0};
+  // Path that packet was received on (see `MachnetPktHdr::echo_path').
+  uint8_t ts_echo_path{0};
+
+ private:
+  // Windows are decreased at most once per RTT.
+  bool can_decrease(uint64_t now_ns) const {
+    const auto rtt_ns = srtt_ns == 0 ? kInitialRttNs : srtt_ns;
+    return now_ns - t_last_decrease_ns >= rtt_ns;
+  }
+
+  static bool UpdateWindow(double *wnd, uint64_t delay_ns,
+                           uint64_t target_delay_ns, uint32_t num_acked,
+                           bool can_decrease) {
+    if (delay_ns < target_delay_ns) {
+      // Additive increase: `kAdditiveIncrement' packets per RTT, or per ACK
+      // when the window is below one packet.
+      if (*wnd >= 1.0) {
+        *wnd += kAdditiveIncrement / *wnd * num_acked;
+      } else {
+        *wnd += kAdditiveIncrement * num_acked;
+      }
+      return false;
+    }
+    if (!can_decrease) return false;
+
+    // Multiplicative decrease, proportional to the excess delay.
+    const double excess = static_cast<double>(delay_ns - target_delay_ns);
+    *wnd *= std::max(1.0 - kBeta * excess / delay_ns, 1.0 - kMaxMdf);
+    return true;
+  }
+
+  void DecreaseOnLoss(uint64_t now_ns) {
+    if (!can_decrease(now_ns)) return;
+    fabric_cwnd *= 1.0 - kMaxMdf;
+    endpoint_cwnd *= 1.0 - kMaxMdf;
+    t_last_decrease_ns = now_ns;
+    UpdateCwnd();
+  }
+
+  void UpdateCwnd() {
+    fabric_cwnd = std::clamp(fabric_cwnd, kMinCwnd, kMaxCwnd);
+    endpoint_cwnd = std::clamp(endpoint_cwnd, kMinCwnd, kMaxCwnd);
+    cwnd = std::min(fabric_cwnd, endpoint_cwnd);
+  }
 };
 
 }  // namespace swift
@@ -8,13 +8,25 @@
 
 #include <channel_msgbuf.h>
 #include <common.h>
+#include <engine_stats.h>
 #include <flow_key.h>
 #include <glog/logging.h>
 #include <machnet_common.h>
+#include <linux/mempolicy.h>
 #include <machnet_private.h>
+#include <packet.h>
+#include <packet_pool.h>
 #include <rte_eal.h>
 #include <rte_mbuf_core.h>
-
+#include <slab_pool.h>
+#include <sys/syscall.h>
+#include <tx_scheduler.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <iterator>
 #include <list>
 #include <memory>
@@ -23,6 +35,7 @@
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 namespace juggler {
 class MachnetEngine;  // forward declaration
@@ -39,6 +52,140 @@ class Flow;  // forward declaration
 namespace juggler {
 namespace shm {
 
+/**
+ * @brief Class `ChannelArena' is a large region of memory (of huge pages, if
+ * there are enough of them) that channels are sub-allocated from, in
+ * fixed-size slots (see `ChannelManager::CreateArena()'), instead of each
+ * being a shared memory object of its own. The arena is registered for DMA
+ * once, so channels come and go without registering memory with the NIC.
+ *
+ * Each slot is a memfd of its own, mapped at its place in the (contiguous)
+ * region: an application gets the file descriptor of its channel's slot only,
+ * sealed so that it cannot be resized, and can map no other memory of the
+ * arena.
+ *
+ * An application may keep its mapping after it detaches, so the slot of a
+ * channel that belonged to one (see `SetSlotOwner()') is not taken again
+ * until the application is gone (see `ReleaseOwner()'). Slots are zeroed
+ * before they are taken again.
+ *
+ * This class is non-copyable. Taking and giving back slots is thread-safe.
+ */
+class ChannelArena {
+ public:
+  ChannelArena() = delete;
+  ChannelArena(const ChannelArena &) = delete;
+  /**
+   * @brief `ChannelArena' Constructor; it takes over the memory region and
+   * the file descriptors of its slots (see `Create()').
+   * @param name         The name of the arena.
+   * @param mem          The mapped memory region.
+   * @param slot_size    The size of the slots (page aligned).
+   * @param slot_fds     The file descriptors of the slots, in order.
+   * @param is_posix_shm Whether it is backed by regular pages, or by huge
+   * pages.
+   */
+  ChannelArena(const std::string &name, uchar_t *mem, size_t slot_size,
+               std::vector<int> slot_fds, bool is_posix_shm);
+  ~ChannelArena();
+  ChannelArena &operator=(const ChannelArena &) = delete;
+
+  /**
+   * @brief Create an arena of slots of a given size.
+   * @param name         The name of the arena (of the memfds of its slots).
+   * @param slots_nr     The number of slots.
+   * @param slot_size    Their size (a multiple of the page size).
+   * @param is_posix_shm Whether to back the arena by regular pages, or by
+   * huge pages.
+   * @return The arena, or nullptr on failure.
+   */
+  static std::shared_ptr<ChannelArena> Create(const std::string &name,
+                                              size_t slots_nr,
+                                              size_t slot_size,
+                                              bool is_posix_shm);
+
+  const std::string &GetName() const { return name_; }
+  bool IsPosixShm() const { return is_posix_shm_; }
+  size_t GetSlotSize() const { return slot_size_; }
+  size_t GetSlotCount() const { return slot_fds_.size(); }
+  size_t GetFreeSlotCount() const {
+    const std::lock_guard<std::mutex> lock(mtx_);
+    return free_slots_.size();
+  }
+
+  // The file descriptor of a slot, to hand to the application of its
+  // channel.
+  int GetSlotFd(const void *slot) const { return slot_fds_[SlotIndex(slot)]; }
+
+  /**
+   * @brief Take a free slot.
+   * @return Its address, or nullptr if the arena is full.
+   */
+  uchar_t *AllocSlot();
+
+  // Give back a slot taken with `AllocSlot()'.
+  void FreeSlot(const void *slot);
+
+  // Record the application that the channel of a slot is handed to.
+  void SetSlotOwner(const void *slot, const std::string &owner) {
+    const std::lock_guard<std::mutex> lock(mtx_);
+    slots_[SlotIndex(slot)].owner = owner;
+  }
+
+  // Let the slots of an application that is gone be taken again.
+  void ReleaseOwner(const std::string &owner);
+
+  /**
+   * @brief Register the memory of the arena for DMA with a device. It is done
+   * once, for all the channels of the arena: later calls with the same device
+   * are no-ops.
+   * @return True on success, false otherwise (e.g., another device).
+   */
+  bool RegisterMemForDMA(rte_device *dev);
+
+  // Whether the arena is registered for DMA.
+  bool IsRegisteredForDMA() const { return attached_dev_ != nullptr; }
+
+  // The IOVA of an address of the arena, which must be registered for DMA.
+  uint64_t GetIova(const void *addr) const {
+    DCHECK(IsRegisteredForDMA());
+    const size_t ofs = static_cast<const uchar_t *>(addr) - mem_;
+    return pages_iova_[ofs / page_size()] + ofs % page_size();
+  }
+
+ private:
+  struct Slot {
+    // The application the slot's channel was handed to, if any.
+    std::string owner{};
+    // Given back while its application may still map it.
+    bool retired{false};
+    // Given back, to be zeroed before it is taken again.
+    bool dirty{false};
+  };
+
+  size_t page_size() const {
+    return is_posix_shm_ ? kPageSize : kHugePage2MSize;
+  }
+  size_t mem_size() const { return slot_size_ * slot_fds_.size(); }
+  size_t SlotIndex(const void *slot) const {
+    const size_t ofs = static_cast<const uchar_t *>(slot) - mem_;
+    DCHECK_EQ(ofs % slot_size_, 0);
+    return ofs / slot_size_;
+  }
+
+  const std::string name_;
+  uchar_t *const mem_;
+  const size_t slot_size_;
+  std::vector<int> slot_fds_;
+  const bool is_posix_shm_;
+  mutable std::mutex mtx_;
+  std::vector<Slot> slots_;
+  // Indices of the free slots, the lowest ones on top.
+  std::vector<uint32_t> free_slots_;
+  rte_device *attached_dev_{nullptr};
+  std::vector<uint64_t> pages_iova_{};
+};
+
 /**
  * @brief Class `ShmChannel' abstracts Machnet shared memory channels.
  * It provides useful methods to allocate, enqueue and dequeue messages to
@@ -62,11 +209,14 @@ class ShmChannel {
    * @param is_posix_shm  Whether the channel is backed by a POSIX shared memory
    * or anonymous huge pages.
    * @param channel_fd    The file descriptor of the channel.
+   * @param arena         The arena of the channel, if it was sub-allocated
+   * from one (`channel_ctx' is then a slot of the arena, and `channel_fd' the
+   * slot's, which the arena owns).
    */
   ShmChannel(const std::string channel_name,
              const MachnetChannelCtx_t *channel_ctx,
              const size_t channel_mem_size, const bool is_posix_shm,
-             int channel_fd);
+             int channel_fd, std::shared_ptr<ChannelArena> arena = nullptr);
   ~ShmChannel();
   ShmChannel &operator=(const ShmChannel &) = delete;
 
@@ -78,6 +228,9 @@ class ShmChannel {
   // Get the channel's file descriptor.
   int GetFd() const { return channel_fd_; }
 
+  // The arena the channel was sub-allocated from, if any.
+  ChannelArena *GetArena() const { return arena_.get(); }
+
   // Get the name of this channel.
   std::string GetName() const { return name_; }
 
@@ -98,6 +251,57 @@ class ShmChannel {
   // Size of the channel in bytes.
   uint64_t GetSize() const { return ctx_->size; }
 
+  /**
+   * @return The number of messages the engine has exchanged with the
+   * application so far (in both directions), e.g., to estimate the load of
+   * the channel. Updated by the engine only; it can be read from any thread.
+   */
+  uint64_t GetMessageCount() const {
+    return GetRxMessageCount() + GetTxMessageCount();
+  }
+  // Messages delivered to the application so far.
+  uint64_t GetRxMessageCount() const {
+    return rx_msg_count_.load(std::memory_order_relaxed);
+  }
+  // Messages received from the application so far.
+  uint64_t GetTxMessageCount() const {
+    return tx_msg_count_.load(std::memory_order_relaxed);
+  }
+  // Batches of messages received from the application so far, of the sizes of
+  // a bucket (see `stats::BatchBucket()').
+  uint64_t GetTxBatchCount(size_t bucket) const {
+    return tx_batch_counts_[bucket].load(std::memory_order_relaxed);
+  }
+
+  // Packets and messages dropped so far as the channel was out of buffers.
+  uint64_t GetBufferDropCount() const {
+    return buf_drops_.load(std::memory_order_relaxed);
+  }
+  void CountBufferDrop() {
+    buf_drops_.store(buf_drops_.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Post the cookies of messages delivered to their receivers to the
+   * completion ring of the channel (see `MACHNET_MSGBUF_NOTIFY_DELIVERY'). The
+   * application does not hold the engine back: the cookies that do not fit
+   * are dropped, and counted.
+   */
+  void PostCompletions(const uint32_t *cookies, uint32_t n) {
+    const uint32_t ret =
+        __machnet_channel_completion_ring_enqueue(ctx_, n, cookies);
+    if (ret != n) [[unlikely]] {  // NOLINT
+      completion_drops_.store(
+          completion_drops_.load(std::memory_order_relaxed) + n - ret,
+          std::memory_order_relaxed);
+    }  // NOLINT
+  }
+  // Delivery completions dropped so far as the completion ring was full.
+  uint64_t GetCompletionDropCount() const {
+    return completion_drops_.load(std::memory_order_relaxed);
+  }
+
   // Total size of each channel's buffer in bytes.
   uint32_t GetTotalBufSize() const { return ctx_->data_ctx.buf_size; }
 
@@ -106,14 +310,32 @@ class ShmChannel {
   // payload. There is still headroom for possible packet headers.
   uint32_t GetUsableBufSize() const { return ctx_->data_ctx.buf_mss; }
 
-  // Total amount of buffers in the channel.
+  // Total amount of (standard) buffers in the channel.
   uint32_t GetTotalBufCount() const {
     return __machnet_channel_buf_ring(ctx_)->capacity;
   }
 
-  // Get the number of buffers that are currently available (i.e., not in use).
+  // Get the number of (standard) buffers that are currently available (i.e.,
+  // not in use).
   uint32_t GetFreeBufCount() const {
-    return cached_buf_count + __machnet_channel_buffers_avail(ctx_);
+    return buf_caches_[MACHNET_MSGBUF_CLASS_STD].count +
+           __machnet_channel_buffers_avail(ctx_);
+  }
+
+  // Total amount of small buffers in the channel; their indices follow those
+  // of the standard buffers (see `MACHNET_MSGBUF_CLASS_SMALL').
+  uint32_t GetSmallBufCount() const { return ctx_->data_ctx.small_buf_nr; }
+
+  // Get the number of small buffers that are currently available.
+  uint32_t GetFreeSmallBufCount() const {
+    return buf_caches_[MACHNET_MSGBUF_CLASS_SMALL].count +
+           __machnet_channel_buf_class_avail(ctx_, MACHNET_MSGBUF_CLASS_SMALL);
+  }
+
+  // The space in small buffers that can be used to store the payload (0 if the
+  // channel has no small buffers).
+  uint32_t GetUsableSmallBufSize() const {
+    return ctx_->data_ctx.small_buf_mss;
   }
 
   /**
@@ -127,6 +349,15 @@ class ShmChannel {
     return reinterpret_cast<MsgBuf *>(__machnet_channel_buf(ctx_, index));
   }
 
+  /**
+   * @brief Returns the buffer holding the payload of a message buffer: the
+   * buffer itself, or the shared buffer it refers to (see `MsgBuf::is_ref()'
+   * and `machnet_sendmsg_fanout()').
+   */
+  MsgBuf *GetPayloadMsgBuf(MsgBuf *msg_buf) {
+    return msg_buf->is_ref() ? GetMsgBuf(msg_buf->ref()) : msg_buf;
+  }
+
   /**
    * @brief Given the pointer to a `MsgBuf' object, returns the index of the
    * buffer on the channel.
@@ -148,7 +379,19 @@ class ShmChannel {
    */
   uint32_t DequeueCtrlRequests(MachnetCtrlQueueEntry_t *ctrl_entries,
                                uint32_t nb_entries) {
-    return __machnet_channel_ctrl_sq_dequeue(ctx_, nb_entries, ctrl_entries);
+    const auto ret =
+        __machnet_channel_ctrl_sq_dequeue(ctx_, nb_entries, ctrl_entries);
+    ctrl_requests_dequeued_ += ret;
+    return ret;
+  }
+
+  /**
+   * @brief Whether the application rang the doorbell of the control queue for
+   * requests that are not dequeued yet. Costs a single load, from a cache line
+   * that the application only writes when it submits requests.
+   */
+  bool HasCtrlRequests() const {
+    return __machnet_channel_ctrl_sq_doorbell(ctx_) != ctrl_requests_dequeued_;
   }
 
   /**
@@ -174,8 +417,11 @@ class ShmChannel {
    */
   uint32_t EnqueueMessages(MachnetRingSlot_t *msgbuf_indices,
                            uint32_t nb_msgs) {
-    return __machnet_channel_machnet_ring_enqueue(ctx_, nb_msgs,
-                                                  msgbuf_indices);
+    const auto ret =
+        __machnet_channel_machnet_ring_enqueue(ctx_, nb_msgs, msgbuf_indices);
+    if (ret != 0) NotifyApp();
+    CountMessages(&rx_msg_count_, ret);
+    return ret;
   }
 
   /**
@@ -211,9 +457,126 @@ class ShmChannel {
     return EnqueueMessages(batch->buf_indices(), batch->GetSize());
   }
 
+  /**
+   * @brief Set the eventfd of the application for receive notifications (see
+   * `machnet_wait()'). The channel takes ownership of the file descriptor.
+   * @return True on success, false if the channel already has one.
+   */
+  bool SetNotifyFd(int fd) {
+    int expected = -1;
+    return notify_fd_.compare_exchange_strong(expected, fd);
+  }
+
+  /**
+   * @brief Signal the application that messages were delivered to the channel,
+   * if it is blocked waiting for them. While the application is polling (i.e.,
+   * notifications are not armed), this costs a fence and a load of a cache
+   * line that is rarely written.
+   */
+  void NotifyApp() {
+    const int fd = notify_fd_.load(std::memory_order_relaxed);
+    if (fd < 0) return;
+    // Order the ring update before reading the flag; the application arms the
+    // flag before it checks the ring for the last time.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto *armed = &ctx()->notify_ctx.armed;
+    if (__atomic_load_n(armed, __ATOMIC_RELAXED) == 0) return;
+    if (__atomic_exchange_n(armed, 0, __ATOMIC_ACQ_REL) == 0) return;
+    const uint64_t one = 1;
+    LOG_IF(ERROR, write(fd, &one, sizeof(one)) != sizeof(one))
+        << "Failed to notify the application of channel " << GetName();
+  }
+
+  /**
+   * @brief Scrub the channel for another application, as if it had just been
+   * created with the same shape (e.g., to keep it in a pool of warm channels):
+   * its rings, buffers and counters are initialized again, in place, and its
+   * notifications are torn down. Neither the application it served nor an
+   * engine may be using the channel.
+   *
+   * @return True on success; the channel must be destroyed otherwise.
+   */
+  bool Reset(size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
+             size_t buf_ring_slot_nr, size_t buffer_size, int ring_type);
+
+  /**
+   * @brief Record the engine the channel is placed on, for the application to
+   * read (see `machnet_get_placement()'). Must be called before the channel
+   * is handed to the application.
+   */
+  void SetPlacement(const MachnetChannelPlacement_t &placement) {
+    ctx()->placement = placement;
+  }
+
+  /**
+   * @brief Have the application stamp the messages it sends, and account the
+   * dequeue delays of the traced messages it receives, or stop it (see
+   * `MachnetChannelTraceCtx').
+   */
+  void SetTracing(bool enabled) {
+    __atomic_store_n(&ctx()->trace_ctx.enabled, enabled ? 1 : 0,
+                     __ATOMIC_RELAXED);
+  }
+
+  /**
+   * @brief Take the number of traced messages the application dequeued in
+   * [2^bucket, 2^(bucket+1)) TSC cycles after their delivery, since the last
+   * call (see `MachnetChannelTraceCtx').
+   */
+  uint64_t TakeTraceDequeueCount(size_t bucket) {
+    DCHECK_LT(bucket, MACHNET_TRACE_BUCKETS);
+    auto *count = &ctx()->trace_ctx.app_dequeue_cycles[bucket];
+    if (__atomic_load_n(count, __ATOMIC_RELAXED) == 0) return 0;
+    return __atomic_exchange_n(count, 0, __ATOMIC_RELAXED);
+  }
+
+  /**
+   * @brief Update the engine-side stats of the channel, for the application to
+   * read (see `MachnetChannelStats'): `fill' is given the stats of the channel
+   * and the array of `MACHNET_FLOW_STATS_MAX' flow records to fill in. Never
+   * waits for the application.
+   */
+  template <typename F>
+  void UpdateEngineStats(F &&fill) {
+    auto *stats = __machnet_channel_stats(ctx());
+    std::atomic_ref<uint64_t> seq(stats->e_seq);
+    const auto s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    fill(&stats->e_stats, stats->e_flows);
+    seq.store(s + 2, std::memory_order_release);
+  }
+
+  /**
+   * @return Number of free slots in the ring of messages destined to the
+   * application, i.e., how many more messages can be delivered right now.
+   */
+  uint32_t GetFreeMachnetRingSlots() const {
+    return __machnet_channel_machnet_ring_free(ctx_);
+  }
+
+  /**
+   * @return Whether the application has enqueued messages to the channel
+   * (destined to the Machnet stack). Only reads the indices of the ring.
+   */
+  bool HasPendingMessages() const {
+    return __machnet_channel_app_ring_pending(ctx_) != 0;
+  }
+
+  /**
+   * @return The TX scheduling weight of the channel, as set by the application
+   * (see `machnet_set_tx_weight()').
+   */
+  uint32_t tx_weight() const {
+    return __atomic_load_n(&ctx_->tx_weight, __ATOMIC_RELAXED);
+  }
+
   /**
    * @brief Dequeues a number of messages from the channel (destined to the
-   * Machnet stack).
+   * Machnet stack). Inline messages (see `MachnetInlineMsg') are copied into
+   * buffers allocated from the channel. The rings of the priority classes are
+   * served in strict priority order: normal priority messages are dequeued
+   * only while no high priority one is pending (see `MACHNET_PRIO_HIGH').
    *
    * @param msg_indices        A pointer to the array of `MachnetRingSlot_t'
    *                           objects (indices of buffers).
@@ -223,13 +586,55 @@ class ShmChannel {
    */
   uint32_t DequeueMessages(MachnetRingSlot_t *msg_indices, MsgBuf **msgs,
                            uint32_t nb_msgs) {
-    uint32_t ret =
-        __machnet_channel_app_ring_dequeue(ctx_, nb_msgs, msg_indices);
-    for (uint32_t i = 0; i < ret; i++) {
-      msgs[i] = reinterpret_cast<MsgBuf *>(
-          __machnet_channel_buf(ctx_, msg_indices[i]));
+    // Room for a burst, and the rest of an inline message at its end.
+    MachnetRingSlot_t slots[MsgBufBatch::kMaxBurst +
+                            MACHNET_MSG_INLINE_SLOTS_MAX];
+    uint32_t ret = 0;
+    while (ret < nb_msgs) {
+      // Each message takes at least one slot.
+      const uint32_t burst = std::min(nb_msgs - ret, MsgBufBatch::kMaxBurst);
+      uint32_t prio = MACHNET_PRIO_HIGH;
+      uint32_t nb_slots =
+          __machnet_channel_app_ring_dequeue_prio(ctx_, prio, burst, slots);
+      if (nb_slots == 0) {
+        prio = MACHNET_PRIO_NORMAL;
+        nb_slots =
+            __machnet_channel_app_ring_dequeue_prio(ctx_, prio, burst, slots);
+      }
+      if (nb_slots == 0) break;
+
+      for (uint32_t i = 0; i < nb_slots;) {
+        if (!__machnet_ring_slot_is_inline(slots[i])) [[likely]] {
+          msg_indices[ret] = slots[i++];
+          msgs[ret] = GetMsgBuf(msg_indices[ret]);
+          ret++;
+          continue;
+        }
+
+        // The slots of an inline message are enqueued (and become visible)
+        // at once, so the rest of a message cut by the burst is there.
+        const uint32_t msg_slots =
+            __machnet_inline_msg_slots_nr(__machnet_inline_msg_len(slots[i]));
+        if (i + msg_slots > nb_slots) {
+          const uint32_t rest = i + msg_slots - nb_slots;
+          CHECK_EQ(__machnet_channel_app_ring_dequeue_prio(ctx_, prio, rest,
+                                                           &slots[nb_slots]),
+                   rest);
+          nb_slots += rest;
+        }
+        auto *msg = InlineMsgToMsgBuf(
+            reinterpret_cast<const MachnetInlineMsg_t *>(&slots[i]));
+        i += msg_slots;
+        if (msg == nullptr) continue;
+        msg_indices[ret] = msg->index();
+        msgs[ret++] = msg;
+      }
     }
 
+    CountMessages(&tx_msg_count_, ret);
+    if (ret != 0) {
+      CountMessages(&tx_batch_counts_[stats::BatchBucket(ret)], 1);
+    }
     return ret;
   }
 
@@ -251,20 +656,19 @@ class ShmChannel {
   }
 
   /**
-   * @brief Allocates a single message buffer from the channel.
+   * @brief Allocates a single message buffer from the channel, large enough to
+   * hold `len' bytes of payload: a small buffer if it fits in one (and there
+   * is one available), a standard buffer otherwise.
    *
+   * @param len     The payload length (a standard buffer by default).
    * @return - pointer to the buffer on success, nullptr otherwise.
    */
-  MsgBuf *MsgBufAlloc() {
-    if (cached_buf_count == 0) {
-      uint32_t ret = __machnet_channel_buf_alloc_bulk(
-          ctx_, NUM_CACHED_BUFS, cached_buf_indices.data(), cached_bufs.data());
-      if (ret != NUM_CACHED_BUFS) return nullptr;
-      cached_buf_count += NUM_CACHED_BUFS;
+  MsgBuf *MsgBufAlloc(uint32_t len = UINT32_MAX) {
+    if (len <= GetUsableSmallBufSize()) {
+      auto *buf = MsgBufClassAlloc(MACHNET_MSGBUF_CLASS_SMALL);
+      if (buf != nullptr) return buf;
     }
-    MachnetMsgBuf_t *buf = cached_bufs[--cached_buf_count];
-    __machnet_channel_buf_init(buf);
-    return reinterpret_cast<MsgBuf *>(buf);
+    return MsgBufClassAlloc(MACHNET_MSGBUF_CLASS_STD);
   }
 
   /**
@@ -278,11 +682,12 @@ class ShmChannel {
     MachnetRingSlot_t index[1] = {__machnet_channel_buf_index(
         ctx_, reinterpret_cast<const MachnetMsgBuf_t *>(buf))};
     MachnetMsgBuf_t *msg_buf = __machnet_channel_buf(ctx_, index[0]);
+    auto &cache = buf_caches_[__machnet_channel_buf_class(ctx_, index[0])];
 
-    if (cached_buf_count < NUM_CACHED_BUFS) {
-      cached_buf_indices[cached_buf_count] = index[0];
-      cached_bufs[cached_buf_count] = msg_buf;
-      cached_buf_count++;
+    if (cache.count < NUM_CACHED_BUFS) {
+      cache.indices[cache.count] = index[0];
+      cache.bufs[cache.count] = msg_buf;
+      cache.count++;
       return true;
     }
 
@@ -339,17 +744,18 @@ class ShmChannel {
   bool MsgBufBulkFree(MachnetRingSlot_t *indices, uint32_t cnt) {
     int retries = 5;
     uint32_t freed;
-    const uint32_t cache_free_slots = NUM_CACHED_BUFS - cached_buf_count;
-    const uint32_t to_cache =
-        (cnt <= cache_free_slots) ? cnt : cache_free_slots;
-
-    for (freed = 0; freed < to_cache; freed++) {
-      cached_buf_indices[cached_buf_count] = indices[freed];
-      MachnetMsgBuf_t *msg_buf = __machnet_channel_buf(ctx_, indices[freed]);
-      cached_bufs[cached_buf_count] = msg_buf;
-      cached_buf_count++;
+
+    // Cache the buffers while there is room in the caches of their classes;
+    // the rest go to the global pools.
+    for (freed = 0; freed < cnt; freed++) {
+      const uint32_t cls = __machnet_channel_buf_class(ctx_, indices[freed]);
+      auto &cache = buf_caches_[cls];
+      if (cache.count == NUM_CACHED_BUFS) break;
+      cache.indices[cache.count] = indices[freed];
+      cache.bufs[cache.count] = __machnet_channel_buf(ctx_, indices[freed]);
+      cache.count++;
     }
-    if (cnt > cache_free_slots) {
+    if (freed < cnt) {
       do {
         freed +=
             __machnet_channel_buf_free_bulk(ctx_, cnt - freed, indices + freed);
@@ -361,11 +767,20 @@ class ShmChannel {
     return true;
   }
 
-  uint32_t GetAllCachedBufferIndices(std::vector<MachnetRingSlot_t> *indices) {
-    indices->insert(indices->end(), cached_buf_indices.begin(),
-                    cached_buf_indices.begin() + cached_buf_count);
-    uint32_t ret = cached_buf_count;
-    cached_buf_count = 0;
+  /**
+   * @brief Takes all the buffers of a size class cached by the channel.
+   *
+   * @param indices     Vector to append the indices of the buffers to.
+   * @param cls         The size class (`MACHNET_MSGBUF_CLASS_*').
+   * @return            The number of buffers taken.
+   */
+  uint32_t GetAllCachedBufferIndices(std::vector<MachnetRingSlot_t> *indices,
+                                     uint32_t cls = MACHNET_MSGBUF_CLASS_STD) {
+    auto &cache = buf_caches_[cls];
+    indices->insert(indices->end(), cache.indices.begin(),
+                    cache.indices.begin() + cache.count);
+    uint32_t ret = cache.count;
+    cache.count = 0;
     return ret;
   }
 
@@ -375,9 +790,72 @@ class ShmChannel {
   const size_t mem_size_;
   const bool is_posix_shm_;
   int channel_fd_;
-  std::array<MachnetRingSlot_t, NUM_CACHED_BUFS> cached_buf_indices;
-  std::array<MachnetMsgBuf_t *, NUM_CACHED_BUFS> cached_bufs;
-  uint32_t cached_buf_count;
+  const std::shared_ptr<ChannelArena> arena_;
+  // The application's eventfd for receive notifications (-1 if none).
+  std::atomic<int> notify_fd_;
+  // Messages exchanged with the application (see `GetMessageCount()').
+  std::atomic<uint64_t> rx_msg_count_{0};
+  std::atomic<uint64_t> tx_msg_count_{0};
+  std::array<std::atomic<uint64_t>, stats::kBatchBuckets> tx_batch_counts_{};
+  std::atomic<uint64_t> buf_drops_{0};
+  std::atomic<uint64_t> completion_drops_{0};
+  // Control requests dequeued, to compare with the doorbell of the queue (see
+  // `HasCtrlRequests()').
+  uint32_t ctrl_requests_dequeued_{0};
+  // Cache of free buffers, per size class.
+  struct BufCache {
+    std::array<MachnetRingSlot_t, NUM_CACHED_BUFS> indices;
+    std::array<MachnetMsgBuf_t *, NUM_CACHED_BUFS> bufs;
+    uint32_t count;
+  };
+  std::array<BufCache, MACHNET_MSGBUF_CLASSES_NR> buf_caches_;
+
+  // Single writer (the engine), so no atomic read-modify-write is needed.
+  static void CountMessages(std::atomic<uint64_t> *counter, uint32_t nb_msgs) {
+    counter->store(counter->load(std::memory_order_relaxed) + nb_msgs,
+                   std::memory_order_relaxed);
+  }
+
+  // Allocates a single message buffer of a size class.
+  MsgBuf *MsgBufClassAlloc(uint32_t cls) {
+    auto &cache = buf_caches_[cls];
+    if (cache.count == 0) {
+      // Refill the cache in bulk, or get the last few buffers one by one.
+      cache.count = __machnet_channel_buf_class_alloc_bulk(
+          ctx_, cls, NUM_CACHED_BUFS, cache.indices.data(), cache.bufs.data());
+      if (cache.count == 0) {
+        cache.count = __machnet_channel_buf_class_alloc_bulk(
+            ctx_, cls, 1, cache.indices.data(), cache.bufs.data());
+      }
+      if (cache.count == 0) return nullptr;
+    }
+    MachnetMsgBuf_t *buf = cache.bufs[--cache.count];
+    __machnet_channel_buf_init(buf);
+    return reinterpret_cast<MsgBuf *>(buf);
+  }
+
+  // Copies an inline message into a buffer. Returns nullptr (and drops the
+  // message) if the channel is out of buffers.
+  MsgBuf *InlineMsgToMsgBuf(const MachnetInlineMsg_t *inline_msg) {
+    const uint32_t len = __machnet_inline_msg_len(inline_msg->hdr);
+    auto *msg = MsgBufAlloc(len);
+    if (msg == nullptr) [[unlikely]] {
+      CountBufferDrop();
+      LOG_EVERY_N(WARNING, 1000)
+          << "Channel " << name_ << " is out of buffers; dropping message.";
+      return nullptr;
+    }
+    utils::Copy(msg->append(len), inline_msg->data, len);
+    msg->set_flags(MACHNET_MSGBUF_FLAGS_SYN | MACHNET_MSGBUF_FLAGS_FIN |
+                   __machnet_inline_msg_flags(inline_msg->hdr));
+    msg->set_msg_length(len);
+    msg->set_src_ip(inline_msg->flow.src_ip);
+    msg->set_dst_ip(inline_msg->flow.dst_ip);
+    msg->set_src_port(inline_msg->flow.src_port);
+    msg->set_dst_port(inline_msg->flow.dst_port);
+    msg->set_last(msg->index());
+    return msg;
+  }
 };
 
 /**
@@ -389,6 +867,12 @@ class ShmChannel {
  */
 class Channel : public ShmChannel {
  public:
+  // Active flows of the channel; the flows are held in the list nodes, which
+  // come from the channel's flow pool.
+  using FlowList = std::list<Flow, SlabAllocator<Flow>>;
+  // Number of flows the flow pool grows by at a time.
+  static constexpr size_t kFlowsPerSlab = 64;
+
   Channel() = delete;
   Channel(const Channel &) = delete;
   /**
@@ -401,21 +885,18 @@ class Channel : public ShmChannel {
    * @param is_posix_shm  Whether the channel is backed by a POSIX shared memory
    * or anonymous huge pages.
    * @param channel_fd    The file descriptor of the channel.
+   * @param arena         The arena of the channel, if any.
    */
   Channel(const std::string &name, const MachnetChannelCtx_t *ctx,
           const size_t channel_mem_size, const bool is_posix_shm,
-          int channel_fd);
+          int channel_fd, std::shared_ptr<ChannelArena> arena = nullptr);
   ~Channel();
   Channel &operator=(const Channel &) = delete;
 
   /**
-   * @brief Get a pointer to mbuf shinfo structure for this channel's buffers.
-   * @return A pointer to the mbuf shinfo structure.
-   */
-  rte_mbuf_ext_shared_info *GetMbufExtShinfo() { return &sh_info_; }
-
-  /**
-   * @brief Register `Channel' memory as DPDK external memory.
+   * @brief Register `Channel' memory as DPDK external memory. The channels of
+   * an arena share its registration (see `ChannelArena::RegisterMemForDMA()'),
+   * and only take the IOVAs of their buffers from it.
    * @return True on success, false otherwise.
    */
   bool RegisterMemForDMA(rte_device *dev);
@@ -425,13 +906,169 @@ class Channel : public ShmChannel {
    */
   void UnregisterDMAMem();
 
+  // Whether the channel memory is registered for DMA.
+  bool IsRegisteredForDMA() const { return attached_dev_ != nullptr; }
+
+  /**
+   * @brief Scrub a channel that an engine stopped serving (see
+   * `ShmChannel::Reset()'), so that it can be handed to another application:
+   * its flows, listeners and zero-copy state are dropped as well, but its
+   * memory stays registered for DMA, and its flow pool keeps its capacity.
+   * The engine must not hold the channel any longer, and the NIC must be
+   * done with its buffers (see `GetTxZeroCopyInflight()').
+   *
+   * @return True on success; the channel must be destroyed otherwise.
+   */
+  bool Recycle(size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
+               size_t buf_ring_slot_nr, size_t buffer_size, int ring_type);
+
+  /**
+   * @brief Create a pool of packet buffers carved out of the channel's
+   * buffers, for a NIC to receive packet payloads directly into (zero-copy
+   * RX). The channel's memory must be registered for DMA (see
+   * `RegisterMemForDMA()').
+   *
+   * @param nmbufs Number of buffers in the pool; these are withdrawn from the
+   * channel while the pool exists.
+   * @return A pointer to the pool on success, nullptr otherwise.
+   */
+  dpdk::PacketPool *CreateRxBufferPool(uint32_t nmbufs);
+
+  /**
+   * @brief Destroy the RX buffer pool of the channel (if any), and return its
+   * buffers to the channel. The pool must not be in use by any RX queue.
+   */
+  void DestroyRxBufferPool();
+
+  /**
+   * @return The RX buffer pool of the channel, or nullptr if there is none.
+   */
+  dpdk::PacketPool *GetRxBufferPool() const { return rx_buffer_pool_.get(); }
+
+  /**
+   * @brief Enable zero-copy TX for the channel: message buffers of at least
+   * `threshold' bytes are attached to the packets that carry them, instead of
+   * being copied. The channel's memory must be registered for DMA (see
+   * `RegisterMemForDMA()').
+   *
+   * A buffer sent zero-copy is freed once the peer has acknowledged it *and*
+   * the NIC is done with it (see `TxZeroCopyAttach()' and
+   * `TxZeroCopyDeferFree()').
+   *
+   * @param threshold Minimum payload size (in bytes) to send zero-copy;
+   * smaller payloads are cheaper to copy.
+   * @return True on success, false otherwise.
+   */
+  bool EnableTxZeroCopy(uint32_t threshold);
+
+  /**
+   * @return Whether a message buffer should be sent zero-copy.
+   */
+  bool IsTxZeroCopy(const MsgBuf *msg_buf) const {
+    return !tx_zerocopy_bufs_.empty() &&
+           msg_buf->length() >= tx_zerocopy_threshold_;
+  }
+
+  /**
+   * @brief Get the shared info to attach a message buffer to a packet with,
+   * for zero-copy TX. It is reference counted by the packets the buffer is
+   * attached to, and its free callback runs when the NIC has sent the last
+   * one.
+   */
+  rte_mbuf_ext_shared_info *TxZeroCopyAttach(MsgBuf *msg_buf) {
+    DCHECK_LT(msg_buf->index(), tx_zerocopy_bufs_.size());
+    auto &buf = tx_zerocopy_bufs_[msg_buf->index()];
+    if (rte_mbuf_ext_refcnt_read(&buf.shinfo) == 0) {
+      buf.acked = false;
+      tx_zerocopy_inflight_++;
+      rte_mbuf_ext_refcnt_set(&buf.shinfo, 1);
+    } else {
+      rte_mbuf_ext_refcnt_update(&buf.shinfo, 1);
+    }
+    return &buf.shinfo;
+  }
+
+  /**
+   * @brief Called when a message buffer has been acknowledged by the peer. If
+   * the NIC still holds packets attached to the buffer (see
+   * `TxZeroCopyAttach()'), the buffer is freed when they are sent.
+   *
+   * @return True if freeing the buffer was deferred, false if the caller
+   * should free it.
+   */
+  bool TxZeroCopyDeferFree(MsgBuf *msg_buf) {
+    if (tx_zerocopy_bufs_.empty()) return false;
+    DCHECK_LT(msg_buf->index(), tx_zerocopy_bufs_.size());
+    auto &buf = tx_zerocopy_bufs_[msg_buf->index()];
+    if (rte_mbuf_ext_refcnt_read(&buf.shinfo) == 0) return false;
+    buf.acked = true;
+    return true;
+  }
+
+  /**
+   * @return Number of message buffers still held by the NIC for zero-copy TX.
+   * The channel must not be destroyed before this drops to zero.
+   */
+  uint32_t GetTxZeroCopyInflight() const { return tx_zerocopy_inflight_; }
+
+  /**
+   * @brief Deliver the messages received on the flows of the channel as soon
+   * as they are complete, instead of in order (see
+   * `MACHNET_ATTACH_F_UNORDERED'). Only affects flows created afterwards, so
+   * it must be set before the channel is handed to the engine.
+   */
+  void SetUnorderedDelivery(bool unordered) { unordered_delivery_ = unordered; }
+  bool unordered_delivery() const { return unordered_delivery_; }
+
+  /**
+   * @brief Deliver long messages received on the flows of the channel in
+   * chunks, as their packets arrive in order (see `MACHNET_ATTACH_F_STREAM').
+   * Like `SetUnorderedDelivery()', only affects flows created afterwards.
+   */
+  void SetStreamDelivery(bool stream) { stream_delivery_ = stream; }
+  bool stream_delivery() const { return stream_delivery_; }
+
+  /**
+   * @brief Take ownership of the channel buffer that a packet segment was
+   * received into (see `CreateRxBufferPool()'), and give the segment a free
+   * channel buffer in exchange, so that it can be recycled by the NIC.
+   *
+   * @param seg The packet segment.
+   * @return The `MsgBuf' holding the data of the segment, or nullptr if the
+   * segment is not backed by the RX buffer pool of this channel (or no buffer
+   * is available in exchange); the data should then be copied.
+   */
+  MsgBuf *AdoptRxBuffer(dpdk::Packet *seg) {
+    if (rx_buffer_pool_ == nullptr ||
+        !seg->from_pool(rx_buffer_pool_->GetMemPool()))
+      return nullptr;
+
+    auto *msg_buf = reinterpret_cast<MsgBuf *>(
+        seg->buf_addr<uchar_t *>() - MACHNET_MSGBUF_SPACE_RESERVED);
+    // The NIC places the data at its own headroom; this should match the
+    // headroom of channel buffers.
+    if (seg->head_data<uchar_t *>() != msg_buf->head_data<uchar_t *>())
+      [[unlikely]] {  // NOLINT
+      return nullptr;
+    }
+
+    auto *replacement = MsgBufAlloc();
+    if (replacement == nullptr) [[unlikely]]
+      return nullptr;
+    seg->replace_pinned_extbuf(replacement->base(), replacement->iova());
+    CHECK_NOTNULL(msg_buf->append(seg->segment_length()));
+    return msg_buf;
+  }
+
+  // State of the channel in the TX scheduler of the engine.
+  TxSchedState &tx_sched_state() { return tx_sched_state_; }
+
  protected:
   /**
    * @brief Gets the list of active flows.
    * @return A reference to the list of active flows.
    */
-  std::list<std::unique_ptr<Flow>> &GetActiveFlows() { return active_flows_; }
-
+  FlowList &GetActiveFlows() { return active_flows_; }
   /**
    * @brief Gets the list of listeners associated with the channel.
    * @return A reference to the list of listeners.
@@ -439,20 +1076,29 @@ class Channel : public ShmChannel {
   std::unordered_set<Listener> &GetListeners() { return listeners_; }
 
   /**
-   * @brief Creates a new flow associated with `this' channel object.
+   * @brief Creates a new flow associated with `this' channel object. The flow
+   * is constructed in place, in a block of the channel's flow pool.
    * @param params The parameters pack to be forwarded to the constructor of the
    *               Flow.
-   * @return A const iterator to the newly created flow.
+   * @return An iterator to the newly created flow.
    */
-  const std::list<std::unique_ptr<Flow>>::const_iterator CreateFlow(
-      auto &&...params) {
-    active_flows_.emplace_back(std::make_unique<Flow>(
-        std::forward<decltype(params)>(params)..., this));
+  FlowList::iterator CreateFlow(auto &&...params) {
+    active_flows_.emplace_back(std::forward<decltype(params)>(params)..., this);
     return std::prev(active_flows_.end());
   }
 
-  void RemoveFlow(
-      const std::list<std::unique_ptr<Flow>>::const_iterator &flow_it);
+  void RemoveFlow(const FlowList::const_iterator &flow_it);
+
+  /**
+   * @brief Grow the flow pool of the channel, so that `nflows' more flows can
+   * be created without any heap allocation (e.g., ahead of a burst of new
+   * connections).
+   */
+  void ReserveFlows(size_t nflows) { flow_pool_.Reserve(nflows); }
+
+  // Number of flows of the channel, and the capacity of its flow pool.
+  size_t GetFlowCount() const { return active_flows_.size(); }
+  size_t GetFlowPoolCapacity() const { return flow_pool_.GetCapacity(); }
 
   /**
    * @brief Adds a listener to the channel (i.e., an IP address and port pair).
@@ -471,24 +1117,58 @@ class Channel : public ShmChannel {
     // Empty callback.
 
     // DPDK requires a callback to be registered with the mbuf shinfo in the
-    // case of external buffers. The purpose of this callback is to do any post
-    // mbuf release cleanup.
+    // case of external buffers. The pinned buffers of the RX buffer pool are
+    // never released through it: their reference count never drops to zero.
+  }
 
-    // There is a caveat with this mechanism: The callback is only called by
-    // DPDK if the `FAST_FREE' offload is not set and the reference count has
-    // reached zero. With `FAST_FREE' offload enabled, the mbuf is simply put
-    // back to the relevant pool with only minimal initialization. We do not
-    // need this callback to re-initialize mbufs; we explicitly initialize them
-    // in the stack and no further book-keeping is required for channel buffers.
+  // Free callback of zero-copy TX buffers; called when the NIC is done with
+  // the last packet attached to the buffer at `addr'.
+  static void tx_zerocopy_free_cb(void *addr, void *opaque) {
+    auto *channel = static_cast<Channel *>(opaque);
+    auto *msg_buf = reinterpret_cast<MsgBuf *>(static_cast<uchar_t *>(addr) -
+                                               MACHNET_MSGBUF_SPACE_RESERVED);
+    DCHECK_GT(channel->tx_zerocopy_inflight_, 0);
+    channel->tx_zerocopy_inflight_--;
+    if (channel->tx_zerocopy_bufs_[msg_buf->index()].acked) {
+      CHECK(channel->MsgBufFree(msg_buf));
+    }
   }
 
-  rte_mbuf_ext_shared_info sh_info_{
-      .free_cb = free_ext_buf_cb, .fcb_opaque = nullptr, .refcnt = 0};
+  // Zero-copy TX state of a channel buffer.
+  struct TxZeroCopyBuf {
+    // Its reference count is the number of packets the buffer is attached to.
+    rte_mbuf_ext_shared_info shinfo;
+    // Whether the buffer has been acknowledged by the peer.
+    bool acked;
+  };
+
+  // Shared info of the pinned buffers of the RX buffer pool. Its reference
+  // count stays at 1, so that mbufs return to the pool with their buffer
+  // attached.
+  rte_mbuf_ext_shared_info rx_sh_info_{
+      .free_cb = free_ext_buf_cb, .fcb_opaque = nullptr, .refcnt = 1};
+  // Pool of packet buffers backed by channel buffers (see
+  // `CreateRxBufferPool()').
+  std::unique_ptr<dpdk::PacketPool> rx_buffer_pool_{nullptr};
+  // Zero-copy TX state, indexed by buffer index; empty if zero-copy TX is not
+  // enabled (see `EnableTxZeroCopy()').
+  std::vector<TxZeroCopyBuf> tx_zerocopy_bufs_{};
+  uint32_t tx_zerocopy_threshold_{0};
+  uint32_t tx_zerocopy_inflight_{0};
+  // Whether received messages are delivered out of order, once complete.
+  bool unordered_delivery_{false};
+  // Whether long received messages are delivered in chunks.
+  bool stream_delivery_{false};
 
   // List of listeners associated with this channel.
   std::unordered_set<Listener> listeners_;
+  // Pool of the flows of this channel; it outlives them. The flows migrate
+  // along with the channel (see `MachnetEngine::DetachChannel()'), so it is
+  // only ever used by the engine that currently owns the channel.
+  SlabPool flow_pool_{kFlowsPerSlab};
   // List of active flows associated with this channel.
-  std::list<std::unique_ptr<Flow>> active_flows_;
+  FlowList active_flows_;
+  TxSchedState tx_sched_state_{};
 
   // DPDK external memory region.
   rte_device *attached_dev_{nullptr};
@@ -504,6 +1184,10 @@ class Channel : public ShmChannel {
  * @brief Class `ChannelManager' is a class that can be used to manage channels.
  * A `ChannelManager' provides method to create, destroy and access the
  * underlying Machnet Channels it holds.
+ *
+ * Channels are shared memory objects of their own (at most `kMaxChannelNr' of
+ * them), or are sub-allocated from arenas (see `ChannelArena'), which bound
+ * their number instead.
  */
 template <class T = Channel,
           class =
@@ -514,10 +1198,75 @@ class ChannelManager {
   static constexpr size_t kMaxChannelNr = 32;
   static constexpr size_t kDefaultRingSize = 256;
   static constexpr size_t kDefaultBufferCount = 4096;
+  // Limits for the sizes that applications request (see `FitSize()').
+  static constexpr size_t kMinRingSize = 64;
+  static constexpr size_t kMaxRingSize = 1 << 14;
+  static constexpr size_t kMinBufferCount = 512;
+  static constexpr size_t kMaxBufferCount = 1 << 17;
+
+  /**
+   * @brief Fits a size requested for a channel's rings (or buffer pool) to
+   * the limits of the manager.
+   *
+   * @param requested    The requested size (0 for the default).
+   * @param default_size The default size.
+   * @param min          The minimum size.
+   * @param max          The maximum size.
+   * @return The requested size rounded up to a power of 2 and clamped to
+   *         [min, max], or the default if none was requested.
+   */
+  static constexpr size_t FitSize(size_t requested, size_t default_size,
+                                  size_t min, size_t max) {
+    if (requested == 0) return default_size;
+    return std::clamp(std::bit_ceil(requested), min, max);
+  }
+
   ChannelManager() {}
   ChannelManager(const ChannelManager &) = delete;
   ChannelManager &operator=(const ChannelManager &) = delete;
 
+  /**
+   * @brief Create an arena for channels of (at most) a given shape (see
+   * `ChannelArena'), e.g., to pass to `AddChannel()'. It is backed by huge
+   * pages if there are enough of them, and by regular pages otherwise.
+   *
+   * @param name         Name of the arena (of the memfds of its slots).
+   * @param slots_nr     The number of channels it holds.
+   * @param machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr,
+   *        buffer_size, ring_type  The shape of the channels (see
+   *        `AddChannel()').
+   * @param numa_node    The NUMA node to allocate the arena on, or -1 for the
+   *                     calling thread's.
+   * @return The arena, or nullptr on failure.
+   */
+  static std::shared_ptr<ChannelArena> CreateArena(
+      const char *name, size_t slots_nr, size_t machnet_ring_slot_nr,
+      size_t app_ring_slot_nr, size_t buf_ring_slot_nr, size_t buffer_size,
+      int ring_type = MACHNET_CHANNEL_RING_JRING, int numa_node = -1) {
+    if (slots_nr == 0 || slots_nr > UINT32_MAX) return nullptr;
+    const bool bind = numa_node >= 0 && SetMemoryNode(numa_node);
+    std::shared_ptr<ChannelArena> arena = nullptr;
+    for (const int is_posix_shm : {0, 1}) {
+      const size_t slot_size = __machnet_channel_dataplane_calculate_size(
+          machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr,
+          buffer_size, ring_type, is_posix_shm);
+      if (slot_size == static_cast<size_t>(-1)) break;
+      arena = ChannelArena::Create(name, slots_nr, slot_size, is_posix_shm);
+      if (arena != nullptr) break;
+    }
+    if (bind) SetMemoryNode(-1);
+    if (arena == nullptr) {
+      LOG(WARNING) << "Failed to create channel arena " << name << " of "
+                   << slots_nr << " channels.";
+      return nullptr;
+    }
+
+    LOG(INFO) << "Channel arena " << name << ": " << slots_nr
+              << " channels of " << arena->GetSlotSize() << " bytes"
+              << (arena->IsPosixShm() ? " (regular pages)." : ".");
+    return arena;
+  }
+
   /**
    * Create a new Machnet dataplane channel.
    *
@@ -530,30 +1279,73 @@ class ChannelManager {
    * @param buf_ring_slot_nr   The number of buffers + 1 in the pool (must be
    *                           power of 2).
    * @param buffer_size        The size of each buffer (power of 2).
+   * @param ring_type          The type of the messaging rings
+   *                           (`MACHNET_CHANNEL_RING_*'); SPSC rings require
+   *                           the application to use a single sending and a
+   *                           single receiving thread.
+   * @param numa_node          The NUMA node to allocate the channel's memory
+   *                           on (e.g., the one of the engine serving it), or
+   *                           -1 for the calling thread's.
+   * @param arena              An arena to sub-allocate the channel from (see
+   *                           `CreateArena()'), if any; the channel gets memory
+   *                           of its own if it does not fit in a slot, or
+   *                           if the arena is full.
    * @return
    *   - `true` if the channel was successfully created.
    *   - `false` otherwise.
    */
   bool AddChannel(const char *name, size_t machnet_ring_slot_nr,
                   size_t app_ring_slot_nr, size_t buf_ring_slot_nr,
-                  size_t buffer_size) {
+                  size_t buffer_size,
+                  int ring_type = MACHNET_CHANNEL_RING_JRING,
+                  int numa_node = -1,
+                  const std::shared_ptr<ChannelArena> &arena = nullptr) {
     const std::lock_guard<std::mutex> lock(mtx_);
-    if (channels_.size() >= kMaxChannelNr) {
-      LOG(WARNING) << "Too many channels.";
+    if (channels_.find(name) != channels_.end()) {
+      LOG(WARNING) << "Channel " << name << " already exists.";
       return false;
     }
 
-    if (channels_.find(name) != channels_.end()) {
-      LOG(WARNING) << "Channel " << name << " already exists.";
+    if (arena != nullptr) {
+      const auto size = __machnet_channel_dataplane_calculate_size(
+          machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr,
+          buffer_size, ring_type, arena->IsPosixShm());
+      auto *slot = size <= arena->GetSlotSize() ? arena->AllocSlot() : nullptr;
+      if (slot != nullptr) {
+        if (__machnet_channel_dataplane_init(
+                slot, arena->GetSlotSize(), arena->IsPosixShm(), name,
+                machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr,
+                buffer_size, ring_type, 0) != 0) {
+          arena->FreeSlot(slot);
+          LOG(WARNING) << "Failed to create channel " << name << " in arena "
+                       << arena->GetName() << ".";
+          return false;
+        }
+        channels_.insert(std::make_pair(
+            name, std::make_shared<T>(
+                      name, reinterpret_cast<MachnetChannelCtx_t *>(slot),
+                      arena->GetSlotSize(), arena->IsPosixShm(),
+                      arena->GetSlotFd(slot), arena)));
+        arena_channels_nr_++;
+        return true;
+      }
+    }
+
+    if (channels_.size() - arena_channels_nr_ >= kMaxChannelNr) {
+      LOG(WARNING) << "Too many channels.";
       return false;
     }
 
     int channel_fd;
     size_t shm_segment_size;
     int is_posix_shm;
+    // The channel's memory is faulted in (and pinned) at creation, so that
+    // preferring the node for the duration of the call is enough to place it.
+    const bool bind = numa_node >= 0 && SetMemoryNode(numa_node);
     auto *ctx = __machnet_channel_create(
         name, machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr,
-        buffer_size, &shm_segment_size, &is_posix_shm, &channel_fd);
+        buffer_size, ring_type, &shm_segment_size, &is_posix_shm, &channel_fd);
+    if (bind) SetMemoryNode(-1);
     if (ctx == nullptr) {
       LOG(WARNING) << "Failed to create channel " << name
                    << " with requested size " << shm_segment_size << ".";
@@ -575,7 +1367,10 @@ class ChannelManager {
   void DestroyChannel(const char *name) {
     const std::lock_guard<std::mutex> lock(mtx_);
 
-    if (channels_.find(name) != channels_.end()) channels_.erase(name);
+    auto it = channels_.find(name);
+    if (it == channels_.end()) return;
+    if (it->second->GetArena() != nullptr) arena_channels_nr_--;
+    channels_.erase(it);
   }
 
   /**
@@ -611,9 +1406,31 @@ class ChannelManager {
     return channels_.size();
   }
 
+  /**
+   * @brief Make the calling thread prefer allocating memory on a NUMA node,
+   * or restore its default policy (`numa_node' -1).
+   * @return True on success.
+   */
+  static bool SetMemoryNode(int numa_node) {
+    if (numa_node < 0) {
+      return syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0) == 0;
+    }
+    constexpr size_t kMaxNodes = sizeof(unsigned long) * 8;  // NOLINT
+    if (static_cast<size_t>(numa_node) >= kMaxNodes) return false;
+    const unsigned long nodemask = 1UL << numa_node;  // NOLINT
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodemask, kMaxNodes) != 0) {
+      LOG(WARNING) << "Cannot allocate memory on NUMA node " << numa_node
+                   << ": " << strerror(errno);
+      return false;
+    }
+    return true;
+  }
+
  private:
   std::mutex mtx_;
   std::unordered_map<std::string, std::shared_ptr<T>> channels_;
+  // Channels sub-allocated from arenas, which `kMaxChannelNr' does not bound.
+  size_t arena_channels_nr_{0};
 };
 
 }  // namespace shm
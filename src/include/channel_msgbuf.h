@@ -76,6 +76,24 @@ class MsgBuf {
   bool is_last() const { return (flags() & MACHNET_MSGBUF_FLAGS_FIN) != 0; }
   // Returns true if the `MachnetMsgBuf_t' is the last in a message.
   bool is_sg() const { return (flags() & MACHNET_MSGBUF_FLAGS_SG) != 0; }
+  // Returns true if the message is traced (see `MessageTracer').
+  bool is_traced() const { return (flags() & MACHNET_MSGBUF_FLAGS_TRACE) != 0; }
+  // Stamp of the last stage of a traced message (see `MessageTracer').
+  uint32_t trace_tsc() const { return msg_buf_.trace_tsc; }
+  // Returns true if the message is of high priority (see `MACHNET_PRIO_HIGH').
+  bool is_prio() const { return (flags() & MACHNET_MSGBUF_FLAGS_PRIO) != 0; }
+  // Returns true if the payload is that of another, shared, buffer.
+  bool is_ref() const { return (flags() & MACHNET_MSGBUF_FLAGS_REF) != 0; }
+  // Index of the buffer holding the payload of a reference.
+  uint32_t ref() const { return msg_buf_.ref; }
+  // Returns true if the delivery of the message is to be notified (see
+  // `MACHNET_MSGBUF_NOTIFY_DELIVERY'), with `cookie()'.
+  bool notify_delivery() const {
+    return (flags() & MACHNET_MSGBUF_NOTIFY_DELIVERY) != 0;
+  }
+  uint32_t cookie() const { return msg_buf_.cookie; }
+  // Number of references to a shared buffer yet to be released.
+  uint16_t refcnt() const { return msg_buf_.refcnt; }
 
   std::string flow_info() const {
     const net::Ipv4::Address src_ip(msg_buf_.flow.src_ip);
@@ -125,6 +143,24 @@ class MsgBuf {
   }
   void set_next(MsgBuf *next) { set_next(next->index()); }
   void set_last(uint32_t last) { msg_buf_.last = last; }
+  void set_trace_tsc(uint32_t stamp) { msg_buf_.trace_tsc = stamp; }
+  void set_refcnt(uint16_t refcnt) { msg_buf_.refcnt = refcnt; }
+  /**
+   * @brief Make this buffer a reference to the payload of `target', which it
+   * then shares with the other references to it.
+   */
+  void set_ref(const MsgBuf *target) {
+    msg_buf_.ref = target->index();
+    add_flags(MACHNET_MSGBUF_FLAGS_REF);
+  }
+  // Set the cookie to notify the delivery of the message with, in its first
+  // buffer (see `MACHNET_MSGBUF_NOTIFY_DELIVERY').
+  void set_cookie(uint32_t cookie) { msg_buf_.cookie = cookie; }
+  // Drop a reference to this shared buffer; true if it was the last one.
+  bool unref() {
+    DCHECK_GT(msg_buf_.refcnt, 0);
+    return --msg_buf_.refcnt == 0;
+  }
   void mark_first() { add_flags(MACHNET_MSGBUF_FLAGS_SYN); }
   void mark_last() { add_flags(MACHNET_MSGBUF_FLAGS_FIN); }
 
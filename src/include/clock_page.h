@@ -0,0 +1,241 @@
+/**
+ * @file clock_page.h
+ * @brief The clock page that the controller shares with its engines and the
+ * applications, for timestamps that are cheap and consistent among them.
+ */
+#ifndef SRC_INCLUDE_CLOCK_PAGE_H_
+#define SRC_INCLUDE_CLOCK_PAGE_H_
+
+#include <common.h>
+#include <cpuid.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <machnet_common.h>
+#include <sys/mman.h>
+#include <ttime.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace juggler {
+namespace time {
+
+/**
+ * @brief Class `ClockPage' calibrates the TSC against `CLOCK_MONOTONIC_RAW',
+ * and publishes the calibration in a page of shared memory (see
+ * `MachnetClockPage'), which applications map read-only (see
+ * `machnet_clock_ns()'), and sets `shared_tsc_hz' for the engines of the
+ * process.
+ *
+ * The first calibration is short (`kCalibrationNs'). It is then refined every
+ * `kRefineIntervalNs' (see `Start()'), over the TSC and the clock since the
+ * page was created: the longer the baseline, the more accurate the frequency.
+ * The published clock never steps back: it is slewed towards
+ * `CLOCK_MONOTONIC_RAW' over the next interval instead.
+ *
+ * The page is sealed, so that applications can only map it read-only.
+ *
+ * This class is non-copyable. `Refine()' must be called from a single thread
+ * (e.g., the one of `Start()').
+ */
+class ClockPage {
+ public:
+  static constexpr uint64_t kCalibrationNs = 10'000'000;        // 10ms
+  static constexpr uint64_t kRefineIntervalNs = 1'000'000'000;  // 1s
+  // Larger errors of a clock that is behind are stepped rather than slewed;
+  // those of a clock that is ahead are slewed by at most this much per
+  // interval.
+  static constexpr int64_t kMaxSlewNs = 1'000'000;  // 1ms
+
+  /**
+   * @brief Create a clock page, and calibrate the TSC for the first time.
+   * @return The clock page, or nullptr on failure.
+   */
+  static std::unique_ptr<ClockPage> Create() {
+    const int fd =
+        memfd_create("machnet_clock", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+      PLOG(ERROR) << "Failed to create the clock page";
+      return nullptr;
+    }
+    void *mem = MAP_FAILED;
+    if (ftruncate(fd, kPageSize) == 0) {
+      mem = mmap(nullptr, kPageSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (mem == MAP_FAILED) {
+      PLOG(ERROR) << "Failed to map the clock page";
+      close(fd);
+      return nullptr;
+    }
+    // Applications get the descriptor: only this mapping can write the page.
+    int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+#ifdef F_SEAL_FUTURE_WRITE
+    seals |= F_SEAL_FUTURE_WRITE;
+#endif
+    if (fcntl(fd, F_ADD_SEALS, seals) != 0) {
+      PLOG(WARNING) << "Failed to seal the clock page";
+    }
+
+    auto clock = std::unique_ptr<ClockPage>(
+        new ClockPage(fd, static_cast<MachnetClockPage_t *>(mem)));
+    clock->page_->flags = HasInvariantTsc() ? MACHNET_CLOCK_F_INVARIANT_TSC : 0;
+    LOG_IF(WARNING, !clock->invariant_tsc())
+        << "The TSC is not invariant: applications will not use the clock "
+           "page.";
+
+    clock->first_ = TakeSample();
+    Sample sample;
+    do {
+      sample = TakeSample();
+    } while (sample.ns - clock->first_.ns < kCalibrationNs);
+    const uint64_t hz = clock->EstimateHz(sample);
+    clock->Publish(hz, sample.tsc, sample.ns,
+                   (static_cast<unsigned __int128>(1'000'000'000)
+                    << MACHNET_CLOCK_SHIFT) /
+                       hz);
+    LOG(INFO) << "Clock page: TSC at " << hz << " Hz.";
+    return clock;
+  }
+
+  ClockPage(const ClockPage &) = delete;
+  ClockPage &operator=(const ClockPage &) = delete;
+
+  ~ClockPage() {
+    if (thread_.joinable()) {
+      {
+        const std::lock_guard<std::mutex> lock(mtx_);
+        running_ = false;
+      }
+      cv_.notify_all();
+      thread_.join();
+    }
+    munmap(page_, kPageSize);
+    close(fd_);
+  }
+
+  // The file descriptor of the page, to hand to applications.
+  int GetFd() const { return fd_; }
+  const MachnetClockPage_t *page() const { return page_; }
+  bool invariant_tsc() const {
+    return page_->flags & MACHNET_CLOCK_F_INVARIANT_TSC;
+  }
+  uint64_t tsc_hz() const {
+    return __atomic_load_n(&page_->tsc_hz, __ATOMIC_RELAXED);
+  }
+
+  // The current time, in nanoseconds of `CLOCK_MONOTONIC_RAW'.
+  uint64_t Now() const { return __machnet_clock_tsc_to_ns(page_, rdtsc()); }
+
+  /**
+   * @brief Refine the calibration, with a new sample of the TSC and the clock,
+   * and publish it.
+   */
+  void Refine() {
+    const auto sample = TakeSample();
+    const uint64_t hz = EstimateHz(sample);
+
+    // The published clock goes on from where it is now.
+    const uint64_t clock_ns = __machnet_clock_tsc_to_ns(page_, sample.tsc);
+    int64_t error_ns = static_cast<int64_t>(sample.ns - clock_ns);
+    uint64_t base_ns = clock_ns;
+    if (error_ns > kMaxSlewNs) {
+      base_ns = sample.ns;
+      error_ns = 0;
+    }
+    error_ns = std::max(error_ns, -kMaxSlewNs);
+
+    // Make up for the error over the next interval.
+    const uint64_t interval_cycles = static_cast<uint64_t>(
+        static_cast<unsigned __int128>(kRefineIntervalNs) * hz / 1'000'000'000);
+    const uint64_t mult = static_cast<uint64_t>(
+        (static_cast<unsigned __int128>(kRefineIntervalNs + error_ns)
+         << MACHNET_CLOCK_SHIFT) /
+        interval_cycles);
+    Publish(hz, sample.tsc, base_ns, mult);
+  }
+
+  // Refine the calibration every `kRefineIntervalNs' in a thread of its own,
+  // until the page is destroyed.
+  void Start() {
+    CHECK(!thread_.joinable());
+    running_ = true;
+    thread_ = std::thread([this]() {
+      std::unique_lock<std::mutex> lock(mtx_);
+      while (!cv_.wait_for(lock, std::chrono::nanoseconds(kRefineIntervalNs),
+                           [this]() { return !running_; })) {
+        Refine();
+      }
+    });
+  }
+
+ private:
+  // A TSC value and the time at it.
+  struct Sample {
+    uint64_t tsc;
+    uint64_t ns;
+  };
+
+  ClockPage(int fd, MachnetClockPage_t *page) : fd_(fd), page_(page) {}
+
+  static bool HasInvariantTsc() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return false;
+    return edx & (1u << 8);
+  }
+
+  // The tightest of a few reads of the clock between two of the TSC.
+  static Sample TakeSample() {
+    constexpr int kReads = 5;
+    Sample best{};
+    uint64_t best_cycles = UINT64_MAX;
+    for (int i = 0; i < kReads; i++) {
+      timespec ts;
+      const uint64_t start = rdtsc();
+      clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+      const uint64_t end = rdtsc();
+      if (end - start >= best_cycles) continue;
+      best_cycles = end - start;
+      best = {start + best_cycles / 2,
+              static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec};
+    }
+    return best;
+  }
+
+  // The frequency of the TSC from the first sample to this one.
+  uint64_t EstimateHz(const Sample &sample) const {
+    return static_cast<uint64_t>(
+        static_cast<unsigned __int128>(sample.tsc - first_.tsc) *
+        1'000'000'000 / (sample.ns - first_.ns));
+  }
+
+  void Publish(uint64_t hz, uint64_t base_tsc, uint64_t base_ns,
+               uint64_t mult) {
+    const uint32_t seq = page_->seq;
+    __atomic_store_n(&page_->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&page_->tsc_hz, hz, __ATOMIC_RELAXED);
+    __atomic_store_n(&page_->base_tsc, base_tsc, __ATOMIC_RELAXED);
+    __atomic_store_n(&page_->base_ns, base_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&page_->mult, mult, __ATOMIC_RELAXED);
+    __atomic_store_n(&page_->seq, seq + 2, __ATOMIC_RELEASE);
+    shared_tsc_hz.store(hz, std::memory_order_relaxed);
+  }
+
+  const int fd_;
+  MachnetClockPage_t *const page_;
+  Sample first_{};
+  std::mutex mtx_{};
+  std::condition_variable cv_{};
+  bool running_{false};
+  std::thread thread_{};
+};
+
+}  // namespace time
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_CLOCK_PAGE_H_
@@ -0,0 +1,76 @@
+/**
+ * @file command_ring.h
+ * @brief Lock-free rings of commands, from the control plane to an engine.
+ */
+#ifndef SRC_INCLUDE_COMMAND_RING_H_
+#define SRC_INCLUDE_COMMAND_RING_H_
+
+#include <glog/logging.h>
+#include <jring.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+
+namespace juggler {
+
+/**
+ * @brief Class `CommandRing' carries commands (heap-allocated objects of type
+ * `T') from a producer to a consumer thread, over a single-producer,
+ * single-consumer `jring' of pointers. The consumer (e.g., an engine thread)
+ * never blocks, and checking for commands costs it a read of the ring's
+ * indices.
+ *
+ * @attention Producers must be serialized (e.g., by a lock of the control
+ * plane); there must be a single consumer.
+ */
+template <typename T>
+class CommandRing {
+ public:
+  static constexpr uint32_t kDefaultSlotsNr = 256;
+
+  explicit CommandRing(uint32_t slots_nr = kDefaultSlotsNr) {
+    const size_t ring_size = jring_get_buf_ring_size(sizeof(T *), slots_nr);
+    CHECK_NE(ring_size, static_cast<size_t>(-1)) << "Invalid ring size";
+    ring_ = static_cast<jring_t *>(std::aligned_alloc(CACHE_LINE_SIZE,
+                                                      ring_size));
+    CHECK_NOTNULL(ring_);
+    CHECK_EQ(jring_init(ring_, slots_nr, sizeof(T *), 0, 0), 0);
+  }
+  CommandRing(const CommandRing &) = delete;
+  CommandRing &operator=(const CommandRing &) = delete;
+
+  ~CommandRing() {
+    while (Pop() != nullptr) {
+    }
+    std::free(ring_);
+  }
+
+  /**
+   * @brief Post a command. If the ring is full, waits (yielding the CPU) for
+   * the consumer to make room.
+   */
+  void Push(std::unique_ptr<T> command) {
+    T *ptr = CHECK_NOTNULL(command.release());
+    while (jring_sp_enqueue_bulk(ring_, &ptr, 1, nullptr) != 1) {
+      std::this_thread::yield();
+    }
+  }
+
+  // Take the next command, or nullptr if there is none.
+  std::unique_ptr<T> Pop() {
+    T *ptr;
+    if (jring_sc_dequeue_bulk(ring_, &ptr, 1, nullptr) != 1) return nullptr;
+    return std::unique_ptr<T>(ptr);
+  }
+
+  bool Empty() const { return jring_empty(ring_); }
+
+ private:
+  jring_t *ring_;
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_COMMAND_RING_H_
@@ -6,6 +6,7 @@
 #ifndef SRC_INCLUDE_COMMON_H_
 #define SRC_INCLUDE_COMMON_H_
 
+#include <cstdint>
 #include <new>
 
 namespace juggler {
@@ -30,13 +31,68 @@ static const std::size_t kPageSize = 4096;
 
 static const std::size_t kHugePage2MSize = 2 * 1024 * 1024;
 
-static constexpr bool kShmZeroCopyEnabled = false;
-
 enum class CopyMode {
   kMemCopy,
   kZeroCopy,
 };
 
+// RX processing pipeline of the Machnet engine.
+enum class RxPipelineMode {
+  // Process each packet of a burst to completion, one after the other.
+  kSequential,
+  // Process bursts in stages (prefetch headers, classify, prefetch flow state,
+  // process packets grouped by flow) to hide memory latency.
+  kStaged,
+};
+
+// Scheduling of the messages that applications enqueue to their channels.
+enum class TxSchedulerMode {
+  // Serve the channels in a fixed order, dequeuing up to a burst of messages
+  // from each, and transmit them right away.
+  kRoundRobin,
+  // Deficit round robin across the channels (in proportion to their weights),
+  // and then across the flows, within a budget of packets per engine
+  // iteration (see `DrrScheduler').
+  kDrr,
+};
+
+// How an engine thread idles when there is no work (see `IdlePolicy').
+enum class IdleMode {
+  // Poll the RX queue and the channels continuously.
+  kBusyPoll,
+  // Back off progressively: `pause' bursts, then timed waits (`umwait' on the
+  // RX queue, or `tpause', where the CPU supports them).
+  kAdaptive,
+  // As `kAdaptive', and finally block on RX interrupts (with a timeout).
+  kInterrupt,
+};
+
+// Default TX budget (in packets) of an engine iteration, and quantum (in
+// packets per round, for a weight of 1) of deficit round robin.
+static constexpr uint32_t kDefaultTxBudget = 256;
+static constexpr uint32_t kDefaultTxQuantum = 16;
+
+// Default ACK coalescing factor of a flow: in-order data packets are
+// acknowledged every `kDefaultAckEvery' packets, or at the end of the RX burst,
+// whichever comes first. A value of 0 means acknowledge only at the end of the
+// RX burst; 1 means acknowledge every packet.
+static constexpr uint32_t kDefaultAckEvery = 16;
+
+// Default burst size (in packets) of the flows of an interface with pacing
+// enabled: a flow sends at most this many packets back to back, and spaces its
+// bursts out to send its window over an RTT (see `Flow::TransmitPackets()').
+static constexpr uint32_t kDefaultPacingBurst = 8;
+
+// Default, smallest and largest (i.e., for jumbo frames) MTU of an interface.
+static constexpr uint16_t kDefaultMtu = 1500;
+static constexpr uint16_t kMinMtu = 576;
+static constexpr uint16_t kMaxMtu = 9000;
+
+// Default minimum payload size (in bytes) of a message buffer to be sent
+// zero-copy, on channels with zero-copy TX. Smaller payloads are cheaper to
+// copy than to attach to packets and track until the NIC is done with them.
+static constexpr uint32_t kDefaultTxZeroCopyThreshold = 1024;
+
 }  // namespace juggler
 
 #endif  // SRC_INCLUDE_COMMON_H_
@@ -0,0 +1,149 @@
+/**
+ * @file cycle_accounting.h
+ * @brief Accounting of the cycles of the main loop of an engine, stage by
+ * stage (see `CycleAccounting').
+ */
+#ifndef SRC_INCLUDE_CYCLE_ACCOUNTING_H_
+#define SRC_INCLUDE_CYCLE_ACCOUNTING_H_
+
+#include <engine_stats.h>
+#include <ttime.h>
+
+#include <array>
+#include <cstdint>
+
+namespace juggler {
+
+/**
+ * @brief Class `CycleAccounting' tells where the main loop of an engine (see
+ * `MachnetEngine::Run()') spends its cycles, for capacity planning (e.g., to
+ * choose the number of engines): in which of its stages, and how much of it in
+ * iterations that found nothing to do.
+ *
+ * It is always on, so it has to be cheap: every iteration is counted, but the
+ * stages are only timed on one in every `kSampleEvery' of them, and their
+ * cycles scaled up accordingly. On sampled iterations, the loop marks the end
+ * of each stage (see `Mark()'), which is charged the cycles since the end of
+ * the previous one. Stages nested in others (e.g., the processing of ARP
+ * packets, amid the RX processing) are timed on their own (see `Nested()'),
+ * and their cycles taken off the enclosing stage.
+ *
+ * It also counts the sizes of the bursts of packets received, in
+ * power-of-two buckets (see `stats::BatchBucket()').
+ *
+ * @attention This class is not thread-safe: it belongs to an engine.
+ */
+class CycleAccounting {
+ public:
+  enum Stage : size_t {
+    // Flow timers and removal of expired flows.
+    kTimers = 0,
+    // Control plane commands and flows pending address resolution.
+    kControl,
+    // Periodic processing and publication of the stats.
+    kPeriodic,
+    // Reception and processing of packets.
+    kRx,
+    // Processing of ARP packets, and maintenance of the ARP table.
+    kArp,
+    // Dequeue of messages from the channels.
+    kDequeue,
+    // Processing of the messages dequeued, into packets.
+    kTx,
+    // Delayed ACKs, and transmission of the packets of the iteration.
+    kFlush,
+    kNumStages,
+  };
+  // The stages are published in this order (see `stats::LoopStats').
+  static_assert(kNumStages == stats::LoopStats::kNumStages);
+
+  static constexpr uint32_t kSampleEvery = 16;
+  static_assert((kSampleEvery & (kSampleEvery - 1)) == 0);
+
+  CycleAccounting() = default;
+  CycleAccounting(const CycleAccounting &) = delete;
+  CycleAccounting &operator=(const CycleAccounting &) = delete;
+
+  /**
+   * @brief An iteration of the loop starts, at `now' (the TSC).
+   * @return Whether it is sampled, i.e., its stages are timed.
+   */
+  bool Begin(uint64_t now) {
+    sampled_ = (++iterations_ & (kSampleEvery - 1)) == 0;
+    start_ = last_ = now;
+    nested_ = 0;
+    return sampled_;
+  }
+
+  bool sampled() const { return sampled_; }
+
+  // A stage ends: charge it the cycles since the end of the previous one
+  // (but those of the stages nested in it), if the iteration is sampled.
+  void Mark(Stage stage) {
+    if (!sampled_) return;
+    const auto now = time::rdtsc();
+    stage_cycles_[stage] += now - last_ - nested_;
+    last_ = now;
+    nested_ = 0;
+  }
+
+  // Run `f', as a stage nested in the current one.
+  template <typename F>
+  void Nested(Stage stage, F &&f) {
+    if (!sampled_) {
+      f();
+      return;
+    }
+    const auto start = time::rdtsc();
+    f();
+    const auto cycles = time::rdtsc() - start;
+    stage_cycles_[stage] += cycles;
+    nested_ += cycles;
+  }
+
+  /**
+   * @brief The iteration ends.
+   * @param useful Whether it did any work.
+   */
+  void End(bool useful) {
+    if (useful) return;
+    empty_iterations_++;
+    if (sampled_) empty_cycles_ += time::rdtsc() - start_;
+  }
+
+  // A (non-empty) burst of `n' packets was received.
+  void CountRxBatch(uint32_t n) { rx_batches_[stats::BatchBucket(n)]++; }
+
+  // Fill in the stats of the loop, for its stats page.
+  void GetStats(stats::LoopStats *loop) const {
+    loop->iterations = iterations_;
+    loop->empty_iterations = empty_iterations_;
+    loop->empty_cycles = empty_cycles_ * kSampleEvery;
+    for (size_t i = 0; i < kNumStages; i++) {
+      loop->stage_cycles[i] = stage_cycles_[i] * kSampleEvery;
+    }
+    loop->sample_every = kSampleEvery;
+    for (size_t i = 0; i < stats::kBatchBuckets; i++) {
+      loop->rx_batches[i] = rx_batches_[i];
+    }
+  }
+
+ private:
+  uint64_t iterations_{0};
+  uint64_t empty_iterations_{0};
+  // Cycles of the sampled iterations (not scaled up).
+  uint64_t empty_cycles_{0};
+  std::array<uint64_t, kNumStages> stage_cycles_{};
+  std::array<uint64_t, stats::kBatchBuckets> rx_batches_{};
+  // State of the current iteration: whether it is sampled, its start, and the
+  // end of its last stage, and the cycles of the stages nested in the current
+  // one.
+  bool sampled_{false};
+  uint64_t start_{0};
+  uint64_t last_{0};
+  uint64_t nested_{0};
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_CYCLE_ACCOUNTING_H_
@@ -0,0 +1,161 @@
+/**
+ * @file direct_engine.h
+ * @brief Direct-NIC mode: a Machnet engine that runs inside a trusted
+ * application, over a queue pair of the NIC of its own, rather than in the
+ * Machnet controller.
+ */
+#ifndef SRC_INCLUDE_DIRECT_ENGINE_H_
+#define SRC_INCLUDE_DIRECT_ENGINE_H_
+
+#include <channel.h>
+#include <glog/logging.h>
+#include <machnet.h>
+#include <machnet_ctrl.h>
+#include <machnet_engine.h>
+#include <pmd.h>
+#include <ttime.h>
+#include <utils.h>
+#include <uuid/uuid.h>
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace juggler {
+
+/**
+ * @brief Class `DirectEngine' runs the Machnet protocol engine (i.e., the
+ * flows of a `MachnetEngine') in a trusted application, as a DPDK secondary
+ * process of the controller, on a queue pair the controller set aside for it
+ * (see `NetworkInterfaceConfig::direct_queues()'). Messages go between the
+ * application's channel and the NIC in the application's own thread, without
+ * crossing to an engine core of the controller and back.
+ *
+ * The controller keeps owning the port: its configuration, the ARP table,
+ * the flow rules (which steer the queue's blocks of UDP ports to it, see
+ * `MachnetEngineSharedState::EnablePortSteering()'), and the listening ports;
+ * the engine asks it for those over the control socket (see
+ * `MachnetEngineSharedState::Delegate'). The queue is given back when the
+ * application exits.
+ *
+ * The application sends and receives on `channel_ctx()' with the usual
+ * `machnet_*()' calls, and runs the engine with `Poll()', e.g., from the
+ * thread that sends and receives, between its calls. The engine copies
+ * payloads in and out of the channel, with the default settings of the
+ * engines (i.e., no zero-copy, encryption or multipath).
+ *
+ * @attention This class is not thread-safe: `Poll()' must be called from a
+ * single thread.
+ */
+class DirectEngine {
+ public:
+  /**
+   * @brief Take a direct queue from the controller, and set up an engine and
+   * a channel on it. DPDK must be initialized as a secondary process of the
+   * controller (e.g., `--proc-type=auto' while it runs), and `machnet_init()'
+   * must have succeeded.
+   *
+   * @param local_ip The local address of the interface to take a queue of,
+   * or any interface's.
+   * @return The engine, or `nullptr' on failure (e.g., no queue is free).
+   */
+  static std::unique_ptr<DirectEngine> Create(
+      std::optional<net::Ipv4::Address> local_ip = std::nullopt) {
+    if (rte_eal_process_type() != RTE_PROC_SECONDARY) {
+      LOG(ERROR) << "Direct engines run in DPDK secondary processes.";
+      return nullptr;
+    }
+
+    // The engine's timers run on the controller's calibration of the TSC.
+    const uint64_t hz = machnet_clock_tsc_hz();
+    time::tsc_hz = hz != 0 ? hz : time::estimate_tsc_hz();
+
+    machnet_direct_queue_info_t info{};
+    if (local_ip.has_value()) info.ipv4_addr = local_ip->address.value();
+    if (machnet_direct_queue(&info) != 0) return nullptr;
+
+    // Out of the packed response, as the constructors take references.
+    const uint16_t port_id = info.port_id, queue_id = info.queue_id,
+                   queues_nr = info.queues_nr;
+    auto pmd_port =
+        std::make_shared<dpdk::PmdPort>(port_id, queues_nr, queues_nr);
+    pmd_port->InitSecondary(queue_id, info.rx_mempool, info.tx_mempool);
+
+    const net::Ipv4::Address ip_addr(info.ipv4_addr);
+    auto shared_state = std::make_shared<MachnetEngineSharedState>(
+        std::vector<uint8_t>{}, pmd_port->GetL2Addr(),
+        std::vector<net::Ipv4::Address>(1, ip_addr));
+    shared_state->EnablePortSteering(queues_nr);
+    shared_state->SetDelegate({&Resolve, &SteerListener});
+
+    auto engine = std::unique_ptr<DirectEngine>(new DirectEngine());
+    uuid_t uuid;
+    uuid_generate(uuid);
+    const std::string channel_name = utils::UUIDToString(uuid);
+    const size_t buffer_size = pmd_port->mtu() - sizeof(net::Ipv4) -
+                               sizeof(net::Udp) - sizeof(net::MachnetPktHdr);
+    if (!engine->channel_manager_.AddChannel(
+            channel_name.c_str(), ChannelManager::kDefaultRingSize,
+            ChannelManager::kDefaultRingSize,
+            ChannelManager::kDefaultBufferCount, buffer_size,
+            MACHNET_CHANNEL_RING_JRING, pmd_port->GetSocketId())) {
+      LOG(ERROR) << "Failed to create the channel of the direct engine.";
+      return nullptr;
+    }
+    engine->channel_ =
+        engine->channel_manager_.GetChannel(channel_name.c_str());
+    engine->engine_ = std::make_unique<MachnetEngine>(
+        pmd_port, queue_id, queue_id, std::move(shared_state),
+        std::vector<std::shared_ptr<shm::Channel>>{engine->channel_});
+    LOG(INFO) << "Direct engine on queue " << queue_id << " of port "
+              << port_id << " (" << ip_addr.ToString() << ")";
+    return engine;
+  }
+
+  DirectEngine(const DirectEngine &) = delete;
+  DirectEngine &operator=(const DirectEngine &) = delete;
+
+  // The channel to send and receive on with the `machnet_*()' calls.
+  void *channel_ctx() const { return channel_->ctx(); }
+
+  /**
+   * @brief Run an iteration of the engine: send the messages of the channel,
+   * and deliver the packets received to it.
+   *
+   * @return Whether the iteration did any work.
+   */
+  bool Poll() { return engine_->Run(time::rdtsc()); }
+
+  MachnetEngine *engine() const { return engine_.get(); }
+
+ private:
+  using ChannelManager = shm::ChannelManager<shm::Channel>;
+
+  DirectEngine() = default;
+
+  static std::optional<net::Ethernet::Address> Resolve(
+      const net::Ipv4::Address &local_ip, const net::Ipv4::Address &ip) {
+    uint8_t l2_addr[net::Ethernet::Address::kSize];
+    if (machnet_direct_resolve(local_ip.address.value(), ip.address.value(),
+                               l2_addr) != 1) {
+      return std::nullopt;
+    }
+    return net::Ethernet::Address(l2_addr);
+  }
+
+  static bool SteerListener(const net::Ipv4::Address &ip,
+                            const net::Udp::Port &port, bool listen) {
+    return machnet_direct_listen(ip.address.value(), port.port.value(),
+                                 listen) == 0;
+  }
+
+  ChannelManager channel_manager_{};
+  std::shared_ptr<shm::Channel> channel_{nullptr};
+  // Destroyed before the channel it serves.
+  std::unique_ptr<MachnetEngine> engine_{nullptr};
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_DIRECT_ENGINE_H_
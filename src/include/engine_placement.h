@@ -0,0 +1,112 @@
+/**
+ * @file engine_placement.h
+ * @brief Placement of channels on Machnet engines.
+ */
+#ifndef SRC_INCLUDE_ENGINE_PLACEMENT_H_
+#define SRC_INCLUDE_ENGINE_PLACEMENT_H_
+
+#include <glog/logging.h>
+#include <machnet_ctrl.h>
+
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace juggler {
+
+/**
+ * @brief Class `EnginePlacement' decides which engine serves a new channel,
+ * following the policy requested by the application
+ * (`MACHNET_PLACEMENT_*'):
+ *  - `MACHNET_PLACEMENT_LEAST_LOADED': the engine with the fewest channels.
+ *  - `MACHNET_PLACEMENT_NUMA_LOCAL': the least loaded engine on the NUMA node
+ *    of the application, or the least loaded one overall if no engine runs on
+ *    that node.
+ *  - `MACHNET_PLACEMENT_ENGINE': the engine explicitly requested.
+ *
+ * Ties are broken in favour of the engine with the lowest index, so that
+ * placement is deterministic.
+ *
+ * @attention This class is not thread-safe.
+ */
+class EnginePlacement {
+ public:
+  /**
+   * @param numa_nodes The NUMA node of each engine (-1 if unknown), indexed
+   *                   by engine.
+   */
+  explicit EnginePlacement(std::vector<int> numa_nodes)
+      : numa_nodes_(std::move(numa_nodes)), load_(numa_nodes_.size(), 0) {}
+  EnginePlacement(const EnginePlacement &) = delete;
+  EnginePlacement &operator=(const EnginePlacement &) = delete;
+
+  /**
+   * @brief Pick the engine for a new channel, and account the channel to it.
+   * @param policy    The placement policy (`MACHNET_PLACEMENT_*').
+   * @param engine_id The requested engine (`MACHNET_PLACEMENT_ENGINE' only).
+   * @param numa_node The NUMA node of the application
+   *                  (`MACHNET_PLACEMENT_NUMA_LOCAL' only).
+   * @return The index of the engine, or std::nullopt if the request cannot be
+   * satisfied (unknown policy or engine, or no engines at all).
+   */
+  std::optional<size_t> Place(uint32_t policy, uint32_t engine_id,
+                              int numa_node) {
+    std::optional<size_t> engine;
+    switch (policy) {
+      case MACHNET_PLACEMENT_LEAST_LOADED:
+        engine = LeastLoaded(kAnyNode);
+        break;
+      case MACHNET_PLACEMENT_NUMA_LOCAL:
+        engine = LeastLoaded(numa_node);
+        if (!engine.has_value()) engine = LeastLoaded(kAnyNode);
+        break;
+      case MACHNET_PLACEMENT_ENGINE:
+        if (engine_id < load_.size()) engine = engine_id;
+        break;
+      default:
+        LOG(ERROR) << "Unknown placement policy: " << policy;
+        break;
+    }
+
+    if (engine.has_value()) load_[engine.value()]++;
+    return engine;
+  }
+
+  /**
+   * @brief Release a channel previously placed on an engine with `Place()'.
+   */
+  void Release(size_t engine) {
+    CHECK_LT(engine, load_.size());
+    CHECK_GT(load_[engine], 0);
+    load_[engine]--;
+  }
+
+  // Number of engines.
+  size_t size() const { return load_.size(); }
+  // Number of channels served by an engine.
+  uint32_t load(size_t engine) const { return load_.at(engine); }
+  // NUMA node of an engine (-1 if unknown).
+  int numa_node(size_t engine) const { return numa_nodes_.at(engine); }
+
+ private:
+  static constexpr int kAnyNode = -1;
+
+  // The least loaded engine on the given NUMA node (any engine for
+  // `kAnyNode'), or std::nullopt if there is none.
+  std::optional<size_t> LeastLoaded(int numa_node) const {
+    std::optional<size_t> best;
+    for (size_t i = 0; i < load_.size(); i++) {
+      if (numa_node != kAnyNode && numa_nodes_[i] != numa_node) continue;
+      if (!best.has_value() || load_[i] < load_[best.value()]) best = i;
+    }
+    return best;
+  }
+
+  const std::vector<int> numa_nodes_;
+  std::vector<uint32_t> load_;
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_ENGINE_PLACEMENT_H_
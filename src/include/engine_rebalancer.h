@@ -0,0 +1,117 @@
+/**
+ * @file engine_rebalancer.h
+ * @brief Balancing of the load of Machnet engines, by migrating channels.
+ */
+#ifndef SRC_INCLUDE_ENGINE_REBALANCER_H_
+#define SRC_INCLUDE_ENGINE_REBALANCER_H_
+
+#include <glog/logging.h>
+
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace juggler {
+
+/**
+ * @brief Class `EngineRebalancer' decides which channel to migrate between
+ * the engines of a port, so that their load evens out. It is fed the load of
+ * the engines over the last interval, and picks at most one migration:
+ *  - From the busiest engine to the idlest one, if their utilization differs
+ *    by more than a threshold, and the busiest one serves at least two
+ *    channels (moving its only channel would just move the hotspot).
+ *  - The channel whose share of the load of the busiest engine (estimated
+ *    from the messages it exchanged) is closest to half the difference, as
+ *    moving it evens out the two engines best. Channels carrying more than the
+ *    difference are left alone, since moving them would make things worse.
+ *
+ * After a migration, the rebalancer holds off for a few intervals, for the
+ * load to settle before it is measured again.
+ *
+ * @attention This class is not thread-safe.
+ */
+class EngineRebalancer {
+ public:
+  // Minimum difference in utilization (in [0, 1]) to migrate a channel.
+  static constexpr double kDefaultThreshold = 0.2;
+  // Intervals to skip after a migration.
+  static constexpr uint32_t kDefaultCooldown = 3;
+
+  // Load of an engine over an interval.
+  struct EngineLoad {
+    // Fraction of the interval the engine was busy, in [0, 1].
+    double utilization;
+    // Messages exchanged by each of its channels.
+    std::vector<uint64_t> channel_msgs;
+  };
+
+  struct Migration {
+    size_t from;
+    size_t to;
+    // Index of the channel in `EngineLoad::channel_msgs' of `from'.
+    size_t channel;
+  };
+
+  explicit EngineRebalancer(double threshold = kDefaultThreshold,
+                            uint32_t cooldown = kDefaultCooldown)
+      : threshold_(threshold), cooldown_(cooldown) {
+    CHECK_GT(threshold_, 0);
+  }
+  EngineRebalancer(const EngineRebalancer &) = delete;
+  EngineRebalancer &operator=(const EngineRebalancer &) = delete;
+
+  /**
+   * @brief Decide on a migration, given the load of the engines over the last
+   * interval.
+   * @param engines The load of each engine, indexed by engine.
+   * @return The migration to carry out, or std::nullopt if the load is
+   * balanced enough (or the rebalancer is cooling down).
+   */
+  std::optional<Migration> Rebalance(const std::vector<EngineLoad> &engines) {
+    if (cooldown_left_ > 0) {
+      cooldown_left_--;
+      return std::nullopt;
+    }
+    if (engines.size() < 2) return std::nullopt;
+
+    size_t hot = 0, cold = 0;
+    for (size_t i = 1; i < engines.size(); i++) {
+      if (engines[i].utilization > engines[hot].utilization) hot = i;
+      if (engines[i].utilization < engines[cold].utilization) cold = i;
+    }
+    const double gap = engines[hot].utilization - engines[cold].utilization;
+    const auto &channel_msgs = engines[hot].channel_msgs;
+    if (gap < threshold_ || channel_msgs.size() < 2) return std::nullopt;
+
+    uint64_t total_msgs = 0;
+    for (const auto msgs : channel_msgs) total_msgs += msgs;
+    if (total_msgs == 0) return std::nullopt;
+
+    std::optional<size_t> best;
+    double best_distance = 0;
+    for (size_t i = 0; i < channel_msgs.size(); i++) {
+      const double load = engines[hot].utilization * channel_msgs[i] /
+                          static_cast<double>(total_msgs);
+      if (load == 0 || load >= gap) continue;
+      const double distance = std::abs(load - gap / 2);
+      if (!best.has_value() || distance < best_distance) {
+        best = i;
+        best_distance = distance;
+      }
+    }
+    if (!best.has_value()) return std::nullopt;
+
+    cooldown_left_ = cooldown_;
+    return Migration{hot, cold, best.value()};
+  }
+
+ private:
+  const double threshold_;
+  const uint32_t cooldown_;
+  uint32_t cooldown_left_{0};
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_ENGINE_REBALANCER_H_
@@ -0,0 +1,395 @@
+/**
+ * @file engine_stats.h
+ * @brief Shared-memory stats pages, where engines publish their counters for
+ * external tools (see `apps/machnet_stats').
+ */
+#ifndef SRC_INCLUDE_ENGINE_STATS_H_
+#define SRC_INCLUDE_ENGINE_STATS_H_
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <shmem.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace juggler {
+namespace stats {
+
+/*
+ * Layout of a stats page. A page starts with a `PageHeader', followed by
+ * `max_channels' `ChannelStats' and `max_flows' `FlowStats' entries. External
+ * tools rely on it: any change to the layout must bump `kPageVersion'.
+ */
+static constexpr uint32_t kPageMagic = 0x4d4e5354;  // "MNST"
+static constexpr uint32_t kPageVersion = 6;
+// Stats pages are POSIX shared memory objects, named after this prefix.
+static constexpr char kPageNamePrefix[] = "machnet-stats";
+
+// Counters of the NIC queues of an engine.
+struct QueueStats {
+  uint16_t port_id;
+  uint16_t rx_queue_id;
+  uint16_t tx_queue_id;
+  uint16_t reserved;
+  uint64_t rx_packets;
+  uint64_t rx_bytes;
+  // Packets dropped by the engine (e.g., with no flow or listener).
+  uint64_t rx_drops;
+  uint64_t tx_packets;
+  uint64_t tx_bytes;
+  uint64_t tx_bursts;
+  // Depth of the TX backlog, and packets dropped as it overflowed.
+  uint64_t tx_backlog;
+  uint64_t tx_backlog_drops;
+  // TSC cycles spent in iterations that did work.
+  uint64_t busy_cycles;
+  // Packets received with a NIC timestamp.
+  uint64_t rx_hw_timestamps;
+  // RTT samples of the flows, and their percentiles, over the last update
+  // interval of the page.
+  uint64_t rtt_samples;
+  uint64_t rtt_min_ns;
+  uint64_t rtt_p50_ns;
+  uint64_t rtt_p99_ns;
+  uint64_t rtt_p999_ns;
+  uint64_t rtt_max_ns;
+  // Memory taken by the flows (sampled every second), and the flows whose
+  // per-packet state was released as they went idle.
+  uint64_t flow_memory_bytes;
+  uint64_t flows_compacted;
+};
+
+/*
+ * Batch sizes are counted in power-of-two buckets: bucket `b' counts the
+ * batches of `[2^b, 2^(b+1))' items, the last one those of 128 items or more.
+ */
+static constexpr size_t kBatchBuckets = 8;
+static constexpr const char *kBatchBucketNames[kBatchBuckets] = {
+    "1", "2-3", "4-7", "8-15", "16-31", "32-63", "64-127", "128+"};
+
+// Bucket of a batch of `n' (non-zero) items.
+static inline size_t BatchBucket(uint32_t n) {
+  return std::min<size_t>(31 - __builtin_clz(n | 1), kBatchBuckets - 1);
+}
+
+// Counters of a channel served by an engine.
+struct ChannelStats {
+  char name[64];
+  // Messages delivered to, and received from, the application.
+  uint64_t rx_messages;
+  uint64_t tx_messages;
+  uint32_t total_buffers;
+  uint32_t free_buffers;
+  uint32_t flows;
+  uint32_t reserved;
+  // Sizes of the (non-empty) batches of messages the engine dequeued from the
+  // application.
+  uint64_t tx_batches[kBatchBuckets];
+};
+
+// State of a flow of an engine. Addresses and ports are in host byte order.
+struct FlowStats {
+  uint32_t local_ip;
+  uint32_t remote_ip;
+  uint16_t local_port;
+  uint16_t remote_port;
+  // Index of the flow's channel in the page.
+  uint16_t channel;
+  // `Flow::State'.
+  uint8_t state;
+  uint8_t reserved;
+  double cwnd;
+  uint64_t srtt_ns;
+  uint32_t snd_nxt;
+  uint32_t snd_una;
+  uint32_t rcv_nxt;
+  // Messages buffers queued at the flow, not yet sent.
+  uint32_t pending_msgbufs;
+  uint32_t fast_rexmits;
+  // Consecutive RTO retransmissions (reset when the flow makes progress).
+  uint32_t rto_rexmits;
+  // Memory taken by the flow (see `Flow::GetMemoryUsage()').
+  uint32_t memory_bytes;
+};
+
+// Latency of a stage of the messages traced by an engine (see
+// `MessageTracer'), over the last update interval of the page.
+struct TraceStageStats {
+  uint64_t samples;
+  uint64_t p50_ns;
+  uint64_t p99_ns;
+  uint64_t p999_ns;
+  uint64_t max_ns;
+};
+
+// Stages of the messages traced by an engine, in the order of
+// `MessageTracer::Stage'.
+struct TraceStats {
+  static constexpr size_t kNumStages = 5;
+  static constexpr const char *kStageNames[kNumStages] = {
+      "app_ring", "engine_tx", "wire", "reassembly", "app_dequeue"};
+  // One in every `sample_every' messages is traced (0: tracing is off).
+  uint32_t sample_every;
+  uint32_t reserved;
+  TraceStageStats stages[kNumStages];
+};
+
+// Where the main loop of an engine spends its cycles (see `CycleAccounting').
+struct LoopStats {
+  static constexpr size_t kNumStages = 8;
+  static constexpr const char *kStageNames[kNumStages] = {
+      "timers", "control", "periodic", "rx",
+      "arp",    "dequeue", "tx",       "flush"};
+  // Iterations of the loop, and those of them that did no work.
+  uint64_t iterations;
+  uint64_t empty_iterations;
+  // TSC cycles spent in empty iterations, and in each stage of the loop
+  // (estimated from one in every `sample_every' iterations).
+  uint64_t empty_cycles;
+  uint64_t stage_cycles[kNumStages];
+  uint32_t sample_every;
+  uint32_t reserved;
+  // Sizes of the (non-empty) bursts of packets received.
+  uint64_t rx_batches[kBatchBuckets];
+};
+
+// Occupancy of a packet pool of an engine (see `dpdk::PacketPool').
+struct PoolStats {
+  uint32_t capacity;
+  uint32_t avail;
+  // The fewest packets available in the pool since the engine started
+  // (sampled), and the allocations that failed for lack of packets.
+  uint32_t min_avail;
+  uint32_t reserved;
+  uint64_t alloc_failures;
+};
+
+// The packet pools of an engine: those of its RX and TX queues, and that of
+// the control packets of its TX queue (see `TxRing::AttachCtrlPool()'), if
+// any (capacity 0 otherwise).
+struct PoolsStats {
+  static constexpr size_t kNumPools = 3;
+  static constexpr const char *kPoolNames[kNumPools] = {"rx", "tx", "ctrl"};
+  PoolStats pools[kNumPools];
+};
+
+struct PageHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t max_channels;
+  uint32_t max_flows;
+  // Sequence lock: odd while the engine updates the page (see `StatsPage').
+  uint64_t seq;
+  // Wall-clock time of the last update, and the TSC frequency.
+  uint64_t timestamp_ns;
+  uint64_t tsc_hz;
+  uint32_t nb_channels;
+  uint32_t nb_flows;
+  // Flows (and channels) left out of the last update, for lack of room.
+  uint32_t flows_truncated;
+  uint32_t channels_truncated;
+  QueueStats queue;
+  TraceStats trace;
+  LoopStats loop;
+  PoolsStats pools;
+};
+
+/**
+ * @brief Name of the stats page of the engine of an RX queue.
+ */
+static inline std::string PageName(uint16_t port_id, uint16_t rx_queue_id) {
+  return utils::Format("%s-p%u-q%u", kPageNamePrefix, port_id, rx_queue_id);
+}
+
+static inline size_t PageSize(uint32_t max_channels, uint32_t max_flows) {
+  return sizeof(PageHeader) + max_channels * sizeof(ChannelStats) +
+         max_flows * sizeof(FlowStats);
+}
+
+/**
+ * @brief Class `StatsPage' is the writer side of a stats page, owned by an
+ * engine. Updates are published under a sequence lock: the writer never waits
+ * for readers; readers retry if the page changed while they were copying it
+ * (see `StatsPageReader').
+ *
+ * @attention This class is not thread-safe: the page has a single writer.
+ */
+class StatsPage {
+ public:
+  static constexpr uint32_t kDefaultMaxChannels = 64;
+  static constexpr uint32_t kDefaultMaxFlows = 4096;
+
+  /**
+   * @brief Create a stats page; a stale page of the same name (e.g., left
+   * behind by a crashed process) is replaced.
+   * @return The page, or `nullptr' on failure.
+   */
+  static std::unique_ptr<StatsPage> Create(
+      const std::string &name, uint32_t max_channels = kDefaultMaxChannels,
+      uint32_t max_flows = kDefaultMaxFlows) {
+    shm_unlink(name.c_str());
+    auto page = std::unique_ptr<StatsPage>(
+        new StatsPage(name, max_channels, max_flows));
+    if (!page->shmem_.Init()) {
+      LOG(WARNING) << "Failed to create stats page " << name;
+      return nullptr;
+    }
+    auto *header = page->header();
+    std::memset(header, 0, sizeof(*header));
+    header->magic = kPageMagic;
+    header->version = kPageVersion;
+    header->max_channels = max_channels;
+    header->max_flows = max_flows;
+    return page;
+  }
+
+  StatsPage(const StatsPage &) = delete;
+  StatsPage &operator=(const StatsPage &) = delete;
+
+  const std::string &GetName() const { return name_; }
+  uint32_t GetMaxChannels() const { return max_channels_; }
+  uint32_t GetMaxFlows() const { return max_flows_; }
+
+  /**
+   * @brief Update the page: `fill' is given the header and the arrays of
+   * channel and flow entries to fill in, and must set the number of entries in
+   * use (and the truncation counters) in the header.
+   */
+  template <typename F>
+  void Update(F &&fill) {
+    auto *header = this->header();
+    std::atomic_ref<uint64_t> seq(header->seq);
+    const auto s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    fill(header, channels(), flows());
+    seq.store(s + 2, std::memory_order_release);
+  }
+
+ private:
+  StatsPage(const std::string &name, uint32_t max_channels, uint32_t max_flows)
+      : name_(name),
+        max_channels_(max_channels),
+        max_flows_(max_flows),
+        shmem_(name, PageSize(max_channels, max_flows)) {}
+
+  PageHeader *header() { return shmem_.head_data<PageHeader *>(); }
+  ChannelStats *channels() {
+    return shmem_.head_data<ChannelStats *>(sizeof(PageHeader));
+  }
+  FlowStats *flows() {
+    return shmem_.head_data<FlowStats *>(sizeof(PageHeader) +
+                                         max_channels_ * sizeof(ChannelStats));
+  }
+
+  const std::string name_;
+  const uint32_t max_channels_;
+  const uint32_t max_flows_;
+  shm::ShMem shmem_;
+};
+
+/**
+ * @brief A consistent copy of a stats page (see `StatsPageReader::Read()').
+ */
+struct Snapshot {
+  PageHeader header;
+  std::vector<ChannelStats> channels;
+  std::vector<FlowStats> flows;
+};
+
+/**
+ * @brief Class `StatsPageReader' maps a stats page read-only, for external
+ * tools. Reading never blocks, nor slows down, the engine.
+ */
+class StatsPageReader {
+ public:
+  // Maximum number of attempts to copy a page that keeps changing.
+  static constexpr int kMaxReadTries = 1000;
+
+  StatsPageReader(const StatsPageReader &) = delete;
+  StatsPageReader &operator=(const StatsPageReader &) = delete;
+  ~StatsPageReader() {
+    if (mem_ != nullptr) munmap(const_cast<char *>(mem_), size_);
+  }
+
+  /**
+   * @brief Open a stats page.
+   * @return The reader, or `nullptr' if the page does not exist or its layout
+   * is not supported.
+   */
+  static std::unique_ptr<StatsPageReader> Open(const std::string &name) {
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(PageHeader)) {
+      close(fd);
+      return nullptr;
+    }
+    const size_t size = st.st_size;
+    void *mem = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) return nullptr;
+    auto reader = std::unique_ptr<StatsPageReader>(
+        new StatsPageReader(static_cast<const char *>(mem), size));
+
+    const auto *header = reinterpret_cast<const PageHeader *>(mem);
+    if (header->magic != kPageMagic || header->version != kPageVersion ||
+        PageSize(header->max_channels, header->max_flows) > size) {
+      LOG(WARNING) << "Unsupported stats page " << name;
+      return nullptr;
+    }
+    return reader;
+  }
+
+  /**
+   * @brief Copy the page, retrying while the engine updates it.
+   * @return False if no consistent copy could be taken.
+   */
+  bool Read(Snapshot *snapshot) const {
+    const auto *header = reinterpret_cast<const PageHeader *>(mem_);
+    std::atomic_ref<uint64_t> seq(const_cast<uint64_t &>(header->seq));
+    std::vector<char> copy(size_);
+    for (int i = 0; i < kMaxReadTries; i++) {
+      const auto s = seq.load(std::memory_order_acquire);
+      if (s & 1) continue;
+      std::memcpy(copy.data(), mem_, size_);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq.load(std::memory_order_relaxed) != s) continue;
+
+      std::memcpy(&snapshot->header, copy.data(), sizeof(PageHeader));
+      const auto &h = snapshot->header;
+      const auto *channels =
+          reinterpret_cast<const ChannelStats *>(copy.data() + sizeof(h));
+      const auto *flows =
+          reinterpret_cast<const FlowStats *>(channels + h.max_channels);
+      snapshot->channels.assign(
+          channels, channels + std::min(h.nb_channels, h.max_channels));
+      snapshot->flows.assign(flows,
+                             flows + std::min(h.nb_flows, h.max_flows));
+      return true;
+    }
+    return false;
+  }
+
+ private:
+  StatsPageReader(const char *mem, size_t size) : mem_(mem), size_(size) {}
+
+  const char *mem_;
+  const size_t size_;
+};
+
+}  // namespace stats
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_ENGINE_STATS_H_
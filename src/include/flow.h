@@ -12,27 +12,75 @@
 #include <common.h>
 #include <dpdk.h>
 #include <ether.h>
+#include <flow_cipher.h>
 #include <flow_key.h>
 #include <glog/logging.h>
 #include <ipv4.h>
+#include <latency_histogram.h>
 #include <machnet_common.h>
 #include <machnet_pkthdr.h>
+#include <message_tracer.h>
+#include <multipath.h>
 #include <packet.h>
 #include <packet_pool.h>
 #include <pmd.h>
+#include <timer_wheel.h>
+#include <ttime.h>
+#include <tx_scheduler.h>
 #include <types.h>
 #include <udp.h>
 #include <utils.h>
+#include <x86intrin.h>
 
+#include <array>
 #include <cstdint>
+#include <cstring>
+#include <memory>
 #include <optional>
 #include <queue>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace juggler {
 namespace net {
 namespace flow {
 
+/**
+ * @class RexmitBudget
+ * @brief The budget of the packets that the flows of an engine keep after
+ * sending them, to retransmit them without copying their payloads again (see
+ * `TXTracking::HoldPacket()'). A packet that is kept stays out of the TX pool
+ * until it is acknowledged; past the budget, retransmissions are prepared anew.
+ *
+ * @attention Keeping packets takes references to them, which the NIC must not
+ * assume it owns alone (i.e., no `MBUF_FAST_FREE', see
+ * `PmdPort::DisableTxFastFree()').
+ */
+class RexmitBudget {
+ public:
+  explicit RexmitBudget(uint32_t max_packets) : max_packets_(max_packets) {}
+
+  // Take one packet out of the budget, if any is left.
+  bool Take() {
+    if (held_ == max_packets_) return false;
+    held_++;
+    return true;
+  }
+  // Give back a packet taken with `Take()'.
+  void Give() {
+    DCHECK_NE(held_, 0);
+    held_--;
+  }
+
+  uint32_t max_packets() const { return max_packets_; }
+  uint32_t held() const { return held_; }
+
+ private:
+  const uint32_t max_packets_;
+  uint32_t held_{0};
+};
+
 class TXTracking {
  public:
   TXTracking() = delete;
@@ -43,15 +91,143 @@ class TXTracking {
         last_msgbuf_(nullptr),
         num_unsent_msgbufs_(0),
         num_tracked_msgbufs_(0) {}
+  ~TXTracking() { set_rexmit_budget(nullptr); }
 
   const uint32_t NumUnsentMsgbufs() const { return num_unsent_msgbufs_; }
   shm::MsgBuf* GetOldestUnackedMsgBuf() const { return oldest_unacked_msgbuf_; }
 
+  /**
+   * @return The message buffer of the unacknowledged packet `offset' packets
+   * after the oldest one. The walk down the chain starts from the oldest one,
+   * or from `from', that of the packet at `from_offset' (e.g., the last one
+   * looked up, when looking up increasing offsets).
+   */
+  shm::MsgBuf* GetUnackedMsgBuf(uint32_t offset, shm::MsgBuf* from = nullptr,
+                                uint32_t from_offset = 0) const {
+    DCHECK_LT(offset, num_tracked_msgbufs_ - num_unsent_msgbufs_);
+    auto* msgbuf = from != nullptr ? from : oldest_unacked_msgbuf_;
+    if (from == nullptr) from_offset = 0;
+    DCHECK_LE(from_offset, offset);
+    for (offset -= from_offset; offset != 0; offset--) {
+      msgbuf = channel_->GetMsgBuf(msgbuf->next());
+    }
+    return msgbuf;
+  }
+
+  // Record the (latest) transmit time of packet `seqno'.
+  void SetSendTimeNs(uint32_t seqno, uint64_t now_ns) {
+    if (send_ns_ == nullptr) [[unlikely]]  // NOLINT
+      send_ns_ = std::make_unique<SendTimes>();
+    (*send_ns_)[seqno % kWindow] = now_ns;
+  }
+  // The latest transmit time of packet `seqno', in flight.
+  uint64_t GetSendTimeNs(uint32_t seqno) const {
+    return send_ns_ != nullptr ? (*send_ns_)[seqno % kWindow] : 0;
+  }
+
+  /**
+   * @brief Keep the packets sent within `budget' (see `HoldPacket()'), or none
+   * if `nullptr'. The packets kept so far are released.
+   */
+  void set_rexmit_budget(RexmitBudget* budget) {
+    if (held_pkts_nr_ != 0) {
+      for (auto& packet : *sent_pkts_) {
+        if (packet == nullptr) continue;
+        dpdk::Packet::Free(std::exchange(packet, nullptr));
+        rexmit_budget_->Give();
+      }
+      held_pkts_nr_ = 0;
+    }
+    rexmit_budget_ = budget;
+  }
+
+  /**
+   * @brief Keep a reference to `packet', just prepared to carry packet
+   * `seqno', for retransmissions (see `GetIdlePacket()'), if the budget allows
+   * it. Packets are kept until acknowledged (see `ReleasePackets()').
+   */
+  void HoldPacket(uint32_t seqno, dpdk::Packet* packet) {
+    if (rexmit_budget_ == nullptr) return;
+    if (sent_pkts_ == nullptr) [[unlikely]]  // NOLINT
+      sent_pkts_ = std::make_unique<SentPackets>();
+    auto& slot = (*sent_pkts_)[seqno % kWindow];
+    if (slot != nullptr) return;
+    if (!rexmit_budget_->Take()) return;
+    packet->Ref();
+    slot = packet;
+    held_pkts_nr_++;
+  }
+
+  /**
+   * @return The packet kept for packet `seqno' (see `HoldPacket()'), for the
+   * caller to update its headers and send it again, if the NIC is done with
+   * it; nullptr otherwise. The packet stays kept: the caller takes a reference
+   * of its own to send it.
+   */
+  dpdk::Packet* GetIdlePacket(uint32_t seqno) const {
+    if (held_pkts_nr_ == 0) return nullptr;
+    auto* packet = (*sent_pkts_)[seqno % kWindow];
+    return packet != nullptr && packet->refcnt() == 1 ? packet : nullptr;
+  }
+
+  // Release the packets kept for the `num_acked_pkts' packets from `seqno' on,
+  // now acknowledged.
+  void ReleasePackets(uint32_t seqno, uint32_t num_acked_pkts) {
+    for (; held_pkts_nr_ != 0 && num_acked_pkts != 0; num_acked_pkts--) {
+      auto& slot = (*sent_pkts_)[seqno++ % kWindow];
+      if (slot == nullptr) continue;
+      dpdk::Packet::Free(std::exchange(slot, nullptr));
+      rexmit_budget_->Give();
+      held_pkts_nr_--;
+    }
+  }
+  uint32_t NumHeldPackets() const { return held_pkts_nr_; }
+
+  /**
+   * @brief Release the per-packet state of the window (transmit times and
+   * kept packets), if there are no packets in flight; it is allocated again
+   * on the next transmission.
+   */
+  void Compact() {
+    if (num_tracked_msgbufs_ != num_unsent_msgbufs_ || held_pkts_nr_ != 0) {
+      return;
+    }
+    send_ns_.reset();
+    sent_pkts_.reset();
+  }
+
+  // Bytes of memory allocated for the per-packet state of the window.
+  size_t GetMemoryUsage() const {
+    return (send_ns_ != nullptr ? sizeof(SendTimes) : 0) +
+           (sent_pkts_ != nullptr ? sizeof(SentPackets) : 0);
+  }
+
+  /**
+   * @brief Release the buffers of the `num_acked_pkts' oldest packets in
+   * flight, now acknowledged, and post the cookies of the messages they
+   * completed, if notified (see `MACHNET_MSGBUF_NOTIFY_DELIVERY'), in a batch.
+   */
   void ReceiveAcks(uint32_t num_acked_pkts) {
     shm::MsgBufBatch to_free;
+    std::array<uint32_t, shm::MsgBufBatch::kMaxBurst> cookies;
+    uint32_t cookies_nr = 0;
     while (num_acked_pkts) {
       auto msgbuf = oldest_unacked_msgbuf_;
       DCHECK(msgbuf != nullptr);
+      // The first buffer of a message may be released long before its last;
+      // keep the cookie until then.
+      if (msgbuf->is_first()) {
+        notify_cookie_ = msgbuf->notify_delivery() && !msgbuf->is_ref()
+                             ? std::optional<uint32_t>(msgbuf->cookie())
+                             : std::nullopt;
+      }
+      if (msgbuf->is_last() && notify_cookie_.has_value()) {
+        cookies[cookies_nr++] = *std::exchange(notify_cookie_, std::nullopt);
+        if (cookies_nr == cookies.size()) {
+          channel_->PostCompletions(cookies.data(), cookies_nr);
+          cookies_nr = 0;
+        }
+      }
       if (msgbuf != last_msgbuf_) {
         DCHECK_NE(oldest_unacked_msgbuf_, oldest_unsent_msgbuf_)
             << "Releasing an unsent msgbuf!";
@@ -60,20 +236,30 @@ class TXTracking {
         oldest_unacked_msgbuf_ = nullptr;
         last_msgbuf_ = nullptr;
       }
-      to_free.Append(msgbuf, msgbuf->index());
-      if (to_free.IsFull()) {
-        num_tracked_msgbufs_ -= to_free.GetSize();
-        CHECK(channel_->MsgBufBulkFree(&to_free));
-      }
       num_acked_pkts--;
+      num_tracked_msgbufs_--;
+      if (msgbuf->is_ref()) {
+        // The payload is shared with other flows (see
+        // `machnet_sendmsg_fanout()'): it is released by the last of them.
+        auto* shared = channel_->GetMsgBuf(msgbuf->ref());
+        Release(msgbuf, &to_free);
+        if (!shared->unref()) continue;
+        msgbuf = shared;
+      }
+      // Buffers sent zero-copy are freed once the NIC is done with them.
+      if (channel_->TxZeroCopyDeferFree(msgbuf)) continue;
+      Release(msgbuf, &to_free);
     }
 
-    num_tracked_msgbufs_ -= to_free.GetSize();
     CHECK(channel_->MsgBufBulkFree(&to_free));
+    if (cookies_nr != 0) channel_->PostCompletions(cookies.data(), cookies_nr);
   }
 
+  /**
+   * @brief Append a message, or the next chunk of the message appended last
+   * (see `machnet_sendmsg_chunk()'), to the transmit queue.
+   */
   void Append(shm::MsgBuf* msgbuf) {
-    DCHECK(msgbuf->is_first());
     // Append the message at the end of the chain of buffers, if any.
     if (last_msgbuf_ == nullptr) {
       // This is the first pending message buffer in the flow.
@@ -84,8 +270,14 @@ class TXTracking {
     } else {
       // This is not the first message buffer in the flow.
       DCHECK(oldest_unacked_msgbuf_ != nullptr);
-      // Let's enqueue the new message buffer at the end of the chain.
-      last_msgbuf_->link(msgbuf);
+      // Let's enqueue the new message buffer at the end of the chain: a chunk
+      // continues the message of the previous one.
+      if (!last_msgbuf_->is_last()) {
+        DCHECK(last_msgbuf_->has_chain() && !msgbuf->is_first());
+        last_msgbuf_->set_next(msgbuf);
+      } else {
+        last_msgbuf_->link(msgbuf);
+      }
       DCHECK(!(last_msgbuf_->is_last() && last_msgbuf_->is_sg()));
       // Update the last buffer pointer to point to the current buffer.
       last_msgbuf_ = channel_->GetMsgBuf(msgbuf->last());
@@ -119,6 +311,11 @@ class TXTracking {
   }
 
  private:
+  void Release(shm::MsgBuf* msgbuf, shm::MsgBufBatch* to_free) {
+    to_free->Append(msgbuf, msgbuf->index());
+    if (to_free->IsFull()) CHECK(channel_->MsgBufBulkFree(to_free));
+  }
+
   const uint32_t NumTrackedMsgbufs() const { return num_tracked_msgbufs_; }
   const shm::MsgBuf* GetLastMsgBuf() const { return last_msgbuf_; }
   const shm::MsgBuf* GetOldestUnsentMsgBuf() const {
@@ -144,6 +341,23 @@ class TXTracking {
 
   uint32_t num_unsent_msgbufs_;
   uint32_t num_tracked_msgbufs_;
+  // Cookie of the message being acknowledged, if its delivery is notified.
+  std::optional<uint32_t> notify_cookie_{std::nullopt};
+
+  // Transmit times of the packets in flight (there are at most
+  // `swift::Pcb::kReassemblyWindow' of them), by sequence number, for RACK
+  // loss detection (see `Flow::RackDetectLosses()').
+  static constexpr size_t kWindow = swift::Pcb::kReassemblyWindow;
+  using SendTimes = std::array<uint64_t, kWindow>;
+  using SentPackets = std::array<dpdk::Packet*, kWindow>;
+  // Both are allocated on first use, and released when the flow is idle (see
+  // `Compact()'), so that idle flows take little memory.
+  std::unique_ptr<SendTimes> send_ns_{};
+  // The packets kept for retransmissions, by sequence number likewise, within
+  // the budget of the engine (see `HoldPacket()').
+  std::unique_ptr<SentPackets> sent_pkts_{};
+  RexmitBudget* rexmit_budget_{nullptr};
+  uint32_t held_pkts_nr_{0};
 };
 
 /**
@@ -151,20 +365,42 @@ class TXTracking {
  * @brief Tracking for message buffers that are received from the network. This
  * class is handling out-of-order reception of packets, and delivers complete
  * messages to the application.
+ *
+ * Messages are delivered in order, unless the channel asked for unordered
+ * delivery (see `shm::Channel::SetUnorderedDelivery()'): then, a message is
+ * delivered as soon as all its packets are in, even if earlier packets are
+ * missing. The packets of a message have consecutive sequence numbers, from
+ * the one marked first to the one marked last (see `MachnetPktHdr::msg_flags'),
+ * so a message is complete when the reassembly buffer holds a run of packets
+ * from the one to the other. Reliability (ACKs, SACKs) is per packet either
+ * way; messages longer than the reassembly window are always delivered in
+ * order.
+ *
+ * If the channel asked for delivery in chunks (see
+ * `shm::Channel::SetStreamDelivery()'), the in-order part of a long message
+ * is delivered every `kStreamChunkPackets' packets, ahead of the rest: only
+ * the first chunk is marked first, and only the last one marked last. The
+ * application frees the buffers of the chunks as it consumes them, which
+ * reopens the window advertised to the sender.
  */
 class RXTracking {
  public:
   using MachnetPktHdr = net::MachnetPktHdr;
 
-  // 64-bit SACK bitmask => we can track up to 64 packets
-  static constexpr std::size_t kReassemblyMaxSeqnoDistance = 64;
-
-  struct reasm_queue_ent_t {
-    shm::MsgBuf* msgbuf;
-    uint64_t seqno;
-
-    reasm_queue_ent_t(shm::MsgBuf* m, uint64_t s) : msgbuf(m), seqno(s) {}
-  };
+  // Size (in packets) of the reassembly buffer, i.e., how far ahead of
+  // `rcv_nxt' out-of-order packets are buffered. Packets received in order
+  // skip the buffer, which is only allocated once a packet arrives out of
+  // order, and released when the flow is idle (see `Compact()'): setting up
+  // a flow takes no heap allocation, and idle flows take little memory.
+  static constexpr std::size_t kReassemblyWindow =
+      swift::Pcb::kReassemblyWindow;
+  static_assert(utils::is_power_of_two(kReassemblyWindow));
+  static_assert(kReassemblyWindow >= MachnetPktHdr::kSackBitmapBits);
+  // Payloads of at least this size (i.e., of jumbo frames) are copied to the
+  // application with non-temporal stores, so as not to flush the engine's
+  // working set out of its caches. Smaller ones are left in cache, from where
+  // the application's core gets them faster than from memory.
+  static constexpr std::size_t kNonTemporalCopyMin = 2048;
 
   RXTracking(const RXTracking&) = delete;
   RXTracking(uint32_t local_ip, uint16_t local_port, uint32_t remote_ip,
@@ -174,16 +410,104 @@ class RXTracking {
         remote_ip_(remote_ip),
         remote_port_(remote_port),
         channel_(CHECK_NOTNULL(channel)),
+        unordered_(channel->unordered_delivery()),
+        stream_(channel->stream_delivery()),
+        num_buffered_(0),
         cur_msg_train_head_(nullptr),
-        cur_msg_train_tail_(nullptr) {}
+        cur_msg_train_tail_(nullptr),
+        cur_msg_train_len_(0),
+        cur_msg_streamed_(false) {}
+
+  /**
+   * @return Number of out-of-order packets currently buffered.
+   */
+  std::size_t NumBuffered() const { return num_buffered_; }
+
+  // Trace the messages received (see `Flow::set_tracer()').
+  void set_tracer(MessageTracer* tracer) { tracer_ = tracer; }
+
+  /**
+   * @return Number of complete messages held back because the ring to the
+   * application was full (see `FlushUndelivered()').
+   */
+  std::size_t NumUndelivered() const {
+    return undelivered_.size() - undelivered_head_;
+  }
+
+  /**
+   * @brief Receive window to advertise to the sender (see
+   * `MachnetPktHdr::rwnd'): the number of packets from `rcv_nxt' on there is
+   * room for. Each packet takes a channel buffer, and may complete a message
+   * that takes a slot of the ring to the application; out-of-order packets
+   * hold their buffer already.
+   *
+   * All the flows of a channel share its buffers, so their windows may add up
+   * to more than the channel has; packets that find no buffer are dropped, and
+   * retransmitted by the sender (see `Add()').
+   */
+  uint16_t AdvertisedWindow() const {
+    const uint32_t free_slots = channel_->GetFreeMachnetRingSlots();
+    const uint32_t slots =
+        free_slots > NumUndelivered() ? free_slots - NumUndelivered() : 0;
+    const uint32_t room = std::min(channel_->GetFreeBufCount(), slots);
+    return std::min<uint32_t>(room + num_buffered_, kReassemblyWindow);
+  }
+
+  /**
+   * @brief Hand the messages held back while the ring to the application was
+   * full over to the application, in order, as far as the ring allows now.
+   * @return Number of messages still held back.
+   */
+  std::size_t FlushUndelivered() {
+    while (undelivered_head_ != undelivered_.size()) {
+      if (channel_->EnqueueMessages(&undelivered_[undelivered_head_], 1) != 1)
+        break;
+      undelivered_head_++;
+    }
+    if (undelivered_head_ == undelivered_.size()) {
+      undelivered_.clear();
+      undelivered_head_ = 0;
+    }
+    return NumUndelivered();
+  }
 
-  void Add(swift::Pcb* pcb, const dpdk::Packet* packet) {
+  /**
+   * @brief Release the reassembly buffer, if it holds no packets, and the
+   * room for messages held back, if there are none; they are allocated again
+   * when needed.
+   */
+  void Compact() {
+    if (num_buffered_ == 0) reasm_.reset();
+    if (undelivered_.empty()) undelivered_.shrink_to_fit();
+  }
+
+  // Bytes of memory allocated for the reassembly buffer and for the messages
+  // held back.
+  size_t GetMemoryUsage() const {
+    return (reasm_ != nullptr ? sizeof(Reassembly) : 0) +
+           undelivered_.capacity() * sizeof(shm::MsgBuf*);
+  }
+
+  // Number of in-order packets of a message that are delivered as a chunk of
+  // it, if the channel asked for delivery in chunks (see
+  // `shm::Channel::SetStreamDelivery()'). Large enough to amortize the ring
+  // operations, and small enough for the chunks to keep buffers flowing back
+  // into the advertised window.
+  static constexpr std::size_t kStreamChunkPackets = 32;
+
+  // Buffer the payload of a data packet, which ends with `trailer_len' bytes
+  // that are not part of it (see `Cipher') and arrived at `rx_ns' (see
+  // `Flow::InputPacket()'), and deliver what became complete.
+  void Add(swift::Pcb* pcb, dpdk::Packet* packet, size_t trailer_len = 0,
+           uint64_t rx_ns = 0) {
     const size_t net_hdr_len = sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp);
+    const size_t hdr_len = net_hdr_len + sizeof(MachnetPktHdr);
     const auto* machneth = packet->head_data<MachnetPktHdr*>(net_hdr_len);
-    const auto* payload =
-        packet->head_data<uint8_t*>(net_hdr_len + sizeof(MachnetPktHdr));
     const auto seqno = machneth->seqno.value();
     const auto expected_seqno = pcb->rcv_nxt;
+    if (!undelivered_.empty()) [[unlikely]] {  // NOLINT
+      FlushUndelivered();
+    }  // NOLINT
 
     if (swift::seqno_lt(seqno, expected_seqno)) [[unlikely]] {  // NOLINT
       // Packet is in the past
@@ -193,84 +517,267 @@ class RXTracking {
     }  // NOLINT
 
     const size_t distance = seqno - expected_seqno;
-    if (distance >= kReassemblyMaxSeqnoDistance) [[unlikely]] {  // NOLINT
-      LOG(ERROR) << "Packet too far ahead. Dropping as we can't handle SACK. "
+    if (distance >= kReassemblyWindow) [[unlikely]] {  // NOLINT
+      LOG(ERROR) << "Packet beyond the reassembly window. Dropping. "
                  << "seqno: " << seqno << ", expected: " << expected_seqno;
       return;
     }  // NOLINT
 
-    // Only iterate through the deque if we must, i.e., for ooo packts only
-    auto it = reass_q_.begin();
-    if (seqno != expected_seqno) {
-      it = std::find_if(reass_q_.begin(), reass_q_.end(),
-                        [&seqno](const reasm_queue_ent_t& entry) {
-                          return entry.seqno >= seqno;
-                        });
-      if (it != reass_q_.end() && it->seqno == seqno) {
-        // Packet is a duplicate.
+    // The next packet expected, with none buffered, goes straight to the
+    // message train (the common case).
+    const bool in_order = distance == 0 && num_buffered_ == 0;
+    const size_t slot = seqno & (kReassemblyWindow - 1);
+    const uint64_t slot_bit = 1ULL << (slot % 64);
+    if (!in_order) {
+      if (reasm_ == nullptr) [[unlikely]]  // NOLINT
+        reasm_ = std::make_unique<Reassembly>();
+      if (reasm_->bitmap[slot / 64] & slot_bit) {
+        // Packet is a duplicate (it may have been delivered already).
         return;
       }
     }
 
     // Buffer the packet in the SHM channel. It may be out-of-order.
-    auto* msgbuf = channel_->MsgBufAlloc();
-    CHECK_NOTNULL(msgbuf);
-    const size_t payload_len =
-        packet->length() - net_hdr_len - sizeof(MachnetPktHdr);
-    auto* msg_data = msgbuf->append<uint8_t*>(payload_len);
-    utils::Copy(CHECK_NOTNULL(msg_data), payload, msgbuf->length());
-    msgbuf->set_flags(machneth->msg_flags);
+    // If the NIC split the headers off and received the payload directly into
+    // a buffer of this channel, hand it over as-is (zero-copy RX). Otherwise,
+    // copy the payload into a new buffer.
+    const size_t payload_len = packet->length() - hdr_len - trailer_len;
+    shm::MsgBuf* msgbuf = nullptr;
+    auto* payload_seg = packet->next_segment();
+    if (payload_seg != nullptr && packet->segment_length() == hdr_len &&
+        payload_seg->segment_length() == payload_len) {
+      msgbuf = channel_->AdoptRxBuffer(payload_seg);
+    }
+    if (msgbuf == nullptr) {
+      msgbuf = channel_->MsgBufAlloc(payload_len);
+      if (msgbuf == nullptr) [[unlikely]] {  // NOLINT
+        // The application is not keeping up and the channel ran out of buffers
+        // (e.g., its other flows took the room this flow advertised). Drop the
+        // packet; the sender retransmits it.
+        channel_->CountBufferDrop();
+        LOG_EVERY_N(WARNING, 1000)
+            << "Channel " << channel_->GetName()
+            << " out of buffers, dropping packet " << seqno;
+        return;
+      }  // NOLINT
+      auto* msg_data = msgbuf->append<uint8_t*>(payload_len);
+      packet->CopyOut(CHECK_NOTNULL(msg_data), hdr_len, payload_len,
+                      payload_len >= kNonTemporalCopyMin);
+    }
+    // Messages are traced only if both ends trace them.
+    msgbuf->set_flags(tracer_ != nullptr
+                          ? machneth->msg_flags
+                          : machneth->msg_flags & ~MACHNET_MSGBUF_FLAGS_TRACE);
+    if (tracer_ != nullptr && msgbuf->is_traced()) {
+      tracer_->OnReceive(msgbuf, machneth->timestamp1.value(), rx_ns,
+                         time::rdtsc());
+    }
     msgbuf->set_src_ip(remote_ip_);
     msgbuf->set_src_port(remote_port_);
     msgbuf->set_dst_ip(local_ip_);
     msgbuf->set_dst_port(local_port_);
     DCHECK(!(msgbuf->is_last() && msgbuf->is_sg()));
 
-    if (seqno == expected_seqno) {
-      reass_q_.emplace_front(msgbuf, seqno);
-    } else {
-      reass_q_.insert(it, reasm_queue_ent_t(msgbuf, seqno));
-    }
+    if (in_order) [[likely]] {  // NOLINT
+      pcb->advance_rcv_nxt();
+      AppendToShmTrain(msgbuf);
+      return;
+    }  // NOLINT
 
-    // Update the SACK bitmap for the newly received packet.
-    pcb->sack_bitmap |= (1ULL << distance);
+    reasm_->buf[slot] = msgbuf;
+    reasm_->bitmap[slot / 64] |= slot_bit;
+    num_buffered_++;
     pcb->sack_bitmap_count++;
 
+    if (unordered_) {
+      if (msgbuf->is_first()) reasm_->first[slot / 64] |= slot_bit;
+      if (msgbuf->is_last()) reasm_->last[slot / 64] |= slot_bit;
+      DeliverCompleteMessage(pcb, seqno);
+    }
     PushInOrderMsgbufsToShmTrain(pcb);
   }
 
+  /**
+   * @brief Fill in the SACK bitmap (see `MachnetPktHdr') of an outgoing
+   * packet, relative to `rcv_nxt'. Only the first
+   * `MachnetPktHdr::kSackBitmapBits' slots of the reassembly window are
+   * reported.
+   */
+  void FillSackBitmap(const swift::Pcb* pcb, MachnetPktHdr* machneth) const {
+    const size_t mask = kReassemblyWindow - 1;
+    const size_t nwords = kReassemblyWindow / 64;
+    machneth->sack_bitmap_count = be16_t(pcb->sack_bitmap_count);
+    for (size_t w = 0; w < MachnetPktHdr::kSackBitmapWords; w++) {
+      uint64_t bits = 0;
+      if (num_buffered_ != 0) {
+        // The window starts at an arbitrary slot; stitch the 64 bits together
+        // from (up to) two words of the circular bitmap.
+        const size_t pos = (pcb->rcv_nxt + 64 * w) & mask;
+        const size_t shift = pos % 64;
+        bits = reasm_->bitmap[pos / 64] >> shift;
+        if (shift != 0) {
+          bits |= reasm_->bitmap[(pos / 64 + 1) % nwords] << (64 - shift);
+        }
+      }
+      machneth->sack_bitmap[w] = be64_t(bits);
+    }
+  }
+
  private:
-  void PushInOrderMsgbufsToShmTrain(swift::Pcb* pcb) {
-    while (!reass_q_.empty() && reass_q_.front().seqno == pcb->rcv_nxt) {
-      auto& front = reass_q_.front();
-      auto* msgbuf = front.msgbuf;
-      reass_q_.pop_front();
+  using Bitmap = std::array<uint64_t, kReassemblyWindow / 64>;
+
+  // Circular reassembly buffer indexed by sequence number (modulo its size),
+  // and a bitmap of its occupied slots. With unordered delivery, the slots of
+  // delivered packets stay marked until `rcv_nxt' moves past them, and two
+  // more bitmaps mark the slots of the first and last packets of messages.
+  struct Reassembly {
+    std::array<shm::MsgBuf*, kReassemblyWindow> buf{};
+    Bitmap bitmap{};
+    Bitmap first{};
+    Bitmap last{};
+  };
 
-      if (cur_msg_train_head_ == nullptr) {
+  /**
+   * @brief Scan the (circular) bitmap of the reassembly buffer, from the slot
+   * of sequence number `seqno' on, for a bit equal to `value'.
+   * @param n Number of slots to scan.
+   * @return The distance from `seqno' to the first match, or `n' if none.
+   */
+  static size_t ScanForward(const Bitmap& bitmap, uint32_t seqno, size_t n,
+                            bool value) {
+    size_t pos = seqno & (kReassemblyWindow - 1);
+    for (size_t done = 0; done < n;) {
+      const size_t shift = pos % 64;
+      const size_t len = std::min(64 - shift, n - done);
+      uint64_t bits = (value ? bitmap[pos / 64] : ~bitmap[pos / 64]) >> shift;
+      if (len < 64) bits &= (1ULL << len) - 1;
+      if (bits != 0) return done + __builtin_ctzll(bits);
+      done += len;
+      pos = (pos + len) & (kReassemblyWindow - 1);
+    }
+    return n;
+  }
+
+  // Same as `ScanForward()', towards lower sequence numbers.
+  static size_t ScanBackward(const Bitmap& bitmap, uint32_t seqno, size_t n,
+                             bool value) {
+    size_t pos = seqno & (kReassemblyWindow - 1);
+    for (size_t done = 0; done < n;) {
+      const size_t shift = 63 - pos % 64;
+      const size_t len = std::min(64 - shift, n - done);
+      uint64_t bits = (value ? bitmap[pos / 64] : ~bitmap[pos / 64]) << shift;
+      if (len < 64) bits &= ~0ULL << (64 - len);
+      if (bits != 0) return done + __builtin_clzll(bits);
+      done += len;
+      pos = (pos - len) & (kReassemblyWindow - 1);
+    }
+    return n;
+  }
+
+  /**
+   * @brief Deliver the message that the packet `seqno' belongs to, if all its
+   * packets are in the reassembly buffer (unordered delivery). The slots of
+   * its packets are left marked as received, so that `rcv_nxt' and the SACKs
+   * still advance packet by packet.
+   */
+  void DeliverCompleteMessage(const swift::Pcb* pcb, uint32_t seqno) {
+    // The message starts at the last packet marked first at or before
+    // `seqno', with no missing packet in between; a message that started
+    // before `rcv_nxt' is already on its way through the in-order train.
+    const size_t behind = seqno - pcb->rcv_nxt + 1;
+    const size_t hole_behind =
+        ScanBackward(reasm_->bitmap, seqno, behind, false);
+    const size_t first = ScanBackward(reasm_->first, seqno, hole_behind, true);
+    if (first == hole_behind) return;
+    // It ends at the first packet marked last at or after `seqno'.
+    const size_t ahead = pcb->rcv_nxt + kReassemblyWindow - seqno;
+    const size_t hole_ahead = ScanForward(reasm_->bitmap, seqno, ahead, false);
+    const size_t last = ScanForward(reasm_->last, seqno, hole_ahead, true);
+    if (last == hole_ahead) return;
+
+    const size_t mask = kReassemblyWindow - 1;
+    shm::MsgBuf* head = nullptr;
+    shm::MsgBuf* tail = nullptr;
+    for (uint32_t s = seqno - first; s != seqno + last + 1; s++) {
+      auto* msgbuf = std::exchange(reasm_->buf[s & mask], nullptr);
+      DCHECK(msgbuf != nullptr);
+      if (head == nullptr) {
         DCHECK(msgbuf->is_first());
-        cur_msg_train_head_ = msgbuf;
-        cur_msg_train_tail_ = msgbuf;
+        head = msgbuf;
       } else {
-        cur_msg_train_tail_->set_next(msgbuf);
-        cur_msg_train_tail_ = msgbuf;
+        tail->set_next(msgbuf);
       }
+      tail = msgbuf;
+    }
+    DCHECK(tail->is_last() && !tail->is_sg());
+    DeliverMessage(head);
+  }
 
-      if (cur_msg_train_tail_->is_last()) {
-        // We have a complete message. Let's deliver it to the application.
-        DCHECK(!cur_msg_train_tail_->is_sg());
-        auto* msgbuf_to_deliver = cur_msg_train_head_;
-        auto nr_delivered = channel_->EnqueueMessages(&msgbuf_to_deliver, 1);
-        if (nr_delivered != 1) {
-          LOG(FATAL) << "SHM channel full, failed to deliver message";
-        }
-
-        cur_msg_train_head_ = nullptr;
-        cur_msg_train_tail_ = nullptr;
-      }
+  // Hand a complete message over to the application; hold it back (behind the
+  // ones held back already) if the ring to the application is full.
+  void DeliverMessage(shm::MsgBuf* msg) {
+    if (tracer_ != nullptr && msg->is_traced()) {
+      tracer_->OnDeliver(msg, time::rdtsc());
+    }
+    if (undelivered_.empty() && channel_->EnqueueMessages(&msg, 1) == 1) return;
+    undelivered_.push_back(msg);
+  }
 
+  void PushInOrderMsgbufsToShmTrain(swift::Pcb* pcb) {
+    const size_t mask = kReassemblyWindow - 1;
+    while (num_buffered_ != 0) {
+      const size_t slot = pcb->rcv_nxt & mask;
+      const uint64_t slot_bit = 1ULL << (slot % 64);
+      if (!(reasm_->bitmap[slot / 64] & slot_bit)) break;
+      auto* msgbuf = std::exchange(reasm_->buf[slot], nullptr);
+      reasm_->bitmap[slot / 64] &= ~slot_bit;
+      reasm_->first[slot / 64] &= ~slot_bit;
+      reasm_->last[slot / 64] &= ~slot_bit;
+      num_buffered_--;
       pcb->advance_rcv_nxt();
-      pcb->sack_bitmap >>= 1;
       pcb->sack_bitmap_count--;
+      // Delivered already, along with the rest of its message (unordered
+      // delivery).
+      if (msgbuf == nullptr) continue;
+      AppendToShmTrain(msgbuf);
+    }
+  }
+
+  // Append the next in-order buffer to the train of the current message, and
+  // deliver the message (or a chunk of it) if it is complete.
+  void AppendToShmTrain(shm::MsgBuf* msgbuf) {
+    if (cur_msg_train_head_ == nullptr) {
+      // A chunk of the message may have been delivered already.
+      DCHECK_NE(msgbuf->is_first(), cur_msg_streamed_);
+      cur_msg_train_head_ = msgbuf;
+      cur_msg_train_tail_ = msgbuf;
+    } else {
+      cur_msg_train_tail_->set_next(msgbuf);
+      cur_msg_train_tail_ = msgbuf;
+    }
+    cur_msg_train_len_++;
+
+    if (cur_msg_train_tail_->is_last()) {
+      // We have a complete message. Let's deliver it to the application.
+      DCHECK(!cur_msg_train_tail_->is_sg());
+      DeliverMessage(cur_msg_train_head_);
+
+      cur_msg_train_head_ = nullptr;
+      cur_msg_train_tail_ = nullptr;
+      cur_msg_train_len_ = 0;
+      cur_msg_streamed_ = false;
+    } else if (stream_ && cur_msg_train_len_ == kStreamChunkPackets) {
+      // Deliver the in-order part of a long message as a chunk of it; its
+      // last buffer is neither marked last nor followed by another one (its
+      // flags came from the wire, where it was).
+      cur_msg_train_tail_->set_flags(cur_msg_train_tail_->flags() &
+                                     ~MACHNET_MSGBUF_FLAGS_SG);
+      DeliverMessage(cur_msg_train_head_);
+
+      cur_msg_train_head_ = nullptr;
+      cur_msg_train_tail_ = nullptr;
+      cur_msg_train_len_ = 0;
+      cur_msg_streamed_ = true;
     }
   }
 
@@ -279,9 +786,26 @@ class RXTracking {
   const uint32_t remote_ip_;
   const uint16_t remote_port_;
   shm::Channel* channel_;
-  std::deque<reasm_queue_ent_t> reass_q_;
+  const bool unordered_;
+  // Whether long messages are delivered in chunks (see `kStreamChunkPackets').
+  const bool stream_;
+  // The reassembly buffer, once a packet arrived out of order (see
+  // `Reassembly').
+  std::unique_ptr<Reassembly> reasm_{};
+  std::size_t num_buffered_;
   shm::MsgBuf* cur_msg_train_head_;
   shm::MsgBuf* cur_msg_train_tail_;
+  // Number of buffers in the train, and whether chunks of its message have
+  // been delivered already.
+  std::size_t cur_msg_train_len_;
+  bool cur_msg_streamed_;
+  // Complete messages held back while the ring to the application is full,
+  // from `undelivered_head_' on. They hold their buffers, which shrinks the
+  // advertised window until the application catches up.
+  std::vector<shm::MsgBuf*> undelivered_{};
+  std::size_t undelivered_head_{0};
+  // Tracer of the messages received, if any (see `set_tracer()').
+  MessageTracer* tracer_{nullptr};
 };
 
 /**
@@ -308,6 +832,27 @@ class Flow {
   using MachnetPktHdr = net::MachnetPktHdr;
   using ApplicationCallback =
       std::function<void(shm::Channel*, bool, const Key&)>;
+  // Invoked (from a timer) when the flow is done and should be removed.
+  using RemovalCallback = std::function<void(Flow*)>;
+  // The Ethernet, IPv4 and UDP headers of the packets of a flow.
+  struct __attribute__((packed)) NetHeaders {
+    Ethernet eth;
+    Ipv4 ipv4;
+    Udp udp;
+  };
+  static_assert(sizeof(NetHeaders) == 42);
+  // Length of the headers in front of the payload of data packets.
+  static constexpr size_t kDataHeadersLen =
+      sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp) + sizeof(MachnetPktHdr);
+  // How long to hold pending data back, while the TX ring is backpressured
+  // (see `TransmitPackets()').
+  static constexpr uint64_t kTxBackpressureRetryNs = 10000;
+  // Paced transmissions due within this much time go out right away: the
+  // timer wheel fires timers with a granularity of about that much.
+  static constexpr uint64_t kPacingSlackNs = 500;
+  // Interval at which messages held back for lack of room in the ring to the
+  // application are retried.
+  static constexpr uint64_t kDeliveryRetryNs = 10000;
 
   enum class State {
     kClosed,
@@ -342,13 +887,26 @@ class Flow {
    * @param local_l2_addr Local L2 address.
    * @param remote_l2_addr Remote L2 address.
    * @param txring TX ring to send packets to.
+   * @param callback Callback invoked when the flow is established or fails to.
+   * @param ack_every ACK coalescing factor (see `kDefaultAckEvery').
+   * @param pacing_burst Burst size of paced transmissions (see
+   * `kDefaultPacingBurst'), or 0 to pace only windows below one packet.
+   * @param num_paths Number of network paths to spread the data packets over
+   * (see `Multipath').
+   * @param encryption_key Pre-shared key to encrypt the flow's packets with
+   * (see `Cipher'), if any.
+   * @param timer_wheel Timer wheel of the engine, for the flow's timers.
+   * @param removal_callback Callback invoked when the flow should be removed.
    * @param channel Shared memory channel this flow is associated with.
    */
   Flow(const Ipv4::Address& local_addr, const Udp::Port& local_port,
        const Ipv4::Address& remote_addr, const Udp::Port& remote_port,
        const Ethernet::Address& local_l2_addr,
        const Ethernet::Address& remote_l2_addr, dpdk::TxRing* txring,
-       ApplicationCallback callback, shm::Channel* channel)
+       ApplicationCallback callback, uint32_t ack_every, uint32_t pacing_burst,
+       uint8_t num_paths, const std::optional<crypto::Key>& encryption_key,
+       TimerWheel* timer_wheel, RemovalCallback removal_callback,
+       shm::Channel* channel)
       : key_(local_addr, local_port, remote_addr, remote_port),
         local_l2_addr_(local_l2_addr),
         remote_l2_addr_(remote_l2_addr),
@@ -360,8 +918,22 @@ class Flow {
         tx_tracking_(CHECK_NOTNULL(channel)),
         rx_tracking_(local_addr.address.value(), local_port.port.value(),
                      remote_addr.address.value(), remote_port.port.value(),
-                     CHECK_NOTNULL(channel)) {
+                     CHECK_NOTNULL(channel)),
+        ack_every_(ack_every),
+        pacing_burst_(pacing_burst),
+        multipath_(num_paths > 1 ? std::make_unique<Multipath>(num_paths)
+                                 : nullptr),
+        cipher_(encryption_key.has_value()
+                    ? std::make_unique<Cipher>(encryption_key.value())
+                    : nullptr),
+        timer_wheel_(CHECK_NOTNULL(timer_wheel)),
+        removal_callback_(std::move(removal_callback)),
+        rto_timer_([this](uint64_t) { OnRtoTimeout(); }),
+        tlp_timer_([this](uint64_t) { OnTlpTimeout(); }),
+        pacing_timer_([this](uint64_t) { TransmitPackets(); }),
+        delivery_timer_([this](uint64_t) { OnDeliveryRetry(); }) {
     CHECK_NOTNULL(txring_->GetPacketPool());
+    BuildHeaderTemplate();
   }
   ~Flow() {}
   /**
@@ -386,6 +958,110 @@ class Flow {
    */
   State state() const { return state_; }
 
+  // Congestion control state of the flow.
+  const swift::Pcb& pcb() const { return pcb_; }
+  // Number of message buffers queued at the flow, not yet sent.
+  uint32_t GetPendingMsgbufCount() const {
+    return tx_tracking_.NumUnsentMsgbufs();
+  }
+
+  /**
+   * @brief Release the state that only transfers in progress need (the
+   * per-packet state of the windows, see `TXTracking::Compact()' and
+   * `RXTracking::Compact()'), if the flow neither sent nor received a packet
+   * since the last call. It is allocated again when the flow resumes.
+   * @return Bytes of memory released.
+   */
+  size_t CompactIfIdle() {
+    if (std::exchange(active_, false)) return 0;
+    const size_t usage = GetMemoryUsage();
+    tx_tracking_.Compact();
+    rx_tracking_.Compact();
+    return usage - GetMemoryUsage();
+  }
+
+  // Bytes of memory taken by the flow: the object itself, and the state it
+  // allocated (see `CompactIfIdle()').
+  size_t GetMemoryUsage() const {
+    return sizeof(*this) + tx_tracking_.GetMemoryUsage() +
+           rx_tracking_.GetMemoryUsage() +
+           (multipath_ != nullptr ? sizeof(Multipath) : 0) +
+           (cipher_ != nullptr ? sizeof(Cipher) : 0);
+  }
+
+  /**
+   * @brief Record the RTT samples of the flow in a histogram (e.g., of its
+   * engine), or stop recording them if `nullptr'.
+   */
+  void set_rtt_histogram(LatencyHistogram* histogram) {
+    rtt_histogram_ = histogram;
+  }
+
+  /**
+   * @brief Trace the messages of the flow that are sampled for tracing (see
+   * `MessageTracer'), or stop tracing them if `nullptr'.
+   */
+  void set_tracer(MessageTracer* tracer) {
+    tracer_ = tracer;
+    rx_tracking_.set_tracer(tracer);
+  }
+
+  /**
+   * @brief Keep the packets sent, for copy-free retransmissions, within the
+   * budget of the flow's engine (see `RexmitBudget'), or stop keeping them if
+   * `nullptr'.
+   */
+  void set_rexmit_budget(RexmitBudget* budget) {
+    tx_tracking_.set_rexmit_budget(budget);
+  }
+
+  /**
+   * @brief Update the L2 address of the remote end of the flow (e.g., after
+   * its ARP entry changed), for the packets sent from now on.
+   */
+  void SetRemoteL2Addr(const Ethernet::Address& remote_l2_addr) {
+    remote_l2_addr_ = remote_l2_addr;
+    hdr_template_.eth.dst_addr = remote_l2_addr;
+  }
+
+  /**
+   * @brief Prefetch the flow state that is touched when an incoming packet is
+   * processed (i.e., the PCB and the TX/RX tracking state).
+   */
+  void Prefetch() const {
+    rte_prefetch0(&state_);
+    rte_prefetch0(&pcb_);
+    rte_prefetch0(&tx_tracking_);
+    rte_prefetch0(&rx_tracking_);
+  }
+
+  /**
+   * @brief Schedule the flow for a delayed ACK, to be sent (at the latest) by
+   * `FlushDelayedAck()' at the end of the current RX burst.
+   *
+   * @return true if the flow owes an ACK to the remote end and was not already
+   * scheduled; the caller must then call `FlushDelayedAck()' on this flow.
+   */
+  bool ScheduleDelayedAck() {
+    if (unacked_pkts_ == 0 || ack_scheduled_) return false;
+    ack_scheduled_ = true;
+    return true;
+  }
+
+  /**
+   * @brief Send the pending delayed ACK, if it has not been sent (or
+   * piggybacked on outgoing data) in the meantime.
+   */
+  void FlushDelayedAck() {
+    ack_scheduled_ = false;
+    if (unacked_pkts_ == 0) return;
+    if (state_ == State::kEstablished) [[likely]] {  // NOLINT
+      SendAck();
+    } else {
+      unacked_pkts_ = 0;
+    }
+  }
+
   std::string ToString() const {
     return utils::Format(
         "%s [%s] <-> [%s]\n\t\t\t%s\n\t\t\t[TX Queue] Pending "
@@ -417,11 +1093,58 @@ class Flow {
   void InitiateHandshake() {
     CHECK(state_ == State::kClosed);
     SendSyn(pcb_.get_snd_nxt());
-    pcb_.rto_reset();
+    RtoArm();
     state_ = State::kSynSent;
   }
 
+  /**
+   * @brief Unbind the flow from its engine, before it migrates to another one
+   * (see `Adopt()'). Its timers are disarmed, so that they do not fire on the
+   * old engine; whether they were armed is remembered, to re-arm them on the
+   * new one.
+   *
+   * @attention Must be called from the thread of the old engine.
+   */
+  void Detach() {
+    DCHECK(!ack_scheduled_);
+    rto_was_armed_ = rto_timer_.armed();
+    pacing_was_armed_ = pacing_timer_.armed();
+    rto_timer_.Disarm();
+    tlp_timer_.Disarm();
+    pacing_timer_.Disarm();
+    delivery_timer_.Disarm();
+    rtt_histogram_ = nullptr;
+    set_tracer(nullptr);
+    // The packets kept are of the old engine's pool.
+    set_rexmit_budget(nullptr);
+  }
+
+  /**
+   * @brief Bind a detached flow (see `Detach()') to a new engine. The RTO
+   * restarts from now, and paced transmissions resume right away.
+   *
+   * @attention Must be called from the thread of the new engine.
+   */
+  void Adopt(dpdk::TxRing* txring, TimerWheel* timer_wheel,
+             RemovalCallback removal_callback) {
+    txring_ = CHECK_NOTNULL(txring);
+    timer_wheel_ = CHECK_NOTNULL(timer_wheel);
+    removal_callback_ = std::move(removal_callback);
+    CHECK_NOTNULL(txring_->GetPacketPool());
+    if (rto_was_armed_) RtoArm();
+    TlpMaybeArm();
+    if (pacing_was_armed_) timer_wheel_->Arm(&pacing_timer_, time::rdtsc());
+    if (rx_tracking_.NumUndelivered() != 0) DeliveryRetryArm();
+    rto_was_armed_ = pacing_was_armed_ = false;
+  }
+
   void ShutDown() {
+    // The flow is about to be removed by the engine.
+    rto_timer_.Disarm();
+    tlp_timer_.Disarm();
+    pacing_timer_.Disarm();
+    delivery_timer_.Disarm();
+    set_rexmit_budget(nullptr);
     switch (state_) {
       case State::kClosed:
         break;
@@ -430,7 +1153,6 @@ class Flow {
       case State::kSynReceived:
         [[fallthrough]];
       case State::kEstablished:
-        pcb_.rto_disable();
         SendRst();
         state_ = State::kClosed;
         break;
@@ -449,8 +1171,13 @@ class Flow {
    * transport-related parameters for the flow.
    *
    * @param packet Pointer to the allocated packet on the rx ring of the driver
+   * @param rx_ns  Arrival time of the packet, in nanoseconds on the TSC time
+   *               base (e.g., its NIC timestamp, see `dpdk::NicClock'); 0 if
+   *               unknown, to use the current time.
    */
-  void InputPacket(const dpdk::Packet* packet) {
+  void InputPacket(dpdk::Packet* packet, uint64_t rx_ns = 0) {
+    rx_ns_ = rx_ns != 0 ? rx_ns : Now();
+    active_ = true;
     // Parse the Machnet header of the packet.
     const size_t net_hdr_len = sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp);
     auto* machneth = packet->head_data<MachnetPktHdr*>(net_hdr_len);
@@ -463,6 +1190,20 @@ class Flow {
     } // NOLINT
     // clang-format on
 
+    // Past the handshake, the packets of an encrypted flow must be authentic;
+    // their payload is decrypted in place.
+    const bool handshake =
+        machneth->net_flags == MachnetPktHdr::MachnetFlags::kSyn ||
+        machneth->net_flags == MachnetPktHdr::MachnetFlags::kSynAck;
+    if (cipher_ != nullptr && !handshake) {
+      const bool authentic = cipher_->established() && cipher_->Open(packet);
+      if (!authentic) [[unlikely]] {  // NOLINT
+        LOG_EVERY_N(WARNING, 1000)
+            << "Dropping unauthenticated packet of flow " << key_.ToString();
+        return;
+      }  // NOLINT
+    }
+
     switch (machneth->net_flags) {
       case MachnetPktHdr::MachnetFlags::kSyn:
         // SYN packet received. For this to be valid it has to be an already
@@ -474,10 +1215,21 @@ class Flow {
         }
 
         if (state_ == State::kClosed) {
+          // An encrypted flow takes its keys from the nonce of the SYN.
+          if (cipher_ != nullptr) {
+            const auto* nonce = HandshakePayload(packet, Cipher::kNonceSize);
+            if (nonce == nullptr) {
+              LOG(WARNING) << "Rejecting unencrypted flow " << key_.ToString();
+              timer_wheel_->Arm(&rto_timer_, time::rdtsc());
+              return;
+            }
+            cipher_->Establish(nonce, false);
+          }
           // If the flow is in closed state, we need to send a SYN-ACK packetj
           // and mark the flow as established.
           pcb_.rcv_nxt = machneth->seqno.value();
           pcb_.advance_rcv_nxt();
+          UpdateTimestampEcho(machneth);
           SendSynAck(pcb_.get_snd_nxt());
           state_ = State::kSynReceived;
         } else if (state_ == State::kSynReceived) {
@@ -502,11 +1254,33 @@ class Flow {
           return;
         }
 
+        if (state_ == State::kSynSent && cipher_ != nullptr) {
+          const auto* payload =
+              HandshakePayload(packet, Cipher::kSynAckPayloadSize);
+          if (payload == nullptr) {
+            LOG(WARNING) << "Remote end of flow " << key_.ToString()
+                         << " does not encrypt";
+            FailHandshake();
+            return;
+          }
+          // The nonces may have been tampered with on the way: the flow would
+          // then be up with keys that do not match those of the remote end.
+          cipher_->Establish(payload, true);
+          if (!cipher_->VerifySynAckMac(payload + Cipher::kNonceSize)) {
+            LOG(WARNING) << "Handshake of flow " << key_.ToString()
+                         << " failed authentication";
+            FailHandshake();
+            return;
+          }
+        }
         if (state_ == State::kSynSent) {
+          // Take the first RTT sample from the handshake.
+          pcb_.OnAck(Now(), 0, RttSample(machneth),
+                     machneth->remote_delay.value());
           pcb_.snd_una++;
           pcb_.rcv_nxt = machneth->seqno.value();
           pcb_.advance_rcv_nxt();
-          pcb_.rto_maybe_reset();
+          RtoMaybeArm();
           // Mark the flow as established.
           state_ = State::kEstablished;
           // Notify the application that the flow is established.
@@ -519,8 +1293,11 @@ class Flow {
         const auto seqno = machneth->seqno.value();
         const auto expected_seqno = pcb_.rcv_nxt;
         if (swift::seqno_eq(seqno, expected_seqno)) {
-          // If the RST packet is in sequence, we can reset the flow.
+          // If the RST packet is in sequence, we can reset the flow. CLOSED
+          // state is terminal; have the flow removed right away.
           state_ = State::kClosed;
+          pacing_timer_.Disarm();
+          timer_wheel_->Arm(&rto_timer_, time::rdtsc());
         }
       } break;
       case MachnetPktHdr::MachnetFlags::kAck:
@@ -528,7 +1305,12 @@ class Flow {
         // update_flow(machneth);
         process_ack(machneth);
         break;
-      case MachnetPktHdr::MachnetFlags::kData:
+      case MachnetPktHdr::MachnetFlags::kDataAck:
+        // Data packet with a piggybacked ACK. Process the ACK first, as it
+        // might be the one completing the handshake.
+        process_ack(machneth);
+        [[fallthrough]];
+      case MachnetPktHdr::MachnetFlags::kData: {
         // clang-format off
         if (state_ != State::kEstablished) [[unlikely]] { // NOLINT
           // clang-format on
@@ -537,9 +1319,27 @@ class Flow {
           return;
         }
         // Data packet, process the payload.
-        rx_tracking_.Add(&pcb_, packet);
-        SendAck();
-        break;
+        const auto prev_rcv_nxt = pcb_.rcv_nxt;
+        const auto prev_ooo = pcb_.sack_bitmap_count;
+        rx_tracking_.Add(&pcb_, packet,
+                         cipher_ != nullptr ? Cipher::kTrailerSize : 0, rx_ns_);
+        UpdateTimestampEcho(machneth);
+        unacked_pkts_++;
+        if (rx_tracking_.NumUndelivered() != 0 && !delivery_timer_.armed())
+            [[unlikely]] {  // NOLINT
+          DeliveryRetryArm();
+        }  // NOLINT
+
+        // In-order packets are acknowledged lazily (see `ack_every_'). Any
+        // other packet (out-of-order, filling a hole, or a duplicate) changes
+        // the SACK state or leaves `rcv_nxt' untouched, and is acknowledged
+        // immediately so as not to delay loss recovery at the sender.
+        const bool in_order = pcb_.rcv_nxt != prev_rcv_nxt &&
+                              prev_ooo == 0 && pcb_.sack_bitmap_count == 0;
+        if (!in_order || (ack_every_ != 0 && unacked_pkts_ >= ack_every_)) {
+          SendAck();
+        }
+      } break;
     }
   }
 
@@ -551,36 +1351,49 @@ class Flow {
    *
    * @param msg Pointer to the first message buffer on a train of buffers,
    * aggregating to a partial or a full Message.
+   * @param transmit Whether to transmit right away; otherwise the message is
+   * only queued, until `TransmitPending()' is called.
    */
-  void OutputMessage(shm::MsgBuf* msg) {
+  void OutputMessage(shm::MsgBuf* msg, bool transmit = true) {
     tx_tracking_.Append(msg);
 
-    // TODO(ilias): We first need to check whether the cwnd is < 1, so that we
-    // fallback to rate-based CC.
-
-    // Calculate the effective window (in # of packets) to check whether we can
-    // send more packets.
-    TransmitPackets();
+    // Send as many packets as the congestion window allows; if the window is
+    // fractional, this falls back to pacing (see `TransmitPackets()').
+    if (transmit) TransmitPackets();
   }
 
   /**
-   * @brief Periodically checks the state of the flow and performs necessary
-   * actions.
-   *
-   * This method is called periodically to check the state of the flow, update
-   * the RTO timer, retransmit unacknowledged messages, and potentially remove
-   * the flow or notify the application about the connection state.
+   * @brief Transmit pending data (see `OutputMessage()'), as the congestion
+   * window allows.
    *
-   * @return Returns true if the flow should continue to be checked
-   * periodically, false if the flow should be removed or closed.
+   * @param max_packets Maximum number of packets to transmit.
+   * @return The number of packets transmitted, and whether the flow has more
+   * packets that it could transmit right away.
    */
-  bool PeriodicCheck() {
-    // CLOSED state is terminal; the engine might remove the flow.
-    if (state_ == State::kClosed) return false;
+  std::pair<uint32_t, bool> TransmitPending(uint32_t max_packets) {
+    const auto sent = TransmitPackets(max_packets);
+    const bool pending = tx_tracking_.NumUnsentMsgbufs() != 0 &&
+                         EffectiveWnd() != 0 && !paced();
+    return {sent, pending};
+  }
 
-    if (pcb_.rto_disabled()) return true;
+  // State of the flow in the TX scheduler of the engine, and its weight.
+  TxSchedState& tx_sched_state() { return tx_sched_state_; }
+  uint32_t tx_weight() const { return channel_->tx_weight(); }
+
+ private:
+  /**
+   * @brief Handle the expiration of the RTO timer: retransmit the oldest
+   * unacknowledged packet, or remove the flow if it is closed or has exhausted
+   * its retransmissions.
+   */
+  void OnRtoTimeout() {
+    // CLOSED state is terminal.
+    if (state_ == State::kClosed) {
+      Remove();
+      return;
+    }
 
-    pcb_.rto_advance();
     if (pcb_.max_rexmits_reached()) {
       if (state_ == State::kSynSent) {
         // Notify the application that the flow has not been established.
@@ -588,51 +1401,219 @@ class Flow {
         callback_(channel(), false, key());
       }
       // TODO(ilias): Send RST packet.
+      Remove();
+      return;
+    }
 
-      // Indicate removal of the flow.
-      return false;
+    if (state_ == State::kEstablished && pcb_.zero_window()) {
+      // The receiver is alive, but out of room: probe it for a window update
+      // with the oldest unacknowledged packet. This is not a loss, so neither
+      // the window nor the RTO backs off.
+      RetransmitPacket(tx_tracking_.GetOldestUnackedMsgBuf(), pcb_.snd_una);
+      RtoArm();
+      return;
     }
 
-    if (pcb_.rto_expired()) {
-      // Retransmit the oldest unacknowledged message buffer.
-      RTORetransmit();
+    // Retransmit the oldest unacknowledged message buffer.
+    pcb_.OnRto(Now());
+    if (multipath_ != nullptr) multipath_->OnLoss(pcb_.snd_una, Now(), true);
+    RTORetransmit();
+  }
+
+  /**
+   * @brief Handle the expiration of the TLP timer: no ACK has come for a PTO
+   * (see `swift::Pcb::pto_ns()') while data is in flight, e.g., as the last
+   * packets of a message were lost, and no later delivery reveals it. Send a
+   * tail loss probe, whose ACK lets RACK detect the losses (see
+   * `RackDetectLosses()') in about an RTT, instead of waiting for the RTO: a
+   * new packet if the windows let one out, or else the last packet again. The
+   * window does not back off, as nothing is known to be lost yet.
+   */
+  void OnTlpTimeout() {
+    if (state_ != State::kEstablished || pcb_.snd_una == pcb_.snd_nxt ||
+        pcb_.zero_window()) {
+      return;
     }
+    // A single probe, until an ACK reports a new delivery.
+    tlp_outstanding_ = true;
+    pcb_.tlp_probes++;
+    if (tx_tracking_.NumUnsentMsgbufs() != 0 && TransmitPackets(1) != 0) return;
 
-    return true;
+    const uint32_t offset = pcb_.snd_nxt - 1 - pcb_.snd_una;
+    RetransmitPacket(tx_tracking_.GetUnackedMsgBuf(offset), pcb_.snd_nxt - 1);
   }
 
- private:
-  void PrepareL2Header(dpdk::Packet* packet) {
-    auto* eh = packet->head_data<Ethernet*>();
-    eh->src_addr = local_l2_addr_;
-    eh->dst_addr = remote_l2_addr_;
-    eh->eth_type = be16_t(Ethernet::kIpv4);
-    packet->set_l2_len(sizeof(*eh));
-  }
-
-  void PrepareL3Header(dpdk::Packet* packet) {
-    // Prepare the L3 header.
-    auto* ipv4h = packet->head_data<Ipv4*>(sizeof(Ethernet));
-    ipv4h->version_ihl = 0x45;
-    ipv4h->type_of_service = 0;
-    ipv4h->packet_id = be16_t(0x1513);
-    ipv4h->fragment_offset = be16_t(0);
-    ipv4h->time_to_live = 64;
-    ipv4h->next_proto_id = Ipv4::Proto::kUdp;
-    ipv4h->total_length = be16_t(packet->length() - sizeof(Ethernet));
-    ipv4h->src_addr = key_.local_addr;
-    ipv4h->dst_addr = key_.remote_addr;
-    ipv4h->hdr_checksum = 0;
-    packet->set_l3_len(sizeof(*ipv4h));
-  }
-
-  void PrepareL4Header(dpdk::Packet* packet) {
-    // Prepare the L4 header.
-    auto* udph = packet->head_data<Udp*>(sizeof(Ethernet) + sizeof(Ipv4));
-    udph->src_port = key_.local_port;
-    udph->dst_port = key_.remote_port;
-    udph->len = be16_t(packet->length() - sizeof(Ethernet) - sizeof(Ipv4));
-    udph->cksum = be16_t(0);
+  /**
+   * @brief Handle the expiration of the delivery timer: retry handing over the
+   * messages held back for lack of room in the ring to the application. Once
+   * they are through, tell the sender about the room made (its window may have
+   * closed meanwhile).
+   */
+  void OnDeliveryRetry() {
+    if (rx_tracking_.FlushUndelivered() != 0) {
+      DeliveryRetryArm();
+      return;
+    }
+    if (state_ == State::kEstablished) SendAck();
+  }
+
+  void DeliveryRetryArm() {
+    timer_wheel_->Arm(&delivery_timer_,
+                      time::rdtsc() + time::ns_to_cycles(kDeliveryRetryNs));
+  }
+
+  // Stop the flow's timers and ask the engine to remove the flow.
+  void Remove() {
+    rto_timer_.Disarm();
+    tlp_timer_.Disarm();
+    pacing_timer_.Disarm();
+    delivery_timer_.Disarm();
+    set_rexmit_budget(nullptr);
+    if (removal_callback_) removal_callback_(this);
+  }
+
+  // (Re-)arm the RTO timer, to expire one RTO from now.
+  void RtoArm() {
+    timer_wheel_->Arm(&rto_timer_,
+                      time::rdtsc() + time::ns_to_cycles(pcb_.rto_ns()));
+  }
+
+  // Arm the RTO timer if there is unacknowledged data, disarm it otherwise.
+  void RtoMaybeArm() {
+    if (pcb_.snd_una == pcb_.snd_nxt)
+      rto_timer_.Disarm();
+    else
+      RtoArm();
+  }
+
+  // (Re-)arm the TLP timer, to expire one PTO from now, if data is in flight
+  // with no probe outstanding, and no RTO has fired (then, the RTO backs off
+  // instead); disarm it otherwise.
+  void TlpMaybeArm() {
+    if (state_ != State::kEstablished || pcb_.snd_una == pcb_.snd_nxt ||
+        tlp_outstanding_ || pcb_.rto_rexmits != 0) {
+      tlp_timer_.Disarm();
+      return;
+    }
+    timer_wheel_->Arm(&tlp_timer_,
+                      time::rdtsc() + time::ns_to_cycles(pcb_.pto_ns()));
+  }
+
+  // Current time in nanoseconds, as used for CC timestamps.
+  static uint64_t Now() { return time::cycles_to_ns(time::rdtsc()); }
+
+  // Remember the timestamp of a received packet, to echo it back to the sender
+  // with the next ACK.
+  void UpdateTimestampEcho(const MachnetPktHdr* machneth) {
+    const auto ts = machneth->timestamp1.value();
+    if (ts == 0) return;
+    pcb_.ts_echo = ts;
+    pcb_.ts_echo_rx_ns = rx_ns_;
+    pcb_.ts_echo_path = machneth->path;
+  }
+
+  // RTT sample carried by an ACK (0 if none), measured up to the arrival of
+  // the ACK.
+  uint64_t RttSample(const MachnetPktHdr* machneth) {
+    const auto echo = machneth->timestamp2.value();
+    if (echo == 0 || rx_ns_ <= echo) return 0;
+    const auto rtt = rx_ns_ - echo;
+    if (rtt_histogram_ != nullptr) rtt_histogram_->Record(rtt);
+    return rtt;
+  }
+
+  // The payload of a SYN (the nonce of the initiator) or SYN-ACK (see
+  // `Cipher::kSynAckPayloadSize') of an encrypted flow, or `nullptr' if it is
+  // shorter than `len'.
+  static const uint8_t* HandshakePayload(const dpdk::Packet* packet,
+                                         size_t len) {
+    if (packet->length() < kDataHeadersLen + len ||
+        packet->segment_length() < kDataHeadersLen + len) {
+      return nullptr;
+    }
+    return packet->head_data<const uint8_t*>(kDataHeadersLen);
+  }
+
+  // Give up on a connection whose SYN-ACK is not acceptable: notify the
+  // application, and have the flow removed.
+  void FailHandshake() {
+    callback_(channel(), false, key());
+    state_ = State::kClosed;
+    timer_wheel_->Arm(&rto_timer_, time::rdtsc());
+  }
+
+  // Stamp the transmit time of a packet, and echo the timestamp of the last
+  // data packet received.
+  void PrepareTimestamps(MachnetPktHdr* machneth, uint64_t now_ns) const {
+    machneth->timestamp1 = be64_t(now_ns);
+    machneth->timestamp2 = be64_t(pcb_.ts_echo);
+    machneth->echo_path = pcb_.ts_echo_path;
+    // The arrival time may be a NIC timestamp, slightly off the TSC.
+    const auto remote_delay =
+        pcb_.ts_echo == 0 || now_ns < pcb_.ts_echo_rx_ns
+            ? 0
+            : now_ns - pcb_.ts_echo_rx_ns;
+    machneth->remote_delay = be32_t(static_cast<uint32_t>(
+        std::min<uint64_t>(remote_delay, UINT32_MAX)));
+  }
+
+  // Fill in the template of the network headers of the flow's packets (see
+  // `PrepareNetHeaders()'); lengths are set per packet.
+  void BuildHeaderTemplate() {
+    auto& t = hdr_template_;
+    t = NetHeaders{};
+    t.eth.src_addr = local_l2_addr_;
+    t.eth.dst_addr = remote_l2_addr_;
+    t.eth.eth_type = be16_t(Ethernet::kIpv4);
+    t.ipv4.version_ihl = 0x45;
+    t.ipv4.type_of_service = 0;
+    t.ipv4.packet_id = be16_t(0x1513);
+    t.ipv4.fragment_offset = be16_t(0);
+    t.ipv4.time_to_live = 64;
+    t.ipv4.next_proto_id = Ipv4::Proto::kUdp;
+    t.ipv4.src_addr = key_.local_addr;
+    t.ipv4.dst_addr = key_.remote_addr;
+    t.ipv4.hdr_checksum = 0;
+    t.udp.src_port = key_.local_port;
+    t.udp.dst_port = key_.remote_port;
+    t.udp.cksum = be16_t(0);
+  }
+
+  /**
+   * @brief Write the Ethernet, IPv4 and UDP headers of a packet, whose length
+   * is final, from the flow's template: the 42 bytes of headers are copied
+   * with three (overlapping) 16-byte stores, and only the lengths are patched.
+   *
+   * @param path The path of the packet (see `Multipath').
+   * @param dscp The DSCP to mark the packet with, for the fabric to honor the
+   * priority of its message (see `MACHNET_DSCP_PRIO').
+   */
+  void PrepareNetHeaders(dpdk::Packet* packet, uint8_t path = 0,
+                         uint8_t dscp = 0) {
+    static_assert(sizeof(NetHeaders) > 32 && sizeof(NetHeaders) <= 48);
+    constexpr size_t kTail = sizeof(NetHeaders) - 16;
+    auto* dst = packet->head_data<uint8_t*>();
+    const auto* src = reinterpret_cast<const uint8_t*>(&hdr_template_);
+    const __m128i v0 = _mm_load_si128(reinterpret_cast<const __m128i*>(src));
+    const __m128i v1 =
+        _mm_load_si128(reinterpret_cast<const __m128i*>(src + 16));
+    const __m128i v2 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + kTail));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), v0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), v1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + kTail), v2);
+
+    auto* hdrs = reinterpret_cast<NetHeaders*>(dst);
+    const uint16_t len = packet->length();
+    hdrs->ipv4.total_length = be16_t(len - sizeof(Ethernet));
+    hdrs->udp.len = be16_t(len - sizeof(Ethernet) - sizeof(Ipv4));
+    if (path != 0) {
+      hdrs->udp.src_port = Udp::Port(
+          Multipath::PathPort(key_.local_port.port.value(), path));
+    }
+    if (dscp != 0) hdrs->ipv4.type_of_service = dscp << 2;
+    packet->set_l2_len(sizeof(Ethernet));
+    packet->set_l3_len(sizeof(Ipv4));
     packet->offload_udpv4_csum();
   }
 
@@ -646,26 +1627,49 @@ class Flow {
     machneth->msg_flags = msg_flags;
     machneth->seqno = be32_t(seqno);
     machneth->ackno = be32_t(pcb_.ackno());
-    machneth->sack_bitmap = be64_t(pcb_.sack_bitmap);
-    machneth->sack_bitmap_count = be16_t(pcb_.sack_bitmap_count);
-    machneth->timestamp1 = be64_t(0);
+    rx_tracking_.FillSackBitmap(&pcb_, machneth);
+    machneth->rwnd = be16_t(rx_tracking_.AdvertisedWindow());
+    machneth->path = 0;
+    PrepareTimestamps(machneth, Now());
   }
 
   void SendControlPacket(uint32_t seqno,
                          const MachnetPktHdr::MachnetFlags& flags) {
-    auto* packet = CHECK_NOTNULL(txring_->GetPacketPool()->PacketAlloc());
+    auto* packet = CHECK_NOTNULL(txring_->GetCtrlPacketPool()->PacketAlloc());
     dpdk::Packet::Reset(packet);
 
     const size_t kControlPacketSize =
         sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp) + sizeof(MachnetPktHdr);
-    CHECK_NOTNULL(packet->append(kControlPacketSize));
-    PrepareL2Header(packet);
-    PrepareL3Header(packet);
-    PrepareL4Header(packet);
+    // The SYN and SYN-ACK of an encrypted flow carry the nonce of their end,
+    // and the SYN-ACK the MAC of the handshake too; the other packets are
+    // sealed, once the keys are set up.
+    const bool syn = flags == MachnetPktHdr::MachnetFlags::kSyn;
+    const bool syn_ack = flags == MachnetPktHdr::MachnetFlags::kSynAck;
+    const bool sealed = cipher_ != nullptr && !syn && !syn_ack &&
+                        cipher_->established();
+    size_t extra_len = 0;
+    if (cipher_ != nullptr) {
+      extra_len = syn       ? Cipher::kNonceSize
+                  : syn_ack ? Cipher::kSynAckPayloadSize
+                  : sealed  ? Cipher::kTrailerSize
+                            : 0;
+    }
+    auto* payload = CHECK_NOTNULL(packet->append<uint8_t*>(
+        kControlPacketSize + extra_len)) + kControlPacketSize;
+    PrepareNetHeaders(packet);
     PrepareMachnetHdr(packet, seqno, flags);
+    if (cipher_ != nullptr && (syn || syn_ack)) {
+      std::memcpy(payload, cipher_->local_nonce().data(), Cipher::kNonceSize);
+      if (syn_ack) {
+        const auto mac = cipher_->SynAckMac();
+        std::memcpy(payload + Cipher::kNonceSize, mac.data(), Cipher::kMacSize);
+      }
+    } else if (sealed) {
+      cipher_->Seal({packet, nullptr, 0});
+    }
 
     // Send the packet.
-    txring_->SendPackets(&packet, 1);
+    txring_->BufferPacket(packet);
   }
 
   void SendSyn(uint32_t seqno) {
@@ -679,6 +1683,7 @@ class Flow {
 
   void SendAck() {
     SendControlPacket(pcb_.seqno(), MachnetPktHdr::MachnetFlags::kAck);
+    unacked_pkts_ = 0;
   }
 
   void SendRst() {
@@ -693,32 +1698,39 @@ class Flow {
    * @param buf Pointer to the message buffer to be sent.
    * @param packet Pointer to an allocated packet.
    * @param seqno Sequence number of the packet.
+   * @param now_ns Transmit time to stamp the packet with.
+   * @param seal_op With encryption, where to queue the packet to be sealed
+   * along with the rest of its batch (see `Cipher::Seal()'); the packet is
+   * sealed right away if `nullptr'.
    */
   template <CopyMode copy_mode>
   void PrepareDataPacket(shm::MsgBuf* msg_buf, dpdk::Packet* packet,
-                         uint32_t seqno) {
+                         uint32_t seqno, uint64_t now_ns = Now(),
+                         Cipher::SealOp* seal_op = nullptr) {
     DCHECK(!(msg_buf->is_last() && msg_buf->is_sg()));
-    // Header length after before the payload.
-    const size_t hdr_length =
-        (sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp) + sizeof(MachnetPktHdr));
-    const uint32_t pkt_len = hdr_length + msg_buf->length();
-    CHECK_LE(pkt_len - sizeof(Ethernet), dpdk::PmdRing::kDefaultFrameSize);
+    // The payload may be that of a buffer shared with other flows.
+    auto* payload_buf = channel_->GetPayloadMsgBuf(msg_buf);
+    const size_t hdr_length = kDataHeadersLen;
+    const size_t trailer_length =
+        cipher_ != nullptr ? Cipher::kTrailerSize : 0;
+    const uint32_t pkt_len =
+        hdr_length + payload_buf->length() + trailer_length;
+    CHECK_LE(pkt_len - sizeof(Ethernet), txring_->GetPmdPort()->mtu());
 
     if constexpr (copy_mode == CopyMode::kMemCopy) {
-      // In this mode we memory copy the packet payload.
-
-      // We reset the allocated packet here. This is because if `FAST_FREE'
-      // offload is enabled, the DPDK driver will not free any EXT buffers
-      // attached to the mbuf which could lead to problems.
-      // For the zerocopy mode, we do not need to reset it because we do all the
-      // necessary initialization in the `attach_extbuf` method.
-      dpdk::Packet::Reset(packet);
-
-      // Allocate packet space.
+      // In this mode we memory copy the packet payload. Packets come out of
+      // the pool with their own buffer, even if a zero-copy packet returned
+      // to it through `FAST_FREE' (see `PacketPool').
       CHECK_NOTNULL(packet->append(pkt_len));
     } else {
       // In this mode we zero-copy the packet payload, by attaching the message
-      // buffer.
+      // buffer. The headers are written in the headroom of the buffer; this is
+      // only done for the first transmission (retransmissions copy), so they
+      // are never rewritten while the NIC may be reading them. Encrypted
+      // payloads, and payloads shared with other flows (whose headers would
+      // share the headroom), are always copied (see `TransmitPackets()').
+      DCHECK(cipher_ == nullptr);
+      DCHECK(!msg_buf->is_ref());
 
       // Move the message buffer into the packet.
       auto* buf_va = msg_buf->base();
@@ -728,53 +1740,172 @@ class Flow {
       const auto buf_data_len = msg_buf->length();
 
       packet->attach_extbuf(buf_va, buf_iova, buf_len, buf_data_ofs,
-                            buf_data_len, channel_->GetMbufExtShinfo());
+                            buf_data_len, channel_->TxZeroCopyAttach(msg_buf));
       CHECK_NOTNULL(packet->prepend(hdr_length));
     }
 
+    auto* machneth = PrepareDataHeaders(msg_buf, packet, seqno, now_ns);
+
+    if constexpr (copy_mode == CopyMode::kMemCopy) {
+      if (cipher_ != nullptr) {
+        // Encrypt the payload into the packet, instead of copying it.
+        const Cipher::SealOp op{packet, payload_buf->head_data(),
+                                payload_buf->length()};
+        if (seal_op != nullptr) {
+          *seal_op = op;
+        } else {
+          cipher_->Seal(op);
+        }
+        return;
+      }
+      // Copy the payload.
+      auto* payload = reinterpret_cast<uint8_t*>(machneth + 1);
+      utils::Copy(payload, payload_buf->head_data(), payload_buf->length());
+    }
+  }
+
+  /**
+   * @brief Write the headers of data packet `seqno', that carries `msg_buf',
+   * in `packet' (whose payload is in place, or written next), and record its
+   * transmission at `now_ns'.
+   *
+   * @return The Machnet header of the packet.
+   */
+  MachnetPktHdr* PrepareDataHeaders(shm::MsgBuf* msg_buf, dpdk::Packet* packet,
+                                    uint32_t seqno, uint64_t now_ns) {
+    // Record the transmit time, for RACK. New packets go out in sequence order;
+    // a retransmission breaks it (see `swift::Pcb::rexmit_end').
+    active_ = true;
+    tx_tracking_.SetSendTimeNs(seqno, now_ns);
+    if (seqno != pcb_.snd_nxt - 1 && swift::seqno_ge(seqno, pcb_.rexmit_end))
+      pcb_.rexmit_end = seqno + 1;
+
+    // Send the packet on the path with the most room (see `Multipath').
+    uint8_t path = 0;
+    if (multipath_ != nullptr) {
+      path = multipath_->PickPath();
+      multipath_->OnSend(seqno, path);
+    }
+
     // Prepare network headers.
-    PrepareL2Header(packet);
-    PrepareL3Header(packet);
-    PrepareL4Header(packet);
+    PrepareNetHeaders(packet, path, msg_buf->is_prio() ? MACHNET_DSCP_PRIO : 0);
 
     // Prepare the Machnet-specific header.
     auto* machneth = packet->head_data<MachnetPktHdr*>(
         sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp));
     machneth->magic = be16_t(MachnetPktHdr::kMagic);
-    machneth->net_flags = MachnetPktHdr::MachnetFlags::kData;
-    machneth->ackno = be32_t(UINT32_MAX);
-    machneth->msg_flags = msg_buf->flags();
+    // Piggyback the ACK for the reverse direction on every data packet; this
+    // also covers any delayed ACK that is pending for the flow.
+    machneth->net_flags = MachnetPktHdr::MachnetFlags::kDataAck;
+    machneth->ackno = be32_t(pcb_.ackno());
+    rx_tracking_.FillSackBitmap(&pcb_, machneth);
+    machneth->rwnd = be16_t(rx_tracking_.AdvertisedWindow());
+    unacked_pkts_ = 0;
+    machneth->msg_flags = msg_buf->flags() & ~MACHNET_MSGBUF_FLAGS_REF;
     DCHECK(!(msg_buf->is_last() && msg_buf->is_sg()));
+    if (tracer_ != nullptr && msg_buf->is_traced()) {
+      tracer_->OnTransmit(msg_buf, time::rdtsc());
+    }
 
-    // machneth->msg_id = be32_t(msg_id_);
     machneth->seqno = be32_t(seqno);
-    machneth->timestamp1 = be64_t(0);
+    machneth->path = path;
+    PrepareTimestamps(machneth, now_ns);
+    return machneth;
+  }
 
-    if constexpr (copy_mode == CopyMode::kMemCopy) {
-      // Copy the payload.
-      auto* payload = reinterpret_cast<uint8_t*>(machneth + 1);
-      utils::Copy(payload, msg_buf->head_data(), msg_buf->length());
+  /**
+   * @brief Retransmit data packet `seqno', that carries `msg_buf'. The packet
+   * of its last transmission is sent again with its headers updated, if the
+   * flow kept it (see `TXTracking::HoldPacket()') and the NIC is done with
+   * it; otherwise, the packet is prepared anew, copying its payload.
+   */
+  void RetransmitPacket(shm::MsgBuf* msg_buf, uint32_t seqno,
+                        uint64_t now_ns = Now()) {
+    auto* packet = tx_tracking_.GetIdlePacket(seqno);
+    if (packet != nullptr) {
+      PrepareDataHeaders(msg_buf, packet, seqno, now_ns);
+      // The flow keeps its reference; the NIC takes this one.
+      packet->Ref();
+    } else {
+      packet = CHECK_NOTNULL(txring_->GetPacketPool()->PacketAlloc());
+      PrepareDataPacket<CopyMode::kMemCopy>(msg_buf, packet, seqno, now_ns);
+      HoldPacket(seqno, packet);
     }
+    txring_->BufferPacket(packet);
   }
 
-  void FastRetransmit() {
-    // Retransmit the oldest unacknowledged message buffer.
-    auto* packet = CHECK_NOTNULL(txring_->GetPacketPool()->PacketAlloc());
-    PrepareDataPacket<CopyMode::kMemCopy>(tx_tracking_.GetOldestUnackedMsgBuf(),
-                                          packet, pcb_.snd_una);
-    txring_->SendPackets(&packet, 1);
-    pcb_.rto_reset();
-    pcb_.fast_rexmits++;
-    LOG(INFO) << "Fast retransmitting packet " << pcb_.snd_una;
+  // Keep a packet just prepared by copy, for its retransmissions. Encrypted
+  // packets are not kept: their headers are authenticated along with the
+  // payload, and they are sealed anew.
+  void HoldPacket(uint32_t seqno, dpdk::Packet* packet) {
+    if (cipher_ == nullptr) tx_tracking_.HoldPacket(seqno, packet);
+  }
+
+  /**
+   * @brief RACK loss detection (RFC 8985): retransmit the packets in flight
+   * that were sent more than a reordering window before the most recently sent
+   * packet known to be delivered (see `swift::Pcb::rack_xmit_ns'), as they
+   * would have been delivered by now had they not been lost. A retransmission
+   * takes a new transmit time, so it is deemed lost in turn only once a packet
+   * sent after it is delivered.
+   *
+   * Unlike counting duplicate ACKs, a single ACK is enough to repair any
+   * number of holes, whatever the size of the window; losses that no later
+   * delivery reveals (e.g., at the tail of a message) are left to tail loss
+   * probes (see `OnTlpTimeout()').
+   *
+   * @param machneth The Machnet header of the ACK, whose SACK bitmap (relative
+   * to `snd_una') tells the packets delivered out of order.
+   */
+  void RackDetectLosses(const MachnetPktHdr* machneth) {
+    const auto reorder_window_ns = pcb_.reorder_window_ns();
+    if (state_ != State::kEstablished ||
+        pcb_.rack_xmit_ns <= reorder_window_ns) {
+      return;
+    }
+    const uint64_t lost_before_ns = pcb_.rack_xmit_ns - reorder_window_ns;
+    // Delivery is only known within the range of the SACK bitmap.
+    const uint32_t range = std::min<uint32_t>(pcb_.snd_nxt - pcb_.snd_una,
+                                              MachnetPktHdr::kSackBitmapBits);
+    const auto now = Now();
+    shm::MsgBuf* msgbuf = nullptr;
+    uint32_t msgbuf_offset = 0, num_lost = 0;
+    bool done = false;
+    for (uint32_t w = 0; !done && 64 * w < range; w++) {
+      uint64_t holes = ~machneth->sack_bitmap[w].value();
+      if (range - 64 * w < 64) holes &= (1ULL << (range - 64 * w)) - 1;
+      for (; holes != 0; holes &= holes - 1) {
+        const uint32_t offset = 64 * w + __builtin_ctzll(holes);
+        const uint32_t seqno = pcb_.snd_una + offset;
+        if (tx_tracking_.GetSendTimeNs(seqno) >= lost_before_ns) {
+          // Not lost (yet). From `rexmit_end' on, the packets that follow were
+          // sent after this one: none of them is lost either.
+          done = swift::seqno_ge(seqno, pcb_.rexmit_end);
+          if (done) break;
+          continue;
+        }
+        // Bound the burst; the other lost packets go on the next ACK.
+        done = num_lost == dpdk::PacketBatch::kMaxBurst;
+        if (done) break;
+
+        if (multipath_ != nullptr) multipath_->OnLoss(seqno, now, false);
+        msgbuf = tx_tracking_.GetUnackedMsgBuf(offset, msgbuf, msgbuf_offset);
+        msgbuf_offset = offset;
+        RetransmitPacket(msgbuf, seqno, now);
+        num_lost++;
+      }
+    }
+    if (num_lost == 0) return;
+
+    pcb_.OnFastRetransmit(now);
+    pcb_.fast_rexmits += num_lost;
+    RtoArm();
   }
 
   void RTORetransmit() {
     if (state_ == State::kEstablished) {
       LOG(INFO) << "RTO retransmitting data packet " << pcb_.snd_una;
-      auto* packet = CHECK_NOTNULL(txring_->GetPacketPool()->PacketAlloc());
-      PrepareDataPacket<CopyMode::kMemCopy>(
-          tx_tracking_.GetOldestUnackedMsgBuf(), packet, pcb_.snd_una);
-      txring_->SendPackets(&packet, 1);
+      RetransmitPacket(tx_tracking_.GetOldestUnackedMsgBuf(), pcb_.snd_una);
     } else if (state_ == State::kSynReceived) {
       SendSynAck(pcb_.snd_una);
     } else if (state_ == State::kSynSent) {
@@ -782,19 +1913,53 @@ class Flow {
       // Retransmit the SYN packet.
       SendSyn(pcb_.snd_una);
     }
-    pcb_.rto_reset();
+    // Back off (see `swift::Pcb::rto_ns()').
     pcb_.rto_rexmits++;
+    RtoArm();
   }
 
   /**
    * @brief Helper function to transmit a number of packets from the queue of
    * pending TX data.
+   *
+   * @param max_packets Maximum number of packets to transmit.
+   * @return Number of packets transmitted.
    */
-  void TransmitPackets() {
-    auto remaining_packets =
-        std::min(pcb_.effective_wnd(), tx_tracking_.NumUnsentMsgbufs());
-    if (remaining_packets == 0) return;
+  uint32_t TransmitPackets(uint32_t max_packets = UINT32_MAX) {
+    auto remaining_packets = std::min(
+        {EffectiveWnd(), tx_tracking_.NumUnsentMsgbufs(), max_packets});
+    if (remaining_packets == 0) return 0;
+
+    // The NIC is falling behind, and the TX ring is backlogging packets: hold
+    // new data back (retransmissions and ACKs still go out), and try again
+    // shortly, from the pacing timer.
+    if (txring_->IsBackpressured()) [[unlikely]] {  // NOLINT
+      if (!pacing_timer_.armed()) {
+        timer_wheel_->Arm(&pacing_timer_,
+                          time::rdtsc() +
+                              time::ns_to_cycles(kTxBackpressureRetryNs));
+      }
+      return 0;
+    }
+
+    const auto now = Now();
+    if (paced()) {
+      // Send a burst (a single packet, with a fractional window), once the
+      // pacing delay of the previous one has elapsed; the pacing timer sends
+      // the next one. Deadlines within a tick of the timer wheel are due.
+      if (now + kPacingSlackNs < pcb_.next_tx_ns) {
+        if (!pacing_timer_.armed()) {
+          timer_wheel_->Arm(&pacing_timer_,
+                            time::rdtsc() +
+                                time::ns_to_cycles(pcb_.next_tx_ns - now));
+        }
+        return 0;
+      }
+      const uint32_t burst = pcb_.pacing_enabled() ? 1 : pacing_burst_;
+      remaining_packets = std::min(remaining_packets, burst);
+    }
 
+    uint32_t sent = 0;
     do {
       // Allocate a packet batch.
       dpdk::PacketBatch batch;
@@ -802,96 +1967,114 @@ class Flow {
           std::min(remaining_packets, static_cast<uint32_t>(batch.GetRoom()));
       if (!txring_->GetPacketPool()->PacketBulkAlloc(&batch, pkt_cnt)) {
         LOG(ERROR) << "Failed to allocate packet batch";
-        return;
+        break;
       }
 
-      // Prepare the packets.
+      // Prepare the packets. Encrypted payloads are sealed into the packets
+      // for the whole batch at once, with no zero-copy: the message buffers
+      // must stay in the clear for retransmissions.
+      Cipher::SealOp seal_ops[dpdk::PacketBatch::kMaxBurst];
+      uint16_t nb_seal_ops = 0;
       for (uint16_t i = 0; i < batch.GetSize(); i++) {
         auto msg = tx_tracking_.GetAndUpdateOldestUnsent();
         if (!msg.has_value()) break;
         auto* msg_buf = msg.value();
         auto* packet = batch.pkts()[i];
-        if (kShmZeroCopyEnabled) {
+        if (cipher_ == nullptr && !msg_buf->is_ref() &&
+            channel_->IsTxZeroCopy(msg_buf) &&
+            msg_buf->data_offset() >= kDataHeadersLen) {
           PrepareDataPacket<CopyMode::kZeroCopy>(msg_buf, packet,
-                                                pcb_.get_snd_nxt());
+                                                 pcb_.get_snd_nxt(), now);
         } else {
-          PrepareDataPacket<CopyMode::kMemCopy>(msg_buf, packet,
-                                                pcb_.get_snd_nxt());
+          const uint32_t seqno = pcb_.get_snd_nxt();
+          PrepareDataPacket<CopyMode::kMemCopy>(
+              msg_buf, packet, seqno, now,
+              cipher_ != nullptr ? &seal_ops[nb_seal_ops++] : nullptr);
+          HoldPacket(seqno, packet);
         }
       }
+      if (nb_seal_ops != 0) cipher_->Seal(seal_ops, nb_seal_ops);
 
       // TX.
-      txring_->SendPackets(&batch);
+      txring_->BufferPackets(&batch);
       remaining_packets -= pkt_cnt;
+      sent += pkt_cnt;
     } while (remaining_packets);
 
-    if (pcb_.rto_disabled()) pcb_.rto_enable();
+    if (sent != 0) {
+      if (!rto_timer_.armed()) RtoArm();
+      TlpMaybeArm();
+    }
+    if (paced() && sent != 0) {
+      // At `cwnd / srtt', the burst takes `sent * srtt / cwnd' to go out.
+      const auto delay_ns = sent * PacingDelayNs();
+      pcb_.next_tx_ns = now + delay_ns;
+      if (tx_tracking_.NumUnsentMsgbufs() != 0 && EffectiveWnd() != 0) {
+        timer_wheel_->Arm(&pacing_timer_,
+                          time::rdtsc() + time::ns_to_cycles(delay_ns));
+      }
+    }
+    return sent;
+  }
+
+  // Whether transmissions are paced (see `TransmitPackets()'). The paths of
+  // multipath flows have windows of at least one packet.
+  bool paced() const {
+    return pacing_burst_ != 0 ||
+           (multipath_ == nullptr && pcb_.pacing_enabled());
+  }
+
+  // Inter-packet gap of paced transmissions.
+  uint64_t PacingDelayNs() const {
+    if (multipath_ == nullptr) return pcb_.pacing_delay_ns();
+    return multipath_->pacing_delay_ns(pcb_.srtt_ns);
+  }
+
+  // Number of packets that the congestion window(s) and the receiver let the
+  // flow send right now.
+  uint32_t EffectiveWnd() const {
+    if (multipath_ == nullptr) return pcb_.effective_wnd();
+    return std::min(multipath_->effective_wnd(), pcb_.receiver_wnd());
   }
 
+  /**
+   * @brief Process the acknowledgement carried by a packet (a pure ACK, or a
+   * data packet): free the acknowledged packets, and detect losses (see
+   * `RackDetectLosses()').
+   *
+   * @param machneth The Machnet header of the packet.
+   */
   void process_ack(const MachnetPktHdr* machneth) {
     auto ackno = machneth->ackno.value();
-    if (swift::seqno_lt(ackno, pcb_.snd_una)) {
-      return;
-    } else if (swift::seqno_eq(ackno, pcb_.snd_una)) {
-      // Duplicate ACK.
-      pcb_.duplicate_acks++;
-      // Update the number of out-of-order acknowledgements.
-      pcb_.snd_ooo_acks = machneth->sack_bitmap_count.value();
-
-      if (pcb_.duplicate_acks < swift::Pcb::kRexmitThreshold) {
-        // We have not reached the threshold yet, so we do not do anything.
-      } else if (pcb_.duplicate_acks == swift::Pcb::kRexmitThreshold) {
-        // Fast retransmit.
-        FastRetransmit();
-      } else {
-        // We have already done the fast retransmit, so we are now in the
-        // fast recovery phase. We need to send a new packet for every ACK we
-        // get.
-        auto sack_bitmap = machneth->sack_bitmap.value();
-        auto sack_bitmap_count = machneth->sack_bitmap_count.value();
-
-        // First we check the SACK bitmap to see if there are more undelivered
-        // packets. In fast recovery mode we get after a fast retransmit, and
-        // for every new ACKnowledgement we get, we send a new packet.
-        // Up until we get the first new acknowledgement, for the next in-order
-        // packet, the SACK bitmap will likely keep expanding.
-        // In order to avoid retransmitting multiple times other missing packets
-        // in the bitmap, we skip holes: we use the number of duplicate ACKs to
-        // skip previous holes.
-        auto* msgbuf = tx_tracking_.GetOldestUnackedMsgBuf();
-        size_t holes_to_skip =
-            pcb_.duplicate_acks - swift::Pcb::kRexmitThreshold;
-        size_t index = 0;
-        while (sack_bitmap_count) {
-          if ((sack_bitmap & (1ULL << index)) == 0) {
-            // We found a missing packet.
-            // We skip holes in the SACK bitmap that have already been
-            // retransmitted.
-            if (holes_to_skip-- == 0) {
-              auto seqno = pcb_.snd_una + index;
-              auto* packet_pool = txring_->GetPacketPool();
-              auto* packet = CHECK_NOTNULL(packet_pool->PacketAlloc());
-              PrepareDataPacket<CopyMode::kMemCopy>(msgbuf, packet, seqno);
-              txring_->SendPackets(&packet, 1);
-              pcb_.rto_reset();
-              return;
-            }
-          } else {
-            sack_bitmap_count--;
-          }
-          index++;
-          msgbuf = channel_->GetMsgBuf(msgbuf->next());
-        }
-        // There is no other missing segment to retransmit, so we could send new
-        // packets.
-      }
-      // clang-format off
-    } else if (swift::seqno_gt(ackno, pcb_.snd_nxt)) [[unlikely]] { // NOLINT
+    if (swift::seqno_lt(ackno, pcb_.snd_una)) return;
+    // clang-format off
+    if (swift::seqno_gt(ackno, pcb_.snd_nxt)) [[unlikely]] { // NOLINT
       // clang-format on
       LOG(ERROR) << "ACK received for untransmitted data.";
-      // clang-format off
-    } else [[likely]] { // NOLINT
-      // clang-format on
+      TransmitPackets();
+      return;
+    }
+    const auto prev_rwnd = pcb_.rwnd;
+    pcb_.rwnd = machneth->rwnd.value();
+    // Every ACK echoes the transmit time of the last data packet delivered.
+    const auto echo = machneth->timestamp2.value();
+    if (echo > pcb_.rack_xmit_ns) {
+      pcb_.rack_xmit_ns = echo;
+      tlp_outstanding_ = false;
+    }
+
+    if (swift::seqno_eq(ackno, pcb_.snd_una)) {
+      // Nothing new is acknowledged. The replies of a receiver out of room to
+      // window probes (see `OnRtoTimeout()') say nothing about losses; nor do
+      // the window updates that unblock a sender limited by the receive
+      // window.
+      const bool window_update = pcb_.rwnd > prev_rwnd &&
+                                 pcb_.snd_nxt - pcb_.snd_una >= prev_rwnd;
+      if (pcb_.zero_window() || window_update) {
+        if (pcb_.rwnd > prev_rwnd) TransmitPackets();
+        return;
+      }
+    } else {
       // This is a valid ACK, acknowledging new data.
       size_t num_acked_packets = ackno - pcb_.snd_una;
       if (state_ == State::kSynReceived) {
@@ -899,20 +2082,35 @@ class Flow {
         num_acked_packets--;
       }
       tx_tracking_.ReceiveAcks(num_acked_packets);
+      tx_tracking_.ReleasePackets(ackno - num_acked_packets, num_acked_packets);
+      const auto now = Now();
+      const auto rtt_ns = RttSample(machneth);
+      const auto remote_delay_ns = machneth->remote_delay.value();
+      pcb_.OnAck(now, num_acked_packets, rtt_ns, remote_delay_ns);
+      if (multipath_ != nullptr) {
+        multipath_->OnAck(now, pcb_.snd_una, ackno, rtt_ns, remote_delay_ns,
+                          machneth->echo_path);
+      }
       pcb_.snd_una = ackno;
-      pcb_.duplicate_acks = 0;
-      pcb_.snd_ooo_acks = 0;
+      if (swift::seqno_lt(pcb_.rexmit_end, ackno)) pcb_.rexmit_end = ackno;
       pcb_.rto_rexmits = 0;
-      pcb_.rto_maybe_reset();
+      tlp_outstanding_ = false;
+      RtoMaybeArm();
     }
 
+    // Packets SACKed by the receiver have left the network.
+    pcb_.snd_ooo_acks = machneth->sack_bitmap_count.value();
+    if (!pcb_.zero_window()) RackDetectLosses(machneth);
+    TlpMaybeArm();
     TransmitPackets();
   }
 
   const Key key_;
   // A flow is identified by the 5-tuple (Proto is always UDP).
   const Ethernet::Address local_l2_addr_;
-  const Ethernet::Address remote_l2_addr_;
+  Ethernet::Address remote_l2_addr_;
+  // Network headers of the packets of the flow (see `PrepareNetHeaders()').
+  alignas(16) NetHeaders hdr_template_;
   // Flow state.
   State state_;
   // Pointer to the TX ring for the flow to send packets on.
@@ -925,6 +2123,44 @@ class Flow {
   swift::Pcb pcb_;
   TXTracking tx_tracking_;
   RXTracking rx_tracking_;
+  // ACK coalescing factor (0: ACK only at the end of RX bursts).
+  const uint32_t ack_every_;
+  // Burst size of paced transmissions (0: pace only fractional windows).
+  const uint32_t pacing_burst_;
+  // Congestion state of the paths of a multipath flow (`nullptr' if the flow
+  // has a single path, that of `pcb_').
+  const std::unique_ptr<Multipath> multipath_;
+  // Keys of an encrypted flow (`nullptr' if the flow is not encrypted).
+  const std::unique_ptr<Cipher> cipher_;
+  // Number of data packets received since the last ACK was sent.
+  uint32_t unacked_pkts_{0};
+  // Whether the engine will call `FlushDelayedAck()' on this flow.
+  bool ack_scheduled_{false};
+  // Arrival time of the packet being processed (see `InputPacket()').
+  uint64_t rx_ns_{0};
+  // Whether the flow sent or received a packet since the last
+  // `CompactIfIdle()'.
+  bool active_{true};
+  // Histogram of the RTT samples, if any (see `set_rtt_histogram()').
+  LatencyHistogram* rtt_histogram_{nullptr};
+  // Tracer of the messages of the flow, if any (see `set_tracer()').
+  MessageTracer* tracer_{nullptr};
+  // Timer wheel of the engine, and the flow's timers armed on it.
+  TimerWheel* timer_wheel_;
+  RemovalCallback removal_callback_;
+  Timer rto_timer_;
+  // Sends tail loss probes (see `OnTlpTimeout()').
+  Timer tlp_timer_;
+  Timer pacing_timer_;
+  // Retries the delivery of messages held back by `rx_tracking_'.
+  Timer delivery_timer_;
+  // Whether the timers were armed when the flow was detached from its engine
+  // (see `Detach()').
+  bool rto_was_armed_{false};
+  bool pacing_was_armed_{false};
+  // Whether a tail loss probe was sent, with no new delivery reported since.
+  bool tlp_outstanding_{false};
+  TxSchedState tx_sched_state_{};
 };
 
 }  // namespace flow
@@ -936,9 +2172,7 @@ namespace std {
 template <>
 struct hash<juggler::net::flow::Flow> {
   size_t operator()(const juggler::net::flow::Flow& flow) const {
-    const auto& key = flow.key();
-    return juggler::utils::hash<uint64_t>(reinterpret_cast<const char*>(&key),
-                                          sizeof(key));
+    return std::hash<juggler::net::flow::Key>{}(flow.key());
   }
 };
 
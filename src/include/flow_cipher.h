@@ -0,0 +1,249 @@
+/**
+ * @file flow_cipher.h
+ * @brief Authenticated encryption of the packets of a flow, with per-flow keys
+ * set up during the handshake.
+ */
+#ifndef SRC_INCLUDE_FLOW_CIPHER_H_
+#define SRC_INCLUDE_FLOW_CIPHER_H_
+
+#include <aes_gcm.h>
+#include <ether.h>
+#include <glog/logging.h>
+#include <ipv4.h>
+#include <machnet_pkthdr.h>
+#include <packet.h>
+#include <types.h>
+#include <udp.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace juggler {
+namespace net {
+namespace flow {
+
+/**
+ * @brief Class `Cipher' seals and opens the packets of a flow with AES-128-GCM.
+ *
+ * The two ends of a flow share a pre-shared key (`psk'), configured on their
+ * interfaces. Each end draws a random nonce, sent in the payload of its SYN (or
+ * SYN-ACK); both then derive a key per direction from the PSK and the two
+ * nonces, so that every flow encrypts under keys of its own.
+ *
+ * The nonces travel in the clear, so the SYN-ACK also carries a MAC of both
+ * nonces under the PSK (see `SynAckMac()'): the initiator checks that the
+ * responder saw the same nonces, and so derived the same keys, before the flow
+ * is established. The first ACK of the initiator is sealed under the keys of
+ * the flow, which confirms them to the responder in turn.
+ *
+ * A sealed packet carries its Machnet header in the clear (authenticated as the
+ * AAD), followed by the encrypted payload and a trailer: the 64-bit sequence
+ * number of the packet under its key, from which the IV is made, and the tag.
+ * Every transmission, retransmissions included, takes a new sequence number, so
+ * that IVs never repeat. Replays are not detected here: the transport already
+ * discards the packets it has seen.
+ */
+class Cipher {
+ public:
+  using Nonce = std::array<uint8_t, 16>;
+  static constexpr size_t kNonceSize = sizeof(Nonce);
+  static constexpr size_t kMacSize = sizeof(Nonce);
+  // The payload of a SYN-ACK: the nonce of the responder, and the MAC of the
+  // handshake (see `SynAckMac()').
+  static constexpr size_t kSynAckPayloadSize = kNonceSize + kMacSize;
+  static constexpr size_t kSeqSize = sizeof(uint64_t);
+  static constexpr size_t kTrailerSize = kSeqSize + crypto::AesGcm::kTagSize;
+  // Offset of the Machnet header, and of the payload, in the packets.
+  static constexpr size_t kNetHeadersLen =
+      sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp);
+  static constexpr size_t kHeadersLen = kNetHeadersLen + sizeof(MachnetPktHdr);
+
+  // A packet to seal: its headers are final, room is appended for the payload
+  // and the trailer, and the plaintext is still in a message buffer.
+  struct SealOp {
+    dpdk::Packet *packet;
+    const void *plaintext;
+    uint32_t len;
+  };
+
+  explicit Cipher(const crypto::Key &psk) : psk_(psk) {
+    std::random_device rd;
+    for (size_t i = 0; i < kNonceSize; i += sizeof(uint32_t)) {
+      const uint32_t r = rd();
+      std::memcpy(&local_nonce_[i], &r, sizeof(r));
+    }
+  }
+
+  const Nonce &local_nonce() const { return local_nonce_; }
+  // Whether the keys are set up (see `Establish()').
+  bool established() const { return established_; }
+
+  /**
+   * @brief Derive the keys of the flow from the nonce of the remote end.
+   * @param initiator Whether this end sent the SYN.
+   */
+  void Establish(const uint8_t *remote_nonce, bool initiator) {
+    std::memcpy(remote_nonce_.data(), remote_nonce, kNonceSize);
+    initiator_ = initiator;
+    const auto c2s = DeriveKey(client_nonce(), server_nonce(), kClientLabel);
+    const auto s2c = DeriveKey(client_nonce(), server_nonce(), kServerLabel);
+    tx_.SetKey(initiator ? c2s : s2c);
+    rx_.SetKey(initiator ? s2c : c2s);
+    tx_seq_ = 0;
+    established_ = true;
+  }
+
+  /**
+   * @brief The MAC, under the PSK, of the nonces of both ends, as sent by the
+   * responder on its SYN-ACK. Only an end that knows the PSK can make it, and
+   * it only matches if both ends saw the same nonces.
+   */
+  Nonce SynAckMac() const {
+    DCHECK(established_);
+    return DeriveKey(client_nonce(), server_nonce(), kSynAckLabel);
+  }
+
+  /**
+   * @brief Check the MAC of a SYN-ACK received (see `SynAckMac()'), in
+   * constant time.
+   * @return Whether the two ends derived the same keys.
+   */
+  bool VerifySynAckMac(const uint8_t *mac) const {
+    const auto expected = SynAckMac();
+    uint8_t diff = 0;
+    for (size_t i = 0; i < kMacSize; i++) diff |= expected[i] ^ mac[i];
+    return diff == 0;
+  }
+
+  /**
+   * @brief Seal a batch of packets (see `SealOp'), encrypting their payloads
+   * from the message buffers straight into the packets.
+   */
+  void Seal(const SealOp *ops, size_t n) {
+    DCHECK(established_);
+    for (size_t i = 0; i < n; i++) {
+      if (i + 1 < n) rte_prefetch0(ops[i + 1].plaintext);
+      Seal(ops[i]);
+    }
+  }
+
+  void Seal(const SealOp &op) {
+    auto *machneth = op.packet->head_data<uint8_t *>(kNetHeadersLen);
+    auto *payload = machneth + sizeof(MachnetPktHdr);
+    auto *trailer = payload + op.len;
+    const be64_t seq(tx_seq_++);
+    std::memcpy(trailer, &seq, kSeqSize);
+    uint8_t iv[crypto::AesGcm::kIvSize];
+    MakeIv(trailer, iv);
+    tx_.Seal(iv, machneth, sizeof(MachnetPktHdr), op.plaintext, payload,
+             op.len, trailer + kSeqSize);
+  }
+
+  /**
+   * @brief Authenticate a received packet, and decrypt its payload in place.
+   * The trailer is left at the end of the packet.
+   *
+   * @return Whether the packet is authentic.
+   */
+  bool Open(dpdk::Packet *packet) const {
+    DCHECK(established_);
+    const uint32_t len = packet->length();
+    if (len < kHeadersLen + kTrailerSize ||
+        packet->segment_length() < kHeadersLen) [[unlikely]] {  // NOLINT
+      return false;
+    }  // NOLINT
+    const auto *machneth = packet->head_data<uint8_t *>(kNetHeadersLen);
+    const uint32_t payload_len = len - kHeadersLen - kTrailerSize;
+    uint8_t iv[crypto::AesGcm::kIvSize];
+
+    if (packet->segment_length() == len) [[likely]] {  // NOLINT
+      auto *payload = packet->head_data<uint8_t *>(kHeadersLen);
+      const auto *trailer = payload + payload_len;
+      MakeIv(trailer, iv);
+      return rx_.Open(iv, machneth, sizeof(MachnetPktHdr), payload, payload,
+                      payload_len, trailer + kSeqSize);
+    }  // NOLINT
+
+    // The payload spans several segments (e.g., a jumbo frame in chained
+    // buffers): decrypt a linear copy, and write the plaintext back.
+    thread_local std::vector<uint8_t> scratch;
+    scratch.resize(payload_len + kTrailerSize);
+    packet->CopyOut(scratch.data(), kHeadersLen, scratch.size());
+    const auto *trailer = scratch.data() + payload_len;
+    MakeIv(trailer, iv);
+    if (!rx_.Open(iv, machneth, sizeof(MachnetPktHdr), scratch.data(),
+                  scratch.data(), payload_len, trailer + kSeqSize)) {
+      return false;
+    }
+    size_t offset = kHeadersLen, done = 0;
+    for (auto *seg = packet; seg != nullptr && done < payload_len;
+         seg = seg->next_segment()) {
+      const size_t seg_len = seg->segment_length();
+      if (offset >= seg_len) {
+        offset -= seg_len;
+        continue;
+      }
+      const size_t n = std::min(seg_len - offset, payload_len - done);
+      std::memcpy(seg->head_data<uint8_t *>(offset), scratch.data() + done, n);
+      done += n;
+      offset = 0;
+    }
+    return true;
+  }
+
+ private:
+  static constexpr Nonce kClientLabel = {'m', 'a', 'c', 'h', 'n', 'e', 't', ' ',
+                                         'c', '2', 's', ' ', 'k', 'e', 'y'};
+  static constexpr Nonce kServerLabel = {'m', 'a', 'c', 'h', 'n', 'e', 't', ' ',
+                                         's', '2', 'c', ' ', 'k', 'e', 'y'};
+  static constexpr Nonce kSynAckLabel = {'m', 'a', 'c', 'h', 'n', 'e', 't', ' ',
+                                         's', 'y', 'n', 'a', 'c', 'k'};
+
+  const Nonce &client_nonce() const {
+    return initiator_ ? local_nonce_ : remote_nonce_;
+  }
+  const Nonce &server_nonce() const {
+    return initiator_ ? remote_nonce_ : local_nonce_;
+  }
+
+  // A key of the flow, or the MAC of its handshake: the CBC-MAC, under the PSK,
+  // of the nonces of both ends and a label for the direction, or the SYN-ACK
+  // (a PRF, as all its inputs are 3 blocks).
+  crypto::Key DeriveKey(const Nonce &client, const Nonce &server,
+                        const Nonce &label) const {
+    const crypto::Aes128 aes(psk_);
+    crypto::Key block;
+    aes.Encrypt(client.data(), block.data());
+    for (const auto *next : {&server, &label}) {
+      for (size_t i = 0; i < block.size(); i++) block[i] ^= (*next)[i];
+      aes.Encrypt(block.data(), block.data());
+    }
+    return block;
+  }
+
+  // The IV of a packet: 32 zero bits, then its sequence number.
+  static void MakeIv(const uint8_t *seq, uint8_t *iv) {
+    std::memset(iv, 0, crypto::AesGcm::kIvSize - kSeqSize);
+    std::memcpy(iv + crypto::AesGcm::kIvSize - kSeqSize, seq, kSeqSize);
+  }
+
+  const crypto::Key psk_;
+  Nonce local_nonce_{};
+  Nonce remote_nonce_{};
+  // Whether this end sent the SYN (see `Establish()').
+  bool initiator_{false};
+  bool established_{false};
+  uint64_t tx_seq_{0};
+  crypto::AesGcm tx_;
+  crypto::AesGcm rx_;
+};
+
+}  // namespace flow
+}  // namespace net
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_FLOW_CIPHER_H_
@@ -116,14 +116,10 @@ struct hash<juggler::net::flow::Listener> {
 
 template <>
 struct hash<juggler::net::flow::Key> {
+  static constexpr uint32_t kKeyHashSeed = 0xdeadbeef;
   size_t operator()(const juggler::net::flow::Key& key) const {
-    // TODO(ilias): Use a better hash function.
-    // return std::hash<uint32_t>()(key.local_addr.address.raw_value()) ^
-    //        std::hash<uint32_t>()(key.remote_addr.address.raw_value()) ^
-    //        std::hash<uint16_t>()(key.local_port.port.raw_value()) ^
-    //        std::hash<uint16_t>()(key.remote_port.port.raw_value());
-    return juggler::utils::hash<uint64_t>(reinterpret_cast<const char*>(&key),
-                                          sizeof(key));
+    // CRC32C over the 12 bytes of the key: two instructions.
+    return juggler::utils::kernels::Crc32c(&key, sizeof(key), kKeyHashSeed);
   }
 };
 
@@ -0,0 +1,317 @@
+/**
+ * @file flow_table.h
+ * @brief Open-addressing, cache-line bucketed hash table for active flows.
+ */
+#ifndef SRC_INCLUDE_FLOW_TABLE_H_
+#define SRC_INCLUDE_FLOW_TABLE_H_
+
+#include <common.h>
+#include <flow_key.h>
+#include <glog/logging.h>
+#include <utils.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace juggler {
+namespace net {
+namespace flow {
+
+/**
+ * @brief Class `FlowTable' maps flow keys to values of type `V'. It is
+ * intended for the per-packet datapath, where node-based maps (e.g.,
+ * `std::unordered_map') incur several dependent cache misses per lookup.
+ *
+ * The table consists of a power-of-two number of buckets. Each bucket occupies
+ * exactly one cache line and holds `kSlotsPerBucket' (signature, key) pairs, so
+ * that a lookup hitting in its home bucket touches one cache line to compare
+ * keys plus one for the value (values are stored out of line, in a parallel
+ * array). On overflow, entries are placed in the next bucket(s) (linear
+ * probing at bucket granularity).
+ *
+ * All operations take the 32-bit hash of the key. The table does not care
+ * where the hash comes from (e.g., it could be the RSS hash computed by the
+ * NIC), as long as the same function is used for insertions and lookups.
+ * `FlowTable::Hash()' provides a cheap software default (CRC32C).
+ *
+ * Erased entries leave tombstones behind, which are reused by subsequent
+ * insertions and purged when the table is rehashed.
+ *
+ * @attention This class is not thread-safe.
+ */
+template <typename V>
+class FlowTable {
+ public:
+  static constexpr size_t kSlotsPerBucket = 4;
+  static constexpr size_t kDefaultCapacity = 1024;
+  // Maximum number of keys that can be looked up with a single `LookupBulk()'.
+  static constexpr size_t kMaxBulkLookup = 64;
+
+  /**
+   * @brief Construct a new FlowTable object.
+   *
+   * @param capacity Initial number of flows the table can hold without
+   *                 resizing; rounded up to the table's geometry.
+   */
+  explicit FlowTable(size_t capacity = kDefaultCapacity) {
+    Reset(BucketsFor(capacity));
+  }
+  FlowTable(const FlowTable &) = delete;
+  FlowTable &operator=(const FlowTable &) = delete;
+
+  /**
+   * @brief Default hash function for flow keys (CRC32C over the 12 bytes of
+   * the key).
+   */
+  static uint32_t Hash(const Key &key) {
+    return utils::kernels::Crc32c(&key, sizeof(key), kHashSeed);
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  size_t capacity() const { return buckets_.size() * kSlotsPerBucket; }
+
+  /**
+   * @brief Find the value associated with a key.
+   *
+   * @param key   The flow key.
+   * @param hash  The hash of the key.
+   * @return Pointer to the value if found, `nullptr' otherwise. The pointer is
+   * invalidated by the next insertion.
+   */
+  V *Lookup(const Key &key, uint32_t hash) {
+    const auto slot = FindSlot(Pack(key), Signature(hash));
+    return slot == kInvalidSlot ? nullptr : &values_[slot];
+  }
+
+  /**
+   * @brief Find the values associated with a batch of keys.
+   *
+   * The lookup is staged, so that the memory accesses for all the keys of the
+   * batch are overlapped: first all home buckets are prefetched, then keys are
+   * compared and the matching values are prefetched.
+   *
+   * @param keys    Array of `n' pointers to flow keys; `nullptr' entries are
+   *                skipped.
+   * @param hashes  Array of `n' hashes, one for each key.
+   * @param n       Number of keys (at most `kMaxBulkLookup').
+   * @param values  Output array of `n' value pointers; `nullptr' is stored for
+   *                keys not found (or skipped).
+   * @return Number of keys found.
+   */
+  size_t LookupBulk(const Key *const keys[], const uint32_t hashes[], size_t n,
+                    V *values[]) {
+    DCHECK_LE(n, kMaxBulkLookup);
+    for (size_t i = 0; i < n; i++) {
+      if (keys[i] == nullptr) continue;
+      __builtin_prefetch(&buckets_[Signature(hashes[i]) & mask_], 0, 3);
+    }
+
+    size_t nfound = 0;
+    for (size_t i = 0; i < n; i++) {
+      values[i] = nullptr;
+      if (keys[i] == nullptr) continue;
+      const auto slot = FindSlot(Pack(*keys[i]), Signature(hashes[i]));
+      if (slot == kInvalidSlot) continue;
+      __builtin_prefetch(&values_[slot], 0, 3);
+      values[i] = &values_[slot];
+      nfound++;
+    }
+
+    return nfound;
+  }
+
+  /**
+   * @brief Insert a new (key, value) pair in the table.
+   *
+   * @param key    The flow key.
+   * @param hash   The hash of the key.
+   * @param value  The value to be associated with the key.
+   * @return `true' on success, `false' if the key already exists.
+   */
+  bool Insert(const Key &key, uint32_t hash, const V &value) {
+    const auto packed = Pack(key);
+    const auto sig = Signature(hash);
+    if (FindSlot(packed, sig) != kInvalidSlot) return false;
+
+    if ((size_ + tombstones_ + 1) * kMaxLoadDen > capacity() * kMaxLoadNum) {
+      // Double the table if it is actually full, otherwise just purge the
+      // tombstones.
+      const bool grow = (size_ + 1) * 2 * kMaxLoadDen > capacity() * kMaxLoadNum;
+      Rehash(grow ? buckets_.size() * 2 : buckets_.size());
+    }
+
+    Place(packed, sig, value);
+    return true;
+  }
+
+  /**
+   * @brief Remove a key from the table.
+   *
+   * @param key   The flow key.
+   * @param hash  The hash of the key.
+   * @return `true' if the key was found and removed, `false' otherwise.
+   */
+  bool Erase(const Key &key, uint32_t hash) {
+    const auto slot = FindSlot(Pack(key), Signature(hash));
+    if (slot == kInvalidSlot) return false;
+    EraseSlot(slot);
+    return true;
+  }
+
+  /**
+   * @brief Invoke `f' for every value in the table.
+   */
+  template <typename F>
+  void ForEach(F &&f) {
+    for (size_t b = 0; b < buckets_.size(); b++) {
+      for (size_t s = 0; s < kSlotsPerBucket; s++) {
+        if (buckets_[b].sigs[s] < kMinSignature) continue;
+        f(values_[b * kSlotsPerBucket + s]);
+      }
+    }
+  }
+
+  /**
+   * @brief Remove all the entries for which `pred' returns true. The
+   * predicate is allowed to release any resources referenced by the value.
+   *
+   * @return Number of entries removed.
+   */
+  template <typename F>
+  size_t EraseIf(F &&pred) {
+    size_t nerased = 0;
+    for (size_t b = 0; b < buckets_.size(); b++) {
+      for (size_t s = 0; s < kSlotsPerBucket; s++) {
+        if (buckets_[b].sigs[s] < kMinSignature) continue;
+        const auto slot = b * kSlotsPerBucket + s;
+        if (!pred(values_[slot])) continue;
+        EraseSlot(slot);
+        nerased++;
+      }
+    }
+    return nerased;
+  }
+
+ private:
+  static constexpr uint32_t kHashSeed = 0xBADC0FEE;
+  static constexpr uint32_t kEmpty = 0;
+  static constexpr uint32_t kTombstone = 1;
+  static constexpr uint32_t kMinSignature = 2;
+  static constexpr size_t kInvalidSlot = SIZE_MAX;
+  // Maximum load factor (including tombstones) before rehashing: 3/4.
+  static constexpr size_t kMaxLoadNum = 3;
+  static constexpr size_t kMaxLoadDen = 4;
+
+  // Keys are stored packed (12 bytes) to fit a bucket in a cache line.
+  struct __attribute__((packed)) PackedKey {
+    uint64_t lo;
+    uint32_t hi;
+    bool operator==(const PackedKey &other) const {
+      return lo == other.lo && hi == other.hi;
+    }
+  };
+  static_assert(sizeof(PackedKey) == sizeof(Key));
+
+  struct alignas(hardware_constructive_interference_size) Bucket {
+    uint32_t sigs[kSlotsPerBucket];
+    PackedKey keys[kSlotsPerBucket];
+  };
+  static_assert(sizeof(Bucket) == hardware_constructive_interference_size,
+                "FlowTable bucket does not fit in a cache line.");
+
+  static PackedKey Pack(const Key &key) {
+    PackedKey packed;
+    std::memcpy(&packed, &key, sizeof(packed));
+    return packed;
+  }
+
+  // Signatures double as the source of the bucket index; values 0 and 1 are
+  // reserved to mark empty slots and tombstones.
+  static uint32_t Signature(uint32_t hash) {
+    return hash < kMinSignature ? hash + kMinSignature : hash;
+  }
+
+  static size_t BucketsFor(size_t capacity) {
+    size_t nbuckets = 1;
+    while (nbuckets * kSlotsPerBucket * kMaxLoadNum < capacity * kMaxLoadDen)
+      nbuckets <<= 1;
+    return nbuckets;
+  }
+
+  void Reset(size_t nbuckets) {
+    CHECK(utils::is_power_of_two(nbuckets));
+    buckets_.assign(nbuckets, Bucket{});
+    values_.assign(nbuckets * kSlotsPerBucket, V{});
+    mask_ = nbuckets - 1;
+    size_ = 0;
+    tombstones_ = 0;
+  }
+
+  size_t FindSlot(const PackedKey &key, uint32_t sig) const {
+    size_t b = sig & mask_;
+    for (size_t probes = 0; probes < buckets_.size(); probes++) {
+      const auto &bucket = buckets_[b];
+      for (size_t s = 0; s < kSlotsPerBucket; s++) {
+        if (bucket.sigs[s] == sig && bucket.keys[s] == key)
+          return b * kSlotsPerBucket + s;
+        if (bucket.sigs[s] == kEmpty) return kInvalidSlot;
+      }
+      b = (b + 1) & mask_;
+    }
+    return kInvalidSlot;
+  }
+
+  // Place a key that is known not to exist in the first available slot.
+  void Place(const PackedKey &key, uint32_t sig, const V &value) {
+    size_t b = sig & mask_;
+    for (size_t probes = 0; probes < buckets_.size(); probes++) {
+      auto &bucket = buckets_[b];
+      for (size_t s = 0; s < kSlotsPerBucket; s++) {
+        if (bucket.sigs[s] >= kMinSignature) continue;
+        if (bucket.sigs[s] == kTombstone) tombstones_--;
+        bucket.sigs[s] = sig;
+        bucket.keys[s] = key;
+        values_[b * kSlotsPerBucket + s] = value;
+        size_++;
+        return;
+      }
+      b = (b + 1) & mask_;
+    }
+    LOG(FATAL) << "FlowTable is full.";
+  }
+
+  void EraseSlot(size_t slot) {
+    buckets_[slot / kSlotsPerBucket].sigs[slot % kSlotsPerBucket] = kTombstone;
+    values_[slot] = V{};
+    size_--;
+    tombstones_++;
+  }
+
+  void Rehash(size_t nbuckets) {
+    auto old_buckets = std::move(buckets_);
+    auto old_values = std::move(values_);
+    Reset(nbuckets);
+    for (size_t b = 0; b < old_buckets.size(); b++) {
+      for (size_t s = 0; s < kSlotsPerBucket; s++) {
+        const auto sig = old_buckets[b].sigs[s];
+        if (sig < kMinSignature) continue;
+        Place(old_buckets[b].keys[s], sig,
+              old_values[b * kSlotsPerBucket + s]);
+      }
+    }
+  }
+
+  std::vector<Bucket> buckets_{};
+  std::vector<V> values_{};
+  size_t mask_{0};
+  size_t size_{0};
+  size_t tombstones_{0};
+};
+
+}  // namespace flow
+}  // namespace net
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_FLOW_TABLE_H_
@@ -0,0 +1,136 @@
+/**
+ * @file idle_policy.h
+ * @brief Adaptive idling of the engine threads.
+ */
+#ifndef SRC_INCLUDE_IDLE_POLICY_H_
+#define SRC_INCLUDE_IDLE_POLICY_H_
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+
+namespace juggler {
+
+/**
+ * @brief Class `IdlePolicy' decides how an engine thread idles, after
+ * iterations that found no work. The longer the engine stays idle, the deeper
+ * it backs off:
+ *  - `kPoll': keep polling, for the first `poll_iterations' idle iterations.
+ *  - `kPause': spin on `pause' bursts that grow exponentially (see
+ *    `PauseBurst()'), for the next `pause_iterations'.
+ *  - `kWait': wait for a short while, in a low-power state if the CPU
+ *    supports it (`umwait' on the RX queue, or `tpause').
+ *  - `kSleep': block on RX interrupts (only if `sleep' is enabled).
+ * The engine goes back to polling on the first iteration that finds work.
+ *
+ * The policy also keeps track of how long the engine had been waiting when
+ * work resumed, per stage: as the work may have arrived any time during the
+ * wait, this bounds the latency added to it by idling.
+ *
+ * @attention This class is not thread-safe.
+ */
+class IdlePolicy {
+ public:
+  enum Stage { kPoll = 0, kPause, kWait, kSleep, kStagesNr };
+  static constexpr uint32_t kDefaultPollIterations = 256;
+  static constexpr uint32_t kDefaultPauseIterations = 1024;
+  static constexpr uint32_t kDefaultWaitIterations = 1024;
+  // Largest `pause' burst; it doubles every `kPauseBurstStep' iterations.
+  static constexpr uint32_t kMaxPauseBurst = 64;
+  static constexpr uint32_t kPauseBurstStep = 128;
+
+  // Wakeups from a stage, and the time waited (in TSC cycles) before them.
+  struct WakeupStats {
+    uint64_t wakeups;
+    uint64_t wait_cycles;
+    uint64_t max_wait_cycles;
+  };
+
+  /**
+   * @param sleep            Whether to end up blocking (`kSleep').
+   * @param poll_iterations  Idle iterations to keep polling for.
+   * @param pause_iterations Idle iterations to spin on `pause' for.
+   * @param wait_iterations  Idle iterations to wait for, before sleeping.
+   */
+  explicit IdlePolicy(bool sleep,
+                      uint32_t poll_iterations = kDefaultPollIterations,
+                      uint32_t pause_iterations = kDefaultPauseIterations,
+                      uint32_t wait_iterations = kDefaultWaitIterations)
+      : sleep_(sleep),
+        poll_iterations_(poll_iterations),
+        pause_iterations_(pause_iterations),
+        wait_iterations_(wait_iterations) {}
+  IdlePolicy(const IdlePolicy &) = delete;
+  IdlePolicy &operator=(const IdlePolicy &) = delete;
+
+  /**
+   * @brief Account an idle iteration.
+   * @return The stage the engine should idle in.
+   */
+  Stage OnIdle() {
+    if (idle_iterations_ < std::numeric_limits<uint32_t>::max()) {
+      idle_iterations_++;
+    }
+    uint64_t limit = poll_iterations_;
+    if (idle_iterations_ <= limit) return kPoll;
+    limit += pause_iterations_;
+    if (idle_iterations_ <= limit) return kPause;
+    limit += wait_iterations_;
+    if (!sleep_ || idle_iterations_ <= limit) return kWait;
+    return kSleep;
+  }
+
+  // The number of `pause' instructions of the current iteration (`kPause').
+  uint32_t PauseBurst() const {
+    const uint32_t step = (idle_iterations_ - poll_iterations_) /
+                          kPauseBurstStep;
+    return std::min(kMaxPauseBurst, 1u << std::min(step, 6u));
+  }
+
+  /**
+   * @brief Account the time spent waiting in an idle iteration (`kWait' and
+   * `kSleep' only).
+   */
+  void OnWait(Stage stage, uint64_t cycles) {
+    DCHECK_GE(stage, kWait);
+    last_stage_ = stage;
+    last_wait_cycles_ = cycles;
+  }
+
+  // Account an iteration that found work: back to polling.
+  void OnBusy() {
+    if (idle_iterations_ == 0) return;
+    idle_iterations_ = 0;
+    if (last_stage_ == kPoll) return;
+    auto &stats = stats_[last_stage_];
+    stats.wakeups++;
+    stats.wait_cycles += last_wait_cycles_;
+    stats.max_wait_cycles = std::max(stats.max_wait_cycles, last_wait_cycles_);
+    last_stage_ = kPoll;
+  }
+
+  // Whether the engine is backing off (i.e., past `kPoll').
+  bool idling() const { return idle_iterations_ > poll_iterations_; }
+
+  // The wakeup statistics of a stage, since the last `ResetStats()'.
+  const WakeupStats &stats(Stage stage) const { return stats_.at(stage); }
+  void ResetStats() { stats_ = {}; }
+
+ private:
+  const bool sleep_;
+  const uint32_t poll_iterations_;
+  const uint32_t pause_iterations_;
+  const uint32_t wait_iterations_;
+  uint32_t idle_iterations_{0};
+  // The stage of the last wait, and how long it took.
+  Stage last_stage_{kPoll};
+  uint64_t last_wait_cycles_{0};
+  std::array<WakeupStats, kStagesNr> stats_{};
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_IDLE_POLICY_H_
@@ -0,0 +1,334 @@
+/**
+ * @file kernels.h
+ * @brief SIMD kernels for memory copies, Internet checksums and hashes, with
+ * AVX2 and AVX-512 variants selected at runtime on the features of the CPU.
+ *
+ * The tree is built for SSE4.2 (see `-msse4.2'); the wider variants are
+ * compiled with function-level target attributes, and only ever called
+ * through the table of the CPU they run on (see `GetKernels()').
+ */
+#ifndef SRC_INCLUDE_KERNELS_H_
+#define SRC_INCLUDE_KERNELS_H_
+
+#include <immintrin.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace juggler {
+namespace utils {
+namespace kernels {
+
+// Instruction sets the kernels are available for, from the narrowest.
+enum class Isa { kSse42 = 0, kAvx2 = 1, kAvx512 = 2 };
+
+static inline const char *IsaName(Isa isa) {
+  switch (isa) {
+    case Isa::kSse42:
+      return "sse4.2";
+    case Isa::kAvx2:
+      return "avx2";
+    case Isa::kAvx512:
+      return "avx512";
+  }
+  return "unknown";
+}
+
+// The widest instruction set supported by this CPU (checked with `cpuid').
+static inline Isa DetectIsa() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return Isa::kAvx512;
+  if (__builtin_cpu_supports("avx2")) return Isa::kAvx2;
+  return Isa::kSse42;
+}
+
+// Largest copy done with inlined loads and stores (see `CopySmall()').
+static constexpr size_t kSmallCopyMax = 64;
+// Shorter checksums (e.g., of IPv4 headers, or small ICMP payloads) are not
+// worth the call to a kernel: they are summed inline, 16 bits at a time.
+static constexpr size_t kMinVectorChecksum = 256;
+// Non-temporal copies smaller than this are regular copies: there are too few
+// cache lines to bypass for the streaming stores (and the fence) to pay off.
+static constexpr size_t kMinNonTemporalCopy = 256;
+
+/**
+ * @brief Copy up to 64 bytes with at most four (possibly overlapping) loads
+ * and stores, instead of a call to `memcpy()'. SSE4.2 only, so that it can be
+ * inlined anywhere.
+ */
+static inline void CopySmall(void *__restrict__ dest,
+                             const void *__restrict__ src, size_t nbytes) {
+  auto *d = static_cast<uint8_t *>(dest);
+  const auto *s = static_cast<const uint8_t *>(src);
+  if (nbytes >= 16) {
+    if (nbytes > 32) {
+      const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+      const auto b =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 16));
+      const auto c = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(s + nbytes - 32));
+      const auto e = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(s + nbytes - 16));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(d), a);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(d + 16), b);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(d + nbytes - 32), c);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(d + nbytes - 16), e);
+      return;
+    }
+    const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+    const auto b = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(s + nbytes - 16));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(d), a);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(d + nbytes - 16), b);
+    return;
+  }
+  if (nbytes >= 8) {
+    uint64_t a, b;
+    std::memcpy(&a, s, 8);
+    std::memcpy(&b, s + nbytes - 8, 8);
+    std::memcpy(d, &a, 8);
+    std::memcpy(d + nbytes - 8, &b, 8);
+  } else if (nbytes >= 4) {
+    uint32_t a, b;
+    std::memcpy(&a, s, 4);
+    std::memcpy(&b, s + nbytes - 4, 4);
+    std::memcpy(d, &a, 4);
+    std::memcpy(d + nbytes - 4, &b, 4);
+  } else if (nbytes >= 2) {
+    uint16_t a, b;
+    std::memcpy(&a, s, 2);
+    std::memcpy(&b, s + nbytes - 2, 2);
+    std::memcpy(d, &a, 2);
+    std::memcpy(d + nbytes - 2, &b, 2);
+  } else if (nbytes == 1) {
+    *d = *s;
+  }
+}
+
+/*
+ * Non-temporal copies: the destination is written with streaming stores, that
+ * bypass the caches of this core. This is meant for payloads that another core
+ * (e.g., the application) reads next. The stores are fenced before returning,
+ * so that they are ordered before a subsequent release (e.g., of a ring slot).
+ */
+template <typename F>
+static inline void CopyNonTemporalLines(void *__restrict__ dest,
+                                        const void *__restrict__ src,
+                                        size_t nbytes, F &&copy_lines) {
+  auto *d = static_cast<uint8_t *>(dest);
+  const auto *s = static_cast<const uint8_t *>(src);
+  // Align the destination to a cache line, then stream whole lines.
+  const size_t head = -reinterpret_cast<uintptr_t>(d) & 63;
+  CopySmall(d, s, head);
+  const size_t lines = (nbytes - head) / 64;
+  copy_lines(d + head, s + head, lines);
+  const size_t done = head + lines * 64;
+  CopySmall(d + done, s + done, nbytes - done);
+}
+
+static inline void CopyNonTemporalSse42(void *__restrict__ dest,
+                                        const void *__restrict__ src,
+                                        size_t nbytes) {
+  CopyNonTemporalLines(
+      dest, src, nbytes, [](uint8_t *d, const uint8_t *s, size_t lines) {
+        for (size_t i = 0; i < lines; i++, d += 64, s += 64) {
+          const auto *p = reinterpret_cast<const __m128i *>(s);
+          const auto a = _mm_loadu_si128(p);
+          const auto b = _mm_loadu_si128(p + 1);
+          const auto c = _mm_loadu_si128(p + 2);
+          const auto e = _mm_loadu_si128(p + 3);
+          auto *q = reinterpret_cast<__m128i *>(d);
+          _mm_stream_si128(q, a);
+          _mm_stream_si128(q + 1, b);
+          _mm_stream_si128(q + 2, c);
+          _mm_stream_si128(q + 3, e);
+        }
+      });
+  _mm_sfence();
+}
+
+__attribute__((target("avx2"))) static inline void StreamLinesAvx2(
+    uint8_t *d, const uint8_t *s, size_t lines) {
+  for (size_t i = 0; i < lines; i++, d += 64, s += 64) {
+    const auto *p = reinterpret_cast<const __m256i *>(s);
+    const auto a = _mm256_loadu_si256(p);
+    const auto b = _mm256_loadu_si256(p + 1);
+    auto *q = reinterpret_cast<__m256i *>(d);
+    _mm256_stream_si256(q, a);
+    _mm256_stream_si256(q + 1, b);
+  }
+}
+
+static inline void CopyNonTemporalAvx2(void *__restrict__ dest,
+                                       const void *__restrict__ src,
+                                       size_t nbytes) {
+  CopyNonTemporalLines(dest, src, nbytes, StreamLinesAvx2);
+  _mm_sfence();
+}
+
+__attribute__((target("avx512f"))) static inline void StreamLinesAvx512(
+    uint8_t *d, const uint8_t *s, size_t lines) {
+  for (size_t i = 0; i < lines; i++, d += 64, s += 64) {
+    _mm512_stream_si512(reinterpret_cast<__m512i *>(d),
+                        _mm512_loadu_si512(s));
+  }
+}
+
+static inline void CopyNonTemporalAvx512(void *__restrict__ dest,
+                                         const void *__restrict__ src,
+                                         size_t nbytes) {
+  CopyNonTemporalLines(dest, src, nbytes, StreamLinesAvx512);
+  _mm_sfence();
+}
+
+/*
+ * Internet checksums (RFC 1071). The 16-bit ones' complement sum carries over
+ * to wider words (2^16 = 1 modulo 2^16 - 1), so the kernels add up the data as
+ * 32-bit words into 64-bit lanes, and fold the result to 16 bits at the end.
+ * The bytes past the last whole vector are summed as 16-bit words, the same
+ * way as `ComputeChecksum16()' always did.
+ */
+static inline uint64_t SumTail(const uint8_t *data, size_t length) {
+  uint64_t sum = 0;
+  for (; length > 1; length -= 2, data += 2) {
+    uint16_t word;
+    std::memcpy(&word, data, sizeof(word));
+    sum += word;
+  }
+  if (length == 1) sum += static_cast<uint16_t>(*data << 8);
+  return sum;
+}
+
+static inline uint16_t FoldChecksum(uint64_t sum) {
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+  return static_cast<uint16_t>(~sum);
+}
+
+static inline uint16_t ChecksumSse42(const uint8_t *data, size_t length) {
+  const auto lo_mask = _mm_set1_epi64x(0xffffffff);
+  auto acc = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    acc = _mm_add_epi64(acc, _mm_and_si128(v, lo_mask));
+    acc = _mm_add_epi64(acc, _mm_srli_epi64(v, 32));
+  }
+  const uint64_t sum = static_cast<uint64_t>(_mm_cvtsi128_si64(acc)) +
+                       static_cast<uint64_t>(_mm_extract_epi64(acc, 1)) +
+                       SumTail(data + i, length - i);
+  return FoldChecksum(sum);
+}
+
+__attribute__((target("avx2"))) static inline uint16_t ChecksumAvx2(
+    const uint8_t *data, size_t length) {
+  const auto lo_mask = _mm256_set1_epi64x(0xffffffff);
+  auto acc0 = _mm256_setzero_si256();
+  auto acc1 = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    const auto v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+    acc0 = _mm256_add_epi64(acc0, _mm256_and_si256(v, lo_mask));
+    acc1 = _mm256_add_epi64(acc1, _mm256_srli_epi64(v, 32));
+  }
+  const auto acc = _mm256_add_epi64(acc0, acc1);
+  const auto half = _mm_add_epi64(_mm256_castsi256_si128(acc),
+                                  _mm256_extracti128_si256(acc, 1));
+  const uint64_t sum = static_cast<uint64_t>(_mm_cvtsi128_si64(half)) +
+                       static_cast<uint64_t>(_mm_extract_epi64(half, 1)) +
+                       SumTail(data + i, length - i);
+  return FoldChecksum(sum);
+}
+
+// GCC 12 flags the placeholder operands of some AVX-512 intrinsics as
+// uninitialized (GCC bug 105593).
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f"))) static inline uint16_t ChecksumAvx512(
+    const uint8_t *data, size_t length) {
+  const auto lo_mask = _mm512_set1_epi64(0xffffffff);
+  auto acc0 = _mm512_setzero_si512();
+  auto acc1 = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 64 <= length; i += 64) {
+    const auto v = _mm512_loadu_si512(data + i);
+    acc0 = _mm512_add_epi64(acc0, _mm512_and_si512(v, lo_mask));
+    acc1 = _mm512_add_epi64(acc1, _mm512_srli_epi64(v, 32));
+  }
+  const uint64_t sum =
+      static_cast<uint64_t>(_mm512_reduce_add_epi64(
+          _mm512_add_epi64(acc0, acc1))) +
+      SumTail(data + i, length - i);
+  return FoldChecksum(sum);
+}
+#pragma GCC diagnostic pop
+
+/**
+ * @brief CRC32C of `len' bytes, 8 bytes per instruction (SSE4.2). A cheap
+ * hash for short keys, e.g., flow 5-tuples (12 bytes: two instructions).
+ */
+static inline uint32_t Crc32c(const void *data, size_t len, uint32_t seed) {
+  const auto *p = static_cast<const uint8_t *>(data);
+  uint64_t crc = seed;
+  for (; len >= 8; len -= 8, p += 8) {
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    crc = _mm_crc32_u64(crc, word);
+  }
+  auto crc32 = static_cast<uint32_t>(crc);
+  if (len >= 4) {
+    uint32_t word;
+    std::memcpy(&word, p, sizeof(word));
+    crc32 = _mm_crc32_u32(crc32, word);
+    len -= 4;
+    p += 4;
+  }
+  if (len >= 2) {
+    uint16_t word;
+    std::memcpy(&word, p, sizeof(word));
+    crc32 = _mm_crc32_u16(crc32, word);
+    len -= 2;
+    p += 2;
+  }
+  if (len == 1) crc32 = _mm_crc32_u8(crc32, *p);
+  return crc32;
+}
+
+/**
+ * @brief The variants of the kernels for one instruction set (see
+ * `GetKernels()').
+ */
+struct KernelTable {
+  Isa isa;
+  // Copies of at least `kMinNonTemporalCopy' bytes.
+  void (*copy_nt)(void *__restrict__, const void *__restrict__, size_t);
+  uint16_t (*checksum)(const uint8_t *, size_t);
+};
+
+static inline const KernelTable &GetKernels(Isa isa) {
+  static constexpr KernelTable kTables[] = {
+      {Isa::kSse42, CopyNonTemporalSse42, ChecksumSse42},
+      {Isa::kAvx2, CopyNonTemporalAvx2, ChecksumAvx2},
+      {Isa::kAvx512, CopyNonTemporalAvx512, ChecksumAvx512},
+  };
+  return kTables[static_cast<int>(isa)];
+}
+
+/**
+ * @brief The kernels for the widest instruction set of this CPU, selected on
+ * first use.
+ */
+inline const KernelTable &GetKernels() {
+  static const KernelTable &kernels = GetKernels(DetectIsa());
+  return kernels;
+}
+
+}  // namespace kernels
+}  // namespace utils
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_KERNELS_H_
@@ -0,0 +1,93 @@
+/**
+ * @file latency_histogram.h
+ * @brief Histograms of latencies (e.g., RTTs), backed by HdrHistogram.
+ */
+#ifndef SRC_INCLUDE_LATENCY_HISTOGRAM_H_
+#define SRC_INCLUDE_LATENCY_HISTOGRAM_H_
+
+#include <glog/logging.h>
+#include <hdr/hdr_histogram.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+namespace juggler {
+
+/**
+ * @brief Class `LatencyHistogram' records latencies in nanoseconds, with 3
+ * significant digits, from 1 ns up to `kMaxValueNs' (larger values are
+ * recorded as `kMaxValueNs'). Recording a value takes no allocation.
+ *
+ * @attention This class is not thread-safe.
+ */
+class LatencyHistogram {
+ public:
+  static constexpr int64_t kMinValueNs = 1;
+  static constexpr int64_t kMaxValueNs = 10'000'000'000;  // 10s
+  static constexpr int kSignificantFigures = 3;
+
+  // Summary of the values recorded in a histogram, in nanoseconds.
+  struct Summary {
+    uint64_t count{0};
+    uint64_t min_ns{0};
+    uint64_t p50_ns{0};
+    uint64_t p99_ns{0};
+    uint64_t p999_ns{0};
+    uint64_t max_ns{0};
+
+    std::string ToString() const {
+      return utils::Format(
+          "samples: %lu, min: %.1f us, p50: %.1f us, p99: %.1f us, "
+          "p99.9: %.1f us, max: %.1f us",
+          count, min_ns / 1E3, p50_ns / 1E3, p99_ns / 1E3, p999_ns / 1E3,
+          max_ns / 1E3);
+    }
+  };
+
+  LatencyHistogram() {
+    CHECK_EQ(hdr_init(kMinValueNs, kMaxValueNs, kSignificantFigures,
+                      &histogram_),
+             0)
+        << "Failed to allocate latency histogram";
+  }
+  LatencyHistogram(const LatencyHistogram &) = delete;
+  LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+  ~LatencyHistogram() { hdr_close(histogram_); }
+
+  // Record `count' occurrences of a value.
+  void Record(uint64_t value_ns, int64_t count = 1) {
+    hdr_record_values(
+        histogram_, std::min(static_cast<int64_t>(value_ns), kMaxValueNs),
+        count);
+  }
+
+  uint64_t GetCount() const { return histogram_->total_count; }
+
+  // Value at the given percentile (e.g., 99.9).
+  uint64_t GetPercentile(double percentile) const {
+    return hdr_value_at_percentile(histogram_, percentile);
+  }
+
+  Summary GetSummary() const {
+    Summary summary;
+    summary.count = GetCount();
+    if (summary.count == 0) return summary;
+    summary.min_ns = hdr_min(histogram_);
+    summary.p50_ns = GetPercentile(50.0);
+    summary.p99_ns = GetPercentile(99.0);
+    summary.p999_ns = GetPercentile(99.9);
+    summary.max_ns = hdr_max(histogram_);
+    return summary;
+  }
+
+  void Reset() { hdr_reset(histogram_); }
+
+ private:
+  hdr_histogram *histogram_;
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_LATENCY_HISTOGRAM_H_
@@ -0,0 +1,202 @@
+/**
+ * @file loopback_link.h
+ * @brief An in-memory link between two ports, with configurable impairments,
+ * to run engines back to back in one process (see `LoopbackLink').
+ */
+#ifndef SRC_INCLUDE_LOOPBACK_LINK_H_
+#define SRC_INCLUDE_LOOPBACK_LINK_H_
+
+#include <pmd.h>
+#include <rte_ring.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace juggler {
+namespace dpdk {
+
+/**
+ * @brief Impairments of one direction of a `LoopbackLink'. Each packet that
+ * crosses it is impaired independently of the others, as with `netem'.
+ */
+struct LinkImpairments {
+  // Probability that a packet is dropped.
+  double loss{0};
+  // Probability that a packet is duplicated.
+  double duplicate{0};
+  // Probability that a packet is held back by `reorder_delay_ns', for the
+  // packets that follow to overtake it.
+  double reorder{0};
+  uint64_t reorder_delay_ns{20000};  // 20us
+  // One-way delay of the packets, plus a uniformly random jitter of up to
+  // `jitter_ns' (which may reorder packets too).
+  uint64_t delay_ns{0};
+  uint64_t jitter_ns{0};
+};
+
+/**
+ * @brief Counters of one direction of a `LoopbackLink'.
+ */
+struct LinkStats {
+  // Packets sent over the link, by the end it starts from (see
+  // `rte_eth_stats_get()').
+  uint64_t packets{0};
+  // Packets lost (see `LinkImpairments::loss').
+  uint64_t drops{0};
+  uint64_t duplicates{0};
+  uint64_t reorders{0};
+};
+
+/**
+ * @brief Class `LoopbackLink' connects two ports back to back in memory, for
+ * engines to run against each other in one process, at full speed, without
+ * NICs (e.g., to evaluate and regression-test congestion control and loss
+ * recovery).
+ *
+ * The ports are `net_ring' devices (see `rte_eth_from_rings()'): queue `q' of
+ * each end transmits into an `rte_ring' that queue `q' of the other end
+ * receives from. As a NIC would, the link copies the packets sent into the
+ * receive buffers of the other end (by a TX callback of the sending queue), so
+ * that each packet pool is only ever used by the thread of its engine. When
+ * the other end runs out of receive buffers (e.g., with many packets delayed),
+ * the sender is held back, as by flow control.
+ *
+ * The impairments of each direction (see `LinkImpairments') are applied as the
+ * packets cross: duplicates as they are sent, the rest where they are received
+ * (by an RX callback of the receiving queue). Delayed packets wait in a delay
+ * line of the receiving queue, until a later burst is due to pick them up.
+ * Without impairments, the packets go straight through.
+ *
+ * The ports need no checksums, as the wire is lossless but for the impairments:
+ * like `net_null', they are configured with no offloads.
+ *
+ * @attention The engines using the ports must be stopped, and destroyed (as
+ * they hold on to the ports) before the link.
+ */
+class LoopbackLink {
+ public:
+  // Size of the rings of each queue pair; must be a power of two.
+  static constexpr uint32_t kRingSize = 4096;
+  // Receive descriptors of the queues of the ports, which size their pools of
+  // receive buffers (see `PmdPort::InitDriver()'): deep enough for the
+  // packets in flight, and those in the delay lines.
+  static constexpr uint16_t kRxDescNr = 8192;
+
+  /**
+   * @brief Create the ports of the link, and initialize them.
+   *
+   * @param name        Name of the link (short, and unique in the process);
+   *                    the ports are named after it (as `<name>_0' and
+   *                    `<name>_1').
+   * @param nr_queues   Number of RX and TX queues of each port.
+   * @param impairments Impairments of the packets sent by each end (i.e., the
+   *                    first applies from port 0 to port 1).
+   * @param mtu         (Optional) MTU of the ports (see
+   *                    `PmdPort::InitDriver()').
+   */
+  LoopbackLink(const std::string &name, uint16_t nr_queues,
+               const std::array<LinkImpairments, 2> &impairments,
+               uint16_t mtu = PmdRing::kDefaultFrameSize);
+  LoopbackLink(const LoopbackLink &) = delete;
+  LoopbackLink &operator=(const LoopbackLink &) = delete;
+  ~LoopbackLink();
+
+  // The port of an end of the link (0 or 1).
+  std::shared_ptr<PmdPort> port(size_t end) const { return ports_.at(end); }
+
+  // Counters of the packets sent by an end of the link (0 or 1), so far.
+  LinkStats GetStats(size_t end) const;
+
+ private:
+  // A packet in a delay line, due for reception at `release' (TSC cycles);
+  // among packets due at the same time, the first one in is the first out.
+  struct DelayedPacket {
+    uint64_t release;
+    uint64_t seq;
+    rte_mbuf *mbuf;
+    bool operator>(const DelayedPacket &other) const {
+      return release != other.release ? release > other.release
+                                      : seq > other.seq;
+    }
+  };
+
+  /**
+   * @brief A queue of one direction of the link: copies the packets sent into
+   * receive buffers (see `TxCallback()'), and impairs them (see `TxCallback()'
+   * and `RxCallback()').
+   */
+  class Queue {
+   public:
+    Queue(const LinkImpairments &impairments, uint64_t seed, rte_ring *ring,
+          rte_mempool *rx_pool);
+    ~Queue();
+
+    static uint16_t TxCallback(uint16_t port_id, uint16_t queue_id,
+                               rte_mbuf *pkts[], uint16_t nb_pkts, void *arg) {
+      return static_cast<Queue *>(arg)->Transmit(pkts, nb_pkts);
+    }
+    static uint16_t RxCallback(uint16_t port_id, uint16_t queue_id,
+                               rte_mbuf *pkts[], uint16_t nb_pkts,
+                               uint16_t max_pkts, void *arg) {
+      return static_cast<Queue *>(arg)->Receive(pkts, nb_pkts, max_pkts);
+    }
+
+    // Counters, each updated by a single thread: the sending one (for
+    // `duplicates') or the receiving one.
+    std::atomic<uint64_t> drops{0};
+    std::atomic<uint64_t> duplicates{0};
+    std::atomic<uint64_t> reorders{0};
+    const void *tx_callback{nullptr};
+    const void *rx_callback{nullptr};
+
+   private:
+    uint16_t Transmit(rte_mbuf **pkts, uint16_t nb_pkts);
+    uint16_t Receive(rte_mbuf **pkts, uint16_t nb_pkts, uint16_t max_pkts);
+    // Copy a packet into a receive buffer, as received; nullptr if there is
+    // none left.
+    rte_mbuf *Copy(const rte_mbuf *mbuf);
+    static bool Chance(std::mt19937_64 *rng, double probability) {
+      return probability > 0 &&
+             std::uniform_real_distribution<double>(0.0, 1.0)(*rng) <
+                 probability;
+    }
+    static void Count(std::atomic<uint64_t> *counter) {
+      counter->store(counter->load(std::memory_order_relaxed) + 1,
+                     std::memory_order_relaxed);
+    }
+
+    const LinkImpairments impairments_;
+    const uint64_t delay_cycles_;
+    const uint64_t jitter_cycles_;
+    const uint64_t reorder_cycles_;
+    rte_ring *const ring_;
+    rte_mempool *const rx_pool_;
+    // Random draws of the sending and receiving threads.
+    std::mt19937_64 tx_rng_;
+    std::mt19937_64 rx_rng_;
+    std::priority_queue<DelayedPacket, std::vector<DelayedPacket>,
+                        std::greater<DelayedPacket>>
+        delayed_{};
+    uint64_t next_seq_{0};
+  };
+
+  // Free the packets left in the rings of the link.
+  void DrainRings();
+
+  // Rings from each end of the link to the other, by queue.
+  std::array<std::vector<rte_ring *>, 2> rings_;
+  std::array<std::shared_ptr<PmdPort>, 2> ports_;
+  // Queues of the packets sent by each end.
+  std::array<std::vector<std::unique_ptr<Queue>>, 2> queues_;
+};
+
+}  // namespace dpdk
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_LOOPBACK_LINK_H_
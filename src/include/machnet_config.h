@@ -10,9 +10,13 @@
 #include <ipv4.h>
 #include <utils.h>
 
+#include <aes_gcm.h>
+#include <common.h>
+
 #include <algorithm>
 #include <nlohmann/json.hpp>
 #include <unordered_set>
+#include <vector>
 
 namespace juggler {
 
@@ -24,12 +28,81 @@ class NetworkInterfaceConfig {
                                   const net::Ethernet::Address &l2_addr,
                                   const net::Ipv4::Address &ip_addr,
                                   size_t engine_threads = 1,
-                                  cpu_set_t cpu_mask = kDefaultCpuMask)
+                                  cpu_set_t cpu_mask = kDefaultCpuMask,
+                                  RxPipelineMode rx_pipeline_mode =
+                                      RxPipelineMode::kSequential,
+                                  uint32_t ack_every = kDefaultAckEvery,
+                                  bool rx_zerocopy = false,
+                                  bool tx_zerocopy = false,
+                                  uint32_t tx_zerocopy_threshold =
+                                      kDefaultTxZeroCopyThreshold,
+                                  TxSchedulerMode tx_scheduler_mode =
+                                      TxSchedulerMode::kRoundRobin,
+                                  uint32_t tx_budget = kDefaultTxBudget,
+                                  uint32_t tx_quantum = kDefaultTxQuantum,
+                                  bool flow_steering = false,
+                                  uint32_t rebalance_interval_ms = 0,
+                                  IdleMode idle_mode = IdleMode::kBusyPoll,
+                                  std::vector<size_t> cores = {},
+                                  bool hw_timestamps = false,
+                                  uint16_t mtu = kDefaultMtu,
+                                  bool pacing = false,
+                                  uint32_t pacing_burst = kDefaultPacingBurst,
+                                  uint8_t paths = 1,
+                                  std::optional<crypto::Key> encryption_key =
+                                      std::nullopt,
+                                  std::vector<net::Ipv4::Address> neighbors =
+                                      {},
+                                  uint32_t trace_sample_every = 0,
+                                  uint32_t capture_records = 0,
+                                  uint32_t channel_pool = 0,
+                                  uint32_t direct_queues = 0,
+                                  uint32_t channel_arena = 0,
+                                  uint32_t rexmit_packets = 0,
+                                  uint16_t rx_descriptors = 0,
+                                  uint16_t tx_descriptors = 0,
+                                  uint32_t rx_mbufs = 0,
+                                  uint32_t tx_mbufs = 0,
+                                  uint16_t mbuf_data_room = 0,
+                                  uint32_t ctrl_mbufs = 0,
+                                  bool slow_path = false)
       : pcie_addr_(pcie_addr),
         l2_addr_(l2_addr),
         ip_addr_(ip_addr),
         engine_threads_(engine_threads),
         cpu_mask_(cpu_mask),
+        rx_pipeline_mode_(rx_pipeline_mode),
+        ack_every_(ack_every),
+        rx_zerocopy_(rx_zerocopy),
+        tx_zerocopy_(tx_zerocopy),
+        tx_zerocopy_threshold_(tx_zerocopy_threshold),
+        tx_scheduler_mode_(tx_scheduler_mode),
+        tx_budget_(tx_budget),
+        tx_quantum_(tx_quantum),
+        flow_steering_(flow_steering),
+        rebalance_interval_ms_(rebalance_interval_ms),
+        idle_mode_(idle_mode),
+        cores_(std::move(cores)),
+        hw_timestamps_(hw_timestamps),
+        mtu_(mtu),
+        pacing_(pacing),
+        pacing_burst_(pacing_burst),
+        paths_(paths),
+        encryption_key_(std::move(encryption_key)),
+        neighbors_(std::move(neighbors)),
+        trace_sample_every_(trace_sample_every),
+        capture_records_(capture_records),
+        channel_pool_(channel_pool),
+        direct_queues_(direct_queues),
+        channel_arena_(channel_arena),
+        rexmit_packets_(rexmit_packets),
+        rx_descriptors_(rx_descriptors),
+        tx_descriptors_(tx_descriptors),
+        rx_mbufs_(rx_mbufs),
+        tx_mbufs_(tx_mbufs),
+        mbuf_data_room_(mbuf_data_room),
+        ctrl_mbufs_(ctrl_mbufs),
+        slow_path_(slow_path),
         dpdk_port_id_(std::nullopt) {}
   bool operator==(const NetworkInterfaceConfig &other) const {
     return l2_addr_ == other.l2_addr_;
@@ -40,16 +113,110 @@ class NetworkInterfaceConfig {
   const net::Ipv4::Address &ip_addr() const { return ip_addr_; }
   size_t engine_threads() const { return engine_threads_; }
   cpu_set_t cpu_mask() const { return cpu_mask_; }
+  RxPipelineMode rx_pipeline_mode() const { return rx_pipeline_mode_; }
+  uint32_t ack_every() const { return ack_every_; }
+  bool rx_zerocopy() const { return rx_zerocopy_; }
+  bool tx_zerocopy() const { return tx_zerocopy_; }
+  uint32_t tx_zerocopy_threshold() const { return tx_zerocopy_threshold_; }
+  TxSchedulerMode tx_scheduler_mode() const { return tx_scheduler_mode_; }
+  uint32_t tx_budget() const { return tx_budget_; }
+  uint32_t tx_quantum() const { return tx_quantum_; }
+  bool flow_steering() const { return flow_steering_; }
+  // Interval of channel rebalancing among the engines (0 if disabled).
+  uint32_t rebalance_interval_ms() const { return rebalance_interval_ms_; }
+  IdleMode idle_mode() const { return idle_mode_; }
+  // The core of each engine thread (engine `i' runs on `cores()[i]'), or empty
+  // to run them on `cpu_mask()'.
+  const std::vector<size_t> &cores() const { return cores_; }
+  // Whether to timestamp received packets on the NIC, if it supports it.
+  bool hw_timestamps() const { return hw_timestamps_; }
+  uint16_t mtu() const { return mtu_; }
+  // Whether flows pace their transmissions, and in bursts of how many packets
+  // (see `kDefaultPacingBurst').
+  bool pacing() const { return pacing_; }
+  uint32_t pacing_burst() const { return pacing_burst_; }
+  // Number of network paths the flows spread their packets over.
+  uint8_t paths() const { return paths_; }
+  // Pre-shared key to encrypt the flows with, if any.
+  const std::optional<crypto::Key> &encryption_key() const {
+    return encryption_key_;
+  }
+  // Neighbors to resolve ahead of time, and to keep resolved.
+  const std::vector<net::Ipv4::Address> &neighbors() const {
+    return neighbors_;
+  }
+  // Trace one in every this many messages (0: no tracing).
+  uint32_t trace_sample_every() const { return trace_sample_every_; }
+  // Records of the capture ring of each engine (0: no packet capture).
+  uint32_t capture_records() const { return capture_records_; }
+  // Warm channels to keep ready for applications to attach to (0: none).
+  uint32_t channel_pool() const { return channel_pool_; }
+  // Queue pairs to set aside for applications that run their own engine, as
+  // DPDK secondary processes (0: none; see `machnet_direct_queue()').
+  uint32_t direct_queues() const { return direct_queues_; }
+  // Channels to sub-allocate from a single arena of shared memory, registered
+  // for DMA once (0: each channel is a shared memory object of its own; see
+  // `shm::ChannelArena').
+  uint32_t channel_arena() const { return channel_arena_; }
+  // Packets sent that the flows of each engine keep, for retransmissions that
+  // do not copy their payloads again (0: none; see `net::flow::RexmitBudget').
+  uint32_t rexmit_packets() const { return rexmit_packets_; }
+  // Descriptors of each RX and TX queue of the NIC (0: the default, see
+  // `dpdk::PmdRing::kDefaultRingDescNr').
+  uint16_t rx_descriptors() const { return rx_descriptors_; }
+  uint16_t tx_descriptors() const { return tx_descriptors_; }
+  // Mbufs of the packet pool of each RX and TX queue, and their data room
+  // (0: the defaults, see `dpdk::PmdPort::PoolConfig').
+  uint32_t rx_mbufs() const { return rx_mbufs_; }
+  uint32_t tx_mbufs() const { return tx_mbufs_; }
+  uint16_t mbuf_data_room() const { return mbuf_data_room_; }
+  // Small mbufs of each TX queue for ACKs and other control packets (0: they
+  // take mbufs of the TX pool).
+  uint32_t ctrl_mbufs() const { return ctrl_mbufs_; }
+  // Whether ARP, ICMP and IPv6 are steered to a queue and a thread of their
+  // own (see `SlowPath'), off the engines.
+  bool slow_path() const { return slow_path_; }
   std::optional<uint16_t> dpdk_port_id() const { return dpdk_port_id_; }
   void Dump() const {
     LOG(INFO) << "NetworkInterfaceConfig: "
               << utils::Format(
                      "[PCIe: %s, L2: %s, IP: %s, engine_threads: %zu, "
-                     "cpu_mask: %lu, dpdk_port_id: %d]",
+                     "cpu_mask: %lu, rx_pipeline: %s, ack_every: %u, "
+                     "rx_zerocopy: %d, tx_zerocopy: %d (threshold: %u), "
+                     "tx_scheduler: %s (budget: %u, quantum: %u), "
+                     "flow_steering: %d, rebalance_interval_ms: %u, "
+                     "idle_mode: %s, cores: %s, hw_timestamps: %d, mtu: %u, "
+                     "pacing: %d (burst: %u), paths: %u, encryption: %d, "
+                     "neighbors: %zu, trace_sample_every: %u, "
+                     "capture_records: %u, channel_pool: %u, "
+                     "direct_queues: %u, channel_arena: %u, "
+                     "rexmit_packets: %u, rx_descriptors: %u, "
+                     "tx_descriptors: %u, rx_mbufs: %u, tx_mbufs: %u, "
+                     "mbuf_data_room: %u, ctrl_mbufs: %u, slow_path: %d, "
+                     "dpdk_port_id: %d]",
                      pcie_addr_.c_str(), l2_addr_.ToString().c_str(),
                      ip_addr_.ToString().c_str(), engine_threads_,
                      utils::cpuset_to_sizet(cpu_mask_),
-                     dpdk_port_id_.value_or(-1));
+                     rx_pipeline_mode_ == RxPipelineMode::kStaged
+                         ? "staged"
+                         : "sequential",
+                     ack_every_, rx_zerocopy_, tx_zerocopy_,
+                     tx_zerocopy_threshold_,
+                     tx_scheduler_mode_ == TxSchedulerMode::kDrr
+                         ? "drr"
+                         : "round_robin",
+                     tx_budget_, tx_quantum_, flow_steering_,
+                     rebalance_interval_ms_,
+                     idle_mode_ == IdleMode::kBusyPoll   ? "busy_poll"
+                     : idle_mode_ == IdleMode::kAdaptive ? "adaptive"
+                                                         : "interrupt",
+                     CoresToString().c_str(), hw_timestamps_, mtu_, pacing_,
+                     pacing_burst_, paths_, encryption_key_.has_value(),
+                     neighbors_.size(), trace_sample_every_,
+                     capture_records_, channel_pool_, direct_queues_,
+                     channel_arena_, rexmit_packets_, rx_descriptors_,
+                     tx_descriptors_, rx_mbufs_, tx_mbufs_, mbuf_data_room_,
+                     ctrl_mbufs_, slow_path_, dpdk_port_id_.value_or(-1));
   }
 
   void set_dpdk_port_id(std::optional<uint16_t> dpdk_port_id) {
@@ -57,11 +224,52 @@ class NetworkInterfaceConfig {
   }
 
  private:
+  std::string CoresToString() const {
+    std::string str;
+    for (const auto core : cores_) {
+      if (!str.empty()) str += ",";
+      str += std::to_string(core);
+    }
+    return str.empty() ? "-" : str;
+  }
+
   const std::string pcie_addr_;
   const net::Ethernet::Address l2_addr_;
   const net::Ipv4::Address ip_addr_;
   const size_t engine_threads_;
   cpu_set_t cpu_mask_;
+  const RxPipelineMode rx_pipeline_mode_;
+  const uint32_t ack_every_;
+  const bool rx_zerocopy_;
+  const bool tx_zerocopy_;
+  const uint32_t tx_zerocopy_threshold_;
+  const TxSchedulerMode tx_scheduler_mode_;
+  const uint32_t tx_budget_;
+  const uint32_t tx_quantum_;
+  const bool flow_steering_;
+  const uint32_t rebalance_interval_ms_;
+  const IdleMode idle_mode_;
+  const std::vector<size_t> cores_;
+  const bool hw_timestamps_;
+  const uint16_t mtu_;
+  const bool pacing_;
+  const uint32_t pacing_burst_;
+  const uint8_t paths_;
+  const std::optional<crypto::Key> encryption_key_;
+  const std::vector<net::Ipv4::Address> neighbors_;
+  const uint32_t trace_sample_every_;
+  const uint32_t capture_records_;
+  const uint32_t channel_pool_;
+  const uint32_t direct_queues_;
+  const uint32_t channel_arena_;
+  const uint32_t rexmit_packets_;
+  const uint16_t rx_descriptors_;
+  const uint16_t tx_descriptors_;
+  const uint32_t rx_mbufs_;
+  const uint32_t tx_mbufs_;
+  const uint16_t mbuf_data_room_;
+  const uint32_t ctrl_mbufs_;
+  const bool slow_path_;
   std::optional<uint16_t> dpdk_port_id_;
 };
 }  // namespace juggler
@@ -85,7 +293,8 @@ namespace juggler {
  *     "00:0d:3a:d6:9b:6a": {
  *         "ip": "10.0.0.1",
  *         "engine_threads": "1",
- *         "cpu_mask": "0x1"
+ *         "cpu_mask": "0x1",
+ *         "rx_pipeline": "staged"
  *     },
  *   }
  * }
@@ -96,6 +305,16 @@ namespace juggler {
  *
  * Note that `engine_threads` (decimal) and `cpu_mask` (hex) are optional. If
  * not specified, the default value is 1 and 0xFFFFFFFF respectively.
+ * `rx_pipeline` is also optional; it selects the RX processing mode of the
+ * engines ("sequential" or "staged"), with "sequential" being the default.
+ * `rx_zerocopy` (boolean, default false) lets the NIC receive payloads directly
+ * into the applications' channel buffers, where supported.
+ * `tx_zerocopy` (boolean, default false) lets channels send payloads of at
+ * least `tx_zerocopy_threshold` bytes straight from their buffers.
+ * `cores` (a CPU list, e.g., "2,4-6") pins each engine thread to a core of its
+ * own, in place of `cpu_mask`; `engine_threads` then defaults to the number of
+ * cores listed. Without either, the engine threads run on the cores of the
+ * NIC's NUMA node.
  */
 class MachnetConfigProcessor {
  public:
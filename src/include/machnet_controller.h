@@ -7,14 +7,25 @@
 #define SRC_INCLUDE_MACHNET_CONTROLLER_H_
 
 #include <channel.h>
+#include <clock_page.h>
+#include <engine_placement.h>
+#include <engine_rebalancer.h>
 #include <machnet_config.h>
 #include <machnet_ctrl.h>
 #include <machnet_engine.h>
+#include <slow_path.h>
 #include <ud_socket.h>
 #include <uuid/uuid.h>
 
+#include <chrono>
+#include <condition_variable>
 #include <csignal>
+#include <mutex>
+#include <optional>
+#include <string>
 #include <thread>
+#include <tuple>
+#include <vector>
 
 #include "common.h"
 
@@ -94,8 +105,9 @@ class MachnetController {
    * @param s The socket that is being connected.
    * @param data The data received.
    * @param length The length of the data received.
+   * @param fd The file descriptor carried with the message (-1 if none).
    */
-  void HandleNewMessage(UDSocket *s, const char *data, size_t length);
+  void HandleNewMessage(UDSocket *s, const char *data, size_t length, int fd);
 
   /**
    * @brief Callback to handle passive close of the socket.
@@ -140,10 +152,120 @@ class MachnetController {
    * @param[in] app_uuid     UUID of the originating application.
    * @param[in] channel_info Information about the channel to be created.
    * @param[out] fd         The file descriptor of the channel (-1 on failure).
+   * @param[out] granted    The channel as created: its UUID (that of a warm
+   *                        channel, if one is handed out), its sizes, the
+   *                        requested `MACHNET_CHANNEL_INFO_FLAGS_*' that were
+   *                        granted, and the engine it is placed on.
    * @return True if the channel has been created successfully, false otherwise.
    */
   bool CreateChannel(const uuid_t app_uuid,
-                     const machnet_channel_info_t *channel_info, int *fd);
+                     const machnet_channel_info_t *channel_info, int *fd,
+                     machnet_channel_info_t *granted);
+
+  /**
+   * @brief Take a channel back from an application (see `machnet_detach()'):
+   * its engine stops serving it, and it goes back to its pool (once the
+   * application is gone), if it came from one, or is destroyed.
+   * @param[in] app_uuid     UUID of the originating application.
+   * @param[in] channel_info Information about the channel.
+   * @return True on success, false if the channel is not the application's.
+   */
+  bool ReturnChannel(const uuid_t app_uuid,
+                     const machnet_channel_info_t *channel_info);
+
+  /**
+   * @brief Stop serving a channel, and release it (see `ReturnChannel()'). A
+   * warm channel is only handed out again once `owner', the application that
+   * may still map it (if any), is gone (see `UnregisterApplication()').
+   */
+  void ReleaseChannel(const std::string &channel_name,
+                      const std::string &owner = "");
+
+  /**
+   * @brief Hand out a warm channel for an engine to serve, if the pool of its
+   * port has one on the engine's NUMA node.
+   * @return The name of the channel, if any.
+   */
+  std::optional<std::string> TakePooledChannel(size_t engine_index);
+
+  /**
+   * @brief Create a warm channel in a pool.
+   * @return True on success.
+   */
+  bool AddPooledChannel(size_t pool_index);
+
+  /**
+   * @brief Scrub the channels given back to the pools that the engines are
+   * done with, so that they can be handed out again, and create the channels
+   * the pools are short of. Cheap when there is nothing to do.
+   */
+  void RefillChannelPools();
+
+  /**
+   * @brief Grant a direct queue to an application (see
+   * `machnet_direct_queue()'): a free one of the interface with the requested
+   * address, or of any interface.
+   *
+   * @param app_uuid The UUID of the application.
+   * @param request The requested interface.
+   * @param granted The queue granted, on success.
+   * @return True on success, false if no queue is free.
+   */
+  bool GrantDirectQueue(const uuid_t app_uuid,
+                        const machnet_direct_queue_info_t *request,
+                        machnet_direct_queue_info_t *granted);
+
+  /**
+   * @brief Steer a listening port to the direct queue of an application, or
+   * stop doing so (see `machnet_direct_listen()'). The ports of the blocks of
+   * the queue reach it already; the others are taken from the engines of the
+   * port, and steered by a flow rule of their own.
+   */
+  bool SteerDirectListener(const uuid_t app_uuid,
+                           const machnet_direct_addr_info_t *info);
+
+  /**
+   * @brief Resolve a remote address for the engine of a direct queue (see
+   * `machnet_direct_resolve()'). A new address is added to the neighbors of
+   * the interface, which the engines resolve and keep resolved; the response
+   * tells whether it is resolved already.
+   */
+  bool ResolveForDirectQueue(const uuid_t app_uuid,
+                             const machnet_direct_addr_info_t *request,
+                             machnet_direct_addr_info_t *response);
+
+  /**
+   * @brief Take the direct queues of an application back, along with its
+   * listening ports (e.g., when it exits).
+   */
+  void ReleaseDirectQueues(const std::string &app_uuid_str);
+
+  /**
+   * @brief Set up receive notifications for a channel of an application.
+   * @param[in] app_uuid     UUID of the originating application.
+   * @param[in] channel_info Information about the channel.
+   * @param[in] fd           The eventfd of the application; the channel takes
+   *                         ownership of it on success.
+   * @return True on success, false otherwise.
+   */
+  bool SetChannelNotifyFd(const uuid_t app_uuid,
+                          const machnet_channel_info_t *channel_info, int fd);
+
+  /**
+   * @brief Move a channel, and its flows, to another engine of the same port
+   * (see `MachnetEngine::DetachChannel()').
+   * @param channel_name The name of the channel.
+   * @param engine_index The engine to move the channel to.
+   * @return True on success, false if the channel stays where it was.
+   */
+  bool MigrateChannel(const std::string &channel_name, size_t engine_index);
+
+  /**
+   * @brief The main loop of the rebalancer thread: periodically balance the
+   * load of the engines of each port that asks for it (see
+   * `NetworkInterfaceConfig::rebalance_interval_ms()').
+   */
+  void RunRebalancer();
 
   /**
    * @brief The main loop of the controller.
@@ -163,7 +285,98 @@ class MachnetController {
   dpdk::Dpdk dpdk_{};
   std::vector<std::shared_ptr<dpdk::PmdPort>> pmd_ports_{};
   std::vector<std::shared_ptr<MachnetEngine>> engines_{};
+  // Where each engine runs (indexed by engine), and the engine of each channel.
+  std::vector<MachnetChannelPlacement_t> engine_placements_{};
+  std::unique_ptr<EnginePlacement> engine_placement_{nullptr};
+  std::unordered_map<std::string, size_t> channel_engines_{};
+  // Rebalancing state of a port: its engines (indices in `engines_'), their
+  // load counters at the last round, and when the next round is due.
+  struct PortRebalancer {
+    std::vector<size_t> engines;
+    std::chrono::milliseconds interval;
+    std::chrono::steady_clock::time_point next_round;
+    std::unique_ptr<EngineRebalancer> rebalancer;
+    std::vector<MachnetEngine::LoadStats> last_load;
+    uint64_t last_tsc;
+  };
+  void RebalancePort(PortRebalancer *port);
+  std::vector<PortRebalancer> port_rebalancers_{};
+  // Warm channels of a port (see `NetworkInterfaceConfig::channel_pool()'),
+  // to hand out to applications that attach with the default sizes. They are
+  // all of the default shape, on the NUMA node of the port, and registered for
+  // DMA if its engines use zero-copy; they count towards
+  // `ChannelManager::kMaxChannelNr', unless they come from the arena of the
+  // port.
+  struct ChannelPool {
+    std::shared_ptr<dpdk::PmdPort> pmd_port;
+    // Channels of the pool, handed out or not.
+    size_t size;
+    size_t channels_nr;
+    int numa_node;
+    size_t buffer_size;
+    bool dma;
+    // Channels ready to be handed out.
+    std::vector<std::string> idle;
+    // Channels given back, until their engine (and the NIC) let go of them,
+    // and until the application they were handed out to (`owner', if not
+    // empty) disconnects: it may keep them mapped after `machnet_detach()'.
+    struct Returned {
+      std::string name;
+      std::string owner;
+    };
+    std::vector<Returned> returned;
+  };
+  std::vector<ChannelPool> channel_pools_{};
+  // The pool of each channel that comes from one.
+  std::unordered_map<std::string, size_t> pooled_channels_{};
+  // The arena that the channels of a port are sub-allocated from (see
+  // `NetworkInterfaceConfig::channel_arena()'), for the default shape, on the
+  // NUMA node of the port, and registered for DMA if its engines use
+  // zero-copy.
+  struct PortArena {
+    std::shared_ptr<dpdk::PmdPort> pmd_port;
+    int numa_node;
+    std::shared_ptr<shm::ChannelArena> arena;
+  };
+  // The arena for a channel of a port on a NUMA node (-1: any), if any.
+  std::shared_ptr<shm::ChannelArena> GetChannelArena(
+      const std::shared_ptr<dpdk::PmdPort> &pmd_port, int numa_node) const;
+  std::vector<PortArena> channel_arenas_{};
+  // A queue pair of a port set aside for an application that runs its own
+  // engine, as a DPDK secondary process (see
+  // `NetworkInterfaceConfig::direct_queues()'). Its port blocks are reserved
+  // in the shared state of the port (see
+  // `MachnetEngineSharedState::ReservePortSteeringQueue()').
+  struct DirectQueue {
+    std::shared_ptr<dpdk::PmdPort> pmd_port;
+    std::shared_ptr<MachnetEngineSharedState> shared_state;
+    net::Ipv4::Address ip_addr;
+    uint16_t queue_id;
+    // The application it is granted to (empty if none).
+    std::string app_uuid;
+    // Listening ports outside of the blocks of the queue, and their rules.
+    std::vector<std::tuple<net::Ipv4::Address, net::Udp::Port, rte_flow *>>
+        listeners;
+    // A reader of the ARP table of the port, for the controller thread.
+    std::unique_ptr<MachnetEngineSharedState::ArpTableReader> arp_reader;
+  };
+  // The direct queue of an application on a local address, if any.
+  DirectQueue *FindDirectQueue(const std::string &app_uuid_str,
+                               const net::Ipv4::Address &ip_addr);
+  std::vector<DirectQueue> direct_queues_{};
+  // The slow paths of the ports (see `NetworkInterfaceConfig::slow_path()').
+  std::vector<std::unique_ptr<SlowPath>> slow_paths_{};
+  // Messages exchanged by each channel at the last rebalancing round.
+  std::unordered_map<std::string, uint64_t> channel_msgs_{};
+  std::thread rebalancer_thread_{};
+  bool rebalancer_running_{false};
+  std::condition_variable rebalancer_cv_{};
+  // Serializes the handling of control messages and the rebalancing rounds.
+  std::mutex mtx_{};
   std::unique_ptr<UDServer> server_{nullptr};
+  // The calibration of the TSC for the engines and the applications (see
+  // `MACHNET_CTRL_MSG_TYPE_REQ_CLOCK'), if it could be set up.
+  std::unique_ptr<time::ClockPage> clock_page_{nullptr};
   std::unordered_map<std::string, std::unordered_set<std::string>>
       applications_registered_{};
 };
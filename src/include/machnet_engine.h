@@ -5,27 +5,48 @@
 #ifndef SRC_INCLUDE_MACHNET_ENGINE_H_
 #define SRC_INCLUDE_MACHNET_ENGINE_H_
 
+#include <aes_gcm.h>
 #include <arp.h>
 #include <channel.h>
+#include <command_ring.h>
 #include <common.h>
+#include <cycle_accounting.h>
+#include <engine_stats.h>
 #include <ether.h>
 #include <flow.h>
+#include <flow_table.h>
 #include <icmp.h>
+#include <idle_policy.h>
 #include <ipv4.h>
+#include <latency_histogram.h>
+#include <message_tracer.h>
+#include <neighbor_table.h>
+#include <packet_capture.h>
 #include <pmd.h>
+#include <rcu.h>
+#include <rte_pause.h>
 #include <rte_thash.h>
+#include <timer_wheel.h>
+#include <ttime.h>
+#include <tx_scheduler.h>
 #include <udp.h>
 
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <chrono>
 #include <concepts>
 #include <cstddef>
 #include <functional>
 #include <future>
+#include <limits>
 #include <list>
 #include <memory>
 #include <optional>
 #include <string>
 #include <tuple>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 namespace juggler {
@@ -34,30 +55,42 @@ namespace juggler {
  * @brief Class `MachnetEngineSharedState' contains any state that might need to
  * be shared among different engines. This might be required when multiple
  * engine threads operate on a single PMD, sharing one or more IP addresses.
+ *
+ * The engines use it from their datapath, so it takes no locks: ports are
+ * allocated and listeners registered with atomic operations on per-address
+ * bitmaps, and the ARP table is a read-mostly snapshot (see `NeighborTable')
+ * that each engine reads through an `ArpTableReader' of its own.
  */
 class MachnetEngineSharedState {
  public:
+  using ArpTableReader = NeighborTable::Reader;
+
   static const size_t kSrcPortMin = (1 << 10);      // 1024
   static const size_t kSrcPortMax = (1 << 16) - 1;  // 65535
   static constexpr size_t kSrcPortBitmapSize =
       (kSrcPortMax + 1) / sizeof(uint64_t) / 8;
+  // Priorities of the flow rules for port steering: the rules of listening
+  // ports take precedence over the ones of the port blocks.
+  static constexpr uint32_t kListenerSteeringRulePriority = 0;
+  static constexpr uint32_t kPortSteeringRulePriority = 1;
   explicit MachnetEngineSharedState(std::vector<uint8_t> rss_key,
                                     net::Ethernet::Address l2addr,
                                     std::vector<net::Ipv4::Address> ipv4_addrs)
-      : rss_key_(rss_key), arp_handler_(l2addr, ipv4_addrs) {
+      : rss_key_(rss_key),
+        arp_handler_(l2addr, ipv4_addrs),
+        ipv4_addrs_(ipv4_addrs) {
     for (const auto &addr : ipv4_addrs) {
-      CHECK(ipv4_port_bitmap_.find(addr) == ipv4_port_bitmap_.end());
-      ipv4_port_bitmap_.insert({addr, std::vector<uint64_t>(1, UINT64_MAX)});
+      CHECK(local_addrs_.find(addr) == local_addrs_.end());
+      local_addrs_.emplace(addr, std::make_unique<LocalAddress>());
     }
   }
 
-  const std::unordered_map<net::Ipv4::Address, std::vector<uint64_t>>
-      &GetIpv4PortBitmap() const {
-    return ipv4_port_bitmap_;
+  const std::vector<net::Ipv4::Address> &GetIpv4Addresses() const {
+    return ipv4_addrs_;
   }
 
   bool IsLocalIpv4Address(const net::Ipv4::Address &ipv4_addr) const {
-    return ipv4_port_bitmap_.find(ipv4_addr) != ipv4_port_bitmap_.end();
+    return local_addrs_.find(ipv4_addr) != local_addrs_.end();
   }
 
   /**
@@ -95,26 +128,33 @@ class MachnetEngineSharedState {
       const net::Ipv4::Address &ipv4_addr,
       std::predicate<uint16_t> auto &&lambda) {
     constexpr size_t bits_per_slot = sizeof(uint64_t) * 8;
-    auto it = ipv4_port_bitmap_.find(ipv4_addr);
-    if (it == ipv4_port_bitmap_.end()) {
+    auto it = local_addrs_.find(ipv4_addr);
+    if (it == local_addrs_.end()) {
       return std::nullopt;
     }
 
     // Helper lambda to find a free port.
-    // Given a 64-bit wide slot in a bitmap (vector of uint64_t), find the first
-    // available port that satisfies the lambda condition.
+    // Given a 64-bit wide slot in a bitmap, find the first available port that
+    // satisfies the lambda condition.
     auto find_free_port = [&lambda, &bits_per_slot](
                               auto &bitmap,
                               size_t index) -> std::optional<net::Udp::Port> {
+      auto bits = bitmap[index].load(std::memory_order_relaxed);
       auto mask = ~0ULL;
       do {
-        auto pos = __builtin_ffsll(bitmap[index] & mask);
+        auto pos = __builtin_ffsll(bits & mask);
         if (pos == 0) break;  // This slot is fully used.
         const size_t candidate_port = index * bits_per_slot + pos - 1;
         if (candidate_port > kSrcPortMax) break;  // Illegal port.
         if (lambda(candidate_port)) {
-          bitmap[index] &= ~(1ULL << (pos - 1));
-          return net::Udp::Port(candidate_port);
+          // Another engine may take a port of the slot meanwhile; if so, look
+          // at the slot again.
+          if (bitmap[index].compare_exchange_weak(
+                  bits, bits & ~(1ULL << (pos - 1)),
+                  std::memory_order_acq_rel, std::memory_order_relaxed)) {
+            return net::Udp::Port(candidate_port);
+          }
+          continue;
         }
         // If we reached the end of the slot and the port is not suitable,
         // abort.
@@ -126,29 +166,150 @@ class MachnetEngineSharedState {
       return std::nullopt;
     };
 
-    const std::lock_guard<std::mutex> lock(mtx_);
-    auto &bitmap = it->second;
-    // Calculate how many bitmap elements are required to cover port
-    // kSrcPortMin.
+    auto &bitmap = it->second->port_bitmap;
+    // The first bitmap element that covers port kSrcPortMin.
     const size_t first_valid_slot = kSrcPortMin / bits_per_slot;
-    if (bitmap.size() < first_valid_slot + 1) {
-      bitmap.resize(first_valid_slot + 1, ~0ULL);
-    }
-
     for (size_t i = first_valid_slot; i < bitmap.size(); i++) {
-      if (bitmap[i] == 0) continue;  // This slot is fully used.
+      // This slot is fully used.
+      if (bitmap[i].load(std::memory_order_relaxed) == 0) continue;
       auto port = find_free_port(bitmap, i);
       if (port.has_value()) {
         return port;
       }
     }
 
-    while (bitmap.size() < kSrcPortBitmapSize) {
-      // We have exhausted the current bitmap, but there is still space to
-      // allocate more ports.
-      bitmap.emplace_back(~0ULL);
-      auto port = find_free_port(bitmap, bitmap.size() - 1);
-      if (port.has_value()) return port;
+    return std::nullopt;
+  }
+
+  /**
+   * @brief Number of port blocks for port steering over `rx_queues_nr' RX
+   * queues (see `EnablePortSteering()'): the smallest power of two that is
+   * not smaller than the number of queues.
+   */
+  static size_t PortSteeringBlocksNr(size_t rx_queues_nr) {
+    CHECK_GT(rx_queues_nr, 0);
+    CHECK_LE(rx_queues_nr, kSrcPortBitmapSize);
+    size_t blocks_nr = 1;
+    while (blocks_nr < rx_queues_nr) blocks_nr <<= 1;
+    return blocks_nr;
+  }
+
+  /**
+   * @brief Size (in ports) of each port block for port steering over
+   * `rx_queues_nr' RX queues.
+   */
+  static size_t PortSteeringBlockSize(size_t rx_queues_nr) {
+    return (kSrcPortMax + 1) / PortSteeringBlocksNr(rx_queues_nr);
+  }
+
+  /**
+   * @brief Switches the allocation of source ports to port steering: the port
+   * space is split into `PortSteeringBlocksNr()' aligned blocks of equal size,
+   * block `b' being served by RX queue `b % rx_queues_nr'. The NIC must steer
+   * the packets destined to each block to its queue (e.g., with
+   * `PmdPort::AddUdpSteeringRule()'), so that the source port of a flow alone
+   * decides the queue its replies land on, and allocating one does not search
+   * for a port that RSS happens to hash to the right queue.
+   *
+   * @attention Must be called before any ports are allocated.
+   */
+  void EnablePortSteering(size_t rx_queues_nr) {
+    port_steering_queues_nr_ = rx_queues_nr;
+    port_steering_cursors_.assign(rx_queues_nr, 0);
+  }
+
+  bool IsPortSteeringEnabled() const { return port_steering_queues_nr_ != 0; }
+
+  /**
+   * @return The RX queue that serves the port block of `port' (see
+   * `EnablePortSteering()').
+   */
+  size_t PortSteeringQueue(const net::Udp::Port &port) const {
+    CHECK(IsPortSteeringEnabled());
+    const size_t block_size = PortSteeringBlockSize(port_steering_queues_nr_);
+    return (port.port.value() / block_size) % port_steering_queues_nr_;
+  }
+
+  /**
+   * @brief Marks all the ports of the blocks of an RX queue as used (see
+   * `EnablePortSteering()'), for a queue that allocates its ports elsewhere
+   * (i.e., a queue driven directly by an application, see
+   * `dpdk::PmdPort::ReserveQueues()'): no local flow or listener takes them.
+   *
+   * @attention Must be called before any ports are allocated.
+   */
+  void ReservePortSteeringQueue(size_t rx_queue_id) {
+    constexpr size_t bits_per_slot = sizeof(uint64_t) * 8;
+    CHECK(IsPortSteeringEnabled());
+    CHECK_LT(rx_queue_id, port_steering_queues_nr_);
+    const size_t blocks_nr = PortSteeringBlocksNr(port_steering_queues_nr_);
+    const size_t block_slots =
+        PortSteeringBlockSize(port_steering_queues_nr_) / bits_per_slot;
+    for (auto &[_, local_addr] : local_addrs_) {
+      for (size_t block = rx_queue_id; block < blocks_nr;
+           block += port_steering_queues_nr_) {
+        for (size_t i = 0; i < block_slots; i++) {
+          local_addr->port_bitmap[block * block_slots + i].store(
+              0, std::memory_order_relaxed);
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Allocates a source UDP port for a given IPv4 address, from the port
+   * blocks of an RX queue (see `EnablePortSteering()'). The search resumes
+   * where the last one for the queue stopped, and skips 64 used ports at a
+   * time, so its cost does not grow with the number of ports in use.
+   * Each RX queue must allocate from a single thread (i.e., its engine's).
+   *
+   * @param ipv4_addr The IPv4 address for which the source port is allocated.
+   * @param rx_queue_id The RX queue that must receive the flow's packets.
+   * @return std::optional<net::Udp::Port> containing the allocated source port
+   * if found, or std::nullopt otherwise.
+   */
+  std::optional<net::Udp::Port> SrcPortAllocSteered(
+      const net::Ipv4::Address &ipv4_addr, size_t rx_queue_id) {
+    constexpr size_t bits_per_slot = sizeof(uint64_t) * 8;
+    CHECK(IsPortSteeringEnabled());
+    CHECK_LT(rx_queue_id, port_steering_queues_nr_);
+    auto it = local_addrs_.find(ipv4_addr);
+    if (it == local_addrs_.end()) {
+      return std::nullopt;
+    }
+
+    auto &bitmap = it->second->port_bitmap;
+
+    // The slots of the blocks of this queue, in order.
+    const size_t blocks_nr = PortSteeringBlocksNr(port_steering_queues_nr_);
+    const size_t block_slots =
+        PortSteeringBlockSize(port_steering_queues_nr_) / bits_per_slot;
+    const size_t queue_blocks_nr =
+        (blocks_nr - rx_queue_id + port_steering_queues_nr_ - 1) /
+        port_steering_queues_nr_;
+    const size_t queue_slots = queue_blocks_nr * block_slots;
+    auto slot_of = [&](size_t i) {
+      const size_t block =
+          rx_queue_id + (i / block_slots) * port_steering_queues_nr_;
+      return block * block_slots + i % block_slots;
+    };
+
+    auto &cursor = port_steering_cursors_[rx_queue_id];
+    for (size_t n = 0; n < queue_slots; n++) {
+      const size_t i = (cursor + n) % queue_slots;
+      const size_t slot = slot_of(i);
+      // Ports below kSrcPortMin are reserved (e.g., for listeners).
+      if (slot < kSrcPortMin / bits_per_slot) continue;
+      auto bits = bitmap[slot].load(std::memory_order_relaxed);
+      while (bits != 0) {
+        const auto pos = __builtin_ctzll(bits);
+        if (bitmap[slot].compare_exchange_weak(bits, bits & ~(1ULL << pos),
+                                               std::memory_order_acq_rel,
+                                               std::memory_order_relaxed)) {
+          cursor = i;
+          return net::Udp::Port(slot * bits_per_slot + pos);
+        }
+      }
     }
 
     return std::nullopt;
@@ -166,8 +327,7 @@ class MachnetEngineSharedState {
    * @param port The net::Udp::Port instance representing the allocated source
    * port to be released.
    *
-   * @note Thread-safe, as it uses a lock_guard to protect concurrent access to
-   * the shared data.
+   * @note Thread-safe (lock-free).
    *
    * Example usage:
    * @code
@@ -178,8 +338,15 @@ class MachnetEngineSharedState {
    */
   void SrcPortRelease(const net::Ipv4::Address &ipv4_addr,
                       const net::Udp::Port &port) {
-    const std::lock_guard<std::mutex> lock(mtx_);
-    SrcPortReleaseLocked(ipv4_addr, port);
+    auto it = local_addrs_.find(ipv4_addr);
+    if (it == local_addrs_.end()) {
+      return;
+    }
+
+    constexpr size_t bits_per_slot = sizeof(uint64_t) * 8;
+    const auto p = port.port.value();
+    it->second->port_bitmap[p / bits_per_slot].fetch_or(
+        1ULL << (p % bits_per_slot), std::memory_order_release);
   }
 
   /**
@@ -202,8 +369,7 @@ class MachnetEngineSharedState {
    * successful. Returns `true` if the port is available and the registration
    * operation is successful, `false` otherwise.
    *
-   * @note Thread-safe, as it uses a lock_guard to protect concurrent access to
-   * the shared data.
+   * @note Thread-safe (lock-free).
    *
    * Example usage:
    * @code
@@ -216,27 +382,23 @@ class MachnetEngineSharedState {
    */
   bool RegisterListener(const net::Ipv4::Address &ipv4_addr,
                         const net::Udp::Port &port, size_t rx_queue_id) {
-    const std::lock_guard<std::mutex> lock(mtx_);
-    if (ipv4_port_bitmap_.find(ipv4_addr) == ipv4_port_bitmap_.end()) {
+    CHECK_LT(rx_queue_id, std::numeric_limits<uint16_t>::max());
+    auto it = local_addrs_.find(ipv4_addr);
+    if (it == local_addrs_.end()) {
       return false;
     }
 
     constexpr size_t bits_per_slot = sizeof(uint64_t) * 8;
-    auto p = port.port.value();
-    const auto slot = p / bits_per_slot;
-    const auto bit = p % bits_per_slot;
-    auto &bitmap = ipv4_port_bitmap_[ipv4_addr];
-    if (slot >= bitmap.size()) {
-      // Allocate more elements in the bitmap.
-      bitmap.resize(slot + 1, ~0ULL);
-    }
-    // Check if the port is already in use (i.e, bit is unset).
-    if (!(bitmap[slot] & (1ULL << bit))) return false;
-    bitmap[slot] &= ~(1ULL << bit);
+    const auto p = port.port.value();
+    const uint64_t bit = 1ULL << (p % bits_per_slot);
+    // Claim the port, unless it is already in use (i.e, bit is unset).
+    auto &slot = it->second->port_bitmap[p / bits_per_slot];
+    if (!(slot.fetch_and(~bit, std::memory_order_acq_rel) & bit)) return false;
 
     // Add the port and engine to the listeners.
-    DCHECK(listeners_to_rxq.find({ipv4_addr, port}) == listeners_to_rxq.end());
-    listeners_to_rxq[{ipv4_addr, port}] = rx_queue_id;
+    auto &listener_rxq = it->second->listener_rxq[p];
+    DCHECK_EQ(listener_rxq.load(std::memory_order_relaxed), 0);
+    listener_rxq.store(rx_queue_id + 1, std::memory_order_release);
 
     return true;
   }
@@ -253,8 +415,7 @@ class MachnetEngineSharedState {
    * @param port The net::Udp::Port instance representing the source port
    * associated with the listener.
    *
-   * @note Thread-safe, as it uses a lock_guard to protect concurrent access to
-   * the shared data.
+   * @note Thread-safe (lock-free).
    *
    * Example usage:
    * @code
@@ -266,70 +427,266 @@ class MachnetEngineSharedState {
    */
   void UnregisterListener(const net::Ipv4::Address &ipv4_addr,
                           const net::Udp::Port &port) {
-    const std::lock_guard<std::mutex> lock(mtx_);
-    auto it = listeners_to_rxq.find({ipv4_addr, port});
-    if (it == listeners_to_rxq.end()) {
+    auto it = local_addrs_.find(ipv4_addr);
+    if (it == local_addrs_.end()) {
       return;
     }
 
-    listeners_to_rxq.erase(it);
-    SrcPortReleaseLocked(ipv4_addr, port);
+    if (it->second->listener_rxq[port.port.value()].exchange(
+            0, std::memory_order_acq_rel) == 0) {
+      return;
+    }
+    SrcPortRelease(ipv4_addr, port);
   }
 
-  std::optional<net::Ethernet::Address> GetL2Addr(
-      const dpdk::TxRing *txring, const net::Ipv4::Address &local_ip,
-      const net::Ipv4::Address &target_ip) {
-    const std::lock_guard<std::mutex> lock(mtx_);
-    return arp_handler_.GetL2Addr(txring, local_ip, target_ip);
+  /**
+   * @return The RX queue registered for the listener on a given IPv4 address
+   * and UDP port (see `RegisterListener()'), or std::nullopt if there is no
+   * such listener.
+   */
+  std::optional<size_t> GetListenerRxQueue(const net::Ipv4::Address &ipv4_addr,
+                                           const net::Udp::Port &port) const {
+    auto it = local_addrs_.find(ipv4_addr);
+    if (it == local_addrs_.end()) return std::nullopt;
+    const auto rxq = it->second->listener_rxq[port.port.value()].load(
+        std::memory_order_acquire);
+    if (rxq == 0) return std::nullopt;
+    return rxq - 1;
   }
 
-  void ProcessArpPacket(dpdk::TxRing *txring, net::Arp *arph) {
-    const std::lock_guard<std::mutex> lock(mtx_);
-    arp_handler_.ProcessArpPacket(txring, arph);
+  /**
+   * @brief Hooks for an engine that runs outside of the Machnet controller,
+   * in an application (see `DirectEngine'): the controller keeps owning the
+   * ARP table and the flow rules of the port, so the engine asks it to
+   * resolve addresses (the ARP replies land on the controller's queues), and
+   * to steer its listening ports.
+   */
+  struct Delegate {
+    // The MAC address of `ip', or `std::nullopt' if it is not resolved yet.
+    std::function<std::optional<net::Ethernet::Address>(
+        const net::Ipv4::Address &local_ip, const net::Ipv4::Address &ip)>
+        resolve;
+    // Steer a listening port to the engine's queue (`listen'), or stop doing
+    // so; false on failure.
+    std::function<bool(const net::Ipv4::Address &ip,
+                       const net::Udp::Port &port, bool listen)>
+        steer_listener;
+  };
+
+  /**
+   * @brief Hand the ARP requests and the steering of listening ports over to
+   * `delegate' (see `Delegate'). Must be called before the engines run.
+   */
+  void SetDelegate(Delegate delegate) {
+    CHECK(delegate.resolve != nullptr && delegate.steer_listener != nullptr);
+    delegate_ = std::move(delegate);
   }
 
-  std::vector<std::tuple<std::string, std::string>> GetArpTableEntries() {
-    const std::lock_guard<std::mutex> lock(mtx_);
-    return arp_handler_.GetArpTableEntries();
+  bool IsDelegated() const { return delegate_.resolve != nullptr; }
+
+  // Steer a listening port through the delegate (see `Delegate').
+  bool SteerListener(const net::Ipv4::Address &ip, const net::Udp::Port &port,
+                     bool listen) {
+    CHECK(IsDelegated());
+    return delegate_.steer_listener(ip, port, listen);
   }
 
- private:
-  struct hash_ip_port_pair {
-    template <typename T, typename U>
-    std::size_t operator()(const std::pair<T, U> &x) const {
-      return std::hash<T>()(x.first) ^ std::hash<U>()(x.second);
+  // A reader of the ARP table, for the calling engine thread.
+  std::unique_ptr<ArpTableReader> NewArpTableReader() {
+    return neighbors_.NewReader();
+  }
+
+  // The MAC address of `ip' in the ARP table, if it is resolved.
+  static std::optional<net::Ethernet::Address> LookupL2Addr(
+      ArpTableReader *reader, const net::Ipv4::Address &ip) {
+    return NeighborTable::Lookup(reader, ip);
+  }
+
+  /**
+   * @brief Resolve the MAC address of a target IP address from the ARP
+   * table; if it is not there, issue an ARP request for it (once: the table
+   * requests it again as needed, see `MaintainArpTable()').
+   *
+   * @param reader The ARP table reader of the calling thread.
+   * @return The MAC address, or `std::nullopt' if it is not known yet.
+   */
+  std::optional<net::Ethernet::Address> GetL2Addr(
+      ArpTableReader *reader, const dpdk::TxRing *txring,
+      const net::Ipv4::Address &local_ip,
+      const net::Ipv4::Address &target_ip) {
+    const auto l2addr = NeighborTable::Lookup(reader, target_ip);
+    if (l2addr.has_value()) return l2addr;
+
+    if (neighbors_.Resolve(reader, local_ip, target_ip, Now())) {
+      if (IsDelegated()) return ResolveDelegated(reader, local_ip, target_ip);
+      arp_handler_.RequestL2Addr(txring, local_ip, target_ip);
     }
-  };
+    return std::nullopt;
+  }
 
   /**
-   * @brief Private method to release a previously allocated UDP source port.
+   * @brief Resolve the MAC address of a neighbor ahead of time, and keep it
+   * resolved (see `NeighborTable::AddNeighbor()'). Thread-safe; not for the
+   * datapath, as it may wait for an engine updating the table.
    *
-   * @attention This method is not thread-safe, and should only be called when
-   * locked.
+   * @param txring The TX ring to send the first ARP request on right away, if
+   * any; otherwise, the address is requested by the next maintenance of the
+   * table (see `MaintainArpTable()').
    */
-  void SrcPortReleaseLocked(const net::Ipv4::Address &ipv4_addr,
-                            const net::Udp::Port &port) {
-    auto it = ipv4_port_bitmap_.find(ipv4_addr);
-    if (it == ipv4_port_bitmap_.end()) {
-      return;
+  void AddNeighbor(const net::Ipv4::Address &local_ip,
+                   const net::Ipv4::Address &ip,
+                   const dpdk::TxRing *txring = nullptr) {
+    if (neighbors_.AddNeighbor(local_ip, ip, Now()) && txring != nullptr) {
+      arp_handler_.RequestL2Addr(txring, local_ip, ip);
     }
+  }
 
-    constexpr size_t bits_per_slot = sizeof(uint64_t) * 8;
-    auto p = port.port.value();
-    const auto slot = p / bits_per_slot;
-    const auto bit = p % bits_per_slot;
-    auto &bitmap = ipv4_port_bitmap_[ipv4_addr];
-    bitmap[slot] |= (1ULL << bit);
+  /**
+   * @brief Handle a received ARP packet: reply to requests for our addresses,
+   * and learn the addresses of the senders of replies.
+   *
+   * An engine does not wait for another one that is updating the ARP table; it
+   * drops the reply instead, as if it had been lost (the address is requested
+   * again, see `MaintainArpTable()').
+   *
+   * @param reader The ARP table reader of the calling thread.
+   */
+  void ProcessArpPacket(ArpTableReader *reader, dpdk::TxRing *txring,
+                        const net::Arp *arph) {
+    const auto entry = arp_handler_.HandleArpPacket(txring, arph);
+    if (!entry.has_value()) return;
+    const auto &[ip_addr, l2_addr] = entry.value();
+    const bool learned = neighbors_.Learn(reader, arph->ipv4_data.tpa, ip_addr,
+                                          l2_addr, Now());
+    LOG_IF(WARNING, !learned)
+        << "ARP table busy; dropped ARP reply from " << ip_addr.ToString();
   }
 
+  /**
+   * @brief Background maintenance of the ARP table (see
+   * `NeighborTable::Maintain()'): the engines call it periodically, and one of
+   * them at a time sends the ARP requests due.
+   */
+  void MaintainArpTable(ArpTableReader *reader, const dpdk::TxRing *txring) {
+    std::vector<std::pair<net::Ipv4::Address, net::Ipv4::Address>> delegated;
+    neighbors_.Maintain(reader, Now(),
+                        [&](const net::Ipv4::Address &local_ip,
+                            const net::Ipv4::Address &ip) {
+                          if (IsDelegated()) {
+                            delegated.emplace_back(local_ip, ip);
+                            return;
+                          }
+                          arp_handler_.RequestL2Addr(txring, local_ip, ip);
+                        });
+    // Learned once the maintenance is done walking the table with `reader'.
+    for (const auto &[local_ip, ip] : delegated) {
+      ResolveDelegated(reader, local_ip, ip);
+    }
+  }
+
+  std::vector<std::tuple<std::string, std::string>> GetArpTableEntries(
+      ArpTableReader *reader) const {
+    std::vector<std::tuple<std::string, std::string>> entries;
+    for (const auto &[ip_addr, entry] : reader->Get()) {
+      entries.emplace_back(ip_addr.ToString(),
+                           entry.l2addr.has_value() ? entry.l2addr->ToString()
+                                                    : "(resolving)");
+    }
+    return entries;
+  }
+
+ private:
+  // Current time in nanoseconds, on the TSC.
+  static uint64_t Now() { return time::cycles_to_ns(time::rdtsc()); }
+
+  // Resolve `ip' through the delegate, and learn its address if it is known.
+  std::optional<net::Ethernet::Address> ResolveDelegated(
+      ArpTableReader *reader, const net::Ipv4::Address &local_ip,
+      const net::Ipv4::Address &ip) {
+    const auto l2addr = delegate_.resolve(local_ip, ip);
+    if (l2addr.has_value()) {
+      neighbors_.Learn(reader, local_ip, ip, l2addr.value(), Now());
+    }
+    return l2addr;
+  }
+
+  // The ports of a local IPv4 address.
+  struct LocalAddress {
+    LocalAddress() {
+      for (auto &slot : port_bitmap) slot.store(~0ULL);
+    }
+    // Free (bit set) and used (bit unset) UDP ports.
+    std::array<std::atomic<uint64_t>, kSrcPortBitmapSize> port_bitmap;
+    // The RX queue (plus one) of the listener of each port, or 0 if none.
+    std::array<std::atomic<uint16_t>, kSrcPortMax + 1> listener_rxq{};
+  };
+
   const std::vector<uint8_t> rss_key_;
-  ArpHandler arp_handler_;
-  std::mutex mtx_{};
-  std::unordered_map<net::Ipv4::Address, std::vector<uint64_t>>
-      ipv4_port_bitmap_{};
-  std::unordered_map<std::pair<net::Ipv4::Address, net::Udp::Port>, size_t,
-                     hash_ip_port_pair>
-      listeners_to_rxq{};
+  // Shared by the engines for its const methods only (which are thread-safe);
+  // the ARP table is kept in `neighbors_' instead.
+  const ArpHandler arp_handler_;
+  NeighborTable neighbors_;
+  const std::vector<net::Ipv4::Address> ipv4_addrs_;
+  // Number of RX queues for port steering (0 if disabled, see
+  // `EnablePortSteering()'), and where the last search of each queue stopped.
+  size_t port_steering_queues_nr_{0};
+  std::vector<size_t> port_steering_cursors_{};
+  // Set for an engine outside of the controller (see `SetDelegate()').
+  Delegate delegate_{};
+  // Never modified after construction, so that lookups need no lock.
+  std::unordered_map<net::Ipv4::Address, std::unique_ptr<LocalAddress>>
+      local_addrs_{};
+};
+
+/**
+ * @brief The options of a `MachnetEngine' (`MachnetEngine::Options'), each
+ * with its default. Set the ones that matter with designated initializers,
+ * e.g., `{.ack_every = 1, .tx_zerocopy = true}'.
+ */
+struct MachnetEngineOptions {
+  // RX processing mode (see `RxPipelineMode').
+  RxPipelineMode rx_pipeline_mode{RxPipelineMode::kSequential};
+  // ACK coalescing factor of the flows (see `kDefaultAckEvery').
+  uint32_t ack_every{kDefaultAckEvery};
+  // Receive packet payloads directly into channel buffers, if the NIC
+  // supports it (see `MachnetEngine::EnableRxZeroCopy()').
+  bool rx_zerocopy{false};
+  // Let channels send payloads directly from their buffers (see
+  // `MachnetEngine::tx_zerocopy()').
+  bool tx_zerocopy{false};
+  // Minimum payload size to send zero-copy (see
+  // `kDefaultTxZeroCopyThreshold').
+  uint32_t tx_zerocopy_threshold{kDefaultTxZeroCopyThreshold};
+  // Scheduling of the messages of the channels (see `TxSchedulerMode').
+  TxSchedulerMode tx_scheduler_mode{TxSchedulerMode::kRoundRobin};
+  // TX budget (in packets) of an iteration, with deficit round robin
+  // scheduling.
+  uint32_t tx_budget{kDefaultTxBudget};
+  // Deficit round robin quantum (in packets per round, for a weight of 1).
+  uint32_t tx_quantum{kDefaultTxQuantum};
+  // How the engine idles when there is no work (see `MachnetEngine::Idle()').
+  // `IdleMode::kInterrupt' requires a port with RX interrupts enabled.
+  IdleMode idle_mode{IdleMode::kBusyPoll};
+  // Burst size of the paced transmissions of the flows (see
+  // `kDefaultPacingBurst'); 0 disables pacing, but for windows below a packet.
+  uint32_t pacing_burst{0};
+  // Number of network paths the flows spread their packets over (see
+  // `net::flow::Multipath').
+  uint8_t num_paths{1};
+  // Pre-shared key to encrypt the flows with (see `net::flow::Cipher'); no
+  // encryption if unset.
+  std::optional<crypto::Key> encryption_key{std::nullopt};
+  // Trace one in every this many messages through the stack (see
+  // `MessageTracer'); 0 disables tracing.
+  uint32_t trace_sample_every{0};
+  // Number of records of the capture ring of the engine (see
+  // `capture::PacketCapture'), a power of two; 0 disables packet capture.
+  uint32_t capture_records{0};
+  // Number of packets sent that the flows of the engine keep, to retransmit
+  // them without copying their payloads again (see
+  // `net::flow::RexmitBudget'); 0 disables it, as does a port with fast free
+  // (see `PmdPort::DisableTxFastFree()').
+  uint32_t rexmit_packets{0};
 };
 
 /**
@@ -345,15 +702,55 @@ class MachnetEngine {
   using Icmp = net::Icmp;
   using Flow = net::flow::Flow;
   using PmdPort = juggler::dpdk::PmdPort;
+  // Length of the headers of Machnet packets; with zero-copy RX, the NIC
+  // splits received packets after these.
+  static constexpr uint16_t kMachnetHeadersLen = sizeof(Ethernet) +
+                                                 sizeof(Ipv4) + sizeof(Udp) +
+                                                 sizeof(net::MachnetPktHdr);
   // Slow timer (periodic processing) interval in microseconds.
-  const size_t kSlowTimerIntervalUs = 1000000;  // 2ms
-  const size_t kPendingRequestTimeoutSlowTicks = 3;
-  // Flow creation timeout in slow ticks (# of periodic executions since
-  // flow creation request).
-  const size_t kFlowCreationTimeoutSlowTicks = 3;
+  const size_t kSlowTimerIntervalUs = 1000000;  // 1s
+  // Interval of the updates of the stats page, in microseconds.
+  const size_t kStatsIntervalUs = 100000;  // 100ms
+  // Interval of the samples of the low watermarks of the packet pools, in
+  // microseconds.
+  const size_t kPoolSampleIntervalUs = 1000;  // 1ms
+  // Timeout of the pending requests (flows to remote addresses not resolved
+  // yet), in microseconds.
+  const size_t kPendingRequestTimeoutUs = 3000000;  // 3s
+  // Maximum number of control requests served per iteration, as soon as the
+  // applications ring the doorbells of their control queues.
+  static constexpr uint32_t kCtrlRequestsBudget = 8;
+  // Received packets that are dropped (e.g., of unsupported protocols, or for
+  // ports with no listener) are logged once in every this many, so that
+  // unwanted traffic does not slow the engine down with logging.
+  static constexpr int kDropLogEvery = 1000;
+  using Options = MachnetEngineOptions;
   MachnetEngine() = delete;
   MachnetEngine(MachnetEngine const &) = delete;
 
+  /**
+   * @brief A channel in transit between two engines of the same port, along
+   * with its flows (see `DetachChannel()' and `AdoptChannel()').
+   */
+  struct ChannelHandoff {
+    std::shared_ptr<shm::Channel> channel{nullptr};
+    // Flow rules steering the flows of the channel to the RX queue of the new
+    // engine (only with port steering).
+    std::vector<std::pair<net::flow::Key, rte_flow *>> steering_rules{};
+  };
+
+  /**
+   * @brief Load counters of an engine, e.g., to balance the channels among
+   * engines. They only grow; the load over an interval is the difference of
+   * two samples.
+   */
+  struct LoadStats {
+    // TSC cycles spent in iterations of `Run()' that did any work.
+    uint64_t busy_cycles;
+    uint64_t rx_packets;
+    uint64_t tx_packets;
+  };
+
   /**
    * @brief Construct a new MachnetEngine object.
    *
@@ -365,24 +762,91 @@ class MachnetEngine {
    *                      associated should be initialized with a packet pool.
    * @param channels      (optional) Machnet channels the engine will be
    *                      responsible for (if any).
+   * @param options       (optional) The options of the engine (see
+   *                      `Options'), e.g., from the configuration of its
+   *                      interface.
    */
   MachnetEngine(std::shared_ptr<PmdPort> pmd_port, uint16_t rx_queue_id,
                 uint16_t tx_queue_id,
                 std::shared_ptr<MachnetEngineSharedState> shared_state,
-                std::vector<std::shared_ptr<shm::Channel>> channels = {})
-      : pmd_port_(CHECK_NOTNULL(pmd_port)),
+                std::vector<std::shared_ptr<shm::Channel>> channels = {},
+                Options options = {})
+      : rx_pipeline_mode_(options.rx_pipeline_mode),
+        ack_every_(options.ack_every),
+        pacing_burst_(options.pacing_burst),
+        num_paths_(options.num_paths),
+        encryption_key_(std::move(options.encryption_key)),
+        // Encrypted payloads are copied in and out of the buffers of the
+        // channels, as they are encrypted and decrypted.
+        rx_zerocopy_(options.rx_zerocopy && !encryption_key_.has_value()),
+        tx_zerocopy_(options.tx_zerocopy && !encryption_key_.has_value()),
+        tx_zerocopy_threshold_(options.tx_zerocopy_threshold),
+        tx_scheduler_mode_(options.tx_scheduler_mode),
+        tx_budget_(options.tx_budget),
+        channel_scheduler_(options.tx_quantum),
+        flow_scheduler_(options.tx_quantum),
+        idle_mode_(options.idle_mode),
+        idle_policy_(options.idle_mode == IdleMode::kInterrupt),
+        pmd_port_(CHECK_NOTNULL(pmd_port)),
         rxring_(pmd_port_->GetRing<dpdk::RxRing>(rx_queue_id)),
         txring_(pmd_port_->GetRing<dpdk::TxRing>(tx_queue_id)),
         packet_pool_(CHECK_NOTNULL(txring_->GetPacketPool())),
         shared_state_(CHECK_NOTNULL(shared_state)),
+        arp_table_reader_(shared_state_->NewArpTableReader()),
         channels_(channels),
         last_periodic_timestamp_(0),
-        periodic_ticks_(0) {
-    for (const auto &[ipv4_addr, _] : shared_state_->GetIpv4PortBitmap()) {
+        periodic_ticks_(0),
+        tracer_(options.trace_sample_every),
+        stats_page_(stats::StatsPage::Create(
+            stats::PageName(pmd_port_->GetPortId(), rx_queue_id))),
+        // Half the TX pool at most, so that new data always finds packets.
+        rexmit_budget_(pmd_port_->tx_fast_free()
+                           ? 0
+                           : std::min(options.rexmit_packets,
+                                      packet_pool_->Capacity() / 2)) {
+    for (const auto &ipv4_addr : shared_state_->GetIpv4Addresses()) {
       listeners_.emplace(
           ipv4_addr,
           std::unordered_map<Udp::Port, std::shared_ptr<shm::Channel>>());
     }
+    delayed_ack_flows_.reserve(juggler::dpdk::PacketBatch::kMaxBurst);
+    pending_syns_.reserve(juggler::dpdk::PacketBatch::kMaxBurst);
+    CHECK(idle_mode_ != IdleMode::kInterrupt || pmd_port_->rx_interrupts())
+        << "Interrupt idle mode requires RX interrupts on the port";
+    if (pmd_port_->rx_timestamps()) {
+      nic_clock_.emplace(pmd_port_->GetPortId());
+      nic_clock_->Calibrate();
+    }
+    for (const auto &channel : channels_) {
+      channel->SetTracing(tracer_.enabled());
+    }
+    if (options.capture_records != 0) {
+      capture_ = capture::PacketCapture::Create(
+          capture::RingName(pmd_port_->GetPortId(), rx_queue_id),
+          options.capture_records);
+      if (capture_ != nullptr) txring_->SetCapture(capture_.get());
+    }
+    LOG_IF(WARNING,
+           options.rexmit_packets != 0 && rexmit_budget_.max_packets() == 0)
+        << "Copy-free retransmissions require a port without fast free";
+  }
+
+  ~MachnetEngine() {
+    txring_->SetCapture(nullptr);
+    // The packets kept by the flows go back to the TX pool.
+    for (const auto &channel : channels_) {
+      for (auto &flow : channel->GetActiveFlows()) {
+        flow.set_rexmit_budget(nullptr);
+      }
+    }
+    // The NIC must stop receiving into channel buffers before the channel
+    // goes away.
+    if (rx_zerocopy_channel_ != nullptr) DisableRxZeroCopy();
+    // Likewise, the NIC must be done sending from channel buffers.
+    TxZeroCopyDrain();
+    LOG_IF(ERROR, !tx_zerocopy_draining_.empty())
+        << "Channel buffers are still held by the NIC (engine @tx_q_id: "
+        << txring_->GetRingId() << ")";
   }
 
   /**
@@ -393,16 +857,112 @@ class MachnetEngine {
   // Adds a channel to be served by this engine.
   void AddChannel(std::shared_ptr<shm::Channel> channel,
                   std::promise<bool> &&status) {
-    const std::lock_guard<std::mutex> lock(mtx_);
-    auto channel_info =
-        std::make_tuple(std::move(CHECK_NOTNULL(channel)), std::move(status));
-    channels_to_enqueue_.emplace_back(std::move(channel_info));
+    auto command = std::make_unique<ChannelCommand>();
+    command->type = ChannelCommand::kAdd;
+    command->channel = std::move(CHECK_NOTNULL(channel));
+    command->status = std::move(status);
+    commands_.Push(std::move(command));
   }
 
   // Removes a channel from the engine.
   void RemoveChannel(std::shared_ptr<shm::Channel> channel) {
-    const std::lock_guard<std::mutex> lock(mtx_);
-    channels_to_dequeue_.emplace_back(std::move(channel));
+    auto command = std::make_unique<ChannelCommand>();
+    command->type = ChannelCommand::kRemove;
+    command->channel = std::move(channel);
+    commands_.Push(std::move(command));
+  }
+
+  /**
+   * @brief Hand a channel, and its flows, over to another engine of the same
+   * port (see `AdoptChannel()'). The packets of the flows of the channel are
+   * redirected to the RX queue of the new engine: with port steering, by a
+   * flow rule per flow; otherwise, by pointing the entries of the RSS
+   * redirection table they hash to at that queue.
+   *
+   * The flows keep their state (e.g., unacknowledged data is retransmitted by
+   * the new engine); packets that arrive while the channel is in transit are
+   * dropped, and recovered by retransmission.
+   *
+   * The engine refuses (i.e., `status' is set to false) to hand over channels
+   * with listeners, pending flow creation requests, or buffers still held by
+   * the NIC for zero-copy TX. Without port steering, it also refuses if the
+   * flows share RSS entries with other flows of the engine, or if the engine
+   * has listeners (whose new connections would be redirected too).
+   *
+   * @param channel     The channel to hand over.
+   * @param rx_queue_id The RX queue of the new engine.
+   * @param handoff     Filled in with the channel in transit on success; it
+   *                    must be valid until `status' is set.
+   * @param status      Set to whether the channel was detached.
+   */
+  void DetachChannel(std::shared_ptr<shm::Channel> channel,
+                     uint16_t rx_queue_id, ChannelHandoff *handoff,
+                     std::promise<bool> &&status) {
+    auto command = std::make_unique<ChannelCommand>();
+    command->type = ChannelCommand::kDetach;
+    command->channel = std::move(CHECK_NOTNULL(channel));
+    command->status = std::move(status);
+    command->rx_queue_id = rx_queue_id;
+    command->detached = CHECK_NOTNULL(handoff);
+    commands_.Push(std::move(command));
+  }
+
+  /**
+   * @brief Serve a channel handed over by another engine of the same port
+   * (see `DetachChannel()'), along with its flows.
+   */
+  void AdoptChannel(ChannelHandoff &&handoff, std::promise<bool> &&status) {
+    CHECK_NOTNULL(handoff.channel);
+    auto command = std::make_unique<ChannelCommand>();
+    command->type = ChannelCommand::kAdopt;
+    command->status = std::move(status);
+    command->adopted = std::move(handoff);
+    commands_.Push(std::move(command));
+  }
+
+  // RX queue index used by the engine.
+  uint16_t GetRxQueueId() const { return rxring_->GetRingId(); }
+
+  // Sample the load counters of the engine. Thread-safe.
+  LoadStats GetLoadStats() const {
+    return {busy_cycles_.load(std::memory_order_relaxed),
+            rx_packets_.load(std::memory_order_relaxed),
+            tx_packets_.load(std::memory_order_relaxed)};
+  }
+
+  // Whether the engine is configured to use zero-copy RX.
+  bool rx_zerocopy() const { return rx_zerocopy_; }
+  // Whether the flows of the engine are encrypted.
+  bool encrypted() const { return encryption_key_.has_value(); }
+
+  /**
+   * @brief Whether the channels of this engine may use zero-copy TX (see
+   * `shm::Channel::EnableTxZeroCopy()'), and the minimum payload size to do
+   * so. Requires the channel memory to be registered for DMA.
+   */
+  bool tx_zerocopy() const { return tx_zerocopy_; }
+  uint32_t tx_zerocopy_threshold() const { return tx_zerocopy_threshold_; }
+
+  /**
+   * @brief Make a channel eligible for zero-copy RX: the NIC splits the
+   * headers off the received packets, and places the payloads directly into
+   * buffers of the channel, which are then delivered to the application
+   * without a copy. The channel memory must be registered for DMA (see
+   * `shm::Channel::RegisterMemForDMA()').
+   *
+   * The NIC places the payload of every packet of the RX queue into the
+   * buffers of the channel, before the engine tells which flow (or channel)
+   * the packet is for: the application of the channel could read, and modify,
+   * the payloads of any other channel. Hence zero-copy RX is only in effect
+   * while the engine serves this channel alone; otherwise (or if the NIC does
+   * not support buffer split) payloads are copied.
+   */
+  void EnableRxZeroCopy(std::shared_ptr<shm::Channel> channel) {
+    if (!rx_zerocopy_) return;
+    auto command = std::make_unique<ChannelCommand>();
+    command->type = ChannelCommand::kEnableRxZeroCopy;
+    command->channel = std::move(CHECK_NOTNULL(channel));
+    commands_.Push(std::move(command));
   }
 
   /**
@@ -413,8 +973,35 @@ class MachnetEngine {
    * This method is not thread-safe.
    *
    * @param now The current TSC.
+   * @return Whether the iteration did any work (i.e., received or sent any
+   * packets); if not, the caller may `Idle()' before the next one.
    */
-  void Run(uint64_t now) {
+  bool Run(uint64_t now) {
+    // The end of each stage is marked on the iterations sampled by the cycle
+    // accounting (see `CycleAccounting').
+    cycles_.Begin(now);
+    if (capture_ != nullptr) capture_->BeginIteration();
+
+    // Fire the flow timers that are due (RTOs and pacing), and remove the
+    // flows that are done.
+    timer_wheel_.Advance(now);
+    RemoveExpiredFlows();
+    cycles_.Mark(CycleAccounting::kTimers);
+
+    // Channels added, removed or migrating are taken care of right away,
+    // rather than at the next periodic processing.
+    if (!commands_.Empty()) [[unlikely]] ChannelsUpdate();  // NOLINT
+    // So are the flows waiting for an address that was just resolved (e.g.,
+    // from an ARP reply received by another engine).
+    if (!pending_requests_.empty() && arp_table_reader_->Updated())  // NOLINT
+        [[unlikely]] {                                               // NOLINT
+      ProcessPendingRequests(now);
+    }  // NOLINT
+    // And so are the control requests of the applications (e.g., connect and
+    // listen), a few per iteration.
+    ProcessCtrlDoorbells(now);
+    cycles_.Mark(CycleAccounting::kControl);
+
     // Calculate the time elapsed since the last periodic processing.
     const auto elapsed = time::cycles_to_us(now - last_periodic_timestamp_);
     if (elapsed >= kSlowTimerIntervalUs) {
@@ -422,28 +1009,166 @@ class MachnetEngine {
       PeriodicProcess(now);
       last_periodic_timestamp_ = now;
     }
+    if (time::cycles_to_us(now - last_pool_sample_timestamp_) >=
+        kPoolSampleIntervalUs) {
+      rxring_->GetPacketPool()->SampleWatermark();
+      packet_pool_->SampleWatermark();
+      if (txring_->HasCtrlPacketPool()) {
+        txring_->GetCtrlPacketPool()->SampleWatermark();
+      }
+      last_pool_sample_timestamp_ = now;
+    }
+    if (time::cycles_to_us(now - last_stats_timestamp_) >= kStatsIntervalUs) {
+      // RTT percentiles are reported over the last interval, and so are the
+      // stages of the traced messages.
+      rtt_summary_ = rtt_histogram_.GetSummary();
+      rtt_histogram_.Reset();
+      if (tracer_.enabled()) {
+        for (const auto &channel : channels_) {
+          tracer_.CollectAppDequeues(channel.get());
+        }
+        tracer_.Summarize();
+      }
+      if (nic_clock_.has_value()) nic_clock_->Calibrate();
+      if (stats_page_ != nullptr) PublishStats();
+      PublishChannelStats();
+      last_stats_timestamp_ = now;
+    }
+    cycles_.Mark(CycleAccounting::kPeriodic);
+
+    // Packets the NIC did not take in the previous iteration go out first.
+    const auto tx_packets = txring_->GetFlushedPacketCount();
+    txring_->RetryBacklog();
+    cycles_.Mark(CycleAccounting::kFlush);
 
     juggler::dpdk::PacketBatch rx_packet_batch;
-    const uint16_t nb_pkt_rx = rxring_->RecvPackets(&rx_packet_batch);
-    for (uint16_t i = 0; i < nb_pkt_rx; i++) {
-      const auto *pkt = rx_packet_batch.pkts()[i];
-      process_rx_pkt(pkt, now);
+    rxring_->RecvPackets(&rx_packet_batch);
+    const auto rx_packets = rx_packet_batch.GetSize();
+    for (uint16_t i = 0; i < rx_packets; i++) {
+      rx_bytes_ += rx_packet_batch.pkts()[i]->length();
+    }
+    if (capture_ != nullptr && capture_->active()) [[unlikely]] {  // NOLINT
+      for (uint16_t i = 0; i < rx_packets; i++) {
+        capture_->Capture(rx_packet_batch.pkts()[i], capture::kRx);
+      }
+    }  // NOLINT
+    if (rx_pipeline_mode_ == RxPipelineMode::kStaged) {
+      ProcessRxBatchStaged(rx_packet_batch, now);
+    } else {
+      ProcessRxBatch(rx_packet_batch, now);
     }
 
     // We have processed the RX batch; release it.
     rx_packet_batch.Release();
+    if (rx_packets != 0) cycles_.CountRxBatch(rx_packets);
+    cycles_.Mark(CycleAccounting::kRx);
+
+    // Process messages from channels, unless the NIC is falling behind: the
+    // messages then stay in the channels (backpressuring the applications)
+    // until the TX backlog drains.
+    if (!txring_->IsBackpressured()) [[likely]] {  // NOLINT
+      if (tx_scheduler_mode_ == TxSchedulerMode::kDrr) {
+        ScheduleTx(now);
+      } else {
+        shm::MsgBufBatch msg_buf_batch;
+        std::array<Flow *, shm::MsgBufBatch::kMaxBurst> tx_flows;
+        for (auto &channel : channels_) {
+          uint32_t nb_msg_dequeued;
+          cycles_.Nested(CycleAccounting::kDequeue, [&]() {
+            nb_msg_dequeued = channel->DequeueMessages(&msg_buf_batch);
+          });
+          LookupTxFlows(msg_buf_batch, tx_flows.data());
+          for (uint32_t i = 0; i < nb_msg_dequeued; i++) {
+            auto *msg = msg_buf_batch.bufs()[i];
+            process_msg(channel.get(), msg, tx_flows[i], now);
+          }
+          // We have processed the message batch; reset it.
+          msg_buf_batch.Clear();
+        }
+      }
+    }
+    cycles_.Mark(CycleAccounting::kTx);
+
+    // Acknowledge the data received in this iteration, unless the ACKs have
+    // already been piggybacked on the data sent above.
+    FlushDelayedAcks();
+
+    // Send out all the packets produced in this iteration (data, ACKs,
+    // retransmissions and control packets) in as few bursts as possible.
+    txring_->Flush();
+
+    // Account the load of the engine (see `GetLoadStats()'). Single writer,
+    // so no atomic read-modify-write is needed. A backlogged TX ring keeps the
+    // engine from idling, so that the backlog is retried right away.
+    cycles_.Mark(CycleAccounting::kFlush);
+    const auto tx_sent = txring_->GetFlushedPacketCount() - tx_packets;
+    if (rx_packets == 0 && tx_sent == 0 && txring_->GetBacklogCount() == 0) {
+      cycles_.End(false);
+      return false;
+    }
+    cycles_.End(true);
+    auto add = [](std::atomic<uint64_t> *counter, uint64_t value) {
+      counter->store(counter->load(std::memory_order_relaxed) + value,
+                     std::memory_order_relaxed);
+    };
+    add(&busy_cycles_, time::rdtsc() - now);
+    add(&rx_packets_, rx_packets);
+    add(&tx_packets_, tx_sent);
+    idle_policy_.OnBusy();
+    return true;
+  }
 
-    // Process messages from channels.
-    shm::MsgBufBatch msg_buf_batch;
-    for (auto &channel : channels_) {
-      // TODO(ilias): Revisit the number of messages to dequeue.
-      const auto nb_msg_dequeued = channel->DequeueMessages(&msg_buf_batch);
-      for (uint32_t i = 0; i < nb_msg_dequeued; i++) {
-        auto *msg = msg_buf_batch.bufs()[i];
-        process_msg(channel.get(), msg, now);
+  /**
+   * @brief Idle after an iteration of `Run()' that did no work, as the idle
+   * mode of the engine dictates (see `IdlePolicy'). With `IdleMode::kAdaptive'
+   * the engine spins on `pause' bursts, and then waits in a low-power state
+   * for a few microseconds at a time: until the NIC writes the next RX
+   * descriptor (`umwait'), or for a while (`tpause'), depending on what the
+   * NIC and the CPU support. With `IdleMode::kInterrupt' it finally blocks on
+   * the RX interrupt of its queue. Waits are bounded, as messages from the
+   * applications and the timers of the flows raise no events.
+   */
+  void Idle() {
+    if (idle_mode_ == IdleMode::kBusyPoll) return;
+    const auto stage = idle_policy_.OnIdle();
+    switch (stage) {
+      case IdlePolicy::kPoll:
+        return;
+      case IdlePolicy::kPause:
+        for (uint32_t i = 0; i < idle_policy_.PauseBurst(); i++) rte_pause();
+        return;
+      case IdlePolicy::kWait: {
+        const auto start = time::rdtsc();
+        const auto deadline = start + time::us_to_cycles(kIdleWaitUs);
+        if (!monitor_supported_ || !rxring_->MonitorPackets(deadline)) {
+          monitor_supported_ = false;
+          if (!pause_supported_ || rte_power_pause(deadline) != 0) {
+            pause_supported_ = false;
+            while (time::rdtsc() < deadline) rte_pause();
+          }
+        }
+        idle_policy_.OnWait(stage, time::rdtsc() - start);
+        return;
+      }
+      case IdlePolicy::kSleep: {
+        if (!rx_interrupt_ready_) {
+          // RX interrupts are set up from the engine thread (per-thread epoll).
+          rx_interrupt_ready_ = rxring_->InitInterrupt();
+          if (!rx_interrupt_ready_) {
+            LOG(WARNING) << "Falling back to adaptive idling (engine @rx_q_id: "
+                         << rxring_->GetRingId() << ")";
+            idle_mode_ = IdleMode::kAdaptive;
+            idle_policy_.ResetStats();
+            return;
+          }
+        }
+        const auto start = time::rdtsc();
+        rxring_->WaitForPackets(kIdleSleepTimeoutMs);
+        idle_policy_.OnWait(stage, time::rdtsc() - start);
+        return;
       }
-      // We have processed the message batch; reset it.
-      msg_buf_batch.Clear();
+      default:
+        return;
     }
   }
 
@@ -456,20 +1181,279 @@ class MachnetEngine {
   void PeriodicProcess(uint64_t now) {
     // Advance the periodic ticks counter.
     ++periodic_ticks_;
-    HandleRTO();
-    DumpStatus();
-    ProcessControlRequests();
-    // Continue the rest of management tasks locked to avoid race conditions
-    // with the control plane.
-    const std::lock_guard<std::mutex> lock(mtx_);
-    // Refresh the list of active channels, if needed.
-    ChannelsUpdate();
+    // The full status dump is for debugging: monitoring tools read the stats
+    // page instead (see `PublishStats()').
+    if (VLOG_IS_ON(1)) DumpStatus();
+    ProcessControlRequests(now);
+    cycles_.Nested(CycleAccounting::kArp, [this]() {
+      shared_state_->MaintainArpTable(arp_table_reader_.get(), txring_);
+    });
+    // The list of active channels is refreshed on every iteration that finds
+    // control plane commands (see `Run()').
+    RxZeroCopyUpdate();
+    TxZeroCopyDrain();
+    CompactFlows();
+  }
+
+  /**
+   * @brief Build the reply to an ICMP echo request (i.e., a ping), received
+   * by the port of address `l2_addr', in a new packet of `pool'.
+   * @return The reply, or nullptr if `pkt' is not an echo request or the pool
+   * is out of packets.
+   */
+  static dpdk::Packet *IcmpEchoReply(dpdk::Packet *pkt, dpdk::PacketPool *pool,
+                                     const Ethernet::Address &l2_addr) {
+    if (pkt->length() < sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Icmp))
+      [[unlikely]] return nullptr;
+
+    const auto *eh = pkt->head_data<Ethernet *>();
+    const auto *ipv4h = pkt->head_data<Ipv4 *>(sizeof(Ethernet));
+    const auto *icmph =
+        pkt->head_data<Icmp *>(sizeof(Ethernet) + sizeof(Ipv4));
+    // Only process ICMP echo requests.
+    if (icmph->type != Icmp::kEchoRequest) [[unlikely]] return nullptr;
+
+    // Allocate and construct a new packet for the response, instead of
+    // in-place modification.
+    // If `FAST_FREE' is enabled it's unsafe to use packets from different
+    // pools (the driver may put them in the wrong pool on reclaim).
+    auto *response = pool->PacketAlloc();
+    if (response == nullptr) [[unlikely]] return nullptr;
+    auto *response_eh = response->append<Ethernet *>(pkt->length());
+    response_eh->dst_addr = eh->src_addr;
+    response_eh->src_addr = l2_addr;
+    response_eh->eth_type = be16_t(Ethernet::kIpv4);
+    response->set_l2_len(sizeof(*response_eh));
+    auto *response_ipv4h = reinterpret_cast<Ipv4 *>(response_eh + 1);
+    response_ipv4h->version_ihl = 0x45;
+    response_ipv4h->type_of_service = 0;
+    response_ipv4h->packet_id = be16_t(0x1513);
+    response_ipv4h->fragment_offset = be16_t(0);
+    response_ipv4h->time_to_live = 64;
+    response_ipv4h->next_proto_id = Ipv4::Proto::kIcmp;
+    response_ipv4h->total_length = be16_t(pkt->length() - sizeof(Ethernet));
+    response_ipv4h->src_addr = ipv4h->dst_addr;
+    response_ipv4h->dst_addr = ipv4h->src_addr;
+    response_ipv4h->hdr_checksum = 0;
+    response->set_l3_len(sizeof(*response_ipv4h));
+    response->offload_ipv4_csum();
+    auto *response_icmph = reinterpret_cast<Icmp *>(response_ipv4h + 1);
+    response_icmph->type = Icmp::kEchoReply;
+    response_icmph->code = Icmp::kCodeZero;
+    response_icmph->cksum = 0;
+    response_icmph->id = icmph->id;
+    response_icmph->seq = icmph->seq;
+
+    // The request might span multiple segments (see `EnableRxZeroCopy()').
+    auto *response_data = reinterpret_cast<uint8_t *>(response_icmph + 1);
+    constexpr auto kIcmpHeadersLen =
+        sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Icmp);
+    pkt->CopyOut(response_data, kIcmpHeadersLen,
+                 pkt->length() - kIcmpHeadersLen);
+    response_icmph->cksum = utils::ComputeChecksum16(
+        reinterpret_cast<const uint8_t *>(response_icmph),
+        pkt->length() - sizeof(Ethernet) - sizeof(Ipv4));
+    return response;
   }
 
   // Return the number of channels served by this engine.
   size_t GetChannelCount() const { return channels_.size(); }
 
+  // Return the number of active flows of this engine.
+  size_t GetFlowCount() const { return active_flows_.size(); }
+
  protected:
+  /**
+   * @brief Release the state of the flows that stayed idle since the last
+   * periodic processing (see `Flow::CompactIfIdle()'), and account the memory
+   * that the flows of the engine take.
+   */
+  void CompactFlows() {
+    size_t usage = 0;
+    for (const auto &channel : channels_) {
+      for (auto &flow : channel->GetActiveFlows()) {
+        if (flow.CompactIfIdle() != 0) flows_compacted_++;
+        usage += flow.GetMemoryUsage();
+      }
+    }
+    flow_memory_bytes_ = usage;
+  }
+
+  /**
+   * @brief Publish the counters of the engine, its channels and its flows to
+   * its stats page, for external tools (e.g., `machnet_stats'). Never waits
+   * for the readers of the page.
+   */
+  void PublishStats() {
+    stats_page_->Update([this](stats::PageHeader *header,
+                               stats::ChannelStats *channels,
+                               stats::FlowStats *flows) {
+      header->timestamp_ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::system_clock::now().time_since_epoch())
+              .count();
+      header->tsc_hz = time::tsc_hz;
+
+      auto &queue = header->queue;
+      queue.port_id = pmd_port_->GetPortId();
+      queue.rx_queue_id = rxring_->GetRingId();
+      queue.tx_queue_id = txring_->GetRingId();
+      queue.rx_packets = rx_packets_.load(std::memory_order_relaxed);
+      queue.rx_bytes = rx_bytes_;
+      queue.rx_drops = rx_drops_;
+      queue.tx_packets = txring_->GetFlushedPacketCount();
+      queue.tx_bytes = txring_->GetFlushedByteCount();
+      queue.tx_bursts = txring_->GetFlushCount();
+      queue.tx_backlog = txring_->GetBacklogCount();
+      queue.tx_backlog_drops = txring_->GetBacklogOverflowCount();
+      queue.busy_cycles = busy_cycles_.load(std::memory_order_relaxed);
+      queue.rx_hw_timestamps = rx_hw_timestamps_;
+      queue.flow_memory_bytes = flow_memory_bytes_;
+      queue.flows_compacted = flows_compacted_;
+      queue.rtt_samples = rtt_summary_.count;
+      queue.rtt_min_ns = rtt_summary_.min_ns;
+      queue.rtt_p50_ns = rtt_summary_.p50_ns;
+      queue.rtt_p99_ns = rtt_summary_.p99_ns;
+      queue.rtt_p999_ns = rtt_summary_.p999_ns;
+      queue.rtt_max_ns = rtt_summary_.max_ns;
+
+      header->trace.sample_every = tracer_.sample_every();
+      for (size_t i = 0; i < MessageTracer::kNumStages; i++) {
+        const auto &summary =
+            tracer_.GetSummary(static_cast<MessageTracer::Stage>(i));
+        auto &stage = header->trace.stages[i];
+        stage.samples = summary.count;
+        stage.p50_ns = summary.p50_ns;
+        stage.p99_ns = summary.p99_ns;
+        stage.p999_ns = summary.p999_ns;
+        stage.max_ns = summary.max_ns;
+      }
+      cycles_.GetStats(&header->loop);
+
+      dpdk::PacketPool *const pools[stats::PoolsStats::kNumPools] = {
+          rxring_->GetPacketPool(), packet_pool_,
+          txring_->HasCtrlPacketPool() ? txring_->GetCtrlPacketPool()
+                                       : nullptr};
+      for (size_t i = 0; i < stats::PoolsStats::kNumPools; i++) {
+        auto &pool = header->pools.pools[i];
+        pool = {};
+        if (pools[i] == nullptr) continue;
+        pool.capacity = pools[i]->Capacity();
+        pool.avail = pools[i]->AvailPacketsCount();
+        pool.min_avail = pools[i]->GetMinAvailPacketsCount();
+        pool.alloc_failures = pools[i]->GetAllocFailureCount();
+      }
+
+      const uint32_t max_channels = stats_page_->GetMaxChannels();
+      const uint32_t max_flows = stats_page_->GetMaxFlows();
+      uint32_t nb_channels = 0, nb_flows = 0, flows_truncated = 0;
+      for (const auto &channel : channels_) {
+        if (nb_channels == max_channels) break;
+        auto &c = channels[nb_channels];
+        std::memset(c.name, 0, sizeof(c.name));
+        channel->GetName().copy(c.name, sizeof(c.name) - 1);
+        c.rx_messages = channel->GetRxMessageCount();
+        c.tx_messages = channel->GetTxMessageCount();
+        c.total_buffers = channel->GetTotalBufCount();
+        c.free_buffers = channel->GetFreeBufCount();
+        c.flows = channel->GetFlowCount();
+        for (size_t i = 0; i < stats::kBatchBuckets; i++) {
+          c.tx_batches[i] = channel->GetTxBatchCount(i);
+        }
+
+        for (const auto &flow : channel->GetActiveFlows()) {
+          if (nb_flows == max_flows) {
+            flows_truncated++;
+            continue;
+          }
+          const auto &key = flow.key();
+          const auto &pcb = flow.pcb();
+          auto &f = flows[nb_flows++];
+          f.local_ip = key.local_addr.address.value();
+          f.remote_ip = key.remote_addr.address.value();
+          f.local_port = key.local_port.port.value();
+          f.remote_port = key.remote_port.port.value();
+          f.channel = nb_channels;
+          f.state = static_cast<uint8_t>(flow.state());
+          f.cwnd = pcb.cwnd;
+          f.srtt_ns = pcb.srtt_ns;
+          f.snd_nxt = pcb.snd_nxt;
+          f.snd_una = pcb.snd_una;
+          f.rcv_nxt = pcb.rcv_nxt;
+          f.pending_msgbufs = flow.GetPendingMsgbufCount();
+          f.fast_rexmits = pcb.fast_rexmits;
+          f.rto_rexmits = pcb.rto_rexmits;
+          f.memory_bytes = flow.GetMemoryUsage();
+        }
+        nb_channels++;
+      }
+      header->nb_channels = nb_channels;
+      header->nb_flows = nb_flows;
+      header->channels_truncated = channels_.size() - nb_channels;
+      header->flows_truncated = flows_truncated;
+    });
+  }
+
+  /**
+   * @brief Publish the counters of each channel, and of its flows, to the
+   * channel itself, for the application to read (see `machnet_get_stats()').
+   */
+  void PublishChannelStats() {
+    using State = Flow::State;
+    static_assert(static_cast<int>(State::kClosed) ==
+                  MACHNET_FLOW_STATE_CLOSED);
+    static_assert(static_cast<int>(State::kSynSent) ==
+                  MACHNET_FLOW_STATE_SYN_SENT);
+    static_assert(static_cast<int>(State::kSynReceived) ==
+                  MACHNET_FLOW_STATE_SYN_RECEIVED);
+    static_assert(static_cast<int>(State::kEstablished) ==
+                  MACHNET_FLOW_STATE_ESTABLISHED);
+
+    const uint64_t timestamp_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    for (const auto &channel : channels_) {
+      channel->UpdateEngineStats([&](MachnetChannelEngineStats_t *stats,
+                                     MachnetFlowStats_t *flows) {
+        stats->timestamp_ns = timestamp_ns;
+        stats->rx_msgs = channel->GetRxMessageCount();
+        stats->tx_msgs = channel->GetTxMessageCount();
+        stats->buf_drops = channel->GetBufferDropCount();
+        stats->completion_drops = channel->GetCompletionDropCount();
+        uint32_t nb_flows = 0, flows_truncated = 0;
+        for (const auto &flow : channel->GetActiveFlows()) {
+          if (nb_flows == MACHNET_FLOW_STATS_MAX) {
+            flows_truncated++;
+            continue;
+          }
+          const auto &key = flow.key();
+          const auto &pcb = flow.pcb();
+          auto &f = flows[nb_flows++];
+          f.flow.src_ip = key.local_addr.address.value();
+          f.flow.dst_ip = key.remote_addr.address.value();
+          f.flow.src_port = key.local_port.port.value();
+          f.flow.dst_port = key.remote_port.port.value();
+          f.state = static_cast<uint32_t>(flow.state());
+          f.cwnd = pcb.cwnd;
+          f.srtt_ns = pcb.srtt_ns;
+          f.rttvar_ns = pcb.rttvar_ns;
+          f.min_rtt_ns = pcb.min_rtt_ns;
+          f.snd_nxt = pcb.snd_nxt;
+          f.snd_una = pcb.snd_una;
+          f.rcv_nxt = pcb.rcv_nxt;
+          f.rwnd = pcb.rwnd;
+          f.pending_msgbufs = flow.GetPendingMsgbufCount();
+          f.fast_rexmits = pcb.fast_rexmits;
+          f.rto_rexmits = pcb.rto_rexmits;
+          f.tlp_probes = pcb.tlp_probes;
+        }
+        stats->nb_flows = nb_flows;
+        stats->flows_truncated = flows_truncated;
+      });
+    }
+  }
+
   void DumpStatus() {
     std::string s;
     s += "[Machnet Engine Status]";
@@ -480,21 +1464,51 @@ class MachnetEngine {
     s += "\t\t" + pmd_port_->GetL2Addr().ToString() + "\n";
     s += "\tLocal IPv4 addresses:\n";
     s += "\t\t";
-    for (const auto &[addr, _] : shared_state_->GetIpv4PortBitmap()) {
+    for (const auto &addr : shared_state_->GetIpv4Addresses()) {
       s += addr.ToString();
       s += ",";
     }
     s += "\n";
+    s += "\tTX bursts: " + std::to_string(txring_->GetFlushCount()) +
+         ", TX packets: " + std::to_string(txring_->GetFlushedPacketCount()) +
+         ", TX backlog: " + std::to_string(txring_->GetBacklogCount()) +
+         " (overflows: " +
+         std::to_string(txring_->GetBacklogOverflowCount()) + ")\n";
+    s += "\tRTT (last " + std::to_string(kStatsIntervalUs / 1000) +
+         " ms): " + rtt_summary_.ToString() + "\n";
+    if (nic_clock_.has_value()) {
+      s += "\tRX packets with NIC timestamps: " +
+           std::to_string(rx_hw_timestamps_) + "\n";
+    }
+    if (idle_mode_ != IdleMode::kBusyPoll) {
+      s += "\tIdle wakeups (since last dump):";
+      for (const auto stage : {IdlePolicy::kWait, IdlePolicy::kSleep}) {
+        const auto &stats = idle_policy_.stats(stage);
+        s += stage == IdlePolicy::kWait ? " [wait] " : " [sleep] ";
+        s += std::to_string(stats.wakeups);
+        if (stats.wakeups == 0) continue;
+        s += ", waited avg " +
+             std::to_string(time::cycles_to_us(stats.wait_cycles /
+                                               stats.wakeups)) +
+             " us, max " +
+             std::to_string(time::cycles_to_us(stats.max_wait_cycles)) + " us";
+      }
+      s += "\n";
+      idle_policy_.ResetStats();
+    }
     s += "\tActive channels:";
     for (const auto &channel : channels_) {
       s += "\n\t\t";
       s += "[" + channel->GetName() + "]" +
            " Total buffers: " + std::to_string(channel->GetTotalBufCount()) +
-           ", Free buffers: " + std::to_string(channel->GetFreeBufCount());
+           ", Free buffers: " + std::to_string(channel->GetFreeBufCount()) +
+           ", Flows: " + std::to_string(channel->GetFlowCount()) +
+           " (pool: " + std::to_string(channel->GetFlowPoolCapacity()) + ")";
     }
     s += "\n";
     s += "\tARP Table:\n";
-    for (const auto &entry : shared_state_->GetArpTableEntries()) {
+    for (const auto &entry :
+         shared_state_->GetArpTableEntries(arp_table_reader_.get())) {
       s += "\t\t" + std::get<0>(entry) + " -> " + std::get<1>(entry) + "\n";
     }
     s += "\tListeners:\n";
@@ -506,191 +1520,546 @@ class MachnetEngine {
       }
     }
     s += "\tActive flows:\n";
-    for (const auto &[key, flow_it] : active_flows_map_) {
+    active_flows_.ForEach([&s](const ActiveFlow &active_flow) {
       s += "\t\t";
-      s += (*flow_it)->ToString();
+      s += active_flow.flow->ToString();
       s += "\n";
-    }
+    });
     s += "\n";
     LOG(INFO) << s;
   }
 
   /**
-   * @brief This method curates the list of active channels under this engine.
-   * It enqueues newly added channels to the list of active channels, and
-   * removes/destroys channels pending for removal from the list.
-   * We choose to curate the list in a separate method, so that the caller can
-   * do this operation periodically, amortising the cost of locking.
+   * @brief This method curates the list of active channels under this engine,
+   * by carrying out the commands posted by the control plane (see
+   * `AddChannel()', `RemoveChannel()', `DetachChannel()', `AdoptChannel()' and
+   * `EnableRxZeroCopy()'), in order.
    *
-   * @attention This method should be executed periodically at the dataplane,
-   * with the mutex held to achieve synchronization with the control plane
-   * thread.
+   * @attention This method must be executed by the engine thread. The control
+   * plane does not share any other state with the engine (and never holds a
+   * lock the engine needs).
    */
   void ChannelsUpdate() {
-    // TODO(ilias): For now, we assume that added channels do not carry any
-    // flows (i.e., these are newly created channels).
-    // If we want, dynamic load balancing (e.g., moving channels to different
-    // engines, we should take care of flow migrations).
-    for (auto it = channels_to_enqueue_.begin();
-         it != channels_to_enqueue_.end();
-         it = channels_to_enqueue_.erase(it)) {
-      auto &channel_info = *it;
-      const auto &channel = std::get<0>(channel_info);
-      auto &status = std::get<1>(channel_info);
-
-      channels_.emplace_back(std::move(channel));
-      status.set_value(true);
-    }
-
-    // Remove channels pending for removal.
-    for (auto &channel : channels_to_dequeue_) {
-      const auto &it =
-          std::find_if(channels_.begin(), channels_.end(),
-                       [&channel](const auto &c) { return channel == c; });
-      if (it == channels_.end()) {
-        // This channel is not in the list of active channels.
-        LOG(WARNING) << "Channel " << channel->GetName()
-                     << " is not in the list of active channels";
+    while (auto command = commands_.Pop()) {
+      auto &channel = command->channel;
+      switch (command->type) {
+        case ChannelCommand::kAdd:
+          // Added channels do not carry any flows (i.e., these are newly
+          // created channels); channels migrating from other engines are
+          // adopted along with their flows.
+          channel->SetTracing(tracer_.enabled());
+          channels_.emplace_back(std::move(channel));
+          command->status.set_value(true);
+          break;
+        case ChannelCommand::kRemove:
+          ChannelRemove(channel);
+          break;
+        case ChannelCommand::kDetach:
+          command->status.set_value(
+              HandOffChannel(channel, command->rx_queue_id, command->detached));
+          break;
+        case ChannelCommand::kAdopt:
+          AdoptChannelFlows(&command->adopted);
+          command->adopted.channel->SetTracing(tracer_.enabled());
+          channels_.emplace_back(std::move(command->adopted.channel));
+          command->status.set_value(true);
+          break;
+        case ChannelCommand::kEnableRxZeroCopy:
+          rx_zerocopy_channels_.emplace_back(std::move(channel));
+          break;
+      }
+    }
+
+    // Zero-copy RX stops as soon as the engine serves another channel, before
+    // any flow of the latter is set up (see `EnableRxZeroCopy()'). It is set
+    // up again once the channel is alone (see `RxZeroCopyUpdate()').
+    if (rx_zerocopy_channel_ != nullptr && channels_.size() != 1) {
+      DisableRxZeroCopy();
+    }
+  }
+
+  // Stop serving a channel: remove its listeners and flows.
+  void ChannelRemove(const std::shared_ptr<shm::Channel> &channel) {
+    const auto &it =
+        std::find_if(channels_.begin(), channels_.end(),
+                     [&channel](const auto &c) { return channel == c; });
+    if (it == channels_.end()) {
+      // This channel is not in the list of active channels.
+      LOG(WARNING) << "Channel " << channel->GetName()
+                   << " is not in the list of active channels";
+      return;
+    }
+
+    // Remove from the engine all listeners associated with this channel.
+    const auto &channel_listeners = channel->GetListeners();
+    for (const auto &ch_listener : channel_listeners) {
+      const auto &local_ip = ch_listener.addr;
+      const auto &local_port = ch_listener.port;
+
+      if (listeners_.find(local_ip) == listeners_.end()) {
+        LOG(ERROR) << "No listeners for IP " << local_ip.ToString();
         continue;
       }
 
-      // Remove from the engine all listeners associated with this channel.
-      const auto &channel_listeners = channel->GetListeners();
-      for (const auto &ch_listener : channel_listeners) {
-        const auto &local_ip = ch_listener.addr;
-        const auto &local_port = ch_listener.port;
+      auto &listeners_for_ip = listeners_[local_ip];
+      if (listeners_for_ip.find(local_port) == listeners_for_ip.end()) {
+        LOG(ERROR) << utils::Format("Listener not found %s:%hu",
+                                    local_ip.ToString().c_str(),
+                                    local_port.port.value());
+        continue;
+      }
 
-        if (listeners_.find(local_ip) == listeners_.end()) {
-          LOG(ERROR) << "No listeners for IP " << local_ip.ToString();
-          continue;
-        }
+      shared_state_->UnregisterListener(local_ip, local_port);
+      if (shared_state_->IsDelegated()) {
+        shared_state_->SteerListener(local_ip, local_port, false);
+      }
+      listeners_for_ip.erase(local_port);
+      auto &rules_for_ip = listener_steering_rules_[local_ip];
+      if (rules_for_ip.find(local_port) != rules_for_ip.end()) {
+        pmd_port_->RemoveSteeringRule(rules_for_ip[local_port]);
+        rules_for_ip.erase(local_port);
+      }
+    }
 
-        auto &listeners_for_ip = listeners_[local_ip];
-        if (listeners_for_ip.find(local_port) == listeners_for_ip.end()) {
-          LOG(ERROR) << utils::Format("Listener not found %s:%hu",
-                                      local_ip.ToString().c_str(),
-                                      local_port.port.value());
-          continue;
-        }
+    auto &channel_flows = channel->GetActiveFlows();
+    // Remove from the engine's map all the flows associated with this
+    // channel.
+    for (auto &flow : channel_flows) {
+      flow_scheduler_.Remove(&flow);
+      const auto &flow_key = flow.key();
+      const auto flow_hash = FlowTable::Hash(flow_key);
+      if (active_flows_.Lookup(flow_key, flow_hash) != nullptr) {
+        RemoveFlowSteeringRule(flow_key);
+        shared_state_->SrcPortRelease(flow_key.local_addr,
+                                      flow_key.local_port);
+        LOG(INFO) << "Removing flow " << flow_key.ToString();
+        flow.ShutDown();
+        active_flows_.Erase(flow_key, flow_hash);
+      } else {
+        LOG(WARNING) << "Flow " << flow.key().ToString()
+                     << " is not in the list of active flows";
+      }
+    }
+
+    // Stop receiving into the channel's buffers.
+    if (channel == rx_zerocopy_channel_) DisableRxZeroCopy();
+    std::erase(rx_zerocopy_channels_, channel);
 
-        shared_state_->UnregisterListener(local_ip, local_port);
-        listeners_for_ip.erase(local_port);
+    // Keep the channel around while the NIC may still send from its
+    // buffers (see `TxZeroCopyDrain()').
+    if (channel->GetTxZeroCopyInflight() > 0) {
+      tx_zerocopy_draining_.emplace_back(channel);
+    }
+
+    // Finally remove the channel.
+    channel_scheduler_.Remove(channel.get());
+    channels_.erase(it);
+  }
+
+  /**
+   * @brief Detach a channel from this engine, and redirect the packets of its
+   * flows to another RX queue (see `DetachChannel()').
+   *
+   * @return True if the channel is now in transit (in `handoff'), false if it
+   * cannot be handed over (it is then left untouched).
+   */
+  bool HandOffChannel(const std::shared_ptr<shm::Channel> &channel,
+                      uint16_t rx_queue_id, ChannelHandoff *handoff) {
+    const auto it = std::find(channels_.begin(), channels_.end(), channel);
+    if (it == channels_.end()) {
+      LOG(WARNING) << "Channel " << channel->GetName()
+                   << " is not in the list of active channels";
+      return false;
+    }
+
+    if (!channel->GetListeners().empty()) {
+      LOG(WARNING) << "Cannot migrate channel " << channel->GetName()
+                   << ": it has listeners";
+      return false;
+    }
+    for (const auto &[_, req, ch] : pending_requests_) {
+      if (ch == channel) {
+        LOG(WARNING) << "Cannot migrate channel " << channel->GetName()
+                     << ": flow creation pending";
+        return false;
+      }
+    }
+    // The NIC returns the sent packets to this engine's TX queue.
+    txring_->ReclaimTxMbufs();
+    if (channel->GetTxZeroCopyInflight() > 0) {
+      LOG(WARNING) << "Cannot migrate channel " << channel->GetName()
+                   << ": buffers held by the NIC for zero-copy TX";
+      return false;
+    }
+
+    auto &channel_flows = channel->GetActiveFlows();
+    if (shared_state_->IsPortSteeringEnabled()) {
+      // The source ports of the flows stay within the port block of this
+      // engine's queue; exact-match rules take precedence over the block.
+      for (const auto &flow : channel_flows) {
+        const auto &key = flow.key();
+        auto *rule = pmd_port_->AddUdpSteeringRule(
+            &key.local_addr, key.local_port.port.value(), UINT16_MAX,
+            rx_queue_id,
+            MachnetEngineSharedState::kListenerSteeringRulePriority);
+        if (rule == nullptr) {
+          for (auto &[_, r] : handoff->steering_rules) {
+            pmd_port_->RemoveSteeringRule(r);
+          }
+          handoff->steering_rules.clear();
+          return false;
+        }
+        handoff->steering_rules.emplace_back(key, rule);
+      }
+      for (const auto &flow : channel_flows) {
+        RemoveFlowSteeringRule(flow.key());
+      }
+    } else {
+      bool has_listeners = false;
+      for (const auto &[_, listeners_on_ip] : listeners_) {
+        has_listeners |= !listeners_on_ip.empty();
+      }
+      if (has_listeners) {
+        LOG(WARNING) << "Cannot migrate channel " << channel->GetName()
+                     << ": the engine has listeners";
+        return false;
       }
 
-      const auto &channel_flows = channel->GetActiveFlows();
-      // Remove from the engine's map all the flows associated with this
-      // channel.
+      std::unordered_set<uint16_t> buckets;
       for (const auto &flow : channel_flows) {
-        if (active_flows_map_.find(flow->key()) != active_flows_map_.end()) {
-          shared_state_->SrcPortRelease(flow->key().local_addr,
-                                        flow->key().local_port);
-          LOG(INFO) << "Removing flow " << flow->key().ToString();
-          flow->ShutDown();
-          active_flows_map_.erase(flow->key());
-        } else {
-          LOG(WARNING) << "Flow " << flow->key().ToString()
-                       << " is not in the list of active flows";
+        for (const auto bucket : RxRssBuckets(flow.key())) {
+          buckets.insert(bucket);
         }
       }
+      bool shared = false;
+      active_flows_.ForEach([&](const ActiveFlow &active_flow) {
+        if (active_flow.flow->channel() == channel.get()) return;
+        for (const auto bucket : RxRssBuckets(active_flow.flow->key())) {
+          shared |= buckets.contains(bucket);
+        }
+      });
+      if (shared) {
+        LOG(WARNING) << "Cannot migrate channel " << channel->GetName()
+                     << ": its flows share RSS entries with other flows";
+        return false;
+      }
+      if (!buckets.empty() &&
+          !pmd_port_->RedirectRSSBuckets({buckets.begin(), buckets.end()},
+                                         rx_queue_id)) {
+        return false;
+      }
+    }
+
+    for (auto &flow : channel_flows) {
+      flow_scheduler_.Remove(&flow);
+      flow.Detach();
+      const auto &flow_key = flow.key();
+      active_flows_.Erase(flow_key, FlowTable::Hash(flow_key));
+    }
+
+    if (channel == rx_zerocopy_channel_) DisableRxZeroCopy();
+    std::erase(rx_zerocopy_channels_, channel);
+    channel_scheduler_.Remove(channel.get());
+    channels_.erase(it);
+    handoff->channel = channel;
+    LOG(INFO) << "Channel " << channel->GetName() << " ("
+              << channel_flows.size() << " flows) handed over to RX queue "
+              << rx_queue_id
+              << " (engine @rx_q_id: " << rxring_->GetRingId() << ")";
+    return true;
+  }
+
+  /**
+   * @brief Bind the flows of a channel handed over by another engine to this
+   * one (see `AdoptChannel()').
+   */
+  void AdoptChannelFlows(ChannelHandoff *handoff) {
+    auto &channel_flows = handoff->channel->GetActiveFlows();
+    for (auto flow_it = channel_flows.begin(); flow_it != channel_flows.end();
+         ++flow_it) {
+      auto *flow = &*flow_it;
+      flow->Adopt(txring_, &timer_wheel_, flow_removal_callback_);
+      AddActiveFlow(flow_it);
+      // Data queued at the flow is sent by the scheduler.
+      if (tx_scheduler_mode_ == TxSchedulerMode::kDrr) {
+        flow_scheduler_.Activate(flow);
+      }
+    }
+    for (auto &[key, rule] : handoff->steering_rules) {
+      flow_steering_rules_.emplace(key, rule);
+    }
+    LOG(INFO) << "Channel " << handoff->channel->GetName() << " ("
+              << channel_flows.size() << " flows) adopted (engine @rx_q_id: "
+              << rxring_->GetRingId() << ")";
+  }
+
+  /**
+   * @brief The entries of the RSS redirection table that the packets of a flow
+   * hash to on arrival, for either byte order of the hash (as when allocating
+   * the source port of the flow, see `ProcessControlRequests()').
+   */
+  std::array<uint16_t, 2> RxRssBuckets(const net::flow::Key &key) const {
+    rte_thash_tuple ipv4_l3_l4_tuple;
+    ipv4_l3_l4_tuple.v4.src_addr = key.remote_addr.address.value();
+    ipv4_l3_l4_tuple.v4.dst_addr = key.local_addr.address.value();
+    ipv4_l3_l4_tuple.v4.sport = key.remote_port.port.value();
+    ipv4_l3_l4_tuple.v4.dport = key.local_port.port.value();
+    const auto rss_hash =
+        rte_softrss(reinterpret_cast<uint32_t *>(&ipv4_l3_l4_tuple),
+                    RTE_THASH_V4_L4_LEN, pmd_port_->GetRSSKey().data());
+    return {pmd_port_->GetRSSBucket(rss_hash),
+            pmd_port_->GetRSSBucket(__builtin_bswap32(rss_hash))};
+  }
+
+  /**
+   * @brief Remove the flow rule steering a flow to this engine, if the flow
+   * migrated here (see `AdoptChannel()').
+   */
+  void RemoveFlowSteeringRule(const net::flow::Key &key) {
+    const auto it = flow_steering_rules_.find(key);
+    if (it == flow_steering_rules_.end()) return;
+    pmd_port_->RemoveSteeringRule(it->second);
+    flow_steering_rules_.erase(it);
+  }
+
+  /**
+   * @brief Set up zero-copy RX for the first eligible channel (see
+   * `EnableRxZeroCopy()'), if not already set up, and if it is the only
+   * channel of the engine.
+   */
+  void RxZeroCopyUpdate() {
+    if (channels_.size() != 1) return;
+    while (rx_zerocopy_channel_ == nullptr && !rx_zerocopy_channels_.empty()) {
+      auto channel = rx_zerocopy_channels_.front();
+      auto *pool = channel->CreateRxBufferPool(2 * rxring_->GetDescNum());
+      if (pool == nullptr) {
+        rx_zerocopy_channels_.erase(rx_zerocopy_channels_.begin());
+        continue;
+      }
+
+      if (!rxring_->ConfigureBufferSplit(pool, kMachnetHeadersLen)) {
+        LOG(WARNING) << "Zero-copy RX is not available (engine @rx_q_id: "
+                     << rxring_->GetRingId()
+                     << "); received payloads will be copied.";
+        channel->DestroyRxBufferPool();
+        rx_zerocopy_channels_.clear();
+        break;
+      }
 
-      // Finally remove the channel.
-      channels_.erase(it);
+      LOG(INFO) << "Zero-copy RX enabled for channel " << channel->GetName()
+                << " (engine @rx_q_id: " << rxring_->GetRingId() << ")";
+      rx_zerocopy_channel_ = std::move(channel);
     }
+  }
 
-    channels_to_dequeue_.clear();
+  /**
+   * @brief Release the removed channels that are no longer held by the NIC
+   * for zero-copy TX. The NIC normally returns the sent packets lazily, so
+   * they are reclaimed explicitly first.
+   */
+  void TxZeroCopyDrain() {
+    if (tx_zerocopy_draining_.empty()) return;
+    txring_->ReclaimTxMbufs();
+    std::erase_if(tx_zerocopy_draining_, [](const auto &channel) {
+      return channel->GetTxZeroCopyInflight() == 0;
+    });
+  }
+
+  /**
+   * @brief Stop receiving into the buffers of the zero-copy RX channel, and
+   * go back to receiving whole packets.
+   */
+  void DisableRxZeroCopy() {
+    rxring_->ConfigureBufferSplit(nullptr, 0);
+    rx_zerocopy_channel_->DestroyRxBufferPool();
+    LOG(INFO) << "Zero-copy RX disabled for channel "
+              << rx_zerocopy_channel_->GetName();
+    rx_zerocopy_channel_.reset();
   }
 
   /**
    * @brief This method polls active channels for all control plane requests and
    * processes them.
-   * It is called periodically.
+   * It is called periodically, to time out the pending ones (the requests are
+   * normally served as soon as they are submitted, see
+   * `ProcessCtrlDoorbells()').
+   *
+   * @param now The current TSC.
    */
-  void ProcessControlRequests() {
-    MachnetCtrlQueueEntry_t reqs[MACHNET_CHANNEL_CTRL_SQ_SLOT_NR];
+  void ProcessControlRequests(uint64_t now) {
     for (const auto &channel : channels_) {
-      // Peek the control SQ.
-      const auto nreqs =
-          channel->DequeueCtrlRequests(reqs, MACHNET_CHANNEL_CTRL_SQ_SLOT_NR);
-      for (auto i = 0u; i < nreqs; i++) {
-        const auto &req = reqs[i];
-        auto emit_completion = [&req, &channel](bool success) {
-          MachnetCtrlQueueEntry_t resp;
-          resp.id = req.id;
-          resp.opcode = MACHNET_CTRL_OP_STATUS;
-          resp.status =
-              success ? MACHNET_CTRL_STATUS_OK : MACHNET_CTRL_STATUS_ERROR;
-          channel->EnqueueCtrlCompletions(&resp, 1);
-        };
-        switch (req.opcode) {
-          case MACHNET_CTRL_OP_CREATE_FLOW:
-            // clang-format off
-            {
-              const Ipv4::Address src_addr(req.flow_info.src_ip);
-              if (!shared_state_->IsLocalIpv4Address(src_addr)) {
-                LOG(ERROR) << "Source IP " << src_addr.ToString()
-                           << " is not local. Cannot create flow.";
-                emit_completion(false);
-                break;
-              }
-              const Ipv4::Address dst_addr(req.flow_info.dst_ip);
-              const Udp::Port dst_port(req.flow_info.dst_port);
-              LOG(INFO) << "Request to create flow " << src_addr.ToString()
-                        << " -> "
-                        << dst_addr.ToString() << ":" << dst_port.port.value();
-              pending_requests_.emplace_back(periodic_ticks_, req, channel);
+      ProcessChannelCtrlRequests(channel, MACHNET_CHANNEL_CTRL_SQ_SLOT_NR, now);
+    }
+    ProcessPendingRequests(now);
+  }
+
+  /**
+   * @brief Serve the control requests of the channels whose doorbells rang, up
+   * to `kCtrlRequestsBudget' of them; the others are served on the next
+   * iterations. The flows requested are created right away, if their remote
+   * addresses are resolved, so that their handshakes start in this iteration.
+   *
+   * @param now The current TSC.
+   */
+  void ProcessCtrlDoorbells(uint64_t now) {
+    uint32_t budget = kCtrlRequestsBudget;
+    for (const auto &channel : channels_) {
+      if (budget == 0) break;
+      if (!channel->HasCtrlRequests()) continue;
+      budget -= ProcessChannelCtrlRequests(channel, budget, now);
+    }
+    if (budget != kCtrlRequestsBudget && !pending_requests_.empty()) {
+      ProcessPendingRequests(now);
+    }
+  }
+
+  /**
+   * @brief Dequeue up to `max_reqs' control requests from a channel, and
+   * process them. Flow creations are queued as pending requests (see
+   * `ProcessPendingRequests()').
+   *
+   * @param now The current TSC.
+   * @return The number of requests dequeued.
+   */
+  uint32_t ProcessChannelCtrlRequests(
+      const std::shared_ptr<shm::Channel> &channel, uint32_t max_reqs,
+      uint64_t now) {
+    MachnetCtrlQueueEntry_t reqs[MACHNET_CHANNEL_CTRL_SQ_SLOT_NR];
+    const auto nreqs = channel->DequeueCtrlRequests(
+        reqs, std::min<uint32_t>(max_reqs, MACHNET_CHANNEL_CTRL_SQ_SLOT_NR));
+    for (auto i = 0u; i < nreqs; i++) {
+      const auto &req = reqs[i];
+      auto emit_completion = [&req, &channel](bool success) {
+        MachnetCtrlQueueEntry_t resp;
+        resp.id = req.id;
+        resp.opcode = MACHNET_CTRL_OP_STATUS;
+        resp.status =
+            success ? MACHNET_CTRL_STATUS_OK : MACHNET_CTRL_STATUS_ERROR;
+        channel->EnqueueCtrlCompletions(&resp, 1);
+      };
+      switch (req.opcode) {
+        case MACHNET_CTRL_OP_CREATE_FLOW:
+          // clang-format off
+          {
+            const Ipv4::Address src_addr(req.flow_info.src_ip);
+            if (!shared_state_->IsLocalIpv4Address(src_addr)) {
+              LOG(ERROR) << "Source IP " << src_addr.ToString()
+                         << " is not local. Cannot create flow.";
+              emit_completion(false);
+              break;
             }
+            const Ipv4::Address dst_addr(req.flow_info.dst_ip);
+            const Udp::Port dst_port(req.flow_info.dst_port);
+            LOG(INFO) << "Request to create flow " << src_addr.ToString()
+                      << " -> "
+                      << dst_addr.ToString() << ":" << dst_port.port.value();
+            pending_requests_.emplace_back(now, req, channel);
+          }
+          break;
+          // clang-format on
+        case MACHNET_CTRL_OP_DESTROY_FLOW:
+          break;
+        case MACHNET_CTRL_OP_LISTEN:
+          // clang-format off
+          {
+            const Ipv4::Address local_ip(req.listener_info.ip);
+            const Udp::Port local_port(req.listener_info.port);
+            if (!shared_state_->IsLocalIpv4Address(local_ip) ||
+                listeners_.find(local_ip) == listeners_.end()) {
+            emit_completion(false);
             break;
-            // clang-format on
-          case MACHNET_CTRL_OP_DESTROY_FLOW:
-            break;
-          case MACHNET_CTRL_OP_LISTEN:
-            // clang-format off
-            {
-              const Ipv4::Address local_ip(req.listener_info.ip);
-              const Udp::Port local_port(req.listener_info.port);
-              if (!shared_state_->IsLocalIpv4Address(local_ip) ||
-                  listeners_.find(local_ip) == listeners_.end()) {
+            }
+
+            auto &listeners_on_ip = listeners_[local_ip];
+            if (listeners_on_ip.find(local_port) != listeners_on_ip.end()) {
+              LOG(ERROR) << "Cannot register listener for IP "
+                         << local_ip.ToString() << " and port "
+                         << local_port.port.value();
               emit_completion(false);
               break;
-              }
+            }
+
+            if (!shared_state_->RegisterListener(local_ip, local_port,
+                                                 rxring_->GetRingId())) {
+              LOG(ERROR) << "Cannot register listener for IP "
+                         << local_ip.ToString() << " and port "
+                         << local_port.port.value();
+              emit_completion(false);
+              break;
+            }
 
-              auto &listeners_on_ip = listeners_[local_ip];
-              if (listeners_on_ip.find(local_port) != listeners_on_ip.end()) {
-                LOG(ERROR) << "Cannot register listener for IP "
-                           << local_ip.ToString() << " and port "
-                           << local_port.port.value();
+            // With port steering, the listening port may belong to the
+            // block of another engine's queue; steer it here explicitly (or
+            // have the controller do it, for an engine outside of it).
+            if (shared_state_->IsDelegated()) {
+              if (!shared_state_->SteerListener(local_ip, local_port, true)) {
+                shared_state_->UnregisterListener(local_ip, local_port);
                 emit_completion(false);
                 break;
               }
-
-              if (!shared_state_->RegisterListener(local_ip, local_port,
-                                                   rxring_->GetRingId())) {
-                LOG(ERROR) << "Cannot register listener for IP "
-                           << local_ip.ToString() << " and port "
-                           << local_port.port.value();
+            } else if (shared_state_->IsPortSteeringEnabled()) {
+              auto *rule = pmd_port_->AddUdpSteeringRule(
+                  &local_ip, local_port.port.value(), UINT16_MAX,
+                  rxring_->GetRingId(),
+                  MachnetEngineSharedState::kListenerSteeringRulePriority);
+              if (rule == nullptr) {
+                shared_state_->UnregisterListener(local_ip, local_port);
                 emit_completion(false);
                 break;
               }
+              listener_steering_rules_[local_ip][local_port] = rule;
+            }
 
-              listeners_on_ip.emplace(local_port, channel);
-              channel->AddListener(local_ip, local_port);
-              emit_completion(true);
+            listeners_on_ip.emplace(local_port, channel);
+            channel->AddListener(local_ip, local_port);
+            emit_completion(true);
+          }
+          // clang-format on
+          break;
+        case MACHNET_CTRL_OP_RESOLVE:
+          // clang-format off
+          {
+            const Ipv4::Address src_addr(req.flow_info.src_ip);
+            if (!shared_state_->IsLocalIpv4Address(src_addr)) {
+              LOG(ERROR) << "Source IP " << src_addr.ToString()
+                         << " is not local. Cannot resolve neighbor.";
+              emit_completion(false);
+              break;
             }
-            // clang-format on
-            break;
-          default:
-            LOG(ERROR) << "Unknown control plane request opcode: "
-                       << req.opcode;
-        }
+            const Ipv4::Address dst_addr(req.flow_info.dst_ip);
+            shared_state_->AddNeighbor(src_addr, dst_addr, txring_);
+            emit_completion(true);
+          }
+          break;
+          // clang-format on
+        default:
+          LOG(ERROR) << "Unknown control plane request opcode: "
+                     << req.opcode;
       }
     }
+    return nreqs;
+  }
 
+  /**
+   * @brief Create the flows requested to remote addresses that are resolved
+   * by now, and initiate their handshakes; the requests to addresses that are
+   * not are kept pending, up to a timeout.
+   *
+   * @param now The current TSC.
+   */
+  void ProcessPendingRequests(uint64_t now) {
     for (auto it = pending_requests_.begin(); it != pending_requests_.end();) {
       const auto &[timestamp_, req, channel] = *it;
-      if (periodic_ticks_ - timestamp_ > kPendingRequestTimeoutSlowTicks) {
+      if (time::cycles_to_us(now - timestamp_) > kPendingRequestTimeoutUs) {
         LOG(ERROR) << utils::Format(
             "Pending request timeout: [ID: %lu, Opcode: %u]", req.id,
             req.opcode);
+        // Fail the request, rather than leave the application waiting.
+        MachnetCtrlQueueEntry_t resp;
+        resp.id = req.id;
+        resp.opcode = MACHNET_CTRL_OP_STATUS;
+        resp.status = MACHNET_CTRL_STATUS_ERROR;
+        channel->EnqueueCtrlCompletions(&resp, 1);
         it = pending_requests_.erase(it);
         continue;
       }
@@ -700,7 +2069,8 @@ class MachnetEngine {
       const Udp::Port dst_port(req.flow_info.dst_port);
 
       auto remote_l2_addr =
-          shared_state_->GetL2Addr(txring_, src_addr, dst_addr);
+          shared_state_->GetL2Addr(arp_table_reader_.get(), txring_, src_addr,
+                                   dst_addr);
       if (!remote_l2_addr.has_value()) {
         // L2 address has not been resolved yet.
         it++;
@@ -748,7 +2118,13 @@ class MachnetEngine {
         return true;
       };
 
-      auto src_port = shared_state_->SrcPortAlloc(src_addr, rss_lambda);
+      // With port steering, the NIC steers the replies to this engine by the
+      // source port alone; otherwise, search for one that RSS hashes here.
+      auto src_port =
+          shared_state_->IsPortSteeringEnabled()
+              ? shared_state_->SrcPortAllocSteered(src_addr,
+                                                   rxring_->GetRingId())
+              : shared_state_->SrcPortAlloc(src_addr, rss_lambda);
       if (!src_port.has_value()) {
         LOG(ERROR) << "Cannot allocate source port for " << src_addr.ToString();
         it = pending_requests_.erase(it);
@@ -772,41 +2148,340 @@ class MachnetEngine {
       const auto &flow_it =
           channel->CreateFlow(src_addr, src_port.value(), dst_addr, dst_port,
                               pmd_port_->GetL2Addr(), remote_l2_addr.value(),
-                              txring_, application_callback);
-      (*flow_it)->InitiateHandshake();
-      active_flows_map_.emplace((*flow_it)->key(), flow_it);
+                              txring_, application_callback, ack_every_,
+                              pacing_burst_, num_paths_, encryption_key_,
+                              &timer_wheel_, flow_removal_callback_);
+      flow_it->InitiateHandshake();
+      AddActiveFlow(flow_it);
       it = pending_requests_.erase(it);
     }
   }
 
   /**
-   * @brief Iterate throught the list of flows, check and handle RTOs.
+   * @brief Deficit round robin TX (see `TxSchedulerMode::kDrr'). First,
+   * dequeue the messages of the channels that have any pending, in proportion
+   * to the channel weights; the messages are queued at their flows. Then,
+   * transmit the queued data of the flows, in turn. Each stage sends at most
+   * `tx_budget_' packets per iteration; the rest is left for the next ones.
+   *
+   * @param now The current TSC.
    */
-  void HandleRTO() {
-    for (auto it = active_flows_map_.begin(); it != active_flows_map_.end();) {
-      const auto &flow_it = it->second;
-      auto is_active_flow = (*flow_it)->PeriodicCheck();
-      if (!is_active_flow) {
-        LOG(INFO) << "Flow " << (*flow_it)->key().ToString()
-                  << " is no longer active. Removing.";
-        auto channel = (*flow_it)->channel();
-        shared_state_->SrcPortRelease((*flow_it)->key().local_addr,
-                                      (*flow_it)->key().local_port);
-        channel->RemoveFlow(flow_it);
-        it = active_flows_map_.erase(it);
+  void ScheduleTx(uint64_t now) {
+    // Only channels with messages pending take part in the scheduling.
+    for (auto &channel : channels_) {
+      if (!channel->tx_sched_state().active && channel->HasPendingMessages()) {
+        channel_scheduler_.Activate(channel.get());
+      }
+    }
+
+    channel_scheduler_.Run(tx_budget_, [this, now](shm::Channel *channel,
+                                                   uint32_t max_packets) {
+      shm::MsgBufBatch msg_buf_batch;
+      std::array<Flow *, shm::MsgBufBatch::kMaxBurst> tx_flows;
+      const uint32_t nb_msgs =
+          std::min<uint32_t>(max_packets, msg_buf_batch.GetRoom());
+      uint32_t nb_msg_dequeued;
+      cycles_.Nested(CycleAccounting::kDequeue, [&]() {
+        nb_msg_dequeued = channel->DequeueMessages(
+            msg_buf_batch.buf_indices(), msg_buf_batch.bufs(), nb_msgs);
+      });
+      msg_buf_batch.IncrCount(nb_msg_dequeued);
+      LookupTxFlows(msg_buf_batch, tx_flows.data());
+
+      // Charge the channel for the packets of its messages.
+      const auto mss = channel->GetUsableBufSize();
+      uint32_t nb_packets = 0;
+      for (uint32_t i = 0; i < nb_msg_dequeued; i++) {
+        auto *msg = msg_buf_batch.bufs()[i];
+        nb_packets += std::max(1u, (msg->msg_length() + mss - 1) / mss);
+        process_msg(channel, msg, tx_flows[i], now, false);
+        if (tx_flows[i] != nullptr) flow_scheduler_.Activate(tx_flows[i]);
+      }
+      const bool pending =
+          nb_msg_dequeued == nb_msgs && channel->HasPendingMessages();
+      return std::make_pair(nb_packets, pending);
+    });
+
+    flow_scheduler_.Run(tx_budget_, [](Flow *flow, uint32_t max_packets) {
+      return flow->TransmitPending(max_packets);
+    });
+  }
+
+  /**
+   * @brief Remove the flows that asked to be removed (see
+   * `Flow::RemovalCallback'), e.g., because they are closed or timed out.
+   */
+  void RemoveExpiredFlows() {
+    for (auto *flow : expired_flows_) {
+      const auto flow_key = flow->key();
+      const auto flow_hash = FlowTable::Hash(flow_key);
+      const auto *entry = active_flows_.Lookup(flow_key, flow_hash);
+      if (entry == nullptr) continue;
+
+      // Not logged by default: in a storm of connections, the log would take
+      // longer than the removal (see `machnet_engine_bench').
+      VLOG(1) << "Flow " << flow_key.ToString()
+              << " is no longer active. Removing.";
+      const auto flow_it = entry->it;
+      RemoveFlowSteeringRule(flow_key);
+      shared_state_->SrcPortRelease(flow_key.local_addr, flow_key.local_port);
+      active_flows_.Erase(flow_key, flow_hash);
+      flow_scheduler_.Remove(flow);
+      flow->channel()->RemoveFlow(flow_it);
+    }
+    expired_flows_.clear();
+  }
+
+  /**
+   * @brief Insert a newly created flow in the table of active flows.
+   */
+  void AddActiveFlow(
+      const shm::Channel::FlowList::iterator &flow_it) {
+    const auto &flow_key = flow_it->key();
+    const bool inserted = active_flows_.Insert(
+        flow_key, FlowTable::Hash(flow_key), {&*flow_it, flow_it});
+    DCHECK(inserted) << "Flow " << flow_key.ToString() << " already exists";
+    flow_it->set_rtt_histogram(&rtt_histogram_);
+    flow_it->set_tracer(tracer_.enabled() ? &tracer_ : nullptr);
+    flow_it->set_rexmit_budget(
+        rexmit_budget_.max_packets() != 0 ? &rexmit_budget_ : nullptr);
+  }
+
+  /**
+   * @brief The arrival time of a received packet, from its NIC timestamp (see
+   * `PmdPort::EnableRxTimestamps()'), in nanoseconds on the TSC time base.
+   * @return 0 if the packet has no NIC timestamp (or the NIC clock is not
+   * calibrated yet), for the flow to take the current time instead.
+   */
+  uint64_t RxTimestamp(const juggler::dpdk::Packet *pkt) {
+    if (!nic_clock_.has_value() || !nic_clock_->IsCalibrated()) return 0;
+    const auto nic_ticks = pkt->rx_timestamp(
+        pmd_port_->rx_timestamp_offset(), pmd_port_->rx_timestamp_flag());
+    if (nic_ticks == 0) return 0;
+    rx_hw_timestamps_++;
+    return nic_clock_->ToNs(nic_ticks);
+  }
+
+  /**
+   * @brief The remote port of the flow a UDP packet belongs to: its source
+   * port, unless it was sent on another path of a multipath flow, which flips
+   * bits of the port (see `net::flow::Multipath').
+   */
+  static Udp::Port RemotePort(const juggler::dpdk::Packet *pkt) {
+    const auto *udph = pkt->head_data<Udp *>(sizeof(Ethernet) + sizeof(Ipv4));
+    if (pkt->length() < kMachnetHeadersLen) [[unlikely]] {  // NOLINT
+      return udph->src_port;
+    }
+    const auto *machneth =
+        reinterpret_cast<const net::MachnetPktHdr *>(udph + 1);
+    const auto path = machneth->path;
+    using net::flow::Multipath;
+    if (path == 0 || path >= Multipath::kMaxPaths) [[likely]] {  // NOLINT
+      return udph->src_port;
+    }
+    return Udp::Port(Multipath::PathPort(udph->src_port.port.value(), path));
+  }
+
+  /**
+   * @brief Batched lookup in the table of active flows.
+   *
+   * Table entries are resolved to flow pointers right away: unlike pointers to
+   * the table entries, these remain valid if the table is rehashed (e.g., a
+   * new flow is created while processing the batch).
+   */
+  void LookupActiveFlows(const net::flow::Key *const keys[],
+                         const uint32_t hashes[], size_t n, Flow *flows[]) {
+    std::array<ActiveFlow *, FlowTable::kMaxBulkLookup> entries;
+    active_flows_.LookupBulk(keys, hashes, n, entries.data());
+    for (size_t i = 0; i < n; i++) {
+      flows[i] = entries[i] == nullptr ? nullptr : entries[i]->flow;
+    }
+  }
+
+  /**
+   * @brief Look up the active flows for all the packets of an RX burst.
+   *
+   * @param batch  The RX packet batch.
+   * @param flows  Output array (one entry per packet in the batch); set to the
+   *               active flow the packet belongs to, or `nullptr' if there is
+   *               none (or it is not a Machnet packet).
+   */
+  void LookupRxFlows(const juggler::dpdk::PacketBatch &batch, Flow *flows[]) {
+    constexpr auto kMaxBurst = juggler::dpdk::PacketBatch::kMaxBurst;
+    std::array<std::optional<net::flow::Key>, kMaxBurst> keys;
+    std::array<const net::flow::Key *, kMaxBurst> key_ptrs;
+    std::array<uint32_t, kMaxBurst> hashes;
+    for (uint16_t i = 0; i < batch.GetSize(); i++) {
+      key_ptrs[i] = nullptr;
+      const auto *pkt = batch.pkts()[i];
+      if (pkt->length() < sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp))
+          [[unlikely]]
+        continue;
+      const auto *eh = pkt->head_data<Ethernet *>();
+      const auto *ipv4h = reinterpret_cast<const Ipv4 *>(eh + 1);
+      if (eh->eth_type.value() != Ethernet::kIpv4 ||
+          ipv4h->next_proto_id != Ipv4::kUdp) [[unlikely]]
+        continue;
+      const auto *udph = reinterpret_cast<const Udp *>(ipv4h + 1);
+      keys[i].emplace(ipv4h->dst_addr, udph->dst_port, ipv4h->src_addr,
+                      RemotePort(pkt));
+      key_ptrs[i] = &keys[i].value();
+      hashes[i] = FlowTable::Hash(*key_ptrs[i]);
+    }
+
+    LookupActiveFlows(key_ptrs.data(), hashes.data(), batch.GetSize(), flows);
+  }
+
+  /**
+   * @brief Look up the active flows for a batch of messages dequeued from a
+   * channel.
+   *
+   * @param batch  The message batch.
+   * @param flows  Output array (one entry per message in the batch); set to
+   *               the flow the message is destined to, or `nullptr' if the
+   *               flow does not exist.
+   */
+  void LookupTxFlows(const shm::MsgBufBatch &batch, Flow *flows[]) {
+    constexpr auto kMaxBurst = shm::MsgBufBatch::kMaxBurst;
+    std::array<std::optional<net::flow::Key>, kMaxBurst> keys;
+    std::array<const net::flow::Key *, kMaxBurst> key_ptrs;
+    std::array<uint32_t, kMaxBurst> hashes;
+    for (uint32_t i = 0; i < batch.GetSize(); i++) {
+      const auto *flow_info = batch.bufs()[i]->flow();
+      keys[i].emplace(flow_info->src_ip, flow_info->src_port,
+                      flow_info->dst_ip, flow_info->dst_port);
+      key_ptrs[i] = &keys[i].value();
+      hashes[i] = FlowTable::Hash(*key_ptrs[i]);
+    }
+
+    LookupActiveFlows(key_ptrs.data(), hashes.data(), batch.GetSize(), flows);
+  }
+
+  /**
+   * @brief Send the delayed ACKs of all the flows that received data since the
+   * last call.
+   */
+  void FlushDelayedAcks() {
+    for (auto *flow : delayed_ack_flows_) flow->FlushDelayedAck();
+    delayed_ack_flows_.clear();
+  }
+
+  /**
+   * @brief Process an RX burst, one packet after the other.
+   *
+   * @param batch The RX packet batch.
+   * @param now   TSC timestamp.
+   */
+  void ProcessRxBatch(const juggler::dpdk::PacketBatch &batch, uint64_t now) {
+    // Resolve the flows for the whole burst at once, to overlap the flow table
+    // cache misses.
+    std::array<Flow *, juggler::dpdk::PacketBatch::kMaxBurst> flows;
+    LookupRxFlows(batch, flows.data());
+    for (uint16_t i = 0; i < batch.GetSize(); i++) {
+      process_rx_pkt(batch.pkts()[i], flows[i], now);
+    }
+    AcceptPendingSyns();
+  }
+
+  /**
+   * @brief Process an RX burst in stages, to hide the memory latency of
+   * accessing packet headers and flow state:
+   *  1. Prefetch the protocol headers of all the packets in the burst.
+   *  2. Classify the packets to active flows, and prefetch the state of each
+   *     flow.
+   *  3. Process the packets grouped by flow. The order of the packets within
+   *     each flow is preserved; packets not belonging to an active flow (e.g.,
+   *     ARP, ICMP or SYNs for new flows) are processed in arrival order.
+   *
+   * @param batch The RX packet batch.
+   * @param now   TSC timestamp.
+   */
+  void ProcessRxBatchStaged(const juggler::dpdk::PacketBatch &batch,
+                            uint64_t now) {
+    constexpr auto kMaxBurst = juggler::dpdk::PacketBatch::kMaxBurst;
+    const auto nb_pkts = batch.GetSize();
+
+    for (uint16_t i = 0; i < nb_pkts; i++) {
+      batch.pkts()[i]->prefetch_head(kMachnetHeadersLen);
+    }
+
+    std::array<Flow *, kMaxBurst> flows;
+    LookupRxFlows(batch, flows.data());
+    for (uint16_t i = 0; i < nb_pkts; i++) {
+      if (flows[i] != nullptr) flows[i]->Prefetch();
+    }
+
+    std::bitset<kMaxBurst> processed;
+    for (uint16_t i = 0; i < nb_pkts; i++) {
+      if (processed[i]) continue;
+      auto *flow = flows[i];
+      if (flow == nullptr) {
+        process_rx_pkt(batch.pkts()[i], nullptr, now);
+        continue;
+      }
+      for (uint16_t j = i; j < nb_pkts; j++) {
+        if (flows[j] != flow) continue;
+        process_rx_pkt(batch.pkts()[j], flow, now);
+        processed[j] = true;
+      }
+    }
+    AcceptPendingSyns();
+  }
+
+  /**
+   * @brief Set up the flows of the SYNs of an RX burst (see
+   * `process_rx_ipv4()'), all at once. In a storm of new connections, the flow
+   * pools of the listening channels grow at most once per burst, and the
+   * SYN-ACKs go out in the same TX burst.
+   */
+  void AcceptPendingSyns() {
+    if (pending_syns_.empty()) [[likely]] return;  // NOLINT
+
+    const shm::Channel *reserved = nullptr;
+    for (const auto &[pkt, channel] : pending_syns_) {
+      if (channel != reserved) {
+        channel->ReserveFlows(pending_syns_.size());
+        reserved = channel;
+      }
+
+      const auto *eh = pkt->head_data<Ethernet *>();
+      const auto *ipv4h = pkt->head_data<Ipv4 *>(sizeof(Ethernet));
+      const auto *udph =
+          pkt->head_data<Udp *>(sizeof(Ethernet) + sizeof(Ipv4));
+      const net::flow::Key key(ipv4h->dst_addr, udph->dst_port,
+                               ipv4h->src_addr, RemotePort(pkt));
+      // A retransmitted SYN, for a flow set up earlier in the burst.
+      const auto *entry = active_flows_.Lookup(key, FlowTable::Hash(key));
+      if (entry != nullptr) {
+        entry->flow->InputPacket(pkt, RxTimestamp(pkt));
         continue;
       }
-      ++it;
+
+      auto empty_callback = [](shm::Channel *, bool,
+                               const net::flow::Key &) {};
+      const auto &flow_it = channel->CreateFlow(
+          key.local_addr, key.local_port, key.remote_addr, key.remote_port,
+          pmd_port_->GetL2Addr(), eh->src_addr, txring_, empty_callback,
+          ack_every_, pacing_burst_, num_paths_, encryption_key_,
+          &timer_wheel_, flow_removal_callback_);
+      AddActiveFlow(flow_it);
+
+      // Handle the incoming packet.
+      flow_it->InputPacket(pkt, RxTimestamp(pkt));
     }
+    pending_syns_.clear();
   }
 
   /**
    * @brief Process an incoming packet.
    *
-   * @param pkt Pointer to the packet.
-   * @param now TSC timestamp.
+   * @param pkt   Pointer to the packet.
+   * @param flow  The active flow the packet belongs to, as resolved by
+   *              `LookupRxFlows()' (`nullptr' if none).
+   * @param now   TSC timestamp.
    */
-  void process_rx_pkt(const juggler::dpdk::Packet *pkt, uint64_t now) {
+  void process_rx_pkt(juggler::dpdk::Packet *pkt, Flow *flow,
+                      uint64_t now) {
     // Sanity ethernet header check.
     if (pkt->length() < sizeof(Ethernet)) [[unlikely]]
       return;
@@ -817,13 +2492,16 @@ class MachnetEngine {
       case Ethernet::kArp:
         {
           auto *arph = pkt->head_data<Arp *>(sizeof(*eh));
-          shared_state_->ProcessArpPacket(txring_, arph);
+          cycles_.Nested(CycleAccounting::kArp, [this, arph]() {
+            shared_state_->ProcessArpPacket(arp_table_reader_.get(), txring_,
+                                            arph);
+          });
         }
       // clang-format on
       break;
         // clang-format off
       [[likely]] case Ethernet::kIpv4:
-          process_rx_ipv4(pkt, now);
+          process_rx_ipv4(pkt, flow, now);
         break;
       // clang-format on
       case Ethernet::kIpv6:
@@ -834,24 +2512,24 @@ class MachnetEngine {
     }
   }
 
-  void process_rx_ipv4(const juggler::dpdk::Packet *pkt, uint64_t now) {
+  void process_rx_ipv4(juggler::dpdk::Packet *pkt, Flow *flow,
+                       uint64_t now) {
     // Sanity ipv4 header check.
     if (pkt->length() < sizeof(Ethernet) + sizeof(Ipv4)) [[unlikely]]
       return;
 
-    const auto *eh = pkt->head_data<Ethernet *>();
     const auto *ipv4h = pkt->head_data<Ipv4 *>(sizeof(Ethernet));
     const auto *udph = pkt->head_data<Udp *>(sizeof(Ethernet) + sizeof(Ipv4));
 
-    const net::flow::Key pkt_key(ipv4h->dst_addr, udph->dst_port,
-                                 ipv4h->src_addr, udph->src_port);
     // Check ivp4 header length.
     // clang-format off
     if (pkt->length() != sizeof(Ethernet) + ipv4h->total_length.value()) [[unlikely]] { // NOLINT
       // clang-format on
-      LOG(WARNING) << "IPv4 packet length mismatch (expected: "
-                   << ipv4h->total_length.value()
-                   << ", actual: " << pkt->length() << ")";
+      LOG_EVERY_N(WARNING, kDropLogEvery)
+          << "IPv4 packet length mismatch (expected: "
+          << ipv4h->total_length.value() << ", actual: " << pkt->length()
+          << ")";
+      rx_drops_++;
       return;
     }
 
@@ -859,9 +2537,11 @@ class MachnetEngine {
       // clang-format off
       [[likely]] case Ipv4::kUdp:
           // clang-format on
-          if (active_flows_map_.find(pkt_key) != active_flows_map_.end()) {
-        const auto &flow_it = active_flows_map_[pkt_key];
-        (*flow_it)->InputPacket(pkt);
+      // No flow is created while the burst is processed (see
+      // `AcceptPendingSyns()'), so the batched lookup is up to date.
+      if (flow != nullptr) [[likely]] {
+        flow->InputPacket(pkt, RxTimestamp(pkt));
+        if (flow->ScheduleDelayedAck()) delayed_ack_flows_.push_back(flow);
         return;
       }
 
@@ -875,101 +2555,53 @@ class MachnetEngine {
           // We have a listener on this port.
           const auto &listeners_on_ip = listeners_[local_ipv4_addr];
           if (listeners_on_ip.find(local_udp_port) == listeners_on_ip.end()) {
-            LOG(INFO) << "Dropping packet with RSS hash: " << pkt->rss_hash()
-                      << " (be: " << __builtin_bswap32(pkt->rss_hash()) << ")"
-                      << " because there is no listener on port "
-                      << local_udp_port.port.value()
-                      << " (engine @rx_q_id: " << rxring_->GetRingId() << ")";
+            LOG_EVERY_N(INFO, kDropLogEvery)
+                << "Dropping packet with RSS hash: " << pkt->rss_hash()
+                << " (be: " << __builtin_bswap32(pkt->rss_hash()) << ")"
+                << " because there is no listener on port "
+                << local_udp_port.port.value()
+                << " (engine @rx_q_id: " << rxring_->GetRingId() << ")";
+            rx_drops_++;
             return;
           }
 
-          // Create a new flow.
-          const auto &channel = listeners_on_ip.at(local_udp_port);
-          const auto &remote_ipv4_addr = ipv4h->src_addr;
-          const auto &remote_udp_port = udph->src_port;
-
           // Check if it is a SYN packet.
           const auto *machneth = pkt->head_data<net::MachnetPktHdr *>(
               sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp));
           if (machneth->net_flags != net::MachnetPktHdr::MachnetFlags::kSyn) {
-            LOG(WARNING) << "Received a non-SYN packet on a listening port";
+            LOG_EVERY_N(WARNING, kDropLogEvery)
+                << "Received a non-SYN packet on a listening port";
+            rx_drops_++;
             break;
           }
 
-          auto empty_callback = [](shm::Channel *, bool,
-                                   const net::flow::Key &) {};
-          const auto &flow_it = channel->CreateFlow(
-              local_ipv4_addr, local_udp_port, remote_ipv4_addr,
-              remote_udp_port, pmd_port_->GetL2Addr(), eh->src_addr, txring_,
-              empty_callback);
-          active_flows_map_.insert({pkt_key, flow_it});
-
-          // Handle the incoming packet.
-          (*flow_it)->InputPacket(pkt);
+          // The new flow is set up along with those of the other SYNs of the
+          // burst (see `AcceptPendingSyns()').
+          pending_syns_.push_back(
+              {pkt, listeners_on_ip.at(local_udp_port).get()});
+          return;
         }
+        // Not one of our addresses.
+        rx_drops_++;
       }
 
       break;
       // clang-format off
       case Ipv4::kIcmp:
       {
-        if (pkt->length() < sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Icmp))
-          [[unlikely]] return;
-
-        const auto *icmph =
-            pkt->head_data<Icmp *>(sizeof(Ethernet) + sizeof(Ipv4));
-        // Only process ICMP echo requests.
-        if (icmph->type != Icmp::kEchoRequest) [[unlikely]] return;
-
-        // Allocate and construct a new packet for the response, instead of
-        // in-place modification.
-        // If `FAST_FREE' is enabled it's unsafe to use packets from different
-        // pools (the driver may put them in the wrong pool on reclaim).
-        auto *response = CHECK_NOTNULL(packet_pool_->PacketAlloc());
-        auto *response_eh = response->append<Ethernet *>(pkt->length());
-        response_eh->dst_addr = eh->src_addr;
-        response_eh->src_addr = pmd_port_->GetL2Addr();
-        response_eh->eth_type = be16_t(Ethernet::kIpv4);
-        response->set_l2_len(sizeof(*response_eh));
-        auto *response_ipv4h = reinterpret_cast<Ipv4 *>(response_eh + 1);
-        response_ipv4h->version_ihl = 0x45;
-        response_ipv4h->type_of_service = 0;
-        response_ipv4h->packet_id = be16_t(0x1513);
-        response_ipv4h->fragment_offset = be16_t(0);
-        response_ipv4h->time_to_live = 64;
-        response_ipv4h->next_proto_id = Ipv4::Proto::kIcmp;
-        response_ipv4h->total_length = be16_t(pkt->length() - sizeof(Ethernet));
-        response_ipv4h->src_addr = ipv4h->dst_addr;
-        response_ipv4h->dst_addr = ipv4h->src_addr;
-        response_ipv4h->hdr_checksum = 0;
-        response->set_l3_len(sizeof(*response_ipv4h));
-        response->offload_ipv4_csum();
-        auto *response_icmph = reinterpret_cast<Icmp *>(response_ipv4h + 1);
-        response_icmph->type = Icmp::kEchoReply;
-        response_icmph->code = Icmp::kCodeZero;
-        response_icmph->cksum = 0;
-        response_icmph->id = icmph->id;
-        response_icmph->seq = icmph->seq;
-
-        auto *response_data = reinterpret_cast<uint8_t *>(response_icmph + 1);
-        const auto *request_data =
-            reinterpret_cast<const uint8_t *>(icmph + 1);
-        utils::Copy(
-            response_data, request_data,
-            pkt->length() - sizeof(Ethernet) - sizeof(Ipv4) - sizeof(Icmp));
-        response_icmph->cksum = utils::ComputeChecksum16(
-            reinterpret_cast<const uint8_t *>(response_icmph),
-            pkt->length() - sizeof(Ethernet) - sizeof(Ipv4));
-
-        auto nsent = txring_->TrySendPackets(&response, 1);
-        LOG_IF(WARNING, nsent != 1) << "Failed to send ICMP echo reply";
+        // Unless the NIC steers ICMP to the slow path (see `SlowPath').
+        auto *response =
+            IcmpEchoReply(pkt, packet_pool_, pmd_port_->GetL2Addr());
+        if (response != nullptr) txring_->BufferPacket(response);
       }
       // clang-format on
 
       break;
       default:
-        LOG(WARNING) << "Unsupported IP protocol: "
-                     << static_cast<uint32_t>(ipv4h->next_proto_id);
+        LOG_EVERY_N(WARNING, kDropLogEvery)
+            << "Unsupported IP protocol: "
+            << static_cast<uint32_t>(ipv4h->next_proto_id);
+        rx_drops_++;
         break;
     }
   }
@@ -979,13 +2611,17 @@ class MachnetEngine {
    * @param channel A pointer to the channel that the message was enqueued to.
    * @param msg     A pointer to the `MsgBuf` containing the first buffer of the
    *                message.
+   * @param flow    The active flow the message is destined to, as resolved by
+   *                `LookupTxFlows()' (`nullptr' if none).
+   * @param transmit Whether the flow transmits the message right away (see
+   *                `Flow::OutputMessage()').
    */
   void process_msg(const shm::Channel *channel, shm::MsgBuf *msg,
-                   uint64_t now) {
-    const auto *flow_info = msg->flow();
-    const net::flow::Key msg_key(flow_info->src_ip, flow_info->src_port,
-                                 flow_info->dst_ip, flow_info->dst_port);
-    if (active_flows_map_.find(msg_key) == active_flows_map_.end()) {
+                   Flow *flow, uint64_t now, bool transmit = true) {
+    if (flow == nullptr) [[unlikely]] {
+      const auto *flow_info = msg->flow();
+      const net::flow::Key msg_key(flow_info->src_ip, flow_info->src_port,
+                                   flow_info->dst_ip, flow_info->dst_port);
       LOG(ERROR) << "Message received for a non-existing flow! "
                  << utils::Format("(Channel: %s, 5-tuple hash: %lu, Flow: %s)",
                                   channel->GetName().c_str(),
@@ -993,13 +2629,31 @@ class MachnetEngine {
                                   msg_key.ToString().c_str());
       return;
     }
-    const auto &flow_it = active_flows_map_[msg_key];
-    (*flow_it)->OutputMessage(msg);
+    if (tracer_.enabled()) tracer_.OnDequeue(msg, now);
+    flow->OutputMessage(msg, transmit);
   }
 
  private:
-  using channel_info =
-      std::tuple<std::shared_ptr<shm::Channel>, std::promise<bool>>;
+  // Entry of the active flows table. The flow pointer is cached next to the
+  // list iterator to avoid chasing the list node on the datapath.
+  struct ActiveFlow {
+    Flow *flow{nullptr};
+    shm::Channel::FlowList::const_iterator it{};
+  };
+  using FlowTable = net::flow::FlowTable<ActiveFlow>;
+  // A control plane operation on the channels of the engine.
+  struct ChannelCommand {
+    enum Type { kAdd, kRemove, kDetach, kAdopt, kEnableRxZeroCopy };
+    Type type;
+    std::shared_ptr<shm::Channel> channel{nullptr};
+    // Set once the command is carried out (`kAdd', `kDetach' and `kAdopt').
+    std::promise<bool> status{};
+    // The RX queue of the new engine, and the channel in transit (`kDetach').
+    uint16_t rx_queue_id{0};
+    ChannelHandoff *detached{nullptr};
+    // The channel handed over (`kAdopt').
+    ChannelHandoff adopted{};
+  };
   using flow_info =
       std::tuple<uint64_t, Ipv4::Address, Udp::Port, Ipv4::Address, Udp::Port,
                  std::shared_ptr<shm::Channel>, std::promise<bool>>;
@@ -1011,8 +2665,34 @@ class MachnetEngine {
   static constexpr size_t kSrcPortBitmapSize =
       ((kSrcPortMax - kSrcPortMin + 1) + sizeof(uint64_t) - 1) /
       sizeof(uint64_t);
-  // A mutex to synchronize control plane operations.
-  std::mutex mtx_;
+  // RX processing mode.
+  const RxPipelineMode rx_pipeline_mode_;
+  // ACK coalescing factor of the flows created by this engine.
+  const uint32_t ack_every_;
+  // Burst size of the paced flows created by this engine (0: no pacing).
+  const uint32_t pacing_burst_;
+  // Number of paths of the flows created by this engine.
+  const uint8_t num_paths_;
+  // Pre-shared key of the encrypted flows created by this engine, if any.
+  const std::optional<crypto::Key> encryption_key_;
+  // Whether zero-copy RX is enabled (see `EnableRxZeroCopy()').
+  const bool rx_zerocopy_;
+  // Whether zero-copy TX is enabled, and for payloads of what size.
+  const bool tx_zerocopy_;
+  const uint32_t tx_zerocopy_threshold_;
+  // TX scheduling (see `ScheduleTx()').
+  const TxSchedulerMode tx_scheduler_mode_;
+  const uint32_t tx_budget_;
+  DrrScheduler<shm::Channel> channel_scheduler_;
+  DrrScheduler<Flow> flow_scheduler_;
+  // Idling (see `Idle()'), and what the NIC and the CPU support for it.
+  static constexpr uint64_t kIdleWaitUs = 10;
+  static constexpr int kIdleSleepTimeoutMs = 1;
+  IdleMode idle_mode_;
+  IdlePolicy idle_policy_;
+  bool monitor_supported_{true};
+  bool pause_supported_{true};
+  bool rx_interrupt_ready_{false};
   // A shared pointer to the PmdPort instance.
   std::shared_ptr<PmdPort> pmd_port_;
   // Designated RX queue for this engine (not shared).
@@ -1024,6 +2704,8 @@ class MachnetEngine {
   dpdk::PacketPool *packet_pool_;
   // Shared State instance for this engine.
   std::shared_ptr<MachnetEngineSharedState> shared_state_;
+  // This engine's view of the ARP table of the shared state.
+  std::unique_ptr<MachnetEngineSharedState::ArpTableReader> arp_table_reader_;
   // Local IPv4 addresses bound to this engine/interface.
   std::unordered_set<Ipv4::Address> local_ipv4_addrs_;
   // Vector of active channels this engine is serving.
@@ -1037,15 +2719,76 @@ class MachnetEngine {
       Ipv4::Address,
       std::unordered_map<Udp::Port, std::shared_ptr<shm::Channel>>>
       listeners_{};
-  // Unordered map of active flows.
-  std::unordered_map<net::flow::Key,
-                     const std::list<std::unique_ptr<Flow>>::const_iterator>
-      active_flows_map_{};
-  // Vector of channels to be added to the list of active channels.
-  std::vector<channel_info> channels_to_enqueue_{};
-  // Vector of channels to be removed from the list of active channels.
-  std::vector<std::shared_ptr<shm::Channel>> channels_to_dequeue_{};
-  // List of pending control plane requests.
+  // Flow rules steering the listening ports to this engine (only with port
+  // steering, see `MachnetEngineSharedState::EnablePortSteering()').
+  std::unordered_map<Ipv4::Address, std::unordered_map<Udp::Port, rte_flow *>>
+      listener_steering_rules_{};
+  // Flow rules steering the flows that migrated to this engine (only with
+  // port steering, see `AdoptChannel()').
+  std::unordered_map<net::flow::Key, rte_flow *> flow_steering_rules_{};
+  // Table of active flows.
+  FlowTable active_flows_{};
+  // Flows with a delayed ACK pending (see `FlushDelayedAcks()').
+  std::vector<Flow *> delayed_ack_flows_{};
+  // SYNs of the current RX burst for new flows, and their listening channels
+  // (see `AcceptPendingSyns()').
+  struct PendingSyn {
+    juggler::dpdk::Packet *pkt;
+    shm::Channel *channel;
+  };
+  std::vector<PendingSyn> pending_syns_{};
+  // Timer wheel for the timers of the flows (RTO and pacing).
+  TimerWheel timer_wheel_{time::rdtsc()};
+  // Flows to be removed after the timers have fired (see
+  // `RemoveExpiredFlows()'); removal is deferred, as a flow cannot be
+  // destroyed from one of its own timer callbacks.
+  std::vector<Flow *> expired_flows_{};
+  const Flow::RemovalCallback flow_removal_callback_{
+      [this](Flow *flow) { expired_flows_.push_back(flow); }};
+  // Commands from the control plane (see `ChannelsUpdate()').
+  CommandRing<ChannelCommand> commands_{};
+  // Load counters (see `GetLoadStats()').
+  std::atomic<uint64_t> busy_cycles_{0};
+  std::atomic<uint64_t> rx_packets_{0};
+  std::atomic<uint64_t> tx_packets_{0};
+  // Counters of the stats page only (see `PublishStats()').
+  uint64_t rx_bytes_{0};
+  uint64_t rx_drops_{0};
+  // Packets received with a NIC timestamp (see `RxTimestamp()').
+  uint64_t rx_hw_timestamps_{0};
+  // Memory taken by the flows, as of the last periodic processing, and the
+  // flows compacted since the engine started (see `CompactFlows()').
+  uint64_t flow_memory_bytes_{0};
+  uint64_t flows_compacted_{0};
+  // Clock of the NIC, if it timestamps received packets.
+  std::optional<dpdk::NicClock> nic_clock_{};
+  // RTT samples of the flows of the engine, and their summary over the last
+  // stats interval.
+  LatencyHistogram rtt_histogram_{};
+  LatencyHistogram::Summary rtt_summary_{};
+  // Stages of the messages traced by the engine, if enabled.
+  MessageTracer tracer_;
+  // Where the main loop spends its cycles (see `Run()').
+  CycleAccounting cycles_{};
+  // Stats page of the engine (`nullptr' if it could not be created), and the
+  // time of its last update.
+  std::unique_ptr<stats::StatsPage> stats_page_;
+  // Capture ring of the engine (`nullptr' if disabled, or it could not be
+  // created).
+  std::unique_ptr<capture::PacketCapture> capture_{};
+  // Packets kept by the flows for copy-free retransmissions (none if the
+  // budget is 0).
+  net::flow::RexmitBudget rexmit_budget_;
+  uint64_t last_stats_timestamp_{0};
+  uint64_t last_pool_sample_timestamp_{0};
+  // Channels eligible for zero-copy RX, and the one the RX queue currently
+  // receives into (if any).
+  std::vector<std::shared_ptr<shm::Channel>> rx_zerocopy_channels_{};
+  std::shared_ptr<shm::Channel> rx_zerocopy_channel_{nullptr};
+  // Removed channels with buffers still held by the NIC for zero-copy TX.
+  std::vector<std::shared_ptr<shm::Channel>> tx_zerocopy_draining_{};
+  // List of pending control plane requests, with the TSC of their
+  // submission.
   std::list<std::tuple<uint64_t, MachnetCtrlQueueEntry_t,
                        const std::shared_ptr<shm::Channel>>>
       pending_requests_{};
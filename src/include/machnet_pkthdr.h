@@ -16,23 +16,44 @@ namespace net {
  */
 struct __attribute__((packed)) MachnetPktHdr {
   static constexpr uint16_t kMagic = 0x4e53;
+  // The SACK bitmap covers the `kSackBitmapBits' packets following `ackno'.
+  // This is less than a full window (see `swift::Pcb::kMaxCwnd'): holes
+  // further ahead are only reported (and repaired by RACK) once `ackno' moves
+  // within range of them, or else repaired by the RTO.
+  static constexpr size_t kSackBitmapWords = 4;
+  static constexpr size_t kSackBitmapBits = 64 * kSackBitmapWords;
   be16_t magic;  // Magic value tagged after initialization for the flow.
   enum class MachnetFlags : uint8_t {
     kData = 0b0,
     kSyn = 0b1,         // SYN packet.
     kAck = 0b10,        // ACK packet.
     kSynAck = 0b11,     // SYN-ACK packet.
+    kDataAck = 0b100,   // Data packet carrying a (piggybacked) ACK.
     kRst = 0b10000000,  // RST packet.
   };
   MachnetFlags net_flags;  // Network flags.
   uint8_t msg_flags;       // Field to reflect the `MachnetMsgBuf_t' flags.
   be32_t seqno;  // Sequence number to denote the packet counter in the flow.
   be32_t ackno;  // Sequence number to denote the packet counter in the flow.
-  be64_t sack_bitmap;        // Bitmap of the SACKs received.
-  be16_t sack_bitmap_count;  // Length of the SACK bitmap [0-64].
-  be64_t timestamp1;         // Timestamp of the packet before sending.
+  // Number of out-of-order packets buffered by the receiver.
+  be16_t sack_bitmap_count;
+  // Bitmap of the SACKs received: bit `i % 64' of word `i / 64' is set if
+  // packet `ackno + i' has been received.
+  be64_t sack_bitmap[kSackBitmapWords];
+  be64_t timestamp1;    // Timestamp of the packet before sending.
+  be64_t timestamp2;    // Echo of `timestamp1' of the last data packet received.
+  be32_t remote_delay;  // Time (ns) between receiving that data packet and
+                        // sending this one.
+  // Receive window: number of packets from `ackno' on that the receiver has
+  // room for (channel buffers and ring slots), see `swift::Pcb::rwnd'.
+  be16_t rwnd;
+  // Path the packet was sent on, and that of the data packet whose timestamp
+  // is echoed in `timestamp2' (see `flow::Multipath'); 0 for single-path
+  // flows.
+  uint8_t path;
+  uint8_t echo_path;
 };
-static_assert(sizeof(MachnetPktHdr) == 30, "MachnetPktHdr size mismatch");
+static_assert(sizeof(MachnetPktHdr) == 70, "MachnetPktHdr size mismatch");
 
 inline MachnetPktHdr::MachnetFlags operator|(MachnetPktHdr::MachnetFlags lhs,
                                              MachnetPktHdr::MachnetFlags rhs) {
@@ -0,0 +1,176 @@
+/**
+ * @file message_tracer.h
+ * @brief Sampled tracing of messages through the stack, stage by stage (see
+ * `MessageTracer').
+ */
+#ifndef SRC_INCLUDE_MESSAGE_TRACER_H_
+#define SRC_INCLUDE_MESSAGE_TRACER_H_
+
+#include <channel.h>
+#include <channel_msgbuf.h>
+#include <engine_stats.h>
+#include <latency_histogram.h>
+#include <machnet_common.h>
+#include <ttime.h>
+
+#include <array>
+#include <cstdint>
+
+namespace juggler {
+
+/**
+ * @brief Class `MessageTracer' attributes the latency of messages to the
+ * stages they go through, from the application that sends them to the one
+ * that receives them, on a sample of them (one in every `sample_every' the
+ * engine dequeues), for tail latency to be pinned on queueing in the rings of
+ * the channels, in the engines, or on the wire.
+ *
+ * A traced message is marked with `MACHNET_MSGBUF_FLAGS_TRACE' in its first
+ * buffer, which its first packet carries over to the receiver (in
+ * `MachnetPktHdr::msg_flags'), and carries the TSC stamp of the last stage it
+ * went through (see `MachnetMsgBuf::trace_tsc'). Each stage records the time
+ * since the previous one, and stamps the message anew:
+ *
+ * - `kAppRing': from `machnet_sendmsg()' to the dequeue by the engine (i.e.,
+ *   queueing in the ring from the application). Inline messages are not
+ *   stamped by the application, and skip this stage.
+ * - `kEngineTx': from the dequeue to the first transmission of the first
+ *   packet of the message (e.g., behind the congestion window).
+ * - `kWire': from that transmission (see `MachnetPktHdr::timestamp1') to the
+ *   reception of the packet at the other end (by its NIC, with NIC
+ *   timestamps, or else by its engine; see `Flow::InputPacket()'). Each end
+ *   tells the time by its own TSC, so this is only meaningful if they share
+ *   one (e.g., engines on the same host, as in `apps/loopback_perf').
+ * - `kReassembly': from the processing of the first packet by the engine to
+ *   the delivery of the message to the application (i.e., waiting for the
+ *   rest of the message, or for the messages before it).
+ * - `kAppDequeue': from the delivery to the dequeue by the application (i.e.,
+ *   queueing in the ring to the application). The application accounts these
+ *   itself, in power-of-two buckets of its channel (see
+ *   `MachnetChannelTraceCtx'), for the engine to collect (see
+ *   `CollectAppDequeues()').
+ *
+ * The stamps are the low 32 bits of the TSC: stages that take longer than
+ * their wraparound (about a second) are misattributed.
+ *
+ * @attention This class is not thread-safe: it belongs to an engine.
+ */
+class MessageTracer {
+ public:
+  enum Stage : size_t {
+    kAppRing = 0,
+    kEngineTx,
+    kWire,
+    kReassembly,
+    kAppDequeue,
+    kNumStages,
+  };
+  // The stages are published in this order (see `stats::TraceStats').
+  static_assert(kNumStages == stats::TraceStats::kNumStages);
+
+  /**
+   * @param sample_every Trace one in every `sample_every' messages dequeued;
+   *                     0 disables tracing.
+   */
+  explicit MessageTracer(uint32_t sample_every = 0)
+      : sample_every_(sample_every) {}
+  MessageTracer(const MessageTracer &) = delete;
+  MessageTracer &operator=(const MessageTracer &) = delete;
+
+  bool enabled() const { return sample_every_ != 0; }
+  uint32_t sample_every() const { return sample_every_; }
+
+  // Stamp of a TSC value, as carried by traced messages (never 0).
+  static uint32_t Stamp(uint64_t tsc) { return static_cast<uint32_t>(tsc) | 1; }
+
+  // Nanoseconds from a stamp to a later TSC value.
+  static uint64_t ElapsedNs(uint32_t stamp, uint64_t tsc) {
+    return time::cycles_to_ns(static_cast<uint32_t>(Stamp(tsc) - stamp));
+  }
+
+  /**
+   * @brief A message was dequeued from an application (`now' is the TSC):
+   * sample it.
+   * @param msg First buffer of the message.
+   */
+  void OnDequeue(shm::MsgBuf *msg, uint64_t now) {
+    if (++dequeued_ < sample_every_) return;
+    dequeued_ = 0;
+    if (msg->trace_tsc() != 0) {
+      Record(kAppRing, ElapsedNs(msg->trace_tsc(), now));
+    }
+    msg->set_trace_tsc(Stamp(now));
+    msg->add_flags(MACHNET_MSGBUF_FLAGS_TRACE);
+  }
+
+  /**
+   * @brief A packet of a traced message is being transmitted, at `now' (the
+   * TSC). Only the first transmission of the first packet counts.
+   */
+  void OnTransmit(shm::MsgBuf *msg_buf, uint64_t now) {
+    if (msg_buf->trace_tsc() == 0) return;
+    Record(kEngineTx, ElapsedNs(msg_buf->trace_tsc(), now));
+    msg_buf->set_trace_tsc(0);
+  }
+
+  /**
+   * @brief The first packet of a traced message, sent at `tx_ns', was
+   * received at `rx_ns' (each on the TSC time base of its end, in
+   * nanoseconds), and is being processed at `now' (the TSC).
+   * @param msgbuf The buffer of the packet.
+   */
+  void OnReceive(shm::MsgBuf *msgbuf, uint64_t tx_ns, uint64_t rx_ns,
+                 uint64_t now) {
+    if (rx_ns > tx_ns) Record(kWire, rx_ns - tx_ns);
+    msgbuf->set_trace_tsc(Stamp(now));
+  }
+
+  // A traced message was delivered to the application, at `now' (the TSC).
+  void OnDeliver(shm::MsgBuf *msg, uint64_t now) {
+    if (msg->trace_tsc() == 0) return;
+    Record(kReassembly, ElapsedNs(msg->trace_tsc(), now));
+    msg->set_trace_tsc(Stamp(now));
+  }
+
+  /**
+   * @brief Collect the dequeue delays of the traced messages the application
+   * of a channel received (see `MachnetChannelTraceCtx'); each counts as the
+   * middle of its bucket.
+   */
+  void CollectAppDequeues(shm::Channel *channel) {
+    for (size_t bucket = 0; bucket < MACHNET_TRACE_BUCKETS; bucket++) {
+      const auto count = channel->TakeTraceDequeueCount(bucket);
+      if (count == 0) continue;
+      const uint64_t cycles = (3ULL << bucket) / 2;
+      histograms_[kAppDequeue].Record(time::cycles_to_ns(cycles), count);
+    }
+  }
+
+  /**
+   * @brief Summarize the stages over the samples recorded since the last
+   * call (see `GetSummary()'), and start over.
+   */
+  void Summarize() {
+    for (size_t stage = 0; stage < kNumStages; stage++) {
+      summaries_[stage] = histograms_[stage].GetSummary();
+      histograms_[stage].Reset();
+    }
+  }
+
+  const LatencyHistogram::Summary &GetSummary(Stage stage) const {
+    return summaries_[stage];
+  }
+
+ private:
+  void Record(Stage stage, uint64_t ns) { histograms_[stage].Record(ns); }
+
+  const uint32_t sample_every_;
+  // Messages dequeued since the last one sampled.
+  uint32_t dequeued_{0};
+  std::array<LatencyHistogram, kNumStages> histograms_{};
+  std::array<LatencyHistogram::Summary, kNumStages> summaries_{};
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_MESSAGE_TRACER_H_
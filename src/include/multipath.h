@@ -0,0 +1,182 @@
+/**
+ * @file multipath.h
+ * @brief Spreading the packets of a flow over several network paths, each with
+ * its own congestion state.
+ */
+#ifndef SRC_INCLUDE_MULTIPATH_H_
+#define SRC_INCLUDE_MULTIPATH_H_
+
+#include <cc.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+namespace juggler {
+namespace net {
+namespace flow {
+
+/**
+ * @brief Class `Multipath' spreads the data packets of a flow over up to
+ * `kMaxPaths' network paths, e.g., the ECMP paths of a fabric between two
+ * hosts. The packets of path `p' (see `MachnetPktHdr::path') carry the source
+ * UDP port of the flow with the bits of `p' flipped (see `PathPort()'), for
+ * the switches to hash them to different paths; the receiver flips them back
+ * to find the flow, so all the paths share the same sequence space, SACKs and
+ * reassembly buffer.
+ *
+ * Each path has its own Swift window and delay estimates (in a `swift::Pcb',
+ * of which only the congestion control state is used), fed by the RTT samples
+ * and the losses of the packets it carried. The flow keeps its single-path
+ * `swift::Pcb' for reliability (sequence numbers, retransmissions, RTO and
+ * receive window). New packets go to the path with the most room left.
+ *
+ * @attention All the paths of a flow must reach the same engine at the
+ * receiver, e.g., an interface running a single engine.
+ */
+class Multipath {
+ public:
+  static constexpr uint8_t kMaxPaths = 4;
+  // The path index is folded into these bits of the source UDP port.
+  static constexpr uint16_t kPortShift = 14;
+  static_assert((kMaxPaths - 1) << kPortShift <= UINT16_MAX);
+  // Marks the packets of the window that are not in flight on any path.
+  static constexpr uint8_t kNoPath = UINT8_MAX;
+
+  /**
+   * @return The source UDP port of path `path' of a flow with source port
+   * `port'; also maps it back.
+   */
+  static constexpr uint16_t PathPort(uint16_t port, uint8_t path) {
+    return port ^ static_cast<uint16_t>(path << kPortShift);
+  }
+
+  explicit Multipath(uint8_t num_paths) : num_paths_(num_paths) {
+    CHECK_GT(num_paths, 1);
+    CHECK_LE(num_paths, kMaxPaths);
+    path_of_.fill(kNoPath);
+  }
+
+  uint8_t num_paths() const { return num_paths_; }
+  // Congestion control state of a path.
+  const swift::Pcb &path(uint8_t p) const { return paths_[p]; }
+  // Number of packets in flight on a path.
+  uint32_t inflight(uint8_t p) const { return inflight_[p]; }
+
+  /**
+   * @return Number of packets the windows of the paths, together, let the flow
+   * send right now. As with a single path, a window below one packet still
+   * lets one packet out (but paths are not paced).
+   */
+  uint32_t effective_wnd() const {
+    uint32_t wnd = 0;
+    for (uint8_t p = 0; p < num_paths_; p++) wnd += Room(p);
+    return wnd;
+  }
+
+  /**
+   * @return The inter-packet gap to send the windows of all the paths over an
+   * RTT of `srtt_ns' (see `swift::Pcb::pacing_delay_ns()').
+   */
+  uint64_t pacing_delay_ns(uint64_t srtt_ns) const {
+    const auto rtt_ns = srtt_ns == 0 ? swift::Pcb::kInitialRttNs : srtt_ns;
+    double cwnd = 0;
+    for (uint8_t p = 0; p < num_paths_; p++) cwnd += paths_[p].cwnd;
+    return static_cast<uint64_t>(rtt_ns / cwnd);
+  }
+
+  /**
+   * @return The path with the most room left in its window (the least loaded
+   * one if all are full), for the next packet.
+   */
+  uint8_t PickPath() const {
+    uint8_t best = 0;
+    int64_t best_room = Slack(0);
+    for (uint8_t p = 1; p < num_paths_; p++) {
+      const int64_t room = Slack(p);
+      if (room > best_room) {
+        best = p;
+        best_room = room;
+      }
+    }
+    return best;
+  }
+
+  /**
+   * @brief Account for packet `seqno' sent on path `p'. A retransmitted packet
+   * moves from the path it was in flight on.
+   */
+  void OnSend(uint32_t seqno, uint8_t p) {
+    DCHECK_LT(p, num_paths_);
+    auto &path = path_of_[seqno % path_of_.size()];
+    if (path != kNoPath) inflight_[path]--;
+    path = p;
+    inflight_[p]++;
+  }
+
+  /**
+   * @brief Account for the cumulative ACK of the packets from `snd_una' up to
+   * `ackno' (excluded), and update the windows of the paths that carried them.
+   *
+   * @param rtt_ns          RTT sample of the ACK (0 if none), taken on path
+   *                        `echo_path'.
+   * @param remote_delay_ns Endpoint delay reported by the receiver for the
+   *                        sampled packet.
+   */
+  void OnAck(uint64_t now_ns, uint32_t snd_una, uint32_t ackno,
+             uint64_t rtt_ns, uint64_t remote_delay_ns, uint8_t echo_path) {
+    std::array<uint32_t, kMaxPaths> acked{};
+    for (uint32_t seqno = snd_una; seqno != ackno; seqno++) {
+      auto &path = path_of_[seqno % path_of_.size()];
+      if (path == kNoPath) continue;
+      inflight_[path]--;
+      acked[path]++;
+      path = kNoPath;
+    }
+    for (uint8_t p = 0; p < num_paths_; p++) {
+      const bool sampled = p == echo_path && rtt_ns != 0;
+      if (acked[p] == 0 && !sampled) continue;
+      paths_[p].OnAck(now_ns, acked[p], sampled ? rtt_ns : 0,
+                      remote_delay_ns);
+    }
+  }
+
+  /**
+   * @brief Back off the window of the path that packet `seqno' was lost on.
+   * @param rto Whether the loss was detected by a retransmission timeout.
+   */
+  void OnLoss(uint32_t seqno, uint64_t now_ns, bool rto) {
+    const auto p = path_of_[seqno % path_of_.size()];
+    if (p == kNoPath) return;
+    if (rto) {
+      paths_[p].OnRto(now_ns);
+    } else {
+      paths_[p].OnFastRetransmit(now_ns);
+    }
+  }
+
+ private:
+  // Window of a path, in whole packets (at least one).
+  uint32_t Window(uint8_t p) const {
+    return std::max(static_cast<uint32_t>(paths_[p].cwnd), 1u);
+  }
+  uint32_t Room(uint8_t p) const {
+    return inflight_[p] >= Window(p) ? 0 : Window(p) - inflight_[p];
+  }
+  int64_t Slack(uint8_t p) const {
+    return static_cast<int64_t>(Window(p)) - inflight_[p];
+  }
+
+  const uint8_t num_paths_;
+  std::array<swift::Pcb, kMaxPaths> paths_{};
+  std::array<uint32_t, kMaxPaths> inflight_{};
+  // Path each packet of the window is in flight on, by sequence number.
+  std::array<uint8_t, swift::Pcb::kReassemblyWindow> path_of_;
+};
+
+}  // namespace flow
+}  // namespace net
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_MULTIPATH_H_
@@ -0,0 +1,220 @@
+/**
+ * @file neighbor_table.h
+ * @brief The table of the L2 addresses of the neighbors of an interface,
+ * resolved and refreshed with ARP.
+ */
+#ifndef SRC_INCLUDE_NEIGHBOR_TABLE_H_
+#define SRC_INCLUDE_NEIGHBOR_TABLE_H_
+
+#include <ether.h>
+#include <glog/logging.h>
+#include <ipv4.h>
+#include <rcu.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace juggler {
+
+/**
+ * @brief Class `NeighborTable' keeps the L2 addresses of the neighbors of an
+ * interface, shared by its engines. It only decides what to resolve, and when;
+ * the callers send the ARP requests, and feed back the replies (see
+ * `MachnetEngineSharedState').
+ *
+ * The table is a read-mostly snapshot (see `RcuValue'): each engine looks
+ * addresses up in its own `Reader', without locks. Addresses are resolved on
+ * the first lookup that misses (see `Resolve()'), or ahead of time for the
+ * neighbors added with `AddNeighbor()'. In the background (see `Maintain()'),
+ * unresolved addresses are requested again, and resolved ones are refreshed
+ * once older than `kRefreshNs', so that lookups keep hitting: only an address
+ * that goes unconfirmed for `kLifetimeNs' (e.g., of a host gone) expires,
+ * unless it was added with `AddNeighbor()' (such neighbors are resolved for as
+ * long as the table lives, with the last known address kept meanwhile).
+ */
+class NeighborTable {
+ public:
+  using Ethernet = net::Ethernet;
+  using Ipv4 = net::Ipv4;
+
+  struct Entry {
+    // The L2 address, or `std::nullopt' while it is being resolved.
+    std::optional<Ethernet::Address> l2addr;
+    // The local address to send ARP requests from.
+    Ipv4::Address local_ip;
+    // When the address was last confirmed (or first requested, while being
+    // resolved).
+    uint64_t updated_ns;
+    // Whether the neighbor was added with `AddNeighbor()'.
+    bool pinned;
+  };
+  using Table = std::unordered_map<Ipv4::Address, Entry>;
+  using Reader = RcuValue<Table>::Reader;
+
+  // Interval of the background maintenance (see `Maintain()'); unresolved
+  // addresses are requested again at this rate.
+  static constexpr uint64_t kMaintenanceIntervalNs = 1000000000;  // 1s
+  // Age of the addresses that are refreshed, and of the ones that expire.
+  static constexpr uint64_t kRefreshNs = 30 * kMaintenanceIntervalNs;
+  static constexpr uint64_t kLifetimeNs = 2 * kRefreshNs;
+  // How long resolving an address is tried for, before giving up on it.
+  static constexpr uint64_t kResolveTimeoutNs = 3 * kMaintenanceIntervalNs;
+
+  NeighborTable() = default;
+  NeighborTable(const NeighborTable &) = delete;
+  NeighborTable &operator=(const NeighborTable &) = delete;
+
+  // A reader of the table, for the calling thread.
+  std::unique_ptr<Reader> NewReader() {
+    return std::make_unique<Reader>(&table_);
+  }
+
+  /**
+   * @return The L2 address of `ip', or `std::nullopt' if it is not resolved
+   * (see `Resolve()').
+   */
+  static std::optional<Ethernet::Address> Lookup(Reader *reader,
+                                                 const Ipv4::Address &ip) {
+    const auto &table = reader->Get();
+    const auto it = table.find(ip);
+    if (it == table.end()) return std::nullopt;
+    return it->second.l2addr;
+  }
+
+  /**
+   * @brief Start resolving `ip', if it is not in the table yet.
+   *
+   * @param reader   The reader of the calling thread.
+   * @param local_ip The local address to send the ARP requests from.
+   * @return Whether the caller should send an ARP request for `ip' right
+   * away; the next ones, if any, are left to `Maintain()'.
+   */
+  bool Resolve(Reader *reader, const Ipv4::Address &local_ip,
+               const Ipv4::Address &ip, uint64_t now_ns) {
+    if (reader->Get().contains(ip)) return false;
+    // If another thread is updating the table, the entry is added on the next
+    // lookup instead; the request goes out regardless.
+    table_.TryUpdate([&](Table &table) {
+      return table.try_emplace(ip, Entry{std::nullopt, local_ip, now_ns, false})
+          .second;
+    });
+    return true;
+  }
+
+  /**
+   * @brief Add a neighbor to resolve ahead of time, and to keep resolved (see
+   * `NeighborTable'). Blocks while another thread updates the table, so not
+   * for the datapath.
+   *
+   * @return Whether the neighbor was not in the table yet: the caller may then
+   * send an ARP request for it right away, rather than leave the first one to
+   * `Maintain()'.
+   */
+  bool AddNeighbor(const Ipv4::Address &local_ip, const Ipv4::Address &ip,
+                   uint64_t now_ns) {
+    bool added = false;
+    table_.Update([&](Table &table) {
+      auto [it, inserted] =
+          table.try_emplace(ip, Entry{std::nullopt, local_ip, now_ns, true});
+      added = inserted;
+      if (!inserted && it->second.pinned) return false;
+      it->second.pinned = true;
+      return true;
+    });
+    return added;
+  }
+
+  /**
+   * @brief Learn (or confirm) the L2 address of `ip' from an ARP reply.
+   *
+   * @param local_ip The local address the reply was sent to.
+   * @return False if the address was dropped, as another thread was updating
+   * the table (as if the reply had been lost).
+   */
+  bool Learn(Reader *reader, const Ipv4::Address &local_ip,
+             const Ipv4::Address &ip, const Ethernet::Address &l2addr,
+             uint64_t now_ns) {
+    // Confirmations of addresses that are not due for a refresh change
+    // nothing worth a new version of the table.
+    const auto &current = reader->Get();
+    const auto it = current.find(ip);
+    if (it != current.end() && it->second.l2addr == l2addr &&
+        now_ns - it->second.updated_ns < kRefreshNs) {
+      return true;
+    }
+
+    return table_.TryUpdate([&](Table &table) {
+      auto [entry, inserted] =
+          table.try_emplace(ip, Entry{l2addr, local_ip, now_ns, false});
+      if (!inserted) {
+        entry->second.l2addr = l2addr;
+        entry->second.updated_ns = now_ns;
+      }
+      return true;
+    });
+  }
+
+  /**
+   * @brief Background maintenance of the table, about once per
+   * `kMaintenanceIntervalNs' whichever threads call it (e.g., every engine,
+   * periodically; give or take a tenth, for their jitter): expire the
+   * addresses that are stale, and request the ones that are unresolved or due
+   * for a refresh.
+   *
+   * @param reader  The reader of the calling thread.
+   * @param request Called with the local address to request from, and the
+   *                address to resolve, for each ARP request to send.
+   * @return Whether maintenance was due, and done by this call.
+   */
+  template <typename F>
+  bool Maintain(Reader *reader, uint64_t now_ns, F &&request) {
+    auto due_ns = next_maintenance_ns_.load(std::memory_order_relaxed);
+    if (now_ns < due_ns) return false;
+    if (!next_maintenance_ns_.compare_exchange_strong(
+            due_ns, now_ns + kMaintenanceIntervalNs * 9 / 10,
+            std::memory_order_relaxed)) {
+      return false;
+    }
+
+    std::vector<Ipv4::Address> expired;
+    for (const auto &[ip, entry] : reader->Get()) {
+      const auto age_ns =
+          now_ns > entry.updated_ns ? now_ns - entry.updated_ns : 0;
+      if (!entry.l2addr.has_value()) {
+        if (!entry.pinned && age_ns >= kResolveTimeoutNs) {
+          LOG(WARNING) << "Failed to resolve " << ip.ToString();
+          expired.push_back(ip);
+          continue;
+        }
+      } else if (age_ns < kRefreshNs) {
+        continue;
+      } else if (!entry.pinned && age_ns >= kLifetimeNs) {
+        expired.push_back(ip);
+        continue;
+      }
+      request(entry.local_ip, ip);
+    }
+
+    // Expire the stale addresses on the next maintenance, if another thread
+    // is updating the table.
+    if (!expired.empty()) {
+      table_.TryUpdate([&](Table &table) {
+        for (const auto &ip : expired) table.erase(ip);
+        return true;
+      });
+    }
+    return true;
+  }
+
+ private:
+  RcuValue<Table> table_{};
+  std::atomic<uint64_t> next_maintenance_ns_{0};
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_NEIGHBOR_TABLE_H_
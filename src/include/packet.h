@@ -6,6 +6,8 @@
 #include <glog/logging.h>
 #include <ipv4.h>
 #include <rte_mbuf.h>
+#include <rte_mbuf_dyn.h>
+#include <rte_prefetch.h>
 #include <utils.h>
 #include <x86intrin.h>
 
@@ -32,6 +34,19 @@ class alignas(juggler::hardware_constructive_interference_size) Packet {
    */
   static void Free(Packet *pkt) { rte_pktmbuf_free(&pkt->mbuf_); }
 
+  /**
+   * @brief Take a reference to the packet (e.g., to keep it after handing it
+   * to the NIC); `Free()' drops one, and returns the packet to its mempool
+   * with the last one.
+   */
+  void Ref() { rte_mbuf_refcnt_update(&mbuf_, 1); }
+
+  /**
+   * @return The number of references to the packet (1 once the NIC is done
+   * with a packet that was kept with `Ref()').
+   */
+  uint16_t refcnt() const { return rte_mbuf_refcnt_read(&mbuf_); }
+
   /**
    * @brief Resets the packet to its initial state.
    * @param pkt Packet to be reset.
@@ -81,17 +96,85 @@ class alignas(juggler::hardware_constructive_interference_size) Packet {
         static_cast<const Packet &>(*this).head_data<T>(offset));
   }
 
+  /**
+   * @brief Prefetches the first `len' bytes of packet data (e.g., the
+   * protocol headers) into all levels of the cache hierarchy.
+   */
+  void prefetch_head(uint16_t len) const {
+    const auto *data = head_data<const uint8_t *>();
+    for (uint16_t ofs = 0; ofs < len;
+         ofs += juggler::hardware_constructive_interference_size) {
+      rte_prefetch0(data + ofs);
+    }
+  }
+
   /**
    * @return Length of the packet.
    */
   uint16_t length() const { return rte_pktmbuf_pkt_len(&mbuf_); }
 
+  /**
+   * @return Length of the data in this segment of the packet (equal to
+   * `length()' for single-segment packets).
+   */
+  uint16_t segment_length() const { return mbuf_.data_len; }
+
+  /**
+   * @return The next segment of a multi-segment packet (e.g., received with
+   * buffer split), or nullptr if this is the last one.
+   */
+  Packet *next_segment() const {
+    return reinterpret_cast<Packet *>(mbuf_.next);
+  }
+
+  /**
+   * @return Whether this packet was allocated from the given mempool.
+   */
+  bool from_pool(const rte_mempool *mp) const { return mbuf_.pool == mp; }
+
+  /**
+   * @return Start address of the buffer of this segment.
+   */
+  template <typename T = void *>
+  T buf_addr() const {
+    return reinterpret_cast<T>(mbuf_.buf_addr);
+  }
+
+  /**
+   * @brief Copy `len' bytes of packet data, starting at `offset', to `dst'.
+   * The data may span multiple segments.
+   * @param nontemporal Whether to write `dst' with non-temporal stores (see
+   *                    `utils::CopyNonTemporal()'); single-segment data only.
+   */
+  void CopyOut(void *dst, uint32_t offset, uint32_t len,
+               bool nontemporal = false) const {
+    const auto *src = rte_pktmbuf_read(&mbuf_, offset, len, dst);
+    if (src == dst) return;
+    if (nontemporal) {
+      juggler::utils::CopyNonTemporal(dst, src, len);
+    } else {
+      juggler::utils::Copy(dst, src, len);
+    }
+  }
+
   /**
    * @return RSS hash value associated with the packet.
    * @note This is valid only if the DPDK PMD was initialized with RSS enabled.
    */
   uint32_t rss_hash() const { return mbuf_.hash.rss; }
 
+  /**
+   * @return The NIC timestamp of a received packet, in NIC clock ticks, or 0
+   * if it has none.
+   * @param offset Offset of the timestamp dynamic field of the mbufs.
+   * @param flag   Flag set in the mbufs that carry a timestamp.
+   * @note See `PmdPort::EnableRxTimestamps()'.
+   */
+  uint64_t rx_timestamp(int offset, uint64_t flag) const {
+    if (!(mbuf_.ol_flags & flag)) return 0;
+    return *RTE_MBUF_DYNFIELD(&mbuf_, offset, const rte_mbuf_timestamp_t *);
+  }
+
   // Setters.
   void set_l2_len(uint16_t length) { mbuf_.l2_len = length; }
   void set_l3_len(uint16_t length) { mbuf_.l3_len = length; }
@@ -122,6 +205,18 @@ class alignas(juggler::hardware_constructive_interference_size) Packet {
     rte_mbuf_refcnt_set(&mbuf_, 1);
   }
 
+  /**
+   * @brief Replace the pinned external buffer of this packet (see
+   * `RTE_PKTMBUF_POOL_F_PINNED_EXT_BUF'). The buffer must have the same
+   * length as the one it replaces.
+   * @param buf_va External buffer virtual address (VA).
+   * @param buf_iova External buffer IO address (IOVA).
+   */
+  void replace_pinned_extbuf(void *buf_va, uint64_t buf_iova) {
+    mbuf_.buf_addr = buf_va;
+    mbuf_.buf_iova = buf_iova;
+  }
+
   /**
    * @brief Append len bytes to this packet and return a pointer to the start
    * address of the appended data.
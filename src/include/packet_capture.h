@@ -0,0 +1,194 @@
+/**
+ * @file packet_capture.h
+ * @brief Built-in packet capture of the engines: the headers of the packets
+ * they receive and send are copied to a ring in shared memory, for an external
+ * tool to drain (see `apps/machnet_capture').
+ */
+#ifndef SRC_INCLUDE_PACKET_CAPTURE_H_
+#define SRC_INCLUDE_PACKET_CAPTURE_H_
+
+#include <capture_ring.h>
+#include <glog/logging.h>
+#include <packet.h>
+#include <ttime.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+namespace juggler {
+namespace capture {
+
+/**
+ * @brief Class `PacketCapture' is the writer side of a capture ring, owned by
+ * an engine. The ring is idle until a capture tool sets a filter (see
+ * `RingReader::Start()'): the engine then copies the first `Record::kSnapLen'
+ * bytes of the matching packets, received and sent, to the ring. Capture
+ * never slows down the engine for long:
+ *
+ * - While idle, it costs a load from shared memory per iteration of the
+ *   engine (see `BeginIteration()'), and a branch per packet.
+ * - At most `Filter::budget' packets are captured per iteration.
+ * - The engine never waits for the tool: packets are dropped if the ring is
+ *   full (see `RingHeader::drops').
+ *
+ * @attention This class is not thread-safe: the ring has a single writer.
+ */
+class PacketCapture {
+ public:
+  // Default, and maximum, budget of an iteration.
+  static constexpr uint32_t kDefaultBudget = 32;
+  static constexpr uint32_t kMaxBudget = 256;
+
+  /**
+   * @brief Create the capture ring of an engine.
+   * @param nb_records Number of records of the ring (a power of two).
+   * @return The ring, or `nullptr' on failure.
+   */
+  static std::unique_ptr<PacketCapture> Create(
+      const std::string &name, uint32_t nb_records = kDefaultRecords) {
+    CHECK(utils::is_power_of_two(nb_records)) << nb_records;
+    auto memory = RingMemory::Map(name, RingSize(nb_records), true);
+    if (memory == nullptr) {
+      LOG(WARNING) << "Failed to create capture ring " << name;
+      return nullptr;
+    }
+    auto *header = static_cast<RingHeader *>(memory->mem());
+    std::memset(header, 0, sizeof(*header));
+    header->magic = kRingMagic;
+    header->version = kRingVersion;
+    header->nb_records = nb_records;
+    header->record_size = sizeof(Record);
+    header->tsc_hz = time::tsc_hz;
+    return std::unique_ptr<PacketCapture>(
+        new PacketCapture(std::move(memory)));
+  }
+
+  PacketCapture(const PacketCapture &) = delete;
+  PacketCapture &operator=(const PacketCapture &) = delete;
+
+  /**
+   * @brief An iteration of the engine starts: pick up a new filter, if the
+   * capture tool set one, and reset the budget.
+   */
+  void BeginIteration() {
+    const auto generation = std::atomic_ref<uint32_t>(header_->generation)
+                                .load(std::memory_order_acquire);
+    if (generation != generation_) [[unlikely]] {  // NOLINT
+      Refresh(generation);
+    }  // NOLINT
+    budget_ = filter_.budget;
+  }
+
+  // Whether a capture is on.
+  bool active() const { return generation_ != 0; }
+
+  /**
+   * @brief Capture a packet, if a capture is on and the packet matches its
+   * filter.
+   */
+  void Capture(const dpdk::Packet *pkt, Direction direction) {
+    if (!active()) return;
+    Capture(pkt->head_data<const uint8_t *>(), pkt->segment_length(),
+            pkt->length(), direction);
+  }
+
+  /**
+   * @brief Capture the first `len' bytes of a packet of `orig_len' bytes.
+   */
+  void Capture(const uint8_t *data, uint16_t len, uint16_t orig_len,
+               Direction direction) {
+    if (!active() || (filter_.directions & direction) == 0) return;
+    if (!Match(filter_, data, len)) return;
+    if (++matched_ < filter_.sample_every) return;
+    matched_ = 0;
+    if (budget_ == 0) {
+      Count(&header_->skipped);
+      return;
+    }
+    budget_--;
+
+    const auto tail = std::atomic_ref<uint64_t>(header_->tail)
+                          .load(std::memory_order_acquire);
+    if (head_ - tail == nb_records_) {
+      Count(&header_->drops);
+      return;
+    }
+    auto *record = &records_[head_ & (nb_records_ - 1)];
+    record->tsc = time::rdtsc();
+    record->orig_len = orig_len;
+    record->cap_len = std::min(len, Record::kSnapLen);
+    record->direction = direction;
+    std::memcpy(record->data, data, record->cap_len);
+    head_++;
+    std::atomic_ref<uint64_t>(header_->head)
+        .store(head_, std::memory_order_release);
+    Count(&header_->captured);
+  }
+
+  bool hugepages() const { return memory_->hugepages(); }
+
+ private:
+  explicit PacketCapture(std::unique_ptr<RingMemory> memory)
+      : memory_(std::move(memory)),
+        header_(static_cast<RingHeader *>(memory_->mem())),
+        records_(reinterpret_cast<Record *>(header_ + 1)),
+        nb_records_(header_->nb_records) {}
+
+  // Single writer, so no atomic read-modify-write is needed.
+  static void Count(uint64_t *counter) {
+    std::atomic_ref<uint64_t> c(*counter);
+    c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  // Take the filter of a new generation (0: the capture stopped).
+  void Refresh(uint32_t generation) {
+    Filter filter;
+    std::memcpy(&filter, &header_->filter, sizeof(filter));
+    // The tool clears the generation before changing the filter: if it did,
+    // the copy may be torn; try again on the next iteration.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (std::atomic_ref<uint32_t>(header_->generation)
+            .load(std::memory_order_relaxed) != generation) {
+      return;
+    }
+    generation_ = generation;
+    if (generation == 0) return;
+    filter_ = filter;
+    filter_.sample_every = std::max(1u, filter_.sample_every);
+    filter_.budget = std::min(
+        filter_.budget == 0 ? kDefaultBudget : filter_.budget, kMaxBudget);
+    if (filter_.directions == 0) filter_.directions = kRx | kTx;
+    matched_ = 0;
+    header_->tsc_hz = time::tsc_hz;
+    header_->anchor_tsc = time::rdtsc();
+    header_->anchor_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    LOG(INFO) << "Packet capture started (generation " << generation << ")";
+  }
+
+  const std::unique_ptr<RingMemory> memory_;
+  RingHeader *const header_;
+  Record *const records_;
+  const uint32_t nb_records_;
+  // The filter in use, and its generation (0 while there is no capture).
+  Filter filter_{};
+  uint32_t generation_{0};
+  // Budget left in the iteration, and matching packets since the last one
+  // captured.
+  uint32_t budget_{0};
+  uint32_t matched_{0};
+  uint64_t head_{0};
+};
+
+}  // namespace capture
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_PACKET_CAPTURE_H_
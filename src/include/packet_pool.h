@@ -7,7 +7,9 @@
 #include <rte_errno.h>
 #include <rte_mbuf.h>
 #include <rte_mbuf_core.h>
+#include <rte_memory.h>
 
+#include <algorithm>
 #include <cstdint>
 
 namespace juggler {
@@ -39,10 +41,29 @@ class PacketPool {
    * @param nmbufs Number of mbufs.
    * @param mbuf_size Size of each mbuf.
    * @param mempool_name Name of the mempool.
+   * @param socket_id NUMA socket to allocate the mempool on, e.g., the one of
+   * the NIC that DMAs to it; `SOCKET_ID_ANY' for the caller's socket.
    */
   PacketPool(uint32_t nmbufs = kRteDefaultMbufsNum_,
              uint16_t mbuf_size = kRteDefaultMbufDataSz_,
-             const char *mempool_name = kRteDefaultMempoolName);
+             const char *mempool_name = kRteDefaultMempoolName,
+             int socket_id = SOCKET_ID_ANY);
+
+  /**
+   * @brief Initializes a packet pool of mbufs with pinned external buffers
+   * (see `RTE_PKTMBUF_POOL_F_PINNED_EXT_BUF'), e.g., buffers of a shared memory
+   * channel that are registered for DMA. The pool does not allocate any data
+   * buffers itself; `obj_init' is called on each mbuf to initialize it and
+   * attach its buffer.
+   * @param nmbufs Number of mbufs.
+   * @param buf_size Size of each external buffer (i.e., the data room).
+   * @param obj_init Callback to initialize each mbuf.
+   * @param obj_init_arg Opaque argument passed to `obj_init'.
+   * @param socket_id NUMA socket to allocate the mbufs on; `SOCKET_ID_ANY'
+   * for the caller's socket.
+   */
+  PacketPool(uint32_t nmbufs, uint16_t buf_size, rte_mempool_obj_cb_t *obj_init,
+             void *obj_init_arg, int socket_id = SOCKET_ID_ANY);
   ~PacketPool();
 
   /**
@@ -67,7 +88,10 @@ class PacketPool {
    * @return Pointer to the allocated packet.
    */
   Packet *PacketAlloc() {
-    return reinterpret_cast<Packet *>(rte_pktmbuf_alloc(mpool_));
+    auto *packet = reinterpret_cast<Packet *>(rte_pktmbuf_alloc(mpool_));
+    if (packet == nullptr) [[unlikely]]
+      alloc_failures_++;
+    return packet;
   }
 
   /**
@@ -81,6 +105,7 @@ class PacketPool {
         mpool_, reinterpret_cast<struct rte_mbuf **>(pkts), cnt);
     if (ret == 0) [[likely]]
       return true;
+    alloc_failures_++;
     return false;
   }
 
@@ -94,8 +119,10 @@ class PacketPool {
     (void)DCHECK_NOTNULL(batch);
     int ret = rte_pktmbuf_alloc_bulk(
         mpool_, reinterpret_cast<struct rte_mbuf **>(batch->pkts()), cnt);
-    if (ret != 0) [[unlikely]]
+    if (ret != 0) [[unlikely]] {  // NOLINT
+      alloc_failures_++;
       return false;
+    }
 
     batch->IncrCount(cnt);
     return true;
@@ -111,12 +138,35 @@ class PacketPool {
    */
   uint32_t AvailPacketsCount() { return rte_mempool_avail_count(mpool_); }
 
+  /**
+   * @brief Sample the count of available packets, for the low watermark of
+   * the pool (see `GetMinAvailPacketsCount()'), e.g., periodically.
+   */
+  void SampleWatermark() {
+    min_avail_ = std::min(min_avail_, AvailPacketsCount());
+  }
+
+  /**
+   * @return The fewest packets sampled available in the pool (see
+   * `SampleWatermark()'), or the capacity if none was sampled yet.
+   */
+  uint32_t GetMinAvailPacketsCount() {
+    return std::min(min_avail_, Capacity());
+  }
+
+  /**
+   * @return The count of allocations that failed for lack of packets.
+   */
+  uint64_t GetAllocFailureCount() const { return alloc_failures_; }
+
  private:
   const bool
       is_dpdk_primary_process_;  //!< Indicates if it's a DPDK primary process.
   static uint16_t next_id_;  //!< Static ID for the next packet pool instance.
   rte_mempool *mpool_;       //!< Underlying rte mbuf pool.
   uint16_t id_;              //!< Unique ID for this packet pool instance.
+  uint32_t min_avail_{UINT32_MAX};  //!< Low watermark of available packets.
+  uint64_t alloc_failures_{0};      //!< Allocations that failed.
 };
 
 }  // namespace dpdk
@@ -4,8 +4,12 @@
 #include <glog/logging.h>
 #include <rte_bus_pci.h>
 #include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_power_intrinsics.h>
 
+#include <algorithm>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <utility>
@@ -13,8 +17,11 @@
 
 #include "dpdk.h"
 #include "ether.h"
+#include "ipv4.h"
 #include "packet.h"
+#include "packet_capture.h"
 #include "packet_pool.h"
+#include "ttime.h"
 
 namespace juggler {
 namespace dpdk {
@@ -49,6 +56,8 @@ class PmdRing {
   uint16_t GetDescNum() const { return ndesc_; }
   uint8_t GetPortId() const { return port_id_; }
   uint16_t GetRingId() const { return ring_id_; }
+  // The NUMA socket of the ring's descriptors and mbufs, i.e., the NIC's.
+  int GetSocketId() const { return socket_id_; }
 
  protected:
   // Only TX rings can be initialized without a packetpool attached.
@@ -58,6 +67,7 @@ class PmdRing {
         port_id_(port_id),
         ring_id_(ring_id),
         ndesc_(ndesc),
+        socket_id_(rte_eth_dev_socket_id(port_id)),
         ppool_(nullptr) {}
   PmdRing(const PmdPort *port, uint8_t port_id, uint16_t ring_id,
           uint16_t ndesc, uint32_t nmbufs, uint32_t mbuf_sz)
@@ -65,7 +75,22 @@ class PmdRing {
         port_id_(port_id),
         ring_id_(ring_id),
         ndesc_(ndesc),
-        ppool_(std::unique_ptr<PacketPool>(new PacketPool(nmbufs, mbuf_sz))) {}
+        socket_id_(rte_eth_dev_socket_id(port_id)),
+        ppool_(std::unique_ptr<PacketPool>(
+            new PacketPool(nmbufs, mbuf_sz, PacketPool::kRteDefaultMempoolName,
+                           socket_id_))) {}
+
+  // Shares the packet pool of a ring that the DPDK primary process set up
+  // (see `PmdPort::InitSecondary()').
+  PmdRing(const PmdPort *port, uint8_t port_id, uint16_t ring_id,
+          uint16_t ndesc, const std::string &mempool_name)
+      : pmd_port_(port),
+        port_id_(port_id),
+        ring_id_(ring_id),
+        ndesc_(ndesc),
+        socket_id_(rte_eth_dev_socket_id(port_id)),
+        ppool_(std::unique_ptr<PacketPool>(
+            new PacketPool(0, 0, mempool_name.c_str(), socket_id_))) {}
 
   rte_mempool *GetPacketMemPool() const { return ppool_.get()->GetMemPool(); }
 
@@ -74,6 +99,8 @@ class PmdRing {
   const uint8_t port_id_;
   const uint16_t ring_id_;
   const uint16_t ndesc_;
+  // `SOCKET_ID_ANY' if the NIC's socket is unknown.
+  const int socket_id_;
   const std::unique_ptr<PacketPool> ppool_;
 };
 
@@ -84,6 +111,17 @@ class PmdRing {
  */
 class TxRing : public PmdRing {
  public:
+  // Maximum number of packets held by the TX buffer (see `BufferPacket()').
+  static constexpr uint16_t kTxBufferSize = 2 * PacketBatch::kMaxBurst;
+  // Maximum number of packets held by the TX backlog (see `Flush()'); must be
+  // a power of two.
+  static constexpr uint32_t kTxBacklogSize = 4096;
+  // Backlog depth above which the ring signals backpressure (see
+  // `IsBackpressured()').
+  static constexpr uint32_t kTxBacklogWatermark = 1024;
+  static_assert((kTxBacklogSize & (kTxBacklogSize - 1)) == 0,
+                "The TX backlog size must be a power of two");
+
   TxRing(const PmdPort *pmd_port, uint8_t port_id, uint16_t ring_id,
          uint16_t ndesc)
       : PmdRing(pmd_port, port_id, ring_id, ndesc) {}
@@ -98,11 +136,46 @@ class TxRing : public PmdRing {
       : PmdRing(pmd_port, port_id, ring_id, ndesc, nmbufs, mbuf_sz),
         conf_(txconf) {}
 
+  TxRing(const PmdPort *pmd_port, uint8_t port_id, uint16_t ring_id,
+         uint16_t ndesc, const std::string &mempool_name)
+      : PmdRing(pmd_port, port_id, ring_id, ndesc, mempool_name) {}
+
   TxRing(TxRing const &) = delete;
   TxRing &operator=(TxRing const &) = delete;
 
+  // Data room (headroom included) of the mbufs of control packets (see
+  // `AttachCtrlPool()'): the headers of a control packet fit with room to
+  // spare.
+  static constexpr uint16_t kCtrlMbufDataSize = RTE_PKTMBUF_HEADROOM + 256;
+
+  ~TxRing() override {
+    for (uint16_t i = 0; i < tx_buffer_cnt_; i++) Packet::Free(tx_buffer_[i]);
+    for (; tx_backlog_cnt_ != 0; tx_backlog_cnt_--) {
+      Packet::Free(tx_backlog_[tx_backlog_head_++ & (kTxBacklogSize - 1)]);
+    }
+  }
+
   void Init();
 
+  /**
+   * @brief Give the ring a pool of `nmbufs' small mbufs of its own for control
+   * packets (e.g., ACKs and ARP), so that they do not take full-sized mbufs
+   * from the pool of data packets.
+   */
+  void AttachCtrlPool(uint32_t nmbufs) {
+    CHECK(ctrl_ppool_ == nullptr);
+    ctrl_ppool_ = std::make_unique<PacketPool>(
+        nmbufs, kCtrlMbufDataSize, PacketPool::kRteDefaultMempoolName,
+        GetSocketId());
+  }
+
+  // The pool of control packets: the ring's own (see `AttachCtrlPool()'), or
+  // else the pool of its data packets.
+  PacketPool *GetCtrlPacketPool() const {
+    return ctrl_ppool_ != nullptr ? ctrl_ppool_.get() : GetPacketPool();
+  }
+  bool HasCtrlPacketPool() const { return ctrl_ppool_ != nullptr; }
+
   /**
    * @brief Tries to send a burst of packets through this TX ring.
    *
@@ -111,11 +184,17 @@ class TxRing : public PmdRing {
    * @return Number of packets successfully sent.
    */
   uint16_t TrySendPackets(Packet **pkts, uint16_t nb_pkts) const {
+    if (capture_ != nullptr) [[unlikely]] {  // NOLINT
+      for (uint16_t i = 0; i < nb_pkts; i++) {
+        capture_->Capture(pkts[i], capture::kTx);
+      }
+    }  // NOLINT
     const uint16_t nb_success =
         rte_eth_tx_burst(this->GetPortId(), this->GetRingId(),
                          reinterpret_cast<struct rte_mbuf **>(pkts), nb_pkts);
 
-    // Free not-sent packets. TODO (ilias): This drops packets!
+    // Free not-sent packets. Callers that cannot afford to drop packets use
+    // `BufferPacket()' instead, which backlogs them.
     for (auto i = nb_success; i < nb_pkts; ++i) Packet::Free(pkts[i]);
     return nb_success;
   }
@@ -161,6 +240,118 @@ class TxRing : public PmdRing {
     batch->Clear();
   }
 
+  /**
+   * @brief Buffers a packet for transmission through this TX ring.
+   *
+   * Buffered packets are sent in bursts, either when the buffer fills up or
+   * when `Flush()' is called. This amortizes the cost of `rte_eth_tx_burst()'
+   * (and the NIC doorbell it rings) over packets coming from different flows
+   * and control paths. Packets are never dropped because the NIC's queue is
+   * full, unless the TX backlog overflows (see `Flush()').
+   *
+   * @param pkt Packet to send.
+   * @attention Not thread-safe; the ring must be owned by a single thread.
+   */
+  void BufferPacket(Packet *pkt) {
+    if (capture_ != nullptr) [[unlikely]] {  // NOLINT
+      capture_->Capture(pkt, capture::kTx);
+    }  // NOLINT
+    tx_buffer_[tx_buffer_cnt_++] = pkt;
+    if (tx_buffer_cnt_ == kTxBufferSize) [[unlikely]]
+      Flush();
+  }
+
+  /**
+   * @brief Buffers all packets from a PacketBatch for transmission through
+   * this TX ring (see `BufferPacket()').
+   *
+   * @param batch Pointer to the PacketBatch; it is cleared on return.
+   */
+  void BufferPackets(PacketBatch *batch) {
+    for (uint16_t i = 0; i < batch->GetSize(); i++) {
+      BufferPacket(batch->pkts()[i]);
+    }
+    batch->Clear();
+  }
+
+  /**
+   * @brief Sends all the buffered packets through this TX ring, without
+   * waiting for room in the NIC's queue.
+   *
+   * Packets that the NIC does not take are moved to the TX backlog, a software
+   * queue behind the NIC's, and are sent before any other on the next call
+   * (or `RetryBacklog()'), in order. If the backlog is full, they are dropped
+   * (see `GetBacklogOverflowCount()'); the transport recovers them as losses.
+   */
+  void Flush() {
+    if (tx_backlog_cnt_ != 0) [[unlikely]]  // NOLINT
+      RetryBacklog();
+    if (tx_buffer_cnt_ == 0) return;
+    uint16_t nb_sent = 0;
+    if (tx_backlog_cnt_ == 0) [[likely]] {  // NOLINT
+      nb_sent = Burst(tx_buffer_, tx_buffer_cnt_);
+    }
+    for (uint16_t i = nb_sent; i < tx_buffer_cnt_; i++) {
+      BacklogPacket(tx_buffer_[i]);
+    }
+    tx_buffer_cnt_ = 0;
+  }
+
+  /**
+   * @brief Sends as many packets from the TX backlog as the NIC takes, oldest
+   * first.
+   */
+  void RetryBacklog() {
+    while (tx_backlog_cnt_ != 0) {
+      const uint32_t head = tx_backlog_head_ & (kTxBacklogSize - 1);
+      const auto nb_pkts = static_cast<uint16_t>(
+          std::min(tx_backlog_cnt_, kTxBacklogSize - head));
+      const uint16_t nb_sent = Burst(&tx_backlog_[head], nb_pkts);
+      tx_backlog_head_ += nb_sent;
+      tx_backlog_cnt_ -= nb_sent;
+      if (nb_sent < nb_pkts) break;
+    }
+  }
+
+  /**
+   * @return Whether the TX backlog is above its watermark, i.e., the NIC has
+   * been falling behind: producers of new packets (e.g., flows pulling
+   * messages from the channels) should hold back until it drains.
+   */
+  bool IsBackpressured() const {
+    return tx_backlog_cnt_ > kTxBacklogWatermark;
+  }
+
+  /**
+   * @return Number of packets currently held in the TX buffer.
+   */
+  uint16_t GetBufferedCount() const { return tx_buffer_cnt_; }
+
+  /**
+   * @return Number of packets currently held in the TX backlog.
+   */
+  uint32_t GetBacklogCount() const { return tx_backlog_cnt_; }
+
+  /**
+   * @return Number of packets dropped so far, because the TX backlog was full.
+   */
+  uint64_t GetBacklogOverflowCount() const { return tx_backlog_overflows_; }
+
+  /**
+   * @return Number of TX bursts through the TX buffer and backlog so far.
+   */
+  uint64_t GetFlushCount() const { return tx_flushes_; }
+
+  /**
+   * @return Number of packets sent through the TX buffer and backlog so far.
+   */
+  uint64_t GetFlushedPacketCount() const { return tx_flushed_pkts_; }
+
+  /**
+   * @return Number of bytes sent through the TX buffer and backlog so far.
+   */
+  uint64_t GetFlushedByteCount() const { return tx_flushed_bytes_; }
+
   /**
    * @brief Explicitly reclaims the memory buffers (mbufs) used by sent packets
    * in the TX ring.
@@ -169,8 +360,53 @@ class TxRing : public PmdRing {
     return rte_eth_tx_done_cleanup(this->GetPortId(), this->GetRingId(), 0);
   }
 
+  /**
+   * @brief Capture the packets sent through this TX ring (`BufferPacket()'
+   * and `TrySendPackets()') to a capture ring (see `capture::PacketCapture'),
+   * or stop (`nullptr').
+   */
+  void SetCapture(capture::PacketCapture *capture) { capture_ = capture; }
+
  private:
+  uint16_t Burst(Packet **pkts, uint16_t nb_pkts) {
+    // The lengths are read before the NIC owns the packets.
+    uint64_t nb_bytes = 0;
+    for (uint16_t i = 0; i < nb_pkts; i++) nb_bytes += pkts[i]->length();
+    const uint16_t nb_sent =
+        rte_eth_tx_burst(this->GetPortId(), this->GetRingId(),
+                         reinterpret_cast<struct rte_mbuf **>(pkts), nb_pkts);
+    for (uint16_t i = nb_sent; i < nb_pkts; i++) nb_bytes -= pkts[i]->length();
+    tx_flushes_++;
+    tx_flushed_pkts_ += nb_sent;
+    tx_flushed_bytes_ += nb_bytes;
+    return nb_sent;
+  }
+
+  void BacklogPacket(Packet *pkt) {
+    if (tx_backlog_cnt_ == kTxBacklogSize) [[unlikely]] {  // NOLINT
+      Packet::Free(pkt);
+      tx_backlog_overflows_++;
+      return;
+    }
+    tx_backlog_[(tx_backlog_head_ + tx_backlog_cnt_) & (kTxBacklogSize - 1)] =
+        pkt;
+    tx_backlog_cnt_++;
+  }
+
   struct rte_eth_txconf conf_;
+  Packet *tx_buffer_[kTxBufferSize];
+  uint16_t tx_buffer_cnt_{0};
+  // The TX backlog: a circular buffer of the packets the NIC did not take.
+  Packet *tx_backlog_[kTxBacklogSize];
+  uint32_t tx_backlog_head_{0};
+  uint32_t tx_backlog_cnt_{0};
+  uint64_t tx_backlog_overflows_{0};
+  uint64_t tx_flushes_{0};
+  // Small mbufs for control packets, if any (see `AttachCtrlPool()').
+  std::unique_ptr<PacketPool> ctrl_ppool_{nullptr};
+  uint64_t tx_flushed_pkts_{0};
+  uint64_t tx_flushed_bytes_{0};
+  capture::PacketCapture *capture_{nullptr};
 };
 
 /**
@@ -190,11 +426,28 @@ class RxRing : public PmdRing {
       : PmdRing(pmd_port, port_id, ring_id, ndesc, nmbufs, mbuf_sz),
         conf_(rxconf) {}
 
+  RxRing(const PmdPort *pmd_port, uint8_t port_id, uint16_t ring_id,
+         uint16_t ndesc, const std::string &mempool_name)
+      : PmdRing(pmd_port, port_id, ring_id, ndesc, mempool_name) {}
+
   RxRing(RxRing const &) = delete;
   RxRing &operator=(RxRing const &) = delete;
 
   void Init();
 
+  /**
+   * @brief (Re)configure buffer split on this RX ring, at runtime: the first
+   * `hdr_len' bytes of each received packet are stored in a buffer of the
+   * ring's own packet pool, and the rest in a buffer of `payload_pool'.
+   *
+   * @param payload_pool Packet pool for the payloads, or nullptr to receive
+   * whole packets in the ring's own packet pool again.
+   * @param hdr_len Length of the first segment of each packet.
+   * @return true on success. On failure the ring receives whole packets in its
+   * own packet pool.
+   */
+  bool ConfigureBufferSplit(PacketPool *payload_pool, uint16_t hdr_len);
+
   /**
    * @brief Receives a burst of packets from this RX ring.
    *
@@ -229,6 +482,39 @@ class RxRing : public PmdRing {
     return nb_rx;
   }
 
+  /**
+   * @brief Wait in a low-power state (`umwait') until the NIC writes the next
+   * RX descriptor of this ring, or until a deadline.
+   *
+   * @param deadline TSC timestamp to wait until, at most.
+   * @return True if the ring was monitored, false if the NIC or the CPU do not
+   * support it (the call then returns right away).
+   */
+  bool MonitorPackets(uint64_t deadline) {
+    rte_power_monitor_cond cond;
+    if (rte_eth_get_monitor_addr(GetPortId(), GetRingId(), &cond) != 0)
+      return false;
+    return rte_power_monitor(&cond, deadline) == 0;
+  }
+
+  /**
+   * @brief Set up the RX interrupt of this ring on the epoll instance of the
+   * calling thread (see `WaitForPackets()'). The port must be initialized with
+   * RX interrupts enabled (see `PmdPort::EnableRxInterrupts()').
+   *
+   * @return True on success, false if the port does not support it.
+   */
+  bool InitInterrupt();
+
+  /**
+   * @brief Block the calling thread until packets arrive at this ring (RX
+   * interrupt), or until a timeout. Requires `InitInterrupt()' first, from the
+   * same thread.
+   *
+   * @param timeout_ms Timeout in milliseconds.
+   */
+  void WaitForPackets(int timeout_ms);
+
  private:
   struct rte_eth_rxconf conf_;
 };
@@ -302,11 +588,110 @@ class PmdPort {
   /**
    * @brief Initializes the driver.
    *
-   * @param mtu (Optional) Maximum Transmission Unit to set for the port.
-   * Default is PmdRing::kDefaultFrameSize.
+   * @param mtu (Optional) Maximum Transmission Unit to set for the port
+   * (e.g., up to `kMaxMtu' for jumbo frames). The mbufs of the port
+   * are sized to hold full frames, without chaining. Default is
+   * PmdRing::kDefaultFrameSize.
    */
   void InitDriver(uint16_t mtu = PmdRing::kDefaultFrameSize);
 
+  /**
+   * @brief Initializes the port in a DPDK secondary process, for one of the
+   * queue pairs that the primary process (i.e., the Machnet controller)
+   * configured and started, and reserved for it (see `ReserveQueues()'). The
+   * rings of the pair share the packet pools the primary created for them;
+   * the other queues of the port are left alone, and have no rings here.
+   *
+   * @param queue_id The RX and TX queue to drive.
+   * @param rx_mempool_name Name of the packet pool of the RX queue.
+   * @param tx_mempool_name Name of the packet pool of the TX queue.
+   */
+  void InitSecondary(uint16_t queue_id, const std::string &rx_mempool_name,
+                     const std::string &tx_mempool_name);
+
+  // The MTU the port was initialized with (see `InitDriver()').
+  uint16_t mtu() const { return mtu_; }
+
+  /**
+   * @brief Let the RX rings of the port raise interrupts (see
+   * `RxRing::WaitForPackets()'). Must be called before `InitDriver()'.
+   */
+  void EnableRxInterrupts() {
+    CHECK(!initialized_);
+    rx_interrupts_ = true;
+  }
+  bool rx_interrupts() const { return rx_interrupts_; }
+
+  /**
+   * @brief Keep the last `queues_nr' queue pairs of the port out of the RSS
+   * redirection table, for applications that drive them from DPDK secondary
+   * processes (see `InitSecondary()'): packets only reach them by flow rules.
+   * Must be called before `InitDriver()'.
+   */
+  void ReserveQueues(uint16_t queues_nr) {
+    CHECK(!initialized_);
+    CHECK_LT(queues_nr, std::min(rx_rings_nr_, tx_rings_nr_));
+    reserved_queues_nr_ = queues_nr;
+  }
+  uint16_t GetReservedQueuesNr() const { return reserved_queues_nr_; }
+
+  /**
+   * @brief Have the NIC timestamp the packets it receives, if it can (see
+   * `Packet::rx_timestamp()' and `NicClock'). Must be called before
+   * `InitDriver()', which finds out whether the NIC supports it (see
+   * `rx_timestamps()').
+   */
+  void EnableRxTimestamps() {
+    CHECK(!initialized_);
+    rx_timestamps_requested_ = true;
+  }
+  bool rx_timestamps() const { return rx_timestamp_offset_ >= 0; }
+
+  /**
+   * @brief Keep the `MBUF_FAST_FREE' TX offload off, e.g., for engines that
+   * keep references to the packets they send (see
+   * `net::flow::RexmitBudget'). Must be called before `InitDriver()'.
+   */
+  void DisableTxFastFree() {
+    CHECK(!initialized_);
+    tx_fast_free_requested_ = false;
+  }
+  // Whether the NIC assumes it owns the packets sent alone, and frees them to
+  // their pool straight away (`MBUF_FAST_FREE').
+  bool tx_fast_free() const { return tx_fast_free_; }
+
+  /**
+   * @brief Sizes of the packet pools of each ring of a port (see
+   * `SetPoolConfig()'); 0 for the defaults.
+   */
+  struct PoolConfig {
+    // Mbufs of the pool of each RX and TX ring (default: twice the
+    // descriptors of the ring).
+    uint32_t rx_mbufs{0};
+    uint32_t tx_mbufs{0};
+    // Data room of the mbufs, headroom included (default: that of a full
+    // frame at the MTU, the least they can have).
+    uint16_t data_room{0};
+    // Small mbufs of each TX ring for control packets (see
+    // `TxRing::AttachCtrlPool()'); 0: they take mbufs of the data pool.
+    uint32_t ctrl_mbufs{0};
+  };
+
+  /**
+   * @brief Size the packet pools of the rings. Must be called before
+   * `InitDriver()'. With control pools, the TX rings send packets of two
+   * pools, so fast free is off (see `DisableTxFastFree()').
+   */
+  void SetPoolConfig(const PoolConfig &config) {
+    CHECK(!initialized_);
+    pool_config_ = config;
+  }
+  const PoolConfig &pool_config() const { return pool_config_; }
+  // Offset of the timestamp field of the received mbufs, and their flag
+  // telling whether the field is set.
+  int rx_timestamp_offset() const { return rx_timestamp_offset_; }
+  uint64_t rx_timestamp_flag() const { return rx_timestamp_flag_; }
+
   /**
    * @brief Deinitializes the port.
    */
@@ -321,6 +706,12 @@ class PmdPort {
 
   uint16_t GetPortId() const { return port_id_; }
 
+  /**
+   * @return The NUMA socket the NIC is attached to, or `SOCKET_ID_ANY' if it
+   * is unknown (e.g., on single-socket hosts, or for virtual devices).
+   */
+  int GetSocketId() const { return rte_eth_dev_socket_id(port_id_); }
+
   std::string GetDriverName() const {
     return juggler::utils::Format("%s", devinfo_.driver_name);
   }
@@ -332,6 +723,17 @@ class PmdPort {
    */
   rte_device *GetDevice() const { return device_; }
 
+  /**
+   * @brief Whether the RX queues of this port can be reconfigured at runtime
+   * to split the received packets into a header and a payload buffer, each
+   * from a different pool (see `RxRing::ConfigureBufferSplit()').
+   */
+  bool SupportsRxBufferSplit() const {
+    return (devinfo_.rx_offload_capa & RTE_ETH_RX_OFFLOAD_BUFFER_SPLIT) &&
+           (devinfo_.rx_offload_capa & RTE_ETH_RX_OFFLOAD_SCATTER) &&
+           (devinfo_.dev_capa & RTE_ETH_DEV_CAPA_RUNTIME_RX_QUEUE_SETUP);
+  }
+
   template <typename T>
   decltype(auto) GetRing(uint16_t id) const {
     constexpr bool is_tx_ring = std::is_same<T, TxRing>::value;
@@ -374,18 +776,84 @@ class PmdPort {
    * @return The index of the RX queue.
    */
   uint16_t GetRSSRxQueue(uint32_t rss_hash) const {
-    auto lsb = rss_hash & (devinfo_.reta_size - 1);
+    auto lsb = GetRSSBucket(rss_hash);
     auto index = lsb / RTE_ETH_RETA_GROUP_SIZE;
     auto shift = lsb % RTE_ETH_RETA_GROUP_SIZE;
+    // The table may be updated concurrently (see `RedirectRSSBuckets()').
+    const auto queue =
+        __atomic_load_n(&rss_reta_conf_[index].reta[shift], __ATOMIC_RELAXED);
     LOG(INFO) << "index: " << index << " shift: " << shift
               << "rss_hash: " << rss_hash
               << " reta_size: " << devinfo_.reta_size
               << " reta_group_size: " << RTE_ETH_RETA_GROUP_SIZE
-              << " reta: " << rss_reta_conf_[index].reta[shift]
-              << " lsb: " << lsb;
-    return rss_reta_conf_[index].reta[shift];
+              << " reta: " << queue << " lsb: " << lsb;
+    return queue;
+  }
+
+  /**
+   * @return The entry of the RSS redirection table (RETA) for a given RSS
+   * hash.
+   */
+  uint16_t GetRSSBucket(uint32_t rss_hash) const {
+    return rss_hash & (devinfo_.reta_size - 1);
   }
 
+  /**
+   * @brief Points entries of the RSS redirection table (RETA) to an RX queue,
+   * so that the packets hashing to them land there from now on. Thread-safe.
+   *
+   * @param buckets The RETA entries to update (see `GetRSSBucket()').
+   * @param rx_queue_id The RX queue to point them to.
+   * @return True on success, false if the NIC rejected the update (in which
+   * case the table is left as it was).
+   */
+  bool RedirectRSSBuckets(const std::vector<uint16_t> &buckets,
+                          uint16_t rx_queue_id);
+
+  /**
+   * @brief Steers received UDP packets to an RX queue with a flow rule (see
+   * `rte_flow'), instead of RSS. A packet matches if its destination port,
+   * masked with `dst_port_mask', equals `dst_port', and (optionally) it is
+   * destined to `dst_addr'. Where rules overlap, the one with the lowest
+   * `priority' value applies.
+   *
+   * @param dst_addr Destination IPv4 address to match, or nullptr for any.
+   * @param dst_port Destination UDP port to match (host byte order).
+   * @param dst_port_mask Bits of the destination port to match.
+   * @param rx_queue_id RX queue to steer the packets to.
+   * @param priority Priority of the rule (lower values are matched first).
+   * @return The rule, or nullptr if the NIC cannot offload it.
+   */
+  rte_flow *AddUdpSteeringRule(const net::Ipv4::Address *dst_addr,
+                               uint16_t dst_port, uint16_t dst_port_mask,
+                               uint16_t rx_queue_id, uint32_t priority);
+
+  /**
+   * @brief Steers received packets of an EtherType (e.g., ARP) to an RX queue,
+   * like `AddUdpSteeringRule()'.
+   *
+   * @param eth_type EtherType to match (host byte order).
+   * @return The rule, or nullptr if the NIC cannot offload it.
+   */
+  rte_flow *AddEthTypeSteeringRule(uint16_t eth_type, uint16_t rx_queue_id,
+                                   uint32_t priority);
+
+  /**
+   * @brief Steers received IPv4 packets of a protocol (e.g., ICMP) to an RX
+   * queue, like `AddUdpSteeringRule()'.
+   *
+   * @param proto IP protocol number to match.
+   * @return The rule, or nullptr if the NIC cannot offload it.
+   */
+  rte_flow *AddIpv4ProtoSteeringRule(uint8_t proto, uint16_t rx_queue_id,
+                                     uint32_t priority);
+
+  /**
+   * @brief Removes a rule installed with `AddUdpSteeringRule()' (or the other
+   * steering rules).
+   */
+  void RemoveSteeringRule(rte_flow *rule);
+
   /**
    * @brief Retrieves the number of RX queues for the port.
    *
@@ -463,6 +931,12 @@ class PmdPort {
   }
 
  private:
+  // Validate and create a rule that steers the packets matching `pattern' to
+  // an RX queue; `kind' names the rule in the logs.
+  rte_flow *AddSteeringRule(const char *kind, uint32_t priority,
+                            const rte_flow_item *pattern,
+                            uint16_t rx_queue_id);
+
   const bool is_dpdk_primary_process_;
   const uint16_t port_id_;
   const uint16_t tx_rings_nr_, rx_rings_nr_;
@@ -473,11 +947,87 @@ class PmdPort {
   struct rte_eth_dev_info devinfo_;
   rte_device *device_;
   std::vector<rte_eth_rss_reta_entry64> rss_reta_conf_;
+  // Serializes updates of the RETA (see `RedirectRSSBuckets()').
+  std::mutex reta_mtx_{};
   struct rte_eth_stats port_stats_;
   std::vector<uint8_t> rss_hash_key_;
   std::string pci_info_;
+  uint16_t mtu_{PmdRing::kDefaultFrameSize};
+  // The last queue pairs, out of RSS (see `ReserveQueues()').
+  uint16_t reserved_queues_nr_{0};
+  bool rx_interrupts_{false};
+  bool rx_timestamps_requested_{false};
+  bool tx_fast_free_requested_{true};
+  PoolConfig pool_config_{};
+  bool tx_fast_free_{false};
+  int rx_timestamp_offset_{-1};
+  uint64_t rx_timestamp_flag_{0};
   bool initialized_;
 };
+
+/**
+ * @brief Class `NicClock' converts timestamps of a NIC's clock (e.g., of the
+ * packets it receives, see `PmdPort::EnableRxTimestamps()') to nanoseconds on
+ * the time base of the TSC (i.e., that of `time::cycles_to_ns()').
+ *
+ * The NIC clock runs at a frequency of its own, and drifts against the TSC:
+ * the conversion is calibrated from simultaneous readings of both clocks, one
+ * per call to `Calibrate()', which is meant to be called periodically (e.g.,
+ * every 100ms). No conversion is possible until the second reading.
+ *
+ * @attention This class is not thread-safe.
+ */
+class NicClock {
+ public:
+  explicit NicClock(uint16_t port_id) : port_id_(port_id) {}
+
+  /**
+   * @brief Take a reading of the NIC clock and the TSC, and update the
+   * conversion from the previous reading.
+   * @return False if the NIC clock cannot be read.
+   */
+  bool Calibrate() {
+    uint64_t nic_ticks, tsc;
+    if (!Read(&nic_ticks, &tsc)) return false;
+    const auto now_ns = time::cycles_to_ns(tsc);
+    // The NIC clock may have been reset (e.g., along with the port); start
+    // over from this reading.
+    if (last_ns_ != 0 && nic_ticks > last_ticks_ && now_ns > last_ns_) {
+      ns_per_tick_ = static_cast<double>(now_ns - last_ns_) /
+                     static_cast<double>(nic_ticks - last_ticks_);
+    }
+    last_ticks_ = nic_ticks;
+    last_ns_ = now_ns;
+    return true;
+  }
+
+  bool IsCalibrated() const { return ns_per_tick_ != 0; }
+
+  /**
+   * @brief Convert a NIC timestamp to nanoseconds on the TSC time base; the
+   * clock must be calibrated.
+   */
+  uint64_t ToNs(uint64_t nic_ticks) const {
+    DCHECK(IsCalibrated());
+    const auto delta = static_cast<int64_t>(nic_ticks - last_ticks_);
+    return last_ns_ + static_cast<int64_t>(delta * ns_per_tick_);
+  }
+
+ private:
+  // Read the NIC clock, along with the TSC halfway through the read.
+  bool Read(uint64_t *nic_ticks, uint64_t *tsc) const {
+    const auto before = time::rdtsc();
+    if (rte_eth_read_clock(port_id_, nic_ticks) != 0) return false;
+    const auto after = time::rdtsc();
+    *tsc = before + (after - before) / 2;
+    return true;
+  }
+
+  const uint16_t port_id_;
+  uint64_t last_ticks_{0};
+  uint64_t last_ns_{0};
+  double ns_per_tick_{0};
+};
 }  // namespace dpdk
 }  // namespace juggler
 
@@ -0,0 +1,171 @@
+/**
+ * @file rcu.h
+ * @brief Read-mostly values that threads read without locks (RCU-style).
+ */
+#ifndef SRC_INCLUDE_RCU_H_
+#define SRC_INCLUDE_RCU_H_
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace juggler {
+
+/**
+ * @brief Class `RcuValue' holds a value that is read much more often than it
+ * is updated, e.g., the ARP table shared by the engines of a port.
+ *
+ * Readers access the latest version of the value through a `Reader' of their
+ * own, without locks or atomic read-modify-write operations. Writers copy the
+ * value, update the copy, and publish it as the new version; the old version
+ * is reclaimed once every reader has moved past it (i.e., quiescent-state
+ * based reclamation: a reader is done with a version when it asks for the
+ * value again and gets a newer one). Writers are serialized by a mutex that
+ * readers never take.
+ *
+ * @tparam T The type of the value; it must be copyable.
+ */
+template <typename T>
+class RcuValue {
+  struct Version {
+    uint64_t seq;
+    T value;
+  };
+
+ public:
+  /**
+   * @brief A reader of the value. Each reader must be used by a single thread
+   * at a time, and must not outlive the value.
+   */
+  class Reader {
+   public:
+    explicit Reader(RcuValue *value) : value_(CHECK_NOTNULL(value)) {
+      value_->Register(this);
+    }
+    ~Reader() { value_->Unregister(this); }
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+
+    /**
+     * @brief Get the latest version of the value. It stays valid until the
+     * next call to `Get()' from this reader, or until the reader is destroyed.
+     */
+    const T &Get() {
+      const Version *version = value_->current_.load(std::memory_order_acquire);
+      if (version != version_) [[unlikely]] {  // NOLINT
+        version_ = version;
+        // Announce that older versions are no longer in use.
+        seen_.store(version->seq, std::memory_order_release);
+      }
+      return version_->value;
+    }
+
+    /**
+     * @brief Whether a newer version of the value has been published since the
+     * last call to `Get()'.
+     */
+    bool Updated() const {
+      return value_->current_.load(std::memory_order_acquire) != version_;
+    }
+
+   private:
+    friend class RcuValue;
+    RcuValue *const value_;
+    const Version *version_{nullptr};
+    std::atomic<uint64_t> seen_{0};
+  };
+
+  explicit RcuValue(T value = T())
+      : owned_(std::make_unique<Version>(Version{1, std::move(value)})) {
+    current_.store(owned_.get(), std::memory_order_release);
+  }
+  RcuValue(const RcuValue &) = delete;
+  RcuValue &operator=(const RcuValue &) = delete;
+  ~RcuValue() { CHECK(readers_.empty()) << "RcuValue destroyed with readers"; }
+
+  /**
+   * @brief Update the value: `update' is called on a copy of the latest
+   * version, and returns whether it changed anything; if so, the copy is
+   * published. Blocks while another writer updates the value.
+   */
+  template <typename F>
+  void Update(F &&update) {
+    const std::lock_guard<std::mutex> lock(mtx_);
+    UpdateLocked(std::forward<F>(update));
+  }
+
+  /**
+   * @brief Same as `Update()', but gives up instead of blocking if another
+   * writer is updating the value.
+   * @return False if the update was given up on.
+   */
+  template <typename F>
+  bool TryUpdate(F &&update) {
+    std::unique_lock<std::mutex> lock(mtx_, std::try_to_lock);
+    if (!lock.owns_lock()) return false;
+    UpdateLocked(std::forward<F>(update));
+    return true;
+  }
+
+  // The number of old versions not yet reclaimed (for tests).
+  size_t GetRetiredCount() {
+    const std::lock_guard<std::mutex> lock(mtx_);
+    return retired_.size();
+  }
+
+ private:
+  template <typename F>
+  void UpdateLocked(F &&update) {
+    auto next =
+        std::make_unique<Version>(Version{owned_->seq + 1, owned_->value});
+    if (!update(next->value)) return;
+    current_.store(next.get(), std::memory_order_release);
+    retired_.emplace_back(std::move(owned_));
+    owned_ = std::move(next);
+    Reclaim();
+  }
+
+  // Free the old versions that no reader may still be using.
+  void Reclaim() {
+    uint64_t min_seen = std::numeric_limits<uint64_t>::max();
+    for (const auto *reader : readers_) {
+      min_seen =
+          std::min(min_seen, reader->seen_.load(std::memory_order_acquire));
+    }
+    std::erase_if(retired_, [min_seen](const auto &version) {
+      return version->seq < min_seen;
+    });
+  }
+
+  void Register(Reader *reader) {
+    const std::lock_guard<std::mutex> lock(mtx_);
+    // The reader has not seen any version yet; its first `Get()' returns at
+    // least the latest one.
+    reader->seen_.store(owned_->seq, std::memory_order_relaxed);
+    readers_.push_back(reader);
+  }
+
+  void Unregister(Reader *reader) {
+    const std::lock_guard<std::mutex> lock(mtx_);
+    std::erase(readers_, reader);
+    Reclaim();
+  }
+
+  std::mutex mtx_;
+  // The latest version, as published to the readers.
+  std::atomic<const Version *> current_{nullptr};
+  // The latest version, and the older ones that readers may still be using.
+  std::unique_ptr<Version> owned_;
+  std::vector<std::unique_ptr<Version>> retired_;
+  std::vector<Reader *> readers_;
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_RCU_H_
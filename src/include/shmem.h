@@ -13,6 +13,7 @@
 #include <sys/stat.h> /* For mode constants */
 #include <utils.h>
 
+#include <memory>
 #include <mutex>
 #include <unordered_map>
 
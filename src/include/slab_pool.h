@@ -0,0 +1,178 @@
+/**
+ * @file slab_pool.h
+ * @brief Pools of fixed-size memory blocks, carved out of larger slabs.
+ */
+#ifndef SRC_INCLUDE_SLAB_POOL_H_
+#define SRC_INCLUDE_SLAB_POOL_H_
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+namespace juggler {
+
+/**
+ * @brief Class `SlabPool' hands out memory blocks of a single size, from
+ * slabs of `blocks_per_slab' blocks each. Freed blocks are kept in a free list
+ * and reused; slabs are only released when the pool is destroyed. Allocating
+ * and freeing a block takes no heap allocation, except when the pool runs out
+ * of blocks and grows by another slab.
+ *
+ * The blocks are large (and aligned) enough for every object type the pool was
+ * fitted to (see `Fit()'), before its first slab was allocated. This lets the
+ * pool back containers whose nodes are of an unnamed type (see
+ * `SlabAllocator').
+ *
+ * @attention This class is not thread-safe. The pool must outlive the blocks
+ * it hands out.
+ */
+class SlabPool {
+ public:
+  static constexpr size_t kDefaultBlocksPerSlab = 64;
+
+  explicit SlabPool(size_t blocks_per_slab = kDefaultBlocksPerSlab)
+      : blocks_per_slab_(blocks_per_slab) {
+    CHECK_GT(blocks_per_slab_, 0);
+  }
+  SlabPool(const SlabPool &) = delete;
+  SlabPool &operator=(const SlabPool &) = delete;
+
+  ~SlabPool() {
+    LOG_IF(ERROR, in_use_ != 0)
+        << "SlabPool destroyed with " << in_use_ << " blocks in use";
+    for (auto *slab : slabs_) std::free(slab);
+  }
+
+  /**
+   * @brief Make the blocks of the pool fit objects of the given size and
+   * alignment. Only possible until the first slab is allocated.
+   */
+  void Fit(size_t size, size_t align) {
+    if (size <= block_size_ && align <= block_align_) return;
+    CHECK(slabs_.empty()) << "Cannot resize the blocks of a SlabPool in use";
+    block_align_ = std::max(block_align_, align);
+    block_size_ = std::max(block_size_, size);
+    block_size_ =
+        (block_size_ + block_align_ - 1) / block_align_ * block_align_;
+  }
+
+  /**
+   * @brief Allocate a block.
+   * @return Pointer to the block; never `nullptr'.
+   */
+  void *Alloc() {
+    if (free_list_ == nullptr) [[unlikely]]  // NOLINT
+      Grow();
+    auto *block = free_list_;
+    free_list_ = block->next;
+    in_use_++;
+    return block;
+  }
+
+  // Return a block to the pool.
+  void Free(void *ptr) {
+    DCHECK_GT(in_use_, 0);
+    auto *block = static_cast<FreeBlock *>(ptr);
+    block->next = free_list_;
+    free_list_ = block;
+    in_use_--;
+  }
+
+  /**
+   * @brief Grow the pool (by whole slabs) until it holds at least `nblocks'
+   * free blocks, so that as many allocations take no heap allocation.
+   */
+  void Reserve(size_t nblocks) {
+    while (GetCapacity() - in_use_ < nblocks) Grow();
+  }
+
+  // Size of the blocks of the pool.
+  size_t GetBlockSize() const { return block_size_; }
+
+  // Number of blocks currently handed out.
+  size_t GetInUseCount() const { return in_use_; }
+  // Total number of blocks, in use or free.
+  size_t GetCapacity() const { return slabs_.size() * blocks_per_slab_; }
+
+ private:
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+
+  void Grow() {
+    const size_t slab_align = std::max(block_align_, sizeof(max_align_t));
+    size_t slab_size = block_size_ * blocks_per_slab_;
+    slab_size = (slab_size + slab_align - 1) / slab_align * slab_align;
+    auto *slab = static_cast<char *>(std::aligned_alloc(slab_align, slab_size));
+    CHECK_NOTNULL(slab);
+    slabs_.push_back(slab);
+    // Thread the blocks of the slab onto the free list, in address order.
+    for (size_t i = blocks_per_slab_; i > 0; i--) {
+      auto *block = reinterpret_cast<FreeBlock *>(slab + (i - 1) * block_size_);
+      block->next = free_list_;
+      free_list_ = block;
+    }
+  }
+
+  const size_t blocks_per_slab_;
+  size_t block_size_{sizeof(FreeBlock)};
+  size_t block_align_{alignof(FreeBlock)};
+  FreeBlock *free_list_{nullptr};
+  size_t in_use_{0};
+  std::vector<char *> slabs_{};
+};
+
+/**
+ * @brief Class `SlabAllocator' is a standard allocator that takes single
+ * objects from a `SlabPool' (e.g., the nodes of a `std::list'), and anything
+ * else from the heap. All the allocators rebound from it share its pool, which
+ * is fitted to the object types of all of them on construction: they must be
+ * constructed (e.g., along with the container) before the pool is used.
+ */
+template <typename T>
+class SlabAllocator {
+ public:
+  using value_type = T;
+
+  explicit SlabAllocator(SlabPool *pool) : pool_(CHECK_NOTNULL(pool)) {
+    pool_->Fit(sizeof(T), alignof(T));
+  }
+  template <typename U>
+  SlabAllocator(const SlabAllocator<U> &other)  // NOLINT(runtime/explicit)
+      : pool_(other.pool()) {
+    pool_->Fit(sizeof(T), alignof(T));
+  }
+
+  T *allocate(size_t n) {
+    if (n != 1) [[unlikely]]  // NOLINT
+      return std::allocator<T>().allocate(n);
+    DCHECK_LE(sizeof(T), pool_->GetBlockSize());
+    return static_cast<T *>(pool_->Alloc());
+  }
+
+  void deallocate(T *ptr, size_t n) {
+    if (n != 1) [[unlikely]] {  // NOLINT
+      std::allocator<T>().deallocate(ptr, n);
+      return;
+    }
+    pool_->Free(ptr);
+  }
+
+  SlabPool *pool() const { return pool_; }
+
+  template <typename U>
+  bool operator==(const SlabAllocator<U> &other) const {
+    return pool_ == other.pool();
+  }
+
+ private:
+  SlabPool *pool_;
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_SLAB_POOL_H_
@@ -0,0 +1,188 @@
+/**
+ * @file slow_path.h
+ * @brief The slow path of a port: a queue and a thread of their own for the
+ * traffic that is not Machnet's (ARP, ICMP and the rest), off the engines.
+ */
+#ifndef SRC_INCLUDE_SLOW_PATH_H_
+#define SRC_INCLUDE_SLOW_PATH_H_
+
+#include <arp.h>
+#include <ether.h>
+#include <glog/logging.h>
+#include <icmp.h>
+#include <ipv4.h>
+#include <machnet_engine.h>
+#include <packet.h>
+#include <pmd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace juggler {
+
+/**
+ * @brief Class `SlowPath' serves an RX/TX queue pair of a port that the NIC
+ * steers the packets the engines have no use for to (see
+ * `InstallSteeringRules()'): ARP, ICMP and IPv6. A thread of its own answers
+ * ARP requests and learns the replies (in the ARP table the engines share,
+ * see `MachnetEngineSharedState::ProcessArpPacket()'), answers pings, and
+ * drops the rest, so that a burst of such packets does not take cycles or
+ * RX descriptors from the engines.
+ *
+ * The queue must be out of RSS (see `PmdPort::ReserveQueues()'). UDP packets
+ * for ports with no listener cannot be told apart by the NIC: they still
+ * reach the engines, which drop them and log them at a limited rate.
+ *
+ * This class is non-copyable; `Start()' must be called at most once.
+ */
+class SlowPath {
+ public:
+  // How long the thread sleeps when the queue is empty.
+  static constexpr auto kIdleSleep = std::chrono::microseconds(100);
+  // Priority of the flow rules: any, as they do not overlap with the rules of
+  // port steering (IPv4 UDP).
+  static constexpr uint32_t kSteeringRulePriority =
+      MachnetEngineSharedState::kPortSteeringRulePriority;
+  // Dropped packets are logged once in every this many.
+  static constexpr int kDropLogEvery = 1000;
+
+  /**
+   * @param pmd_port The port.
+   * @param queue_id The queue pair of the port to serve.
+   * @param shared_state The state that the engines of the port share.
+   */
+  SlowPath(std::shared_ptr<dpdk::PmdPort> pmd_port, uint16_t queue_id,
+           std::shared_ptr<MachnetEngineSharedState> shared_state)
+      : pmd_port_(CHECK_NOTNULL(pmd_port)),
+        queue_id_(queue_id),
+        shared_state_(CHECK_NOTNULL(shared_state)),
+        arp_table_reader_(shared_state_->NewArpTableReader()),
+        rxring_(pmd_port_->GetRing<dpdk::RxRing>(queue_id)),
+        txring_(pmd_port_->GetRing<dpdk::TxRing>(queue_id)) {}
+
+  SlowPath(const SlowPath &) = delete;
+  SlowPath &operator=(const SlowPath &) = delete;
+
+  ~SlowPath() {
+    if (!thread_.joinable()) return;
+    running_.store(false, std::memory_order_relaxed);
+    thread_.join();
+    LOG(INFO) << "Slow path of port " << pmd_port_->GetPortId() << " (queue "
+              << queue_id_ << "): " << arp_packets_ << " ARP, "
+              << icmp_packets_ << " ICMP, " << dropped_packets_
+              << " dropped packets.";
+  }
+
+  /**
+   * @brief Install the flow rules that steer the slow-path traffic (ARP, IPv6
+   * and ICMP) of the port to the queue.
+   * @return True on success; false if the NIC cannot offload the rules, in
+   * which case none are left installed (and the traffic stays on the
+   * engines).
+   */
+  bool InstallSteeringRules() {
+    CHECK(rules_.empty());
+    const auto add = [this](rte_flow *rule) {
+      if (rule != nullptr) rules_.push_back(rule);
+      return rule != nullptr;
+    };
+    if (!add(pmd_port_->AddEthTypeSteeringRule(
+            net::Ethernet::kArp, queue_id_, kSteeringRulePriority)) ||
+        !add(pmd_port_->AddEthTypeSteeringRule(
+            net::Ethernet::kIpv6, queue_id_, kSteeringRulePriority)) ||
+        !add(pmd_port_->AddIpv4ProtoSteeringRule(
+            net::Ipv4::kIcmp, queue_id_, kSteeringRulePriority))) {
+      for (auto *rule : rules_) pmd_port_->RemoveSteeringRule(rule);
+      rules_.clear();
+      return false;
+    }
+    LOG(INFO) << "Port " << pmd_port_->GetPortId()
+              << ": steering ARP, ICMP and IPv6 to RX queue " << queue_id_
+              << ".";
+    return true;
+  }
+
+  // Serve the queue in a thread of its own, until this is destroyed.
+  void Start() {
+    CHECK(!thread_.joinable());
+    running_.store(true, std::memory_order_relaxed);
+    thread_ = std::thread([this]() {
+      while (running_.load(std::memory_order_relaxed)) {
+        if (Poll() == 0) std::this_thread::sleep_for(kIdleSleep);
+      }
+    });
+  }
+
+  /**
+   * @brief Receive and handle a burst of packets, and send the replies.
+   * @return The number of packets received.
+   */
+  uint16_t Poll() {
+    dpdk::PacketBatch batch;
+    const uint16_t nb_rx = rxring_->RecvPackets(&batch);
+    for (uint16_t i = 0; i < nb_rx; i++) Process(batch[i]);
+    batch.Release();
+    txring_->Flush();
+    return nb_rx;
+  }
+
+  uint64_t arp_packets() const { return arp_packets_; }
+  uint64_t icmp_packets() const { return icmp_packets_; }
+  uint64_t dropped_packets() const { return dropped_packets_; }
+
+ private:
+  void Process(dpdk::Packet *pkt) {
+    if (pkt->length() < sizeof(net::Ethernet)) [[unlikely]] {  // NOLINT
+      dropped_packets_++;
+      return;
+    }
+    const auto *eh = pkt->head_data<net::Ethernet *>();
+    const uint16_t eth_type = eh->eth_type.value();
+    if (eth_type == net::Ethernet::kArp &&
+        pkt->length() >= sizeof(net::Ethernet) + sizeof(net::Arp)) {
+      arp_packets_++;
+      shared_state_->ProcessArpPacket(
+          arp_table_reader_.get(), txring_,
+          pkt->head_data<net::Arp *>(sizeof(net::Ethernet)));
+      return;
+    }
+    if (eth_type == net::Ethernet::kIpv4 &&
+        pkt->length() >= sizeof(net::Ethernet) + sizeof(net::Ipv4) &&
+        pkt->head_data<net::Ipv4 *>(sizeof(net::Ethernet))->next_proto_id ==
+            net::Ipv4::kIcmp) {
+      icmp_packets_++;
+      // Echo requests may be of any size, up to the MTU.
+      auto *response = MachnetEngine::IcmpEchoReply(
+          pkt, txring_->GetPacketPool(), pmd_port_->GetL2Addr());
+      if (response != nullptr) txring_->BufferPacket(response);
+      return;
+    }
+    dropped_packets_++;
+    LOG_EVERY_N(INFO, kDropLogEvery)
+        << "Slow path of port " << pmd_port_->GetPortId()
+        << ": dropping a packet of EtherType 0x" << std::hex << eth_type
+        << std::dec << " (" << dropped_packets_ << " dropped).";
+  }
+
+  const std::shared_ptr<dpdk::PmdPort> pmd_port_;
+  const uint16_t queue_id_;
+  const std::shared_ptr<MachnetEngineSharedState> shared_state_;
+  const std::unique_ptr<MachnetEngineSharedState::ArpTableReader>
+      arp_table_reader_;
+  dpdk::RxRing *const rxring_;
+  dpdk::TxRing *const txring_;
+  std::vector<rte_flow *> rules_{};
+  uint64_t arp_packets_{0};
+  uint64_t icmp_packets_{0};
+  uint64_t dropped_packets_{0};
+  std::atomic<bool> running_{false};
+  std::thread thread_{};
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_SLOW_PATH_H_
@@ -6,15 +6,21 @@
 #include <stdio.h>
 #include <time.h>
 
+#include <atomic>
 #include <concepts>
 
 namespace juggler {
 namespace time {
 
-// TODO(ilias): Reconsider whether this should be global for all threads. Which
-// CPUs have non-synchronized TSC these days?
+// The TSC frequency, in each thread for cheap access. Invariant TSCs tick at
+// the same rate on all the cores: threads take it from `shared_tsc_hz' if
+// they can (see `calibrated_tsc_hz()').
 extern thread_local uint64_t tsc_hz;
 
+// The TSC frequency that the controller calibrates and publishes (see
+// `ClockPage'), or 0 if there is none in this process.
+extern std::atomic<uint64_t> shared_tsc_hz;
+
 static inline uint64_t rdtsc() {
   uint32_t hi, lo;
   __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
@@ -51,6 +57,13 @@ static inline uint64_t rdtsc() {
   return cycles * 1E9 / time_in_ns;
 }
 
+// The TSC frequency: the shared one (so that threads agree on it, and skip
+// the estimate), or an estimate of this thread's.
+[[maybe_unused]] static inline uint64_t calibrated_tsc_hz() {
+  const uint64_t hz = shared_tsc_hz.load(std::memory_order_relaxed);
+  return hz != 0 ? hz : estimate_tsc_hz();
+}
+
 template <typename T = uint64_t>
     requires std::integral<T> ||
     std::floating_point<T>[[maybe_unused]] static inline T cycles_to_ns(
@@ -81,6 +94,10 @@ template <typename T = double>
   return cycles_to_ns<T>(cycles) / 1E9;
 }
 
+[[maybe_unused]] static inline uint64_t ns_to_cycles(uint64_t ns) {
+  return ns * tsc_hz / 1E9;
+}
+
 [[maybe_unused]] static inline uint64_t us_to_cycles(uint64_t us) {
   return us * tsc_hz / 1E6;
 }
@@ -0,0 +1,141 @@
+/**
+ * @file tx_scheduler.h
+ * @brief Deficit round robin scheduling of transmissions across channels and
+ * flows.
+ */
+#ifndef SRC_INCLUDE_TX_SCHEDULER_H_
+#define SRC_INCLUDE_TX_SCHEDULER_H_
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+
+namespace juggler {
+
+/**
+ * @brief Per-item state of a `DrrScheduler'. Items (e.g., channels or flows)
+ * embed it, so that activating them never allocates or looks them up.
+ */
+struct TxSchedState {
+  // Whether the item is in the active list of the scheduler.
+  bool active{false};
+  // Whether the item has been granted its quantum for the current round.
+  bool granted{false};
+  // Remaining credit (in packets); negative when the item overdrew its
+  // credit in its last turn.
+  int64_t deficit{0};
+};
+
+/**
+ * @brief Class `DrrScheduler' implements deficit round robin over the items
+ * (of type `T') that have work pending. In each round, an item is granted a
+ * quantum of `quantum * weight' packets of credit, and is served until it runs
+ * out of credit or work; items with nothing to send are not visited at all.
+ *
+ * Items are served in batches, so they may overdraw their credit by up to one
+ * batch; the overdraft is paid back in the next round, which keeps the shares
+ * proportional to the weights in the long run.
+ *
+ * `T' must provide `TxSchedState &tx_sched_state()' and
+ * `uint32_t tx_weight() const'.
+ *
+ * @attention This class is not thread-safe.
+ */
+template <typename T>
+class DrrScheduler {
+ public:
+  /**
+   * @param quantum Credit (in packets) granted per round to an item of weight
+   *                1.
+   */
+  explicit DrrScheduler(uint32_t quantum) : quantum_(quantum) {
+    CHECK_GT(quantum_, 0);
+  }
+  DrrScheduler(const DrrScheduler &) = delete;
+  DrrScheduler &operator=(const DrrScheduler &) = delete;
+
+  /**
+   * @brief Mark an item as having work pending. No-op if already active.
+   */
+  void Activate(T *item) {
+    auto &state = item->tx_sched_state();
+    if (state.active) return;
+    state.active = true;
+    state.granted = false;
+    active_.push_back(item);
+  }
+
+  /**
+   * @brief Remove an item from the scheduler (e.g., before destroying it).
+   */
+  void Remove(T *item) {
+    auto &state = item->tx_sched_state();
+    if (state.active) std::erase(active_, item);
+    state = TxSchedState{};
+  }
+
+  // Number of active items.
+  size_t size() const { return active_.size(); }
+  bool empty() const { return active_.empty(); }
+
+  /**
+   * @brief Serve the active items in deficit round robin order, until
+   * `budget' packets have been sent or no item has work pending. Items that
+   * still have work pending when the budget runs out keep their place (and
+   * remaining credit) for the next call.
+   *
+   * @param budget Maximum number of packets to send.
+   * @param serve  Called as `serve(item, max_packets)'; sends up to (about)
+   *               `max_packets' packets of `item', and returns the number of
+   *               packets sent, and whether the item has more work pending.
+   * @return Number of packets sent.
+   */
+  template <typename F>
+  uint32_t Run(uint32_t budget, F &&serve) {
+    uint32_t sent = 0;
+    while (!active_.empty() && sent < budget) {
+      T *item = active_.front();
+      auto &state = item->tx_sched_state();
+      if (!state.granted) {
+        state.deficit +=
+            static_cast<int64_t>(quantum_) * std::max(item->tx_weight(), 1u);
+        state.granted = true;
+      }
+
+      if (state.deficit > 0) {
+        const auto max_packets = static_cast<uint32_t>(
+            std::min<int64_t>(state.deficit, budget - sent));
+        const auto [nsent, pending] = serve(item, max_packets);
+        sent += nsent;
+        state.deficit -= nsent;
+        if (!pending || nsent == 0) {
+          // Idle items leave the active list, and lose their credit.
+          active_.pop_front();
+          state = TxSchedState{};
+          continue;
+        }
+        if (state.deficit > 0) {
+          // Out of budget, with credit left: resume here on the next call.
+          if (sent >= budget) break;
+          continue;
+        }
+      }
+
+      // Out of credit: move to the back of the active list.
+      active_.pop_front();
+      active_.push_back(item);
+      state.granted = false;
+    }
+    return sent;
+  }
+
+ private:
+  const uint32_t quantum_;
+  std::deque<T *> active_;
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_TX_SCHEDULER_H_
@@ -10,17 +10,20 @@
 #include <sched.h>
 #include <sys/stat.h>
 
+#include <cctype>
 #include <chrono>
 #include <cstdarg>
 #include <cstring>
 #include <functional>
 #include <iomanip>
 #include <locale>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <type_traits>
 #include <vector>
 
+#include "kernels.h"
 #include "ttime.h"
 
 #define XXH_STATIC_LINKING_ONLY
@@ -30,11 +33,36 @@
 namespace juggler {
 namespace utils {
 
-// Placeholder in case we want to experiment with memory copy more.
+/**
+ * @brief Copy memory. Copies of up to 64 bytes (e.g., headers, descriptors and
+ * small messages) are inlined loads and stores, instead of a call to
+ * `std::memcpy()' and its size dispatch; larger ones, and copies of a size
+ * known at compile time, are left to `std::memcpy()'.
+ */
 [[maybe_unused]] static inline void Copy(void *__restrict__ dest,
                                          const void *__restrict__ src,
                                          std::size_t nbytes) {
-  std::memcpy(dest, src, nbytes);
+  if (__builtin_constant_p(nbytes) || nbytes > kernels::kSmallCopyMax) {
+    std::memcpy(dest, src, nbytes);
+    return;
+  }
+  kernels::CopySmall(dest, src, nbytes);
+}
+
+/**
+ * @brief Copy memory with non-temporal stores, that do not bring the
+ * destination into the caches of this core (e.g., payloads that the engine
+ * hands over to an application, and does not touch again). Small copies are
+ * regular copies.
+ */
+[[maybe_unused]] static inline void CopyNonTemporal(
+    void *__restrict__ dest, const void *__restrict__ src,
+    std::size_t nbytes) {
+  if (nbytes < kernels::kMinNonTemporalCopy) {
+    Copy(dest, src, nbytes);
+    return;
+  }
+  kernels::GetKernels().copy_nt(dest, src, nbytes);
 }
 
 [[maybe_unused]] static inline std::string HexDump(uint8_t *data, size_t len) {
@@ -143,7 +171,8 @@ namespace utils {
  * bits), the last remaining byte is padded with zeros on its least significant
  * byte and included in the checksum. The sum is then folded into 16 bits by
  * adding the high and low parts, and finally, the bitwise complement of the sum
- * is returned.
+ * is returned. Inputs of `kernels::kMinVectorChecksum' bytes or more are
+ * summed by the vector kernels of the CPU (see `kernels::GetKernels()').
  *
  * @param data Pointer to the input data. The input data is treated as a
  * sequence of 16-bit words.
@@ -158,22 +187,10 @@ namespace utils {
  */
 [[maybe_unused]] static inline uint16_t ComputeChecksum16(const uint8_t *data,
                                                           size_t length) {
-  uint32_t sum = 0;
-  const uint16_t *ptr = reinterpret_cast<const uint16_t *>(data);
-
-  for (; length > 1; length -= 2) {
-    sum += *ptr++;
-  }
-
-  if (length == 1) {
-    sum += static_cast<uint16_t>(*reinterpret_cast<const uint8_t *>(ptr) << 8);
+  if (length < kernels::kMinVectorChecksum) {
+    return kernels::FoldChecksum(kernels::SumTail(data, length));
   }
-
-  while (sum >> 16) {
-    sum = (sum & 0xFFFF) + (sum >> 16);
-  }
-
-  return static_cast<uint16_t>(~sum);
+  return kernels::GetKernels().checksum(data, length);
 }
 
 [[maybe_unused]] static inline void UUIDUnparse(const unsigned char uuid[16],
@@ -220,7 +237,9 @@ namespace utils {
 [[maybe_unused]] static inline constexpr size_t cpuset_to_sizet(
     cpu_set_t mask) {
   size_t ret = 0;
-  for (size_t i = 0; i < CPU_SETSIZE; ++i) {
+  const auto mask_bitsize =
+      std::min(sizeof(ret) * 8, static_cast<size_t>(CPU_SETSIZE));
+  for (size_t i = 0; i < mask_bitsize; ++i) {
     if (CPU_ISSET(i, &mask)) {
       ret |= (1ULL << i);
     }
@@ -240,6 +259,35 @@ namespace utils {
   return m;
 }
 
+/**
+ * @brief Parse a list of CPUs in the format of the kernel's `cpulist' files
+ * (see cpuset(7)), e.g., "0-3,8,10-11".
+ * @return The CPUs, in the order listed, or std::nullopt if the list is
+ * malformed or names a CPU past `CPU_SETSIZE'.
+ */
+[[maybe_unused]] static inline std::optional<std::vector<size_t>>
+ParseCpuList(const std::string &cpulist) {
+  std::vector<size_t> cpus;
+  for (const auto &range : SplitString(cpulist, ',')) {
+    const auto bounds = SplitString(range, '-');
+    if (bounds.empty() || bounds.size() > 2) return std::nullopt;
+    size_t first = 0, last = 0;
+    for (size_t i = 0; i < bounds.size(); i++) {
+      const auto &bound = bounds[i];
+      char *end = nullptr;
+      if (bound.empty() || !std::isdigit(bound.front())) return std::nullopt;
+      const size_t cpu = std::strtoull(bound.c_str(), &end, 10);
+      if (*end != '\0' && !std::isspace(*end)) return std::nullopt;
+      if (cpu >= CPU_SETSIZE) return std::nullopt;
+      (i == 0 ? first : last) = cpu;
+    }
+    if (bounds.size() == 1) last = first;
+    if (last < first) return std::nullopt;
+    for (size_t cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
 template <typename T>
 requires std::integral<T>
 static constexpr inline bool is_power_of_two(T x) {
@@ -16,6 +16,7 @@
 #include <functional>
 #include <memory>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
 namespace juggler {
@@ -148,8 +149,8 @@ class Worker {
     pthread_setaffinity_np(pthread_self(), sizeof(cpuset_p_), &cpuset_p_);
     // utils::SetHighPriorityAndSchedFifoForProcess();
 
-    // Estimate TSC frequency.
-    juggler::time::tsc_hz = juggler::time::estimate_tsc_hz();
+    // Take the TSC frequency of the controller's clock page, if any.
+    juggler::time::tsc_hz = juggler::time::calibrated_tsc_hz();
     LOG(INFO) << "Worker [" << static_cast<uint32_t>(id_)
               << "] (cpu_mask: " << std::hex
               << utils::cpuset_to_sizet(cpuset_p_) << std::dec
@@ -168,7 +169,12 @@ class Worker {
         if (shouldQuit()) break;
       }
 
-      engine_->Run(now_);
+      if constexpr (std::is_same_v<decltype(engine_->Run(now_)), bool>) {
+        // Engines report whether they found any work, and idle if not.
+        if (!engine_->Run(now_)) engine_->Idle();
+      } else {
+        engine_->Run(now_);
+      }
       cycles_++;
     } while (true);
 